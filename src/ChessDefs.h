@@ -6,6 +6,13 @@
  ****************************************************************************/
 #ifndef CHESSDEFS_H
 #define CHESSDEFS_H
+#include <stdint.h>
+
+// The std::string_view overloads of the parsing functions need C++17
+#if __cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+#include <string_view>
+#define THC_HAVE_STRING_VIEW
+#endif
 
 // Simple definition to aid platform portability (only remains of former Portability.h)
 int strcmp_ignore( const char *s, const char *t ); // return 0 if case-insensitive match
@@ -102,12 +109,35 @@ enum TERMINAL
     TERMINAL_BSTALEMATE = 2     // Black is stalemated
 };
 
+// A bitboard has one bit for each square, using the Square convention, so
+//  bit 0 is a8 and bit 63 is h1
+typedef uint64_t Bitboard;
+
+// Index into ChessPosition's array of piece bitboards
+enum BITBOARD_PIECE
+{
+    BB_WPAWN=0, BB_WKNIGHT, BB_WBISHOP, BB_WROOK, BB_WQUEEN, BB_WKING,
+    BB_BPAWN,   BB_BKNIGHT, BB_BBISHOP, BB_BROOK, BB_BQUEEN, BB_BKING,
+    BB_NBR      // also used by bb_index[] to indicate an empty square
+};
+
 // Calculate an upper limit to the length of a list of moves
 #define MAXMOVES (27 + 2*13 + 2*14 + 2*8 + 8 + 8*4  +  3*27)
                 //[Q   2*B    2*R    2*N   K   8*P] +  [3*Q]
                 //             ^                         ^
                 //[calculated practical maximum   ] + [margin]
 
+// Buffer size for a move in natural notation, the longest being eg "Nb1xd2+"
+//  or "exd8=Q+", plus the terminating '\0'
+#define NATURAL_MOVE_SIZE 8
+
+// Buffer size for a move in terse notation, eg "e7e8q", plus the '\0'
+#define TERSE_MOVE_SIZE 6
+
+// Buffer size for a position in Forsyth (FEN) notation, enough for the
+//  longest possible (with the biggest possible counts) plus the '\0'
+#define FORSYTH_SIZE 128
+
 // We have developed an algorithm to compress any legal chess position,
 //  including who to move, castling allowed flags and enpassant_target
 //  into 24 bytes
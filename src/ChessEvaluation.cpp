@@ -642,6 +642,159 @@ int ChessEvaluation::EnpriseBlack()
 
 
 
+/****************************************************************************
+ * Static exchange evaluation
+ ****************************************************************************/
+
+// Material value of each kind of man, indexed by BB_WPAWN .. BB_WKING (and
+//  the same values as either_colour_material[])
+static const int see_value[6] = { 10, 30, 31, 50, 90, 500 };
+
+// Value of the man arriving on the destination square, and the material
+//  gained by the move itself (capture plus any promotion)
+static void see_move_values( Move move, const char *squares, int &arriving, int &gain )
+{
+    arriving = either_colour_material[ (unsigned char)squares[move.src] ];
+    gain     = either_colour_material[ (unsigned char)move.capture ];
+    int promotion = 0;
+    switch( move.special )
+    {
+        case SPECIAL_PROMOTION_QUEEN:   promotion = see_value[BB_WQUEEN];   break;
+        case SPECIAL_PROMOTION_ROOK:    promotion = see_value[BB_WROOK];    break;
+        case SPECIAL_PROMOTION_BISHOP:  promotion = see_value[BB_WBISHOP];  break;
+        case SPECIAL_PROMOTION_KNIGHT:  promotion = see_value[BB_WKNIGHT];  break;
+        default:                                                            break;
+    }
+    if( promotion )
+    {
+        gain    += promotion - arriving;
+        arriving = promotion;
+    }
+}
+
+// Occupied squares once the move's man and anything it captures are gone
+static Bitboard see_occupied( Move move, Bitboard occupied )
+{
+    occupied &= ~BB(move.src);
+    if( move.special == SPECIAL_WEN_PASSANT )
+        occupied &= ~BB(SOUTH(move.dst));
+    else if( move.special == SPECIAL_BEN_PASSANT )
+        occupied &= ~BB(NORTH(move.dst));
+    return occupied;
+}
+
+// Remove the least valuable of a side's attackers from occupied, returning
+//  its kind (BB_WPAWN .. BB_WKING), and add any slider x-rayed through it
+int ChessEvaluation::SeeLeastValuable( Square square, Bitboard side_attackers, Bitboard &occupied, Bitboard &attackers )
+{
+    bool white = (side_attackers & bb_white) != 0;
+    const Bitboard *side = &bb_pieces[ white ? BB_WPAWN : BB_BPAWN ];
+    for( int kind=BB_WPAWN; kind<=BB_WKING; kind++ )
+    {
+        Bitboard bb = side_attackers & side[kind];
+        if( bb )
+        {
+            occupied &= ~(bb & (0-bb));
+            if( kind==BB_WPAWN || kind==BB_WBISHOP || kind==BB_WQUEEN )
+                attackers |= bishop_attacks_bb(square,occupied) &
+                    (bb_pieces[BB_WBISHOP]|bb_pieces[BB_WQUEEN]|bb_pieces[BB_BBISHOP]|bb_pieces[BB_BQUEEN]);
+            if( kind==BB_WROOK || kind==BB_WQUEEN )
+                attackers |= rook_attacks_bb(square,occupied) &
+                    (bb_pieces[BB_WROOK]|bb_pieces[BB_WQUEEN]|bb_pieces[BB_BROOK]|bb_pieces[BB_BQUEEN]);
+            attackers &= occupied;
+            return kind;
+        }
+    }
+    return BB_WKING;
+}
+
+/****************************************************************************
+ * Static exchange evaluation, the material won (negative if lost) by the
+ *  moving side if both sides keep capturing on the destination square with
+ *  their least valuable man, either side stopping when it suits them. Pins
+ *  are ignored, x-rays (eg a rook behind a queen) are not
+ ****************************************************************************/
+int ChessEvaluation::SEE( Move move )
+{
+    if( move.special>=SPECIAL_WK_CASTLING && move.special<=SPECIAL_BQ_CASTLING )
+        return 0;
+    int gain[40];
+    int arriving;
+    see_move_values( move, squares, arriving, gain[0] );
+    Square square = move.dst;
+    Bitboard occupied = see_occupied( move, bb_occupied() );
+    Bitboard attackers = (AttackersTo(square,true,occupied) | AttackersTo(square,false,occupied)) & occupied;
+    bool white = !IsWhite(squares[move.src]);
+    int depth = 0;
+    for(;;)
+    {
+        Bitboard side_attackers = attackers & (white ? bb_white : bb_black);
+        if( !side_attackers )
+            break;
+
+        // A king can only capture if there is nothing left to recapture
+        bool king = ((side_attackers & bb_pieces[white?BB_WKING:BB_BKING]) == side_attackers);
+        if( king && (attackers & ~side_attackers) )
+            break;
+        depth++;
+        gain[depth] = arriving - gain[depth-1];
+        arriving = see_value[ SeeLeastValuable( square, side_attackers, occupied, attackers ) ];
+        white = !white;
+        if( depth+1 >= (int)nbrof(gain) )
+            break;
+    }
+
+    // Each side chooses between stopping and continuing the exchange
+    while( depth > 0 )
+    {
+        if( -gain[depth] < gain[depth-1] )
+            gain[depth-1] = -gain[depth];
+        depth--;
+    }
+    return gain[0];
+}
+
+/****************************************************************************
+ * Fast test of whether SEE(move) >= threshold, gives up on the exchange as
+ *  soon as the outcome relative to the threshold is known
+ ****************************************************************************/
+bool ChessEvaluation::SEEGreaterEqual( Move move, int threshold )
+{
+    if( move.special>=SPECIAL_WK_CASTLING && move.special<=SPECIAL_BQ_CASTLING )
+        return 0 >= threshold;
+    int arriving, gain;
+    see_move_values( move, squares, arriving, gain );
+
+    // If we don't reach the threshold even if the man is captured for free
+    //  we fail, if we reach it even when our man is lost we succeed
+    int swap = gain - threshold;
+    if( swap < 0 )
+        return false;
+    swap = arriving - swap;
+    if( swap <= 0 )
+        return true;
+    Square square = move.dst;
+    Bitboard occupied = see_occupied( move, bb_occupied() );
+    Bitboard attackers = (AttackersTo(square,true,occupied) | AttackersTo(square,false,occupied)) & occupied;
+    bool white = IsWhite(squares[move.src]);
+    int result = 1;
+    for(;;)
+    {
+        white = !white;
+        Bitboard side_attackers = attackers & (white ? bb_white : bb_black);
+        if( !side_attackers )
+            break;
+        result ^= 1;
+        int kind = SeeLeastValuable( square, side_attackers, occupied, attackers );
+        if( kind == BB_WKING )
+            return (attackers & ~(white ? bb_white : bb_black)) ? !result : result!=0;
+        swap = see_value[kind] - swap;
+        if( swap < result )
+            break;
+    }
+    return result != 0;
+}
+
 //=========== EVALUATION ===============================================
 
 static int king_ending_bonus_static[] =
@@ -670,57 +823,14 @@ static int king_ending_bonus_static[] =
 static int king_ending_bonus_dynamic_white[0x80];
 static int king_ending_bonus_dynamic_black[0x80];
 
-// Lookup table for quick calculation of material value of white piece
-static int white_material[]=
-{
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x00-0x0f
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x10-0x1f
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x20-0x2f
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x30-0x3f
-    0,  0, 31,  0,  0,  0,  0,  0,  0,  0,  0,500,  0,  0, 30,  0,   // 0x40-0x4f    'B'=0x42, 'K'=0x4b, 'N'=0x4e
-   10, 90, 50,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x50-0x5f    'P'=0x50, 'Q'=0x51, 'R'=0x52
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x60-0x6f    'b'=0x62, 'k'=0x6b, 'n'=0x6e
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0    // 0x70-0x7f    'p'=0x70, 'q'=0x71, 'r'=0x72
-};
-
-// Lookup table for quick calculation of material value of black piece
-static int black_material[]=
-{
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x00-0x0f
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x10-0x1f
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x20-0x2f
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x30-0x3f
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x40-0x4f    'B'=0x42, 'K'=0x4b, 'N'=0x4e
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x50-0x5f    'P'=0x50, 'Q'=0x51, 'R'=0x52
-    0,  0,-31,  0,  0,  0,  0,  0,  0,  0,  0,-500, 0,  0,-30,  0,   // 0x60-0x6f    'b'=0x62, 'k'=0x6b, 'n'=0x6e
-  -10,-90,-50,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0    // 0x70-0x7f    'p'=0x70, 'q'=0x71, 'r'=0x72
-};
-
-// Lookup table for quick calculation of material value of white piece (not pawn or king)
-static int white_pieces[]=
-{
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x00-0x0f
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x10-0x1f
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x20-0x2f
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x30-0x3f
-    0,  0, 31,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, 30,  0,   // 0x40-0x4f    'B'=0x42, 'K'=0x4b, 'N'=0x4e
-    0, 90, 50,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x50-0x5f    'P'=0x50, 'Q'=0x51, 'R'=0x52
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x60-0x6f    'b'=0x62, 'k'=0x6b, 'n'=0x6e
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0    // 0x70-0x7f    'p'=0x70, 'q'=0x71, 'r'=0x72
-};
-
-// Lookup table for quick calculation of material value of black piece (not pawn or king)
-static int black_pieces[]=
+// Calculate material for one side from the piece bitboards, bb points at
+//  the six bitboards for that side, pieces excludes pawns and king
+static inline void bb_material( const Bitboard *bb, int &material, int &pieces )
 {
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x00-0x0f
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x10-0x1f
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x20-0x2f
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x30-0x3f
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x40-0x4f    'B'=0x42, 'K'=0x4b, 'N'=0x4e
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x50-0x5f    'P'=0x50, 'Q'=0x51, 'R'=0x52
-    0,  0, 31,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, 30,  0,   // 0x60-0x6f    'b'=0x62, 'k'=0x6b, 'n'=0x6e
-    0, 90, 50,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0    // 0x70-0x7f    'p'=0x70, 'q'=0x71, 'r'=0x72
-};
+    pieces   = 30*bb_popcount(bb[BB_WKNIGHT]) + 31*bb_popcount(bb[BB_WBISHOP]) +
+               50*bb_popcount(bb[BB_WROOK])   + 90*bb_popcount(bb[BB_WQUEEN]);
+    material = pieces + 10*bb_popcount(bb[BB_WPAWN]) + 500*bb_popcount(bb[BB_WKING]);
+}
 
 /****************************************************************************
  * Do some planning before making a move
@@ -729,7 +839,6 @@ static int black_pieces[]=
 void ChessEvaluation::Planning()
 {
     Square weaker_king, bonus_square;
-    char piece;
     int score_black_material = 0;
     int score_white_material = 0;
     const int MATERIAL_ENDING  = (500 + ((8*10+4*30+2*50+90)*1)/3);
@@ -738,14 +847,9 @@ void ChessEvaluation::Planning()
     // Get material for both sides
     int score_black_pieces = 0;
     int score_white_pieces = 0;
-    for( Square square=a8; square<=h1; ++square )
-    {
-        piece = squares[square];
-        score_black_material += black_material[ piece ];
-        score_white_material += white_material[ piece ];
-        score_black_pieces   += black_pieces[ piece ];
-        score_white_pieces   += white_pieces[ piece ];
-    }
+    bb_material( &bb_pieces[BB_WPAWN], score_white_material, score_white_pieces );
+    bb_material( &bb_pieces[BB_BPAWN], score_black_material, score_black_pieces );
+    score_black_material = 0-score_black_material;
     int score_white_pawns = score_white_material - 500 // -500 is king
                           - score_white_pieces;
     planning_score_white_pieces = score_white_pieces;
@@ -947,14 +1051,18 @@ const int MATERIAL_MIDDLE  = (500 + ((8*10+4*30+2*50+90)*1)/3);
     int score_black_pieces = 0;
     int score_white_pieces = 0;
 
+    // Material directly from piece counts, the rank by rank scans below
+    //  then only need to visit occupied squares
+    bb_material( &bb_pieces[BB_WPAWN], score_white_material, score_white_pieces );
+    bb_material( &bb_pieces[BB_BPAWN], score_black_material, score_black_pieces );
+    score_black_material = 0-score_black_material;
+    Bitboard occupied = bb_occupied();
+
     // a8->h8
-    for( Square square=a8; square<=h8; ++square )
+    for( Bitboard bb=occupied&BB_RANK('8'); bb; )
     {
+        Square square = bb_pop_lsb(bb);
         piece = squares[square];
-        score_black_material += black_material[ piece ];
-        score_white_material += white_material[ piece ];
-        score_black_pieces   += black_pieces[ piece ];
-        score_white_pieces   += white_pieces[ piece ];
         switch( piece )
         {
             case 'K':
@@ -1027,14 +1135,12 @@ const int MATERIAL_MIDDLE  = (500 + ((8*10+4*30+2*50+90)*1)/3);
     // a7->h7
     unsigned int next_passer_mask = 0;
     unsigned int passer_mask = 0;
-    unsigned int three_files = 0x1c0;   // 1 1100 0000
-    for( Square square=a7; square<=h7; ++square )
+    unsigned int three_files;           // eg 1 1100 0000 for a-file (3 files centred on square)
+    for( Bitboard bb=occupied&BB_RANK('7'); bb; )
     {
+        Square square = bb_pop_lsb(bb);
         piece = squares[square];
-        score_black_material += black_material[ piece ];
-        score_white_material += white_material[ piece ];
-        score_black_pieces   += black_pieces[ piece ];
-        score_white_pieces   += white_pieces[ piece ];
+        three_files = 0x1c0 >> IFILE(square);
         switch( piece )
         {
             case 'K':
@@ -1112,19 +1218,16 @@ const int MATERIAL_MIDDLE  = (500 + ((8*10+4*30+2*50+90)*1)/3);
                 break;
             }
         }
-        three_files >>= 1;
     }
 
     // a6->h6
-    unsigned int file_mask = 0x80;  // 0 1000 0000
-    three_files = 0x1c0;            // 1 1100 0000
-    for( Square square=a6; square<=h6; ++square )
+    unsigned int file_mask;             // eg 0 1000 0000 for a-file
+    for( Bitboard bb=occupied&BB_RANK('6'); bb; )
     {
+        Square square = bb_pop_lsb(bb);
         piece = squares[square];
-        score_black_material += black_material[ piece ];
-        score_white_material += white_material[ piece ];
-        score_black_pieces   += black_pieces[ piece ];
-        score_white_pieces   += white_pieces[ piece ];
+        three_files = 0x1c0 >> IFILE(square);
+        file_mask   = 0x80  >> IFILE(square);
         switch( piece )
         {
             case 'k':
@@ -1198,21 +1301,15 @@ const int MATERIAL_MIDDLE  = (500 + ((8*10+4*30+2*50+90)*1)/3);
                 break;
             }
         }
-        file_mask   >>= 1;
-        three_files >>= 1;
     }
     passer_mask |= next_passer_mask;
 
     // a5->h5;
-    file_mask   = 0x80;             // 0 1000 0000
-//  three_files = 0x1c0;            // 1 1100 0000
-    for( Square square=a5; square<=h5; ++square )
+    for( Bitboard bb=occupied&BB_RANK('5'); bb; )
     {
+        Square square = bb_pop_lsb(bb);
         piece = squares[square];
-        score_black_material += black_material[ piece ];
-        score_white_material += white_material[ piece ];
-        score_black_pieces   += black_pieces[ piece ];
-        score_white_pieces   += white_pieces[ piece ];
+        file_mask   = 0x80  >> IFILE(square);
         switch( piece )
         {
             case 'k':
@@ -1291,21 +1388,16 @@ const int MATERIAL_MIDDLE  = (500 + ((8*10+4*30+2*50+90)*1)/3);
                 break;
             }
         }
-        file_mask   >>= 1;
-        // three_files >>= 1;
     }
 
     // a2->h2
     next_passer_mask = 0;
     passer_mask = 0;
-    three_files = 0x1c0;   // 1 1100 0000
-    for( Square square=a2; square<=h2; ++square )
+    for( Bitboard bb=occupied&BB_RANK('2'); bb; )
     {
+        Square square = bb_pop_lsb(bb);
         piece = squares[square];
-        score_black_material += black_material[ piece ];
-        score_white_material += white_material[ piece ];
-        score_black_pieces   += black_pieces[ piece ];
-        score_white_pieces   += white_pieces[ piece ];
+        three_files = 0x1c0 >> IFILE(square);
         switch( piece )
         {
             case 'k':
@@ -1383,19 +1475,15 @@ const int MATERIAL_MIDDLE  = (500 + ((8*10+4*30+2*50+90)*1)/3);
                 break;
             }
         }
-        three_files >>= 1;
     }
 
     // a3->h3
-    file_mask = 0x80;       // 0 1000 0000
-    three_files = 0x1c0;    // 1 1100 0000
-    for( Square square=a3; square<=h3; ++square )
+    for( Bitboard bb=occupied&BB_RANK('3'); bb; )
     {
+        Square square = bb_pop_lsb(bb);
         piece = squares[square];
-        score_black_material += black_material[ piece ];
-        score_white_material += white_material[ piece ];
-        score_black_pieces   += black_pieces[ piece ];
-        score_white_pieces   += white_pieces[ piece ];
+        three_files = 0x1c0 >> IFILE(square);
+        file_mask   = 0x80  >> IFILE(square);
         switch( piece )
         {
             case 'k':
@@ -1469,21 +1557,15 @@ const int MATERIAL_MIDDLE  = (500 + ((8*10+4*30+2*50+90)*1)/3);
                 break;
             }
         }
-        file_mask   >>= 1;
-        three_files >>= 1;
     }
     passer_mask |= next_passer_mask;
 
     // a4->h4
-    file_mask   = 0x80;             // 0 1000 0000
-//  three_files = 0x1c0;            // 1 1100 0000
-    for( Square square=a4; square<=h4; ++square )
+    for( Bitboard bb=occupied&BB_RANK('4'); bb; )
     {
+        Square square = bb_pop_lsb(bb);
         piece = squares[square];
-        score_black_material += black_material[ piece ];
-        score_white_material += white_material[ piece ];
-        score_black_pieces   += black_pieces[ piece ];
-        score_white_pieces   += white_pieces[ piece ];
+        file_mask   = 0x80  >> IFILE(square);
         switch( piece )
         {
             case 'k':
@@ -1562,18 +1644,13 @@ const int MATERIAL_MIDDLE  = (500 + ((8*10+4*30+2*50+90)*1)/3);
                 break;
             }
         }
-        file_mask   >>= 1;
-        // three_files >>= 1;
     }
 
     // a1->h1
-    for( Square square=a1; square<=h1; ++square )
+    for( Bitboard bb=occupied&BB_RANK('1'); bb; )
     {
+        Square square = bb_pop_lsb(bb);
         piece = squares[square];
-        score_black_material += black_material[ piece ];
-        score_white_material += white_material[ piece ];
-        score_black_pieces   += black_pieces[ piece ];
-        score_white_pieces   += white_pieces[ piece ];
         switch( piece )
         {
             case 'k':
@@ -1979,13 +2056,141 @@ const int MATERIAL_MIDDLE  = (500 + ((8*10+4*30+2*50+90)*1)/3);
 }
 
 
+// Quiescence search. A pawn is 40 in EvaluateLeaf() units, captures that
+//  can't raise alpha by DELTA_MARGIN more than the man captured are pruned
+#define QUIESCE_PAWN            40
+#define QUIESCE_DELTA_MARGIN    80
+
+// Value of captured and capturing men for quiescence move ordering
+static int quiesce_value( char piece )
+{
+    switch( piece )
+    {
+        case 'P': case 'p': return 1;
+        case 'N': case 'n': return 3;
+        case 'B': case 'b': return 3;
+        case 'R': case 'r': return 5;
+        case 'Q': case 'q': return 9;
+        case 'K': case 'k': return 10;
+    }
+    return 0;
+}
+
+// Select the best scoring move at or after idx, and swap it into position
+//  idx (incremental selection sort, cutoffs mean we rarely need them all)
+static void quiesce_pick( MOVELIST &list, int scores[], int idx, bool reverse_ties )
+{
+    int best = idx;
+    for( int i=idx+1; i<list.count; i++ )
+    {
+        if( scores[i]>scores[best] || (reverse_ties && scores[i]==scores[best]) )
+            best = i;
+    }
+    if( best != idx )
+    {
+        Move tmp_move = list.moves[idx];
+        list.moves[idx] = list.moves[best];
+        list.moves[best] = tmp_move;
+        int tmp_score = scores[idx];
+        scores[idx] = scores[best];
+        scores[best] = tmp_score;
+    }
+}
+
+/****************************************************************************
+ * Quiescence search, only captures and queen promotions (or all moves if in
+ *  check) until the position is quiet enough for EvaluateLeaf() to be
+ *  trusted. Captures that can't raise alpha even if they win their man free
+ *  of charge (delta pruning) or that lose material (SEE) are skipped
+ ****************************************************************************/
+int ChessEvaluation::Quiesce( int alpha, int beta, int ply, QuiesceVisitor *visitor )
+{
+    if( visitor && visitor->Node(ply) )
+        return 0;
+
+    // In check, all evasions, no standing pat
+    MOVELIST list;
+    int best_score = -QUIESCE_INFINITY;
+    int stand_pat  = -QUIESCE_INFINITY;
+    bool in_check  = AttackedPiece( white ? wking_square : bking_square );
+    if( in_check && ply<QUIESCE_MAX_PLY-1 )
+    {
+        GenLegalMoveList( &list );
+        if( list.count == 0 )
+            return -QUIESCE_MATE+ply;
+    }
+
+    // Otherwise the side to move can stand pat, or try captures
+    else
+    {
+        int material, positional;
+        EvaluateLeaf( material, positional );
+        stand_pat = material*4 /*balance=4*/ + positional;
+        if( !white )
+            stand_pat = -stand_pat;
+        if( stand_pat>=beta || ply>=QUIESCE_MAX_PLY-1 )
+            return stand_pat;
+        if( stand_pat > alpha )
+            alpha = stand_pat;
+        best_score = stand_pat;
+        GenCaptureList( &list );
+    }
+    int scores[MAXMOVES];
+    for( int i=0; i<list.count; i++ )
+    {
+        Move mv = list.moves[i];
+        scores[i] = quiesce_value(mv.capture)*16 - quiesce_value(squares[mv.src]);
+        if( mv.special == SPECIAL_PROMOTION_QUEEN )
+            scores[i] += 9*16;
+    }
+    bool reverse_ties = (visitor && visitor->ReverseTies());
+    for( int i=0; i<list.count; i++ )
+    {
+        quiesce_pick( list, scores, i, reverse_ties );
+        Move mv = list.moves[i];
+        if( !in_check )
+        {
+            int gain = quiesce_value(mv.capture) + (mv.special==SPECIAL_PROMOTION_QUEEN ? 8 : 0);
+            if( stand_pat + gain*QUIESCE_PAWN + QUIESCE_DELTA_MARGIN <= alpha )
+                continue;
+            if( !SEEGreaterEqual(mv,0) )
+                continue;
+        }
+        PushMove( mv );
+
+        // Captures are generated without regard to check
+        if( !in_check && AttackedPiece( white ? bking_square : wking_square ) )
+        {
+            PopMove( mv );
+            continue;
+        }
+        int score = -Quiesce( -beta, -alpha, ply+1, visitor );
+        PopMove( mv );
+        if( visitor && visitor->Stopping() )
+            return 0;
+        if( score > best_score )
+        {
+            best_score = score;
+            if( score > alpha )
+            {
+                alpha = score;
+                if( visitor )
+                    visitor->BestMove( ply, mv );
+                if( alpha >= beta )
+                    break;
+            }
+        }
+    }
+    return best_score;
+}
+
 /****************************************************************************
  * Create a list of all legal moves (sorted strongest first, public version)
  ****************************************************************************/
-void ChessEvaluation::GenLegalMoveListSorted( vector<Move> &moves )
+void ChessEvaluation::GenLegalMoveListSorted( vector<Move> &moves, bool quiesce )
 {
     MOVELIST movelist;
-    GenLegalMoveListSorted( &movelist );
+    GenLegalMoveListSorted( &movelist, quiesce );
     for( int i=0; i<movelist.count; i++ )
         moves.push_back( movelist.moves[i] );
 }
@@ -2002,7 +2207,7 @@ struct MOVE_IDX
     bool operator >  (const MOVE_IDX& arg) const { return score >  arg.score; }
     bool operator == (const MOVE_IDX& arg) const { return score == arg.score; }
 };
-void ChessEvaluation::GenLegalMoveListSorted( MOVELIST *list )
+void ChessEvaluation::GenLegalMoveListSorted( MOVELIST *list, bool quiesce )
 {
     int i, j;
     bool okay;
@@ -2031,6 +2236,12 @@ void ChessEvaluation::GenLegalMoveListSorted( MOVELIST *list )
             else if( terminal_score==TERMINAL_WSTALEMATE ||
                      terminal_score==TERMINAL_BSTALEMATE )
                 score = 0;
+            else if( quiesce )
+            {
+                score = Quiesce( -QUIESCE_INFINITY, QUIESCE_INFINITY, 0 );
+                if( !white )    // score is from side to move's point of view
+                    score = -score;
+            }
             else
             {
                 int material, positional;
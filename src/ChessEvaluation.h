@@ -13,6 +13,29 @@
 namespace thc
 {
 
+// Lets a search follow ChessEvaluation::Quiesce(), count nodes, stop it
+//  early and collect the principal variation. The defaults do nothing
+class QuiesceVisitor
+{
+public:
+    virtual ~QuiesceVisitor() {}
+
+    // A node is searched at ply
+    //  return bool stop (then Quiesce() gives up, and returns 0)
+    virtual bool Node( int /*ply*/ ) { return false; }
+
+    // Is the search stopping ? (asked after each move is searched)
+    virtual bool Stopping() { return false; }
+
+    // mv raised alpha at ply, the variation after it is the one found at
+    //  ply+1
+    virtual void BestMove( int /*ply*/, Move /*mv*/ ) {}
+
+    // Break ties in move ordering the other way ? (so searches that share
+    //  a hash table don't all do the same thing)
+    virtual bool ReverseTies() { return false; }
+};
+
 class ChessEvaluation: public ChessRules
 {
 public:
@@ -34,15 +57,27 @@ public:
     }
 
 
-    // Use leaf evaluator to generate a sorted move list
-    void GenLegalMoveListSorted( MOVELIST *list );
-    void GenLegalMoveListSorted( std::vector<Move> &moves );
+    // Use leaf evaluator to generate a sorted move list. By default each
+    //  move is scored by the leaf evaluator straight after it's played, so
+    //  a capture of a defended man looks good. With quiesce, captures are
+    //  resolved first (with Quiesce(), the quiescence search Search uses),
+    //  slower but a much better order
+    void GenLegalMoveListSorted( MOVELIST *list, bool quiesce=false );
+    void GenLegalMoveListSorted( std::vector<Move> &moves, bool quiesce=false );
 
     // Evaluate a position, leaf node (useful for playing programs)
     void EvaluateLeaf( int &material, int &positional );
 
+    // Static exchange evaluation, material won by a move (pawn=10) if both
+    //  sides keep capturing on its destination square
+    int SEE( Move move );
+
+    // Fast test that SEE(move) >= threshold
+    bool SEEGreaterEqual( Move move, int threshold );
+
 // internal stuff
 protected:
+    friend class Search;
 
     // Always some planning before calculating a move
     void Planning();
@@ -52,6 +87,15 @@ protected:
     int EnpriseWhite();   // fast white to move version
     int EnpriseBlack();   // fast black to move version
 
+    // Static exchange helper, capture with least valuable attacker
+    int SeeLeastValuable( Square square, Bitboard side_attackers, Bitboard &occupied, Bitboard &attackers );
+
+    // Quiescence search, for GenLegalMoveListSorted() and Search. Score is
+    //  from the side to move's point of view in EvaluateLeaf() units
+    //  (material*4 + positional), or QUIESCE_MATE less the plies to mate
+    enum { QUIESCE_INFINITY=32000, QUIESCE_MATE=31000, QUIESCE_MAX_PLY=128 };
+    int Quiesce( int alpha, int beta, int ply, QuiesceVisitor *visitor=NULL );
+
 // misc
 private:
     bool white_is_better;
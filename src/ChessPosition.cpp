@@ -111,6 +111,49 @@ std::string ChessPosition::ToDebugStr( const char *label )
     return s;
 }
 
+/****************************************************************************
+ * For debug, into a buffer
+ *   return length
+ ****************************************************************************/
+int ChessPosition::ToDebugStr( char *buf, size_t buf_size, const char *label )
+{
+    if( buf_size == 0 )
+        return 0;
+    size_t len=0;
+    const char *p = squares;
+    const char *s = (white ? "\nWhite to move\n" : "\nBlack to move\n");
+    while( label && *label && len+1<buf_size )
+        buf[len++] = *label++;
+    while( *s && len+1<buf_size )
+        buf[len++] = *s++;
+    for( int row=0; row<8; row++ )
+    {
+        for( int col=0; col<9 && len+1<buf_size; col++ )
+        {
+            char c = (col==8 ? '\n' : *p++);
+            if( c==' ' )
+                c = '.';
+            buf[len++] = c;
+        }
+    }
+    buf[len] = '\0';
+    return (int)len;
+}
+
+/****************************************************************************
+ * Set up position on board from Forsyth string of given length
+ *   return bool okay
+ ****************************************************************************/
+bool ChessPosition::Forsyth( const char *txt, size_t len )
+{
+    char buf[FORSYTH_SIZE*2];
+    if( len >= sizeof(buf) )
+        return false;
+    memcpy( buf, txt, len );
+    buf[len] = '\0';
+    return Forsyth( buf );
+}
+
 /****************************************************************************
  * Set up position on board from Forsyth string with extensions
  *   return bool okay
@@ -377,6 +420,7 @@ bool ChessPosition::Forsyth( const char *txt )
                 full_move_count = temp;
         }
     }
+    BitboardsCalculate();
     return( okay );
 }
 
@@ -385,11 +429,23 @@ bool ChessPosition::Forsyth( const char *txt )
  * Publish chess position and supplementary info in forsyth notation
  ****************************************************************************/
 std::string ChessPosition::ForsythPublish()
+{
+    char buf[FORSYTH_SIZE];
+    ForsythPublish( buf );
+    return buf;
+}
+
+/****************************************************************************
+ * Publish chess position and supplementary info in forsyth notation, into
+ *  a buffer
+ *   return length
+ ****************************************************************************/
+int ChessPosition::ForsythPublish( char forsyth_out[FORSYTH_SIZE] )
 {
     int i, empty=0, file=0, rank=7, save_file=0, save_rank=0;
     Square sq;
     char p;
-    std::string str;
+    char *str = forsyth_out;
 
     // Squares
     for( i=0; i<64; i++ )
@@ -407,22 +463,18 @@ std::string ChessPosition::ForsythPublish()
         {
             if( empty )
             {
-                char count = '0' + (char)empty;
-                str += count;
+                *str++ = '0' + (char)empty;
                 empty = 0;
             }
-            str += p;
+            *str++ = p;
         }
         file++;
         if( file == 8 )
         {
             if( empty )
-            {
-                char count = '0'+(char)empty;
-                str += count;
-            }
+                *str++ = '0' + (char)empty;
             if( rank )
-                str += '/';
+                *str++ = '/';
             empty = 0;
             file = 0;
             rank--;
@@ -430,76 +482,104 @@ std::string ChessPosition::ForsythPublish()
     }
 
     // Who to move
-    str += ' ';
-    str += (white?'w':'b');
+    *str++ = ' ';
+    *str++ = (white?'w':'b');
 
     // Castling flags
-    str += ' ';
+    *str++ = ' ';
     if( !wking_allowed() && !wqueen_allowed() && !bking_allowed() && !bqueen_allowed() )
-        str += '-';
+        *str++ = '-';
     else
     {
         if( wking_allowed() )
-            str += 'K';
+            *str++ = 'K';
         if( wqueen_allowed() )
-            str += 'Q';
+            *str++ = 'Q';
         if( bking_allowed() )
-            str += 'k';
+            *str++ = 'k';
         if( bqueen_allowed() )
-            str += 'q';
+            *str++ = 'q';
     }
 
     // Enpassant target square
-    str += ' ';
+    *str++ = ' ';
     if( enpassant_target==SQUARE_INVALID || save_rank==0 )
-        str += '-';
+        *str++ = '-';
     else
     {
-        char file2 = 'a'+(char)save_file;
-        str += file2;
-        char rank2 = '1'+(char)save_rank;
-        str += rank2;
+        *str++ = 'a'+(char)save_file;
+        *str++ = '1'+(char)save_rank;
     }
 
     // Counts
-    char buf[40];
-    sprintf( buf, " %d %d", half_move_clock, full_move_count );
-    str += buf;
-    return( str );
+    str += sprintf( str, " %d %d", half_move_clock, full_move_count );
+    return (int)(str-forsyth_out);
 }
 
 
+// Encode empty square with 2 bits, and other 12 possibilities with
+//  all the other possible nibbles that don't start with those 2 bits
+#define CEMPTY      2   // 10
+#define CWROOK      0   // 0000
+#define CWKNIGHT    1   // 0001
+#define CWBISHOP    2   // 0010
+#define CWQUEEN     3   // 0011
+#define CWKING      4   // 0100
+#define CWPAWN      5   // 0101
+#define CBROOK      6   // 0110
+#define CBKNIGHT    7   // 0111
+#define CBBISHOP   12   // 1100
+#define CBQUEEN    13   // 1101
+#define CBKING     14   // 1110
+#define CBPAWN     15   // 1111
+
+// The code for each piece, and its number of bits (2 for an empty square,
+//  or anything else, 4 for a piece), lookups rather than a switch so
+//  Compress() is fast
+struct COMPRESS_CODES
+{
+    unsigned char code[256];
+    unsigned char nbr_bits[256];
+    COMPRESS_CODES()
+    {
+        memset( code, CEMPTY, sizeof(code) );
+        memset( nbr_bits, 2, sizeof(nbr_bits) );
+        const char *pieces = "RNBQKPrnbqkp";
+        const unsigned char codes[] = { CWROOK, CWKNIGHT, CWBISHOP, CWQUEEN, CWKING, CWPAWN,
+                                        CBROOK, CBKNIGHT, CBBISHOP, CBQUEEN, CBKING, CBPAWN };
+        for( int i=0; pieces[i]; i++ )
+        {
+            code[ (unsigned char)pieces[i] ] = codes[i];
+            nbr_bits[ (unsigned char)pieces[i] ] = 4;
+        }
+    }
+};
+
 /****************************************************************************
  * Compress chess position
  ****************************************************************************/
 unsigned short ChessPosition::Compress( CompressedPosition &dst ) const
 {
-    ChessPosition src = *this;
+    // Work on a copy of the board
+    char src[64];
+    memcpy( src, squares, sizeof(src) );
     int i;
 
-    // Optimisation: Clear the last 1/3 of the 24 bytes of storage only
-    //  as the first 2/3 are cleared inherently as even 64 empty squares
-    //  require 64 * 2 bits = 16 bytes.
-    for( i = ( 2 * nbrof(dst.ints) ) / 3; i<nbrof(dst.ints); i++ )
-    {
-        dst.ints[i] = 0;
-    }
-
     // Encode "castling possible" as opposition pawn on rook's home square
     //  (which is otherwise impossible)
-    if( squares[e1] == 'K' )
+    if( src[e1] == 'K' )
     {
-        if( src.wking && src.squares[h1]=='R' )
-            src.squares[h1] = 'p';
-        if( src.wqueen && src.squares[a1]=='R' )
-            src.squares[a1] = 'p';
+        if( wking && src[h1]=='R' )
+            src[h1] = 'p';
+        if( wqueen && src[a1]=='R' )
+            src[a1] = 'p';
     }
-    if( src.squares[e8] == 'k' )
+    if( src[e8] == 'k' )
     {
-        if( src.bking && src.squares[h8]=='r' )
-            src.squares[h8] = 'P';
-        if( src.bqueen && src.squares[a8]=='r' )
-            src.squares[a8] = 'P';
+        if( bking && src[h8]=='r' )
+            src[h8] = 'P';
+        if( bqueen && src[a8]=='r' )
+            src[a8] = 'P';
     }
 
     // Encode enpassant as friendly pawn on 1st rank (otherwise impossible).
@@ -518,20 +598,20 @@ unsigned short ChessPosition::Compress( CompressedPosition &dst ) const
     //  for the other bug comment in this function).
     #if 1
     // White captures enpassant on a6,b6...h6
-    Square ep_target = src.groomed_enpassant_target();
-    if( src.white && ep_target!=SQUARE_INVALID )
+    Square ep_target = groomed_enpassant_target();
+    if( white && ep_target!=SQUARE_INVALID )
     {
         int idx = ep_target+8; //idx = SOUTH(enpassant_target) is black pawn
-        src.squares[idx] = src.squares[idx-24]; // store 1st rank
-        src.squares[idx-24] = 'p';              // indicate ep
+        src[idx] = src[idx-24]; // store 1st rank
+        src[idx-24] = 'p';      // indicate ep
     }
 
     // Black captures enpassant on a3,b3...h3
-    else if( !src.white && ep_target!=SQUARE_INVALID )
+    else if( !white && ep_target!=SQUARE_INVALID )
     {
         int idx = ep_target-8; //idx = NORTH(enpassant_target) is white pawn
-        src.squares[idx] = src.squares[idx+24]; // store 1st rank
-        src.squares[idx+24] = 'P';              // indicate ep
+        src[idx] = src[idx+24]; // store 1st rank
+        src[idx+24] = 'P';      // indicate ep
     }
 
     // This old ugly one has a bug ... (search for bug below)
@@ -539,156 +619,76 @@ unsigned short ChessPosition::Compress( CompressedPosition &dst ) const
 
     // White captures enpassant on a6,b6...h6
     bool swap = false;
-    if( src.white && a6<=src.enpassant_target && src.enpassant_target<=h6 )
+    if( white && a6<=enpassant_target && enpassant_target<=h6 )
     {
-        int idx = src.enpassant_target+8; //idx = SOUTH(src.enpassant_target)
-        if( src.enpassant_target==a6 && src.squares[idx+1]=='P' )
+        int idx = enpassant_target+8; //idx = SOUTH(enpassant_target)
+        if( enpassant_target==a6 && src[idx+1]=='P' )
             swap = true;
-        else if( src.enpassant_target==h6 && src.squares[idx-1]=='P' )
+        else if( enpassant_target==h6 && src[idx-1]=='P' )
             swap = true;
-        else if( src.squares[idx-1]=='P' || src.squares[idx+1]=='P' )
-            // BUG! src.enpassant_target can be a6 or h6 in this clause
+        else if( src[idx-1]=='P' || src[idx+1]=='P' )
+            // BUG! enpassant_target can be a6 or h6 in this clause
             swap = true;
         if( swap )
         {
-            src.squares[idx] = src.squares[idx-24]; // store 1st rank
-            src.squares[idx-24] = 'p';              // indicate ep
+            src[idx] = src[idx-24]; // store 1st rank
+            src[idx-24] = 'p';      // indicate ep
         }
     }
 
     // Black captures enpassant on a3,b3...h3
-    else if( !src.white && a3<=src.enpassant_target && src.enpassant_target<=h3 )
+    else if( !white && a3<=enpassant_target && enpassant_target<=h3 )
     {
-        int idx = src.enpassant_target-8; //idx = NORTH(src.enpassant_target)
-        if( src.enpassant_target==a3 && src.squares[idx+1]=='p' )
+        int idx = enpassant_target-8; //idx = NORTH(enpassant_target)
+        if( enpassant_target==a3 && src[idx+1]=='p' )
             swap = true;
-        else if( src.enpassant_target==h3 && src.squares[idx-1]=='p' )
+        else if( enpassant_target==h3 && src[idx-1]=='p' )
             swap = true;
-        else if( src.squares[idx-1]=='p' || src.squares[idx+1]=='p' )
-            // BUG! src.enpassant_target can be a3 or h3 in this clause
+        else if( src[idx-1]=='p' || src[idx+1]=='p' )
+            // BUG! enpassant_target can be a3 or h3 in this clause
             swap = true;
         if( swap )
         {
-            src.squares[idx] = src.squares[idx+24]; // store 1st rank
-            src.squares[idx+24] = 'P';              // indicate ep
+            src[idx] = src[idx+24]; // store 1st rank
+            src[idx+24] = 'P';      // indicate ep
         }
     }
     #endif
 
-
-    // Encode empty square with 2 bits, and other 12 possibilities with
-    //  all the other possible nibbles that don't start with those 2 bits
-    #define CEMPTY      2   // 10
-    #define CWROOK      0   // 0000
-    #define CWKNIGHT    1   // 0001
-    #define CWBISHOP    2   // 0010
-    #define CWQUEEN     3   // 0011
-    #define CWKING      4   // 0100
-    #define CWPAWN      5   // 0101
-    #define CBROOK      6   // 0110
-    #define CBKNIGHT    7   // 0111
-    #define CBBISHOP   12   // 1100
-    #define CBQUEEN    13   // 1101
-    #define CBKING     14   // 1110
-    #define CBPAWN     15   // 1111
-
-    unsigned char c, *p, *base;
-    int bit=7;
-    base = p = dst.storage;
-    bool second_king=false;
-    int kings=0;
-    bool err=false;
-    for( i=0; !err && i<64; i++ )
+    // Shift 2 or 4 bits per square into a buffer, most significant first,
+    //  then keep at most 24 bytes (a legal position has at most 32 men). A
+    //  byte is stored every time, and kept only if it's complete, so there
+    //  are no hard to predict branches. The code table is built on first
+    //  use (not during static initialisation, when another translation
+    //  unit might already be calling Compress())
+    static const COMPRESS_CODES compress_codes;
+    unsigned char buf[40];
+    int nbr = 0;
+    uint64_t bits = 0;
+    int nbr_bits = 0;
+    int kings = 0;
+    for( i=0; i<64; i++ )
     {
-        if( p-base >= 24 )   // never need more than 24 bytes in legal position
-        {
-            err = true;
-            break;
-        }
-        bool empty=false;
-        c = CEMPTY;
-        switch( src.squares[i] )
-        {
-            case 'R':   c = CWROOK;     break;
-            case 'N':   c = CWKNIGHT;   break;
-            case 'B':   c = CWBISHOP;   break;
-            case 'Q':   c = CWQUEEN;    break;
-            case 'K':   c = CWKING;     kings++; if( kings==2 ) second_king=true; break;
-            case 'P':   c = CWPAWN;     break;
-            case 'r':   c = CBROOK;     break;
-            case 'n':   c = CBKNIGHT;   break;
-            case 'b':   c = CBBISHOP;   break;
-            case 'q':   c = CBQUEEN;    break;
-            case 'k':   c = CBKING;     kings++; if( kings==2 ) second_king=true; break;
-            case 'p':   c = CBPAWN;     break;
-            case ' ':
-            default:    empty = true;   break;
-        }
+        unsigned char piece = (unsigned char)src[i];
+        unsigned int c = compress_codes.code[piece];
 
         // Encode black to move as two kings same colour (2 white kings if
         //  white king first, 2 black kings otherwise)
-        if( second_king )
-        {
-            second_king = false;
-            if( !src.white )
-            {
-                if( c == CBKING )
-                    c = CWKING;
-                else
-                    c = CBKING;
-            }
-        }
-
-        // Shift and mask 2 or 4 bits into storage
-        if( empty )
-        {
-            switch( bit )
-            {
-                case 7: *p = (CEMPTY<<6);
-                        bit = 5;
-                        break;
-                case 5: *p = (*p&0xc0) | (CEMPTY<<4);
-                        bit = 3;
-                        break;
-                case 3: *p = (*p&0xf0) | (CEMPTY<<2);
-                        bit = 1;
-                        break;
-                case 1: *p = (*p&0xfc) | (CEMPTY);
-                        p++;
-                        bit = 7;
-                        break;
-            }
-        }
-        else
-        {
-            switch( bit )
-            {
-                case 7: *p = (c<<4);
-                        bit = 3;
-                        break;
-                case 5: *p = (*p&0xc0) | (c<<2);
-                        bit = 1;
-                        break;
-                case 3: *p = (*p&0xf0) | (c);
-                        p++;
-                        bit = 7;
-                        break;
-                case 1:
-                {
-                        *p = (*p&0xfc) | ((c>>2)&0x03);
-                        p++;
-                        if( p-base >= 24 )
-                            err = true;
-                        else
-                        {
-                            *p = ((c<<6)&0xc0);
-                            bit = 5;
-                        }
-                        break;
-                }
-            }
-        }
+        if( (piece=='K' || piece=='k') && ++kings==2 && !white )
+            c ^= (CWKING^CBKING);
+        int n = compress_codes.nbr_bits[piece];
+        bits = (bits<<n) | c;
+        nbr_bits += n;
+        buf[nbr] = (unsigned char)((bits<<8) >> nbr_bits);
+        nbr += (nbr_bits>>3);
+        nbr_bits &= 7;
     }
+    if( nbr_bits > 0 )
+        buf[nbr++] = (unsigned char)(bits << (8-nbr_bits));
+    if( nbr > (int)sizeof(dst.storage) )
+        nbr = sizeof(dst.storage);
+    memcpy( dst.storage, buf, nbr );
+    memset( dst.storage+nbr, 0, sizeof(dst.storage)-nbr );
 
     // Create hash
     unsigned int big_hash = 0;
@@ -902,6 +902,77 @@ void ChessPosition::Decompress( const CompressedPosition &src )
             bqueen = true;
         }
     }
+    BitboardsCalculate();
+}
+
+/****************************************************************************
+ * Recalculate bitboards from squares[]
+ ****************************************************************************/
+void ChessPosition::BitboardsCalculate()
+{
+    static bool tables_ready = bitboard_tables_init();  // first time only
+    (void)tables_ready;
+    memset( bb_pieces, 0, sizeof(bb_pieces) );
+    bb_white = 0;
+    bb_black = 0;
+    for( Square square=a8; square<=h1; ++square )
+    {
+        int idx = bb_index[ squares[square] & 0x7f ];
+        if( idx != BB_NBR )
+        {
+            bb_pieces[idx] |= BB(square);
+            if( idx < BB_BPAWN )
+                bb_white |= BB(square);
+            else
+                bb_black |= BB(square);
+        }
+    }
+    KeysCalculate();
+}
+
+/****************************************************************************
+ * Recalculate Zobrist keys
+ ****************************************************************************/
+void ChessPosition::KeysCalculate()
+{
+    key          = KeyCastlingEnpassant() ^ (white ? zobrist_white : 0);
+    pawn_key     = 0;
+    material_key = 0;
+    for( int idx=0; idx<BB_NBR; idx++ )
+    {
+        int count = 0;
+        for( Bitboard bb=bb_pieces[idx]; bb; count++ )
+        {
+            uint64_t z = zobrist_pieces[idx][bb_pop_lsb(bb)];
+            key ^= z;
+            if( idx==BB_WPAWN || idx==BB_BPAWN )
+                pawn_key ^= z;
+            material_key ^= zobrist_pieces[idx][count];  // index by count, not square
+        }
+    }
+}
+
+/****************************************************************************
+ * Zobrist key for castling and en passant possibilities
+ ****************************************************************************/
+uint64_t ChessPosition::KeyCastlingEnpassant() const
+{
+    uint64_t z = 0;
+    if( wking || wqueen || bking || bqueen )    // quick check first, usually false
+    {
+        int castling = (wking_allowed()  ? 1 : 0) |
+                       (wqueen_allowed() ? 2 : 0) |
+                       (bking_allowed()  ? 4 : 0) |
+                       (bqueen_allowed() ? 8 : 0);
+        z = zobrist_castling[castling];
+    }
+    if( enpassant_target != SQUARE_INVALID )
+    {
+        Square ep = groomed_enpassant_target();
+        if( ep != SQUARE_INVALID )
+            z ^= zobrist_enpassant[IFILE(ep)];
+    }
+    return z;
 }
 
 /****************************************************************************
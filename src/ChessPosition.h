@@ -46,6 +46,7 @@ public:
         bking_square = e8;
         half_move_clock = 0;
         full_move_count = 1;
+        BitboardsCalculate();
     }
 
     // Copy constructor and Assignment operator. Defining them this way
@@ -157,13 +158,30 @@ public:
     // For debug
     std::string ToDebugStr( const char *label = 0 );
 
+    // For debug, into a buffer (no memory allocation, output is truncated
+    //  if the buffer is too small)
+    //  return length
+    int ToDebugStr( char *buf, size_t buf_size, const char *label = 0 );
+
     // Set up position on board from Forsyth string with extensions
     //  return bool okay
     virtual bool Forsyth( const char *txt );
 
+    // Set up position on board from Forsyth string of given length (needn't
+    //  be '\0' terminated, must be less than FORSYTH_SIZE*2)
+    //  return bool okay
+    bool Forsyth( const char *txt, size_t len );
+#ifdef THC_HAVE_STRING_VIEW
+    bool Forsyth( std::string_view txt ) { return Forsyth( txt.data(), txt.size() ); }
+#endif
+
     // Publish chess position and supplementary info in forsyth notation
     std::string ForsythPublish();
 
+    // Publish in forsyth notation into a buffer (no memory allocation)
+    //  return length
+    int ForsythPublish( char forsyth_out[FORSYTH_SIZE] );
+
     // Compress a ChessPosition into 24 bytes, return 16-bit hash
     unsigned short Compress( CompressedPosition &dst ) const;
 
@@ -185,6 +203,37 @@ public:
     // Who's turn is it anyway
     inline bool WhiteToPlay() const { return white; }
     void Toggle() { white = !white; }
+
+    // Recalculate bitboards and Zobrist keys from squares[] etc. Both are
+    //  kept up to date by ChessRules::PushMove() and ChessRules::PopMove(),
+    //  so this is only needed if you change squares[] (or castling flags,
+    //  en passant target or who's turn it is) directly
+    void BitboardsCalculate();
+
+    // Recalculate Zobrist keys only
+    void KeysCalculate();
+
+    // The part of the Zobrist key representing castling and en passant
+    //  possibilities, only counting the ones that can actually happen
+    uint64_t KeyCastlingEnpassant() const;
+
+    // All pieces of either colour
+    Bitboard bb_occupied() const { return bb_white | bb_black; }
+
+    // A bitboard representation of the position, shadowing squares[]. The
+    //  DETAIL bits must remain the last 32 bits of ChessPositionRaw, so the
+    //  bitboards live here rather than there.
+    Bitboard bb_pieces[BB_NBR];     // eg bb_pieces[BB_WKNIGHT] = all white knights
+    Bitboard bb_white;              // all white pieces
+    Bitboard bb_black;              // all black pieces
+
+    // Zobrist keys, unlike Hash64Calculate() the main key distinguishes side
+    //  to move, castling and en passant possibilities. Positions with the
+    //  same pawns have the same pawn_key, positions with the same number of
+    //  each type of piece have the same material_key
+    uint64_t key;
+    uint64_t pawn_key;
+    uint64_t material_key;
 };
 
 } //namespace thc
@@ -34,6 +34,32 @@ static unsigned char castling_prohibited_table[] =
     (unsigned char)(~(WQUEEN+WKING)),  0xff, 0xff, (unsigned char)(~WKING)  // e1-h1
 };
 
+// Toggle a piece on or off square(s) in the bitboards and Zobrist keys. A
+//  mask with one square adds or removes a piece, a mask with two squares
+//  moves one
+static inline void bb_toggle( ChessPosition *cp, char piece, Bitboard mask )
+{
+    int idx = bb_index[(int)piece];
+    cp->bb_pieces[idx] ^= mask;
+    if( idx < BB_BPAWN )
+        cp->bb_white ^= mask;
+    else
+        cp->bb_black ^= mask;
+    uint64_t z = 0;
+    for( Bitboard bb=mask; bb; )
+        z ^= zobrist_pieces[idx][bb_pop_lsb(bb)];
+    cp->key ^= z;
+    if( idx==BB_WPAWN || idx==BB_BPAWN )
+        cp->pawn_key ^= z;
+    if( !(mask & (mask-1)) )
+    {
+        int count = bb_popcount( cp->bb_pieces[idx] );    // count after toggle
+        if( cp->bb_pieces[idx] & mask )
+            count--;                                        // added
+        cp->material_key ^= zobrist_pieces[idx][count];
+    }
+}
+
 /****************************************************************************
  * Test internals, for porting to new environments etc
  *   For the moment at least, this is best used by stepping through it
@@ -122,8 +148,9 @@ bool ChessRules::TestInternals( int (*log)(const char *,...) )
     log( " &half_move_clock = 0x%p\n",             &half_move_clock );
     log( " &full_move_count = 0x%p\n",             &full_move_count );
     log( " size to end of full_move_count = %lu", ((char *)&full_move_count - (char *)this) + sizeof(full_move_count) );
-    log( " sizeof(ChessPosition) = %lu (should be 4 more than size to end of full_move_count)\n",
-           sizeof(ChessPosition) );
+    log( " sizeof(ChessPositionRaw) = %lu (should be 4 more than size to end of full_move_count)\n",
+           sizeof(ChessPositionRaw) );
+    log( " sizeof(ChessPosition) = %lu\n",         sizeof(ChessPosition) );
     log( " sizeof(Move) = %lu\n",                  sizeof(Move) );
 
     log( " sizeof(ChessPositionRaw) = %lu\n", sizeof(ChessPositionRaw) );
@@ -191,8 +218,71 @@ bool ChessRules::TestInternals( int (*log)(const char *,...) )
                bqueen?"true":"false" );
     }
 
+    // PackedMove should round trip every legal move, including en passant,
+    //  castling and promotions (with and without capture)
+    bool packed_ok = true;
+    const char *packed_fens[] =
+    {
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+        "r3k2r/1P4P1/8/2pP4/8/8/1p4p1/R3K2R w KQkq c6 0 1",
+        "r3k2r/1P4P1/8/8/3pP3/8/1p4p1/R3K2R b KQkq e3 0 1"
+    };
+    for( unsigned int i=0; i<sizeof(packed_fens)/sizeof(packed_fens[0]); i++ )
+    {
+        Forsyth( packed_fens[i] );
+        MOVELIST list;
+        GenLegalMoveList( &list );
+        for( int j=0; j<list.count; j++ )
+        {
+            PackedMove packed;
+            packed.Pack( list.moves[j] );
+            if( !packed.Valid() || packed.Unpack(*this) != list.moves[j] )
+                packed_ok = false;
+        }
+    }
+
+    // Corrupt PackedMoves are invalid, src==dst, unknown specials and
+    //  specials that don't fit the squares
+    const uint16_t corrupt[] =
+    {
+        0,
+        (uint16_t)(e2 | (e2<<6)),
+        (uint16_t)(e2 | (e4<<6) | (14<<12)),
+        (uint16_t)(e2 | (e4<<6) | (15<<12)),
+        (uint16_t)(d1 | (g1<<6) | (SPECIAL_WK_CASTLING<<12)),
+        (uint16_t)(e4 | (e5<<6) | (SPECIAL_PROMOTION_QUEEN<<12)),
+        (uint16_t)(e3 | (e5<<6) | (SPECIAL_WPAWN_2SQUARES<<12)),
+        (uint16_t)(e5 | (d6<<6) | (SPECIAL_BEN_PASSANT<<12))
+    };
+    for( unsigned int i=0; i<sizeof(corrupt)/sizeof(corrupt[0]); i++ )
+    {
+        PackedMove packed;
+        packed.bits = corrupt[i];
+        if( packed.Valid() )
+            packed_ok = false;
+    }
+    log( "PackedMove round trip %s\n", packed_ok ? "okay" : "failed" );
+
+    // Repetitions are found however far back they are. Shuffle knights out
+    //  and back for 300 plies (the initial position comes round every 4),
+    //  then undo it all
+    Forsyth( "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1" );
+    Init();
+    const char *shuffle[] = { "g1f3", "g8f6", "f3g1", "f6g8" };
+    Move shuffle_moves[300];
+    for( int i=0; i<300; i++ )
+    {
+        shuffle_moves[i].TerseIn( this, shuffle[i%4] );
+        PushMove( shuffle_moves[i] );
+    }
+    bool repetition_ok = (GetRepetitionCount() == 76);
+    for( int i=299; i>=0; i-- )
+        PopMove( shuffle_moves[i] );
+    repetition_ok = repetition_ok && GetRepetitionCount()==1 && reversible_plies==0;
+    log( "Repetition count %s\n", repetition_ok ? "okay" : "failed" );
+
     // Later, extend this to check addresses etc
-    return KQkq_allowed && Qkq_allowed && Qq_allowed && q_allowed && none_allowed && kq_allowed && none_allowed2 &&
+    return repetition_ok && packed_ok && KQkq_allowed && Qkq_allowed && Qq_allowed && q_allowed && none_allowed && kq_allowed && none_allowed2 &&
            KQkq_allowed_f && Qkq_allowed_f && Qq_allowed_f && q_allowed_f && none_allowed_f && kq_allowed_f && none_allowed2_f;
 }
 
@@ -260,24 +350,334 @@ void ChessRules::GenLegalMoveList( vector<Move>  &moves,
 void ChessRules::GenLegalMoveList( MOVELIST *list )
 {
     int i, j;
-    bool okay;
-    MOVELIST list2;
 
     // Generate all moves, including illegal (e.g. put king in check) moves
-    GenMoveList( &list2 );
-
-    // Loop copying the proven good ones
-    for( i=j=0; i<list2.count; i++ )
+    GenMoveList( list );
+
+    // Loop keeping the legal ones. Most moves only need the pinned and
+    //  evasion masks, so that test is done here, the rest are left to
+    //  PseudoLegalIsLegal()
+    Bitboard pinned, evasions;
+    LegalityMasks( pinned, evasions );
+    Square king_square = (Square)(white ? wking_square : bking_square);
+    bool king_present  = (squares[king_square] == (white ? 'K' : 'k'));
+    for( i=j=0; i<list->count; i++ )
     {
-        PushMove( list2.moves[i] );
-        okay = Evaluate();
-        PopMove( list2.moves[i] );
+        Move mv = list->moves[i];
+        bool okay;
+        if( king_present && mv.src!=king_square &&
+            mv.special!=SPECIAL_WEN_PASSANT && mv.special!=SPECIAL_BEN_PASSANT )
+        {
+            okay = (evasions & BB(mv.dst)) &&
+                   ( !(pinned & BB(mv.src)) || (line_bb[king_square][mv.src] & BB(mv.dst)) );
+        }
+        else
+            okay = PseudoLegalIsLegal( mv, pinned, evasions );
         if( okay )
-            list->moves[j++] = list2.moves[i];
+            list->moves[j++] = mv;
     }
     list->count  = j;
 }
 
+/****************************************************************************
+ * Find the men pinned against our king, and the squares a man other than
+ *  the king must move to if we are in check (all squares if not in check,
+ *  no squares in double check)
+ ****************************************************************************/
+void ChessRules::LegalityMasks( Bitboard &pinned, Bitboard &evasions )
+{
+    Square king_square = (Square)(white ? wking_square : bking_square);
+    pinned   = 0;
+    evasions = ~(Bitboard)0;
+    if( squares[king_square] != (white ? 'K' : 'k') )
+        return;
+    Bitboard occupied = bb_occupied();
+    Bitboard ours     = (white ? bb_white : bb_black);
+    const Bitboard *enemy = &bb_pieces[ white ? BB_BPAWN : BB_WPAWN ];
+    Bitboard checkers = AttackersTo( king_square, !white, occupied );
+    Bitboard snipers  = (bishop_attacks_bb(king_square,occupied&~ours) & (enemy[BB_WBISHOP]|enemy[BB_WQUEEN]))
+                      | (rook_attacks_bb  (king_square,occupied&~ours) & (enemy[BB_WROOK]  |enemy[BB_WQUEEN]));
+    while( snipers )
+    {
+        Bitboard blockers = between_bb[king_square][bb_pop_lsb(snipers)] & occupied;
+        if( bb_popcount(blockers) == 1 )
+            pinned |= blockers;     // must be ours, enemy men were seen through
+    }
+    if( checkers )
+    {
+        Square checker = bb_lsb(checkers);
+        evasions = (checkers&(checkers-1)) ? 0 : (between_bb[king_square][checker] | checkers);
+    }
+}
+
+/****************************************************************************
+ * Is a pseudo-legal move (one from GenMoveList() etc.) legal ? Requires the
+ *  masks calculated by LegalityMasks() for this position
+ ****************************************************************************/
+bool ChessRules::PseudoLegalIsLegal( Move mv, Bitboard pinned, Bitboard evasions )
+{
+    Square king_square = (Square)(white ? wking_square : bking_square);
+    bool okay;
+
+    // Without a king in place there are no pins or checks to work with, so
+    //  fall back to proving the move by playing it
+    if( squares[king_square] != (white ? 'K' : 'k') )
+    {
+        PushMove( mv );
+        okay = Evaluate();
+        PopMove( mv );
+    }
+    else if( mv.src == king_square )
+    {
+        // Castling already checks king isn't in or passing through check,
+        //  otherwise the destination mustn't be attacked with the king gone
+        okay = (mv.special!=SPECIAL_KING_MOVE ||
+                !AttackersTo( mv.dst, !white, bb_occupied() & ~BB(king_square) ));
+    }
+    else if( mv.special==SPECIAL_WEN_PASSANT || mv.special==SPECIAL_BEN_PASSANT )
+    {
+        // En passant clears two squares on a rank, rare enough to just
+        //  play the move to check it
+        PushMove( mv );
+        okay = !AttackedPiece( king_square );
+        PopMove( mv );
+    }
+    else
+    {
+        okay = (evasions & BB(mv.dst)) &&
+               ( !(pinned & BB(mv.src)) || (line_bb[king_square][mv.src] & BB(mv.dst)) );
+    }
+    return okay;
+}
+
+/****************************************************************************
+ * Is a move legal in this position ? (without generating all the moves)
+ ****************************************************************************/
+bool ChessRules::IsLegalMove( Move mv )
+{
+    if( !IsPseudoLegal(mv) )
+        return false;
+    Bitboard pinned, evasions;
+    LegalityMasks( pinned, evasions );
+    return PseudoLegalIsLegal( mv, pinned, evasions );
+}
+
+/****************************************************************************
+ * Count the legal moves in this position, without generating them
+ ****************************************************************************/
+int ChessRules::CountLegalMoves()
+{
+    return LegalMoveCount( false );
+}
+
+/****************************************************************************
+ * Is there at least one legal move ?
+ ****************************************************************************/
+bool ChessRules::HasLegalMove()
+{
+    return LegalMoveCount( true ) > 0;
+}
+
+/****************************************************************************
+ * Count legal moves, optionally stopping at the first one. The destination
+ *  squares of each man are worked out as a bitboard and counted, so no
+ *  Move objects are made, except for the rare castling and en passant moves
+ ****************************************************************************/
+int ChessRules::LegalMoveCount( bool stop_at_first )
+{
+    Square king_square = (Square)(white ? wking_square : bking_square);
+    const Bitboard *ours_bb = &bb_pieces[ white ? BB_WPAWN : BB_BPAWN ];
+    const Bitboard back_ranks = 0xff000000000000ffULL;
+
+    // Unusual positions (no king, extra kings, pawns on the first or last
+    //  rank) are left to the full move generator
+    if( squares[king_square] != (white ? 'K' : 'k') || ours_bb[BB_WKING] != BB(king_square) ||
+        ((bb_pieces[BB_WPAWN]|bb_pieces[BB_BPAWN]) & back_ranks) )
+    {
+        MOVELIST list;
+        GenLegalMoveList( &list );
+        return list.count;
+    }
+    Bitboard pinned, evasions;
+    LegalityMasks( pinned, evasions );
+    Bitboard occupied = bb_occupied();
+    Bitboard ours     = (white ? bb_white : bb_black);
+    Bitboard theirs   = (white ? bb_black : bb_white);
+    int count = 0;
+
+    // King moves, the only moves possible in double check
+    Bitboard targets = king_attacks_bb[king_square] & ~ours;
+    while( targets )
+    {
+        if( !AttackersTo( bb_pop_lsb(targets), !white, occupied & ~BB(king_square) ) )
+        {
+            count++;
+            if( stop_at_first )
+                return count;
+        }
+    }
+    if( !evasions )
+        return count;
+    MOVELIST special;
+    special.count = 0;
+    CastlingMoves( &special, king_square );
+    count += special.count;
+    if( stop_at_first && count )
+        return count;
+
+    // Knights, bishops, rooks and queens. A pinned man can only move along
+    //  the line through the king and the pinner (so a pinned knight can't
+    //  move at all)
+    Bitboard men = ours & ~ours_bb[BB_WPAWN] & ~ours_bb[BB_WKING];
+    while( men )
+    {
+        Square square = bb_pop_lsb(men);
+        switch( squares[square] )
+        {
+            case 'N':
+            case 'n':   targets = knight_attacks_bb[square];                 break;
+            case 'B':
+            case 'b':   targets = bishop_attacks_bb(square,occupied);        break;
+            case 'R':
+            case 'r':   targets = rook_attacks_bb(square,occupied);          break;
+            default:    targets = queen_attacks_bb(square,occupied);         break;
+        }
+        targets &= ~ours & evasions;
+        if( pinned & BB(square) )
+            targets &= line_bb[king_square][square];
+        count += bb_popcount(targets);
+        if( stop_at_first && count )
+            return count;
+    }
+
+    // Pawns, promotions count four times. En passant is generated whenever
+    //  a pawn attacks the en passant target (as in GenMoveList()) and is
+    //  checked by playing it
+    Bitboard enpassant = ((unsigned int)enpassant_target<=(unsigned int)h1 ? BB(enpassant_target) : 0);
+    men = ours_bb[BB_WPAWN];
+    while( men )
+    {
+        Square square = bb_pop_lsb(men);
+        Bitboard attacks = (white ? pawn_white_attacks_bb[square] : pawn_black_attacks_bb[square]);
+        targets = attacks & theirs & ~enpassant;
+        Square ahead = (white ? NORTH(square) : SOUTH(square));
+        if( IsEmptySquare(squares[ahead]) )
+        {
+            targets |= BB(ahead);
+            Square ahead2 = (white ? NORTH(ahead) : SOUTH(ahead));
+            if( RANK(square)==(white?'2':'7') && IsEmptySquare(squares[ahead2]) )
+                targets |= BB(ahead2);
+        }
+        targets &= evasions;
+        if( pinned & BB(square) )
+            targets &= line_bb[king_square][square];
+        count += bb_popcount(targets) * (RANK(square)==(white?'7':'2') ? 4 : 1);
+        if( attacks & enpassant )
+        {
+            Move mv;
+            mv.src     = square;
+            mv.dst     = (Square)enpassant_target;
+            mv.special = (white ? SPECIAL_WEN_PASSANT : SPECIAL_BEN_PASSANT);
+            mv.capture = (white ? 'p' : 'P');
+            if( PseudoLegalIsLegal( mv, pinned, evasions ) )
+                count++;
+        }
+        if( stop_at_first && count )
+            return count;
+    }
+    return count;
+}
+
+/****************************************************************************
+ * Could a move have been generated by GenMoveList() in this position ? (ie
+ *  is it legal apart from possibly leaving the king in check)
+ ****************************************************************************/
+bool ChessRules::IsPseudoLegal( Move mv )
+{
+    if( (unsigned int)mv.src>(unsigned int)h1 || (unsigned int)mv.dst>(unsigned int)h1 )
+        return false;
+    char piece  = squares[mv.src];
+    char target = squares[mv.dst];
+    if( !(white ? IsWhite(piece) : IsBlack(piece)) )
+        return false;
+    if( (white ? bb_white : bb_black) & BB(mv.dst) )
+        return false;
+    char pawn = (white ? 'P' : 'p');
+    Bitboard pawn_attacks = (white ? pawn_white_attacks_bb[mv.src] : pawn_black_attacks_bb[mv.src]);
+    Square ahead = (white ? NORTH(mv.src) : SOUTH(mv.src));
+    bool seventh = (RANK(mv.src) == (white?'7':'2'));
+
+    // En passant is the only case where the captured man isn't on the
+    //  destination square
+    if( mv.special==SPECIAL_WEN_PASSANT || mv.special==SPECIAL_BEN_PASSANT )
+    {
+        return mv.special == (white ? SPECIAL_WEN_PASSANT : SPECIAL_BEN_PASSANT) &&
+               piece == pawn && mv.dst == enpassant_target &&
+               mv.capture == (white ? 'p' : 'P') && (pawn_attacks & BB(mv.dst));
+    }
+    if( mv.capture != target )
+        return false;
+    switch( mv.special )
+    {
+        case NOT_SPECIAL:
+        {
+            Bitboard occupied = bb_occupied();
+            switch( piece )
+            {
+                case 'P':
+                case 'p':
+                    return !seventh &&
+                           ( (mv.dst==ahead && IsEmptySquare(target)) ||
+                             ((pawn_attacks & BB(mv.dst)) && !IsEmptySquare(target)) );
+                case 'N':
+                case 'n':   return (knight_attacks_bb[mv.src] & BB(mv.dst)) != 0;
+                case 'B':
+                case 'b':   return (bishop_attacks_bb(mv.src,occupied) & BB(mv.dst)) != 0;
+                case 'R':
+                case 'r':   return (rook_attacks_bb(mv.src,occupied) & BB(mv.dst)) != 0;
+                case 'Q':
+                case 'q':   return (queen_attacks_bb(mv.src,occupied) & BB(mv.dst)) != 0;
+            }
+            return false;   // king moves are always SPECIAL_KING_MOVE
+        }
+        case SPECIAL_KING_MOVE:
+            return piece == (white ? 'K' : 'k') && (king_attacks_bb[mv.src] & BB(mv.dst));
+        case SPECIAL_WK_CASTLING:
+        case SPECIAL_BK_CASTLING:
+        case SPECIAL_WQ_CASTLING:
+        case SPECIAL_BQ_CASTLING:
+        {
+            if( piece != (white ? 'K' : 'k') )
+                return false;
+            MOVELIST castling;
+            castling.count = 0;
+            CastlingMoves( &castling, mv.src );
+            for( int i=0; i<castling.count; i++ )
+            {
+                if( castling.moves[i] == mv )
+                    return true;
+            }
+            return false;
+        }
+        case SPECIAL_PROMOTION_QUEEN:
+        case SPECIAL_PROMOTION_ROOK:
+        case SPECIAL_PROMOTION_BISHOP:
+        case SPECIAL_PROMOTION_KNIGHT:
+            return piece == pawn && seventh &&
+                   ( (mv.dst==ahead && IsEmptySquare(target)) ||
+                     ((pawn_attacks & BB(mv.dst)) && !IsEmptySquare(target)) );
+        case SPECIAL_WPAWN_2SQUARES:
+        case SPECIAL_BPAWN_2SQUARES:
+            return mv.special == (white ? SPECIAL_WPAWN_2SQUARES : SPECIAL_BPAWN_2SQUARES) &&
+                   piece == pawn && RANK(mv.src) == (white?'2':'7') &&
+                   IsEmptySquare(squares[ahead]) && IsEmptySquare(target) &&
+                   mv.dst == (white ? NORTH(ahead) : SOUTH(ahead));
+        default:
+            break;
+    }
+    return false;
+}
+
 /****************************************************************************
  * Create a list of all legal moves in this position, with extra info
  ****************************************************************************/
@@ -285,35 +685,243 @@ void ChessRules::GenLegalMoveList( MOVELIST *list, bool check[MAXMOVES],
                                                     bool mate[MAXMOVES],
                                                     bool stalemate[MAXMOVES] )
 {
-    int i, j;
-    bool okay;
-    TERMINAL terminal_score;
-    MOVELIST list2;
-
-    // Generate all moves, including illegal (e.g. put king in check) moves
-    GenMoveList( &list2 );
+    GenLegalMoveList( list );
+    GenCheckInfo( *list, check, mate, stalemate );
+}
 
-    // Loop copying the proven good ones
-    for( i=j=0; i<list2.count; i++ )
+/****************************************************************************
+ * Find whether each of a list of legal moves gives check, mate or stalemate
+ ****************************************************************************/
+void ChessRules::GenCheckInfo( const MOVELIST &list, bool check[], bool mate[], bool stalemate[] )
+{
+    Square enemy_king = (Square)(white ? bking_square : wking_square);
+    const Bitboard *ours_bb   = &bb_pieces[ white ? BB_WPAWN : BB_BPAWN ];
+    const Bitboard *theirs_bb = &bb_pieces[ white ? BB_BPAWN : BB_WPAWN ];
+    const Bitboard back_ranks = 0xff000000000000ffULL;
+
+    // Unusual positions (no king, extra kings, pawns on the first or last
+    //  rank), play each move in turn to get the extra info
+    if( squares[enemy_king] != (white ? 'k' : 'K') || theirs_bb[BB_WKING] != BB(enemy_king) ||
+        bb_popcount(ours_bb[BB_WKING]) != 1 || ((bb_pieces[BB_WPAWN]|bb_pieces[BB_BPAWN]) & back_ranks) )
     {
-        PushMove( list2.moves[i] );
-        okay = Evaluate(terminal_score);
-        Square king_to_move = (Square)(white ? wking_square : bking_square );
-        bool bcheck = false;
-        if( AttackedPiece(king_to_move) )
-            bcheck = true;
-        PopMove( list2.moves[i] );
-        if( okay )
+        TERMINAL terminal_score;
+        for( int i=0; i<list.count; i++ )
         {
-            stalemate[j] = (terminal_score==TERMINAL_WSTALEMATE ||
+            Move mv = list.moves[i];
+            PushMove( mv );
+            Evaluate(terminal_score);
+            Square king_to_move = (Square)(white ? wking_square : bking_square );
+            bool bcheck = false;
+            if( AttackedPiece(king_to_move) )
+                bcheck = true;
+            PopMove( mv );
+            stalemate[i] = (terminal_score==TERMINAL_WSTALEMATE ||
                             terminal_score==TERMINAL_BSTALEMATE);
-            mate[j]      = (terminal_score==TERMINAL_WCHECKMATE ||
+            mate[i]      = (terminal_score==TERMINAL_WCHECKMATE ||
                             terminal_score==TERMINAL_BCHECKMATE);
-            check[j]     = mate[j] ? false : bcheck;
-            list->moves[j++] = list2.moves[i];
+            check[i]     = mate[i] ? false : bcheck;
         }
+        return;
+    }
+    Bitboard occupied = bb_occupied();
+    Bitboard ours     = (white ? bb_white : bb_black);
+    Bitboard theirs   = (white ? bb_black : bb_white);
+
+    // The squares each type of our men give check from
+    Bitboard check_squares[6];
+    check_squares[BB_WPAWN]   = (white ? pawn_black_attacks_bb[enemy_king] : pawn_white_attacks_bb[enemy_king]);
+    check_squares[BB_WKNIGHT] = knight_attacks_bb[enemy_king];
+    check_squares[BB_WBISHOP] = bishop_attacks_bb(enemy_king,occupied);
+    check_squares[BB_WROOK]   = rook_attacks_bb(enemy_king,occupied);
+    check_squares[BB_WQUEEN]  = check_squares[BB_WBISHOP] | check_squares[BB_WROOK];
+    check_squares[BB_WKING]   = 0;
+
+    // A man standing alone between one of our long range men and the enemy
+    //  king is either ours, and moving it off the line discovers check, or
+    //  theirs, and it's pinned
+    Bitboard discoverers = 0, pinned = 0;
+    Bitboard snipers = (bishop_attacks_bb(enemy_king,0) & (ours_bb[BB_WBISHOP]|ours_bb[BB_WQUEEN]))
+                     | (rook_attacks_bb  (enemy_king,0) & (ours_bb[BB_WROOK]  |ours_bb[BB_WQUEEN]));
+    while( snipers )
+    {
+        Bitboard blockers = between_bb[enemy_king][bb_pop_lsb(snipers)] & occupied;
+        if( bb_popcount(blockers) == 1 )
+        {
+            if( blockers & ours )
+                discoverers |= blockers;
+            else
+                pinned |= blockers;
+        }
+    }
+
+    // Stalemate needs every one of their men to be stuck after our move.
+    //  An ordinary move that doesn't give check can take away the only
+    //  moves of at most six of their men, (by capturing one, pinning one on
+    //  each of the lines through its source and destination squares,
+    //  blocking a pawn, and moving away a man two pawns could capture), so
+    //  if they have seven unpinned men with moves now, stalemate is
+    //  impossible. Castling and en passant move or remove two men, so they
+    //  are always checked
+    enum { STALEMATE_PROOF=7 };
+    int mobile = 0;
+    Bitboard men = theirs & ~theirs_bb[BB_WKING] & ~pinned;
+    while( men && mobile<STALEMATE_PROOF )
+    {
+        Square square = bb_pop_lsb(men);
+        Bitboard targets;
+        switch( squares[square] )
+        {
+            case 'P':
+            case 'p':
+            {
+                Square ahead = (white ? SOUTH(square) : NORTH(square));
+                targets = (white ? pawn_black_attacks_bb[square] : pawn_white_attacks_bb[square]) & ours;
+                if( IsEmptySquare(squares[ahead]) )
+                    targets |= BB(ahead);
+                break;
+            }
+            case 'N':
+            case 'n':   targets = knight_attacks_bb[square] & ~theirs;                break;
+            case 'B':
+            case 'b':   targets = bishop_attacks_bb(square,occupied) & ~theirs;       break;
+            case 'R':
+            case 'r':   targets = rook_attacks_bb(square,occupied) & ~theirs;         break;
+            default:    targets = queen_attacks_bb(square,occupied) & ~theirs;        break;
+        }
+        if( targets )
+            mobile++;
+    }
+
+    // Direct and discovered checks can be read off the bitboards, except for
+    //  the special moves that move or remove a second man (or change a man
+    //  into another), which are played to find out. Mate and stalemate are
+    //  only looked for if there's check, or stalemate is possible
+    for( int i=0; i<list.count; i++ )
+    {
+        Move mv = list.moves[i];
+        bool bcheck;
+        bool ordinary = (mv.special==NOT_SPECIAL || mv.special==SPECIAL_KING_MOVE ||
+                         mv.special==SPECIAL_WPAWN_2SQUARES || mv.special==SPECIAL_BPAWN_2SQUARES);
+        if( ordinary )
+        {
+            int idx = bb_index[ squares[mv.src] & 0x7f ] % BB_BPAWN;
+            bcheck = (check_squares[idx] & BB(mv.dst)) ||
+                     ((discoverers & BB(mv.src)) && !(line_bb[enemy_king][mv.src] & BB(mv.dst)));
+        }
+        else
+        {
+            PushMove( mv );
+            bcheck = AttackedPiece( enemy_king );
+            PopMove( mv );
+        }
+        bool no_moves = false;
+        bool castling_or_enpassant = !ordinary && (mv.special<SPECIAL_PROMOTION_QUEEN || mv.special>SPECIAL_PROMOTION_KNIGHT);
+        if( bcheck || mobile<STALEMATE_PROOF || castling_or_enpassant )
+        {
+            PushMove( mv );
+            no_moves = !HasLegalMove();
+            PopMove( mv );
+        }
+        mate[i]      = bcheck && no_moves;
+        stalemate[i] = !bcheck && no_moves;
+        check[i]     = bcheck && !no_moves;
+    }
+}
+
+/****************************************************************************
+ * Convert a list of legal moves to natural strings, eg "Nf3". One legal move
+ *  list and one table of the men of each type moving to each square serve
+ *  for disambiguation, and check and mate are found for all moves together
+ ****************************************************************************/
+void ChessRules::NaturalOutAll( const MOVELIST &list, char out[][NATURAL_MOVE_SIZE] )
+{
+    MOVELIST legal;
+    GenLegalMoveList( &legal );
+    bool check[MAXMOVES];
+    bool mate[MAXMOVES];
+    bool stalemate[MAXMOVES];
+    GenCheckInfo( list, check, mate, stalemate );
+
+    // sources[type][dst] = men of that type with a legal move to dst, only
+    //  the entries we use are cleared
+    Bitboard sources[BB_BPAWN][64];
+    for( int i=0; i<legal.count; i++ )
+    {
+        Move mv = legal.moves[i];
+        sources[ bb_index[squares[mv.src]&0x7f] % BB_BPAWN ][mv.dst] = 0;
+    }
+    for( int i=0; i<legal.count; i++ )
+    {
+        Move mv = legal.moves[i];
+        sources[ bb_index[squares[mv.src]&0x7f] % BB_BPAWN ][mv.dst] |= BB(mv.src);
+    }
+    for( int i=0; i<list.count; i++ )
+    {
+        Move mv = list.moves[i];
+        char *s = out[i];
+        char p  = (char)toupper(squares[mv.src]);
+        if( p == 'P' )
+        {
+            if( !IsEmptySquare(mv.capture) )
+            {
+                *s++ = FILE(mv.src);
+                *s++ = 'x';
+            }
+            *s++ = FILE(mv.dst);
+            *s++ = RANK(mv.dst);
+            const char *promotion = "";
+            switch( mv.special )
+            {
+                case SPECIAL_PROMOTION_QUEEN:   promotion = "=Q";   break;
+                case SPECIAL_PROMOTION_ROOK:    promotion = "=R";   break;
+                case SPECIAL_PROMOTION_BISHOP:  promotion = "=B";   break;
+                case SPECIAL_PROMOTION_KNIGHT:  promotion = "=N";   break;
+                default:                                            break;
+            }
+            while( *promotion )
+                *s++ = *promotion++;
+        }
+        else if( mv.special==SPECIAL_WK_CASTLING || mv.special==SPECIAL_BK_CASTLING )
+        {
+            strcpy( s, "O-O" );
+            s += 3;
+        }
+        else if( mv.special==SPECIAL_WQ_CASTLING || mv.special==SPECIAL_BQ_CASTLING )
+        {
+            strcpy( s, "O-O-O" );
+            s += 5;
+        }
+        else
+        {
+            // Disambiguate by file if that's enough, else by rank if that's
+            //  enough, else by both
+            Bitboard others = sources[ bb_index[squares[mv.src]&0x7f] % BB_BPAWN ][mv.dst] & ~BB(mv.src);
+            bool ambiguous = (others != 0);
+            bool same_file = false, same_rank = false;
+            while( others )
+            {
+                Square other = bb_pop_lsb(others);
+                if( FILE(other) == FILE(mv.src) )
+                    same_file = true;
+                if( RANK(other) == RANK(mv.src) )
+                    same_rank = true;
+            }
+            *s++ = p;
+            if( ambiguous && (!same_file || same_rank) )
+                *s++ = FILE(mv.src);
+            if( ambiguous && same_file )
+                *s++ = RANK(mv.src);
+            if( !IsEmptySquare(mv.capture) )
+                *s++ = 'x';
+            *s++ = FILE(mv.dst);
+            *s++ = RANK(mv.dst);
+        }
+        if( mate[i] )
+            *s++ = '#';
+        else if( check[i] )
+            *s++ = '+';
+        *s = '\0';
     }
-    list->count  = j;
 }
 
 /****************************************************************************
@@ -350,138 +958,15 @@ bool ChessRules::IsDraw( bool white_asks, DRAWTYPE &result )
  ****************************************************************************/
 int ChessRules::GetRepetitionCount()
 {
-    int matches=0;
-
-    //  Save those aspects of current position that are changed by multiple
-    //  PopMove() calls as we search backwards (i.e. squares, white,
-    //  detail, detail_idx)
-    char save_squares[sizeof(squares)];
-    memcpy( save_squares, squares, sizeof(save_squares) );
-    unsigned char save_detail_idx = detail_idx;  // must be unsigned char
-    bool          save_white      = white;
-    unsigned char idx             = history_idx; // must be unsigned char
-    DETAIL_SAVE;
-
-    // Search backwards ....
-    int nbr_half_moves = (full_move_count-1)*2 + (!white?1:0);
-    if( nbr_half_moves > nbrof(history)-1 )
-        nbr_half_moves = nbrof(history)-1;
-    if( nbr_half_moves > nbrof(detail_stack)-1 )
-        nbr_half_moves = nbrof(detail_stack)-1;
-    for( int i=0; i<nbr_half_moves; i++ )
+    // Compare keys with the same side to move, going back no further than
+    //  the last pawn move or capture
+    int matches = 1;    // counts current position
+    for( int i=2; i<=reversible_plies && i<=key_history_len; i+=2 )
     {
-        Move m = history[--idx];
-        if( m.src == m.dst )
-            break;  // unused history is set to zeroed memory
-        PopMove(m);
-
-        // ... looking for matching positions
-        if( white    == save_white      && // quick ones first!
-            DETAIL_EQ_KING_POSITIONS    &&
-            0 == memcmp(squares,save_squares,sizeof(squares) )
-            )
-        {
+        if( KeyHistoryKey(key_history_len-i) == key )
             matches++;
-            if( !DETAIL_EQ_ALL )    // Castling flags and/or enpassant target different?
-            {
-                // It might not be a match (but it could be - we have to unpack what the differences
-                //  really mean)
-                bool revoke_match = false;
-
-                // Revoke match if different value of en-passant target square means different
-                //  en passant possibilities
-                if( !DETAIL_EQ_EN_PASSANT )
-                {
-                    int ep_saved = (int)(tmp&0xff);
-                    int ep_now   = (int)(*DETAIL_ADDR&0xff);
-
-                    // Work out whether each en_passant is a real one, i.e. is there an opposition
-                    //  pawn in place to capture (if not it's just a double pawn advance with no
-                    //  actual enpassant consequences)
-                    bool real=false;
-                    int ep = ep_saved;
-                    char const *squ = save_squares;
-                    for( int j=0; j<2; j++ )
-                    {
-                        if( ep == 0x10 )    // 0x10 = a6
-                        {
-                             real = (squ[SE(ep)] == 'P');
-                        }
-                        else if( 0x10<ep && ep<0x17 )   // 0x10 = h6
-                        {
-                             real = (squ[SW(ep)] == 'P' || squ[SE(ep)] == 'P');
-                        }
-                        else if( ep==0x17 )
-                        {
-                             real = (squ[SW(ep)] == 'P');
-                        }
-                        else if( 0x28==ep )   // 0x28 = a3
-                        {
-                             real = (squ[NE(ep)] == 'p');
-                        }
-                        else if( 0x28<ep && ep<0x2f )   // 0x2f = h3
-                        {
-                             real = (squ[NE(ep)] == 'p' || squ[NW(ep)] == 'p');
-                        }
-                        else if( ep==0x2f )
-                        {
-                             real = (squ[NW(ep)] == 'p' );
-                        }
-                        if( j > 0 )
-                            ep_now = real?ep:0x40;      // evaluate second time through
-                        else
-                        {
-                            ep_saved = real?ep:0x40;    // evaluate first time through
-                            ep = ep_now;                // setup second time through
-                            squ = squares;
-                            real = false;
-                        }
-                    }
-
-                    // If for example one en_passant is real and the other not, it's not a real match
-                    if( ep_saved != ep_now )
-                        revoke_match = true;
-                }
-
-                // Revoke match if different value of castling flags means different
-                //  castling possibilities
-                if( !revoke_match && !DETAIL_EQ_CASTLING )
-                {
-                    bool wking_saved  = save_squares[e1]=='K' && save_squares[h1]=='R' && (int)(tmp&(WKING<<24));
-                    bool wking_now    = squares[e1]=='K' && squares[h1]=='R' && (int)(*DETAIL_ADDR&(WKING<<24));
-                    bool bking_saved  = save_squares[e8]=='k' && save_squares[h8]=='r' && (int)(tmp&(BKING<<24));
-                    bool bking_now    = squares[e8]=='k' && squares[h8]=='r' && (int)(*DETAIL_ADDR&(BKING<<24));
-                    bool wqueen_saved = save_squares[e1]=='K' && save_squares[a1]=='R' && (int)(tmp&(WQUEEN<<24));
-                    bool wqueen_now   = squares[e1]=='K' && squares[a1]=='R' && (int)(*DETAIL_ADDR&(WQUEEN<<24));
-                    bool bqueen_saved = save_squares[e8]=='k' && save_squares[a8]=='r' && (int)(tmp&(BQUEEN<<24));
-                    bool bqueen_now   = squares[e8]=='k' && squares[a8]=='r' && (int)(*DETAIL_ADDR&(BQUEEN<<24));
-                    revoke_match = ( wking_saved != wking_now ||
-                                     bking_saved != bking_now ||
-                                     wqueen_saved != wqueen_now ||
-                                     bqueen_saved != bqueen_now );
-                }
-
-                // If the real castling or enpassant possibilities differ, it's not a match
-                //  At one stage we just did a naive binary match of the details - not good enough. For example
-                //  a rook moving away from h1 doesn't affect the WKING flag, but does disallow white king side
-                //  castling
-                if( revoke_match )
-                     matches--;
-            }
-        }
-
-        // For performance reasons, abandon search early if pawn move
-        //  or capture
-        if( squares[m.src]=='P' || squares[m.src]=='p' || !IsEmptySquare(m.capture) )
-            break;
     }
-
-    // Restore current position
-    memcpy( squares, save_squares, sizeof(squares) );
-    white      = save_white;
-    detail_idx = save_detail_idx;
-    DETAIL_RESTORE;
-    return( matches+1 );  // +1 counts original position
+    return matches;
 }
 
 /****************************************************************************
@@ -489,36 +974,16 @@ int ChessRules::GetRepetitionCount()
  ****************************************************************************/
 bool ChessRules::IsInsufficientDraw( bool white_asks, DRAWTYPE &result )
 {
-    char   piece;
-    int    piece_count=0;
-    bool   bishop_or_knight=false, lone_wking=true, lone_bking=true;
     bool   draw=false;
 
-    // Loop through the board
-    for( Square square=a8; square<=h1; ++square )
-    {
-        piece = squares[square];
-        switch( piece )
-        {
-            case 'B':
-            case 'b':
-            case 'N':
-            case 'n':       bishop_or_knight=true;  // and fall through
-            case 'Q':
-            case 'q':
-            case 'R':
-            case 'r':
-            case 'P':
-            case 'p':       piece_count++;
-                            if( isupper(piece) )
-                                lone_wking = false;
-                            else
-                                lone_bking = false;
-                            break;
-        }
-        if( !lone_wking && !lone_bking )
-            break;  // quit early for performance
-    }
+    // Count everything except the kings
+    Bitboard wmen = bb_white & ~bb_pieces[BB_WKING];
+    Bitboard bmen = bb_black & ~bb_pieces[BB_BKING];
+    int  piece_count = bb_popcount( wmen|bmen );
+    bool bishop_or_knight = (bb_pieces[BB_WBISHOP] | bb_pieces[BB_WKNIGHT] |
+                             bb_pieces[BB_BBISHOP] | bb_pieces[BB_BKNIGHT]) != 0;
+    bool lone_wking = (wmen == 0);
+    bool lone_bking = (bmen == 0);
 
     // Automatic draw if K v K or K v K+N or K v K+B
     //  (note that K+B v K+N etc. is not auto granted due to
@@ -570,115 +1035,211 @@ void ChessRules::GenMoveList( MOVELIST *l )
     // Clear move list
     l->count  = 0;   // set each field for each move
 
-    // Loop through all squares
-    for( square=a8; square<=h1; ++square )
+    // Loop through all squares occupied by a piece of the right colour
+    Bitboard occupied = bb_occupied();
+    Bitboard bb = (white ? bb_white : bb_black);
+    while( bb )
     {
-
-        // If square occupied by a piece of the right colour
+        square = bb_pop_lsb(bb);
         char piece=squares[square];
-        if( (white&&IsWhite(piece)) || (!white&&IsBlack(piece)) )
-        {
 
-            // Generate moves according to the occupying piece
-            switch( piece )
+        // Generate moves according to the occupying piece
+        switch( piece )
+        {
+            case 'P':
             {
-                case 'P':
-                {
-                    WhitePawnMoves( l, square );
-                    break;
-                }
-                case 'p':
-                {
-                    BlackPawnMoves( l, square );
-                    break;
-                }
-                case 'N':
-                case 'n':
-                {
-                    const lte *ptr = knight_lookup[square];
-                    ShortMoves( l, square, ptr, NOT_SPECIAL );
-                    break;
-                }
-                case 'B':
-                case 'b':
-                {
-                    const lte *ptr = bishop_lookup[square];
-                    LongMoves( l, square, ptr );
-                    break;
-                }
-                case 'R':
-                case 'r':
-                {
-                    const lte *ptr = rook_lookup[square];
-                    LongMoves( l, square, ptr );
-                    break;
-                }
-                case 'Q':
-                case 'q':
-                {
-                    const lte *ptr = queen_lookup[square];
-                    LongMoves( l, square, ptr );
-                    break;
-                }
-                case 'K':
-                case 'k':
-                {
-                    KingMoves( l, square );
-                    break;
-                }
+                WhitePawnMoves( l, square );
+                break;
+            }
+            case 'p':
+            {
+                BlackPawnMoves( l, square );
+                break;
+            }
+            case 'N':
+            case 'n':
+            {
+                const lte *ptr = knight_lookup[square];
+                ShortMoves( l, square, ptr, NOT_SPECIAL );
+                break;
+            }
+            case 'B':
+            case 'b':
+            {
+                LongMoves( l, square, bishop_attacks_bb(square,occupied) );
+                break;
+            }
+            case 'R':
+            case 'r':
+            {
+                LongMoves( l, square, rook_attacks_bb(square,occupied) );
+                break;
+            }
+            case 'Q':
+            case 'q':
+            {
+                LongMoves( l, square, queen_attacks_bb(square,occupied) );
+                break;
+            }
+            case 'K':
+            case 'k':
+            {
+                KingMoves( l, square );
+                break;
             }
         }
     }
 }
 
+// Add a move to a list
+static inline void move_list_add( MOVELIST *l, Square src, Square dst, SPECIAL special, char capture )
+{
+    Move *m = &l->moves[l->count++];
+    m->src     = src;
+    m->dst     = dst;
+    m->special = special;
+    m->capture = capture;
+}
+
 /****************************************************************************
- * Generate moves for pieces that move along multi-move rays (B,R,Q)
+ * Create a list of captures and promotions only, (including illegally
+ *  "moving into check"), for quiescence searches
  ****************************************************************************/
-void ChessRules::LongMoves( MOVELIST *l, Square square, const lte *ptr )
+void ChessRules::GenCaptureList( MOVELIST *l )
 {
-    Move *m=&l->moves[l->count];
-    Square dst;
-    lte nbr_rays = *ptr++;
-    while( nbr_rays-- )
+    l->count = 0;
+    Bitboard occupied = bb_occupied();
+    Bitboard enemy = (white ? bb_black : bb_white);
+    Bitboard bb = (white ? bb_white : bb_black);
+    while( bb )
     {
-        lte ray_len = *ptr++;
-        while( ray_len-- )
+        Square square = bb_pop_lsb(bb);
+        Bitboard attacks = 0;
+        SPECIAL special = NOT_SPECIAL;
+        switch( squares[square] )
         {
-            dst = (Square)*ptr++;
-            char piece=squares[dst];
-
-            // If square not occupied (empty), add move to list
-            if( IsEmptySquare(piece) )
+            case 'P':
+            case 'p':
             {
-                m->src     = square;
-                m->dst     = dst;
-                m->capture = ' ';
-                m->special = NOT_SPECIAL;
-                m++;
-                l->count++;
+                bool white_pawn = (squares[square]=='P');
+                bool promotion  = (RANK(square) == (white_pawn?'7':'2'));
+                if( promotion )
+                    special = SPECIAL_PROMOTION_QUEEN;
+                attacks = (white_pawn ? pawn_white_attacks_bb[square] : pawn_black_attacks_bb[square]);
+                if( enpassant_target!=SQUARE_INVALID && (attacks&BB(enpassant_target)) )
+                    move_list_add( l, square, enpassant_target,
+                        white_pawn ? SPECIAL_WEN_PASSANT : SPECIAL_BEN_PASSANT, white_pawn ? 'p' : 'P' );
+                attacks &= enemy;
+                Square ahead = (white_pawn ? NORTH(square) : SOUTH(square));
+                if( promotion && IsEmptySquare(squares[ahead]) )
+                    move_list_add( l, square, ahead, SPECIAL_PROMOTION_QUEEN, ' ' );
+                break;
             }
+            case 'N':
+            case 'n':   attacks = knight_attacks_bb[square] & enemy;                    break;
+            case 'B':
+            case 'b':   attacks = bishop_attacks_bb(square,occupied) & enemy;           break;
+            case 'R':
+            case 'r':   attacks = rook_attacks_bb(square,occupied) & enemy;             break;
+            case 'Q':
+            case 'q':   attacks = queen_attacks_bb(square,occupied) & enemy;            break;
+            case 'K':
+            case 'k':   attacks = king_attacks_bb[square] & enemy;
+                        special = SPECIAL_KING_MOVE;                                    break;
+        }
+        while( attacks )
+        {
+            Square dst = bb_pop_lsb(attacks);
+            move_list_add( l, square, dst, special, squares[dst] );
+        }
+    }
+}
 
-            // Else must move to end of ray
-            else
+/****************************************************************************
+ * Create a list of the moves GenCaptureList() doesn't generate, ie non
+ *  captures and underpromotions, (including illegally "moving into check")
+ ****************************************************************************/
+void ChessRules::GenQuietList( MOVELIST *l )
+{
+    l->count = 0;
+    Bitboard occupied = bb_occupied();
+    Bitboard empty = ~occupied;
+    Bitboard enemy = (white ? bb_black : bb_white);
+    Bitboard bb = (white ? bb_white : bb_black);
+    while( bb )
+    {
+        Square square = bb_pop_lsb(bb);
+        Bitboard attacks = 0;
+        SPECIAL special = NOT_SPECIAL;
+        switch( squares[square] )
+        {
+            case 'P':
+            case 'p':
             {
-                ptr += ray_len;
-                ray_len = 0;
-
-                // If not occupied by our man add a capture
-                if( (white&&IsBlack(piece)) || (!white&&IsWhite(piece)) )
+                bool white_pawn = (squares[square]=='P');
+                Square ahead = (white_pawn ? NORTH(square) : SOUTH(square));
+                if( RANK(square) == (white_pawn?'7':'2') )
+                {
+                    Bitboard dsts = (white_pawn ? pawn_white_attacks_bb[square] : pawn_black_attacks_bb[square]) & enemy;
+                    if( IsEmptySquare(squares[ahead]) )
+                        dsts |= BB(ahead);
+                    while( dsts )
+                    {
+                        Square dst = bb_pop_lsb(dsts);
+                        move_list_add( l, square, dst, SPECIAL_PROMOTION_KNIGHT, squares[dst] );
+                        move_list_add( l, square, dst, SPECIAL_PROMOTION_BISHOP, squares[dst] );
+                        move_list_add( l, square, dst, SPECIAL_PROMOTION_ROOK,   squares[dst] );
+                    }
+                }
+                else if( IsEmptySquare(squares[ahead]) )
                 {
-                    m->src     = square;
-                    m->dst     = dst;
-                    m->special = NOT_SPECIAL;
-                    m->capture = piece;
-                    l->count++;
-                    m++;
+                    move_list_add( l, square, ahead, NOT_SPECIAL, ' ' );
+                    Square ahead2 = (white_pawn ? NORTH(ahead) : SOUTH(ahead));
+                    if( RANK(square)==(white_pawn?'2':'7') && IsEmptySquare(squares[ahead2]) )
+                        move_list_add( l, square, ahead2, white_pawn ? SPECIAL_WPAWN_2SQUARES : SPECIAL_BPAWN_2SQUARES, ' ' );
                 }
+                break;
             }
+            case 'N':
+            case 'n':   attacks = knight_attacks_bb[square] & empty;                    break;
+            case 'B':
+            case 'b':   attacks = bishop_attacks_bb(square,occupied) & empty;           break;
+            case 'R':
+            case 'r':   attacks = rook_attacks_bb(square,occupied) & empty;             break;
+            case 'Q':
+            case 'q':   attacks = queen_attacks_bb(square,occupied) & empty;            break;
+            case 'K':
+            case 'k':   attacks = king_attacks_bb[square] & empty;
+                        special = SPECIAL_KING_MOVE;
+                        CastlingMoves( l, square );                                     break;
+        }
+        while( attacks )
+        {
+            Square dst = bb_pop_lsb(attacks);
+            move_list_add( l, square, dst, special, ' ' );
         }
     }
 }
 
+/****************************************************************************
+ * Generate moves for pieces that move along multi-move rays (B,R,Q)
+ ****************************************************************************/
+void ChessRules::LongMoves( MOVELIST *l, Square square, Bitboard attacks )
+{
+    Move *m=&l->moves[l->count];
+    attacks &= ~(white ? bb_white : bb_black);  // can't capture our own men
+    while( attacks )
+    {
+        Square dst = bb_pop_lsb(attacks);
+        m->src     = square;
+        m->dst     = dst;
+        m->special = NOT_SPECIAL;
+        m->capture = squares[dst];   // ' ' if square not occupied
+        m++;
+        l->count++;
+    }
+}
+
 /****************************************************************************
  * Generate moves for pieces that move along single move rays (N,K)
  ****************************************************************************/
@@ -724,8 +1285,14 @@ void ChessRules::KingMoves( MOVELIST *l, Square square )
 {
     const lte *ptr = king_lookup[square];
     ShortMoves( l, square, ptr, SPECIAL_KING_MOVE );
+    CastlingMoves( l, square );
+}
 
-    // Generate castling king moves
+/****************************************************************************
+ * Generate list of castling moves
+ ****************************************************************************/
+void ChessRules::CastlingMoves( MOVELIST *l, Square square )
+{
     Move *m;
     m = &l->moves[l->count];
 
@@ -1046,11 +1613,49 @@ void ChessRules::BlackPawnMoves( MOVELIST *l, Square square )
     }
 }
 
+/****************************************************************************
+ * Push the key (and reversible plies) before a move onto the key history
+ ****************************************************************************/
+void ChessRules::KeyHistoryPush()
+{
+    KEY_HISTORY kh;
+    kh.key = key;
+    kh.reversible_plies = reversible_plies;
+    if( key_history_len < 256 )
+        key_history[key_history_len] = kh;
+    else
+        key_history_more.push_back( kh );   // keeps its capacity when popped
+    key_history_len++;
+}
+
+/****************************************************************************
+ * Pop the key history, restoring reversible plies
+ ****************************************************************************/
+void ChessRules::KeyHistoryPop()
+{
+    if( key_history_len > 0 )
+    {
+        key_history_len--;
+        reversible_plies = KeyHistoryReversiblePlies(key_history_len);
+        if( key_history_len >= 256 )
+            key_history_more.pop_back();
+    }
+}
+
 /****************************************************************************
  * Make a move (with the potential to undo)
  ****************************************************************************/
 void ChessRules::PushMove( Move& m )
 {
+    // Remember key for repetition detection, a pawn move or capture means
+    //  no earlier position can be repeated
+    KeyHistoryPush();
+    bool irreversible = (squares[m.src]=='P' || squares[m.src]=='p' || !IsEmptySquare(squares[m.dst]));
+    reversible_plies = irreversible ? 0 : reversible_plies+1;
+
+    // Castling and en passant possibilities are about to change
+    key ^= KeyCastlingEnpassant();
+
     // Push old details onto stack
     DETAIL_PUSH;
 
@@ -1067,16 +1672,23 @@ void ChessRules::PushMove( Move& m )
                     //  castling remains prohibited).
     enpassant_target = SQUARE_INVALID;
 
+    // Remove captured piece (if any) from bitboards, en passant is the
+    //  exception and is handled below
+    if( !IsEmptySquare(squares[m.dst]) )
+        bb_toggle( this, squares[m.dst], BB(m.dst) );
+
     // Special handling might be required
     switch( m.special )
     {
         default:
+        bb_toggle( this, squares[m.src], BB(m.src)|BB(m.dst) );
         squares[m.dst] = squares[m.src];
         squares[m.src] = ' ';
         break;
 
         // King move updates king position in details field
         case SPECIAL_KING_MOVE:
+        bb_toggle( this, squares[m.src], BB(m.src)|BB(m.dst) );
         squares[m.dst] = squares[m.src];
         squares[m.src] = ' ';
         if( white )
@@ -1087,30 +1699,40 @@ void ChessRules::PushMove( Move& m )
 
         // In promotion case, dst piece doesn't equal src piece
         case SPECIAL_PROMOTION_QUEEN:
+        bb_toggle( this, squares[m.src], BB(m.src) );
         squares[m.src] = ' ';
         squares[m.dst] = (white?'Q':'q');
+        bb_toggle( this, squares[m.dst], BB(m.dst) );
         break;
 
         // In promotion case, dst piece doesn't equal src piece
         case SPECIAL_PROMOTION_ROOK:
+        bb_toggle( this, squares[m.src], BB(m.src) );
         squares[m.src] = ' ';
         squares[m.dst] = (white?'R':'r');
+        bb_toggle( this, squares[m.dst], BB(m.dst) );
         break;
 
         // In promotion case, dst piece doesn't equal src piece
         case SPECIAL_PROMOTION_BISHOP:
+        bb_toggle( this, squares[m.src], BB(m.src) );
         squares[m.src] = ' ';
         squares[m.dst] = (white?'B':'b');
+        bb_toggle( this, squares[m.dst], BB(m.dst) );
         break;
 
         // In promotion case, dst piece doesn't equal src piece
         case SPECIAL_PROMOTION_KNIGHT:
+        bb_toggle( this, squares[m.src], BB(m.src) );
         squares[m.src] = ' ';
         squares[m.dst] = (white?'N':'n');
+        bb_toggle( this, squares[m.dst], BB(m.dst) );
         break;
 
         // White enpassant removes pawn south of destination
         case SPECIAL_WEN_PASSANT:
+        bb_toggle( this, 'P', BB(m.src)|BB(m.dst) );
+        bb_toggle( this, 'p', BB(SOUTH(m.dst)) );
         squares[m.src] = ' ';
         squares[m.dst] = 'P';
         squares[ SOUTH(m.dst) ] = ' ';
@@ -1118,6 +1740,8 @@ void ChessRules::PushMove( Move& m )
 
         // Black enpassant removes pawn north of destination
         case SPECIAL_BEN_PASSANT:
+        bb_toggle( this, 'p', BB(m.src)|BB(m.dst) );
+        bb_toggle( this, 'P', BB(NORTH(m.dst)) );
         squares[m.src] = ' ';
         squares[m.dst] = 'p';
         squares[ NORTH(m.dst) ] = ' ';
@@ -1125,6 +1749,7 @@ void ChessRules::PushMove( Move& m )
 
         // White pawn advances 2 squares sets an enpassant target
         case SPECIAL_WPAWN_2SQUARES:
+        bb_toggle( this, 'P', BB(m.src)|BB(m.dst) );
         squares[m.src] = ' ';
         squares[m.dst] = 'P';
         enpassant_target = SOUTH(m.dst);
@@ -1132,6 +1757,7 @@ void ChessRules::PushMove( Move& m )
 
         // Black pawn advances 2 squares sets an enpassant target
         case SPECIAL_BPAWN_2SQUARES:
+        bb_toggle( this, 'p', BB(m.src)|BB(m.dst) );
         squares[m.src] = ' ';
         squares[m.dst] = 'p';
         enpassant_target = NORTH(m.dst);
@@ -1139,6 +1765,8 @@ void ChessRules::PushMove( Move& m )
 
         // Castling moves update 4 squares each
         case SPECIAL_WK_CASTLING:
+        bb_toggle( this, 'K', BB(e1)|BB(g1) );
+        bb_toggle( this, 'R', BB(h1)|BB(f1) );
         squares[e1] = ' ';
         squares[f1] = 'R';
         squares[g1] = 'K';
@@ -1146,6 +1774,8 @@ void ChessRules::PushMove( Move& m )
         wking_square = g1;
         break;
         case SPECIAL_WQ_CASTLING:
+        bb_toggle( this, 'K', BB(e1)|BB(c1) );
+        bb_toggle( this, 'R', BB(a1)|BB(d1) );
         squares[e1] = ' ';
         squares[d1] = 'R';
         squares[c1] = 'K';
@@ -1153,6 +1783,8 @@ void ChessRules::PushMove( Move& m )
         wking_square = c1;
         break;
         case SPECIAL_BK_CASTLING:
+        bb_toggle( this, 'k', BB(e8)|BB(g8) );
+        bb_toggle( this, 'r', BB(h8)|BB(f8) );
         squares[e8] = ' ';
         squares[f8] = 'r';
         squares[g8] = 'k';
@@ -1160,6 +1792,8 @@ void ChessRules::PushMove( Move& m )
         bking_square = g8;
         break;
         case SPECIAL_BQ_CASTLING:
+        bb_toggle( this, 'k', BB(e8)|BB(c8) );
+        bb_toggle( this, 'r', BB(a8)|BB(d8) );
         squares[e8] = ' ';
         squares[d8] = 'r';
         squares[c8] = 'k';
@@ -1170,6 +1804,7 @@ void ChessRules::PushMove( Move& m )
 
     // Toggle who-to-move
     Toggle();
+    key ^= (zobrist_white ^ KeyCastlingEnpassant());
 }
 
 /****************************************************************************
@@ -1177,6 +1812,12 @@ void ChessRules::PushMove( Move& m )
  ****************************************************************************/
 void ChessRules::PopMove( Move& m )
 {
+    // Key history for repetition detection
+    KeyHistoryPop();
+
+    // Castling and en passant possibilities are about to change
+    key ^= (zobrist_white ^ KeyCastlingEnpassant());
+
     // Previous detail field
     DETAIL_POP;
 
@@ -1187,8 +1828,11 @@ void ChessRules::PopMove( Move& m )
     switch( m.special )
     {
         default:
+        bb_toggle( this, squares[m.dst], BB(m.src)|BB(m.dst) );
         squares[m.src] = squares[m.dst];
         squares[m.dst] = m.capture;
+        if( !IsEmptySquare(m.capture) )
+            bb_toggle( this, m.capture, BB(m.dst) );
         break;
 
         // For promotion, src piece was a pawn
@@ -1196,15 +1840,21 @@ void ChessRules::PopMove( Move& m )
         case SPECIAL_PROMOTION_ROOK:
         case SPECIAL_PROMOTION_BISHOP:
         case SPECIAL_PROMOTION_KNIGHT:
+        bb_toggle( this, squares[m.dst], BB(m.dst) );
         if( white )
             squares[m.src] = 'P';
         else
             squares[m.src] = 'p';
+        bb_toggle( this, squares[m.src], BB(m.src) );
         squares[m.dst] = m.capture;
+        if( !IsEmptySquare(m.capture) )
+            bb_toggle( this, m.capture, BB(m.dst) );
         break;
 
         // White enpassant re-insert black pawn south of destination
         case SPECIAL_WEN_PASSANT:
+        bb_toggle( this, 'P', BB(m.src)|BB(m.dst) );
+        bb_toggle( this, 'p', BB(SOUTH(m.dst)) );
         squares[m.src] = 'P';
         squares[m.dst] = ' ';
         squares[SOUTH(m.dst)] = 'p';
@@ -1212,6 +1862,8 @@ void ChessRules::PopMove( Move& m )
 
         // Black enpassant re-insert white pawn north of destination
         case SPECIAL_BEN_PASSANT:
+        bb_toggle( this, 'p', BB(m.src)|BB(m.dst) );
+        bb_toggle( this, 'P', BB(NORTH(m.dst)) );
         squares[m.src] = 'p';
         squares[m.dst] = ' ';
         squares[NORTH(m.dst)] = 'P';
@@ -1219,30 +1871,67 @@ void ChessRules::PopMove( Move& m )
 
         // Castling moves update 4 squares each
         case SPECIAL_WK_CASTLING:
+        bb_toggle( this, 'K', BB(e1)|BB(g1) );
+        bb_toggle( this, 'R', BB(h1)|BB(f1) );
         squares[e1] = 'K';
         squares[f1] = ' ';
         squares[g1] = ' ';
         squares[h1] = 'R';
         break;
         case SPECIAL_WQ_CASTLING:
+        bb_toggle( this, 'K', BB(e1)|BB(c1) );
+        bb_toggle( this, 'R', BB(a1)|BB(d1) );
         squares[e1] = 'K';
         squares[d1] = ' ';
         squares[c1] = ' ';
         squares[a1] = 'R';
         break;
         case SPECIAL_BK_CASTLING:
+        bb_toggle( this, 'k', BB(e8)|BB(g8) );
+        bb_toggle( this, 'r', BB(h8)|BB(f8) );
         squares[e8] = 'k';
         squares[f8] = ' ';
         squares[g8] = ' ';
         squares[h8] = 'r';
         break;
         case SPECIAL_BQ_CASTLING:
+        bb_toggle( this, 'k', BB(e8)|BB(c8) );
+        bb_toggle( this, 'r', BB(a8)|BB(d8) );
         squares[e8] = 'k';
         squares[d8] = ' ';
         squares[c8] = ' ';
         squares[a8] = 'r';
         break;
     }
+    key ^= KeyCastlingEnpassant();
+}
+
+
+/****************************************************************************
+ * Make a null move, ie pass the move to the other side (for searches)
+ ****************************************************************************/
+void ChessRules::PushNullMove()
+{
+    // The positions either side of a pass can't be a repetition
+    KeyHistoryPush();
+    reversible_plies = 0;
+    key ^= KeyCastlingEnpassant();
+    DETAIL_PUSH;
+    enpassant_target = SQUARE_INVALID;
+    Toggle();
+    key ^= (zobrist_white ^ KeyCastlingEnpassant());
+}
+
+/****************************************************************************
+ * Undo a null move
+ ****************************************************************************/
+void ChessRules::PopNullMove()
+{
+    KeyHistoryPop();
+    key ^= (zobrist_white ^ KeyCastlingEnpassant());
+    DETAIL_POP;
+    Toggle();
+    key ^= KeyCastlingEnpassant();
 }
 
 
@@ -1255,63 +1944,42 @@ bool ChessRules::AttackedPiece( Square square )
     return( AttackedSquare(square,enemy_is_white) );
 }
 
+/****************************************************************************
+ * Bitboard of enemy men attacking a square, given the occupied squares
+ ****************************************************************************/
+Bitboard ChessRules::AttackersTo( Square square, bool enemy_is_white, Bitboard occupied )
+{
+    const Bitboard *enemy = &bb_pieces[ enemy_is_white ? BB_WPAWN : BB_BPAWN ];
+    return (knight_attacks_bb[square] & enemy[BB_WKNIGHT])
+         | (king_attacks_bb[square]   & enemy[BB_WKING])
+         | ((enemy_is_white ? pawn_black_attacks_bb[square] : pawn_white_attacks_bb[square]) & enemy[BB_WPAWN])
+         | (bishop_attacks_bb(square,occupied) & (enemy[BB_WBISHOP]|enemy[BB_WQUEEN]))
+         | (rook_attacks_bb(square,occupied)   & (enemy[BB_WROOK]  |enemy[BB_WQUEEN]));
+}
+
 /****************************************************************************
  * Is a square is attacked by enemy ?
  ****************************************************************************/
 bool ChessRules::AttackedSquare( Square square, bool enemy_is_white )
 {
-    Square dst;
-    const lte *ptr = (enemy_is_white ? attacks_black_lookup[square] : attacks_white_lookup[square] );
-    lte nbr_rays = *ptr++;
-    while( nbr_rays-- )
-    {
-        lte ray_len = *ptr++;
-        while( ray_len-- )
-        {
-            dst = (Square)*ptr++;
-            char piece=squares[dst];
-
-            // If square not occupied (empty), continue
-            if( IsEmptySquare(piece) )
-                ptr++;  // skip mask
-
-            // Else if occupied
-            else
-            {
-                lte mask = *ptr++;
-
-                // White attacker ?
-                if( IsWhite(piece) && enemy_is_white )
-                {
-                    if( to_mask[piece] & mask )
-                        return true;
-                }
-
-                // Black attacker ?
-                else if( IsBlack(piece) && !enemy_is_white )
-                {
-                    if( to_mask[piece] & mask )
-                        return true;
-                }
-
-                // Goto end of ray
-                ptr += (2*ray_len);
-                ray_len = 0;
-            }
-        }
-    }
-
-    ptr = knight_lookup[square];
-    lte nbr_squares = *ptr++;
-    while( nbr_squares-- )
-    {
-        dst = (Square)*ptr++;
-        char piece=squares[dst];
-
-        // If occupied by an enemy knight, we have found an attacker
-        if( (enemy_is_white&&piece=='N') || (!enemy_is_white&&piece=='n') )
-            return true;
-    }
+    const Bitboard *enemy = &bb_pieces[ enemy_is_white ? BB_WPAWN : BB_BPAWN ];
+
+    // Short range attackers are a simple bitboard intersection. Note that a
+    //  pawn attacks square from the squares an opposite colour pawn on
+    //  square would attack
+    if( knight_attacks_bb[square] & enemy[BB_WKNIGHT] )
+        return true;
+    if( king_attacks_bb[square] & enemy[BB_WKING] )
+        return true;
+    if( (enemy_is_white ? pawn_black_attacks_bb[square] : pawn_white_attacks_bb[square]) & enemy[BB_WPAWN] )
+        return true;
+
+    // Long range attackers, look back from square as a bishop and a rook
+    Bitboard occupied = bb_occupied();
+    if( bishop_attacks_bb(square,occupied) & (enemy[BB_WBISHOP]|enemy[BB_WQUEEN]) )
+        return true;
+    if( rook_attacks_bb(square,occupied) & (enemy[BB_WROOK]|enemy[BB_WQUEEN]) )
+        return true;
     return false;
 }
 
@@ -1332,9 +2000,6 @@ bool ChessRules::Evaluate( TERMINAL &score_terminal )
 
 bool ChessRules::Evaluate( MOVELIST *p, TERMINAL &score_terminal )
 {
-    /* static ;remove for thread safety */ MOVELIST local_list;
-    MOVELIST &list = p?*p:local_list;
-    int i, any;
     Square my_king, enemy_king;
     bool okay;
     score_terminal=NOT_TERMINAL;
@@ -1352,18 +2017,11 @@ bool ChessRules::Evaluate( MOVELIST *p, TERMINAL &score_terminal )
         okay = true;
 
         // Work out if the game is over by checking for any legal moves
-        GenMoveList( &list );
-        for( any=i=0 ; i<list.count && any==0 ; i++ )
-        {
-            PushMove( list.moves[i] );
-            my_king = (Square)(white ? bking_square : wking_square);
-            if( !AttackedPiece(my_king) )
-                any++;
-            PopMove( list.moves[i] );
-        }
+        if( p )
+            GenMoveList( p );
 
         // If no legal moves, position is either checkmate or stalemate
-        if( any == 0 )
+        if( !HasLegalMove() )
         {
             my_king = (Square)(white ? wking_square : bking_square);
             if( AttackedPiece(my_king) )
@@ -1448,6 +2106,7 @@ void ChessRules::Transform()
             }
         }
     }
+    BitboardsCalculate();
 }
 
 
@@ -31,6 +31,9 @@ public:
         history[0].src = a8;   // (look backwards through history stops when src==dst)
         history[0].dst = a8;
         detail_idx =0;
+        key_history_len = 0;
+        key_history_more.clear();
+        reversible_plies = 0;
     }
 
     // Copy constructor
@@ -53,6 +56,7 @@ public:
     bool TestInternals( int (*log)(const char *,...) = NULL );
 
     // Initialise from Forsyth string
+    using ChessPosition::Forsyth;
     bool Forsyth( const char *txt )
     {
         bool okay = ChessPosition::Forsyth(txt);
@@ -109,24 +113,63 @@ public:
                                            bool mate[MAXMOVES],
                                            bool stalemate[MAXMOVES] );
 
+    // Convert a list of legal moves in this position (eg from
+    //  GenLegalMoveList()) to natural strings, eg "Nf3", all at once. The
+    //  same as Move::NaturalOut() for each move, but a lot cheaper
+    void NaturalOutAll( const MOVELIST &list, char out[][NATURAL_MOVE_SIZE] );
+
+    // Create a list of captures and promotions only, (including illegally
+    //  "moving into check"), for quiescence searches. Promotions are to
+    //  queen only, underpromotions count as quiet moves here
+    void GenCaptureList( MOVELIST *list );
+
+    // Create a list of the moves GenCaptureList() doesn't generate, ie non
+    //  captures and underpromotions, (including illegally "moving into check")
+    void GenQuietList( MOVELIST *list );
+
+    // Is a move (eg a hash move, or one made up from a user's input) legal
+    //  in this position ? A lot cheaper than generating all the legal moves
+    //  and looking for it. The move must be exactly as GenLegalMoveList()
+    //  would generate it, including special and capture
+    bool IsLegalMove( Move mv );
+
+    // Is a move legal apart from possibly leaving the king in check, ie
+    //  could it have been generated by GenMoveList() in this position ?
+    bool IsPseudoLegal( Move mv );
+
+    // Count the legal moves in this position, without generating them
+    int  CountLegalMoves();
+
+    // Is there at least one legal move ? (stops looking at the first one)
+    bool HasLegalMove();
+
     // Make a move (with the potential to undo)
     void PushMove( Move& m );
 
     // Undo a move
     void PopMove( Move& m );
 
+    // Make a null move, ie pass the move to the other side (for searches)
+    void PushNullMove();
+
+    // Undo a null move
+    void PopNullMove();
+
     // Test fundamental internal assumptions and operations
     void TestInternals();
 
 // Private stuff
 protected:
+    friend class MovePicker;
+    friend class Move;
 
     // Generate a list of all possible moves in a position (including
     //  illegally "moving into check")
     void GenMoveList( MOVELIST *l );
 
-    // Generate moves for pieces that move along multi-move rays (B,R,Q)
-    void LongMoves( MOVELIST *l, Square square, const lte *ptr );
+    // Generate moves for pieces that move along multi-move rays (B,R,Q),
+    //  given the squares the piece attacks
+    void LongMoves( MOVELIST *l, Square square, Bitboard attacks );
 
     // Generate moves for pieces that move along single-move rays (K,N,P)
     void ShortMoves( MOVELIST *l, Square square, const lte *ptr, SPECIAL special  );
@@ -134,6 +177,9 @@ protected:
     // Generate list of king moves
     void KingMoves( MOVELIST *l, Square square );
 
+    // Generate list of castling moves
+    void CastlingMoves( MOVELIST *l, Square square );
+
     // Generate list of white pawn moves
     void WhitePawnMoves( MOVELIST *l, Square square );
 
@@ -143,6 +189,38 @@ protected:
     // Evaluate a position, returns bool okay (not okay means illegal position)
     bool Evaluate( MOVELIST *list, TERMINAL &score_terminal );
 
+    // Find the men pinned against our king, and the squares a man other
+    //  than the king must move to if we are in check
+    void LegalityMasks( Bitboard &pinned, Bitboard &evasions );
+
+    // Is a pseudo-legal move legal ? (given the LegalityMasks())
+    bool PseudoLegalIsLegal( Move mv, Bitboard pinned, Bitboard evasions );
+
+    // Count legal moves, optionally stopping at the first one
+    int  LegalMoveCount( bool stop_at_first );
+
+    // Find whether each of a list of legal moves gives check, mate or
+    //  stalemate
+    void GenCheckInfo( const MOVELIST &list, bool check[], bool mate[], bool stalemate[] );
+
+    // Bitboard of enemy men attacking a square, given the occupied squares
+    //  (so men can be treated as removed, eg the king when it moves)
+    Bitboard AttackersTo( Square square, bool enemy_is_white, Bitboard occupied );
+
+    // Push the current key onto the key history, and pop it
+    void KeyHistoryPush();
+    void KeyHistoryPop();
+
+    // Key history entry i (0 is the oldest)
+    uint64_t KeyHistoryKey( int i ) const
+    {
+        return i<256 ? key_history[i].key : key_history_more[i-256].key;
+    }
+    int KeyHistoryReversiblePlies( int i ) const
+    {
+        return i<256 ? key_history[i].reversible_plies : key_history_more[i-256].reversible_plies;
+    }
+
     //### Data
 
     // Move history is a ring array
@@ -152,6 +230,20 @@ protected:
     // Detail stack is a ring array
     DETAIL detail_stack[256];           // must be 256 ..
     unsigned char detail_idx;           // .. so this loops around naturally
+
+    // Key history is a stack, one entry for each PushMove() not yet undone
+    //  by PopMove(), used for repetition detection. It isn't capped, but
+    //  the first 256 entries are in an array, so ChessRules (and copies of
+    //  it) only allocate memory once there are more
+    struct KEY_HISTORY
+    {
+        uint64_t key;                   // key before the move
+        int      reversible_plies;      // reversible_plies before the move
+    };
+    KEY_HISTORY key_history[256];       // the first 256 entries ..
+    std::vector<KEY_HISTORY> key_history_more;  // .. then the rest, grown as needed and reused
+    int key_history_len;                // number of entries
+    int reversible_plies;               // plies since last pawn move or capture
 };
 
 } //namespace thc
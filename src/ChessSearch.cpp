@@ -0,0 +1,546 @@
+/****************************************************************************
+ * ChessSearch.cpp Chess classes - Alpha-beta search built on ChessEvaluation
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#define _CRT_SECURE_NO_WARNINGS
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include "ChessSearch.h"
+#include "MovePicker.h"
+#include "PrivateChessDefs.h"
+using namespace std;
+using namespace thc;
+
+// Scores are in EvaluateLeaf() units, material*4 + positional, so a pawn
+//  is worth 40. Mate scores are MATE less the distance to mate in plies, as
+//  in ChessEvaluation::Quiesce()
+#define SEARCH_INFINITY     ((int)ChessEvaluation::QUIESCE_INFINITY)
+#define SEARCH_MATE         ((int)ChessEvaluation::QUIESCE_MATE)
+#define SEARCH_MATE_BOUND   (SEARCH_MATE-MAX_PLY)
+#define SEARCH_ASPIRATION   20
+
+/****************************************************************************
+ * Constructor
+ ****************************************************************************/
+Search::Search( int hash_megabytes )
+{
+    stop = false;
+    tt = NULL;
+    tt_generation = 0;
+    SetThreads( 1 );
+    SetHashSize( hash_megabytes );
+}
+
+/****************************************************************************
+ * Destructor
+ ****************************************************************************/
+Search::~Search()
+{
+    SetThreads( 0 );
+    delete[] tt;
+}
+
+/****************************************************************************
+ * Resize the transposition table (also clears it)
+ ****************************************************************************/
+void Search::SetHashSize( int megabytes )
+{
+    size_t nbr = 1;
+    size_t bytes = (size_t)(megabytes<1 ? 1 : megabytes) * 1024 * 1024;
+    while( nbr*2*sizeof(TT_BUCKET) <= bytes )
+        nbr *= 2;
+    delete[] tt;
+    tt = new TT_BUCKET[nbr];
+    tt_mask = nbr-1;
+    Clear();
+}
+
+/****************************************************************************
+ * Number of threads, main thread plus helpers
+ ****************************************************************************/
+void Search::SetThreads( int nbr )
+{
+    while( (int)threads.size() > nbr )
+    {
+        delete threads.back();
+        threads.pop_back();
+    }
+    while( (int)threads.size() < nbr )
+    {
+        THREAD_DATA *td = new THREAD_DATA;
+        td->search = this;
+        td->id = (int)threads.size();
+        memset( td->killers, 0, sizeof(td->killers) );
+        memset( td->history, 0, sizeof(td->history) );
+        threads.push_back( td );
+    }
+}
+
+/****************************************************************************
+ * Forget everything learnt from previous searches
+ ****************************************************************************/
+void Search::Clear()
+{
+    for( uint64_t i=0; i<=tt_mask; i++ )
+    {
+        for( int j=0; j<8; j++ )
+            tt[i].entries[j].data.store( 0, memory_order_relaxed );
+    }
+    for( unsigned int i=0; i<threads.size(); i++ )
+    {
+        memset( threads[i]->killers, 0, sizeof(threads[i]->killers) );
+        memset( threads[i]->history, 0, sizeof(threads[i]->history) );
+    }
+}
+
+/****************************************************************************
+ * Search a position, game history is respected for repetitions
+ ****************************************************************************/
+SearchResult Search::Go( const ChessRules &position, const SearchLimits &limits_ )
+{
+    SearchResult result;
+    result.best_move.Invalid();
+    result.score_cp = 0;
+    result.mate = 0;
+    result.depth = 0;
+    result.nodes = 0;
+    result.main_nodes = 0;
+    result.millisecs = 0;
+    limits = limits_;
+    nodes_shared = 0;
+    stop = false;
+    can_stop = false;
+    start_time = chrono::duration_cast<chrono::milliseconds>(
+                    chrono::steady_clock::now().time_since_epoch() ).count();
+    tt_generation++;
+
+    // Copy as a ChessRules so the key history (for repetitions) comes along,
+    //  plan once then give every thread its own copy
+    THREAD_DATA *main_td = threads[0];
+    static_cast<ChessRules&>(main_td->cr) = position;
+    main_td->cr.Planning();
+    for( unsigned int i=0; i<threads.size(); i++ )
+    {
+        THREAD_DATA *td = threads[i];
+        if( i > 0 )
+            td->cr = main_td->cr;
+        td->nodes = 0;
+        memset( td->killers, 0, sizeof(td->killers) );
+        for( int j=0; j<2; j++ )
+        {
+            for( int k=0; k<64; k++ )
+            {
+                for( int l=0; l<64; l++ )
+                    td->history[j][k][l] /= 8;
+            }
+        }
+    }
+    MOVELIST list;
+    main_td->cr.GenLegalMoveList( &list );
+    if( list.count == 0 )
+        return result;
+    result.best_move = list.moves[0];
+
+    // Helpers run until the main thread is done
+    std::vector<std::thread> helpers;
+    for( unsigned int i=1; i<threads.size(); i++ )
+        helpers.push_back( std::thread( &Search::IterativeDeepening, this, threads[i], (SearchResult *)NULL ) );
+    IterativeDeepening( main_td, &result );
+    stop = true;
+    for( unsigned int i=0; i<helpers.size(); i++ )
+        helpers[i].join();
+    for( unsigned int i=0; i<threads.size(); i++ )
+        result.nodes += threads[i]->nodes;
+    result.main_nodes = main_td->nodes;
+    result.millisecs = Elapsed();
+    return result;
+}
+
+/****************************************************************************
+ * Iterative deepening, main thread fills in result. Helper threads start
+ *  at staggered depths, so that the threads spread out over the tree
+ ****************************************************************************/
+void Search::IterativeDeepening( THREAD_DATA *td, SearchResult *result )
+{
+    int max_depth = MAX_DEPTH;
+    if( td->id==0 && limits.depth>0 && limits.depth<MAX_DEPTH )
+        max_depth = limits.depth;
+    int score = 0;
+    for( int depth=1+(td->id&1); depth<=max_depth; depth++ )
+    {
+        // Aspiration window around the previous iteration's score, widened
+        //  on failure
+        int delta = SEARCH_ASPIRATION;
+        int alpha = -SEARCH_INFINITY;
+        int beta  =  SEARCH_INFINITY;
+        if( depth >= 4 )
+        {
+            alpha = max( score-delta, -SEARCH_INFINITY );
+            beta  = min( score+delta,  SEARCH_INFINITY );
+        }
+        int iteration_score;
+        for(;;)
+        {
+            iteration_score = AlphaBeta( *td, alpha, beta, depth, 0, false );
+            if( stop )
+                break;
+            delta *= 4;
+            if( iteration_score <= alpha )
+                alpha = max( iteration_score-delta, -SEARCH_INFINITY );
+            else if( iteration_score >= beta )
+                beta  = min( iteration_score+delta,  SEARCH_INFINITY );
+            else
+                break;
+        }
+        if( stop )
+            break;
+        score = iteration_score;
+        if( !result )
+            continue;
+
+        // Main thread iteration completed
+        can_stop = true;
+        result->depth = depth;
+        result->pv.clear();
+        for( int i=0; i<td->pv_len[0]; i++ )
+            result->pv.push_back( td->pv[0][i] );
+        if( result->pv.size() > 0 )
+            result->best_move = result->pv[0];
+        if( score >= SEARCH_MATE_BOUND )
+        {
+            result->mate = (SEARCH_MATE-score+1)/2;
+            result->score_cp = 100000;
+        }
+        else if( score <= -SEARCH_MATE_BOUND )
+        {
+            result->mate = -(SEARCH_MATE+score)/2;
+            result->score_cp = -100000;
+        }
+        else
+        {
+            result->mate = 0;
+            result->score_cp = score*10/4;
+        }
+
+        // No point looking deeper once a forced mate is found
+        if( result->mate!=0 && depth > 2*abs(result->mate) )
+            break;
+        CheckLimits();
+        if( stop )
+            break;
+    }
+}
+
+/****************************************************************************
+ * Principal variation search, score from side to move's point of view
+ ****************************************************************************/
+int Search::AlphaBeta( THREAD_DATA &td, int alpha, int beta, int depth, int ply, bool null_ok )
+{
+    ChessEvaluation &cr = td.cr;
+    td.pv_len[ply] = ply;
+
+    // Draws by repetition or insufficient material
+    if( ply > 0 )
+    {
+        DRAWTYPE draw_type;
+        if( cr.GetRepetitionCount() >= 2 )
+            return 0;
+        if( cr.IsInsufficientDraw(cr.white,draw_type) && draw_type==DRAWTYPE_INSUFFICIENT_AUTO )
+            return 0;
+    }
+    if( ply >= MAX_PLY-1 )
+        return Evaluate( td );
+
+    // Extend checks, so quiescence never starts with the king in check
+    bool in_check = cr.AttackedPiece( cr.white ? cr.wking_square : cr.bking_square );
+    if( in_check )
+        depth++;
+    if( depth <= 0 )
+        return cr.Quiesce( alpha, beta, ply, &td );
+    CountNode( td );
+    if( stop )
+        return 0;
+    bool pv_node = (beta-alpha > 1);
+
+    // Transposition table
+    Move tt_move;
+    tt_move.Invalid();
+    TT_DATA entry;
+    if( Probe( cr.key, entry ) )
+    {
+        tt_move = entry.move.Unpack( cr );
+        int tt_score = entry.score;
+        if( tt_score >= SEARCH_MATE_BOUND )
+            tt_score -= ply;
+        else if( tt_score <= -SEARCH_MATE_BOUND )
+            tt_score += ply;
+        if( !pv_node && ply>0 && entry.depth>=depth )
+        {
+            if( entry.bound == BOUND_EXACT ||
+               (entry.bound == BOUND_LOWER && tt_score >= beta) ||
+               (entry.bound == BOUND_UPPER && tt_score <= alpha) )
+                return tt_score;
+        }
+    }
+
+    // Null move pruning, if passing still fails high the position is good
+    //  enough. Not when in check, and not with only king and pawns
+    //  (zugzwang)
+    if( null_ok && !pv_node && !in_check && depth>=3 && beta<SEARCH_MATE_BOUND )
+    {
+        Bitboard pieces = cr.white ?
+            (cr.bb_pieces[BB_WKNIGHT]|cr.bb_pieces[BB_WBISHOP]|cr.bb_pieces[BB_WROOK]|cr.bb_pieces[BB_WQUEEN]) :
+            (cr.bb_pieces[BB_BKNIGHT]|cr.bb_pieces[BB_BBISHOP]|cr.bb_pieces[BB_BROOK]|cr.bb_pieces[BB_BQUEEN]);
+        if( pieces )
+        {
+            int r = 2 + depth/4;
+            cr.PushNullMove();
+            int score = -AlphaBeta( td, -beta, -beta+1, depth-1-r, ply+1, false );
+            cr.PopNullMove();
+            if( stop )
+                return 0;
+            if( score >= beta )
+                return beta;
+        }
+    }
+
+    // Search the moves, the first with a full window, then the rest with a
+    //  null window and late quiet moves at reduced depth, re-searching
+    //  if they turn out better than expected
+    int alpha_original = alpha;
+    int best_score = -SEARCH_INFINITY;
+    Move best_move;
+    best_move.Invalid();
+    int side = cr.white ? 0 : 1;
+    MovePicker picker( cr, tt_move, td.killers[ply], 2, td.history[side] );
+    Move mv;
+    int i;
+    for( i=0; picker.Next(mv); i++ )
+    {
+        bool quiet = (IsEmptySquare(mv.capture) && (mv.special<SPECIAL_PROMOTION_QUEEN || mv.special>SPECIAL_PROMOTION_KNIGHT));
+        cr.PushMove( mv );
+        bool gives_check = cr.AttackedPiece( cr.white ? cr.wking_square : cr.bking_square );
+        int score;
+        if( i == 0 )
+            score = -AlphaBeta( td, -beta, -alpha, depth-1, ply+1, true );
+        else
+        {
+            int reduction = 0;
+            if( depth>=3 && i>=3 && quiet && !in_check && !gives_check &&
+                mv!=td.killers[ply][0] && mv!=td.killers[ply][1] )
+            {
+                reduction = (i>=8 && !pv_node) ? 2 : 1;
+                if( reduction > depth-2 )
+                    reduction = depth-2;
+            }
+            score = -AlphaBeta( td, -alpha-1, -alpha, depth-1-reduction, ply+1, true );
+            if( score>alpha && reduction>0 )
+                score = -AlphaBeta( td, -alpha-1, -alpha, depth-1, ply+1, true );
+            if( score>alpha && score<beta )
+                score = -AlphaBeta( td, -beta, -alpha, depth-1, ply+1, true );
+        }
+        cr.PopMove( mv );
+        if( stop )
+            return 0;
+        if( score > best_score )
+        {
+            best_score = score;
+            best_move  = mv;
+            if( score > alpha )
+            {
+                alpha = score;
+                td.pv[ply][ply] = mv;
+                for( int j=ply+1; j<td.pv_len[ply+1]; j++ )
+                    td.pv[ply][j] = td.pv[ply+1][j];
+                td.pv_len[ply] = td.pv_len[ply+1]>ply+1 ? td.pv_len[ply+1] : ply+1;
+                if( alpha >= beta )
+                {
+                    if( quiet )
+                    {
+                        if( mv != td.killers[ply][0] )
+                        {
+                            td.killers[ply][1] = td.killers[ply][0];
+                            td.killers[ply][0] = mv;
+                        }
+                        td.history[side][mv.src][mv.dst] += depth*depth;
+                        if( td.history[side][mv.src][mv.dst] > 1000000 )
+                        {
+                            for( int j=0; j<64; j++ )
+                            {
+                                for( int k=0; k<64; k++ )
+                                    td.history[side][j][k] /= 2;
+                            }
+                        }
+                    }
+                    break;
+                }
+            }
+        }
+    }
+
+    // Mate or stalemate if there were no moves
+    if( best_score == -SEARCH_INFINITY )
+        return in_check ? -SEARCH_MATE+ply : 0;
+    int bound = best_score>=beta ? BOUND_LOWER : (best_score>alpha_original ? BOUND_EXACT : BOUND_UPPER);
+    Store( cr.key, best_move, best_score, depth, bound, ply );
+    return best_score;
+}
+
+/****************************************************************************
+ * Count nodes, checking limits every so often
+ ****************************************************************************/
+void Search::CountNode( THREAD_DATA &td )
+{
+    td.nodes++;
+    if( (td.nodes&1023) == 0 )
+    {
+        nodes_shared += 1024;
+        if( td.id==0 && can_stop )
+            CheckLimits();
+    }
+}
+
+/****************************************************************************
+ * Score the side to move's position without searching further
+ ****************************************************************************/
+int Search::Evaluate( THREAD_DATA &td )
+{
+    ChessEvaluation &cr = td.cr;
+    int material, positional;
+    cr.EvaluateLeaf( material, positional );
+    int score = material*4 + positional;    // balance = 4, as in GenLegalMoveListSorted()
+    return cr.white ? score : -score;
+}
+
+/****************************************************************************
+ * ChessEvaluation::Quiesce() is searching a node, count it
+ *  return bool stop
+ ****************************************************************************/
+bool Search::THREAD_DATA::Node( int ply )
+{
+    pv_len[ply] = ply;
+    search->CountNode( *this );
+    return search->stop;
+}
+
+/****************************************************************************
+ * Is ChessEvaluation::Quiesce() to stop ?
+ ****************************************************************************/
+bool Search::THREAD_DATA::Stopping()
+{
+    return search->stop;
+}
+
+/****************************************************************************
+ * ChessEvaluation::Quiesce() found a better move at ply, it and the PV
+ *  from ply+1 are the PV from ply
+ ****************************************************************************/
+void Search::THREAD_DATA::BestMove( int ply, Move mv )
+{
+    pv[ply][ply] = mv;
+    for( int j=ply+1; j<pv_len[ply+1]; j++ )
+        pv[ply][j] = pv[ply+1][j];
+    pv_len[ply] = pv_len[ply+1]>ply+1 ? pv_len[ply+1] : ply+1;
+}
+
+/****************************************************************************
+ * Odd numbered helper threads break ChessEvaluation::Quiesce() move
+ *  ordering ties the other way, for variety
+ ****************************************************************************/
+bool Search::THREAD_DATA::ReverseTies()
+{
+    return (id&1) != 0;
+}
+
+/****************************************************************************
+ * Check time and node limits, set stop if exceeded
+ ****************************************************************************/
+void Search::CheckLimits()
+{
+    if( limits.nodes>0 && nodes_shared>=limits.nodes )
+        stop = true;
+    if( limits.millisecs>0 && Elapsed()>=limits.millisecs )
+        stop = true;
+}
+
+/****************************************************************************
+ * Elapsed time since search started
+ ****************************************************************************/
+int Search::Elapsed()
+{
+    long long now = chrono::duration_cast<chrono::milliseconds>(
+                        chrono::steady_clock::now().time_since_epoch() ).count();
+    return (int)(now-start_time);
+}
+
+/****************************************************************************
+ * Transposition table access. Data is packed as move (a PackedMove, 16
+ *  bits), score (16), depth (8), bound (2), generation (6) and the top 16
+ *  bits of the key. The low bits of the key pick the bucket. The generation
+ *  lets us prefer to replace entries left over from previous searches
+ ****************************************************************************/
+bool Search::Probe( uint64_t key, TT_DATA &tt_data )
+{
+    TT_BUCKET &bucket = tt[key&tt_mask];
+    uint16_t key16 = (uint16_t)(key>>48);
+    for( int i=0; i<8; i++ )
+    {
+        uint64_t data = bucket.entries[i].data.load( memory_order_relaxed );
+        if( (uint16_t)(data>>48)==key16 && ((data>>40)&3)!=BOUND_NONE )
+        {
+            tt_data.move.bits = (uint16_t)data;
+            tt_data.score = (int16_t)(data>>16);
+            tt_data.depth = (int8_t)(data>>32);
+            tt_data.bound = (int)((data>>40)&3);
+            return true;
+        }
+    }
+    return false;
+}
+
+void Search::Store( uint64_t key, Move move, int score, int depth, int bound, int ply )
+{
+    // Replace the same position (unless it's deeper and we're not exact),
+    //  otherwise the shallowest entry, treating old entries as shallow
+    TT_BUCKET &bucket = tt[key&tt_mask];
+    uint16_t key16 = (uint16_t)(key>>48);
+    TT_ENTRY *replace = NULL;
+    int replace_value = 0;
+    for( int i=0; i<8; i++ )
+    {
+        TT_ENTRY *entry = &bucket.entries[i];
+        uint64_t data = entry->data.load( memory_order_relaxed );
+        int entry_depth = (int8_t)(data>>32);
+        if( (uint16_t)(data>>48)==key16 && ((data>>40)&3)!=BOUND_NONE )
+        {
+            if( entry_depth>depth && bound!=BOUND_EXACT )
+                return;
+            replace = entry;
+            break;
+        }
+        int age = (int)((tt_generation - (unsigned int)(data>>42)) & 63);
+        int value = ((data>>40)&3)==BOUND_NONE ? -1000 : entry_depth - 8*age;
+        if( replace==NULL || value<replace_value )
+        {
+            replace = entry;
+            replace_value = value;
+        }
+    }
+    if( score >= SEARCH_MATE_BOUND )
+        score += ply;
+    else if( score <= -SEARCH_MATE_BOUND )
+        score -= ply;
+    PackedMove packed;
+    packed.Pack( move );
+    uint64_t data = (uint64_t)packed.bits
+                  | ((uint64_t)(uint16_t)score << 16)
+                  | ((uint64_t)(uint8_t)depth << 32)
+                  | ((uint64_t)bound << 40)
+                  | ((uint64_t)(tt_generation&63) << 42)
+                  | ((uint64_t)key16 << 48);
+    replace->data.store( data, memory_order_relaxed );
+}
@@ -0,0 +1,155 @@
+/****************************************************************************
+ * ChessSearch.h Chess classes - Alpha-beta search built on ChessEvaluation
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#ifndef CHESSSEARCH_H
+#define CHESSSEARCH_H
+#include <atomic>
+#include "ChessEvaluation.h"
+#include "Move.h"
+
+// TripleHappyChess
+namespace thc
+{
+
+// Limits on a search, zero means no limit (a search always completes at
+//  least depth 1, and never goes deeper than Search::MAX_DEPTH)
+struct SearchLimits
+{
+    int       depth;            // iterations of iterative deepening
+    long long nodes;
+    int       millisecs;
+    SearchLimits() : depth(0), nodes(0), millisecs(0) {}
+};
+
+// The result of a search, the score is from the point of view of the side
+//  to move
+struct SearchResult
+{
+    Move              best_move;        // Invalid() if no legal moves
+    int               score_cp;         // centipawns, if mate==0
+    int               mate;             // +n = side to move mates in n, -n = gets mated in n
+    int               depth;            // last completed iteration
+    std::vector<Move> pv;               // principal variation, starting with best_move
+    long long         nodes;            // total, all threads
+    long long         main_nodes;       // main thread only (its time to depth)
+    int               millisecs;
+};
+
+// Note that ChessEvaluation::Planning() uses some global tables, so only one
+//  Search (with any number of threads) should run at a time
+class Search
+{
+public:
+    enum { MAX_DEPTH=64, MAX_PLY=ChessEvaluation::QUIESCE_MAX_PLY };
+
+    // Constructor, transposition table size in megabytes
+    Search( int hash_megabytes=16 );
+    ~Search();
+
+    // Search a position, game history is respected for repetitions
+    SearchResult Go( const ChessRules &position, const SearchLimits &limits );
+
+    // Stop a search in progress (can be called from another thread)
+    void Stop() { stop = true; }
+
+    // Resize the transposition table (also clears it)
+    void SetHashSize( int megabytes );
+
+    // Number of threads. Extra threads are helpers that search the same
+    //  position at staggered depths, sharing the transposition table
+    //  (so called Lazy SMP), only the main thread's result is reported
+    void SetThreads( int nbr );
+
+    // Forget everything learnt from previous searches
+    void Clear();
+
+// internal stuff
+private:
+
+    // Not copyable
+    Search( const Search& );
+    Search& operator=( const Search& );
+
+    // Transposition table entry, lock-free. Everything, including the top
+    //  16 bits of the key, is in a single 8 byte word, so threads' stores
+    //  can't interleave
+    struct TT_ENTRY
+    {
+        std::atomic<uint64_t> data;     // move, score, depth, bound, generation, key
+    };
+
+    // Entries are grouped so a probe touches a single cache line
+    struct alignas(64) TT_BUCKET
+    {
+        TT_ENTRY entries[8];
+    };
+
+    // Unpacked TT_ENTRY data, bound is one of BOUND_EXACT etc.
+    struct TT_DATA
+    {
+        PackedMove move;
+        int      score;
+        int      depth;
+        int      bound;
+    };
+    enum { BOUND_NONE=0, BOUND_UPPER=1, BOUND_LOWER=2, BOUND_EXACT=3 };
+
+    // Each thread has its own position, move ordering and PV. It follows
+    //  ChessEvaluation::Quiesce() to count nodes, stop and extend the PV
+    struct THREAD_DATA : public QuiesceVisitor
+    {
+        bool Node( int ply );
+        bool Stopping();
+        void BestMove( int ply, Move mv );
+        bool ReverseTies();
+
+        Search         *search;
+        int             id;             // 0 = main thread
+        ChessEvaluation cr;
+        Move            killers[MAX_PLY][2];
+        int             history[2][64][64];
+        Move            pv[MAX_PLY][MAX_PLY];
+        int             pv_len[MAX_PLY];
+        long long       nodes;
+    };
+
+    // Iterative deepening, main thread fills in result
+    void IterativeDeepening( THREAD_DATA *td, SearchResult *result );
+
+    // Principal variation search, score from side to move's point of view
+    int  AlphaBeta( THREAD_DATA &td, int alpha, int beta, int depth, int ply, bool null_ok );
+
+    // Count nodes, checking limits every so often
+    void CountNode( THREAD_DATA &td );
+
+    // Score the side to move's position without searching further
+    int  Evaluate( THREAD_DATA &td );
+
+    // Check time and node limits, set stop if exceeded
+    void CheckLimits();
+
+    // Elapsed time since search started
+    int  Elapsed();
+
+    // Transposition table access
+    bool Probe( uint64_t key, TT_DATA &tt_data );
+    void Store( uint64_t key, Move move, int score, int depth, int bound, int ply );
+
+    //### Data
+    TT_BUCKET                *tt;
+    uint64_t                  tt_mask;
+    unsigned int              tt_generation;
+    std::vector<THREAD_DATA*> threads;
+    SearchLimits              limits;
+    long long                 start_time;
+    bool                      can_stop;
+    std::atomic<long long>    nodes_shared;     // updated every 1024 nodes
+    std::atomic<bool>         stop;
+};
+
+} //namespace thc
+
+#endif //CHESSSEARCH_H
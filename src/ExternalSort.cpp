@@ -0,0 +1,579 @@
+/****************************************************************************
+ * ExternalSort.cpp Chess classes - Sort more records than fit in memory
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#define _CRT_SECURE_NO_WARNINGS
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include "ExternalSort.h"
+using namespace std;
+using namespace thc;
+
+// Digit d (0 = least significant) of a record's key, the key is key_words
+//  uint64s, most significant first
+static inline unsigned int esort_digit( const uint64_t *rec, int key_words, int d )
+{
+    return (unsigned int)(rec[key_words-1-d/8] >> (8*(d%8))) & 0xff;
+}
+
+// Compare two records' keys
+static inline int esort_compare( const uint64_t *a, const uint64_t *b, int key_words )
+{
+    for( int i=0; i<key_words; i++ )
+    {
+        if( a[i] != b[i] )
+            return a[i]<b[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+// What the radix sort's threads share
+struct ESORT_JOB
+{
+    uint64_t   *data;
+    uint64_t   *tmp;
+    size_t      nbr;
+    int         record_words;
+    int         key_words;
+    int         nbr_threads;
+    std::vector<size_t> counts;         // [thread][256], then offsets
+    size_t      bucket_start[257];
+    std::atomic<int> next_bucket;
+};
+
+// Split records [begin,end) by their most significant digit, first
+//  counting, then (once counts are offsets) copying
+static void esort_split( ESORT_JOB *job, int thread, bool scatter )
+{
+    size_t per_thread = job->nbr / job->nbr_threads;
+    size_t begin = per_thread * thread;
+    size_t end   = thread==job->nbr_threads-1 ? job->nbr : begin+per_thread;
+    int    rw = job->record_words;
+    int    top = job->key_words*8 - 1;
+    size_t *counts = &job->counts[ 256*thread ];
+    for( size_t i=begin; i<end; i++ )
+    {
+        const uint64_t *rec = job->data + i*rw;
+        unsigned int digit = esort_digit( rec, job->key_words, top );
+        if( scatter )
+            memcpy( job->tmp + (counts[digit]++)*rw, rec, rw*sizeof(uint64_t) );
+        else
+            counts[digit]++;
+    }
+}
+
+// Sort records on digit and the digits below it, the records are in src[],
+//  and end up in data[] (which is src[] if in_data, else dst[]). Most
+//  significant digit first, each digit splitting the records into buckets
+//  in the other buffer, until the buckets are small
+static void esort_msd( uint64_t *src, uint64_t *dst, size_t nbr, int digit, bool in_data,
+                       int record_words, int key_words )
+{
+    int rw = record_words;
+    if( nbr<64 || digit<0 )
+    {
+        // Insertion sort, stable
+        uint64_t rec[64];
+        for( size_t i=1; i<nbr; i++ )
+        {
+            size_t j = i;
+            memcpy( rec, src+i*rw, rw*sizeof(uint64_t) );
+            while( j>0 && esort_compare(src+(j-1)*rw,rec,key_words) > 0 )
+            {
+                memcpy( src+j*rw, src+(j-1)*rw, rw*sizeof(uint64_t) );
+                j--;
+            }
+            memcpy( src+j*rw, rec, rw*sizeof(uint64_t) );
+        }
+        if( !in_data )
+            memcpy( dst, src, nbr*rw*sizeof(uint64_t) );
+        return;
+    }
+
+    // A digit that's the same for every record needn't be sorted on
+    size_t count[256];
+    memset( count, 0, sizeof(count) );
+    for( size_t i=0; i<nbr; i++ )
+        count[ esort_digit(src+i*rw,key_words,digit) ]++;
+    if( count[esort_digit(src,key_words,digit)] == nbr )
+    {
+        esort_msd( src, dst, nbr, digit-1, in_data, record_words, key_words );
+        return;
+    }
+    size_t start[256];
+    size_t offset = 0;
+    for( int i=0; i<256; i++ )
+    {
+        start[i] = offset;
+        offset += count[i];
+    }
+    for( size_t i=0; i<nbr; i++ )
+    {
+        const uint64_t *rec = src + i*rw;
+        memcpy( dst + (start[esort_digit(rec,key_words,digit)]++)*rw, rec, rw*sizeof(uint64_t) );
+    }
+    offset = 0;
+    for( int i=0; i<256; i++ )
+    {
+        if( count[i] > 0 )
+            esort_msd( dst+offset*rw, src+offset*rw, count[i], digit-1, !in_data, record_words, key_words );
+        offset += count[i];
+    }
+}
+
+// A thread's part of the radix sort, bucket by bucket
+static void esort_buckets( ESORT_JOB *job )
+{
+    for(;;)
+    {
+        int bucket = job->next_bucket++;
+        if( bucket >= 256 )
+            break;
+        size_t begin = job->bucket_start[bucket];
+        size_t nbr   = job->bucket_start[bucket+1] - begin;
+        esort_msd( job->tmp + begin*job->record_words, job->data + begin*job->record_words, nbr,
+                   job->key_words*8-2, false, job->record_words, job->key_words );
+    }
+}
+
+/****************************************************************************
+ * Radix sort records in memory
+ ****************************************************************************/
+void ExternalSort::RadixSort( uint64_t *data, uint64_t *tmp, size_t nbr, int record_words, int key_words, int nbr_threads )
+{
+    if( nbr < 2 )
+        return;
+
+    // Only bother with threads if there's plenty to do
+    ESORT_JOB job;
+    job.data         = data;
+    job.tmp          = tmp;
+    job.nbr          = nbr;
+    job.record_words = record_words;
+    job.key_words    = key_words;
+    job.nbr_threads  = nbr_threads<1 ? 1 : nbr_threads;
+    if( (size_t)job.nbr_threads > nbr/65536 + 1 )
+        job.nbr_threads = (int)(nbr/65536 + 1);
+    job.counts.assign( 256*job.nbr_threads, 0 );
+    job.next_bucket = 0;
+
+    // Split by most significant digit into tmp[], each thread's records
+    //  going after the previous thread's, so the sort is stable
+    std::vector<std::thread> threads;
+    for( int i=1; i<job.nbr_threads; i++ )
+        threads.push_back( std::thread( esort_split, &job, i, false ) );
+    esort_split( &job, 0, false );
+    for( size_t i=0; i<threads.size(); i++ )
+        threads[i].join();
+    threads.clear();
+    size_t offset = 0;
+    for( int digit=0; digit<256; digit++ )
+    {
+        job.bucket_start[digit] = offset;
+        for( int i=0; i<job.nbr_threads; i++ )
+        {
+            size_t n = job.counts[256*i+digit];
+            job.counts[256*i+digit] = offset;
+            offset += n;
+        }
+    }
+    job.bucket_start[256] = offset;
+    for( int i=1; i<job.nbr_threads; i++ )
+        threads.push_back( std::thread( esort_split, &job, i, true ) );
+    esort_split( &job, 0, true );
+    for( size_t i=0; i<threads.size(); i++ )
+        threads[i].join();
+    threads.clear();
+
+    // Then sort the buckets, and put them back in data[]
+    for( int i=1; i<job.nbr_threads; i++ )
+        threads.push_back( std::thread( esort_buckets, &job ) );
+    esort_buckets( &job );
+    for( size_t i=0; i<threads.size(); i++ )
+        threads[i].join();
+}
+
+/****************************************************************************
+ * Constructor
+ ****************************************************************************/
+ExternalSort::ExternalSort()
+{
+    memory       = 256*1024*1024;
+    nbr_threads  = (int)std::thread::hardware_concurrency();
+    if( nbr_threads < 1 )
+        nbr_threads = 1;
+    max_merge    = 128;
+    record_words = 1;
+    key_words    = 1;
+    nbr_records  = 0;
+    nbr_runs     = 0;
+    capacity     = 0;
+    combine      = false;
+    error        = false;
+    sorted       = false;
+    next         = 0;
+}
+
+/****************************************************************************
+ * Destructor
+ ****************************************************************************/
+ExternalSort::~ExternalSort()
+{
+    End();
+}
+
+/****************************************************************************
+ * Start sorting
+ *  return bool okay
+ ****************************************************************************/
+bool ExternalSort::Begin( int record_words_, int key_words_, const char *temp_filename_ )
+{
+    End();
+    if( record_words_<1 || record_words_>64 || key_words_<1 || key_words_>8 || key_words_>record_words_ )
+        return false;
+    if( combine && key_words_==record_words_ )
+        return false;
+    record_words  = record_words_;
+    key_words     = key_words_;
+    temp_filename = temp_filename_;
+
+    // Half the memory for records, half for sorting them
+    capacity = memory / 2 / (record_words*sizeof(uint64_t));
+    if( capacity < 1024 )
+        capacity = 1024;
+    record.resize( record_words );
+    return true;
+}
+
+/****************************************************************************
+ * Add a record
+ *  return bool okay
+ ****************************************************************************/
+bool ExternalSort::Add( const uint64_t *rec )
+{
+    if( data.empty() )
+        data.reserve( capacity*record_words );
+    data.insert( data.end(), rec, rec+record_words );
+    nbr_records++;
+    if( data.size() >= capacity*record_words )
+    {
+        // Combining might free enough memory to carry on without a run
+        SortData();
+        if( combine && data.size() <= capacity*record_words/2 )
+            return !error;
+        return WriteRun();
+    }
+    return !error;
+}
+
+/****************************************************************************
+ * Sort the records in memory, combining them if need be
+ ****************************************************************************/
+void ExternalSort::SortData()
+{
+    size_t nbr = data.size() / record_words;
+    tmp.resize( data.size() );
+    RadixSort( data.data(), tmp.data(), nbr, record_words, key_words, nbr_threads );
+    if( combine && nbr>1 )
+    {
+        size_t out = 0;
+        for( size_t i=1; i<nbr; i++ )
+        {
+            uint64_t *prev = &data[out*record_words];
+            const uint64_t *rec = &data[i*record_words];
+            if( esort_compare(prev,rec,key_words) == 0 )
+                prev[key_words] += rec[key_words];
+            else if( ++out != i )
+                memcpy( &data[out*record_words], rec, record_words*sizeof(uint64_t) );
+        }
+        data.resize( (out+1)*record_words );
+    }
+}
+
+/****************************************************************************
+ * Write the (sorted) records in memory as a run
+ *  return bool okay
+ ****************************************************************************/
+bool ExternalSort::WriteRun()
+{
+    char buf[32];
+    sprintf( buf, ".%lld", nbr_runs );
+    FILE *file = fopen( (temp_filename+buf).c_str(), "wb" );
+    run_files.push_back( nbr_runs++ );
+    if( !file || fwrite(data.data(),sizeof(uint64_t),data.size(),file)!=data.size() )
+        error = true;
+    if( file && fclose(file)!=0 )
+        error = true;
+    data.clear();
+    return !error;
+}
+
+/****************************************************************************
+ * All records added, sort them
+ *  return bool okay
+ ****************************************************************************/
+bool ExternalSort::Sort()
+{
+    sorted = true;
+    next   = 0;
+    SortData();
+    std::vector<uint64_t>().swap( tmp );
+    if( nbr_runs == 0 )
+        return true;    // everything fitted in memory
+    if( !data.empty() )
+        WriteRun();
+    std::vector<uint64_t>().swap( data );
+    std::vector<uint64_t>().swap( tmp );
+    if( error )
+        return false;
+
+    // Merge passes if need be, then the final merge happens as Next() is
+    //  called
+    return MergePasses() && OpenRuns(0,run_files.size());
+}
+
+/****************************************************************************
+ * Merge runs in passes until there are few enough to merge at once
+ *  return bool okay
+ ****************************************************************************/
+bool ExternalSort::MergePasses()
+{
+    while( run_files.size() > (size_t)max_merge )
+    {
+        // Merge each max_merge runs in turn into a new run that takes their
+        //  place, so the runs stay in the order their records were added
+        std::vector<long long> merged;
+        for( size_t first=0; first<run_files.size(); first+=max_merge )
+        {
+            size_t nbr = run_files.size() - first;
+            if( nbr > (size_t)max_merge )
+                nbr = max_merge;
+            if( nbr == 1 )
+            {
+                merged.push_back( run_files[first] );
+                continue;
+            }
+            if( !OpenRuns(first,nbr) )
+                return false;
+            char buf[32];
+            sprintf( buf, ".%lld", nbr_runs );
+            FILE *file = fopen( (temp_filename+buf).c_str(), "wb" );
+            merged.push_back( nbr_runs++ );
+            if( !file )
+                error = true;
+            while( !error && MergeNext() )
+            {
+                if( fwrite(record.data(),sizeof(uint64_t),record_words,file) != (size_t)record_words )
+                    error = true;
+            }
+            if( file && fclose(file)!=0 )
+                error = true;
+            CloseRuns();
+            for( size_t i=first; i<first+nbr; i++ )
+            {
+                sprintf( buf, ".%lld", run_files[i] );
+                remove( (temp_filename+buf).c_str() );
+            }
+            if( error )
+                return false;
+        }
+        run_files.swap( merged );
+    }
+    return true;
+}
+
+/****************************************************************************
+ * Open runs for merging
+ *  return bool okay
+ ****************************************************************************/
+bool ExternalSort::OpenRuns( size_t first, size_t nbr )
+{
+    // Share memory between the runs' buffers
+    CloseRuns();
+    size_t words = memory / sizeof(uint64_t) / (nbr>0 ? nbr : 1);
+    words -= words%record_words;
+    if( words < 1024*(size_t)record_words )
+        words = 1024*record_words;
+    runs.resize( nbr );
+    for( size_t i=0; i<nbr; i++ )
+    {
+        char buf[32];
+        sprintf( buf, ".%lld", run_files[first+i] );
+        RUN &run = runs[i];
+        run.file = fopen( (temp_filename+buf).c_str(), "rb" );
+        run.buf.resize( words );
+        run.pos = 0;
+        run.len = 0;
+        if( !run.file )
+            error = true;
+        else
+            ReadRun( (int)i );
+    }
+
+    // Heap of runs, smallest record at the top
+    for( int i=0; i<(int)nbr; i++ )
+    {
+        if( runs[i].len == 0 )
+            continue;
+        size_t j = heap.size();
+        heap.push_back( i );
+        while( j>0 && After(heap[(j-1)/2],heap[j]) )
+        {
+            std::swap( heap[(j-1)/2], heap[j] );
+            j = (j-1)/2;
+        }
+    }
+    return !error;
+}
+
+/****************************************************************************
+ * Close the runs being merged
+ ****************************************************************************/
+void ExternalSort::CloseRuns()
+{
+    for( size_t i=0; i<runs.size(); i++ )
+    {
+        if( runs[i].file )
+            fclose( runs[i].file );
+    }
+    runs.clear();
+    heap.clear();
+}
+
+/****************************************************************************
+ * Refill a run's buffer
+ ****************************************************************************/
+void ExternalSort::ReadRun( int r )
+{
+    RUN &run = runs[r];
+    run.pos = 0;
+    run.len = 0;
+    if( !run.file )
+        return;
+    size_t n = fread( run.buf.data(), sizeof(uint64_t), run.buf.size(), run.file );
+    if( ferror(run.file) || n%record_words != 0 )
+        error = true;
+    run.len = n - n%record_words;
+    if( run.len == 0 )
+    {
+        fclose( run.file );
+        run.file = NULL;
+    }
+}
+
+/****************************************************************************
+ * Does run a's current record come after run b's ?
+ ****************************************************************************/
+bool ExternalSort::After( int a, int b ) const
+{
+    int cmp = esort_compare( &runs[a].buf[runs[a].pos], &runs[b].buf[runs[b].pos], key_words );
+    return cmp>0 || (cmp==0 && a>b);
+}
+
+/****************************************************************************
+ * Get the next record, in order
+ *  return bool found
+ ****************************************************************************/
+bool ExternalSort::Next( const uint64_t *&rec )
+{
+    if( !sorted || error )
+        return false;
+    if( nbr_runs == 0 )
+    {
+        if( next*record_words >= data.size() )
+            return false;
+        rec = &data[ next*record_words ];
+        next++;
+        return true;
+    }
+    if( !MergeNext() )
+        return false;
+    rec = record.data();
+    return true;
+}
+
+/****************************************************************************
+ * Merge the next record into record[]
+ *  return bool found
+ ****************************************************************************/
+bool ExternalSort::MergeNext()
+{
+    if( heap.empty() )
+        return false;
+
+    // Take the top run's record, and any with the same key if combining
+    memcpy( record.data(), Top(), record_words*sizeof(uint64_t) );
+    Pop();
+    while( combine && !heap.empty() && esort_compare(Top(),record.data(),key_words)==0 )
+    {
+        record[key_words] += Top()[key_words];
+        Pop();
+    }
+    return true;
+}
+
+/****************************************************************************
+ * The top run's current record
+ ****************************************************************************/
+const uint64_t *ExternalSort::Top() const
+{
+    const RUN &run = runs[ heap[0] ];
+    return &run.buf[run.pos];
+}
+
+/****************************************************************************
+ * Move past the top run's current record, and the run down the heap
+ ****************************************************************************/
+void ExternalSort::Pop()
+{
+    int r = heap[0];
+    RUN &run = runs[r];
+    run.pos += record_words;
+    if( run.pos >= run.len )
+        ReadRun( r );
+    if( run.len == 0 )
+    {
+        heap[0] = heap.back();
+        heap.pop_back();
+    }
+    size_t j = 0;
+    for(;;)
+    {
+        size_t smallest = j;
+        size_t left = 2*j+1, right = 2*j+2;
+        if( left<heap.size() && After(heap[smallest],heap[left]) )
+            smallest = left;
+        if( right<heap.size() && After(heap[smallest],heap[right]) )
+            smallest = right;
+        if( smallest == j )
+            break;
+        std::swap( heap[j], heap[smallest] );
+        j = smallest;
+    }
+}
+
+/****************************************************************************
+ * Finished, remove the temporary files
+ ****************************************************************************/
+void ExternalSort::End()
+{
+    CloseRuns();
+    for( long long i=0; i<nbr_runs; i++ )
+    {
+        char buf[32];
+        sprintf( buf, ".%lld", i );
+        remove( (temp_filename+buf).c_str() );
+    }
+    std::vector<uint64_t>().swap( data );
+    std::vector<uint64_t>().swap( tmp );
+    run_files.clear();
+    nbr_records = 0;
+    nbr_runs    = 0;
+    error       = false;
+    sorted      = false;
+    next        = 0;
+}
@@ -0,0 +1,157 @@
+/****************************************************************************
+ * ExternalSort.h Chess classes - Sort more records than fit in memory
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#ifndef EXTERNALSORT_H
+#define EXTERNALSORT_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// TripleHappyChess
+namespace thc
+{
+
+// Sorts fixed size records, each a few uint64s, the first key_words of
+//  which are the key (a big number, most significant word first). Records
+//  are collected in memory, and each time memory fills they're radix sorted
+//  on multiple threads and written to a temporary file (a run). Then the
+//  runs are merged, so the number of records is limited by disk space, not
+//  memory. Only so many runs are merged at once (so only so many files are
+//  open), if there are more they're merged in passes, each pass writing
+//  bigger runs. Records with equal keys come out in the order they were
+//  added
+class ExternalSort
+{
+public:
+    ExternalSort();
+    ~ExternalSort();
+
+    // Memory to use, (default 256 megabytes) and number of threads
+    //  (default, one per processor). Set them before Begin()
+    void SetMemory( size_t bytes ) { memory = bytes; }
+    void SetThreads( int nbr ) { nbr_threads = nbr>0 ? nbr : 1; }
+
+    // Most runs to merge at once (default 128, at least 2)
+    void SetMaxMerge( int nbr ) { max_merge = nbr>2 ? nbr : 2; }
+
+    // Combine records with equal keys into one, adding up the word after
+    //  the key (a count say), the other words are the first record's. Runs
+    //  are combined before they're written, and only written at all if
+    //  combining doesn't halve them. Set it before Begin()
+    void SetCombine( bool combine_ ) { combine = combine_; }
+
+    // Start sorting, records are record_words (at most 64) uint64s, the
+    //  first key_words (at most 8) the key. Runs are written to files named
+    //  temp_filename.0, temp_filename.1 etc.
+    //  return bool okay (false if the record or key size is unreasonable,
+    //  or there's no word after the key to combine)
+    bool Begin( int record_words, int key_words, const char *temp_filename );
+
+    // Add a record (record_words uint64s)
+    //  return bool okay (false if a run couldn't be written)
+    bool Add( const uint64_t *record );
+
+    // All records added, sort them
+    //  return bool okay (false if a run couldn't be written or read)
+    bool Sort();
+
+    // Get the records, in order, after Sort(). Record points at a copy that
+    //  is valid until the next call
+    //  return bool found (false when there are no more)
+    bool Next( const uint64_t *&record );
+
+    // Did reading the runs fail ? (then Next() returns false early)
+    bool Error() const { return error; }
+
+    // Number of records added (before any are combined)
+    long long NbrRecords() const { return nbr_records; }
+
+    // Finished, removes the temporary files (Begin() and the destructor do
+    //  this too)
+    void End();
+
+    // Radix sort records in memory (sizes limited as for Begin()), tmp must
+    //  be as big as data
+    static void RadixSort( uint64_t *data, uint64_t *tmp, size_t nbr, int record_words, int key_words, int nbr_threads );
+
+// internal stuff
+private:
+
+    // Not copyable
+    ExternalSort( const ExternalSort& );
+    ExternalSort& operator=( const ExternalSort& );
+
+    // Sort the records in memory, combining them if need be
+    void SortData();
+
+    // Write the (sorted) records in memory as a run
+    //  return bool okay
+    bool WriteRun();
+
+    // Merge runs in passes until there are few enough to merge at once
+    //  return bool okay
+    bool MergePasses();
+
+    // Open nbr runs, starting with run_files[first], for merging
+    //  return bool okay
+    bool OpenRuns( size_t first, size_t nbr );
+
+    // Close the runs being merged
+    void CloseRuns();
+
+    // Merge the next record (combining if need be) into record[]
+    //  return bool found
+    bool MergeNext();
+
+    // Refill a run's buffer
+    void ReadRun( int run );
+
+    // Does run a's current record come after run b's ? (ties go to the
+    //  earlier run, so sorting is stable)
+    bool After( int a, int b ) const;
+
+    // The top run's current record, and moving past it
+    const uint64_t *Top() const;
+    void Pop();
+
+    // A run being merged
+    struct RUN
+    {
+        FILE                 *file;
+        std::vector<uint64_t> buf;
+        size_t                pos;          // words
+        size_t                len;          // words
+    };
+
+    //### Data
+    size_t                  memory;
+    int                     nbr_threads;
+    int                     max_merge;
+    int                     record_words;
+    int                     key_words;
+    std::string             temp_filename;
+    long long               nbr_records;
+    long long               nbr_runs;       // temporary files written
+    std::vector<long long>  run_files;      // runs still to merge, in order
+    std::vector<uint64_t>   data;           // records waiting to be sorted
+    std::vector<uint64_t>   tmp;
+    size_t                  capacity;       // records
+    bool                    combine;
+    bool                    error;
+
+    // Merging (or, if everything fitted in memory, just reading data[])
+    bool                    sorted;
+    size_t                  next;           // in data[]
+    std::vector<RUN>        runs;
+    std::vector<int>        heap;           // of runs, by current record
+    std::vector<uint64_t>   record;
+};
+
+} //namespace thc
+
+#endif //EXTERNALSORT_H
@@ -0,0 +1,581 @@
+/****************************************************************************
+ * GameArchive.cpp Chess classes - Compressed game archive, random access
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#define _CRT_SECURE_NO_WARNINGS
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include "GameArchive.h"
+using namespace std;
+using namespace thc;
+
+/*
+    Archive layout (all numbers in the machine's byte order, every section
+    starts on a multiple of 8 bytes)
+
+    Header, ARCHIVE_HEADER uint64s
+    Blocks, each a GameEncoder stream of one or more games
+    Block index, for each block: offset, length, id of its first game,
+     checksum (archive_checksum() of its bytes)
+    Columns, one entry per game: white, black, event (uint32 string
+     indexes), date (uint32 yyyymmdd), result (uint8)
+    String table, uint32 offsets into '\0' terminated strings, sorted
+ */
+enum
+{
+    ARCHIVE_MAGIC,
+    ARCHIVE_VERSION,
+    ARCHIVE_NBR_GAMES,
+    ARCHIVE_NBR_BLOCKS,
+    ARCHIVE_INDEX,
+    ARCHIVE_WHITES,
+    ARCHIVE_BLACKS,
+    ARCHIVE_EVENTS,
+    ARCHIVE_DATES,
+    ARCHIVE_RESULTS,
+    ARCHIVE_STRING_OFFSETS,
+    ARCHIVE_NBR_STRINGS,
+    ARCHIVE_STRING_DATA,
+    ARCHIVE_STRING_LEN,
+    ARCHIVE_HEADER=16
+};
+static const char     archive_magic[8] = { 'T','H','C','A','R','C','H','1' };
+static const uint64_t archive_version  = 2;
+static const int      archive_index_entry = 4;     // uint64s per block
+
+// FNV-1a hash of a block's bytes, so a corrupt block is found before it's
+//  decoded (the GameEncoder stream's own check is at the end of the block,
+//  and GetGame() only decodes up to the game it wants)
+static uint64_t archive_checksum( const unsigned char *data, size_t len )
+{
+    uint64_t hash = 14695981039346656037ull;
+    for( size_t i=0; i<len; i++ )
+        hash = (hash ^ data[i]) * 1099511628211ull;
+    return hash;
+}
+
+// Is [offset,offset+count*size) inside a file of file_size bytes, and is
+//  offset suitably aligned ?
+static bool archive_inside( uint64_t offset, uint64_t count, uint64_t size, uint64_t file_size )
+{
+    if( offset%8 != 0 || offset > file_size )
+        return false;
+    return count <= (file_size-offset)/size;
+}
+
+// Copy a PGN tag value, without the escapes
+static std::string archive_unescape( const PgnSpan &value )
+{
+    std::string s;
+    for( size_t i=0; i<value.len; i++ )
+    {
+        if( value.ptr[i]=='\\' && i+1<value.len )
+            i++;
+        s += value.ptr[i];
+    }
+    return s;
+}
+
+/****************************************************************************
+ * From a PGN game's tags
+ ****************************************************************************/
+void GameTags::FromPgn( const PgnGame &game )
+{
+    PgnSpan value;
+    white = game.Tag("White",value) ? archive_unescape(value) : "";
+    black = game.Tag("Black",value) ? archive_unescape(value) : "";
+    event = game.Tag("Event",value) ? archive_unescape(value) : "";
+    date  = game.Tag("Date",value) ? ParseDate(value.ptr,value.len) : 0;
+    if( game.Tag("Result",value) )
+        result = ParseResult( value.ptr, value.len );
+    else
+        result = ParseResult( game.result.ptr, game.result.len );
+}
+
+/****************************************************************************
+ * PGN date to yyyymmdd
+ ****************************************************************************/
+int GameTags::ParseDate( const char *s, size_t len )
+{
+    // "yyyy.mm.dd", each field digits, or '?'s for unknown
+    int field[3] = {0,0,0};
+    const int digits[3] = {4,2,2};
+    size_t pos = 0;
+    for( int i=0; i<3; i++ )
+    {
+        if( i>0 )
+        {
+            if( pos>=len || s[pos]!='.' )
+                break;
+            pos++;
+        }
+        int n=0, value=0;
+        bool known = true;
+        while( pos<len && s[pos]!='.' )
+        {
+            char c = s[pos++];
+            if( '0'<=c && c<='9' )
+                value = value*10 + (c-'0');
+            else
+                known = false;
+            n++;
+        }
+        if( !known || n!=digits[i] )
+            break;
+        field[i] = value;
+    }
+    if( field[0]==0 || field[1]>12 || field[2]>31 )
+        return 0;
+    if( field[1] == 0 )
+        field[2] = 0;
+    return field[0]*10000 + field[1]*100 + field[2];
+}
+
+/****************************************************************************
+ * PGN result
+ ****************************************************************************/
+int GameTags::ParseResult( const char *s, size_t len )
+{
+    PgnSpan span(s,len);
+    if( span.Equals("1-0") )
+        return RESULT_WHITE_WINS;
+    else if( span.Equals("0-1") )
+        return RESULT_BLACK_WINS;
+    else if( span.Equals("1/2-1/2") )
+        return RESULT_DRAW;
+    return RESULT_NONE;
+}
+
+/****************************************************************************
+ * Constructor
+ ****************************************************************************/
+GameArchiveWriter::GameArchiveWriter()
+{
+    file             = NULL;
+    okay             = false;
+    offset           = 0;
+    block_size       = 4096;
+    block_first_game = 0;
+}
+
+/****************************************************************************
+ * Destructor
+ ****************************************************************************/
+GameArchiveWriter::~GameArchiveWriter()
+{
+    Close();
+}
+
+/****************************************************************************
+ * Create an archive
+ *  return bool okay
+ ****************************************************************************/
+bool GameArchiveWriter::Open( const char *filename )
+{
+    Close();
+    index.clear();
+    strings.clear();
+    whites.clear();
+    blacks.clear();
+    events.clear();
+    dates.clear();
+    results.clear();
+    block.clear();
+    block_first_game = 0;
+    offset = 0;
+    file = fopen( filename, "wb" );
+    if( !file )
+        return false;
+
+    // The header is filled in by Close()
+    okay = true;
+    uint64_t header[ARCHIVE_HEADER];
+    memset( header, 0, sizeof(header) );
+    Write( header, sizeof(header) );
+    return okay;
+}
+
+/****************************************************************************
+ * Add a game
+ *  return bool okay
+ ****************************************************************************/
+bool GameArchiveWriter::AddGame( const GameTags &tags, const ChessPosition &start, const std::vector<Move> &moves )
+{
+    if( !file )
+        return false;
+
+    // Each block is a stream of its own
+    long long id = NbrGames();
+    if( block_first_game == id )
+        encoder.Begin( block );
+    if( !encoder.GameBegin(start) )
+        return false;
+    bool legal = true;
+    for( size_t i=0; legal && i<moves.size(); i++ )
+        legal = encoder.AddMove( moves[i] );
+    encoder.GameEnd();
+    whites.push_back( StringIndex(tags.white) );
+    blacks.push_back( StringIndex(tags.black) );
+    events.push_back( StringIndex(tags.event) );
+    dates.push_back( tags.date>0 ? (uint32_t)tags.date : 0 );
+    results.push_back( (uint8_t)(tags.result&3) );
+    if( block.size() >= block_size )
+        BlockEnd();
+    return legal;
+}
+
+/****************************************************************************
+ * Write the current block
+ ****************************************************************************/
+void GameArchiveWriter::BlockEnd()
+{
+    if( block_first_game == NbrGames() )
+        return;
+    encoder.End();
+    index.push_back( offset );
+    index.push_back( block.size() );
+    index.push_back( block_first_game );
+    index.push_back( archive_checksum(block.data(),block.size()) );
+    Write( block.data(), block.size() );
+    block.clear();
+    block_first_game = NbrGames();
+}
+
+/****************************************************************************
+ * Write bytes, padded to a multiple of 8
+ ****************************************************************************/
+void GameArchiveWriter::Write( const void *data, size_t len )
+{
+    static const char zeros[8] = {0,0,0,0,0,0,0,0};
+    size_t pad = (8 - len%8) % 8;
+    if( len>0 && fwrite(data,1,len,file)!=len )
+        okay = false;
+    if( pad>0 && fwrite(zeros,1,pad,file)!=pad )
+        okay = false;
+    offset += len + pad;
+}
+
+/****************************************************************************
+ * Index of a string, in order of appearance (sorted by Close())
+ ****************************************************************************/
+uint32_t GameArchiveWriter::StringIndex( const std::string &s )
+{
+    std::map<std::string,uint32_t>::iterator it = strings.find(s);
+    if( it != strings.end() )
+        return it->second;
+    uint32_t idx = (uint32_t)strings.size();
+    strings[s] = idx;
+    return idx;
+}
+
+/****************************************************************************
+ * Finish the archive
+ *  return bool okay
+ ****************************************************************************/
+bool GameArchiveWriter::Close()
+{
+    if( !file )
+        return okay;
+    BlockEnd();
+    uint64_t header[ARCHIVE_HEADER];
+    memset( header, 0, sizeof(header) );
+    memcpy( &header[ARCHIVE_MAGIC], archive_magic, sizeof(archive_magic) );
+    header[ARCHIVE_VERSION]    = archive_version;
+    header[ARCHIVE_NBR_GAMES]  = NbrGames();
+    header[ARCHIVE_NBR_BLOCKS] = index.size()/archive_index_entry;
+    header[ARCHIVE_INDEX]      = offset;
+    Write( index.data(), index.size()*sizeof(uint64_t) );
+
+    // The string table is sorted, so readers can binary search it
+    std::vector<uint32_t> remap( strings.size() );
+    std::vector<uint32_t> string_offsets;
+    std::string string_data;
+    for( std::map<std::string,uint32_t>::iterator it=strings.begin(); it!=strings.end(); ++it )
+    {
+        remap[it->second] = (uint32_t)string_offsets.size();
+        string_offsets.push_back( (uint32_t)string_data.size() );
+        string_data.append( it->first.c_str() );
+        string_data += '\0';
+    }
+    if( string_data.size() > 0xffffffff )
+        okay = false;
+    std::vector<uint32_t> *columns[3] = { &whites, &blacks, &events };
+    for( int i=0; i<3; i++ )
+    {
+        std::vector<uint32_t> &column = *columns[i];
+        for( size_t j=0; j<column.size(); j++ )
+            column[j] = remap[ column[j] ];
+        header[ARCHIVE_WHITES+i] = offset;
+        Write( column.data(), column.size()*sizeof(uint32_t) );
+    }
+    header[ARCHIVE_DATES] = offset;
+    Write( dates.data(), dates.size()*sizeof(uint32_t) );
+    header[ARCHIVE_RESULTS] = offset;
+    Write( results.data(), results.size() );
+    header[ARCHIVE_STRING_OFFSETS] = offset;
+    header[ARCHIVE_NBR_STRINGS]    = string_offsets.size();
+    Write( string_offsets.data(), string_offsets.size()*sizeof(uint32_t) );
+    header[ARCHIVE_STRING_DATA]    = offset;
+    header[ARCHIVE_STRING_LEN]     = string_data.size();
+    Write( string_data.data(), string_data.size() );
+
+    // Now the header
+    if( fseek(file,0,SEEK_SET) != 0 || fwrite(header,1,sizeof(header),file) != sizeof(header) )
+        okay = false;
+    if( fclose(file) != 0 )
+        okay = false;
+    file = NULL;
+    return okay;
+}
+
+/****************************************************************************
+ * Constructor
+ ****************************************************************************/
+GameArchive::GameArchive()
+{
+    Close();
+}
+
+/****************************************************************************
+ * Finished with it
+ ****************************************************************************/
+void GameArchive::Close()
+{
+    file.Close();
+    nbr_games      = 0;
+    nbr_blocks     = 0;
+    index          = NULL;
+    whites         = NULL;
+    blacks         = NULL;
+    events         = NULL;
+    dates          = NULL;
+    results        = NULL;
+    string_offsets = NULL;
+    nbr_strings    = 0;
+    string_data    = NULL;
+    string_len     = 0;
+    decoder_block  = -1;
+    decoder_game   = 0;
+}
+
+/****************************************************************************
+ * Memory map an archive
+ *  return bool okay
+ ****************************************************************************/
+bool GameArchive::Open( const char *filename )
+{
+    Close();
+    if( !file.Open(filename) )
+        return false;
+
+    // Check everything is where the header says, so nothing read later can
+    //  be outside the file
+    uint64_t size = file.Size();
+    const char *data = file.Data();
+    uint64_t header[ARCHIVE_HEADER];
+    bool okay = size >= sizeof(header);
+    if( okay )
+    {
+        memcpy( header, data, sizeof(header) );
+        okay = memcmp(&header[ARCHIVE_MAGIC],archive_magic,sizeof(archive_magic))==0 &&
+               header[ARCHIVE_VERSION] == archive_version;
+    }
+    uint64_t games  = okay ? header[ARCHIVE_NBR_GAMES]  : 0;
+    uint64_t blocks = okay ? header[ARCHIVE_NBR_BLOCKS] : 0;
+    okay = okay && archive_inside( header[ARCHIVE_INDEX], blocks, archive_index_entry*sizeof(uint64_t), size )
+                && archive_inside( header[ARCHIVE_WHITES], games, sizeof(uint32_t), size )
+                && archive_inside( header[ARCHIVE_BLACKS], games, sizeof(uint32_t), size )
+                && archive_inside( header[ARCHIVE_EVENTS], games, sizeof(uint32_t), size )
+                && archive_inside( header[ARCHIVE_DATES],  games, sizeof(uint32_t), size )
+                && archive_inside( header[ARCHIVE_RESULTS], games, 1, size )
+                && archive_inside( header[ARCHIVE_STRING_OFFSETS], header[ARCHIVE_NBR_STRINGS], sizeof(uint32_t), size )
+                && archive_inside( header[ARCHIVE_STRING_DATA], header[ARCHIVE_STRING_LEN], 1, size )
+                && header[ARCHIVE_NBR_STRINGS] <= 0xffffffff
+                && (blocks>0 || games==0);
+    if( okay )
+    {
+        index = (const uint64_t *)(data + header[ARCHIVE_INDEX]);
+        for( uint64_t i=0; okay && i<blocks; i++ )
+        {
+            const uint64_t *entry = index + archive_index_entry*i;
+            okay = entry[0] <= size && entry[1] <= size-entry[0] &&
+                   (i==0 ? entry[2]==0 : entry[2]>entry[2-archive_index_entry]) && entry[2]<games;
+        }
+    }
+    if( okay )
+    {
+        string_len  = header[ARCHIVE_STRING_LEN];
+        string_data = data + header[ARCHIVE_STRING_DATA];
+        okay = string_len==0 || string_data[string_len-1]=='\0';
+    }
+    if( !okay )
+    {
+        Close();
+        return false;
+    }
+    nbr_games      = (long long)games;
+    nbr_blocks     = (long long)blocks;
+    whites         = (const uint32_t *)(data + header[ARCHIVE_WHITES]);
+    blacks         = (const uint32_t *)(data + header[ARCHIVE_BLACKS]);
+    events         = (const uint32_t *)(data + header[ARCHIVE_EVENTS]);
+    dates          = (const uint32_t *)(data + header[ARCHIVE_DATES]);
+    results        = (const uint8_t  *)(data + header[ARCHIVE_RESULTS]);
+    string_offsets = (const uint32_t *)(data + header[ARCHIVE_STRING_OFFSETS]);
+    nbr_strings    = (uint32_t)header[ARCHIVE_NBR_STRINGS];
+    return true;
+}
+
+/****************************************************************************
+ * Get a game's starting position and moves
+ *  return bool okay
+ ****************************************************************************/
+bool GameArchive::GetGame( long long id, ChessPosition &start, std::vector<Move> &moves )
+{
+    moves.clear();
+    if( id<0 || id>=nbr_games )
+        return false;
+
+    // Find the game's block, the last block starting at or before it
+    long long lo=0, hi=nbr_blocks;
+    while( hi-lo > 1 )
+    {
+        long long mid = (lo+hi)/2;
+        if( (long long)index[archive_index_entry*mid+2] <= id )
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    // Carry on from the last game got if we can, else check and start the
+    //  block
+    if( decoder_block!=lo || decoder_game>id )
+    {
+        const uint64_t *entry = index + archive_index_entry*lo;
+        const unsigned char *block = (const unsigned char *)file.Data() + entry[0];
+        decoder_block = -1;
+        if( archive_checksum(block,(size_t)entry[1]) != entry[3] )
+            return false;
+        decoder.Begin( block, (size_t)entry[1] );
+        decoder_block = lo;
+        decoder_game  = (long long)entry[2];
+    }
+    bool okay = true;
+    while( okay && decoder_game<id )
+    {
+        okay = decoder.NextGame();
+        decoder_game++;
+    }
+    okay = okay && decoder.NextGame();
+    if( okay )
+    {
+        start = decoder.Position();
+        Move mv;
+        while( decoder.NextMove(mv) )
+            moves.push_back( mv );
+        okay = !decoder.Error();
+    }
+    decoder_game = id+1;
+    if( !okay )
+    {
+        moves.clear();
+        decoder_block = -1;
+    }
+    return okay;
+}
+
+/****************************************************************************
+ * Get a game's tags
+ *  return bool okay
+ ****************************************************************************/
+bool GameArchive::GetTags( long long id, GameTags &tags ) const
+{
+    if( id<0 || id>=nbr_games )
+        return false;
+    tags.white  = White(id);
+    tags.black  = Black(id);
+    tags.event  = Event(id);
+    tags.date   = Date(id);
+    tags.result = Result(id);
+    return true;
+}
+
+/****************************************************************************
+ * A string in the string table
+ ****************************************************************************/
+const char *GameArchive::String( const uint32_t *column, long long id ) const
+{
+    if( id<0 || id>=nbr_games )
+        return "";
+    uint32_t idx = column[id];
+    if( idx >= nbr_strings || string_offsets[idx] >= string_len )
+        return "";
+    return string_data + string_offsets[idx];
+}
+
+/****************************************************************************
+ * Find a string in the string table
+ *  return bool found
+ ****************************************************************************/
+bool GameArchive::FindString( const char *s, uint32_t &idx ) const
+{
+    uint32_t lo=0, hi=nbr_strings;
+    while( lo < hi )
+    {
+        uint32_t mid = lo + (hi-lo)/2;
+        const char *t = string_offsets[mid]<string_len ? string_data+string_offsets[mid] : "";
+        int cmp = strcmp( t, s );
+        if( cmp == 0 )
+        {
+            idx = mid;
+            return true;
+        }
+        if( cmp < 0 )
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    return false;
+}
+
+/****************************************************************************
+ * Find the games that match a filter
+ *  return number of games found
+ ****************************************************************************/
+long long GameArchive::Find( const GameFilter &filter, std::vector<long long> &ids ) const
+{
+    ids.clear();
+
+    // Names to string indexes, a name that isn't there matches nothing
+    const char *names[4] = { filter.player, filter.white, filter.black, filter.event };
+    uint32_t idx[4] = {0,0,0,0};
+    for( int i=0; i<4; i++ )
+    {
+        if( names[i] && !FindString(names[i],idx[i]) )
+            return 0;
+    }
+
+    // Scan only the columns needed, an unknown date never matches a date range
+    bool by_date = filter.date_from>0 || filter.date_to>0;
+    uint32_t date_from = filter.date_from>0 ? (uint32_t)filter.date_from : 1;
+    uint32_t date_to   = filter.date_to>0   ? (uint32_t)filter.date_to   : 0xffffffff;
+    for( long long id=0; id<nbr_games; id++ )
+    {
+        if( filter.player && whites[id]!=idx[0] && blacks[id]!=idx[0] )
+            continue;
+        if( filter.white && whites[id]!=idx[1] )
+            continue;
+        if( filter.black && blacks[id]!=idx[2] )
+            continue;
+        if( filter.event && events[id]!=idx[3] )
+            continue;
+        if( by_date && (dates[id]<date_from || dates[id]>date_to) )
+            continue;
+        if( filter.result>=0 && results[id]!=filter.result )
+            continue;
+        ids.push_back( id );
+    }
+    return (long long)ids.size();
+}
@@ -0,0 +1,204 @@
+/****************************************************************************
+ * GameArchive.h Chess classes - Compressed game archive, random access
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#ifndef GAMEARCHIVE_H
+#define GAMEARCHIVE_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "ChessDefs.h"
+#include "ChessPosition.h"
+#include "GameCodec.h"
+#include "MappedFile.h"
+#include "Move.h"
+#include "PgnReader.h"
+
+// TripleHappyChess
+namespace thc
+{
+
+// The tags of a game kept in an archive
+struct GameTags
+{
+    enum { RESULT_NONE=0, RESULT_WHITE_WINS=1, RESULT_BLACK_WINS=2, RESULT_DRAW=3 };
+    std::string white;
+    std::string black;
+    std::string event;
+    int         date;           // yyyymmdd, mm and/or dd 00 if unknown, 0 if all unknown
+    int         result;         // RESULT_NONE etc.
+    GameTags() : date(0), result(RESULT_NONE) {}
+
+    // From a PGN game's White, Black, Event, Date and Result tags (values
+    //  are as in the PGN, escapes and all)
+    void FromPgn( const PgnGame &game );
+
+    // PGN date, eg "2015.03.??" to 20150300
+    static int ParseDate( const char *s, size_t len );
+
+    // PGN result, eg "1-0" to RESULT_WHITE_WINS
+    static int ParseResult( const char *s, size_t len );
+};
+
+// Which games GameArchive::Find() finds, names must match exactly, NULL
+//  (or 0, or -1 for result) means anything will do
+struct GameFilter
+{
+    const char *player;         // white or black
+    const char *white;
+    const char *black;
+    const char *event;
+    int         date_from;      // yyyymmdd, inclusive
+    int         date_to;
+    int         result;
+    GameFilter() : player(NULL), white(NULL), black(NULL), event(NULL),
+                   date_from(0), date_to(0), result(-1) {}
+};
+
+// Writes an archive of compressed games. Games are compressed by
+//  GameEncoder in blocks of about the same size, each block coded on its
+//  own so any game can be got back by decoding just one block. The tags
+//  are kept separately, column by column, so searching them never touches
+//  the moves
+class GameArchiveWriter
+{
+public:
+    GameArchiveWriter();
+    ~GameArchiveWriter();
+
+    // Approximate size of each block of compressed games (default 4096
+    //  bytes), bigger blocks compress a little better, smaller blocks make
+    //  GameArchive::GetGame() faster. Set it before Open()
+    void SetBlockSize( size_t bytes ) { block_size = bytes>0 ? bytes : 1; }
+
+    // Create an archive
+    //  return bool okay
+    bool Open( const char *filename );
+
+    // Add a game, its ids are 0, 1, 2 ... in the order they are added
+    //  return bool okay (false if the start position can't be compressed,
+    //  then the game isn't added, or a move isn't legal, then the game is
+    //  added up to that move)
+    bool AddGame( const GameTags &tags, const ChessPosition &start, const std::vector<Move> &moves );
+
+    // Finish the archive (the destructor does this too)
+    //  return bool okay (false if anything couldn't be written)
+    bool Close();
+
+    // Games so far
+    long long NbrGames() const { return (long long)dates.size(); }
+
+// internal stuff
+private:
+
+    // Not copyable
+    GameArchiveWriter( const GameArchiveWriter& );
+    GameArchiveWriter& operator=( const GameArchiveWriter& );
+
+    // Write the current block
+    void BlockEnd();
+
+    // Write bytes, and pad them to a multiple of 8
+    void Write( const void *data, size_t len );
+
+    // Index of a string in the string table
+    uint32_t StringIndex( const std::string &s );
+
+    //### Data
+    FILE                       *file;
+    bool                        okay;
+    uint64_t                    offset;         // in the file
+    size_t                      block_size;
+    GameEncoder                 encoder;
+    std::vector<unsigned char>  block;
+    long long                   block_first_game;
+    std::vector<uint64_t>       index;          // offset, len, first game, checksum for each block
+    std::map<std::string,uint32_t> strings;
+    std::vector<uint32_t>       whites, blacks, events, dates;
+    std::vector<uint8_t>        results;
+};
+
+// Reads an archive written by GameArchiveWriter, straight from a memory
+//  mapped file. Not safe to share between threads, but any number of
+//  GameArchives can have the same file open
+class GameArchive
+{
+public:
+    GameArchive();
+
+    // Memory map an archive
+    //  return bool okay (false if it can't be opened, or isn't an archive)
+    bool Open( const char *filename );
+
+    // Finished with it
+    void Close();
+
+    // Number of games
+    long long NbrGames() const { return nbr_games; }
+
+    // Get a game's starting position and moves. Only the block the game is
+    //  in is decoded (and only up to the game), or less if the last game
+    //  got was from the same block. The block's checksum is checked before
+    //  it's decoded
+    //  return bool okay (false if id is out of range or the block is corrupt)
+    bool GetGame( long long id, ChessPosition &start, std::vector<Move> &moves );
+
+    // Get a game's tags
+    //  return bool okay (false if id is out of range)
+    bool GetTags( long long id, GameTags &tags ) const;
+
+    // Tags one at a time, without copying
+    const char *White( long long id ) const  { return String( whites, id ); }
+    const char *Black( long long id ) const  { return String( blacks, id ); }
+    const char *Event( long long id ) const  { return String( events, id ); }
+    int         Date( long long id ) const   { return (id>=0 && id<nbr_games) ? (int)dates[id] : 0; }
+    int         Result( long long id ) const { return (id>=0 && id<nbr_games) ? (int)results[id] : 0; }
+
+    // Find the games that match a filter, only the tag columns the filter
+    //  needs are scanned
+    //  return number of games found
+    long long Find( const GameFilter &filter, std::vector<long long> &ids ) const;
+
+// internal stuff
+private:
+
+    // Not copyable
+    GameArchive( const GameArchive& );
+    GameArchive& operator=( const GameArchive& );
+
+    // A string in the string table, "" if out of range
+    const char *String( const uint32_t *column, long long id ) const;
+
+    // Find a string in the (sorted) string table
+    //  return bool found
+    bool FindString( const char *s, uint32_t &idx ) const;
+
+    //### Data
+    MappedFile          file;
+    long long           nbr_games;
+    long long           nbr_blocks;
+    const uint64_t     *index;          // offset, len, first game, checksum for each block
+    const uint32_t     *whites;
+    const uint32_t     *blacks;
+    const uint32_t     *events;
+    const uint32_t     *dates;
+    const uint8_t      *results;
+    const uint32_t     *string_offsets;
+    uint32_t            nbr_strings;
+    const char         *string_data;
+    uint64_t            string_len;
+
+    // The last block decoded, and the next game in it
+    GameDecoder         decoder;
+    long long           decoder_block;
+    long long           decoder_game;
+};
+
+} //namespace thc
+
+#endif //GAMEARCHIVE_H
@@ -0,0 +1,816 @@
+/****************************************************************************
+ * GameCodec.cpp Chess classes - Compress games, a fraction of a byte per move
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#define _CRT_SECURE_NO_WARNINGS
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <functional>
+#include "GameCodec.h"
+#include "PrivateChessDefs.h"
+using namespace std;
+using namespace thc;
+
+// Probabilities move 1/32 of the way towards each bit coded
+static const int codec_prob_shift = 5;
+
+// Piece values for ranking moves
+static int codec_value( char piece )
+{
+    switch( piece )
+    {
+        case 'P': case 'p': return 100;
+        case 'N': case 'n': return 300;
+        case 'B': case 'b': return 310;
+        case 'R': case 'r': return 500;
+        case 'Q': case 'q': return 900;
+    }
+    return 0;
+}
+
+// Piece square tables for ranking moves, from white's point of view (so
+//  a8 first), flip the square (sq^56) for black. Pawn, knight, bishop,
+//  rook, queen, king (middlegame) and king (endgame)
+static const int codec_pst[7][64] =
+{
+    {     0,  0,  0,  0,  0,  0,  0,  0,
+         50, 50, 50, 50, 50, 50, 50, 50,
+         10, 10, 20, 30, 30, 20, 10, 10,
+          5,  5, 10, 25, 25, 10,  5,  5,
+          0,  0,  0, 20, 20,  0,  0,  0,
+          5, -5,-10,  0,  0,-10, -5,  5,
+          5, 10, 10,-20,-20, 10, 10,  5,
+          0,  0,  0,  0,  0,  0,  0,  0 },
+    {   -50,-40,-30,-30,-30,-30,-40,-50,
+        -40,-20,  0,  0,  0,  0,-20,-40,
+        -30,  0, 10, 15, 15, 10,  0,-30,
+        -30,  5, 15, 20, 20, 15,  5,-30,
+        -30,  0, 15, 20, 20, 15,  0,-30,
+        -30,  5, 10, 15, 15, 10,  5,-30,
+        -40,-20,  0,  5,  5,  0,-20,-40,
+        -50,-40,-30,-30,-30,-30,-40,-50 },
+    {   -20,-10,-10,-10,-10,-10,-10,-20,
+        -10,  0,  0,  0,  0,  0,  0,-10,
+        -10,  0,  5, 10, 10,  5,  0,-10,
+        -10,  5,  5, 10, 10,  5,  5,-10,
+        -10,  0, 10, 10, 10, 10,  0,-10,
+        -10, 10, 10, 10, 10, 10, 10,-10,
+        -10,  5,  0,  0,  0,  0,  5,-10,
+        -20,-10,-10,-10,-10,-10,-10,-20 },
+    {     0,  0,  0,  0,  0,  0,  0,  0,
+          5, 10, 10, 10, 10, 10, 10,  5,
+         -5,  0,  0,  0,  0,  0,  0, -5,
+         -5,  0,  0,  0,  0,  0,  0, -5,
+         -5,  0,  0,  0,  0,  0,  0, -5,
+         -5,  0,  0,  0,  0,  0,  0, -5,
+         -5,  0,  0,  0,  0,  0,  0, -5,
+          0,  0,  0,  5,  5,  0,  0,  0 },
+    {   -20,-10,-10, -5, -5,-10,-10,-20,
+        -10,  0,  0,  0,  0,  0,  0,-10,
+        -10,  0,  5,  5,  5,  5,  0,-10,
+         -5,  0,  5,  5,  5,  5,  0, -5,
+          0,  0,  5,  5,  5,  5,  0, -5,
+        -10,  5,  5,  5,  5,  5,  0,-10,
+        -10,  0,  5,  0,  0,  0,  0,-10,
+        -20,-10,-10, -5, -5,-10,-10,-20 },
+    {   -30,-40,-40,-50,-50,-40,-40,-30,
+        -30,-40,-40,-50,-50,-40,-40,-30,
+        -30,-40,-40,-50,-50,-40,-40,-30,
+        -30,-40,-40,-50,-50,-40,-40,-30,
+        -20,-30,-30,-40,-40,-30,-30,-20,
+        -10,-20,-20,-20,-20,-20,-20,-10,
+         20, 20,  0,  0,  0,  0, 20, 20,
+         20, 30, 10,  0,  0, 10, 30, 20 },
+    {   -50,-40,-30,-20,-20,-30,-40,-50,
+        -30,-20,-10,  0,  0,-10,-20,-30,
+        -30,-10, 20, 30, 30, 20,-10,-30,
+        -30,-10, 30, 40, 40, 30,-10,-30,
+        -30,-10, 30, 40, 40, 30,-10,-30,
+        -30,-10, 20, 30, 30, 20,-10,-30,
+        -30,-30,  0,  0,  0,  0,-30,-30,
+        -50,-30,-30,-30,-30,-30,-30,-50 }
+};
+
+// Squares attacked by one side's men (base = BB_WPAWN or BB_BPAWN)
+static Bitboard codec_attacks( const ChessPosition &cp, int base, Bitboard occupied )
+{
+    Bitboard attacked = 0;
+    for( int i=0; i<6; i++ )
+    {
+        for( Bitboard bb=cp.bb_pieces[base+i]; bb; )
+        {
+            Square sq = bb_pop_lsb( bb );
+            Bitboard a = 0;
+            switch( i )
+            {
+                case 0: a = base==BB_WPAWN ? pawn_white_attacks_bb[sq] : pawn_black_attacks_bb[sq]; break;
+                case 1: a = knight_attacks_bb[sq];              break;
+                case 2: a = bishop_attacks_bb(sq,occupied);     break;
+                case 3: a = rook_attacks_bb(sq,occupied);       break;
+                case 4: a = queen_attacks_bb(sq,occupied);      break;
+                case 5: a = king_attacks_bb[sq];                break;
+            }
+            attacked |= a;
+        }
+    }
+    return attacked;
+}
+
+// Squares attacked by one side's pawns
+static Bitboard codec_pawn_attacks( const ChessPosition &cp, bool white )
+{
+    Bitboard attacked = 0;
+    for( Bitboard bb=cp.bb_pieces[white?BB_WPAWN:BB_BPAWN]; bb; )
+    {
+        Square sq = bb_pop_lsb( bb );
+        attacked |= (white ? pawn_white_attacks_bb[sq] : pawn_black_attacks_bb[sq]);
+    }
+    return attacked;
+}
+
+// How much a man is likely to lose by standing on a square the other side
+//  attacks, a very rough static exchange evaluation
+static int codec_risk( Bitboard square, int value, Bitboard them, Bitboard them_pawns, Bitboard us )
+{
+    if( !(square & them) )
+        return 0;
+    if( !(square & us) )
+        return value;
+    if( square & them_pawns )
+        return value>100 ? value-100 : 0;
+    return value>330 ? value-330 : 0;
+}
+
+/****************************************************************************
+ * Start a stream
+ ****************************************************************************/
+void RangeEncoder::Begin( std::vector<unsigned char> *out_ )
+{
+    out        = out_;
+    low        = 0;
+    range      = 0xffffffff;
+    cache_size = 1;
+    cache      = 0;
+}
+
+/****************************************************************************
+ * Code a bit with an adaptive probability
+ ****************************************************************************/
+void RangeEncoder::EncodeBit( uint16_t &prob, int bit )
+{
+    uint32_t bound = (range>>PROB_BITS) * prob;
+    if( bit == 0 )
+    {
+        range = bound;
+        prob += ((1<<PROB_BITS) - prob) >> codec_prob_shift;
+    }
+    else
+    {
+        low   += bound;
+        range -= bound;
+        prob  -= prob >> codec_prob_shift;
+    }
+    while( range < (1u<<24) )
+    {
+        range <<= 8;
+        ShiftLow();
+    }
+}
+
+/****************************************************************************
+ * Code bits, each 50% probable
+ ****************************************************************************/
+void RangeEncoder::EncodeDirect( uint32_t value, int nbr_bits )
+{
+    for( int i=nbr_bits-1; i>=0; i-- )
+    {
+        range >>= 1;
+        if( (value>>i) & 1 )
+            low += range;
+        while( range < (1u<<24) )
+        {
+            range <<= 8;
+            ShiftLow();
+        }
+    }
+}
+
+/****************************************************************************
+ * Finish the stream
+ ****************************************************************************/
+void RangeEncoder::End()
+{
+    for( int i=0; i<5; i++ )
+        ShiftLow();
+}
+
+/****************************************************************************
+ * Output the top byte of low, holding back 0xff bytes until we know
+ *  whether a carry will ripple through them
+ ****************************************************************************/
+void RangeEncoder::ShiftLow()
+{
+    if( (uint32_t)low < 0xff000000 || (low>>32) != 0 )
+    {
+        unsigned char carry = (unsigned char)(low>>32);
+        unsigned char temp  = cache;
+        do
+        {
+            out->push_back( (unsigned char)(temp+carry) );
+            temp = 0xff;
+        } while( --cache_size != 0 );
+        cache = (unsigned char)(low>>24);
+    }
+    cache_size++;
+    low = (low & 0x00ffffff) << 8;
+}
+
+/****************************************************************************
+ * Start a stream
+ ****************************************************************************/
+void RangeDecoder::Begin( const unsigned char *data_, size_t len_ )
+{
+    data    = data_;
+    len     = len_;
+    pos     = 0;
+    range   = 0xffffffff;
+    code    = 0;
+    overrun = false;
+
+    // RangeEncoder's first byte is always 0 (there's nothing to carry into
+    //  it yet), so it doesn't reach code
+    first_byte = NextByte();
+    for( int i=0; i<4; i++ )
+        code = (code<<8) | NextByte();
+}
+
+/****************************************************************************
+ * Decode a bit coded with an adaptive probability
+ ****************************************************************************/
+int RangeDecoder::DecodeBit( uint16_t &prob )
+{
+    int bit;
+    uint32_t bound = (range>>RangeEncoder::PROB_BITS) * prob;
+    if( code < bound )
+    {
+        range = bound;
+        prob += ((1<<RangeEncoder::PROB_BITS) - prob) >> codec_prob_shift;
+        bit = 0;
+    }
+    else
+    {
+        code  -= bound;
+        range -= bound;
+        prob  -= prob >> codec_prob_shift;
+        bit = 1;
+    }
+    while( range < (1u<<24) )
+    {
+        range <<= 8;
+        code = (code<<8) | NextByte();
+    }
+    return bit;
+}
+
+/****************************************************************************
+ * Decode bits, each 50% probable
+ ****************************************************************************/
+uint32_t RangeDecoder::DecodeDirect( int nbr_bits )
+{
+    uint32_t value = 0;
+    for( int i=0; i<nbr_bits; i++ )
+    {
+        range >>= 1;
+        int bit = 0;
+        if( code >= range )
+        {
+            code -= range;
+            bit = 1;
+        }
+        value = (value<<1) | bit;
+        while( range < (1u<<24) )
+        {
+            range <<= 8;
+            code = (code<<8) | NextByte();
+        }
+    }
+    return value;
+}
+
+/****************************************************************************
+ * Constructor
+ ****************************************************************************/
+GameCodec::GameCodec()
+{
+    ModelReset();
+}
+
+/****************************************************************************
+ * Back to the start of stream state
+ ****************************************************************************/
+void GameCodec::ModelReset()
+{
+    cr = ChessPosition();
+    last_move.Invalid();
+    list.count = 0;
+    book_hit   = false;
+    clear_best = false;
+    check      = 2166136261u;
+    more_games     = RangeEncoder::PROB_INIT;
+    standard_start = RangeEncoder::PROB_INIT;
+    more_moves     = RangeEncoder::PROB_INIT;
+    for( int i=0; i<RANK_CONTEXTS; i++ )
+    {
+        for( int j=0; j<RANK_BUCKETS; j++ )
+        {
+            bucket_probs[i][j] = RangeEncoder::PROB_INIT;
+            for( int k=0; k<128; k++ )
+                mantissa_probs[i][j][k] = RangeEncoder::PROB_INIT;
+        }
+    }
+    book.assign( BOOK_SIZE, 0 );
+}
+
+/****************************************************************************
+ * Rank the legal moves, sets list and key[]
+ ****************************************************************************/
+void GameCodec::RankMoves()
+{
+    list.count = 0;
+    cr.GenLegalMoveList( &list );
+    book_hit   = false;
+    clear_best = false;
+    if( list.count == 0 )
+        return;
+
+    // Who attacks what
+    bool white = cr.white;
+    int  us    = white ? BB_WPAWN : BB_BPAWN;
+    int  them  = white ? BB_BPAWN : BB_WPAWN;
+    Bitboard occupied = cr.bb_occupied();
+    Bitboard us_attacks   = codec_attacks( cr, us,   occupied );
+    Bitboard them_attacks = codec_attacks( cr, them, occupied );
+    Bitboard them_pawns   = codec_pawn_attacks( cr, !white );
+
+    // Squares where each of our men would give check
+    Square king = (Square)(white ? cr.bking_square : cr.wking_square);
+    Bitboard checks[6];
+    checks[0] = white ? pawn_black_attacks_bb[king] : pawn_white_attacks_bb[king];
+    checks[1] = knight_attacks_bb[king];
+    checks[2] = bishop_attacks_bb( king, occupied );
+    checks[3] = rook_attacks_bb( king, occupied );
+    checks[4] = checks[2] | checks[3];
+    checks[5] = 0;
+
+    // Men worth more than a pawn, and more than a minor piece
+    Bitboard bigger[2];
+    bigger[1] = cr.bb_pieces[them+3] | cr.bb_pieces[them+4];
+    bigger[0] = bigger[1] | cr.bb_pieces[them+1] | cr.bb_pieces[them+2];
+
+    // The king heads for the centre as the pieces come off, phase is 0
+    //  (endgame) to 62 (all the pieces are on the board)
+    int phase = 0;
+    for( int i=1; i<5; i++ )
+    {
+        static const int weight[5] = { 0, 3, 3, 5, 9 };
+        phase += weight[i] * bb_popcount( cr.bb_pieces[BB_WPAWN+i] | cr.bb_pieces[BB_BPAWN+i] );
+    }
+    if( phase > 62 )
+        phase = 62;
+
+    // Has this position been seen before ?
+    uint32_t entry = book[ cr.key & (BOOK_SIZE-1) ];
+    uint16_t book_move = ( entry!=0 && (entry>>16)==(uint16_t)(cr.key>>48) ) ? (uint16_t)entry : 0;
+
+    // Score each move, and note how far ahead the best one is
+    int best = -1000000, second = -1000000;
+    for( int i=0; i<list.count; i++ )
+    {
+        Move mv = list.moves[i];
+        char piece = cr.squares[mv.src];
+        int  type  = bb_index[piece&0x7f] - us;
+        int  value = codec_value(piece);
+        int  src   = white ? mv.src : mv.src^56;
+        int  dst   = white ? mv.dst : mv.dst^56;
+
+        // Positional
+        int score;
+        if( type == 5 )
+            score = ( (codec_pst[5][dst]-codec_pst[5][src])*phase + (codec_pst[6][dst]-codec_pst[6][src])*(62-phase) ) / 62;
+        else
+            score = codec_pst[type][dst] - codec_pst[type][src];
+
+        // Material, what we win or lose on the destination square, plus
+        //  what we might have lost on the source square (a man escaping a
+        //  threat)
+        if( type != 5 )
+        {
+            if( mv.capture!=' ' || (BB(mv.dst)&them_attacks) )
+                score += 10*cr.SEE( mv );
+            score += codec_risk( BB(mv.src), value, them_attacks, them_pawns, us_attacks );
+        }
+        else if( mv.capture != ' ' )
+            score += codec_value(mv.capture);
+        if( mv.capture!=' ' && last_move.Valid() && mv.dst==last_move.dst )
+            score += 100;   // recapture
+        switch( mv.special )
+        {
+            case SPECIAL_PROMOTION_QUEEN:  score += 800;    break;
+            case SPECIAL_PROMOTION_KNIGHT: score += 100;    break;
+            case SPECIAL_PROMOTION_ROOK:
+            case SPECIAL_PROMOTION_BISHOP: score -= 100;    break;
+            case SPECIAL_WK_CASTLING:
+            case SPECIAL_BK_CASTLING:
+            case SPECIAL_WQ_CASTLING:
+            case SPECIAL_BQ_CASTLING:      score += 60;     break;
+            default:                                        break;
+        }
+        if( checks[type] & BB(mv.dst) )
+            score += 40;
+
+        // Attacking a bigger man with a pawn or minor piece
+        if( type == 0 )
+        {
+            Bitboard a = white ? pawn_white_attacks_bb[mv.dst] : pawn_black_attacks_bb[mv.dst];
+            if( a & bigger[0] )
+                score += 50;
+        }
+        else if( type == 1 && (knight_attacks_bb[mv.dst] & bigger[1]) )
+            score += 50;
+        else if( type == 2 && (bishop_attacks_bb(mv.dst,occupied) & bigger[1]) )
+            score += 50;
+
+        // Sort key, ties are broken by the move itself, not the order of
+        //  generation
+        PackedMove packed;
+        packed.Pack( mv );
+        if( packed.bits == book_move )
+        {
+            score += 100000;
+            book_hit = true;
+        }
+        key[i] = (int64_t)score*0x10000 + (0xffff-packed.bits);
+        if( score > best )
+        {
+            second = best;
+            best = score;
+        }
+        else if( score > second )
+            second = score;
+    }
+    clear_best = (best-second >= 100);
+}
+
+/****************************************************************************
+ * Coding context for a rank
+ ****************************************************************************/
+int GameCodec::RankContext() const
+{
+    int ctx = list.count<=8 ? 0 : (list.count<=24 ? 1 : (list.count<=40 ? 2 : 3));
+    return ctx*3 + (book_hit ? 2 : (clear_best?1:0));
+}
+
+/****************************************************************************
+ * Which bucket a rank is in
+ ****************************************************************************/
+int GameCodec::RankBucket( int rank )
+{
+    int bucket = 0;
+    while( rank > 0 )
+    {
+        bucket++;
+        rank >>= 1;
+    }
+    return bucket;
+}
+
+/****************************************************************************
+ * A move has been played, remember it for the next time we see this
+ *  position
+ ****************************************************************************/
+void GameCodec::PlayMove( Move mv )
+{
+    PackedMove packed;
+    packed.Pack( mv );
+    book[ cr.key & (BOOK_SIZE-1) ] = ((uint32_t)(uint16_t)(cr.key>>48) << 16) | packed.bits;
+    CheckAdd( packed.bits );
+    cr.PlayMove( mv );
+    last_move = mv;
+}
+
+/****************************************************************************
+ * A game has started from the position in cr
+ ****************************************************************************/
+void GameCodec::GameStart()
+{
+    last_move.Invalid();
+    CheckAdd( cr.key );
+    CheckAdd( ((uint64_t)cr.half_move_clock<<32) | (uint32_t)cr.full_move_count );
+}
+
+/****************************************************************************
+ * Add to the running check of the games and moves coded (FNV-1a, a 32 bit
+ *  word at a time)
+ ****************************************************************************/
+void GameCodec::CheckAdd( uint64_t value )
+{
+    check = (check ^ (uint32_t)value) * 16777619u;
+    check = (check ^ (uint32_t)(value>>32)) * 16777619u;
+}
+
+/****************************************************************************
+ * Constructor
+ ****************************************************************************/
+GameEncoder::GameEncoder()
+{
+    in_game = false;
+}
+
+/****************************************************************************
+ * Start a stream
+ ****************************************************************************/
+void GameEncoder::Begin( std::vector<unsigned char> &out )
+{
+    ModelReset();
+    rc.Begin( &out );
+    in_game = false;
+}
+
+/****************************************************************************
+ * Start a game from the standard starting position
+ ****************************************************************************/
+void GameEncoder::GameBegin()
+{
+    GameEnd();
+    rc.EncodeBit( more_games, 1 );
+    rc.EncodeBit( standard_start, 1 );
+    cr = ChessPosition();
+    GameStart();
+    in_game = true;
+}
+
+/****************************************************************************
+ * Start a game from some other position
+ *  return bool okay
+ ****************************************************************************/
+bool GameEncoder::GameBegin( const ChessPosition &start )
+{
+    ChessPosition standard;
+    if( start == standard && start.half_move_clock==0 && start.full_move_count==1 )
+    {
+        GameBegin();
+        return true;
+    }
+
+    // The position is stored as a CompressedPosition, make sure it survives
+    //  the trip (it won't if there are too many men for instance)
+    CompressedPosition compressed;
+    start.Compress( compressed );
+    ChessPosition position;
+    position.Decompress( compressed );
+    if( !(position==start) || start.half_move_clock>0xffff || start.full_move_count>0xffff )
+        return false;
+    GameEnd();
+    rc.EncodeBit( more_games, 1 );
+    rc.EncodeBit( standard_start, 0 );
+    for( int i=0; i<(int)sizeof(compressed.storage); i++ )
+        rc.EncodeDirect( compressed.storage[i], 8 );
+    rc.EncodeDirect( start.half_move_clock, 16 );
+    rc.EncodeDirect( start.full_move_count, 16 );
+    position.half_move_clock = start.half_move_clock;
+    position.full_move_count = start.full_move_count;
+    position.wking_square    = start.wking_square;
+    position.bking_square    = start.bking_square;
+    cr = position;
+    GameStart();
+    in_game = true;
+    return true;
+}
+
+/****************************************************************************
+ * Add a move to the game
+ *  return bool okay
+ ****************************************************************************/
+bool GameEncoder::AddMove( Move mv )
+{
+    if( !in_game )
+        return false;
+    RankMoves();
+    int idx;
+    for( idx=0; idx<list.count; idx++ )
+    {
+        if( list.moves[idx] == mv )
+            break;
+    }
+    if( idx == list.count )
+        return false;
+    rc.EncodeBit( more_moves, 1 );
+    if( list.count > 1 )
+    {
+        int rank = 0;
+        for( int i=0; i<list.count; i++ )
+        {
+            if( key[i] > key[idx] )
+                rank++;
+        }
+        int ctx    = RankContext();
+        int bucket = RankBucket(rank);
+        int last   = RankBucket(list.count-1);
+        for( int i=0; i<bucket; i++ )
+            rc.EncodeBit( bucket_probs[ctx][i], 0 );
+        if( bucket < last )
+            rc.EncodeBit( bucket_probs[ctx][bucket], 1 );
+        if( bucket >= 2 )
+        {
+            int nbr_bits = bucket-1;
+            int mantissa = rank - (1<<nbr_bits);
+            int node = 1;
+            for( int i=nbr_bits-1; i>=0; i-- )
+            {
+                int bit = (mantissa>>i) & 1;
+                rc.EncodeBit( mantissa_probs[ctx][bucket][node], bit );
+                node = node*2 + bit;
+            }
+        }
+    }
+    PlayMove( mv );
+    return true;
+}
+
+/****************************************************************************
+ * Finish the game
+ ****************************************************************************/
+void GameEncoder::GameEnd()
+{
+    if( in_game )
+    {
+        // No need to say so if there are no legal moves
+        if( cr.HasLegalMove() )
+            rc.EncodeBit( more_moves, 0 );
+        in_game = false;
+    }
+}
+
+/****************************************************************************
+ * Finish the stream
+ ****************************************************************************/
+void GameEncoder::End()
+{
+    GameEnd();
+    rc.EncodeBit( more_games, 0 );
+    rc.EncodeDirect( check, 32 );
+    rc.End();
+}
+
+/****************************************************************************
+ * Constructor
+ ****************************************************************************/
+GameDecoder::GameDecoder()
+{
+    in_game = false;
+    ended   = false;
+    error   = false;
+}
+
+/****************************************************************************
+ * Start a stream
+ ****************************************************************************/
+void GameDecoder::Begin( const unsigned char *data, size_t len )
+{
+    ModelReset();
+    rc.Begin( data, len );
+    in_game = false;
+    ended   = false;
+    error   = false;
+}
+
+/****************************************************************************
+ * Start the next game
+ *  return bool found
+ ****************************************************************************/
+bool GameDecoder::NextGame()
+{
+    // Skip what's left of the current game, the model has to see it
+    Move mv;
+    while( NextMove(mv) )
+        ;
+    if( error || ended )
+        return false;
+    if( rc.DecodeBit(more_games) == 0 )
+    {
+        // The end of the stream, is everything as the encoder saw it ?
+        ended = true;
+        if( rc.DecodeDirect(32)!=check || !rc.Finished() )
+            error = true;
+        return false;
+    }
+    if( rc.DecodeBit(standard_start) )
+        cr = ChessPosition();
+    else
+    {
+        // If the data is corrupt Decompress() can read up to 32 bytes, and
+        //  the position might not survive the trip back
+        struct
+        {
+            CompressedPosition compressed;
+            unsigned char      overflow[8];
+        } padded;
+        memset( &padded, 0, sizeof(padded) );
+        for( int i=0; i<(int)sizeof(padded.compressed.storage); i++ )
+            padded.compressed.storage[i] = (unsigned char)rc.DecodeDirect(8);
+        ChessPosition position;
+        position.Decompress( padded.compressed );
+        position.half_move_clock = (int)rc.DecodeDirect(16);
+        position.full_move_count = (int)rc.DecodeDirect(16);
+
+        // Decompress() doesn't find the kings
+        int nbr_men = 0;
+        for( int i=0; i<64; i++ )
+        {
+            if( position.squares[i] != ' ' )
+                nbr_men++;
+            if( position.squares[i] == 'K' )
+                position.wking_square = (Square)i;
+            else if( position.squares[i] == 'k' )
+                position.bking_square = (Square)i;
+        }
+        bool okay = (nbr_men <= 32);
+        if( okay )
+        {
+            CompressedPosition check;
+            position.Compress( check );
+            okay = (0 == memcmp(check.storage,padded.compressed.storage,sizeof(check.storage)));
+        }
+        if( !okay )
+        {
+            error = true;
+            return false;
+        }
+        cr = position;
+    }
+    GameStart();
+    if( rc.Overrun() )
+    {
+        error = true;
+        return false;
+    }
+    in_game = true;
+    return true;
+}
+
+/****************************************************************************
+ * Get the next move of the game
+ *  return bool found
+ ****************************************************************************/
+bool GameDecoder::NextMove( Move &mv )
+{
+    if( !in_game || error )
+        return false;
+    RankMoves();
+    if( list.count==0 || rc.DecodeBit(more_moves)==0 )
+    {
+        in_game = false;
+        if( rc.Overrun() )
+            error = true;
+        return false;
+    }
+    int rank = 0;
+    if( list.count > 1 )
+    {
+        int ctx    = RankContext();
+        int last   = RankBucket(list.count-1);
+        int bucket = 0;
+        while( bucket<last && rc.DecodeBit(bucket_probs[ctx][bucket])==0 )
+            bucket++;
+        if( bucket >= 1 )
+            rank = 1;
+        if( bucket >= 2 )
+        {
+            int nbr_bits = bucket-1;
+            int node = 1;
+            for( int i=0; i<nbr_bits; i++ )
+                node = node*2 + rc.DecodeBit( mantissa_probs[ctx][bucket][node] );
+            rank = node;    // the leading 1 bit is 1<<nbr_bits
+        }
+    }
+    if( rank>=list.count || rc.Overrun() )
+    {
+        in_game = false;
+        error   = true;
+        return false;
+    }
+
+    // The rank'th biggest key
+    int64_t sorted[MAXMOVES];
+    memcpy( sorted, key, list.count*sizeof(key[0]) );
+    nth_element( sorted, sorted+rank, sorted+list.count, greater<int64_t>() );
+    int idx = 0;
+    while( key[idx] != sorted[rank] )
+        idx++;
+    mv = list.moves[idx];
+    PlayMove( mv );
+    return true;
+}
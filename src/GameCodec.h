@@ -0,0 +1,243 @@
+/****************************************************************************
+ * GameCodec.h Chess classes - Compress games, a fraction of a byte per move
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#ifndef GAMECODEC_H
+#define GAMECODEC_H
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "ChessDefs.h"
+#include "ChessRules.h"
+#include "ChessEvaluation.h"
+#include "Move.h"
+
+// TripleHappyChess
+namespace thc
+{
+
+// Binary arithmetic (range) coder, as used by LZMA. Each bit is coded with
+//  an adaptive probability, the more predictable the bits the fewer bytes
+//  they take
+class RangeEncoder
+{
+public:
+    // Bit probabilities are 11 bits, PROB_INIT is 50%
+    enum { PROB_BITS=11, PROB_INIT=(1<<PROB_BITS)/2 };
+
+    RangeEncoder() { Begin(NULL); }
+
+    // Start a stream, bytes are appended to out as they're ready
+    void Begin( std::vector<unsigned char> *out );
+
+    // Code a bit with (and update) an adaptive probability
+    void EncodeBit( uint16_t &prob, int bit );
+
+    // Code the low nbr_bits bits of value, each 50% probable
+    void EncodeDirect( uint32_t value, int nbr_bits );
+
+    // Finish the stream, out gets the last few bytes
+    void End();
+
+// internal stuff
+private:
+    void ShiftLow();
+
+    //### Data
+    std::vector<unsigned char> *out;
+    uint64_t    low;
+    uint32_t    range;
+    uint64_t    cache_size;
+    unsigned char cache;
+};
+
+// Decodes what RangeEncoder codes
+class RangeDecoder
+{
+public:
+    RangeDecoder() { Begin(NULL,0); }
+
+    // Start a stream
+    void Begin( const unsigned char *data, size_t len );
+
+    // Decode a bit coded with RangeEncoder::EncodeBit()
+    int DecodeBit( uint16_t &prob );
+
+    // Decode bits coded with RangeEncoder::EncodeDirect()
+    uint32_t DecodeDirect( int nbr_bits );
+
+    // Have we needed more bytes than there are ? (only if the stream is
+    //  truncated or corrupt, decoded bits are meaningless after that)
+    bool Overrun() const { return overrun; }
+
+    // Has the stream ended exactly as RangeEncoder::End() left it ? (after
+    //  the last bit, every byte used and nothing left over)
+    bool Finished() const { return first_byte==0 && code==0 && pos==len && !overrun; }
+
+// internal stuff
+private:
+    unsigned char NextByte()
+    {
+        if( pos < len )
+            return data[pos++];
+        overrun = true;
+        return 0;
+    }
+
+    //### Data
+    const unsigned char *data;
+    size_t      len;
+    size_t      pos;
+    uint32_t    range;
+    uint32_t    code;
+    unsigned char first_byte;
+    bool        overrun;
+};
+
+// What GameEncoder and GameDecoder have in common. Each move is coded as
+//  its rank in a cheap, deterministic ordering of the legal moves, most
+//  likely first, and the ranks are arithmetic coded. The model (the coding
+//  probabilities, and a table of moves already played in positions seen
+//  before, so well trodden openings cost next to nothing) adapts as the
+//  games go by, so a stream of many games compresses better than one game
+class GameCodec
+{
+public:
+    GameCodec();
+
+    // The position, at the start of the game or after the last move
+    const ChessRules &Position() const { return cr; }
+
+    // The legal moves in the current position, ranked. Ordering depends only
+    //  on the position, the last move and the moves seen so far in the
+    //  stream, it's part of the compressed format so it mustn't change
+    void RankMoves();
+
+// internal stuff
+protected:
+
+    // Probabilities etc. back to the start of stream state
+    void ModelReset();
+
+    // Coding contexts for ranks, by number of legal moves and whether the
+    //  top ranked move has been played here before, or is well ahead of
+    //  the rest
+    enum { RANK_CONTEXTS=12, RANK_BUCKETS=9, BOOK_SIZE=1<<16 };
+    int  RankContext() const;
+
+    // Rank bucket b holds ranks [2^(b-1),2^b), bucket 0 just rank 0
+    static int RankBucket( int rank );
+
+    // A game has started from the position in cr
+    void GameStart();
+
+    // A move has been played
+    void PlayMove( Move mv );
+
+    // Add to the running check of the games and moves coded (GameEncoder::
+    //  End() codes it, so GameDecoder can tell if the stream is corrupt)
+    void CheckAdd( uint64_t value );
+
+    //### Data
+    ChessEvaluation     cr;                 // for SEE()
+    Move                last_move;
+    MOVELIST            list;               // legal moves, key[] ranks them
+    int64_t             key[MAXMOVES];      // bigger is better, all different
+    bool                book_hit;           // list has a move from the book
+    bool                clear_best;         // the top ranked move is well ahead
+    uint32_t            check;              // see CheckAdd()
+
+    // Model
+    uint16_t            more_games;
+    uint16_t            standard_start;
+    uint16_t            more_moves;
+    uint16_t            bucket_probs[RANK_CONTEXTS][RANK_BUCKETS];
+    uint16_t            mantissa_probs[RANK_CONTEXTS][RANK_BUCKETS][128];
+    std::vector<uint32_t> book;             // key check (16 bits), PackedMove (16 bits)
+};
+
+// Compresses a stream of games
+class GameEncoder : public GameCodec
+{
+public:
+    GameEncoder();
+
+    // Start a stream, compressed bytes are appended to out as they're ready
+    //  (so out can be written somewhere and cleared between games)
+    void Begin( std::vector<unsigned char> &out );
+
+    // Start a game, from the standard starting position
+    void GameBegin();
+
+    // Start a game from some other position
+    //  return bool okay (false if the position can't be compressed)
+    bool GameBegin( const ChessPosition &start );
+
+    // Add a move to the game
+    //  return bool okay (false if it isn't legal, nothing is coded)
+    bool AddMove( Move mv );
+
+    // Finish the game
+    void GameEnd();
+
+    // Finish the stream, a check of all the games and moves (so the decoder
+    //  can tell if the stream is corrupt) and the last bytes are appended
+    //  to out
+    void End();
+
+// internal stuff
+private:
+
+    // Not copyable
+    GameEncoder( const GameEncoder& );
+    GameEncoder& operator=( const GameEncoder& );
+
+    //### Data
+    RangeEncoder        rc;
+    bool                in_game;
+};
+
+// Decompresses a stream of games, a move at a time
+class GameDecoder : public GameCodec
+{
+public:
+    GameDecoder();
+
+    // Start a stream (it must stay in memory while it's decoded)
+    void Begin( const unsigned char *data, size_t len );
+
+    // Start the next game, Position() is its starting position
+    //  return bool found (false at the end of the stream, or on an error)
+    bool NextGame();
+
+    // Get the next move of the game (and play it, so Position() is the
+    //  position after it)
+    //  return bool found (false at the end of the game, or on an error)
+    bool NextMove( Move &mv );
+
+    // Is the stream corrupt or truncated ? (then NextGame() and NextMove()
+    //  return false from then on). Truncation is found where it happens,
+    //  but corruption mightn't be found until the end of the stream, when
+    //  the check GameEncoder::End() coded doesn't match, so games and moves
+    //  already got from a corrupt stream may be wrong
+    bool Error() const { return error; }
+
+// internal stuff
+private:
+
+    // Not copyable
+    GameDecoder( const GameDecoder& );
+    GameDecoder& operator=( const GameDecoder& );
+
+    //### Data
+    RangeDecoder        rc;
+    bool                in_game;
+    bool                ended;              // end of stream found, and checked
+    bool                error;
+};
+
+} //namespace thc
+
+#endif //GAMECODEC_H
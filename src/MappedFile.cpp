@@ -0,0 +1,133 @@
+/****************************************************************************
+ * MappedFile.cpp Chess classes - Read only memory mapped files
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#define _CRT_SECURE_NO_WARNINGS
+#include <stdio.h>
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "MappedFile.h"
+using namespace std;
+using namespace thc;
+
+/****************************************************************************
+ * Constructor
+ ****************************************************************************/
+MappedFile::MappedFile()
+{
+    data           = "";
+    size           = 0;
+    is_open        = false;
+    file_handle    = NULL;
+    mapping_handle = NULL;
+}
+
+/****************************************************************************
+ * Destructor
+ ****************************************************************************/
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+/****************************************************************************
+ * Map a file
+ *  return bool okay
+ ****************************************************************************/
+bool MappedFile::Open( const char *filename, bool sequential )
+{
+    Close();
+#ifdef _WIN32
+    HANDLE file = CreateFileA( filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                               sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_ATTRIBUTE_NORMAL, NULL );
+    if( file == INVALID_HANDLE_VALUE )
+        return false;
+    LARGE_INTEGER file_size;
+    if( !GetFileSizeEx(file,&file_size) || (unsigned long long)file_size.QuadPart > (size_t)-1 )
+    {
+        CloseHandle( file );
+        return false;
+    }
+    if( file_size.QuadPart > 0 )
+    {
+        HANDLE mapping = CreateFileMappingA( file, NULL, PAGE_READONLY, 0, 0, NULL );
+        const char *view = mapping ? (const char *)MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 ) : NULL;
+        if( !view )
+        {
+            if( mapping )
+                CloseHandle( mapping );
+            CloseHandle( file );
+            return false;
+        }
+        data           = view;
+        size           = (size_t)file_size.QuadPart;
+        mapping_handle = mapping;
+    }
+    file_handle = file;
+#else
+    int fd = open( filename, O_RDONLY );
+    if( fd < 0 )
+        return false;
+    struct stat st;
+    if( fstat(fd,&st)!=0 || (unsigned long long)st.st_size > (size_t)-1 )
+    {
+        close( fd );
+        return false;
+    }
+    if( st.st_size > 0 )
+    {
+        void *view = mmap( NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        if( view == MAP_FAILED )
+        {
+            close( fd );
+            return false;
+        }
+        if( sequential )
+            madvise( view, (size_t)st.st_size, MADV_SEQUENTIAL );
+        data = (const char *)view;
+        size = (size_t)st.st_size;
+    }
+    close( fd );    // the mapping stays valid
+#endif
+    is_open = true;
+    return true;
+}
+
+/****************************************************************************
+ * Unmap the file
+ ****************************************************************************/
+void MappedFile::Close()
+{
+    if( is_open && size>0 )
+    {
+#ifdef _WIN32
+        UnmapViewOfFile( data );
+        CloseHandle( (HANDLE)mapping_handle );
+#else
+        munmap( (void *)data, size );
+#endif
+    }
+#ifdef _WIN32
+    if( is_open )
+        CloseHandle( (HANDLE)file_handle );
+#endif
+    data           = "";
+    size           = 0;
+    is_open        = false;
+    file_handle    = NULL;
+    mapping_handle = NULL;
+}
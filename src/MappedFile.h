@@ -0,0 +1,52 @@
+/****************************************************************************
+ * MappedFile.h Chess classes - Read only memory mapped files
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+#include <stddef.h>
+
+// TripleHappyChess
+namespace thc
+{
+
+// A whole file mapped read only into memory, so big files (PGN databases
+//  and the like) can be read without copying them
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+
+    // Map a file, sequential is a hint that it will be read start to end.
+    //  return bool okay
+    bool Open( const char *filename, bool sequential=false );
+
+    // Unmap the file (Open() and the destructor do this too)
+    void Close();
+
+    // The file's contents, (an empty file gives a valid pointer and size 0)
+    const char *Data() const { return data; }
+    size_t      Size() const { return size; }
+    bool        IsOpen() const { return is_open; }
+
+// internal stuff
+private:
+
+    // Not copyable
+    MappedFile( const MappedFile& );
+    MappedFile& operator=( const MappedFile& );
+
+    //### Data
+    const char *data;
+    size_t      size;
+    bool        is_open;
+    void       *file_handle;        // Windows only
+    void       *mapping_handle;     // Windows only
+};
+
+} //namespace thc
+
+#endif //MAPPEDFILE_H
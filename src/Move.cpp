@@ -17,13 +17,75 @@
 using namespace std;
 using namespace thc;
 
+/****************************************************************************
+ * Make up a move from source and destination squares, as GenLegalMoveList()
+ *  would generate it (promotion is 'Q','R','B','N' or '\0' for the default
+ *  queen, and is ignored if the move isn't a promotion)
+ *  return bool legal
+ ****************************************************************************/
+static bool move_from_squares( ChessRules *cr, Square src, Square dst, char promotion, Move &mv )
+{
+    if( (unsigned int)src>(unsigned int)h1 || (unsigned int)dst>(unsigned int)h1 )
+        return false;
+    bool white = cr->white;
+    char piece = cr->squares[src];
+    mv.src     = src;
+    mv.dst     = dst;
+    mv.capture = cr->squares[dst];
+    mv.special = NOT_SPECIAL;
+    if( piece == (white?'K':'k') )
+    {
+        mv.special = SPECIAL_KING_MOVE;
+        if( src==(white?e1:e8) && dst==(white?g1:g8) )
+            mv.special = (white?SPECIAL_WK_CASTLING:SPECIAL_BK_CASTLING);
+        else if( src==(white?e1:e8) && dst==(white?c1:c8) )
+            mv.special = (white?SPECIAL_WQ_CASTLING:SPECIAL_BQ_CASTLING);
+    }
+    else if( piece == (white?'P':'p') )
+    {
+        if( RANK(dst) == (white?'8':'1') )
+        {
+            switch( promotion )
+            {
+                default:
+                case 'Q': mv.special = SPECIAL_PROMOTION_QUEEN;   break;
+                case 'R': mv.special = SPECIAL_PROMOTION_ROOK;    break;
+                case 'B': mv.special = SPECIAL_PROMOTION_BISHOP;  break;
+                case 'N': mv.special = SPECIAL_PROMOTION_KNIGHT;  break;
+            }
+        }
+        else if( dst==cr->enpassant_target && FILE(dst)!=FILE(src) )
+        {
+            mv.special = (white?SPECIAL_WEN_PASSANT:SPECIAL_BEN_PASSANT);
+            mv.capture = (white?'p':'P');
+        }
+        else if( RANK(src)==(white?'2':'7') && RANK(dst)==(white?'4':'5') )
+            mv.special = (white?SPECIAL_WPAWN_2SQUARES:SPECIAL_BPAWN_2SQUARES);
+    }
+    return cr->IsLegalMove( mv );
+}
+
 /****************************************************************************
  * Read natural string move eg "Nf3"
  *  return bool okay
  ****************************************************************************/
 bool Move::NaturalIn( ChessRules *cr, const char *natural_in )
 {
-    MOVELIST list;
+    size_t len=0;
+    while( len<10 && natural_in[len] )  // the most NaturalIn() ever looks at
+        len++;
+    return NaturalIn( cr, natural_in, len );
+}
+
+/****************************************************************************
+ * Read natural string move of given length eg "Nf3", for NaturalIn() and
+ *  NaturalInUnique(). If unique, input that more than one of our men
+ *  matches (eg "Nd2" if Nbd2 and Nfd2 are both legal) is rejected, rather
+ *  than resolved as the first match
+ *  return bool okay
+ ****************************************************************************/
+static bool move_natural_in( Move &result, ChessRules *cr, const char *natural_in, size_t natural_len, bool unique )
+{
     int  i, len=0;
     char src_file='\0', src_rank='\0', dst_file='\0', dst_rank='\0';
     char promotion='\0';
@@ -31,7 +93,8 @@ bool Move::NaturalIn( ChessRules *cr, const char *natural_in )
     bool kcastling=false;
     bool qcastling=false;
     Square dst_=a8;
-    Move *m, *found=NULL;
+    bool found=false;
+    Move mv;
     char *s;
     char  move[10];
     bool  white=cr->white;
@@ -43,13 +106,13 @@ bool Move::NaturalIn( ChessRules *cr, const char *natural_in )
 
     // Copy to read-write variable
     okay = false;
-    for( i=0; i<sizeof(move); i++ )
+    for( size_t j=0; j<sizeof(move); j++ )
     {
-        move[i] = natural_in[i];
-        if( move[i]=='\0' || move[i]==' ' || move[i]=='\t' ||
-            move[i]=='\r' || move[i]=='\n' )
+        move[j] = (j<natural_len ? natural_in[j] : '\0');
+        if( move[j]=='\0' || move[j]==' ' || move[j]=='\t' ||
+            move[j]=='\r' || move[j]=='\n' )
         {
-            move[i] = '\0';
+            move[j] = '\0';
             okay = true;
             break;
         }
@@ -242,923 +305,417 @@ bool Move::NaturalIn( ChessRules *cr, const char *natural_in )
         }
     }
 
-    // Check against all possible moves
+    // Check candidate source squares directly against the position. They
+    //  are tried in the order GenLegalMoveList() generates moves, so
+    //  ambiguous input is resolved as it always has been
     if( okay )
     {
-        cr->GenLegalMoveList( &list );
-
-        // Have source and destination, eg "d2d3"
         if( enpassant )
             src_rank = dst_rank = '\0';
-        if( src_file && src_rank && dst_file && dst_rank )
-        {
-            for( i=0; i<list.count; i++ )
-            {
-                m = &list.moves[i];
-                if( (default_piece || piece==cr->squares[m->src])  &&
-                    src_file  ==   FILE(m->src)       &&
-                    src_rank  ==   RANK(m->src)       &&
-                    dst_       ==   m->dst
-                )
-                {
-                    if( kcastling )
-                    {
-                        if( m->special ==
-                             (white?SPECIAL_WK_CASTLING:SPECIAL_BK_CASTLING) )
-                            found = m;
-                    }
-                    else if( qcastling )
-                    {
-                        if( m->special ==
-                             (white?SPECIAL_WQ_CASTLING:SPECIAL_BQ_CASTLING) )
-                            found = m;
-                    }
-                    else
-                        found = m;
-                    break;
-                }
-            }
-        }
-
-        // Have source file only, eg "Rae1"
-        else if( src_file && dst_file && dst_rank )
-        {
-            for( i=0; i<list.count; i++ )
-            {
-                m = &list.moves[i];
-                if( piece     ==   cr->squares[m->src]  &&
-                    src_file  ==   FILE(m->src)         &&
-                 /* src_rank  ==   RANK(m->src)  */
-                    dst_       ==   m->dst
-                )
-                {
-                    found = m;
-                    break;
-                }
-            }
-        }
 
-        // Have source rank only, eg "R2d2"
-        else if( src_rank && dst_file && dst_rank )
-        {
-            for( i=0; i<list.count; i++ )
-            {
-                m = &list.moves[i];
-                if( piece     ==   cr->squares[m->src]   &&
-                 /* src_file  ==   FILE(m->src) */
-                    src_rank  ==   RANK(m->src)          &&
-                    dst_       ==   m->dst
-                )
-                {
-                    found = m;
-                    break;
-                }
-            }
-        }
-
-        // Have destination file only eg e4f (because 2 ef moves are possible)
-        else if( src_file && src_rank && dst_file )
+        // Have source and destination, eg "d2d3"
+        if( src_file && src_rank && dst_file && dst_rank )
         {
-            for( i=0; i<list.count; i++ )
+            Square src_ = SQ(src_file,src_rank);
+            if( (default_piece || piece==cr->squares[src_]) &&
+                move_from_squares( cr, src_, dst_, promotion, mv ) )
             {
-                m = &list.moves[i];
-                if( piece     ==   cr->squares[m->src]      &&
-                    src_file  ==   FILE(m->src)             &&
-                    src_rank  ==   RANK(m->src)             &&
-                    dst_file  ==   FILE(m->dst)
-                )
-                {
-                    found = m;
-                    break;
-                }
+                if( kcastling )
+                    found = (mv.special == (white?SPECIAL_WK_CASTLING:SPECIAL_BK_CASTLING));
+                else if( qcastling )
+                    found = (mv.special == (white?SPECIAL_WQ_CASTLING:SPECIAL_BQ_CASTLING));
+                else
+                    found = true;
             }
         }
 
-        // Have files only, eg "ef"
-        else if( src_file && dst_file )
+        // Otherwise try each of our men of the right type that matches
+        //  the source file or rank if we have them, eg "Nf3", "Rae1", "R2d2",
+        //  and for pawn moves without a destination rank, eg "ef", "e4f",
+        //  the destination is the square on that file one step forward (or
+        //  two for a pawn's first move)
+        else
         {
-            for( i=0; i<list.count; i++ )
+            Bitboard men = cr->bb_pieces[ bb_index[piece&0x7f] ];
+            while( (!found || unique) && men )
             {
-                m = &list.moves[i];
-                if( piece     ==   cr->squares[m->src]      &&
-                    src_file  ==   FILE(m->src)             &&
-                 /* src_rank  ==   RANK(m->src) */
-                    dst_file  ==   FILE(m->dst)
-                )
+                Square src_ = bb_pop_lsb(men);
+                if( (src_file && src_file!=FILE(src_)) || (src_rank && src_rank!=RANK(src_)) )
+                    continue;
+                Square dst = dst_;
+                if( !dst_rank )
+                    dst = SQ( dst_file, white ? RANK(src_)+1 : RANK(src_)-1 );
+                Move candidate;
+                bool legal = move_from_squares( cr, src_, dst, promotion, candidate );
+                if( !legal && !dst_rank && dst_file==FILE(src_) )   // eg "ee"
+                    legal = move_from_squares( cr, src_, SQ( dst_file, white ? RANK(src_)+2 : RANK(src_)-2 ), promotion, candidate );
+                if( legal && found )
                 {
-                    if( enpassant )
-                    {
-                        if( m->special ==
-                             (white?SPECIAL_WEN_PASSANT:SPECIAL_BEN_PASSANT) )
-                            found = m;
-                    }
-                    else
-                        found = m;
+                    okay = false;   // ambiguous
                     break;
                 }
-            }
-        }
-
-        // Have destination square only eg "a4"
-        else if( dst_rank && dst_file )
-        {
-            for( i=0; i<list.count; i++ )
-            {
-                m = &list.moves[i];
-                if( piece     ==   cr->squares[m->src]          &&
-                    dst_       ==   m->dst
-                )
+                if( legal )
                 {
-                    found = m;
-                    break;
+                    found = true;
+                    mv = candidate;
+                    if( enpassant && mv.special!=(white?SPECIAL_WEN_PASSANT:SPECIAL_BEN_PASSANT) )
+                        okay = false;
                 }
             }
         }
     }
 
-    // Copy found move
-    if( okay && found )
+    // A promotion must be to a promotion square
+    if( okay && found && promotion )
     {
         bool found_promotion =
-            ( found->special == SPECIAL_PROMOTION_QUEEN ||
-              found->special == SPECIAL_PROMOTION_ROOK ||
-              found->special == SPECIAL_PROMOTION_BISHOP ||
-              found->special == SPECIAL_PROMOTION_KNIGHT
+            ( mv.special == SPECIAL_PROMOTION_QUEEN ||
+              mv.special == SPECIAL_PROMOTION_ROOK ||
+              mv.special == SPECIAL_PROMOTION_BISHOP ||
+              mv.special == SPECIAL_PROMOTION_KNIGHT
             );
-        if( promotion && !found_promotion )
+        if( !found_promotion )
             okay = false;
-        if( found_promotion )
-        {
-            switch( promotion )
-            {
-                default:
-                case 'Q': found->special = SPECIAL_PROMOTION_QUEEN;   break;
-                case 'R': found->special = SPECIAL_PROMOTION_ROOK;    break;
-                case 'B': found->special = SPECIAL_PROMOTION_BISHOP;  break;
-                case 'N': found->special = SPECIAL_PROMOTION_KNIGHT;  break;
-            }
-        }
     }
     if( !found )
         okay = false;
     if( okay )
-        *this = *found;
+        result = mv;
     return okay;
 }
 
+/****************************************************************************
+ * Read natural string move of given length eg "Nf3"
+ *  return bool okay
+ ****************************************************************************/
+bool Move::NaturalIn( ChessRules *cr, const char *natural_in, size_t natural_len )
+{
+    return move_natural_in( *this, cr, natural_in, natural_len, false );
+}
+
+/****************************************************************************
+ * Read natural string move of given length eg "Nf3", rejecting ambiguous
+ *  input
+ *  return bool okay
+ ****************************************************************************/
+bool Move::NaturalInUnique( ChessRules *cr, const char *natural_in, size_t natural_len )
+{
+    return move_natural_in( *this, cr, natural_in, natural_len, true );
+}
+
+/****************************************************************************
+ * Tokenise SAN with a small state machine, characters are classified and
+ *  the table gives the next state for each class
+ ****************************************************************************/
+enum SAN_CLASS { C_END, C_PIECE, C_FILE, C_RANK, C_CAPTURE, C_EQUALS, C_SUFFIX, C_OTHER, C_NBR };
+enum SAN_STATE
+{
+    S_START,
+    S_PIECE,            // eg "N"
+    S_PIECE_FILE,       // eg "Nb", destination or source file
+    S_PIECE_RANK,       // eg "N1", source rank
+    S_PIECE_CAPTURE,    // eg "Nx", "Nbx"
+    S_PIECE_SQUARE,     // eg "Nb1", destination or source square
+    S_PIECE_DST_FILE,   // eg "Nbd", "Nxd"
+    S_PIECE_DST,        // eg "Nbd2"
+    S_PAWN_FILE,        // eg "e"
+    S_PAWN_CAPTURE,     // eg "ex"
+    S_PAWN_CAPTURE_FILE,// eg "exd"
+    S_PAWN_DST,         // eg "e4", "exd5", "e8"
+    S_PROMOTION_EQUALS, // eg "e8="
+    S_PROMOTION,        // eg "e8=Q", "e8Q"
+    S_SUFFIX,           // eg "e4+", "e4!?"
+    S_NBR,
+    S_ACCEPT=S_NBR,
+    S_ERROR
+};
+
+static const unsigned char san_next[S_NBR][C_NBR] =
+{
+    //  C_END     C_PIECE       C_FILE               C_RANK        C_CAPTURE         C_EQUALS            C_SUFFIX  C_OTHER
+    { S_ERROR,  S_PIECE,     S_PAWN_FILE,         S_ERROR,        S_ERROR,         S_ERROR,            S_ERROR,  S_ERROR },  // S_START
+    { S_ERROR,  S_ERROR,     S_PIECE_FILE,        S_PIECE_RANK,   S_PIECE_CAPTURE, S_ERROR,            S_ERROR,  S_ERROR },  // S_PIECE
+    { S_ERROR,  S_ERROR,     S_PIECE_DST_FILE,    S_PIECE_SQUARE, S_PIECE_CAPTURE, S_ERROR,            S_ERROR,  S_ERROR },  // S_PIECE_FILE
+    { S_ERROR,  S_ERROR,     S_PIECE_DST_FILE,    S_ERROR,        S_PIECE_CAPTURE, S_ERROR,            S_ERROR,  S_ERROR },  // S_PIECE_RANK
+    { S_ERROR,  S_ERROR,     S_PIECE_DST_FILE,    S_ERROR,        S_ERROR,         S_ERROR,            S_ERROR,  S_ERROR },  // S_PIECE_CAPTURE
+    { S_ACCEPT, S_ERROR,     S_PIECE_DST_FILE,    S_ERROR,        S_PIECE_CAPTURE, S_ERROR,            S_SUFFIX, S_ERROR },  // S_PIECE_SQUARE
+    { S_ERROR,  S_ERROR,     S_ERROR,             S_PIECE_DST,    S_ERROR,         S_ERROR,            S_ERROR,  S_ERROR },  // S_PIECE_DST_FILE
+    { S_ACCEPT, S_ERROR,     S_ERROR,             S_ERROR,        S_ERROR,         S_ERROR,            S_SUFFIX, S_ERROR },  // S_PIECE_DST
+    { S_ERROR,  S_ERROR,     S_ERROR,             S_PAWN_DST,     S_PAWN_CAPTURE,  S_ERROR,            S_ERROR,  S_ERROR },  // S_PAWN_FILE
+    { S_ERROR,  S_ERROR,     S_PAWN_CAPTURE_FILE, S_ERROR,        S_ERROR,         S_ERROR,            S_ERROR,  S_ERROR },  // S_PAWN_CAPTURE
+    { S_ERROR,  S_ERROR,     S_ERROR,             S_PAWN_DST,     S_ERROR,         S_ERROR,            S_ERROR,  S_ERROR },  // S_PAWN_CAPTURE_FILE
+    { S_ACCEPT, S_PROMOTION, S_ERROR,             S_ERROR,        S_ERROR,         S_PROMOTION_EQUALS, S_SUFFIX, S_ERROR },  // S_PAWN_DST
+    { S_ERROR,  S_PROMOTION, S_ERROR,             S_ERROR,        S_ERROR,         S_ERROR,            S_ERROR,  S_ERROR },  // S_PROMOTION_EQUALS
+    { S_ACCEPT, S_ERROR,     S_ERROR,             S_ERROR,        S_ERROR,         S_ERROR,            S_SUFFIX, S_ERROR },  // S_PROMOTION
+    { S_ACCEPT, S_ERROR,     S_ERROR,             S_ERROR,        S_ERROR,         S_ERROR,            S_SUFFIX, S_ERROR }   // S_SUFFIX
+};
+
+static inline SAN_CLASS san_class( char c )
+{
+    if( 'a'<=c && c<='h' )
+        return C_FILE;
+    if( '1'<=c && c<='8' )
+        return C_RANK;
+    switch( c )
+    {
+        case 'K': case 'Q': case 'R': case 'B': case 'N':
+            return C_PIECE;
+        case 'x':
+            return C_CAPTURE;
+        case '=':
+            return C_EQUALS;
+        case '+': case '#': case '!': case '?':
+            return C_SUFFIX;
+        case '\0': case ' ': case '\t': case '\r': case '\n':
+            return C_END;
+    }
+    return C_OTHER;
+}
+
+// Is the rest of a move only annotation, eg "+", "#", "!?" ?
+static bool san_tail( const char *s, size_t len )
+{
+    for( size_t i=0;; i++ )
+    {
+        SAN_CLASS cls = san_class( i<len ? s[i] : '\0' );
+        if( cls == C_END )
+            return true;
+        if( cls != C_SUFFIX )
+            return false;
+    }
+}
+
 /****************************************************************************
  * Read natural string move eg "Nf3"
  *  return bool okay
- * Fast alternative for known good input
+ * Strict SAN, faster than NaturalIn() and rejects illegal and ambiguous moves
  ****************************************************************************/
 bool Move::NaturalInFast( ChessRules *cr, const char *natural_in )
 {
-    bool err = false;
-    bool found = false;
-    bool capture_ = false;
-    Move mv;
-
-    /*
-     Handles moves of the following type
-     exd8=N
-     e8=B
-     exd8N
-     e8B
-     exd5
-     e4
-     Nf3
-     Nxf3
-     Nef3
-     Nexf3
-     N2f3
-     N2xf3
-     O-O
-     O-O-O
-     */
+    return NaturalInFast( cr, natural_in, strlen(natural_in) );
+}
 
-//
+/****************************************************************************
+ * Read natural string move of given length eg "Nf3"
+ *  return bool okay
+ * Strict SAN, faster than NaturalIn() and rejects illegal and ambiguous moves
+ ****************************************************************************/
+bool Move::NaturalInFast( ChessRules *cr, const char *natural_in, size_t len )
+{
+    bool white = cr->white;
+    Move mv;
     mv.special = NOT_SPECIAL;
     mv.capture = ' ';
-    char f = *natural_in++;
 
-    // WHITE MOVE
-    if( cr->white )
+    // Castling, eg "O-O", "O-O-O" (or with zeros)
+    if( len>0 && (natural_in[0]=='O' || natural_in[0]=='0') )
     {
-
-        // Pawn move ?
-        if( 'a'<=f && f<='h' )
+        char o = natural_in[0];
+        size_t i = 1;
+        while( i+1<len && natural_in[i]=='-' && natural_in[i+1]==o )
+            i += 2;
+        if( (i!=3 && i!=5) || !san_tail(natural_in+i,len-i) )
+            return false;
+        mv.src = (white?e1:e8);
+        if( i == 3 )
         {
-            char r = *natural_in++;
-            if( r != 'x')
-            {
-
-                // Non capturing, non promoting pawn move
-                if( '3'<= r && r<= '7')
-                {
-                    mv.dst = SQ(f,r);
-                    mv.src = SOUTH(mv.dst);
-                    if( cr->squares[mv.src]=='P' && cr->squares[mv.dst]==' ')
-                        found =true;
-                    else if( r=='4' && cr->squares[mv.src]==' ' && cr->squares[mv.dst]==' ')
-                    {
-                        mv.special = SPECIAL_WPAWN_2SQUARES;
-                        mv.src = SOUTH(mv.src);
-                        found = (cr->squares[mv.src]=='P');
-                    }
-                }
-
-                // Non-capturing, promoting pawn move
-                else if( r=='8' )
-                {
-                    if( *natural_in == '=' )    // now optional
-                        natural_in++;
-                    mv.dst = SQ(f,r);
-                    mv.src = SOUTH(mv.dst);
-                    if( cr->squares[mv.src]=='P' && cr->squares[mv.dst]==' ')
-                    {
-                        switch( *natural_in++ )
-                        {
-                            default:
-                            {
-                                break;
-                            }
-                            case 'Q':
-                            case 'q':
-                            {
-                                mv.special = SPECIAL_PROMOTION_QUEEN;
-                                found = true;
-                                break;
-                            }
-                            case 'R':
-                            case 'r':
-                            {
-                                mv.special = SPECIAL_PROMOTION_ROOK;
-                                found = true;
-                                break;
-                            }
-                            case 'N':
-                            case 'n':
-                            {
-                                mv.special = SPECIAL_PROMOTION_KNIGHT;
-                                found = true;
-                                break;
-                            }
-                            case 'B':
-                            case 'b':
-                            {
-                                mv.special = SPECIAL_PROMOTION_BISHOP;
-                                found = true;
-                                break;
-                            }
-                        }
-                    }
-                }
-            }
-            else // if ( r == 'x' )
-            {
-                char g = *natural_in++;
-                if( 'a'<=g && g<='h' )
-                {
-                    r = *natural_in++;
-
-                    // Non promoting, capturing pawn move
-                    if( '3'<= r && r<= '7')
-                    {
-                        mv.dst = SQ(g,r);
-                        mv.src = SQ(f,r-1);
-                        if( cr->squares[mv.src]=='P' && IsBlack(cr->squares[mv.dst]) )
-                        {
-                            mv.capture = cr->squares[mv.dst];
-                            found = true;
-                        }
-                        else if( r=='6' && cr->squares[mv.src]=='P' && cr->squares[mv.dst]==' '  && mv.dst==cr->enpassant_target && cr->squares[SOUTH(mv.dst)]=='p' )
-                        {
-                            mv.capture = 'p';
-                            mv.special = SPECIAL_WEN_PASSANT;
-                            found = true;
-                        }
-                    }
-
-                    // Promoting, capturing pawn move
-                    else if( r=='8' )
-                    {
-                        if( *natural_in == '=' )    // now optional
-                            natural_in++;
-                        mv.dst = SQ(g,r);
-                        mv.src = SQ(f,r-1);
-                        if( cr->squares[mv.src]=='P' && IsBlack(cr->squares[mv.dst]) )
-                        {
-                            mv.capture = cr->squares[mv.dst];
-                            switch( *natural_in++ )
-                            {
-                                default:
-                                {
-                                    break;
-                                }
-                                case 'Q':
-                                case 'q':
-                                {
-                                    mv.special = SPECIAL_PROMOTION_QUEEN;
-                                    found = true;
-                                    break;
-                                }
-                                case 'R':
-                                case 'r':
-                                {
-                                    mv.special = SPECIAL_PROMOTION_ROOK;
-                                    found = true;
-                                    break;
-                                }
-                                case 'N':
-                                case 'n':
-                                {
-                                    mv.special = SPECIAL_PROMOTION_KNIGHT;
-                                    found = true;
-                                    break;
-                                }
-                                case 'B':
-                                case 'b':
-                                {
-                                    mv.special = SPECIAL_PROMOTION_BISHOP;
-                                    found = true;
-                                    break;
-                                }
-                            }
-                        }
-                    }
-                }
-            }
+            mv.dst     = (white?g1:g8);
+            mv.special = (white?SPECIAL_WK_CASTLING:SPECIAL_BK_CASTLING);
         }
         else
         {
+            mv.dst     = (white?c1:c8);
+            mv.special = (white?SPECIAL_WQ_CASTLING:SPECIAL_BQ_CASTLING);
+        }
+        if( !cr->IsLegalMove(mv) )
+            return false;
+        *this = mv;
+        return true;
+    }
 
-            // Piece move
-            const lte **ray_lookup = queen_lookup;
-            switch( f )
-            {
-                case 'O':
-                {
-                    if( 0 == memcmp(natural_in,"-O-O",4) )
-                    {
-                        natural_in += 4;
-                        mv.src = e1;
-                        mv.dst = c1;
-                        mv.capture = ' ';
-                        mv.special = SPECIAL_WQ_CASTLING;
-                        found = true;
-                    }
-                    else if( 0 == memcmp(natural_in,"-O",2) )
-                    {
-                        natural_in += 2;
-                        mv.src = e1;
-                        mv.dst = g1;
-                        mv.capture = ' ';
-                        mv.special = SPECIAL_WK_CASTLING;
-                        found = true;
-                    }
-                    break;
-                }
-
-                // King is simple special case - there's only one king so no disambiguation
-                case 'K':
-                {
-                    f = *natural_in++;
-                    if( f == 'x' )
-                    {
-                        capture_ = true;
-                        f = *natural_in++;
-                    }
-                    if( 'a'<= f && f<='h' )
-                    {
-                        char r = *natural_in++;
-                        if( '1'<=r && r<='8' )
-                        {
-                            mv.src = cr->wking_square;
-                            mv.dst = SQ(f,r);
-                            mv.special = SPECIAL_KING_MOVE;
-                            mv.capture = cr->squares[mv.dst];
-                            found = ( capture_ ? IsBlack(mv.capture) : IsEmptySquare(mv.capture) );
-                        }
-                    }
-                    break;
-                }
-
-                // Other pieces may need to check legality for disambiguation
-                case 'Q':   ray_lookup = queen_lookup;                      // fall through
-                case 'R':   if( f=='R' )    ray_lookup = rook_lookup;       // fall through
-                case 'B':   if( f=='B' )    ray_lookup = bishop_lookup;     // fall through
-                case 'N':
-                {
-                    char piece = f;
-                    f = *natural_in++;
-                    char src_file='\0';
-                    char src_rank='\0';
-                    if( f == 'x' )
-                    {
-                        capture_ = true;
-                        f = *natural_in++;
-                    }
-                    if( '1'<=f && f<='8' )
-                    {
-                        src_rank = f;
-                    }
-                    else if( 'a'<= f && f<='h' )
-                    {
-                        src_file = f;
-                    }
-                    else
-                        err = true;
-                    if( !err )
-                    {
-                        char g = *natural_in++;
-                        if( g == 'x' )
-                        {
-                            if( capture_ )
-                                err = true;
-                            else
-                            {
-                                capture_ = true;
-                                g = *natural_in++;
-                            }
-                        }
-                        if( '1'<=g && g<='8' )
-                        {
-                            if( src_file )
-                            {
-                                mv.dst = SQ(src_file,g);
-                                src_file = '\0';
-                            }
-                            else
-                                err = true;
-                        }
-                        else if( 'a'<=g && g<='h' )
-                        {
-                            char dst_rank = *natural_in++;
-                            if( '1'<=dst_rank && dst_rank<='8' )
-                                mv.dst = SQ(g,dst_rank);
+    // Tokenise, the grammar allows at most two files and two ranks, the
+    //  last of each is the destination, a first one disambiguates
+    char piece='P', promotion='\0';
+    char files[2], ranks[2];
+    int  nbr_files=0, nbr_ranks=0;
+    bool capture_=false;
+    int  state = S_START;
+    for( size_t i=0; state<S_NBR; i++ )
+    {
+        char c = (i<len ? natural_in[i] : '\0');
+        if( (state==S_PAWN_DST || state==S_PROMOTION_EQUALS) && 'a'<=c && c<='z' )
+            c = c-'a'+'A';  // allow lower case promotions eg "e8=q"
+        SAN_CLASS cls = san_class(c);
+        state = san_next[state][cls];
+        switch( cls )
+        {
+            case C_PIECE:   if( state == S_PIECE )
+                                piece = c;
                             else
-                                err = true;
-                        }
-                        else
-                            err = true;
-                        if( !err )
-                        {
-                            if( capture_ ? IsBlack(cr->squares[mv.dst]) : cr->squares[mv.dst]==' ' )
-                            {
-                                mv.capture = cr->squares[mv.dst];
-                                if( piece == 'N' )
-                                {
-                                    int count=0;
-                                    for( int probe=0; !found && probe<2; probe++ )
-                                    {
-                                        const lte *ptr = knight_lookup[mv.dst];
-                                        lte nbr_moves = *ptr++;
-                                        while( !found && nbr_moves-- )
-                                        {
-                                            Square src_ = (Square)*ptr++;
-                                            if( cr->squares[src_]=='N' )
-                                            {
-                                                bool src_file_ok = !src_file || FILE(src_)==src_file;
-                                                bool src_rank_ok = !src_rank || RANK(src_)==src_rank;
-                                                if( src_file_ok && src_rank_ok )
-                                                {
-                                                    mv.src = src_;
-                                                    if( probe == 0 )
-                                                        count++;
-                                                    else // probe==1 means disambiguate by testing whether move is legal, found will be set if
-                                                        // we are not exposing white king to check.
-                                                    {
-                                                        char temp = cr->squares[mv.dst];
-                                                        cr->squares[mv.dst] = 'N';  // temporarily make move
-                                                        cr->squares[src_] = ' ';
-                                                        found = !cr->AttackedSquare( cr->wking_square, false ); //bool AttackedSquare( Square square, bool enemy_is_white );
-                                                        cr->squares[mv.dst] = temp;  // now undo move
-                                                        cr->squares[src_] = 'N';
-                                                    }
-                                                }
-                                            }
-                                        }
-                                        if( probe==0 && count==1 )
-                                            found = true; // done, no need for disambiguation by check
-                                    }
-                                }
-                                else // if( rook, bishop, queen )
-                                {
-                                    int count = 0;
-                                    for( int probe=0; !found && probe<2; probe++ )
-                                    {
-                                        const lte *ptr = ray_lookup[mv.dst];
-                                        lte nbr_rays = *ptr++;
-                                        while( !found && nbr_rays-- )
-                                        {
-                                            lte ray_len = *ptr++;
-                                            while( !found && ray_len-- )
-                                            {
-                                                Square src_ = (Square)*ptr++;
-                                                if( !IsEmptySquare(cr->squares[src_]) )
-                                                {
-                                                    // Any piece, friend or enemy must move to end of ray
-                                                    ptr += ray_len;
-                                                    ray_len = 0;
-                                                    if( cr->squares[src_] == piece )
-                                                    {
-                                                        bool src_file_ok = !src_file || FILE(src_)==src_file;
-                                                        bool src_rank_ok = !src_rank || RANK(src_)==src_rank;
-                                                        if( src_file_ok && src_rank_ok )
-                                                        {
-                                                            mv.src = src_;
-                                                            if( probe == 0 )
-                                                                count++;
-                                                            else // probe==1 means disambiguate by testing whether move is legal, found will be set if
-                                                                // we are not exposing white king to check.
-                                                            {
-                                                                char temp = cr->squares[mv.dst];
-                                                                cr->squares[mv.dst] = piece;  // temporarily make move
-                                                                cr->squares[mv.src] = ' ';
-                                                                found = !cr->AttackedSquare( cr->wking_square, false ); //bool AttackedSquare( Square square, bool enemy_is_white );
-                                                                cr->squares[mv.dst] = temp;  // now undo move
-                                                                cr->squares[mv.src] = piece;
-                                                            }
-                                                        }
-                                                    }
-                                                }
-                                            }
-                                        }
-                                        if( probe==0 && count==1 )
-                                            found = true; // done, no need for disambiguation by check
-                                    }
-                                }
-                            }
-                        }
-                    }
-                }
-            }
+                                promotion = c;
+                            break;
+            case C_FILE:    if( state != S_ERROR )
+                                files[nbr_files++] = c;
+                            break;
+            case C_RANK:    if( state != S_ERROR )
+                                ranks[nbr_ranks++] = c;
+                            break;
+            case C_CAPTURE: capture_ = true;
+                            break;
+            default:        break;
         }
     }
-
-    // BLACK MOVE
-    else
+    if( state != S_ACCEPT )
+        return false;
+    Square dst = SQ( files[nbr_files-1], ranks[nbr_ranks-1] );
+    Bitboard occupied = cr->bb_occupied();
+    Bitboard ours     = (white ? cr->bb_white : cr->bb_black);
+    if( ours & BB(dst) )
+        return false;
+    mv.dst     = dst;
+    mv.capture = cr->squares[dst];
+
+    // Candidate source squares, found by looking back from the destination
+    //  square. Captures must be marked and other moves mustn't be
+    Bitboard candidates;
+    if( piece == 'P' )
     {
-        // Pawn move ?
-        if( 'a'<=f && f<='h' )
+        bool last_rank = (RANK(dst) == (white?'8':'1'));
+        if( last_rank != (promotion!='\0') )
+            return false;
+        switch( promotion )
         {
-            char r = *natural_in++;
-            if( r != 'x')
-            {
-
-                // Non capturing, non promoting pawn move
-                if( '2'<= r && r<= '6')
-                {
-                    mv.dst = SQ(f,r);
-                    mv.src = NORTH(mv.dst);
-                    if( cr->squares[mv.src]=='p' && cr->squares[mv.dst]==' ')
-                        found =true;
-                    else if( r=='5' && cr->squares[mv.src]==' ' && cr->squares[mv.dst]==' ')
-                    {
-                        mv.special = SPECIAL_BPAWN_2SQUARES;
-                        mv.src = NORTH(mv.src);
-                        found = (cr->squares[mv.src]=='p');
-                    }
-                }
-
-                // Non-capturing, promoting pawn move
-                else if( r=='1' )
-                {
-                    if( *natural_in == '=' )    // now optional
-                        natural_in++;
-                    mv.dst = SQ(f,r);
-                    mv.src = NORTH(mv.dst);
-                    if( cr->squares[mv.src]=='p' && cr->squares[mv.dst]==' ')
-                    {
-                        switch( *natural_in++ )
-                        {
-                            default:
-                            {
-                                break;
-                            }
-                            case 'Q':
-                            case 'q':
-                            {
-                                mv.special = SPECIAL_PROMOTION_QUEEN;
-                                found = true;
-                                break;
-                            }
-                            case 'R':
-                            case 'r':
-                            {
-                                mv.special = SPECIAL_PROMOTION_ROOK;
-                                found = true;
-                                break;
-                            }
-                            case 'N':
-                            case 'n':
-                            {
-                                mv.special = SPECIAL_PROMOTION_KNIGHT;
-                                found = true;
-                                break;
-                            }
-                            case 'B':
-                            case 'b':
-                            {
-                                mv.special = SPECIAL_PROMOTION_BISHOP;
-                                found = true;
-                                break;
-                            }
-                        }
-                    }
-                }
-            }
-            else // if ( r == 'x' )
+            case '\0':                                              break;
+            case 'Q':   mv.special = SPECIAL_PROMOTION_QUEEN;       break;
+            case 'R':   mv.special = SPECIAL_PROMOTION_ROOK;        break;
+            case 'B':   mv.special = SPECIAL_PROMOTION_BISHOP;      break;
+            case 'N':   mv.special = SPECIAL_PROMOTION_KNIGHT;      break;
+            default:    return false;
+        }
+        if( capture_ )
+        {
+            // A pawn attacks dst from the squares an enemy pawn on dst attacks
+            candidates = (white ? pawn_black_attacks_bb[dst] : pawn_white_attacks_bb[dst])
+                       & (0x0101010101010101ULL << (files[0]-'a'));
+            if( dst==cr->enpassant_target && IsEmptySquare(mv.capture) )
             {
-                char g = *natural_in++;
-                if( 'a'<=g && g<='h' )
-                {
-                    r = *natural_in++;
-
-                    // Non promoting, capturing pawn move
-                    if( '2'<= r && r<= '6')
-                    {
-                        mv.dst = SQ(g,r);
-                        mv.src = SQ(f,r+1);
-                        if( cr->squares[mv.src]=='p' && IsWhite(cr->squares[mv.dst]) )
-                        {
-                            mv.capture = cr->squares[mv.dst];
-                            found = true;
-                        }
-                        else if( r=='3' && cr->squares[mv.src]=='p' && cr->squares[mv.dst]==' '  && mv.dst==cr->enpassant_target && cr->squares[NORTH(mv.dst)]=='P' )
-                        {
-                            mv.capture = 'P';
-                            mv.special = SPECIAL_BEN_PASSANT;
-                            found = true;
-                        }
-                    }
-
-                    // Promoting, capturing pawn move
-                    else if( r=='1' )
-                    {
-                        if( *natural_in == '=' )    // now optional
-                            natural_in++;
-                        mv.dst = SQ(g,r);
-                        mv.src = SQ(f,r+1);
-                        if( cr->squares[mv.src]=='p' && IsWhite(cr->squares[mv.dst]) )
-                        {
-                            mv.capture = cr->squares[mv.dst];
-                            switch( *natural_in++ )
-                            {
-                                default:
-                                {
-                                    break;
-                                }
-                                case 'Q':
-                                case 'q':
-                                {
-                                    mv.special = SPECIAL_PROMOTION_QUEEN;
-                                    found = true;
-                                    break;
-                                }
-                                case 'R':
-                                case 'r':
-                                {
-                                    mv.special = SPECIAL_PROMOTION_ROOK;
-                                    found = true;
-                                    break;
-                                }
-                                case 'N':
-                                case 'n':
-                                {
-                                    mv.special = SPECIAL_PROMOTION_KNIGHT;
-                                    found = true;
-                                    break;
-                                }
-                                case 'B':
-                                case 'b':
-                                {
-                                    mv.special = SPECIAL_PROMOTION_BISHOP;
-                                    found = true;
-                                    break;
-                                }
-                            }
-                        }
-                    }
-                }
+                mv.special = (white?SPECIAL_WEN_PASSANT:SPECIAL_BEN_PASSANT);
+                mv.capture = (white?'p':'P');
             }
+            else if( IsEmptySquare(mv.capture) )
+                return false;
         }
         else
         {
-
-            // Piece move
-            const lte **ray_lookup=queen_lookup;
-            switch( f )
+            if( !IsEmptySquare(mv.capture) || RANK(dst)==(white?'1':'8') || RANK(dst)==(white?'2':'7') )
+                return false;
+            Square src = (white ? SOUTH(dst) : NORTH(dst));
+            if( IsEmptySquare(cr->squares[src]) && RANK(dst)==(white?'4':'5') )
             {
-                case 'O':
-                {
-                    if( 0 == memcmp(natural_in,"-O-O",4) )
-                    {
-                        natural_in += 4;
-                        mv.src = e8;
-                        mv.dst = c8;
-                        mv.capture = ' ';
-                        mv.special = SPECIAL_BQ_CASTLING;
-                        found = true;
-                    }
-                    else if( 0 == memcmp(natural_in,"-O",2) )
-                    {
-                        natural_in += 2;
-                        mv.src = e8;
-                        mv.dst = g8;
-                        mv.capture = ' ';
-                        mv.special = SPECIAL_BK_CASTLING;
-                        found = true;
-                    }
-                    break;
-                }
-
-                // King is simple special case - there's only one king so no disambiguation
-                case 'K':
-                {
-                    f = *natural_in++;
-                    if( f == 'x' )
-                    {
-                        capture_ = true;
-                        f = *natural_in++;
-                    }
-                    if( 'a'<= f && f<='h' )
-                    {
-                        char r = *natural_in++;
-                        if( '1'<=r && r<='8' )
-                        {
-                            mv.src = cr->bking_square;
-                            mv.dst = SQ(f,r);
-                            mv.special = SPECIAL_KING_MOVE;
-                            mv.capture = cr->squares[mv.dst];
-                            found = ( capture_ ? IsWhite(mv.capture) : IsEmptySquare(mv.capture) );
-                        }
-                    }
-                    break;
-                }
-
-                // Other pieces may need to check legality for disambiguation
-                case 'Q':   ray_lookup = queen_lookup;                      // fall through
-                case 'R':   if( f=='R' )    ray_lookup = rook_lookup;       // fall through
-                case 'B':   if( f=='B' )    ray_lookup = bishop_lookup;     // fall through
-                case 'N':
-                {
-                    char piece = static_cast<char>(tolower(f));
-                    f = *natural_in++;
-                    char src_file='\0';
-                    char src_rank='\0';
-                    if( f == 'x' )
-                    {
-                        capture_ = true;
-                        f = *natural_in++;
-                    }
-                    if( '1'<=f && f<='8' )
-                    {
-                        src_rank = f;
-                    }
-                    else if( 'a'<= f && f<='h' )
-                    {
-                        src_file = f;
-                    }
-                    else
-                        err = true;
-                    if( !err )
-                    {
-                        char g = *natural_in++;
-                        if( g == 'x' )
-                        {
-                            if( capture_ )
-                                err = true;
-                            else
-                            {
-                                capture_ = true;
-                                g = *natural_in++;
-                            }
-                        }
-                        if( '1'<=g && g<='8' )
-                        {
-                            if( src_file )
-                            {
-                                mv.dst = SQ(src_file,g);
-                                src_file = '\0';
-                            }
-                            else
-                                err = true;
-                        }
-                        else if( 'a'<=g && g<='h' )
-                        {
-                            char dst_rank = *natural_in++;
-                            if( '1'<=dst_rank && dst_rank<='8' )
-                                mv.dst = SQ(g,dst_rank);
-                            else
-                                err = true;
-                        }
-                        else
-                            err = true;
-                        if( !err )
-                        {
-                            if( capture_ ? IsWhite(cr->squares[mv.dst]) : cr->squares[mv.dst]==' ' )
-                            {
-                                mv.capture = cr->squares[mv.dst];
-                                if( piece == 'n' )
-                                {
-                                    int count=0;
-                                    for( int probe=0; !found && probe<2; probe++ )
-                                    {
-                                        const lte *ptr = knight_lookup[mv.dst];
-                                        lte nbr_moves = *ptr++;
-                                        while( !found && nbr_moves-- )
-                                        {
-                                            Square src_ = (Square)*ptr++;
-                                            if( cr->squares[src_]=='n' )
-                                            {
-                                                bool src_file_ok = !src_file || FILE(src_)==src_file;
-                                                bool src_rank_ok = !src_rank || RANK(src_)==src_rank;
-                                                if( src_file_ok && src_rank_ok )
-                                                {
-                                                    mv.src = src_;
-                                                    if( probe == 0 )
-                                                        count++;
-                                                    else // probe==1 means disambiguate by testing whether move is legal, found will be set if
-                                                        // we are not exposing black king to check.
-                                                    {
-                                                        char temp = cr->squares[mv.dst];
-                                                        cr->squares[mv.dst] = 'n';  // temporarily make move
-                                                        cr->squares[mv.src] = ' ';
-                                                        found = !cr->AttackedSquare( cr->bking_square, true ); //bool AttackedSquare( Square square, bool enemy_is_white );
-                                                        cr->squares[mv.dst] = temp;  // now undo move
-                                                        cr->squares[mv.src] = 'n';
-                                                    }
-                                                }
-                                            }
-                                        }
-                                        if( probe==0 && count==1 )
-                                            found = true; // done, no need for disambiguation by check
-                                    }
-                                }
-                                else // if( rook, bishop, queen )
-                                {
-                                    int count = 0;
-                                    for( int probe=0; !found && probe<2; probe++ )
-                                    {
-                                        const lte *ptr = ray_lookup[mv.dst];
-                                        lte nbr_rays = *ptr++;
-                                        while( !found && nbr_rays-- )
-                                        {
-                                            lte ray_len = *ptr++;
-                                            while( !found && ray_len-- )
-                                            {
-                                                Square src_ = (Square)*ptr++;
-                                                if( !IsEmptySquare(cr->squares[src_]) )
-                                                {
-                                                    // Any piece, friend or enemy must move to end of ray
-                                                    ptr += ray_len;
-                                                    ray_len = 0;
-                                                    if( cr->squares[src_] == piece )
-                                                    {
-                                                        bool src_file_ok = !src_file || FILE(src_)==src_file;
-                                                        bool src_rank_ok = !src_rank || RANK(src_)==src_rank;
-                                                        if( src_file_ok && src_rank_ok )
-                                                        {
-                                                            mv.src = src_;
-                                                            if( probe == 0 )
-                                                                count++;
-                                                            else // probe==1 means disambiguate by testing whether move is legal, found will be set if
-                                                                // we are not exposing black king to check.
-                                                            {
-                                                                char temp = cr->squares[mv.dst];
-                                                                cr->squares[mv.dst] = piece;  // temporarily make move
-                                                                cr->squares[mv.src] = ' ';
-                                                                found = !cr->AttackedSquare( cr->bking_square, true ); //bool AttackedSquare( Square square, bool enemy_is_white );
-                                                                cr->squares[mv.dst] = temp;  // now undo move
-                                                                cr->squares[mv.src] = piece;
-                                                            }
-                                                        }
-                                                    }
-                                                }
-                                            }
-                                        }
-                                        if( probe==0 && count==1 )
-                                            found = true; // done, no need for disambiguation by check
-                                    }
-                                }
-                            }
-                        }
-                    }
-                }
+                src = (white ? SOUTH(src) : NORTH(src));
+                mv.special = (white?SPECIAL_WPAWN_2SQUARES:SPECIAL_BPAWN_2SQUARES);
             }
+            candidates = BB(src);
         }
+        candidates &= cr->bb_pieces[ white ? BB_WPAWN : BB_BPAWN ];
     }
-    if( found )
+    else
     {
-        char c = *natural_in;
-        bool problem = (isascii(c) && isalnum(c));
-        if( problem )
-            found = false;
+        if( capture_ == IsEmptySquare(mv.capture) )
+            return false;
+        switch( piece )
+        {
+            default:
+            case 'N':   candidates = knight_attacks_bb[dst];                    break;
+            case 'B':   candidates = bishop_attacks_bb(dst,occupied);           break;
+            case 'R':   candidates = rook_attacks_bb(dst,occupied);             break;
+            case 'Q':   candidates = queen_attacks_bb(dst,occupied);            break;
+            case 'K':   candidates = king_attacks_bb[dst];
+                        mv.special = SPECIAL_KING_MOVE;                         break;
+        }
+        candidates &= cr->bb_pieces[ bb_index[ white ? piece : piece-'A'+'a' ] ];
+        if( nbr_files == 2 )
+            candidates &= (0x0101010101010101ULL << (files[0]-'a'));
+        if( nbr_ranks == 2 )
+            candidates &= ((Bitboard)0xff << ('8'-ranks[0])*8);
+    }
+
+    // Exactly one candidate must be legal. Normally there's only one
+    //  anyway, and we check it by looking for attacks on our king with the
+    //  move made on the occupied squares
+    Square king_square = (Square)(white ? cr->wking_square : cr->bking_square);
+    bool king_present  = (cr->squares[king_square] == (white?'K':'k'));
+    int  nbr_legal = 0;
+    Move legal_mv;
+    while( candidates )
+    {
+        mv.src = bb_pop_lsb(candidates);
+        bool legal;
+        if( !king_present || mv.special==SPECIAL_WEN_PASSANT || mv.special==SPECIAL_BEN_PASSANT )
+            legal = cr->IsLegalMove( mv );  // unusual, so check it the long way
+        else if( mv.src == king_square )
+            legal = !cr->AttackersTo( dst, !white, occupied & ~BB(king_square) );
         else
-            *this = mv;
+            legal = !( cr->AttackersTo( king_square, !white, (occupied & ~BB(mv.src)) | BB(dst) ) & ~BB(dst) );
+        if( legal )
+        {
+            legal_mv = mv;
+            if( ++nbr_legal > 1 )
+                return false;   // ambiguous
+        }
+    }
+    if( nbr_legal != 1 )
+        return false;
+    *this = legal_mv;
+    return true;
+}
+
+/****************************************************************************
+ * Unpack a PackedMove, the position supplies capture
+ ****************************************************************************/
+Move PackedMove::Unpack( const ChessPosition &cp ) const
+{
+    Move mv;
+    mv.src     = Src();
+    mv.dst     = Dst();
+    mv.special = Special();
+    if( mv.special == SPECIAL_WEN_PASSANT )
+        mv.capture = 'p';
+    else if( mv.special == SPECIAL_BEN_PASSANT )
+        mv.capture = 'P';
+    else
+        mv.capture = cp.squares[mv.dst];
+    return mv;
+}
+
+/****************************************************************************
+ * Could a PackedMove be a move ?
+ *  return bool valid
+ ****************************************************************************/
+bool PackedMove::Valid() const
+{
+    int src = Src();
+    int dst = Dst();
+    if( src == dst )
+        return false;
+    switch( Special() )
+    {
+        case NOT_SPECIAL:
+        case SPECIAL_KING_MOVE:         return true;
+        case SPECIAL_WK_CASTLING:       return src==e1 && dst==g1;
+        case SPECIAL_BK_CASTLING:       return src==e8 && dst==g8;
+        case SPECIAL_WQ_CASTLING:       return src==e1 && dst==c1;
+        case SPECIAL_BQ_CASTLING:       return src==e8 && dst==c8;
+        case SPECIAL_PROMOTION_QUEEN:
+        case SPECIAL_PROMOTION_ROOK:
+        case SPECIAL_PROMOTION_BISHOP:
+        case SPECIAL_PROMOTION_KNIGHT:  return (src/8==1 && dst/8==0) || (src/8==6 && dst/8==7);
+        case SPECIAL_WPAWN_2SQUARES:    return src/8==6 && dst==src-16;
+        case SPECIAL_BPAWN_2SQUARES:    return src/8==1 && dst==src+16;
+        case SPECIAL_WEN_PASSANT:       return src/8==3 && dst/8==2;
+        case SPECIAL_BEN_PASSANT:       return src/8==4 && dst/8==5;
     }
-    return found;
+    return false;   // unknown special
 }
 
 /****************************************************************************
@@ -1167,10 +724,17 @@ bool Move::NaturalInFast( ChessRules *cr, const char *natural_in )
  ****************************************************************************/
 bool Move::TerseIn( ChessRules *cr, const char *tmove )
 {
-    MOVELIST list;
-    int i;
+    return TerseIn( cr, tmove, strlen(tmove) );
+}
+
+/****************************************************************************
+ * Read terse string move of given length eg "g1f3"
+ *  return bool okay
+ ****************************************************************************/
+bool Move::TerseIn( ChessRules *cr, const char *tmove, size_t len )
+{
     bool okay=false;
-    if( strlen(tmove)>=4 && 'a'<=tmove[0] && tmove[0]<='h'
+    if( len>=4 && 'a'<=tmove[0] && tmove[0]<='h'
                          && '1'<=tmove[1] && tmove[1]<='8'
                          && 'a'<=tmove[2] && tmove[2]<='h'
                          && '1'<=tmove[3] && tmove[3]<='8' )
@@ -1178,7 +742,7 @@ bool Move::TerseIn( ChessRules *cr, const char *tmove )
         Square src_   = SQ(tmove[0],tmove[1]);
         Square dst_   = SQ(tmove[2],tmove[3]);
         char   expected_promotion_if_any = 'Q';
-        if( tmove[4] )
+        if( len>4 && tmove[4] )
         {
             if( tmove[4]=='n' || tmove[4]=='N' )
                 expected_promotion_if_any = 'N';
@@ -1188,44 +752,12 @@ bool Move::TerseIn( ChessRules *cr, const char *tmove )
                 expected_promotion_if_any = 'R';
         }
 
-        // Generate legal moves, then search for this move
-        cr->GenLegalMoveList( &list );
-        for( i=0; !okay && i<list.count; i++ )
-        {
-            if( list.moves[i].dst==dst_ && list.moves[i].src==src_ )
-            {
-                switch( list.moves[i].special )
-                {
-                    default:    okay=true;  break;
-                    case SPECIAL_PROMOTION_QUEEN:
-                    {
-                        if( expected_promotion_if_any == 'Q' )
-                            okay = true;
-                        break;
-                    }
-                    case SPECIAL_PROMOTION_ROOK:
-                    {
-                        if( expected_promotion_if_any == 'R' )
-                            okay = true;
-                        break;
-                    }
-                    case SPECIAL_PROMOTION_BISHOP:
-                    {
-                        if( expected_promotion_if_any == 'B' )
-                            okay = true;
-                        break;
-                    }
-                    case SPECIAL_PROMOTION_KNIGHT:
-                    {
-                        if( expected_promotion_if_any == 'N' )
-                            okay = true;
-                        break;
-                    }
-                }
-            }
-            if( okay )
-                *this = list.moves[i];
-        }
+        // Check this move directly, rather than searching for it in the
+        //  legal move list
+        Move mv;
+        okay = move_from_squares( cr, src_, dst_, expected_promotion_if_any, mv );
+        if( okay )
+            *this = mv;
     }
     return okay;
 }
@@ -1235,6 +767,18 @@ bool Move::TerseIn( ChessRules *cr, const char *tmove )
  *    eg "Nf3"
  ****************************************************************************/
 std::string Move::NaturalOut( ChessRules *cr )
+{
+    char buf[NATURAL_MOVE_SIZE];
+    NaturalOut( cr, buf );
+    return buf;
+}
+
+/****************************************************************************
+ * Convert to natural string in a buffer
+ *    eg "Nf3"
+ *  return length
+ ****************************************************************************/
+int Move::NaturalOut( ChessRules *cr, char natural_out[NATURAL_MOVE_SIZE] )
 {
 
 // Improved algorithm
@@ -1248,7 +792,7 @@ std::string Move::NaturalOut( ChessRules *cr )
         Nb1d2 or Nb1xd2 (fallback if nothing else works)
     */
 
-    char nmove[10];
+    char *nmove = natural_out;
     nmove[0] = '-';
     nmove[1] = '-';
     nmove[2] = '\0';
@@ -1423,13 +967,13 @@ std::string Move::NaturalOut( ChessRules *cr )
         if( do_loop && matches==1 )
             done = true;
     }   // end loop for all algorithms
+    char *s = strchr(nmove,'\0');
     if( append )
     {
-        char *s = strchr(nmove,'\0');
         *s++ = append;
         *s = '\0';
     }
-    return nmove;
+    return (int)(s-nmove);
 }
 
 /****************************************************************************
@@ -1437,7 +981,17 @@ std::string Move::NaturalOut( ChessRules *cr )
  ****************************************************************************/
 std::string Move::TerseOut()
 {
-    char tmove[6];
+    char buf[TERSE_MOVE_SIZE];
+    TerseOut( buf );
+    return buf;
+}
+
+/****************************************************************************
+ * Convert to terse string in a buffer eg "e7e8q"
+ *  return length
+ ****************************************************************************/
+int Move::TerseOut( char tmove[TERSE_MOVE_SIZE] )
+{
     if( src == dst )   // null move should be "0000" according to UCI spec
     {
         tmove[0] = '0';
@@ -1464,6 +1018,6 @@ std::string Move::TerseOut()
             tmove[4] = '\0';
         tmove[5] = '\0';
     }
-    return tmove;
+    return tmove[4] ? 5 : 4;
 }
 
@@ -12,6 +12,7 @@
 // TripleHappyChess
 namespace thc
 {
+class ChessPosition;
 class ChessRules;
 
 // Our representation of a chess move
@@ -62,21 +63,99 @@ public:
     //  return bool okay
     bool NaturalIn( ChessRules *cr, const char *natural_in );
 
+    // Read natural string move of given length (needn't be '\0' terminated)
+    //  return bool okay
+    bool NaturalIn( ChessRules *cr, const char *natural_in, size_t len );
+#ifdef THC_HAVE_STRING_VIEW
+    bool NaturalIn( ChessRules *cr, std::string_view natural_in )
+        { return NaturalIn( cr, natural_in.data(), natural_in.size() ); }
+#endif
+
+    // As forgiving as NaturalIn(), but rejects input that matches more
+    //  than one legal move (NaturalIn() takes the first), eg "Nd2" if Nbd2
+    //  and Nfd2 are both legal
+    //  return bool okay
+    bool NaturalInUnique( ChessRules *cr, const char *natural_in, size_t len );
+
     // Read natural string move eg "Nf3"
     //  return bool okay
-    // Fast alternative for known good input
+    // Fast alternative, for strict SAN only (NaturalIn() is more forgiving),
+    //  rejects illegal moves and ambiguous moves, eg "Nd2" if Nbd2 and Nfd2
+    //  are both legal, so it's safe for untrusted input
     bool NaturalInFast( ChessRules *cr, const char *natural_in );
 
+    // Read natural string move of given length (needn't be '\0' terminated)
+    //  return bool okay
+    bool NaturalInFast( ChessRules *cr, const char *natural_in, size_t len );
+#ifdef THC_HAVE_STRING_VIEW
+    bool NaturalInFast( ChessRules *cr, std::string_view natural_in )
+        { return NaturalInFast( cr, natural_in.data(), natural_in.size() ); }
+#endif
+
     // Read terse string move eg "g1f3"
     //  return bool okay
     bool TerseIn( ChessRules *cr, const char *tmove );
 
+    // Read terse string move of given length (needn't be '\0' terminated)
+    //  return bool okay
+    bool TerseIn( ChessRules *cr, const char *tmove, size_t len );
+#ifdef THC_HAVE_STRING_VIEW
+    bool TerseIn( ChessRules *cr, std::string_view tmove )
+        { return TerseIn( cr, tmove.data(), tmove.size() ); }
+#endif
+
     // Convert to natural string
     //  eg "Nf3"
     std::string NaturalOut( ChessRules *cr );
 
+    // Convert to natural string in a buffer (no memory allocation)
+    //  return length
+    int NaturalOut( ChessRules *cr, char natural_out[NATURAL_MOVE_SIZE] );
+
     // Convert to terse string eg "e7e8q"
     std::string TerseOut();
+
+    // Convert to terse string in a buffer (no memory allocation)
+    //  return length
+    int TerseOut( char terse_out[TERSE_MOVE_SIZE] );
+};
+
+// A move in only 16 bits, for game storage, hash tables and the like; a
+//  return of sorts for the FMOVE. Bits 0-5 are src, bits 6-11 dst and bits
+//  12-15 special (all the SPECIAL values fit). The one thing a Move has
+//  that a PackedMove doesn't is capture, so unpacking takes it from the
+//  position the move is played in, no move generation needed. As for Move,
+//  there is no constructor on purpose, and 0 (a8a8) is invalid
+class PackedMove
+{
+public:
+    uint16_t bits;
+
+    bool operator ==(const PackedMove &other) const { return bits == other.bits; }
+    bool operator !=(const PackedMove &other) const { return bits != other.bits; }
+
+    void    Invalid()       { bits = 0; }
+
+    // Could this be a move ? Rejects 0 (and any src==dst), unknown special
+    //  values and special values that don't fit the squares (castling that
+    //  isn't from e1 or e8, promotion not to the last rank and so on).
+    //  It knows nothing of the position, so a valid PackedMove (from a hash
+    //  table say, where entries can be corrupted or collide) isn't
+    //  necessarily legal, callers must check that
+    bool    Valid() const;
+    Square  Src() const     { return (Square)(bits&0x3f); }
+    Square  Dst() const     { return (Square)((bits>>6)&0x3f); }
+    SPECIAL Special() const { return (SPECIAL)(bits>>12); }
+
+    // Pack a Move, everything but capture is kept
+    void Pack( Move mv )
+    {
+        bits = (uint16_t)( (mv.src&0x3f) | ((mv.dst&0x3f)<<6) | ((mv.special&0xf)<<12) );
+    }
+
+    // Unpack to a Move, exactly the Move that was packed if it was a legal
+    //  (or pseudo-legal) move in this position
+    Move Unpack( const ChessPosition &cp ) const;
 };
 
 // List of moves
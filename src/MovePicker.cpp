@@ -0,0 +1,210 @@
+/****************************************************************************
+ * MovePicker.cpp Chess classes - Staged move generation for searches
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#define _CRT_SECURE_NO_WARNINGS
+#include <stdio.h>
+#include <string.h>
+#include "MovePicker.h"
+#include "PrivateChessDefs.h"
+using namespace std;
+using namespace thc;
+
+// Value of captured and capturing men, for most valuable victim, least
+//  valuable attacker ordering of captures
+static int picker_value( char piece )
+{
+    switch( piece )
+    {
+        case 'P': case 'p': return 1;
+        case 'N': case 'n': return 3;
+        case 'B': case 'b': return 3;
+        case 'R': case 'r': return 5;
+        case 'Q': case 'q': return 9;
+        case 'K': case 'k': return 10;
+    }
+    return 0;
+}
+
+/****************************************************************************
+ * Constructor
+ ****************************************************************************/
+MovePicker::MovePicker( ChessEvaluation &cr_, Move hash_move_, const Move *killers_,
+                                     int nbr_killers_, const int (*history_)[64] )
+    : cr(cr_)
+{
+    stage        = STAGE_HASH;
+    hash_move    = hash_move_;
+    nbr_killers  = 0;
+    for( int i=0; killers_ && i<nbr_killers_ && i<2; i++ )
+        killers[nbr_killers++] = killers_[i];
+    history      = history_;
+    idx          = 0;
+    nbr_captures = 0;
+    nbr_losing   = 0;
+    list.count   = 0;
+    cr.LegalityMasks( pinned, evasions );
+}
+
+/****************************************************************************
+ * Get the next legal move, returns false if there are no more
+ ****************************************************************************/
+bool MovePicker::Next( Move &mv )
+{
+    for(;;)
+    {
+        switch( stage )
+        {
+            case STAGE_HASH:
+            {
+                stage = STAGE_CAPTURES_INIT;
+                if( hash_move.Valid() && cr.IsPseudoLegal(hash_move) && Legal(hash_move) )
+                {
+                    mv = hash_move;
+                    return true;
+                }
+                hash_move.Invalid();
+                break;
+            }
+
+            case STAGE_CAPTURES_INIT:
+            {
+                cr.GenCaptureList( &list );
+                nbr_captures = list.count;
+                for( int i=0; i<nbr_captures; i++ )
+                {
+                    Move m = list.moves[i];
+                    scores[i] = picker_value(m.capture)*16 - picker_value(cr.squares[m.src]);
+                    if( m.special == SPECIAL_PROMOTION_QUEEN )
+                        scores[i] += 9*16;
+                }
+                idx = 0;
+                stage = STAGE_WINNING_CAPTURES;
+                break;
+            }
+
+            // Captures that lose material (by SEE) are put aside until last
+            case STAGE_WINNING_CAPTURES:
+            {
+                while( idx < nbr_captures )
+                {
+                    PickBest( idx, nbr_captures );
+                    Move m = list.moves[idx++];
+                    if( m==hash_move || !Legal(m) )
+                        continue;
+                    if( !cr.SEEGreaterEqual(m,0) )
+                    {
+                        list.moves[idx-1] = list.moves[nbr_losing];
+                        list.moves[nbr_losing++] = m;
+                        continue;
+                    }
+                    mv = m;
+                    return true;
+                }
+                idx = 0;
+                stage = STAGE_KILLERS;
+                break;
+            }
+
+            // Killers are quiet moves that caused a cutoff in a sibling
+            //  position, so they need checking here
+            case STAGE_KILLERS:
+            {
+                while( idx < nbr_killers )
+                {
+                    Move m = killers[idx++];
+                    if( m.Valid() && m!=hash_move && (idx==1 || m!=killers[0]) &&
+                        IsEmptySquare(m.capture) && m.special!=SPECIAL_PROMOTION_QUEEN &&
+                        cr.IsPseudoLegal(m) && Legal(m) )
+                    {
+                        mv = m;
+                        return true;
+                    }
+
+                    // Not picked, so the quiet stage mustn't skip it
+                    if( idx==1 || m!=killers[0] )
+                        killers[idx-1].Invalid();
+                }
+                stage = STAGE_QUIETS_INIT;
+                break;
+            }
+
+            case STAGE_QUIETS_INIT:
+            {
+                MOVELIST quiets;
+                cr.GenQuietList( &quiets );
+                for( int i=0; i<quiets.count; i++ )
+                {
+                    Move m = quiets.moves[i];
+                    list.moves[nbr_captures+i] = m;
+                    scores[nbr_captures+i] = history ? history[m.src][m.dst] : 0;
+                }
+                list.count = nbr_captures + quiets.count;
+                idx = nbr_captures;
+                stage = STAGE_QUIETS;
+                break;
+            }
+
+            case STAGE_QUIETS:
+            {
+                while( idx < list.count )
+                {
+                    PickBest( idx, list.count );
+                    Move m = list.moves[idx++];
+                    if( m == hash_move )
+                        continue;
+                    if( (nbr_killers>0 && m==killers[0]) || (nbr_killers>1 && m==killers[1]) )
+                        continue;
+                    if( Legal(m) )
+                    {
+                        mv = m;
+                        return true;
+                    }
+                }
+                idx = 0;
+                stage = STAGE_LOSING_CAPTURES;
+                break;
+            }
+
+            // Already checked for legality
+            case STAGE_LOSING_CAPTURES:
+            {
+                if( idx < nbr_losing )
+                {
+                    mv = list.moves[idx++];
+                    return true;
+                }
+                stage = STAGE_DONE;
+                break;
+            }
+
+            default:
+                return false;
+        }
+    }
+}
+
+/****************************************************************************
+ * Swap the best scoring move in list[from..end) into list[from] (incremental
+ *  selection sort, cutoffs mean we rarely need them all)
+ ****************************************************************************/
+void MovePicker::PickBest( int from, int end )
+{
+    int best = from;
+    for( int i=from+1; i<end; i++ )
+    {
+        if( scores[i] > scores[best] )
+            best = i;
+    }
+    if( best != from )
+    {
+        Move tmp_move = list.moves[from];
+        list.moves[from] = list.moves[best];
+        list.moves[best] = tmp_move;
+        int tmp_score = scores[from];
+        scores[from] = scores[best];
+        scores[best] = tmp_score;
+    }
+}
@@ -0,0 +1,71 @@
+/****************************************************************************
+ * MovePicker.h Chess classes - Staged move generation for searches
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#ifndef MOVEPICKER_H
+#define MOVEPICKER_H
+#include "ChessEvaluation.h"
+#include "Move.h"
+
+// TripleHappyChess
+namespace thc
+{
+
+// Yields the legal moves of a position one at a time, in the order a search
+//  wants to try them; hash move, winning captures, killers, quiet moves by
+//  history, losing captures. Each stage is only generated when it's reached,
+//  so if the search gets a cutoff early the later stages cost nothing
+class MovePicker
+{
+public:
+    // The hash move and killers are only picked if they are legal here (so
+    //  they can come from a different position). history[src][dst] orders
+    //  the quiet moves (NULL if not available). The position mustn't
+    //  change between calls to Next() (make/unmake pairs are fine)
+    MovePicker( ChessEvaluation &cr, Move hash_move, const Move *killers=NULL,
+                                     int nbr_killers=0, const int (*history)[64]=NULL );
+
+    // Get the next legal move, returns false if there are no more
+    bool Next( Move &mv );
+
+// internal stuff
+private:
+    enum STAGE
+    {
+        STAGE_HASH,
+        STAGE_CAPTURES_INIT,
+        STAGE_WINNING_CAPTURES,
+        STAGE_KILLERS,
+        STAGE_QUIETS_INIT,
+        STAGE_QUIETS,
+        STAGE_LOSING_CAPTURES,
+        STAGE_DONE
+    };
+
+    // Swap the best scoring move in list[from..end) into list[from]
+    void PickBest( int from, int end );
+
+    // Is a generated move legal ?
+    bool Legal( Move mv ) { return cr.PseudoLegalIsLegal( mv, pinned, evasions ); }
+
+    //### Data
+    ChessEvaluation   &cr;
+    int               stage;
+    Move              hash_move;
+    Move              killers[2];
+    int               nbr_killers;
+    const int       (*history)[64];
+    Bitboard          pinned;
+    Bitboard          evasions;
+    MOVELIST          list;             // captures, then quiet moves
+    int               scores[MAXMOVES];
+    int               idx;
+    int               nbr_captures;
+    int               nbr_losing;       // losing captures are moved to the front of list
+};
+
+} //namespace thc
+
+#endif //MOVEPICKER_H
@@ -0,0 +1,205 @@
+/****************************************************************************
+ * PgnPipeline.cpp Chess classes - Read PGN files on multiple threads
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#define _CRT_SECURE_NO_WARNINGS
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include "PgnPipeline.h"
+using namespace std;
+using namespace thc;
+
+/****************************************************************************
+ * Constructor
+ ****************************************************************************/
+PgnPipeline::PgnPipeline()
+{
+    chunk_size  = 1024*1024;
+    queue_size  = 4;
+    ordered     = true;
+    lenient     = false;
+    text        = "";
+    window      = 0;
+    next_chunk  = 0;
+    nbr_reduced = 0;
+    queue       = NULL;
+    nbr_pushed  = 0;
+}
+
+/****************************************************************************
+ * Split PGN text into chunks of whole games
+ ****************************************************************************/
+void PgnPipeline::Split( const char *text, size_t len, size_t chunk_size, std::vector<PgnChunk> &chunks )
+{
+    chunks.clear();
+    size_t start = 0;
+    while( start < len )
+    {
+        // Look for "\n[Event " from chunk_size bytes on
+        size_t end = len;
+        if( chunk_size < len-start )
+        {
+            const char *p   = text + start + chunk_size;
+            const char *eot = text + len;
+            while( p < eot )
+            {
+                p = (const char *)memchr( p, '[', eot-p );
+                if( !p )
+                    break;
+                if( p[-1]=='\n' && eot-p>=7 && 0==memcmp(p+1,"Event ",6) )
+                {
+                    end = p-text;
+                    break;
+                }
+                p++;
+            }
+        }
+        PgnChunk chunk;
+        chunk.nbr    = (long long)chunks.size();
+        chunk.offset = start;
+        chunk.len    = end-start;
+        chunks.push_back( chunk );
+        start = end;
+    }
+}
+
+/****************************************************************************
+ * Read a PGN file
+ *  return number of games, or -1 if the file can't be opened
+ ****************************************************************************/
+long long PgnPipeline::Run( const char *filename, PgnWorker *workers[], int nbr_workers, PgnReducer &reducer )
+{
+    MappedFile file;
+    if( !file.Open(filename,true) )
+        return -1;
+    return Run( file.Data(), file.Size(), workers, nbr_workers, reducer );
+}
+
+/****************************************************************************
+ * Read PGN text that's already in memory
+ *  return number of games
+ ****************************************************************************/
+long long PgnPipeline::Run( const char *text_, size_t len, PgnWorker *workers[], int nbr_workers, PgnReducer &reducer )
+{
+    text = text_;
+    Split( text, len, chunk_size, chunks );
+    long long nbr_chunks = (long long)chunks.size();
+    window      = (long long)queue_size * (nbr_workers>0 ? nbr_workers : 1);
+    next_chunk  = 0;
+    nbr_reduced = 0;
+    nbr_pushed  = 0;
+    queue       = new BoundedQueue<QueueItem>( (size_t)window );
+    std::vector<std::thread> threads;
+    for( int i=0; i<nbr_workers; i++ )
+        threads.push_back( std::thread( &PgnPipeline::WorkerThread, this, workers[i] ) );
+
+    // Reduce on this thread. When ordered, chunks that arrive early wait in
+    //  pending[], the window means there's always room for them
+    std::vector<QueueItem> pending( (size_t)window );
+    std::vector<bool>      is_pending( (size_t)window, false );
+    long long nbr_games  = 0;
+    long long reduced    = 0;
+    long long nbr_popped = 0;
+    while( reduced<nbr_chunks && nbr_workers>0 )
+    {
+        QueueItem item;
+        if( !queue->TryPop(item) )
+        {
+            // Sleep until a worker pushes something
+            std::unique_lock<std::mutex> lock( mutex );
+            while( nbr_pushed == nbr_popped )
+                item_ready.wait( lock );
+            continue;
+        }
+        nbr_popped++;
+        if( !ordered )
+        {
+            Reduce( item, reducer, nbr_games );
+            nbr_reduced.store( ++reduced, std::memory_order_release );
+        }
+        else
+        {
+            pending[ (size_t)(item.chunk_nbr%window) ]    = item;
+            is_pending[ (size_t)(item.chunk_nbr%window) ] = true;
+            while( reduced<nbr_chunks && is_pending[(size_t)(reduced%window)] )
+            {
+                is_pending[(size_t)(reduced%window)] = false;
+                Reduce( pending[(size_t)(reduced%window)], reducer, nbr_games );
+                nbr_reduced.store( ++reduced, std::memory_order_release );
+            }
+        }
+
+        // The window may have moved on, wake any workers waiting for it
+        //  (taking the mutex means a worker can't miss the wake up between
+        //  testing nbr_reduced and sleeping)
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+        }
+        space_ready.notify_all();
+    }
+    for( unsigned int i=0; i<threads.size(); i++ )
+        threads[i].join();
+    delete queue;
+    queue = NULL;
+    return nbr_games;
+}
+
+/****************************************************************************
+ * Pass a chunk's results to the reducer
+ ****************************************************************************/
+void PgnPipeline::Reduce( QueueItem &item, PgnReducer &reducer, long long &nbr_games )
+{
+    if( item.result )
+    {
+        item.result->chunk_nbr      = item.chunk_nbr;
+        item.result->nbr_games      = item.nbr_games;
+        item.result->first_game_nbr = ordered ? nbr_games : -1;
+        reducer.Reduce( *item.result );
+        delete item.result;
+        item.result = NULL;
+    }
+    nbr_games += item.nbr_games;
+}
+
+/****************************************************************************
+ * A worker thread, takes chunks until there are none left
+ ****************************************************************************/
+void PgnPipeline::WorkerThread( PgnWorker *worker )
+{
+    PgnReader reader;
+    reader.SetLenient( lenient );
+    long long nbr_chunks = (long long)chunks.size();
+    for(;;)
+    {
+        long long chunk_nbr = next_chunk.fetch_add( 1 );
+        if( chunk_nbr >= nbr_chunks )
+            break;
+
+        // Don't get too far ahead of the reducer, sleep until it catches up
+        if( chunk_nbr >= nbr_reduced.load(std::memory_order_acquire) + window )
+        {
+            std::unique_lock<std::mutex> lock( mutex );
+            while( chunk_nbr >= nbr_reduced.load(std::memory_order_acquire) + window )
+                space_ready.wait( lock );
+        }
+        const PgnChunk &chunk = chunks[(size_t)chunk_nbr];
+        reader.Attach( text+chunk.offset, chunk.len );
+        worker->ChunkBegin( chunk );
+        QueueItem item;
+        item.chunk_nbr = chunk_nbr;
+        item.nbr_games = reader.Read( *worker );
+        item.result    = worker->ChunkEnd( chunk );
+
+        // Every chunk in the queue is inside the window, and the queue holds
+        //  at least a window's worth, so there's always room
+        queue->TryPush( item );
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            nbr_pushed++;
+        }
+        item_ready.notify_one();
+    }
+}
@@ -0,0 +1,237 @@
+/****************************************************************************
+ * PgnPipeline.h Chess classes - Read PGN files on multiple threads
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#ifndef PGNPIPELINE_H
+#define PGNPIPELINE_H
+#include <stddef.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include "PgnReader.h"
+
+// TripleHappyChess
+namespace thc
+{
+
+// Bounded lock-free queue, any number of threads can push and pop. Each
+//  cell has a sequence number that says whether it's ready to be written
+//  or read for the current trip around the ring (Dmitry Vyukov's design)
+template <class T>
+class BoundedQueue
+{
+public:
+    // Size is rounded up to a power of 2
+    explicit BoundedQueue( size_t size )
+    {
+        size_t n = 2;
+        while( n < size )
+            n *= 2;
+        cells = new Cell[n];
+        mask  = n-1;
+        for( size_t i=0; i<n; i++ )
+            cells[i].sequence.store( i, std::memory_order_relaxed );
+        push_pos.store( 0, std::memory_order_relaxed );
+        pop_pos.store( 0, std::memory_order_relaxed );
+    }
+    ~BoundedQueue() { delete[] cells; }
+
+    // Push an item
+    //  return bool okay (false if the queue is full)
+    bool TryPush( const T &item )
+    {
+        size_t pos = push_pos.load( std::memory_order_relaxed );
+        for(;;)
+        {
+            Cell &cell = cells[pos&mask];
+            size_t seq = cell.sequence.load( std::memory_order_acquire );
+            ptrdiff_t diff = (ptrdiff_t)seq - (ptrdiff_t)pos;
+            if( diff == 0 )
+            {
+                if( push_pos.compare_exchange_weak( pos, pos+1, std::memory_order_relaxed ) )
+                {
+                    cell.item = item;
+                    cell.sequence.store( pos+1, std::memory_order_release );
+                    return true;
+                }
+            }
+            else if( diff < 0 )
+                return false;
+            else
+                pos = push_pos.load( std::memory_order_relaxed );
+        }
+    }
+
+    // Pop an item
+    //  return bool okay (false if the queue is empty)
+    bool TryPop( T &item )
+    {
+        size_t pos = pop_pos.load( std::memory_order_relaxed );
+        for(;;)
+        {
+            Cell &cell = cells[pos&mask];
+            size_t seq = cell.sequence.load( std::memory_order_acquire );
+            ptrdiff_t diff = (ptrdiff_t)seq - (ptrdiff_t)(pos+1);
+            if( diff == 0 )
+            {
+                if( pop_pos.compare_exchange_weak( pos, pos+1, std::memory_order_relaxed ) )
+                {
+                    item = cell.item;
+                    cell.sequence.store( pos+mask+1, std::memory_order_release );
+                    return true;
+                }
+            }
+            else if( diff < 0 )
+                return false;
+            else
+                pos = pop_pos.load( std::memory_order_relaxed );
+        }
+    }
+
+// internal stuff
+private:
+
+    // Not copyable
+    BoundedQueue( const BoundedQueue& );
+    BoundedQueue& operator=( const BoundedQueue& );
+
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T                   item;
+    };
+
+    //### Data
+    Cell                            *cells;
+    size_t                           mask;
+    alignas(64) std::atomic<size_t>  push_pos;
+    alignas(64) std::atomic<size_t>  pop_pos;
+};
+
+// A piece of the PGN text made up of whole games
+struct PgnChunk
+{
+    long long   nbr;                    // 0 = first chunk
+    size_t      offset;                 // in the PGN text
+    size_t      len;
+};
+
+// The results of one chunk of games, derive your own from this
+class PgnChunkResult
+{
+public:
+    PgnChunkResult() : chunk_nbr(0), nbr_games(0), first_game_nbr(-1) {}
+    virtual ~PgnChunkResult() {}
+
+    // Filled in by the pipeline
+    long long   chunk_nbr;
+    long long   nbr_games;
+    long long   first_game_nbr;         // in the whole PGN, only known if ordered, else -1
+};
+
+// The work done on a worker thread, the PgnVisitor functions are called
+//  for each game in each chunk the worker gets
+class PgnWorker : public PgnVisitor
+{
+public:
+
+    // A chunk of games is starting, note that PgnGame nbr and offset are
+    //  relative to the chunk
+    virtual void ChunkBegin( const PgnChunk & /*chunk*/ ) {}
+
+    // The chunk is finished, return its results for PgnReducer::Reduce()
+    //  (they're deleted after that), or NULL if there aren't any
+    virtual PgnChunkResult *ChunkEnd( const PgnChunk & /*chunk*/ ) { return NULL; }
+};
+
+// Collects the results from the workers, on the thread that called
+//  PgnPipeline::Run(), one chunk at a time
+class PgnReducer
+{
+public:
+    virtual ~PgnReducer() {}
+    virtual void Reduce( PgnChunkResult &result ) = 0;
+};
+
+// Splits PGN into chunks of whole games, reads the chunks on worker threads
+//  (each with its own PgnReader and so its own ChessRules) and passes their
+//  results through a bounded lock-free queue to a reducer. Threads with
+//  nothing to do (the reducer waiting for the next chunk, a worker too far
+//  ahead of the reducer) sleep on a condition variable rather than spin
+class PgnPipeline
+{
+public:
+    PgnPipeline();
+
+    // Approximate size of each chunk (default 1 megabyte)
+    void SetChunkSize( size_t bytes ) { chunk_size = bytes>0 ? bytes : 1; }
+
+    // Most chunks in flight (being read, or waiting to be reduced) per
+    //  worker (default 4)
+    void SetQueueSize( int chunks_per_worker ) { queue_size = chunks_per_worker>0 ? chunks_per_worker : 1; }
+
+    // Reduce the chunks in the order they appear in the PGN, so results are
+    //  deterministic (default true)
+    void SetOrdered( bool ordered_ ) { ordered = ordered_; }
+
+    // Read moves that aren't strict SAN too, see PgnReader::SetLenient()
+    //  (default false)
+    void SetLenient( bool lenient_ ) { lenient = lenient_; }
+
+    // Read a PGN file, there is a worker thread for each of workers[]
+    //  return number of games, or -1 if the file can't be opened
+    long long Run( const char *filename, PgnWorker *workers[], int nbr_workers, PgnReducer &reducer );
+
+    // Read PGN text that's already in memory
+    //  return number of games
+    long long Run( const char *text, size_t len, PgnWorker *workers[], int nbr_workers, PgnReducer &reducer );
+
+    // Split PGN text into chunks of about chunk_size bytes. A chunk ends
+    //  just before a line starting "[Event ", so standard PGN (where the
+    //  Event tag comes first) splits into whole games
+    static void Split( const char *text, size_t len, size_t chunk_size, std::vector<PgnChunk> &chunks );
+
+// internal stuff
+private:
+
+    // What goes through the queue
+    struct QueueItem
+    {
+        long long        chunk_nbr;
+        long long        nbr_games;
+        PgnChunkResult  *result;
+    };
+
+    // A worker thread
+    void WorkerThread( PgnWorker *worker );
+
+    // Pass a chunk's results to the reducer
+    void Reduce( QueueItem &item, PgnReducer &reducer, long long &nbr_games );
+
+    //### Data
+    size_t                      chunk_size;
+    int                         queue_size;
+    bool                        ordered;
+    bool                        lenient;
+
+    // For the current Run()
+    const char                 *text;
+    std::vector<PgnChunk>       chunks;
+    long long                   window;         // most chunks in flight
+    std::atomic<long long>      next_chunk;     // the next one a worker takes
+    std::atomic<long long>      nbr_reduced;
+    BoundedQueue<QueueItem>    *queue;
+
+    // For sleeping, nbr_pushed is guarded by the mutex
+    std::mutex                  mutex;
+    std::condition_variable     item_ready;     // the reducer waits for this
+    std::condition_variable     space_ready;    // workers wait for this
+    long long                   nbr_pushed;
+};
+
+} //namespace thc
+
+#endif //PGNPIPELINE_H
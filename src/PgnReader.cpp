@@ -0,0 +1,410 @@
+/****************************************************************************
+ * PgnReader.cpp Chess classes - Read games from PGN files
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#define _CRT_SECURE_NO_WARNINGS
+#include <stdio.h>
+#include <string.h>
+#include "PgnReader.h"
+using namespace std;
+using namespace thc;
+
+// White space in PGN
+static inline bool pgn_space( char c )
+{
+    return c==' ' || c=='\n' || c=='\r' || c=='\t' || c=='\f' || c=='\v';
+}
+
+// Characters that end a move (or move number, or result) in the movetext
+static inline bool pgn_delimiter( char c )
+{
+    switch( c )
+    {
+        case ' ': case '\n': case '\r': case '\t': case '\f': case '\v':
+        case '{': case '}': case '(': case ')': case ';': case '$': case '[': case ']':
+            return true;
+    }
+    return false;
+}
+
+// Length of a game termination marker at p, or 0 if there isn't one
+static inline size_t pgn_result( const char *p, const char *end )
+{
+    size_t n = end-p;
+    size_t r = 0;
+    if( n>=1 && p[0]=='*' )
+        r = 1;
+    else if( n>=3 && (0==memcmp(p,"1-0",3) || 0==memcmp(p,"0-1",3)) )
+        r = 3;
+    else if( n>=7 && 0==memcmp(p,"1/2-1/2",7) )
+        r = 7;
+    if( r && r<n && !pgn_delimiter(p[r]) )
+        r = 0;
+    return r;
+}
+
+// Skip to the end of the line (to the '\n')
+static inline const char *pgn_skip_line( const char *p, const char *end )
+{
+    const char *q = (const char *)memchr( p, '\n', end-p );
+    return q ? q : end;
+}
+
+// Skip a {comment}, p points at the '{'
+static inline const char *pgn_skip_comment( const char *p, const char *end )
+{
+    const char *q = (const char *)memchr( p, '}', end-p );
+    return q ? q+1 : end;
+}
+
+/****************************************************************************
+ * Is it the same as a '\0' terminated string ?
+ ****************************************************************************/
+bool PgnSpan::Equals( const char *s ) const
+{
+    for( size_t i=0; i<len; i++ )
+    {
+        if( s[i] != ptr[i] )    // including s[i]=='\0'
+            return false;
+    }
+    return s[len] == '\0';
+}
+
+/****************************************************************************
+ * Find a tag by name
+ *  return bool found
+ ****************************************************************************/
+bool PgnGame::Tag( const char *name, PgnSpan &value ) const
+{
+    for( int i=0; i<nbr_tags; i++ )
+    {
+        if( tags[i].name.Equals(name) )
+        {
+            value = tags[i].value;
+            return true;
+        }
+    }
+    return false;
+}
+
+/****************************************************************************
+ * Constructor
+ ****************************************************************************/
+PgnReader::PgnReader()
+{
+    text     = "";
+    len      = 0;
+    pos      = 0;
+    game_nbr = 0;
+    lenient  = false;
+}
+
+/****************************************************************************
+ * Memory map a PGN file
+ *  return bool okay
+ ****************************************************************************/
+bool PgnReader::Open( const char *filename )
+{
+    Close();
+    bool okay = file.Open( filename, true );
+    if( okay )
+        Attach( file.Data(), file.Size() );
+    return okay;
+}
+
+/****************************************************************************
+ * Read PGN text that's already in memory
+ ****************************************************************************/
+void PgnReader::Attach( const char *text_, size_t len_, long long first_game_nbr )
+{
+    text     = text_;
+    len      = len_;
+    pos      = 0;
+    game_nbr = first_game_nbr;
+}
+
+/****************************************************************************
+ * Finished with the file or text
+ ****************************************************************************/
+void PgnReader::Close()
+{
+    file.Close();
+    Attach( "", 0 );
+}
+
+/****************************************************************************
+ * Find the next game
+ *  return bool found
+ ****************************************************************************/
+bool PgnReader::NextGame( PgnGame &game )
+{
+    const char *p   = text+pos;
+    const char *end = text+len;
+
+    // Skip blank lines, a byte order mark and '%' escaped lines
+    for(;;)
+    {
+        while( p<end && pgn_space(*p) )
+            p++;
+        if( p<end && *p=='%' )
+            p = pgn_skip_line(p,end);
+        else if( end-p>=3 && (unsigned char)p[0]==0xef && (unsigned char)p[1]==0xbb && (unsigned char)p[2]==0xbf )
+            p += 3;
+        else
+            break;
+    }
+    if( p >= end )
+    {
+        pos = len;
+        return false;
+    }
+    const char *start = p;
+    game.nbr      = game_nbr++;
+    game.offset   = p-text;
+    game.result   = PgnSpan();
+    game.nbr_tags = 0;
+
+    // Tag pairs, eg [Event "F/S Return Match"]
+    while( p<end && *p=='[' )
+    {
+        const char *eol = pgn_skip_line(p,end);
+        p++;
+        while( p<eol && (*p==' ' || *p=='\t') )
+            p++;
+        const char *name = p;
+        while( p<eol && !pgn_space(*p) && *p!='"' && *p!=']' )
+            p++;
+        PgnSpan name_span( name, p-name );
+        while( p<eol && *p!='"' && *p!=']' )
+            p++;
+        if( p<eol && *p=='"' )
+        {
+            const char *value = ++p;
+            while( p<eol && *p!='"' )
+            {
+                if( *p=='\\' && p+1<eol )
+                    p++;
+                p++;
+            }
+            if( game.nbr_tags<PgnGame::MAX_TAGS && name_span.len>0 )
+            {
+                PgnTag &tag = game.tags[game.nbr_tags++];
+                tag.name  = name_span;
+                tag.value = PgnSpan( value, p-value );
+            }
+        }
+
+        // Usually one tag per line, but allow more
+        const char *close = (const char *)memchr( p, ']', eol-p );
+        p = close ? close+1 : eol;
+        while( p<end && pgn_space(*p) )
+            p++;
+    }
+
+    // The movetext ends with a termination marker, or if that's missing,
+    //  where the next game's tags start
+    const char *movetext = p;
+    int depth = 0;
+    while( p < end )
+    {
+        switch( *p )
+        {
+            case '{':
+                p = pgn_skip_comment(p,end);
+                continue;
+            case ';':
+                p = pgn_skip_line(p,end);
+                continue;
+            case '(':
+                depth++;
+                break;
+            case ')':
+                if( depth > 0 )
+                    depth--;
+                break;
+            case '%':
+            case '[':
+            {
+                bool line_start = (p==text || p[-1]=='\n');
+                if( line_start && *p=='%' )
+                {
+                    p = pgn_skip_line(p,end);
+                    continue;
+                }
+                if( line_start && p>movetext )
+                    goto done;
+                break;
+            }
+            case '*':
+            case '0':
+            case '1':
+            {
+                size_t r;
+                if( depth==0 && (p==movetext || pgn_delimiter(p[-1])) && 0!=(r=pgn_result(p,end)) )
+                {
+                    game.result = PgnSpan( p, r );
+                    p += r;
+                    goto done;
+                }
+                break;
+            }
+        }
+        p++;
+    }
+done:
+    game.text     = PgnSpan( start, p-start );
+    game.movetext = PgnSpan( movetext, p-movetext );
+    pos = p-text;
+    return true;
+}
+
+/****************************************************************************
+ * Replay a game's mainline
+ *  return bool okay
+ ****************************************************************************/
+bool PgnReader::Replay( const PgnGame &game, PgnVisitor &visitor )
+{
+    bool okay = true;
+    cr = ChessPosition();
+    PgnSpan fen;
+    if( game.Tag("FEN",fen) )
+        okay = cr.Forsyth( fen.ptr, fen.len );
+    const char *p   = game.movetext.ptr;
+    const char *end = p + game.movetext.len;
+    int  ply  = 0;
+    bool stop = !okay;
+    while( !stop && p<end )
+    {
+        char c = *p;
+        if( pgn_space(c) )
+        {
+            p++;
+            continue;
+        }
+        switch( c )
+        {
+            case '{':
+                p = pgn_skip_comment(p,end);
+                break;
+            case ';':
+            case '%':
+                p = pgn_skip_line(p,end);
+                break;
+
+            // Variation, skip it (and any variations inside it)
+            case '(':
+            {
+                int depth = 1;
+                p++;
+                while( depth>0 && p<end )
+                {
+                    if( *p == '{' )
+                        p = pgn_skip_comment(p,end);
+                    else if( *p == ';' )
+                        p = pgn_skip_line(p,end);
+                    else
+                    {
+                        if( *p == '(' )
+                            depth++;
+                        else if( *p == ')' )
+                            depth--;
+                        p++;
+                    }
+                }
+                break;
+            }
+
+            // NAG, eg $1
+            case '$':
+            {
+                p++;
+                while( p<end && '0'<=*p && *p<='9' )
+                    p++;
+                break;
+            }
+
+            default:
+            {
+                const char *q = p;
+                while( q<end && !pgn_delimiter(*q) )
+                    q++;
+
+                // Result, the end of the game
+                if( pgn_result(p,q) )
+                {
+                    stop = true;
+                    break;
+                }
+
+                // Move number, eg "12." or "12...", maybe run into the move, eg "12.e4"
+                if( '0'<=c && c<='9' && !(c=='0' && q-p>=3 && p[1]=='-' && p[2]=='0') )
+                {
+                    while( p<q && '0'<=*p && *p<='9' )
+                        p++;
+                    while( p<q && *p=='.' )
+                        p++;
+                    break;
+                }
+
+                // Moves start with a piece, file or castling, anything else
+                //  (eg "!", "+-" or stray punctuation) is an annotation
+                bool is_move = ('a'<=c && c<='h') || c=='K' || c=='Q' || c=='R' ||
+                               c=='B' || c=='N' || c=='O' || c=='0';
+                bool is_ep   = (q-p==2 && 0==memcmp(p,"ep",2)) || (q-p==4 && 0==memcmp(p,"e.p.",4));
+                if( is_move && !is_ep )
+                {
+                    // The strict parser handles properly formed SAN, if
+                    //  lenient fall back to the forgiving one for anything
+                    //  else, but never guess at an ambiguous move
+                    Move mv;
+                    bool found = mv.NaturalInFast( &cr, p, q-p );
+                    if( !found && lenient )
+                        found = mv.NaturalInUnique( &cr, p, q-p );
+                    if( !found )
+                    {
+                        okay = false;
+                        stop = true;
+                    }
+                    else if( !visitor.GameMove(game,ply,cr,mv) )
+                        stop = true;
+                    else
+                    {
+                        cr.PlayMove( mv );
+                        ply++;
+                    }
+                }
+                p = q;
+                break;
+            }
+
+            // Unexpected here, ignore it
+            case ')':
+            case '}':
+            case '[':
+            case ']':
+                p++;
+                break;
+        }
+    }
+    visitor.GameEnd( game, cr, !okay );
+    return okay;
+}
+
+/****************************************************************************
+ * Read and replay all the (remaining) games
+ *  return number of games
+ ****************************************************************************/
+long long PgnReader::Read( PgnVisitor &visitor )
+{
+    long long nbr = 0;
+    PgnGame game;
+    while( NextGame(game) )
+    {
+        nbr++;
+        if( visitor.GameBegin(game) )
+            Replay( game, visitor );
+    }
+    return nbr;
+}
@@ -0,0 +1,146 @@
+/****************************************************************************
+ * PgnReader.h Chess classes - Read games from PGN files
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#ifndef PGNREADER_H
+#define PGNREADER_H
+#include <stddef.h>
+#include <string>
+#include "ChessDefs.h"
+#include "ChessRules.h"
+#include "MappedFile.h"
+#include "Move.h"
+
+// TripleHappyChess
+namespace thc
+{
+
+// A piece of the PGN text, not '\0' terminated
+struct PgnSpan
+{
+    const char *ptr;
+    size_t      len;
+    PgnSpan() : ptr(""), len(0) {}
+    PgnSpan( const char *ptr_, size_t len_ ) : ptr(ptr_), len(len_) {}
+
+    // Is it the same as a '\0' terminated string ?
+    bool Equals( const char *s ) const;
+
+    // Copy it
+    std::string Str() const { return std::string(ptr,len); }
+#ifdef THC_HAVE_STRING_VIEW
+    std::string_view View() const { return std::string_view(ptr,len); }
+#endif
+};
+
+// A tag pair, eg [White "Carlsen, Magnus"], the value is without the
+//  quotes, but any escapes (\" and \\) are left in place
+struct PgnTag
+{
+    PgnSpan name;
+    PgnSpan value;
+};
+
+// One game as found in the PGN text, all pieces point into the text
+struct PgnGame
+{
+    enum { MAX_TAGS=32 };               // any more tags are dropped
+    long long   nbr;                    // 0 = first game (see PgnReader::Attach())
+    size_t      offset;                 // of the game in the text
+    PgnSpan     text;                   // the whole game, tags and movetext
+    PgnSpan     movetext;               // including the result
+    PgnSpan     result;                 // "1-0", "0-1", "1/2-1/2", "*" or empty if missing
+    int         nbr_tags;
+    PgnTag      tags[MAX_TAGS];
+
+    // Find a tag by name, eg "White"
+    //  return bool found
+    bool Tag( const char *name, PgnSpan &value ) const;
+};
+
+// Receives the games from PgnReader::Read() or PgnReader::Replay(). All
+//  the functions are optional
+class PgnVisitor
+{
+public:
+    virtual ~PgnVisitor() {}
+
+    // A game has been found, return false to skip replaying its moves (then
+    //  GameEnd() isn't called either)
+    virtual bool GameBegin( const PgnGame & /*game*/ ) { return true; }
+
+    // A mainline move, cr is the position before the move is played (ply
+    //  0 is the first move). Return false to stop replaying this game
+    virtual bool GameMove( const PgnGame & /*game*/, int /*ply*/, const ChessRules & /*cr*/, Move /*mv*/ ) { return true; }
+
+    // The game is over, cr is the final position. Error means a move
+    //  couldn't be read or was illegal (or the FEN tag was bad), cr is then
+    //  the position before the bad move
+    virtual void GameEnd( const PgnGame & /*game*/, const ChessRules & /*cr*/, bool /*error*/ ) {}
+};
+
+// Reads PGN straight from a memory mapped file (or from PGN text already in
+//  memory), without copying it. Games are replayed through ChessRules,
+//  mainline only, comments, NAGs and variations are skipped
+class PgnReader
+{
+public:
+    PgnReader();
+
+    // Memory map a PGN file
+    //  return bool okay
+    bool Open( const char *filename );
+
+    // Read PGN text that's already in memory (it must stay there while the
+    //  games are used), games are numbered from first_game_nbr
+    void Attach( const char *text, size_t len, long long first_game_nbr=0 );
+
+    // Finished with the file or text
+    void Close();
+
+    // Moves are read as strict SAN (Move::NaturalInFast()), anything else
+    //  is an error. If lenient, moves that aren't strict SAN (eg "g1f3",
+    //  "ef" or "e8Q") are read with the forgiving Move::NaturalIn() rules,
+    //  but moves that match more than one legal move are still errors
+    //  (default false)
+    void SetLenient( bool lenient_ ) { lenient = lenient_; }
+
+    // Find the next game, its tags and movetext
+    //  return bool found (false at end of text)
+    bool NextGame( PgnGame &game );
+
+    // Replay a game's mainline, calls visitor.GameMove() for each move, then
+    //  visitor.GameEnd() (not visitor.GameBegin(), that's up to the caller)
+    //  return bool okay (false if a move couldn't be read or was illegal)
+    bool Replay( const PgnGame &game, PgnVisitor &visitor );
+
+    // Read and replay all the (remaining) games
+    //  return number of games
+    long long Read( PgnVisitor &visitor );
+
+    // How far we've got through the text
+    size_t Offset() const { return pos; }
+    size_t Size()   const { return len; }
+
+// internal stuff
+private:
+
+    // Not copyable
+    PgnReader( const PgnReader& );
+    PgnReader& operator=( const PgnReader& );
+
+    //### Data
+    MappedFile  file;
+    const char *text;
+    size_t      len;
+    size_t      pos;
+    long long   game_nbr;
+    bool        lenient;
+    ChessRules  cr;
+};
+
+} //namespace thc
+
+#endif //PGNREADER_H
@@ -0,0 +1,99 @@
+/****************************************************************************
+ * PositionDedup.cpp Chess classes - Sort positions, and count duplicates
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#define _CRT_SECURE_NO_WARNINGS
+#include <stdio.h>
+#include <string.h>
+#include "PositionDedup.h"
+using namespace std;
+using namespace thc;
+
+/****************************************************************************
+ * Constructor
+ ****************************************************************************/
+PositionDedup::PositionDedup()
+{
+    nbr_positions = 0;
+    sorter.SetCombine( true );
+}
+
+/****************************************************************************
+ * Start
+ *  return bool okay
+ ****************************************************************************/
+bool PositionDedup::Begin( const char *temp_filename )
+{
+    nbr_positions = 0;
+    return sorter.Begin( 4, 3, temp_filename );
+}
+
+/****************************************************************************
+ * The sort key
+ *  return bool okay
+ ****************************************************************************/
+bool PositionDedup::Key( const ChessPosition &cp, uint64_t key[3] )
+{
+    // Compress() only has room for 32 men
+    int men = 0;
+    for( int i=0; i<64; i++ )
+    {
+        if( cp.squares[i] != ' ' )
+            men++;
+    }
+    if( men > 32 )
+        return false;
+    CompressedPosition compressed;
+    cp.Compress( compressed );
+    for( int i=0; i<3; i++ )
+    {
+        uint64_t word = 0;
+        for( int j=0; j<8; j++ )
+            word = (word<<8) | compressed.storage[8*i+j];
+        key[i] = word;
+    }
+    return true;
+}
+
+/****************************************************************************
+ * Add a position
+ *  return bool okay
+ ****************************************************************************/
+bool PositionDedup::Add( const ChessPosition &cp, uint64_t count )
+{
+    uint64_t record[4];
+    if( !Key(cp,record) )
+        return false;
+    record[3] = count;
+    nbr_positions += (long long)count;
+    return sorter.Add( record );
+}
+
+/****************************************************************************
+ * All positions added, sort them
+ *  return bool okay
+ ****************************************************************************/
+bool PositionDedup::Sort()
+{
+    return sorter.Sort();
+}
+
+/****************************************************************************
+ * Get the next distinct position
+ *  return bool found
+ ****************************************************************************/
+bool PositionDedup::Next( CompressedPosition &position, uint64_t &count )
+{
+    const uint64_t *record;
+    if( !sorter.Next(record) )
+        return false;
+    for( int i=0; i<3; i++ )
+    {
+        for( int j=0; j<8; j++ )
+            position.storage[8*i+j] = (unsigned char)(record[i] >> (56-8*j));
+    }
+    count = record[3];
+    return true;
+}
@@ -0,0 +1,84 @@
+/****************************************************************************
+ * PositionDedup.h Chess classes - Sort positions, and count duplicates
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#ifndef POSITIONDEDUP_H
+#define POSITIONDEDUP_H
+#include <stddef.h>
+#include <stdint.h>
+#include "ChessDefs.h"
+#include "ChessPosition.h"
+#include "ExternalSort.h"
+
+// TripleHappyChess
+namespace thc
+{
+
+// Sorts any number of positions, each distinct position coming out once
+//  with the number of times it went in. A position's sort key is worked out
+//  once, when it's added: its CompressedPosition, which already counts only
+//  the castling and en passant possibilities that are real (as
+//  ChessPosition::operator==() does), so positions are the same if and only
+//  if their keys are. Positions come out in order of their
+//  CompressedPosition bytes. Sorting is done by ExternalSort, on multiple
+//  threads in limited memory, with duplicates combined as early as possible
+class PositionDedup
+{
+public:
+    PositionDedup();
+
+    // Memory, threads and most runs merged at once for sorting, see
+    //  ExternalSort. Set them before Begin()
+    void SetMemory( size_t bytes ) { sorter.SetMemory(bytes); }
+    void SetThreads( int nbr ) { sorter.SetThreads(nbr); }
+    void SetMaxMerge( int nbr ) { sorter.SetMaxMerge(nbr); }
+
+    // Start, temporary files are temp_filename.0, temp_filename.1 etc.
+    //  return bool okay
+    bool Begin( const char *temp_filename );
+
+    // Add a position, count times
+    //  return bool okay (false if it can't be compressed, it has more than
+    //  32 men, or a temporary file couldn't be written)
+    bool Add( const ChessPosition &cp, uint64_t count=1 );
+
+    // All positions added, sort them
+    //  return bool okay
+    bool Sort();
+
+    // Get the next distinct position, and the number of times it was added
+    //  return bool found (false when there are no more)
+    bool Next( CompressedPosition &position, uint64_t &count );
+
+    // Did sorting fail ? (then Next() returns false early)
+    bool Error() const { return sorter.Error(); }
+
+    // Number of positions added (counting duplicates)
+    long long NbrPositions() const { return nbr_positions; }
+
+    // Finished, removes the temporary files (Begin() and the destructor do
+    //  this too)
+    void End() { sorter.End(); }
+
+    // The sort key, a CompressedPosition as three big endian words (so
+    //  sorting the words sorts the bytes)
+    //  return bool okay (false if the position can't be compressed)
+    static bool Key( const ChessPosition &cp, uint64_t key[3] );
+
+// internal stuff
+private:
+
+    // Not copyable
+    PositionDedup( const PositionDedup& );
+    PositionDedup& operator=( const PositionDedup& );
+
+    //### Data
+    ExternalSort    sorter;
+    long long       nbr_positions;
+};
+
+} //namespace thc
+
+#endif //POSITIONDEDUP_H
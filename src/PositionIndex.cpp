@@ -0,0 +1,269 @@
+/****************************************************************************
+ * PositionIndex.cpp Chess classes - Which games reached a position
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#define _CRT_SECURE_NO_WARNINGS
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include "PositionIndex.h"
+#include "ChessRules.h"
+using namespace std;
+using namespace thc;
+
+/*
+    Index layout (all numbers in the machine's byte order)
+
+    Header, POSINDEX_HEADER uint64s, padded to a page
+    Entries, sorted by key, game and ply
+    Fences, the key of the first entry in each page of entries
+ */
+enum
+{
+    POSINDEX_MAGIC,
+    POSINDEX_VERSION,
+    POSINDEX_NBR_ENTRIES,
+    POSINDEX_ENTRIES,
+    POSINDEX_FENCES,
+    POSINDEX_NBR_FENCES,
+    POSINDEX_HEADER=8,
+    POSINDEX_PAGE=4096
+};
+static const char     posindex_magic[8] = { 'T','H','C','P','O','S','I','1' };
+static const uint64_t posindex_version  = 1;
+
+/****************************************************************************
+ * Constructor
+ ****************************************************************************/
+PositionIndexBuilder::PositionIndexBuilder()
+{
+    okay = false;
+}
+
+/****************************************************************************
+ * Start an index
+ *  return bool okay
+ ****************************************************************************/
+bool PositionIndexBuilder::Open( const char *filename_ )
+{
+    filename = filename_;
+    okay = sorter.Begin( 2, 2, (filename+".run").c_str() );
+    return okay;
+}
+
+/****************************************************************************
+ * Add a position
+ ****************************************************************************/
+void PositionIndexBuilder::AddPosition( uint64_t key, long long game, int ply )
+{
+    if( ply<0 || ply>=(1<<PositionIndexEntry::PLY_BITS) || game<0 )
+        return;
+    uint64_t record[2];
+    record[0] = key;
+    record[1] = ((uint64_t)game<<PositionIndexEntry::PLY_BITS) | (uint64_t)ply;
+    if( okay )
+        okay = sorter.Add( record );
+}
+
+/****************************************************************************
+ * Add a game's positions
+ ****************************************************************************/
+void PositionIndexBuilder::AddGame( long long game, const ChessPosition &start, const std::vector<Move> &moves )
+{
+    ChessRules cr;
+    cr = start;
+    AddPosition( cr.key, game, 0 );
+    for( size_t i=0; i<moves.size(); i++ )
+    {
+        cr.PlayMove( moves[i] );
+        AddPosition( cr.key, game, (int)i+1 );
+    }
+}
+
+/****************************************************************************
+ * Add all the games in an archive
+ *  return bool okay
+ ****************************************************************************/
+bool PositionIndexBuilder::AddGames( GameArchive &archive )
+{
+    ChessPosition start;
+    std::vector<Move> moves;
+    for( long long id=0; id<archive.NbrGames(); id++ )
+    {
+        if( !archive.GetGame(id,start,moves) )
+            return false;
+        AddGame( id, start, moves );
+    }
+    return okay;
+}
+
+/****************************************************************************
+ * Sort and write the index
+ *  return bool okay
+ ****************************************************************************/
+bool PositionIndexBuilder::Close()
+{
+    okay = okay && sorter.Sort();
+    FILE *file = okay ? fopen(filename.c_str(),"wb") : NULL;
+    if( !file )
+    {
+        sorter.End();
+        okay = false;
+        return false;
+    }
+
+    // Header later, then the entries, noting the first key in each page
+    std::vector<uint64_t> buf( POSINDEX_PAGE/sizeof(uint64_t), 0 );
+    if( fwrite(buf.data(),1,POSINDEX_PAGE,file) != POSINDEX_PAGE )
+        okay = false;
+    std::vector<uint64_t> fences;
+    long long nbr_entries = 0;
+    const uint64_t *record;
+    buf.clear();
+    while( sorter.Next(record) )
+    {
+        if( nbr_entries%PositionIndex::ENTRIES_PER_PAGE == 0 )
+            fences.push_back( record[0] );
+        buf.push_back( record[0] );
+        buf.push_back( record[1] );
+        nbr_entries++;
+        if( buf.size() >= 65536 )
+        {
+            if( fwrite(buf.data(),sizeof(uint64_t),buf.size(),file) != buf.size() )
+                okay = false;
+            buf.clear();
+        }
+    }
+    if( sorter.Error() || nbr_entries!=sorter.NbrRecords() )
+        okay = false;
+    if( fwrite(buf.data(),sizeof(uint64_t),buf.size(),file) != buf.size() )
+        okay = false;
+    if( fwrite(fences.data(),sizeof(uint64_t),fences.size(),file) != fences.size() )
+        okay = false;
+    uint64_t header[POSINDEX_HEADER];
+    memset( header, 0, sizeof(header) );
+    memcpy( &header[POSINDEX_MAGIC], posindex_magic, sizeof(posindex_magic) );
+    header[POSINDEX_VERSION]     = posindex_version;
+    header[POSINDEX_NBR_ENTRIES] = nbr_entries;
+    header[POSINDEX_ENTRIES]     = POSINDEX_PAGE;
+    header[POSINDEX_FENCES]      = POSINDEX_PAGE + nbr_entries*sizeof(PositionIndexEntry);
+    header[POSINDEX_NBR_FENCES]  = fences.size();
+    if( fseek(file,0,SEEK_SET) != 0 || fwrite(header,1,sizeof(header),file) != sizeof(header) )
+        okay = false;
+    if( fclose(file) != 0 )
+        okay = false;
+    sorter.End();
+    return okay;
+}
+
+/****************************************************************************
+ * Constructor
+ ****************************************************************************/
+PositionIndex::PositionIndex()
+{
+    Close();
+}
+
+/****************************************************************************
+ * Finished with it
+ ****************************************************************************/
+void PositionIndex::Close()
+{
+    file.Close();
+    entries     = NULL;
+    nbr_entries = 0;
+    fences.clear();
+}
+
+/****************************************************************************
+ * Memory map an index
+ *  return bool okay
+ ****************************************************************************/
+bool PositionIndex::Open( const char *filename )
+{
+    Close();
+    if( !file.Open(filename) )
+        return false;
+    uint64_t size = file.Size();
+    uint64_t header[POSINDEX_HEADER];
+    bool okay = size >= POSINDEX_PAGE;
+    if( okay )
+    {
+        memcpy( header, file.Data(), sizeof(header) );
+        okay = memcmp(&header[POSINDEX_MAGIC],posindex_magic,sizeof(posindex_magic))==0 &&
+               header[POSINDEX_VERSION] == posindex_version;
+    }
+
+    // The entries and fences must be in the file, one fence per page
+    uint64_t nbr = okay ? header[POSINDEX_NBR_ENTRIES] : 0;
+    uint64_t nbr_fences = (nbr+ENTRIES_PER_PAGE-1) / ENTRIES_PER_PAGE;
+    okay = okay && header[POSINDEX_ENTRIES]==POSINDEX_PAGE
+                && nbr <= (size-POSINDEX_PAGE)/sizeof(PositionIndexEntry)
+                && header[POSINDEX_FENCES] == POSINDEX_PAGE + nbr*sizeof(PositionIndexEntry)
+                && header[POSINDEX_NBR_FENCES] == nbr_fences
+                && nbr_fences <= (size-header[POSINDEX_FENCES])/sizeof(uint64_t);
+    if( !okay )
+    {
+        Close();
+        return false;
+    }
+    entries     = (const PositionIndexEntry *)(file.Data() + POSINDEX_PAGE);
+    nbr_entries = (long long)nbr;
+    fences.resize( (size_t)nbr_fences );
+    memcpy( fences.data(), file.Data() + header[POSINDEX_FENCES], (size_t)nbr_fences*sizeof(uint64_t) );
+    return true;
+}
+
+// Order entries by key alone
+static bool posindex_key_less( const PositionIndexEntry &entry, uint64_t key )
+{
+    return entry.key < key;
+}
+static bool posindex_less_key( uint64_t key, const PositionIndexEntry &entry )
+{
+    return key < entry.key;
+}
+
+/****************************************************************************
+ * Find a position
+ *  return number of entries
+ ****************************************************************************/
+size_t PositionIndex::Find( uint64_t key, const PositionIndexEntry *&first ) const
+{
+    first = entries;
+    if( nbr_entries == 0 )
+        return 0;
+
+    // The fences say which page the first entry with the key is in (or at
+    //  the start of the next page), likewise the last
+    size_t page = std::lower_bound( fences.begin(), fences.end(), key ) - fences.begin();
+    size_t lo   = (page>0 ? page-1 : 0) * ENTRIES_PER_PAGE;
+    size_t hi   = std::min( (size_t)nbr_entries, page*ENTRIES_PER_PAGE );
+    const PositionIndexEntry *begin = std::lower_bound( entries+lo, entries+hi, key, posindex_key_less );
+    page = std::upper_bound( fences.begin(), fences.end(), key ) - fences.begin();
+    lo   = (page>0 ? page-1 : 0) * ENTRIES_PER_PAGE;
+    hi   = std::min( (size_t)nbr_entries, page*ENTRIES_PER_PAGE );
+    const PositionIndexEntry *end = std::upper_bound( entries+lo, entries+hi, key, posindex_less_key );
+    first = begin;
+    return end>begin ? (size_t)(end-begin) : 0;
+}
+
+/****************************************************************************
+ * Which games reached a position
+ *  return number of games
+ ****************************************************************************/
+size_t PositionIndex::FindGames( const ChessPosition &cp, std::vector<long long> &games ) const
+{
+    games.clear();
+    const PositionIndexEntry *first;
+    size_t nbr = Find( cp, first );
+    for( size_t i=0; i<nbr; i++ )
+    {
+        long long game = first[i].Game();
+        if( games.empty() || games.back()!=game )
+            games.push_back( game );
+    }
+    return games.size();
+}
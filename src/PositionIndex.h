@@ -0,0 +1,133 @@
+/****************************************************************************
+ * PositionIndex.h Chess classes - Which games reached a position
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#ifndef POSITIONINDEX_H
+#define POSITIONINDEX_H
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "ChessDefs.h"
+#include "ChessPosition.h"
+#include "ExternalSort.h"
+#include "GameArchive.h"
+#include "MappedFile.h"
+#include "Move.h"
+
+// TripleHappyChess
+namespace thc
+{
+
+// A position in a game, key is the position's Zobrist key (ChessPosition::key,
+//  so side to move, castling and en passant count)
+struct PositionIndexEntry
+{
+    enum { PLY_BITS=16 };
+    uint64_t    key;
+    uint64_t    game_ply;       // game id << PLY_BITS | ply
+    long long   Game() const { return (long long)(game_ply>>PLY_BITS); }
+    int         Ply() const  { return (int)(game_ply & ((1<<PLY_BITS)-1)); }
+};
+
+// Builds a position index file. Games are replayed, and every position
+//  (including the starting position, ply 0) is added, then everything is
+//  sorted by key, game and ply with ExternalSort, so the number of games
+//  isn't limited by memory
+class PositionIndexBuilder
+{
+public:
+    PositionIndexBuilder();
+
+    // Memory and threads for sorting, see ExternalSort. Set them before
+    //  Open()
+    void SetMemory( size_t bytes ) { sorter.SetMemory(bytes); }
+    void SetThreads( int nbr ) { sorter.SetThreads(nbr); }
+
+    // Start an index, temporary files are filename.run.0, filename.run.1
+    //  etc.
+    //  return bool okay
+    bool Open( const char *filename );
+
+    // Add a position (positions after ply 65535 are ignored)
+    void AddPosition( uint64_t key, long long game, int ply );
+
+    // Add a game's positions, the moves must be legal
+    void AddGame( long long game, const ChessPosition &start, const std::vector<Move> &moves );
+
+    // Add all the games in an archive, the index's game ids are the
+    //  archive's
+    //  return bool okay (false if a game can't be read)
+    bool AddGames( GameArchive &archive );
+
+    // Sort and write the index
+    //  return bool okay (false if anything couldn't be written)
+    bool Close();
+
+    // Positions so far
+    long long NbrPositions() const { return sorter.NbrRecords(); }
+
+// internal stuff
+private:
+
+    // Not copyable
+    PositionIndexBuilder( const PositionIndexBuilder& );
+    PositionIndexBuilder& operator=( const PositionIndexBuilder& );
+
+    //### Data
+    ExternalSort    sorter;
+    std::string     filename;
+    bool            okay;
+};
+
+// Looks up positions in an index written by PositionIndexBuilder. The
+//  entries are memory mapped, in pages of 256, and the key of the first
+//  entry in each page is kept in memory, so a lookup reads one or two pages
+//  of the file (three at most), however many games there are. Keys are 64
+//  bits, so in a big index there can (very rarely) be a false match, if
+//  that matters check the position by replaying the game
+class PositionIndex
+{
+public:
+    enum { ENTRIES_PER_PAGE=256 };
+    PositionIndex();
+
+    // Memory map an index
+    //  return bool okay (false if it can't be opened, or isn't an index)
+    bool Open( const char *filename );
+
+    // Finished with it
+    void Close();
+
+    // Number of positions
+    long long NbrPositions() const { return nbr_entries; }
+
+    // Find a position, first points to the entries (in the memory mapped
+    //  file), in order of game id and ply
+    //  return number of entries
+    size_t Find( uint64_t key, const PositionIndexEntry *&first ) const;
+    size_t Find( const ChessPosition &cp, const PositionIndexEntry *&first ) const { return Find( cp.key, first ); }
+
+    // Which games reached a position, each game once
+    //  return number of games
+    size_t FindGames( const ChessPosition &cp, std::vector<long long> &games ) const;
+
+// internal stuff
+private:
+
+    // Not copyable
+    PositionIndex( const PositionIndex& );
+    PositionIndex& operator=( const PositionIndex& );
+
+    //### Data
+    MappedFile                  file;
+    const PositionIndexEntry   *entries;
+    long long                   nbr_entries;
+    std::vector<uint64_t>       fences;         // first key in each page
+};
+
+} //namespace thc
+
+#endif //POSITIONINDEX_H
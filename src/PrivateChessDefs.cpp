@@ -49,4 +49,247 @@ lte to_mask[] =
 #undef Q
 #undef K
 
+// A lookup table to convert our character piece convention to an index
+//  into the ChessPosition bitboards
+#define _ BB_NBR
+lte bb_index[] =
+    {_,_,_,_,_,_,_,_,_,_,_,_,_,_,_,_,                             // 0x00-0x0f
+     _,_,_,_,_,_,_,_,_,_,_,_,_,_,_,_,                             // 0x10-0x1f
+     _,_,_,_,_,_,_,_,_,_,_,_,_,_,_,_,                             // 0x20-0x2f
+     _,_,_,_,_,_,_,_,_,_,_,_,_,_,_,_,                             // 0x30-0x3f
+     _,_,BB_WBISHOP,_,_,_,_,_,_,_,_,BB_WKING,_,_,BB_WKNIGHT,_,     // 0x40-0x4f    'B'=0x42, 'K'=0x4b, 'N'=0x4e
+     BB_WPAWN,BB_WQUEEN,BB_WROOK,_,_,_,_,_,_,_,_,_,_,_,_,_,       // 0x50-0x5f    'P'=0x50, 'Q'=0x51, 'R'=0x52
+     _,_,BB_BBISHOP,_,_,_,_,_,_,_,_,BB_BKING,_,_,BB_BKNIGHT,_,     // 0x60-0x6f    'b'=0x62, 'k'=0x6b, 'n'=0x6e
+     BB_BPAWN,BB_BQUEEN,BB_BROOK,_,_,_,_,_,_,_,_,_,_,_,_,_};      // 0x70-0x7f    'p'=0x70, 'q'=0x71, 'r'=0x72
+#undef _
+
+// Bitboard lookup tables, calculated by bitboard_tables_init()
+Bitboard knight_attacks_bb[64];
+Bitboard king_attacks_bb[64];
+Bitboard pawn_white_attacks_bb[64];
+Bitboard pawn_black_attacks_bb[64];
+Bitboard between_bb[64][64];
+Bitboard line_bb[64][64];
+
+// Zobrist keys, calculated by bitboard_tables_init()
+uint64_t zobrist_pieces[BB_NBR][64];
+uint64_t zobrist_white;
+uint64_t zobrist_castling[16];
+uint64_t zobrist_enpassant[8];
+
+// Pseudo random numbers for the Zobrist keys (SplitMix64). A fixed seed
+//  means keys are the same from run to run, so they can be stored
+static uint64_t zobrist_random( uint64_t &seed )
+{
+    uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z>>30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z>>27)) * 0x94d049bb133111ebULL;
+    return z ^ (z>>31);
+}
+
+// Convert a list of squares in a generated lookup table to a bitboard
+static Bitboard squares_to_bb( const lte *ptr )
+{
+    Bitboard bb = 0;
+    lte nbr_squares = *ptr++;
+    while( nbr_squares-- )
+        bb |= BB(*ptr++);
+    return bb;
+}
+
+// Magic numbers for slider attacks, found by trial and error (random sparse
+//  candidates, keeping the first that maps every relevant occupancy to an
+//  index holding the right attacks without destructive collisions)
+static const Bitboard bishop_magic_numbers[64] =
+{
+    0x10102002004a1420ULL, 0x8020040400584008ULL, 0x10510800811201c8ULL, 0x5204042080000088ULL,
+    0x2204106880000002ULL, 0x1401042004000000ULL, 0x0400880410042004ULL, 0x0028208200a02020ULL,
+    0x1500241990010e00ULL, 0x8001200182020a40ULL, 0x40004101030b0000ULL, 0x8002041042000100ULL,
+    0x4010011041020038ULL, 0x0000010421044000ULL, 0x1500210808020a00ULL, 0x8000088400880520ULL,
+    0x0405004010040100ULL, 0x1005823210040108ULL, 0x2708008102040011ULL, 0x4048200404009100ULL,
+    0x0018104101400024ULL, 0x0003000601190101ULL, 0x8004803108491000ULL, 0x8014241200820800ULL,
+    0x0006e080100c3040ULL, 0x0501044a11041800ULL, 0x9020300008004045ULL, 0x0894080000220040ULL,
+    0x1001010083104000ULL, 0x5004030040900080ULL, 0x000400422c012400ULL, 0x0002128698404812ULL,
+    0x1010108404900440ULL, 0x0928021182084100ULL, 0x2006080409020024ULL, 0x1010202020180080ULL,
+    0xa010008200202200ULL, 0x2098015100019004ULL, 0x0002041440810811ULL, 0x802a02020000b098ULL,
+    0x0009015090004060ULL, 0x4000821082081001ULL, 0x0100210040420800ULL, 0x0800004010488a00ULL,
+    0x2000081104004040ULL, 0x4c8e029015000082ULL, 0x0420340322224842ULL, 0x1298260043400210ULL,
+    0x0000822802400008ULL, 0x00008a0101600000ULL, 0x3040003412080021ULL, 0x3040290220884800ULL,
+    0x4a1500401041004aULL, 0x8010200282020781ULL, 0x0020203142209091ULL, 0x0070300600902110ULL,
+    0x0040808800b62048ULL, 0x0000810400c44420ULL, 0x00080400440c0441ULL, 0x8340080020840411ULL,
+    0x0000000104208200ULL, 0x0000800810d00080ULL, 0x0400530411080200ULL, 0x4040702400932244ULL
+};
+
+static const Bitboard rook_magic_numbers[64] =
+{
+    0x1080004008801020ULL, 0x0840092002c03000ULL, 0x1900200010400900ULL, 0x0880100008000480ULL,
+    0x4200100420080200ULL, 0x8100020100080400ULL, 0x0200040110886200ULL, 0x0200008040220411ULL,
+    0x0404800084400220ULL, 0x0000401000402000ULL, 0x0086001081220440ULL, 0x0408800800100280ULL,
+    0x000a001201040820ULL, 0x8848800200840080ULL, 0x4001000100040200ULL, 0x0442000102105084ULL,
+    0x9080010020804100ULL, 0x0040404000201009ULL, 0x0000808010002009ULL, 0x2200090021d00100ULL,
+    0x0008008008040080ULL, 0x0004004002010040ULL, 0x0011040008015042ULL, 0x00000a0001768104ULL,
+    0x0000800080204009ULL, 0x2010004140002001ULL, 0x9800200280100080ULL, 0x1000100080080080ULL,
+    0x0442000a00049020ULL, 0x2100040080020080ULL, 0x0800120400900148ULL, 0x0010040a00128541ULL,
+    0x2800804000800030ULL, 0x1010002000400041ULL, 0x4000200011004100ULL, 0x0610008410800800ULL,
+    0x0400802402800800ULL, 0xc100020080800400ULL, 0x0002000802000401ULL, 0x0182085882000401ULL,
+    0x0220204000808000ULL, 0x2860100040024022ULL, 0x0001002004110040ULL, 0x99101042000a0020ULL,
+    0x0004080004008080ULL, 0x0010040002008080ULL, 0x2012004881020004ULL, 0x8300842444820011ULL,
+    0x0088403882010200ULL, 0x0820400080210100ULL, 0x0110910040a00300ULL, 0x0801100280080480ULL,
+    0x0242009008200600ULL, 0x1002000489500200ULL, 0x0040800200010080ULL, 0x0091800041000080ULL,
+    0x0000209300488001ULL, 0x04c1002414824001ULL, 0x020020000b001041ULL, 0x7000100004200901ULL,
+    0x8002002004100802ULL, 0x30010002084c0007ULL, 0x0888221800813004ULL, 0x4000002840840112ULL
+};
+
+// Slider attacks lookup, one variable size block per square
+SliderMagic bishop_magics[64];
+SliderMagic rook_magics[64];
+static Bitboard bishop_attacks_table[5248];    // sum over squares of 2^(squares in mask)
+static Bitboard rook_attacks_table[102400];
+
+#ifdef THC_PEXT
+bool slider_use_pext;
+
+// Kept out of line so only this function needs to be compiled for BMI2
+#if defined(__GNUC__) && !defined(__BMI2__)
+__attribute__((target("bmi2")))
+#endif
+unsigned int slider_index_pext( Bitboard occupied, Bitboard mask )
+{
+    return (unsigned int)_pext_u64( occupied, mask );
+}
+
+// Does the CPU we are running on support BMI2 (and so PEXT) ?
+static bool cpu_has_bmi2()
+{
+#if defined(__BMI2__)
+    return true;
+#elif defined(__GNUC__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("bmi2") != 0;
+#else
+    int regs[4];
+    __cpuid( regs, 0 );
+    if( regs[0] < 7 )
+        return false;
+    __cpuidex( regs, 7, 0 );
+    return (regs[1] & (1<<8)) != 0;     // EBX bit 8 = BMI2
+#endif
+}
+#endif
+
+// Walk the rays in a generated lookup table, stopping at the first occupied
+//  square on each ray, to get slider attacks the slow way. If mask_only
+//  the final square of each ray is dropped instead, giving the squares that
+//  can block (a man at the end of a ray blocks nothing)
+static Bitboard rays_walk( const lte *ptr, Bitboard occupied, bool mask_only )
+{
+    Bitboard bb = 0;
+    lte nbr_rays = *ptr++;
+    while( nbr_rays-- )
+    {
+        lte ray_len = *ptr++;
+        while( ray_len-- )
+        {
+            Bitboard sq = BB(*ptr++);
+            if( mask_only )
+            {
+                if( ray_len > 0 )
+                    bb |= sq;
+            }
+            else
+            {
+                bb |= sq;
+                if( occupied & sq )
+                {
+                    ptr += ray_len;
+                    ray_len = 0;
+                }
+            }
+        }
+    }
+    return bb;
+}
+
+// Fill in the magic lookup for bishops or rooks
+static void slider_init( SliderMagic *magics, Bitboard *table, const Bitboard *magic_numbers,
+                                                    const lte **lookup, bool use_pext )
+{
+    Bitboard *attacks = table;
+    for( Square square=a8; square<=h1; ++square )
+    {
+        SliderMagic &m = magics[square];
+        m.mask    = rays_walk( lookup[square], 0, true );
+        m.magic   = magic_numbers[square];
+        m.shift   = 64 - bb_popcount(m.mask);
+        m.attacks = attacks;
+
+        // Visit every subset of the mask (the "carry rippler" trick), which
+        //  conveniently visits them in PEXT index order
+        Bitboard occupied = 0;
+        unsigned int pext_idx = 0;
+        do
+        {
+            unsigned int idx = use_pext ? pext_idx
+                                        : (unsigned int)((occupied * m.magic) >> m.shift);
+            m.attacks[idx] = rays_walk( lookup[square], occupied, false );
+            pext_idx++;
+            occupied = (occupied - m.mask) & m.mask;
+        } while( occupied );
+        attacks += pext_idx;
+    }
+}
+
+// Calculate the bitboard lookup tables from the generated lookup tables
+bool bitboard_tables_init()
+{
+    bool use_pext = false;
+    #ifdef THC_PEXT
+    use_pext = slider_use_pext = cpu_has_bmi2();
+    #endif
+    slider_init( bishop_magics, bishop_attacks_table, bishop_magic_numbers, bishop_lookup, use_pext );
+    slider_init( rook_magics,   rook_attacks_table,   rook_magic_numbers,   rook_lookup,   use_pext );
+    for( Square square=a8; square<=h1; ++square )
+    {
+        knight_attacks_bb[square]     = squares_to_bb( knight_lookup[square] );
+        king_attacks_bb[square]       = squares_to_bb( king_lookup[square] );
+        pawn_white_attacks_bb[square] = squares_to_bb( pawn_white_lookup[square] );  // capture ray comes first
+        pawn_black_attacks_bb[square] = squares_to_bb( pawn_black_lookup[square] );
+    }
+
+    // Zobrist keys, no castling possible is zero so it drops out
+    uint64_t seed = 0x7468632d6b657973ULL;
+    for( int idx=0; idx<BB_NBR; idx++ )
+    {
+        for( int i=0; i<64; i++ )
+            zobrist_pieces[idx][i] = zobrist_random(seed);
+    }
+    zobrist_white = zobrist_random(seed);
+    zobrist_castling[0] = 0;
+    for( int i=1; i<16; i++ )
+        zobrist_castling[i] = zobrist_random(seed);
+    for( int i=0; i<8; i++ )
+        zobrist_enpassant[i] = zobrist_random(seed);
+
+    // Lines and the squares between, using the slider attacks from both ends
+    for( Square a=a8; a<=h1; ++a )
+    {
+        for( Square b=a8; b<=h1; ++b )
+        {
+            between_bb[a][b] = 0;
+            line_bb[a][b]    = 0;
+            if( bishop_attacks_bb(a,0) & BB(b) )
+            {
+                between_bb[a][b] = bishop_attacks_bb(a,BB(b)) & bishop_attacks_bb(b,BB(a));
+                line_bb[a][b]    = (bishop_attacks_bb(a,0) & bishop_attacks_bb(b,0)) | BB(a) | BB(b);
+            }
+            else if( rook_attacks_bb(a,0) & BB(b) )
+            {
+                between_bb[a][b] = rook_attacks_bb(a,BB(b)) & rook_attacks_bb(b,BB(a));
+                line_bb[a][b]    = (rook_attacks_bb(a,0) & rook_attacks_bb(b,0)) | BB(a) | BB(b);
+            }
+        }
+    }
+    return true;
+}
+
 }
@@ -7,6 +7,17 @@
 #ifndef PRIVATE_CHESS_DEFS_H_INCLUDED
 #define PRIVATE_CHESS_DEFS_H_INCLUDED
 #include "ChessDefs.h"
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// On x86-64 slider attacks can be indexed with the BMI2 PEXT instruction,
+//  which is used if the CPU supports it. Define THC_NO_PEXT to always
+//  use magic multiplication instead
+#if !defined(THC_NO_PEXT) && (defined(__x86_64__) || defined(_M_X64)) && (defined(__GNUC__) || defined(_MSC_VER))
+#define THC_PEXT
+#include <immintrin.h>
+#endif
 
 // TripleHappyChess
 namespace thc
@@ -61,7 +72,7 @@ inline Square& operator++ ( Square& sq )
     int  bking              : 1;
     int  bqueen             : 1;
 
-  We assume it is located in the last 4 bytes of ChessPosition,
+  We assume it is located in the last 4 bytes of ChessPositionRaw,
   hence the definition of typedef DETAIL as unsigned long, and
   of DETAIL_ADDR below. We assume that ANDing the unsigned
   character at this address + 3, with ~WKING, where WKING
@@ -71,7 +82,7 @@ inline Square& operator++ ( Square& sq )
   TestInternals(). If porting this code, step through that code
   first and make any adjustments necessary */
 
-#define DETAIL_ADDR         ( (DETAIL*) ((char *)this + sizeof(ChessPosition) - sizeof(DETAIL))  )
+#define DETAIL_ADDR         ( (DETAIL*) ((char *)static_cast<ChessPositionRaw*>(this) + sizeof(ChessPositionRaw) - sizeof(DETAIL))  )
 #define DETAIL_SAVE         DETAIL tmp = *DETAIL_ADDR
 #define DETAIL_RESTORE      *DETAIL_ADDR = tmp
 #define DETAIL_EQ_ALL               ( (*DETAIL_ADDR&0x0fffffff) == (tmp&0x0fffffff) )
@@ -131,6 +142,134 @@ extern const lte *attacks_white_lookup[];
 // Lookup squares from which enemy pieces attack black
 extern const lte *attacks_black_lookup[];
 
+// Bitboard with a single square set, eg BB(c5)
+#define BB(sq)      ( (Bitboard)1 << (sq) )
+
+// Bitboard of all squares on a rank, eg BB_RANK('5') -> a5-h5
+#define BB_RANK(r)  ( (Bitboard)0xff << (('8'-(r))*8) )
+
+// Number of squares set in a bitboard
+inline int bb_popcount( Bitboard bb )
+{
+#if defined(__GNUC__)
+    return __builtin_popcountll(bb);
+#else
+    bb = bb - ((bb>>1) & 0x5555555555555555ULL);
+    bb = (bb & 0x3333333333333333ULL) + ((bb>>2) & 0x3333333333333333ULL);
+    bb = (bb + (bb>>4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return (int)((bb * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+// Lowest numbered square set in a (non-zero) bitboard
+inline Square bb_lsb( Bitboard bb )
+{
+#if defined(__GNUC__)
+    return (Square)__builtin_ctzll(bb);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    unsigned long idx;
+    _BitScanForward64( &idx, bb );
+    return (Square)idx;
+#else
+    int idx = 0;
+    while( !(bb&1) )
+    {
+        bb >>= 1;
+        idx++;
+    }
+    return (Square)idx;
+#endif
+}
+
+// Remove and return lowest numbered square set in a (non-zero) bitboard
+inline Square bb_pop_lsb( Bitboard &bb )
+{
+    Square sq = bb_lsb(bb);
+    bb &= (bb-1);
+    return sq;
+}
+
+// Convert piece, e.g. 'N' to BB_WKNIGHT, empty square ' ' to BB_NBR
+extern lte bb_index[];
+
+// Bitboards of squares attacked by a piece on a given square
+extern Bitboard knight_attacks_bb[64];
+extern Bitboard king_attacks_bb[64];
+extern Bitboard pawn_white_attacks_bb[64];  // by a white pawn
+extern Bitboard pawn_black_attacks_bb[64];  // by a black pawn
+
+// Slider (bishop and rook) attacks for any occupancy, using "magic
+//  bitboards". Only the occupied squares within mask (the rays from the
+//  square less their final edge squares) can block, and they are mapped to
+//  a dense index into the attacks table, either by multiplying by a magic
+//  number found by trial and error and keeping the top bits, or in one step
+//  with the PEXT instruction
+struct SliderMagic
+{
+    Bitboard     mask;
+    Bitboard     magic;
+    Bitboard    *attacks;
+    unsigned int shift;     // 64 - number of squares in mask
+};
+extern SliderMagic bishop_magics[64];
+extern SliderMagic rook_magics[64];
+
+#ifdef THC_PEXT
+extern bool slider_use_pext;    // CPU supports PEXT, attacks tables laid out for it
+unsigned int slider_index_pext( Bitboard occupied, Bitboard mask );
+#endif
+
+inline unsigned int slider_index( const SliderMagic &m, Bitboard occupied )
+{
+#if defined(THC_PEXT) && defined(__BMI2__)
+    return (unsigned int)_pext_u64( occupied, m.mask );  // compiled for BMI2, no need to check
+#else
+    #ifdef THC_PEXT
+    if( slider_use_pext )
+        return slider_index_pext( occupied, m.mask );
+    #endif
+    return (unsigned int)( ((occupied & m.mask) * m.magic) >> m.shift );
+#endif
+}
+
+// Squares attacked by a bishop, rook or queen on square, given all occupied
+//  squares. Attacked squares include the first man on each ray (of either
+//  colour)
+inline Bitboard bishop_attacks_bb( Square square, Bitboard occupied )
+{
+    const SliderMagic &m = bishop_magics[square];
+    return m.attacks[ slider_index(m,occupied) ];
+}
+
+inline Bitboard rook_attacks_bb( Square square, Bitboard occupied )
+{
+    const SliderMagic &m = rook_magics[square];
+    return m.attacks[ slider_index(m,occupied) ];
+}
+
+inline Bitboard queen_attacks_bb( Square square, Bitboard occupied )
+{
+    return bishop_attacks_bb(square,occupied) | rook_attacks_bb(square,occupied);
+}
+
+// Squares strictly between two squares on a common line (else 0), and the
+//  whole line (edge to edge) through two squares on a common line (else 0)
+extern Bitboard between_bb[64][64];
+extern Bitboard line_bb[64][64];
+
+// Zobrist key random numbers, for each piece on each square (the material
+//  key reuses these indexed by count of pieces instead of square), white to
+//  move, each combination of castling possibilities and en passant file
+extern uint64_t zobrist_pieces[BB_NBR][64];
+extern uint64_t zobrist_white;
+extern uint64_t zobrist_castling[16];   // 1=K, 2=Q, 4=k, 8=q
+extern uint64_t zobrist_enpassant[8];
+
+// Calculate the bitboard lookup tables above from the generated lookup
+//  tables, returns true. Called automatically before the first
+//  ChessPosition is set up.
+bool bitboard_tables_init();
+
 } //namespace thc
 
 #endif // PRIVATE_CHESS_DEFS_H_INCLUDED
@@ -0,0 +1,257 @@
+/*
+
+    Game archive test and benchmark for the THC Chess library
+
+    With a PGN file, reads all the games, writes them to a GameArchive
+    (out, default archive-bench.tmp, which is deleted afterwards unless
+    given), reads every game and its tags back and checks them, then
+    reports the size of the archive and the speed of GetGame() and of a
+    tag search (all games of the most frequent player after the median
+    date). With no file, does the same with some pseudo random games and
+    made up tags, and checks a file that isn't an archive won't open.
+    Compile and link with thc.cpp.
+
+    Usage:
+        thc_archive_bench [file.pgn [out]]
+
+    Exit status is non-zero if the self test fails.
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include "thc.h"
+#include "bench-util.h"
+
+// Does a game match a filter ? (the slow way, to check GameArchive::Find())
+static bool matches( const thc::GameTags &tags, const thc::GameFilter &filter )
+{
+    bool by_date = filter.date_from>0 || filter.date_to>0;
+    return (!filter.player || tags.white==filter.player || tags.black==filter.player) &&
+           (!filter.white  || tags.white==filter.white) &&
+           (!filter.black  || tags.black==filter.black) &&
+           (!filter.event  || tags.event==filter.event) &&
+           (!by_date || (tags.date>0 && (filter.date_from==0 || tags.date>=filter.date_from)
+                                     && (filter.date_to==0   || tags.date<=filter.date_to))) &&
+           (filter.result<0 || tags.result==filter.result);
+}
+
+// Search, check and report
+//  return bool okay
+static bool search( const thc::GameArchive &archive, const std::vector<Game> &games,
+                    const char *description, const thc::GameFilter &filter )
+{
+    std::vector<long long> ids;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    archive.Find( filter, ids );
+    std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+    std::vector<long long> expected;
+    for( size_t i=0; i<games.size(); i++ )
+    {
+        if( matches(games[i].tags,filter) )
+            expected.push_back( (long long)i );
+    }
+    bool okay = (ids == expected);
+    printf( "  %s: %lu games in %.3f ms, %s\n", description, (unsigned long)ids.size(),
+                secs.count()*1000.0, okay ? "correct" : "WRONG" );
+    return okay;
+}
+
+// Write an archive, read it back, check and report
+//  return bool okay
+static bool run( const char *name, const std::vector<Game> &games, const char *filename, size_t block_size )
+{
+    long long nbr_moves = 0;
+    for( size_t i=0; i<games.size(); i++ )
+        nbr_moves += (long long)games[i].moves.size();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    thc::GameArchiveWriter writer;
+    writer.SetBlockSize( block_size );
+    bool okay = writer.Open( filename );
+    for( size_t i=0; okay && i<games.size(); i++ )
+        okay = writer.AddGame( games[i].tags, games[i].start, games[i].moves );
+    okay = writer.Close() && okay;
+    std::chrono::duration<double> write_secs = std::chrono::steady_clock::now() - start;
+    thc::GameArchive archive;
+    if( !okay || !archive.Open(filename) || archive.NbrGames()!=(long long)games.size() )
+    {
+        printf( "%s: cannot write or open archive %s\n", name, filename );
+        return false;
+    }
+
+    // Read every game in order, and check it
+    thc::ChessPosition position;
+    std::vector<thc::Move> moves;
+    thc::GameTags tags;
+    start = std::chrono::steady_clock::now();
+    for( size_t i=0; i<games.size(); i++ )
+    {
+        if( !archive.GetGame((long long)i,position,moves) || !(position==games[i].start) || moves!=games[i].moves )
+            okay = false;
+    }
+    std::chrono::duration<double> read_secs = std::chrono::steady_clock::now() - start;
+    for( size_t i=0; i<games.size(); i++ )
+    {
+        const thc::GameTags &t = games[i].tags;
+        if( !archive.GetTags((long long)i,tags) || tags.white!=t.white || tags.black!=t.black ||
+            tags.event!=t.event || tags.date!=t.date || tags.result!=t.result )
+            okay = false;
+    }
+
+    // Then some at random
+    int nbr_random = games.empty() ? 0 : 200;
+    unsigned int seed = 1;
+    start = std::chrono::steady_clock::now();
+    for( int i=0; i<nbr_random; i++ )
+    {
+        seed = seed*1103515245 + 12345;
+        size_t id = (seed>>8) % games.size();
+        if( !archive.GetGame((long long)id,position,moves) || moves!=games[id].moves )
+            okay = false;
+    }
+    std::chrono::duration<double> random_secs = std::chrono::steady_clock::now() - start;
+    if( archive.GetGame(-1,position,moves) || archive.GetGame(archive.NbrGames(),position,moves) )
+        okay = false;
+    FILE *f = fopen( filename, "rb" );
+    long size = 0;
+    if( f )
+    {
+        fseek( f, 0, SEEK_END );
+        size = ftell( f );
+        fclose( f );
+    }
+    printf( "%s: %lu games, %lld moves, %ld bytes, %.2f bits/move with tags (block size %lu)\n", name,
+                (unsigned long)games.size(), nbr_moves, size, nbr_moves ? size*8.0/nbr_moves : 0.0,
+                (unsigned long)block_size );
+    printf( "  write %.2f s, read in order %.2f s, random GetGame() %.3f ms, %s\n",
+                write_secs.count(), read_secs.count(),
+                nbr_random ? random_secs.count()*1000.0/nbr_random : 0.0,
+                okay ? "all games match" : "MISMATCH" );
+
+    // Tag searches, for the most frequent player
+    std::map<std::string,int> counts;
+    std::vector<int> dates;
+    for( size_t i=0; i<games.size(); i++ )
+    {
+        counts[games[i].tags.white]++;
+        counts[games[i].tags.black]++;
+        if( games[i].tags.date > 0 )
+            dates.push_back( games[i].tags.date );
+    }
+    std::string player;
+    int best = 0;
+    for( std::map<std::string,int>::iterator it=counts.begin(); it!=counts.end(); ++it )
+    {
+        if( it->second > best )
+        {
+            best = it->second;
+            player = it->first;
+        }
+    }
+    std::sort( dates.begin(), dates.end() );
+    thc::GameFilter filter;
+    filter.player = player.c_str();
+    std::string description = "Games of " + player;
+    okay = search( archive, games, description.c_str(), filter ) && okay;
+    if( !dates.empty() )
+    {
+        filter.date_from = dates[dates.size()/2];
+        char buf[20];
+        sprintf( buf, " from %d", filter.date_from );
+        description += buf;
+        okay = search( archive, games, description.c_str(), filter ) && okay;
+    }
+    filter = thc::GameFilter();
+    filter.result = thc::GameTags::RESULT_DRAW;
+    okay = search( archive, games, "Draws", filter ) && okay;
+    filter.white = "No such player";
+    okay = search( archive, games, "No such player", filter ) && okay;
+    return okay;
+}
+
+// Change a byte in the first block (just after the header), GetGame() must
+//  fail for the games in that block, and only those
+//  return bool okay
+static bool check_corrupt_block( const std::vector<Game> &games, const char *filename )
+{
+    thc::GameArchiveWriter writer;
+    writer.SetBlockSize( 1000 );
+    bool okay = writer.Open( filename );
+    for( size_t i=0; okay && i<games.size(); i++ )
+        okay = writer.AddGame( games[i].tags, games[i].start, games[i].moves );
+    okay = writer.Close() && okay;
+    FILE *f = okay ? fopen( filename, "r+b" ) : NULL;
+    okay = (f != NULL);
+    if( f )
+    {
+        okay = fseek(f,16*8+20,SEEK_SET)==0 && fputc(0x55,f)!=EOF;
+        fclose( f );
+    }
+    thc::GameArchive archive;
+    okay = okay && archive.Open( filename );
+    thc::ChessPosition position;
+    std::vector<thc::Move> moves;
+    long long nbr_bad = 0;
+    for( size_t i=0; okay && i<games.size(); i++ )
+    {
+        // The games not got must be the first few, those got must be right
+        if( !archive.GetGame((long long)i,position,moves) )
+            okay = (nbr_bad++ == (long long)i);
+        else
+            okay = (position==games[i].start) && moves==games[i].moves;
+    }
+    okay = okay && nbr_bad>0 && nbr_bad<(long long)games.size();
+    printf( "Corrupt block %s, %lld games in it not got\n", okay ? "detected" : "NOT DETECTED", nbr_bad );
+    return okay;
+}
+
+int main( int argc, char *argv[] )
+{
+    if( argc > 1 )
+    {
+        std::vector<Game> games;
+        if( !read_games(argv[1],games) )
+            return 1;
+        const char *filename = argc>2 ? argv[2] : "archive-bench.tmp";
+        bool ok = run( argv[1], games, filename, 4096 );
+        if( argc <= 2 )
+            remove( filename );
+        return ok ? 0 : 1;
+    }
+
+    // Self test, small blocks and big blocks
+    const char *filename = "archive-bench.tmp";
+    std::vector<Game> games;
+    make_games( 500, games );
+    bool ok = run( "Random games", games, filename, 1000 );
+    ok = run( "Random games", games, filename, 20000 ) && ok;
+
+    // An empty archive
+    std::vector<Game> empty;
+    ok = run( "No games", empty, filename, 1000 ) && ok;
+
+    // A corrupt block
+    ok = check_corrupt_block( games, filename ) && ok;
+
+    // A file that isn't an archive won't open
+    FILE *f = fopen( filename, "wb" );
+    if( f )
+    {
+        for( int i=0; i<1000; i++ )
+            fputc( i*7919>>3, f );
+        fclose( f );
+    }
+    thc::GameArchive archive;
+    bool rejected = !archive.Open( filename );
+    printf( "Not an archive %s\n", rejected ? "rejected" : "NOT REJECTED" );
+    remove( filename );
+    ok = ok && rejected;
+    printf( "%s\n", ok ? "Game archive ok" : "FAILED" );
+    return ok ? 0 : 1;
+}
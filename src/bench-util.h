@@ -0,0 +1,128 @@
+/*
+
+    Shared test helpers for the THC Chess library benchmarks and self tests
+
+    Games read from PGN files, and pseudo random games (every fifth one from
+    a FEN setup, with made up tags) so self tests don't need any files.
+    Include after thc.h.
+
+ */
+
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+#include <stdio.h>
+#include <vector>
+#include "thc.h"
+
+// A game, its tags, starting position and moves
+struct Game
+{
+    thc::GameTags          tags;
+    thc::ChessPosition     start;
+    std::vector<thc::Move> moves;
+};
+
+// Collects the games from a PGN file
+class GameCollector : public thc::PgnVisitor
+{
+public:
+    std::vector<Game> games;
+    long long         nbr_errors;
+    GameCollector() : nbr_errors(0) {}
+    bool GameBegin( const thc::PgnGame &game )
+    {
+        games.push_back( Game() );
+        games.back().tags.FromPgn( game );
+        return true;
+    }
+    bool GameMove( const thc::PgnGame &, int ply, const thc::ChessRules &cr, thc::Move mv )
+    {
+        if( ply == 0 )
+            games.back().start = cr;
+        games.back().moves.push_back( mv );
+        return true;
+    }
+    void GameEnd( const thc::PgnGame &, const thc::ChessRules &cr, bool error )
+    {
+        if( games.back().moves.empty() )
+            games.back().start = cr;
+        if( error )
+            nbr_errors++;
+    }
+};
+
+// Read all the games in a PGN file
+//  return bool okay
+inline bool read_games( const char *filename, std::vector<Game> &games )
+{
+    thc::PgnReader reader;
+    if( !reader.Open(filename) )
+    {
+        printf( "Cannot open %s\n", filename );
+        return false;
+    }
+    GameCollector collector;
+    reader.Read( collector );
+    if( collector.nbr_errors )
+        printf( "%lld games with errors (moves up to the error are used)\n", collector.nbr_errors );
+    games.swap( collector.games );
+    return true;
+}
+
+// Some pseudo random games, every fifth one from a FEN setup, with made up
+//  tags. Random games rarely meet, so if opening_plies is given the first
+//  few moves are each one of the first opening_choices legal moves
+inline void make_games( int nbr_games, std::vector<Game> &games, int max_plies=200,
+                        int opening_plies=0, int opening_choices=1 )
+{
+    unsigned int seed = 1;
+    for( int i=0; i<nbr_games; i++ )
+    {
+        thc::ChessRules cr;
+        if( i%5 == 4 )
+            cr.Forsyth( "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1" );
+        games.push_back( Game() );
+        Game &game = games.back();
+        game.start = cr;
+        char buf[40];
+        sprintf( buf, "Player %d", i%17 );
+        game.tags.white = buf;
+        sprintf( buf, "Player %d", (i*7+3)%17 );
+        game.tags.black = buf;
+        sprintf( buf, "Event %d", i/50 );
+        game.tags.event = (i%10==0) ? "" : buf;
+        game.tags.date   = (i%13==0) ? 0 : (2000+i%21)*10000 + (i%12+1)*100 + i%28+1;
+        game.tags.result = i%4;
+        for( int ply=0; ply<max_plies; ply++ )
+        {
+            thc::MOVELIST list;
+            cr.GenLegalMoveList( &list );
+            if( list.count == 0 )
+                break;
+            seed = seed*1103515245 + 12345;
+            int nbr = (ply<opening_plies && opening_choices<list.count) ? opening_choices : list.count;
+            thc::Move mv = list.moves[ (seed>>16) % nbr ];
+            game.moves.push_back( mv );
+            cr.PlayMove( mv );
+        }
+    }
+}
+
+// Every position in some games (the position before each move, and the
+//  final position)
+inline void make_positions( const std::vector<Game> &games, std::vector<thc::ChessPosition> &positions )
+{
+    for( size_t i=0; i<games.size(); i++ )
+    {
+        thc::ChessRules cr = games[i].start;
+        for( size_t j=0; j<games[i].moves.size(); j++ )
+        {
+            positions.push_back( cr );
+            thc::Move mv = games[i].moves[j];
+            cr.PlayMove( mv );
+        }
+        positions.push_back( cr );
+    }
+}
+
+#endif //BENCH_UTIL_H
@@ -0,0 +1,173 @@
+/*
+
+    Game compression test and benchmark for the THC Chess library
+
+    With a PGN file, reads all the games, compresses them with GameEncoder
+    into a single stream, decompresses them with GameDecoder, checks every
+    move and reports the size (bits per move) and speed of both. With no
+    file, does the same with some pseudo random games (including some from
+    FEN setups), and checks a corrupt or truncated stream is reported as an
+    error. Compile and link with thc.cpp.
+
+    Usage:
+        thc_codec_bench [file.pgn]
+
+    Exit status is non-zero if the self test fails.
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include "thc.h"
+#include "bench-util.h"
+
+// Compress games, draining the output after each game to show the encoder
+//  streams
+static void encode( const std::vector<Game> &games, std::vector<unsigned char> &stream )
+{
+    thc::GameEncoder encoder;
+    std::vector<unsigned char> out;
+    encoder.Begin( out );
+    for( size_t i=0; i<games.size(); i++ )
+    {
+        encoder.GameBegin( games[i].start );
+        for( size_t j=0; j<games[i].moves.size(); j++ )
+            encoder.AddMove( games[i].moves[j] );
+        encoder.GameEnd();
+        stream.insert( stream.end(), out.begin(), out.end() );
+        out.clear();
+    }
+    encoder.End();
+    stream.insert( stream.end(), out.begin(), out.end() );
+}
+
+// Decompress games and check they match
+//  return bool okay
+static bool decode( const std::vector<unsigned char> &stream, const std::vector<Game> &games )
+{
+    thc::GameDecoder decoder;
+    decoder.Begin( stream.data(), stream.size() );
+    size_t nbr = 0;
+    bool okay = true;
+    while( decoder.NextGame() )
+    {
+        if( nbr >= games.size() || !(decoder.Position()==games[nbr].start) )
+            okay = false;
+        thc::Move mv;
+        size_t ply = 0;
+        while( decoder.NextMove(mv) )
+        {
+            if( nbr<games.size() && (ply>=games[nbr].moves.size() || mv!=games[nbr].moves[ply]) )
+                okay = false;
+            ply++;
+        }
+        if( nbr<games.size() && ply!=games[nbr].moves.size() )
+            okay = false;
+        nbr++;
+    }
+    return okay && !decoder.Error() && nbr==games.size();
+}
+
+// Compress, decompress, check and report
+//  return bool okay
+static bool run( const char *name, const std::vector<Game> &games )
+{
+    long long nbr_moves = 0;
+    for( size_t i=0; i<games.size(); i++ )
+        nbr_moves += (long long)games[i].moves.size();
+    std::vector<unsigned char> stream;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    encode( games, stream );
+    std::chrono::duration<double> encode_secs = std::chrono::steady_clock::now() - start;
+    start = std::chrono::steady_clock::now();
+    bool okay = decode( stream, games );
+    std::chrono::duration<double> decode_secs = std::chrono::steady_clock::now() - start;
+    printf( "%s: %lu games, %lld moves, %lu bytes, %.2f bits/move, %.1f bytes/game\n", name,
+                (unsigned long)games.size(), nbr_moves, (unsigned long)stream.size(),
+                nbr_moves ? stream.size()*8.0/nbr_moves : 0.0,
+                games.size() ? (double)stream.size()/games.size() : 0.0 );
+    printf( "  encode %.2f million moves/s, decode %.2f million moves/s, %s\n",
+                nbr_moves/1e6/encode_secs.count(), nbr_moves/1e6/decode_secs.count(),
+                okay ? "all moves match" : "MISMATCH" );
+    return okay;
+}
+
+int main( int argc, char *argv[] )
+{
+    if( argc > 1 )
+    {
+        std::vector<Game> games;
+        if( !read_games(argv[1],games) )
+            return 1;
+        return run( argv[1], games ) ? 0 : 1;
+    }
+
+    // Self test
+    std::vector<Game> games;
+    make_games( 500, games );
+    bool ok = run( "Random games", games );
+
+    // An empty stream, and an empty game
+    std::vector<Game> empty;
+    ok = run( "No games", empty ) && ok;
+    empty.push_back( Game() );
+    ok = run( "Empty game", empty ) && ok;
+
+    // A truncated stream is an error, not a crash or a garbage game
+    std::vector<unsigned char> stream;
+    encode( games, stream );
+    thc::GameDecoder decoder;
+    decoder.Begin( stream.data(), stream.size()/2 );
+    thc::Move mv;
+    while( decoder.NextGame() )
+    {
+        while( decoder.NextMove(mv) )
+            ;
+    }
+    bool truncated_ok = decoder.Error();
+
+    printf( "Truncated stream %s\n", truncated_ok ? "detected" : "NOT DETECTED" );
+    ok = ok && truncated_ok;
+
+    // So is a stream with a byte changed, here and there (if not before,
+    //  then by the check at the end of the stream)
+    int nbr_detected = 0, nbr_corrupted = 0;
+    for( size_t i=0; i<stream.size(); i+=stream.size()/50+1 )
+    {
+        std::vector<unsigned char> corrupt = stream;
+        corrupt[i] ^= 0x10;
+        decoder.Begin( corrupt.data(), corrupt.size() );
+        while( decoder.NextGame() )
+        {
+            while( decoder.NextMove(mv) )
+                ;
+        }
+        nbr_corrupted++;
+        if( decoder.Error() )
+            nbr_detected++;
+    }
+    bool corrupt_ok = (nbr_detected == nbr_corrupted);
+    printf( "Corrupt stream detected %d times out of %d\n", nbr_detected, nbr_corrupted );
+    ok = ok && corrupt_ok;
+
+    // And so is garbage
+    for( size_t i=0; i<stream.size(); i++ )
+        stream[i] = (unsigned char)(i*7919 >> 3);
+    decoder.Begin( stream.data(), stream.size() );
+    int nbr_games = 0;
+    while( decoder.NextGame() )
+    {
+        nbr_games++;
+        while( decoder.NextMove(mv) )
+            ;
+    }
+    bool garbage_ok = decoder.Error();
+    printf( "Garbage stream (%d games) %s\n", nbr_games, garbage_ok ? "detected" : "NOT DETECTED" );
+    ok = ok && garbage_ok;
+    printf( "%s\n", ok ? "Game codec ok" : "FAILED" );
+    return ok ? 0 : 1;
+}
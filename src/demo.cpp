@@ -43,22 +43,21 @@ int main()
     display_position( cr, "Starting position of Italian opening, after 1.e4 e5 2.Nf3 Nc6 3.Bc4 Bc5" );
 
     printf( "List of all legal moves in the current position\n" );
-    std::vector<thc::Move> moves;
-    std::vector<bool> check;
-    std::vector<bool> mate;
-    std::vector<bool> stalemate;
-    cr.GenLegalMoveList(  moves, check, mate, stalemate );
-    unsigned int len = moves.size();
-    for( unsigned int i=0; i<len; i++ )
+    thc::MOVELIST moves;
+    bool check[MAXMOVES];
+    bool mate[MAXMOVES];
+    bool stalemate[MAXMOVES];
+    char natural[MAXMOVES][NATURAL_MOVE_SIZE];
+    cr.GenLegalMoveList( &moves, check, mate, stalemate );
+    cr.NaturalOutAll( moves, natural );    // much faster than NaturalOut() for each move
+    for( int i=0; i<moves.count; i++ )
     {
-        mv = moves[i];
-        std::string mv_txt = mv.NaturalOut(&cr);
         const char *suffix="";
         if( check[i] )
             suffix = " (note '+' indicates check)";
         else if( mate[i] )
             suffix = " (note '#' indicates mate)";
-        printf( "4.%s%s\n", mv_txt.c_str(), suffix );
+        printf( "4.%s%s\n", natural[i], suffix );
     }
 
     // Example 2, The shortest game leading to mate
@@ -97,5 +96,29 @@ int main()
         printf( "As expected, all flags true, so both penultimate and final positions are legal, in the final position White is mated\n" );
     else
         printf( "Strange(?!), we expected all flags true, meaning both penultimate and final positions are legal, in the final position White is mated\n" );
+
+    // Example 3, Ask the search engine for a move, in the Italian opening position
+    printf("\n");
+    cr = cr2;
+    const char *italian[] = { "e4", "e5", "Nf3", "Nc6", "Bc4", "Bc5" };
+    for( unsigned int i=0; i<sizeof(italian)/sizeof(italian[0]); i++ )
+    {
+        mv.NaturalIn( &cr, italian[i] );
+        cr.PlayMove(mv);
+    }
+    thc::Search search;
+    thc::SearchLimits limits;
+    limits.millisecs = 1000;
+    thc::SearchResult result = search.Go( cr, limits );
+    std::string pv;
+    thc::ChessRules cr_pv = cr;
+    for( unsigned int i=0; i<result.pv.size(); i++ )
+    {
+        mv = result.pv[i];
+        pv += (i==0 ? "" : " ") + mv.NaturalOut(&cr_pv);
+        cr_pv.PlayMove(mv);
+    }
+    printf( "Search: depth %d, score %d centipawns, %lld nodes in %d milliseconds, principal variation 4.%s\n",
+        result.depth, result.score_cp, result.nodes, result.millisecs, pv.c_str() );
 }
 
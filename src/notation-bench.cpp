@@ -0,0 +1,329 @@
+/*
+
+    Notation benchmark for the THC Chess library
+
+    Times the buffer based notation functions, ForsythPublish(), Forsyth(),
+    Move::NaturalOut(), Move::NaturalIn(), Move::NaturalInFast(),
+    Move::TerseOut(), Move::TerseIn() and ToDebugStr(), over the positions
+    of some pseudo random games, and counts the heap allocations they make
+    (there should be none). Compile and link with thc.cpp (needs C++17 for
+    std::string_view).
+
+    Usage:
+        thc_notation_bench [nbr_games]
+
+    Also checks Move::NaturalInFast() rejects illegal, ambiguous and
+    badly formed moves, with some hand picked cases, and with mutations of
+    every move in every eighth position (anything it accepts must be a legal
+    move, the same one the forgiving Move::NaturalIn() reads).
+
+    Exit status is non-zero if any call allocates memory, or any round trip
+    (eg NaturalOut() then NaturalIn()) doesn't give back what it started
+    with, or NaturalInFast() accepts anything it shouldn't.
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <string_view>
+#include "thc.h"
+
+// Count every heap allocation
+static long long nbr_allocations = 0;
+void *operator new( size_t size )
+{
+    nbr_allocations++;
+    void *p = malloc( size ? size : 1 );
+    if( !p )
+        throw std::bad_alloc();
+    return p;
+}
+void operator delete( void *p ) noexcept { free(p); }
+void operator delete( void *p, size_t ) noexcept { free(p); }
+
+// Each test is run over all the positions, or all the legal moves in all
+//  the positions
+struct Sample
+{
+    thc::ChessRules cr;
+    thc::MOVELIST   moves;
+    char            forsyth[FORSYTH_SIZE];
+    char            natural[MAXMOVES][NATURAL_MOVE_SIZE];
+    char            terse[MAXMOVES][TERSE_MOVE_SIZE];
+};
+
+static double elapsed( std::chrono::steady_clock::time_point start )
+{
+    std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+    return d.count();
+}
+
+// NaturalInFast() cases, a position and moves, each either accepted (as
+//  the terse move given) or rejected (terse move NULL)
+struct StrictCase
+{
+    const char *natural;
+    const char *terse;
+};
+struct StrictPosition
+{
+    const char *fen;
+    StrictCase  cases[12];
+};
+static const StrictPosition strict_positions[] =
+{
+    // Knights on b1 and f3 can both go to d2
+    { "rnbqkbnr/pppppppp/8/8/8/5N2/PPP1PPPP/RNBQKB1R w KQkq - 0 1",
+        { {"Nd2",NULL}, {"Nbd2","b1d2"}, {"Nfd2","f3d2"}, {"N1d2","b1d2"}, {"N3d2","f3d2"},
+          {"Nb1d2","b1d2"}, {"Ndd2",NULL}, {"Nxd2",NULL}, {NULL,NULL} } },
+
+    // Captures need an 'x', non captures mustn't have one
+    { "4k3/8/8/3p4/4P3/8/8/4K3 w - - 0 1",
+        { {"exd5","e4d5"}, {"ed5",NULL}, {"xd5",NULL}, {"Pxd5",NULL}, {"e4d5",NULL},
+          {"exe5",NULL}, {"e5","e4e5"}, {"e5+","e4e5"}, {"Kxe2",NULL}, {"Ke2","e1e2"}, {NULL,NULL} } },
+
+    // The knight is pinned
+    { "4k3/4r3/8/8/8/8/4N3/4K3 w - - 0 1",
+        { {"Nc3",NULL}, {"Ng3",NULL}, {"Nc1",NULL}, {"Kd1","e1d1"}, {"Ke2",NULL}, {NULL,NULL} } },
+
+    // Promotion only, and always, on the last rank
+    { "4k3/P7/8/8/8/8/4P3/4K3 w - - 0 1",
+        { {"a8=Q","a7a8q"}, {"a8Q","a7a8q"}, {"a8=N+","a7a8n"}, {"a8",NULL}, {"a8=K",NULL},
+          {"a8=P",NULL}, {"e4=Q",NULL}, {"e3=N",NULL}, {"e4","e2e4"}, {NULL,NULL} } },
+
+    // Castling, truncated and garbage
+    { "r3k2r/8/8/8/8/8/8/R3K2R w KQkq - 0 1",
+        { {"O-O","e1g1"}, {"O-O-O","e1c1"}, {"0-0","e1g1"}, {"O-",NULL}, {"O-O-",NULL},
+          {"O",NULL}, {"",NULL}, {"N",NULL}, {"Zf3",NULL}, {"Rf9",NULL}, {"Kf1x",NULL}, {NULL,NULL} } },
+    { "r3k2r/8/8/8/8/8/8/R3K2R w KQkq - 0 1",
+        { {"Rb1!?","a1b1"}, {"Rb",NULL}, {"R",NULL}, {"b",NULL}, {"Rb1Rb1",NULL}, {"Rbb1",NULL},
+          {"-",NULL}, {"=Q",NULL}, {"+",NULL}, {NULL,NULL} } }
+};
+
+// Check the hand picked NaturalInFast() cases
+//  return bool okay
+static bool check_strict_cases()
+{
+    bool ok = true;
+    int nbr = 0;
+    for( unsigned int i=0; i<sizeof(strict_positions)/sizeof(strict_positions[0]); i++ )
+    {
+        thc::ChessRules cr;
+        cr.Forsyth( strict_positions[i].fen );
+        for( const StrictCase *c=strict_positions[i].cases; c->natural; c++, nbr++ )
+        {
+            thc::Move mv;
+            bool accepted = mv.NaturalInFast( &cr, c->natural );
+            bool right = c->terse ? (accepted && mv.TerseOut()==c->terse) : !accepted;
+            if( !right )
+            {
+                printf( "NaturalInFast() %s \"%s\" in %s\n", accepted?"accepts":"rejects",
+                            c->natural, strict_positions[i].fen );
+                ok = false;
+            }
+        }
+    }
+    printf( "NaturalInFast strict cases: %d, %s\n", nbr, ok ? "all right" : "WRONG" );
+    return ok;
+}
+
+// Mutate moves (truncate them, drop, change or add a character) and check
+//  anything NaturalInFast() accepts is a legal move, the one NaturalIn()
+//  reads
+//  return bool okay
+static bool check_strict_mutations( std::vector<Sample> &s )
+{
+    const char *alphabet = "NBRQKPabcdefgh12345678x=+#O0-";
+    long long nbr = 0, accepted = 0;
+    bool ok = true;
+    for( unsigned int i=0; i<s.size(); i+=8 )
+    {
+        for( int j=0; j<s[i].moves.count; j++ )
+        {
+            std::string natural = s[i].natural[j];
+            std::vector<std::string> mutants;
+            for( size_t k=0; k<natural.length(); k++ )
+            {
+                mutants.push_back( natural.substr(0,k) );
+                mutants.push_back( natural.substr(0,k) + natural.substr(k+1) );
+                for( const char *a=alphabet; *a; a++ )
+                {
+                    std::string changed = natural;
+                    changed[k] = *a;
+                    mutants.push_back( changed );
+                }
+            }
+            for( size_t k=0; k<=natural.length(); k++ )
+                mutants.push_back( natural.substr(0,k) + "x" + natural.substr(k) );
+            for( size_t k=0; k<mutants.size(); k++, nbr++ )
+            {
+                thc::Move mv, slow;
+                if( !mv.NaturalInFast( &s[i].cr, mutants[k].c_str() ) )
+                    continue;
+                accepted++;
+                bool legal = false;
+                for( int m=0; !legal && m<s[i].moves.count; m++ )
+                    legal = (mv == s[i].moves.moves[m]);
+                if( !legal || !slow.NaturalIn( &s[i].cr, mutants[k].c_str() ) || slow!=mv )
+                {
+                    printf( "NaturalInFast() accepts \"%s\" (from %s) as %s\n", mutants[k].c_str(),
+                                natural.c_str(), mv.TerseOut().c_str() );
+                    ok = false;
+                }
+            }
+        }
+    }
+    printf( "NaturalInFast mutations: %lld, %lld accepted, %s\n", nbr, accepted,
+                ok ? "all legal and the same as NaturalIn" : "WRONG" );
+    return ok;
+}
+
+static void report( const char *name, long long calls, double secs, long long allocations )
+{
+    printf( "%-16s %10lld calls %8.1f ns/call %6.3f allocations/call\n", name, calls,
+                calls ? secs*1e9/calls : 0.0, calls ? (double)allocations/calls : 0.0 );
+}
+
+int main( int argc, char *argv[] )
+{
+    int nbr_games = argc>1 ? atoi(argv[1]) : 20;
+
+    // Play some pseudo random games, favouring captures and checks so
+    //  they get into the middlegame and endgame
+    std::vector<Sample> *samples = new std::vector<Sample>;
+    unsigned int seed = 1;
+    for( int game=0; game<nbr_games; game++ )
+    {
+        thc::ChessRules cr;
+        for( int ply=0; ply<200; ply++ )
+        {
+            samples->push_back( Sample() );
+            Sample &sample = samples->back();
+            sample.cr = cr;
+            cr.GenLegalMoveList( &sample.moves );
+            if( sample.moves.count == 0 )
+                break;
+            seed = seed*1103515245 + 12345;
+            thc::Move mv = sample.moves.moves[ (seed>>16) % sample.moves.count ];
+            for( int i=0; i<sample.moves.count; i++ )
+            {
+                if( sample.moves.moves[i].capture != ' ' && ((seed>>8)&3)==0 )
+                    mv = sample.moves.moves[i];
+            }
+            cr.PlayMove( mv );
+        }
+    }
+    std::vector<Sample> &s = *samples;
+    bool ok = true;
+    long long calls, allocations;
+    std::chrono::steady_clock::time_point start;
+
+    calls = 0;
+    allocations = nbr_allocations;
+    start = std::chrono::steady_clock::now();
+    for( unsigned int i=0; i<s.size(); i++, calls++ )
+        s[i].cr.ForsythPublish( s[i].forsyth );
+    report( "ForsythPublish", calls, elapsed(start), nbr_allocations-allocations );
+    ok = ok && nbr_allocations==allocations;
+
+    calls = 0;
+    allocations = nbr_allocations;
+    start = std::chrono::steady_clock::now();
+    for( unsigned int i=0; i<s.size(); i++, calls++ )
+    {
+        thc::ChessPosition cp;
+        if( !cp.Forsyth( std::string_view(s[i].forsyth) ) || !(cp==s[i].cr) )
+            ok = false;
+    }
+    report( "Forsyth", calls, elapsed(start), nbr_allocations-allocations );
+    ok = ok && nbr_allocations==allocations;
+
+    calls = 0;
+    allocations = nbr_allocations;
+    start = std::chrono::steady_clock::now();
+    for( unsigned int i=0; i<s.size(); i++ )
+    {
+        for( int j=0; j<s[i].moves.count; j++, calls++ )
+            s[i].moves.moves[j].NaturalOut( &s[i].cr, s[i].natural[j] );
+    }
+    report( "NaturalOut", calls, elapsed(start), nbr_allocations-allocations );
+    ok = ok && nbr_allocations==allocations;
+
+    calls = 0;
+    allocations = nbr_allocations;
+    start = std::chrono::steady_clock::now();
+    for( unsigned int i=0; i<s.size(); i++ )
+    {
+        for( int j=0; j<s[i].moves.count; j++, calls++ )
+        {
+            thc::Move mv;
+            if( !mv.NaturalIn( &s[i].cr, std::string_view(s[i].natural[j]) ) || mv!=s[i].moves.moves[j] )
+                ok = false;
+        }
+    }
+    report( "NaturalIn", calls, elapsed(start), nbr_allocations-allocations );
+    ok = ok && nbr_allocations==allocations;
+
+    calls = 0;
+    allocations = nbr_allocations;
+    start = std::chrono::steady_clock::now();
+    for( unsigned int i=0; i<s.size(); i++ )
+    {
+        for( int j=0; j<s[i].moves.count; j++, calls++ )
+        {
+            thc::Move mv;
+            if( !mv.NaturalInFast( &s[i].cr, std::string_view(s[i].natural[j]) ) || mv!=s[i].moves.moves[j] )
+                ok = false;
+        }
+    }
+    report( "NaturalInFast", calls, elapsed(start), nbr_allocations-allocations );
+    ok = ok && nbr_allocations==allocations;
+    ok = check_strict_cases() && ok;
+    ok = check_strict_mutations( s ) && ok;
+
+    calls = 0;
+    allocations = nbr_allocations;
+    start = std::chrono::steady_clock::now();
+    for( unsigned int i=0; i<s.size(); i++ )
+    {
+        for( int j=0; j<s[i].moves.count; j++, calls++ )
+            s[i].moves.moves[j].TerseOut( s[i].terse[j] );
+    }
+    report( "TerseOut", calls, elapsed(start), nbr_allocations-allocations );
+    ok = ok && nbr_allocations==allocations;
+
+    calls = 0;
+    allocations = nbr_allocations;
+    start = std::chrono::steady_clock::now();
+    for( unsigned int i=0; i<s.size(); i++ )
+    {
+        for( int j=0; j<s[i].moves.count; j++, calls++ )
+        {
+            thc::Move mv;
+            if( !mv.TerseIn( &s[i].cr, std::string_view(s[i].terse[j]) ) || mv!=s[i].moves.moves[j] )
+                ok = false;
+        }
+    }
+    report( "TerseIn", calls, elapsed(start), nbr_allocations-allocations );
+    ok = ok && nbr_allocations==allocations;
+
+    calls = 0;
+    allocations = nbr_allocations;
+    start = std::chrono::steady_clock::now();
+    for( unsigned int i=0; i<s.size(); i++, calls++ )
+    {
+        char buf[200];
+        s[i].cr.ToDebugStr( buf, sizeof(buf), "Position" );
+    }
+    report( "ToDebugStr", calls, elapsed(start), nbr_allocations-allocations );
+    ok = ok && nbr_allocations==allocations;
+
+    printf( "%s\n", ok ? "No allocations, all round trips ok" : "FAILED" );
+    delete samples;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,363 @@
+/*
+
+    Perft for the THC Chess library
+
+    Perft counts the leaf nodes of the legal move tree to a given depth. The
+    counts for a handful of well known positions are published, so perft is
+    both the standard correctness test for a move generator and a repeatable
+    measure of its speed. Compile and link with thc.cpp.
+
+    Usage:
+        thc_perft                       run the standard suite
+        thc_perft suite [max_nodes]     run the standard suite, for each position
+                                        using the deepest known count that does
+                                        not exceed max_nodes (default 5000000)
+        thc_perft perft depth [fen]     count leaf nodes (default initial position)
+        thc_perft divide depth [fen]    count leaf nodes after each legal move
+
+    Options (anywhere on the command line);
+        -nobulk         play out the last ply rather than simply counting the
+                        legal moves at depth 1 (bulk counting)
+        -threads n      search with n threads (0 = one per hardware thread)
+        -hash mb        share a hash table of mb megabytes between threads
+
+    Exit status is non-zero if any suite count doesn't match.
+
+    Multithreaded perft splits the tree two plies down into tasks, which are
+    dealt out to per thread queues. A thread that runs out of tasks steals
+    from the other queues. The shared hash table is lock free; each entry
+    stores its key xor'd with its data, so an entry torn by simultaneous
+    writes simply fails to match. Counts are the same for any number of
+    threads.
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include "thc.h"
+
+static bool bulk_counting = true;
+static int  nbr_threads   = 1;
+
+// Standard perft positions, with known counts for depths 1,2,3...
+struct PerftPosition
+{
+    const char *name;
+    const char *fen;
+    long long   nodes[7];   // terminated by 0
+};
+
+static const PerftPosition suite[] =
+{
+    { "Initial position",
+      "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+      { 20, 400, 8902, 197281, 4865609, 119060324, 0 } },
+    { "Kiwipete",
+      "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+      { 48, 2039, 97862, 4085603, 193690690, 0 } },
+    { "Position 3",
+      "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+      { 14, 191, 2812, 43238, 674624, 11030083, 0 } },
+    { "Position 4",
+      "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+      { 6, 264, 9467, 422333, 15833292, 0 } },
+    { "Position 4 mirrored",
+      "r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1",
+      { 6, 264, 9467, 422333, 15833292, 0 } },
+    { "Position 5",
+      "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+      { 44, 1486, 62379, 2103487, 89941194, 0 } },
+    { "Position 6",
+      "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+      { 46, 2079, 89890, 3894594, 164075551, 0 } }
+};
+
+// Seconds elapsed since start
+static double elapsed( std::chrono::steady_clock::time_point start )
+{
+    return std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+}
+
+// Nodes per second, formatted for humans
+static std::string nps_str( long long nodes, double secs )
+{
+    char buf[40];
+    if( secs <= 0.0 )
+        return "-";
+    sprintf( buf, "%.2f Mnps", nodes/secs/1000000.0 );
+    return buf;
+}
+
+// Perft hash table entry, data is count<<8 | depth
+struct PerftHashEntry
+{
+    std::atomic<uint64_t> check;    // key ^ data
+    std::atomic<uint64_t> data;
+};
+static std::unique_ptr<PerftHashEntry[]> hash_table;
+static uint64_t hash_mask;
+
+// Allocate (and clear) a hash table, size rounded down to a power of 2
+static void hash_init( long long megabytes )
+{
+    hash_table.reset();
+    uint64_t nbr_entries = 1;
+    while( nbr_entries*2*sizeof(PerftHashEntry) <= (uint64_t)megabytes*1024*1024 )
+        nbr_entries *= 2;
+    if( megabytes > 0 )
+    {
+        hash_table.reset( new PerftHashEntry[nbr_entries]() );
+        hash_mask = nbr_entries-1;
+    }
+}
+
+// Count leaf nodes to depth
+static long long perft( thc::ChessRules &cr, int depth )
+{
+    // Only worth looking up interior nodes
+    uint64_t key = 0;
+    PerftHashEntry *entry = NULL;
+    if( hash_table && depth>=2 )
+    {
+        key   = cr.key;
+        entry = &hash_table[ key & hash_mask ];
+        uint64_t data  = entry->data.load( std::memory_order_relaxed );
+        uint64_t check = entry->check.load( std::memory_order_relaxed );
+        if( (check^data)==key && (int)(data&0xff)==depth )
+            return (long long)(data>>8);
+    }
+    long long nodes = 0;
+    if( depth==1 && bulk_counting )
+        nodes = cr.CountLegalMoves();
+    else
+    {
+        thc::MOVELIST list;
+        cr.GenLegalMoveList( &list );
+        for( int i=0; i<list.count; i++ )
+        {
+            cr.PushMove( list.moves[i] );
+            nodes += (depth<=1 ? 1 : perft(cr,depth-1));
+            cr.PopMove( list.moves[i] );
+        }
+    }
+    if( entry )
+    {
+        uint64_t data = ((uint64_t)nodes<<8) | (uint64_t)depth;
+        entry->data.store( data, std::memory_order_relaxed );
+        entry->check.store( key^data, std::memory_order_relaxed );
+    }
+    return nodes;
+}
+
+// A unit of work for the thread pool, count the nodes below a one or two
+//  ply sequence of moves from the root
+struct PerftTask
+{
+    int       root_idx;     // index of first move in root move list
+    int       nbr_moves;
+    thc::Move moves[2];
+    long long nodes;
+};
+
+// One queue of tasks per thread, the owner takes from the back and thieves
+//  from the front
+struct PerftQueue
+{
+    std::mutex       mtx;
+    std::deque<int>  tasks;
+    bool pop( int &task, bool steal )
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if( tasks.empty() )
+            return false;
+        if( steal )
+        {
+            task = tasks.front();
+            tasks.pop_front();
+        }
+        else
+        {
+            task = tasks.back();
+            tasks.pop_back();
+        }
+        return true;
+    }
+};
+
+static void perft_worker( int id, const thc::ChessRules &root, int depth,
+                          std::vector<PerftTask> &tasks, std::vector<PerftQueue> &queues )
+{
+    thc::ChessRules cr = root;
+    int nbr_queues = (int)queues.size();
+    for(;;)
+    {
+        int t;
+        bool found = queues[id].pop(t,false);
+        for( int i=1; !found && i<nbr_queues; i++ )
+            found = queues[(id+i)%nbr_queues].pop(t,true);
+        if( !found )
+            break;  // all tasks are queued up front, so we're done
+        PerftTask &task = tasks[t];
+        for( int i=0; i<task.nbr_moves; i++ )
+            cr.PushMove( task.moves[i] );
+        int remaining = depth - task.nbr_moves;
+        task.nodes = (remaining==0 ? 1 : perft(cr,remaining));
+        for( int i=task.nbr_moves-1; i>=0; i-- )
+            cr.PopMove( task.moves[i] );
+    }
+}
+
+// Count leaf nodes to depth using the thread pool, optionally showing the
+//  count after each legal move (divide)
+static long long perft_root( thc::ChessRules &cr, int depth, bool show_divide=false )
+{
+    thc::MOVELIST list;
+    cr.GenLegalMoveList( &list );
+
+    // Split into tasks two plies deep (one ply if that's all there is)
+    std::vector<PerftTask> tasks;
+    for( int i=0; i<list.count; i++ )
+    {
+        PerftTask task;
+        task.root_idx  = i;
+        task.nbr_moves = 1;
+        task.moves[0]  = list.moves[i];
+        task.nodes     = 0;
+        if( depth < 3 )
+        {
+            tasks.push_back( task );
+            continue;
+        }
+        task.nbr_moves = 2;
+        thc::MOVELIST replies;
+        cr.PushMove( list.moves[i] );
+        cr.GenLegalMoveList( &replies );
+        cr.PopMove( list.moves[i] );
+        for( int j=0; j<replies.count; j++ )
+        {
+            task.moves[1] = replies.moves[j];
+            tasks.push_back( task );
+        }
+    }
+
+    // Deal out the tasks and run the threads
+    int n = nbr_threads>0 ? nbr_threads : (int)std::thread::hardware_concurrency();
+    if( n < 1 )
+        n = 1;
+    std::vector<PerftQueue> queues(n);
+    for( unsigned int t=0; t<tasks.size(); t++ )
+        queues[t%n].tasks.push_back(t);
+    std::vector<std::thread> threads;
+    for( int i=1; i<n; i++ )
+        threads.push_back( std::thread( perft_worker, i, std::cref(cr), depth, std::ref(tasks), std::ref(queues) ) );
+    perft_worker( 0, cr, depth, tasks, queues );
+    for( unsigned int i=0; i<threads.size(); i++ )
+        threads[i].join();
+
+    // Add up the counts in a fixed order
+    std::vector<long long> root_nodes( list.count, 0 );
+    long long total = 0;
+    for( unsigned int t=0; t<tasks.size(); t++ )
+    {
+        root_nodes[tasks[t].root_idx] += tasks[t].nodes;
+        total += tasks[t].nodes;
+    }
+    if( show_divide )
+    {
+        for( int i=0; i<list.count; i++ )
+            printf( "%s: %lld\n", list.moves[i].TerseOut().c_str(), root_nodes[i] );
+        printf( "\nMoves: %d\n", list.count );
+    }
+    return total;
+}
+
+// Run the standard suite, return true if all counts match
+static bool run_suite( long long max_nodes )
+{
+    bool all_ok = true;
+    long long total_nodes = 0;
+    double    total_secs  = 0.0;
+    for( unsigned int i=0; i<sizeof(suite)/sizeof(suite[0]); i++ )
+    {
+        const PerftPosition &pos = suite[i];
+        int depth = 1;
+        while( pos.nodes[depth] && pos.nodes[depth]<=max_nodes )
+            depth++;
+        thc::ChessRules cr;
+        cr.Forsyth( pos.fen );
+        auto start = std::chrono::steady_clock::now();
+        long long nodes = perft_root( cr, depth );
+        double secs = elapsed( start );
+        bool ok = (nodes == pos.nodes[depth-1]);
+        if( !ok )
+            all_ok = false;
+        total_nodes += nodes;
+        total_secs  += secs;
+        printf( "%-20s depth %d nodes %11lld %s  %7.3fs %14s\n", pos.name, depth, nodes,
+                    ok ? "ok  " : "FAIL", secs, nps_str(nodes,secs).c_str() );
+        if( !ok )
+            printf( "    %s expected %lld\n", pos.fen, pos.nodes[depth-1] );
+    }
+    printf( "%s: %lld nodes %.3fs %s%s, %d thread(s)%s\n", all_ok ? "All counts match" : "Perft FAILED",
+                total_nodes, total_secs, nps_str(total_nodes,total_secs).c_str(),
+                bulk_counting ? "" : " (no bulk counting)", nbr_threads,
+                hash_table ? " with hash" : "" );
+    return all_ok;
+}
+
+int main( int argc, char *argv[] )
+{
+    std::vector<std::string> args;
+    long long hash_megabytes = 0;
+    for( int i=1; i<argc; i++ )
+    {
+        if( 0 == strcmp(argv[i],"-nobulk") )
+            bulk_counting = false;
+        else if( 0==strcmp(argv[i],"-threads") && i+1<argc )
+            nbr_threads = atoi( argv[++i] );
+        else if( 0==strcmp(argv[i],"-hash") && i+1<argc )
+            hash_megabytes = atoll( argv[++i] );
+        else
+            args.push_back( argv[i] );
+    }
+    if( nbr_threads <= 0 )
+        nbr_threads = (int)std::thread::hardware_concurrency();
+    hash_init( hash_megabytes );
+    std::string cmd = args.size()>0 ? args[0] : "suite";
+    if( cmd == "suite" )
+    {
+        long long max_nodes = args.size()>1 ? atoll(args[1].c_str()) : 5000000;
+        return run_suite(max_nodes) ? 0 : 1;
+    }
+    else if( (cmd=="perft" || cmd=="divide") && args.size()>1 )
+    {
+        int depth = atoi( args[1].c_str() );
+        thc::ChessRules cr;
+        if( args.size()>2 && !cr.Forsyth(args[2].c_str()) )
+        {
+            printf( "Bad FEN: %s\n", args[2].c_str() );
+            return 1;
+        }
+        if( depth < 1 )
+        {
+            printf( "Depth must be at least 1\n" );
+            return 1;
+        }
+        auto start = std::chrono::steady_clock::now();
+        long long nodes = perft_root( cr, depth, cmd=="divide" );
+        double secs = elapsed( start );
+        printf( "Nodes: %lld\nTime: %.3fs %s\n", nodes, secs, nps_str(nodes,secs).c_str() );
+        return 0;
+    }
+    printf( "Usage: thc_perft [suite [max_nodes]] | [perft|divide depth [fen]] [-nobulk] [-threads n] [-hash mb]\n" );
+    return 1;
+}
@@ -0,0 +1,362 @@
+/*
+
+    PGN reader test and benchmark for the THC Chess library
+
+    With a PGN file, reads and replays all the games and reports games,
+    moves, errors and speed, using PgnPipeline if -threads is given. With
+    no file, writes some pseudo random games (with comments, NAGs,
+    variations, FEN setups and the like) to a temporary PGN file, reads
+    them back, with PgnReader and with PgnPipeline, and checks every move.
+    Compile and link with thc.cpp.
+
+    Usage:
+        thc_pgn_bench [-threads n] [-lenient] [file.pgn]
+
+    Moves must be strict SAN, unless -lenient is given (see
+    PgnReader::SetLenient()).
+
+    Exit status is non-zero if the self test fails.
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include "thc.h"
+
+// Counts everything, remembers the moves
+class CountingVisitor : public thc::PgnVisitor
+{
+public:
+    long long nbr_games, nbr_moves, nbr_errors;
+    bool      remember;
+    std::vector< std::vector<thc::Move> > games;
+    CountingVisitor( bool remember_ ) : nbr_games(0), nbr_moves(0), nbr_errors(0), remember(remember_) {}
+    bool GameBegin( const thc::PgnGame & )
+    {
+        nbr_games++;
+        if( remember )
+            games.push_back( std::vector<thc::Move>() );
+        return true;
+    }
+    bool GameMove( const thc::PgnGame &, int, const thc::ChessRules &, thc::Move mv )
+    {
+        nbr_moves++;
+        if( remember )
+            games.back().push_back( mv );
+        return true;
+    }
+    void GameEnd( const thc::PgnGame &, const thc::ChessRules &, bool error )
+    {
+        if( error )
+            nbr_errors++;
+    }
+};
+
+// The moves of a chunk's games
+class ChunkMoves : public thc::PgnChunkResult
+{
+public:
+    long long nbr_moves, nbr_errors;
+    std::vector< std::vector<thc::Move> > games;
+    ChunkMoves() : nbr_moves(0), nbr_errors(0) {}
+};
+
+// Counts everything, remembers the moves, for a chunk at a time
+class PipelineWorker : public thc::PgnWorker
+{
+public:
+    bool        remember;
+    ChunkMoves *chunk_moves;
+    PipelineWorker( bool remember_ ) : remember(remember_), chunk_moves(NULL) {}
+    void ChunkBegin( const thc::PgnChunk & )
+    {
+        chunk_moves = new ChunkMoves;
+    }
+    bool GameBegin( const thc::PgnGame & )
+    {
+        if( remember )
+            chunk_moves->games.push_back( std::vector<thc::Move>() );
+        return true;
+    }
+    bool GameMove( const thc::PgnGame &, int, const thc::ChessRules &, thc::Move mv )
+    {
+        chunk_moves->nbr_moves++;
+        if( remember )
+            chunk_moves->games.back().push_back( mv );
+        return true;
+    }
+    void GameEnd( const thc::PgnGame &, const thc::ChessRules &, bool error )
+    {
+        if( error )
+            chunk_moves->nbr_errors++;
+    }
+    thc::PgnChunkResult *ChunkEnd( const thc::PgnChunk & )
+    {
+        return chunk_moves;
+    }
+};
+
+// Puts the chunks back together
+class PipelineReducer : public thc::PgnReducer
+{
+public:
+    long long nbr_moves, nbr_errors, next_game_nbr;
+    bool      in_order;
+    std::vector< std::vector<thc::Move> > games;
+    PipelineReducer() : nbr_moves(0), nbr_errors(0), next_game_nbr(0), in_order(true) {}
+    void Reduce( thc::PgnChunkResult &result )
+    {
+        ChunkMoves &chunk_moves = (ChunkMoves &)result;
+        nbr_moves  += chunk_moves.nbr_moves;
+        nbr_errors += chunk_moves.nbr_errors;
+        if( result.first_game_nbr != next_game_nbr )
+            in_order = false;
+        next_game_nbr += result.nbr_games;
+        games.insert( games.end(), chunk_moves.games.begin(), chunk_moves.games.end() );
+    }
+};
+
+// For sorting games
+static bool move_list_less( const std::vector<thc::Move> &a, const std::vector<thc::Move> &b )
+{
+    for( size_t i=0; i<a.size() && i<b.size(); i++ )
+    {
+        if( a[i] != b[i] )
+            return memcmp( &a[i], &b[i], sizeof(thc::Move) ) < 0;
+    }
+    return a.size() < b.size();
+}
+
+// Write some pseudo random games as PGN
+static std::string make_pgn( int nbr_games, std::vector< std::vector<thc::Move> > &games )
+{
+    const char *results[] = { "1-0", "0-1", "1/2-1/2", "*" };
+    std::string pgn;
+    unsigned int seed = 1;
+    for( int game=0; game<nbr_games; game++ )
+    {
+        thc::ChessRules cr;
+        char buf[200];
+        const char *fen = "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1";
+        sprintf( buf, "[Event \"Test %d\"]\n[White \"Player, \\\"A\\\"\"]\n[Black \"Player B\"]\n", game );
+        pgn += buf;
+        if( game%5 == 4 )
+        {
+            cr.Forsyth( fen );
+            pgn += "[SetUp \"1\"]\n[FEN \"";
+            pgn += fen;
+            pgn += "\"]\n";
+        }
+        seed = seed*1103515245 + 12345;
+        const char *result = results[ (seed>>16)%4 ];
+        pgn += "[Result \"";
+        pgn += result;
+        pgn += "\"]\n\n";
+        games.push_back( std::vector<thc::Move>() );
+        for( int ply=0; ply<160; ply++ )
+        {
+            std::vector<thc::Move> moves;
+            cr.GenLegalMoveList( moves );
+            if( moves.empty() )
+                break;
+            seed = seed*1103515245 + 12345;
+            thc::Move mv = moves[ (seed>>16) % moves.size() ];
+            if( cr.white )
+                sprintf( buf, "%d. ", cr.full_move_count );
+            else
+                sprintf( buf, ply==0 ? "%d... " : "", cr.full_move_count );
+            pgn += buf;
+            pgn += mv.NaturalOut( &cr );
+            switch( (seed>>8) % 16 )
+            {
+                case 0: pgn += " {A comment, with (brackets) and [Tag \"like\"] stuff}"; break;
+                case 1: pgn += " $1";                                                  break;
+                case 2: pgn += "!?";                                                   break;
+                case 3: pgn += " (" + moves[0].NaturalOut(&cr) + " {sub} (" +
+                               moves[moves.size()-1].NaturalOut(&cr) + ") 2. xx 1-0)"; break;
+                case 4: pgn += " ; to the end of the line";                            break;
+            }
+            pgn += ((seed>>12)%8==0 || (seed>>8)%16==4) ? "\n" : " ";
+            games.back().push_back( mv );
+            cr.PlayMove( mv );
+        }
+        if( game%7 != 6 )   // sometimes the result is missing
+            pgn += result;
+        pgn += "\n\n";
+    }
+    return pgn;
+}
+
+// Moves that aren't strict SAN are errors, unless the reader is lenient,
+//  and a move that's ambiguous (here "Nd2", with knights on b1 and f3) is
+//  an error either way, never a guess
+//  return bool okay
+static bool check_ambiguous()
+{
+    const char *pgn =
+        "[Event \"Ambiguous\"]\n\n1. Nf3 d5 2. d3 e5 3. Nd2 Nc6 *\n\n"
+        "[Event \"Not SAN\"]\n\n1. Nf3 d5 2. d3 e5 3. b1d2 Nc6 *\n\n";
+    bool ok = true;
+    for( int lenient=0; lenient<2; lenient++ )
+    {
+        thc::PgnReader reader;
+        reader.SetLenient( lenient!=0 );
+        reader.Attach( pgn, strlen(pgn) );
+        CountingVisitor visitor(true);
+        reader.Read( visitor );
+
+        // The ambiguous game stops before "Nd2", the other one does too
+        //  unless lenient, when "b1d2" is Nbd2
+        bool same = visitor.nbr_games==2 && visitor.games[0].size()==4 &&
+                    visitor.nbr_errors==(lenient ? 1 : 2);
+        if( same && lenient )
+        {
+            same = visitor.games[1].size()==6 &&
+                   visitor.games[1][4].src==thc::b1 && visitor.games[1][4].dst==thc::d2;
+        }
+        else if( same )
+            same = visitor.games[1].size()==4;
+        printf( "Ambiguous and non SAN moves (%s): %lld errors, %s\n", lenient ? "lenient" : "strict",
+                    visitor.nbr_errors, same ? "okay" : "MISMATCH" );
+        ok = ok && same;
+    }
+    return ok;
+}
+
+int main( int argc, char *argv[] )
+{
+    int nbr_threads = 0;
+    bool lenient = false;
+    const char *pgn_file = NULL;
+    for( int i=1; i<argc; i++ )
+    {
+        if( 0==strcmp(argv[i],"-threads") && i+1<argc )
+            nbr_threads = atoi(argv[++i]);
+        else if( 0==strcmp(argv[i],"-lenient") )
+            lenient = true;
+        else
+            pgn_file = argv[i];
+    }
+    if( pgn_file )
+    {
+        thc::MappedFile file;
+        if( !file.Open(pgn_file,true) )
+        {
+            printf( "Cannot open %s\n", pgn_file );
+            return 1;
+        }
+        long long nbr_games, nbr_moves, nbr_errors;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        if( nbr_threads > 0 )
+        {
+            std::vector<PipelineWorker> workers( nbr_threads, PipelineWorker(false) );
+            std::vector<thc::PgnWorker *> worker_ptrs;
+            for( int i=0; i<nbr_threads; i++ )
+                worker_ptrs.push_back( &workers[i] );
+            PipelineReducer reducer;
+            thc::PgnPipeline pipeline;
+            pipeline.SetOrdered( false );
+            pipeline.SetLenient( lenient );
+            nbr_games  = pipeline.Run( file.Data(), file.Size(), &worker_ptrs[0], nbr_threads, reducer );
+            nbr_moves  = reducer.nbr_moves;
+            nbr_errors = reducer.nbr_errors;
+        }
+        else
+        {
+            thc::PgnReader reader;
+            reader.SetLenient( lenient );
+            reader.Attach( file.Data(), file.Size() );
+            CountingVisitor visitor(false);
+            reader.Read( visitor );
+            nbr_games  = visitor.nbr_games;
+            nbr_moves  = visitor.nbr_moves;
+            nbr_errors = visitor.nbr_errors;
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        double secs = elapsed.count();
+        printf( "%lld games, %lld moves, %lld games with errors\n", nbr_games, nbr_moves, nbr_errors );
+        printf( "%.2fs, %.1f MB/s, %.2f million moves/s\n", secs, file.Size()/1e6/secs, nbr_moves/1e6/secs );
+        return 0;
+    }
+
+    // Self test, read the games back from memory and from a file
+    std::vector< std::vector<thc::Move> > games;
+    std::string pgn = make_pgn( 500, games );
+    const char *filename = "thc_pgn_bench.tmp.pgn";
+    FILE *f = fopen( filename, "wb" );
+    if( !f || fwrite(pgn.data(),1,pgn.size(),f)!=pgn.size() )
+    {
+        printf( "Cannot write %s\n", filename );
+        return 1;
+    }
+    fclose( f );
+    bool ok = true;
+    for( int from_file=0; from_file<2; from_file++ )
+    {
+        thc::PgnReader reader;
+        if( from_file )
+            ok = reader.Open(filename) && ok;
+        else
+            reader.Attach( pgn.data(), pgn.size() );
+        CountingVisitor visitor(true);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        reader.Read( visitor );
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        bool same = (visitor.games == games) && visitor.nbr_errors==0;
+        printf( "%s: %lld games, %lld moves, %lld errors, %.2f million moves/s, %s\n",
+                    from_file ? "File" : "Memory", visitor.nbr_games, visitor.nbr_moves,
+                    visitor.nbr_errors, visitor.nbr_moves/1e6/elapsed.count(), same ? "all moves match" : "MISMATCH" );
+        ok = ok && same;
+    }
+
+    // Pipeline, small chunks so there are plenty of them, ordered results
+    //  must match exactly, unordered results in some order
+    for( int ordered=1; ordered>=0; ordered-- )
+    {
+        const int nbr_workers = 3;
+        PipelineWorker worker0(true), worker1(true), worker2(true);
+        thc::PgnWorker *workers[nbr_workers] = { &worker0, &worker1, &worker2 };
+        PipelineReducer reducer;
+        thc::PgnPipeline pipeline;
+        pipeline.SetChunkSize( 4096 );
+        pipeline.SetQueueSize( 2 );
+        pipeline.SetOrdered( ordered!=0 );
+        long long nbr_games = pipeline.Run( pgn.data(), pgn.size(), workers, nbr_workers, reducer );
+        bool same;
+        if( ordered )
+            same = (reducer.games == games) && reducer.in_order;
+        else
+        {
+            std::vector< std::vector<thc::Move> > sorted1=games, sorted2=reducer.games;
+            std::sort( sorted1.begin(), sorted1.end(), move_list_less );
+            std::sort( sorted2.begin(), sorted2.end(), move_list_less );
+            same = (sorted1 == sorted2);
+        }
+        same = same && reducer.nbr_errors==0 && nbr_games==(long long)games.size();
+        printf( "Pipeline (%s): %lld games, %lld moves, %lld errors, %s\n", ordered ? "ordered" : "unordered",
+                    nbr_games, reducer.nbr_moves, reducer.nbr_errors, same ? "all moves match" : "MISMATCH" );
+        ok = ok && same;
+    }
+
+    ok = check_ambiguous() && ok;
+
+    // Tags
+    thc::PgnReader reader;
+    reader.Attach( pgn.data(), pgn.size() );
+    thc::PgnGame game;
+    thc::PgnSpan value;
+    if( !reader.NextGame(game) || !game.Tag("White",value) || !value.Equals("Player, \\\"A\\\"") ||
+        !game.Tag("Event",value) || !value.Equals("Test 0") || game.Tag("Whit",value) )
+    {
+        printf( "Tags MISMATCH\n" );
+        ok = false;
+    }
+    remove( filename );
+    printf( "%s\n", ok ? "PGN reader ok" : "FAILED" );
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,314 @@
+/*
+
+    Position index test and benchmark for the THC Chess library
+
+    With a PGN file, reads all the games, builds a PositionIndex of every
+    position in them (out, default position-bench.tmp, which is deleted
+    afterwards unless given), checks every position of every game can be
+    found, and reports the speed of building the index and of lookups.
+    With no file, first checks ExternalSort against std::stable_sort, with
+    everything in memory and with many runs on disk, then does the same as
+    above with some pseudo random games, and checks an index built from a
+    GameArchive is the same. Then checks PositionDedup against std::sort()
+    and ChessPosition::operator==(). Compile and link with thc.cpp.
+
+    Usage:
+        thc_position_bench [file.pgn [out]]
+
+    Exit status is non-zero if the self test fails.
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include "thc.h"
+#include "bench-util.h"
+
+// Sort records two ways, and compare
+//  return bool okay
+static bool check_sort( size_t nbr, size_t memory, int nbr_threads, int max_merge=128 )
+{
+    // Three words, two of key, only a few different values in the first so
+    //  there are plenty of ties, the third is the order added
+    std::vector<uint64_t> records;
+    unsigned int seed = 1;
+    for( size_t i=0; i<nbr; i++ )
+    {
+        seed = seed*1103515245 + 12345;
+        uint64_t a = (seed>>16) % 5;
+        seed = seed*1103515245 + 12345;
+        uint64_t b = ((uint64_t)seed<<32) | ((seed>>16)%1000);
+        records.push_back( a<<60 );
+        records.push_back( b );
+        records.push_back( i );
+    }
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    thc::ExternalSort sorter;
+    sorter.SetMemory( memory );
+    sorter.SetThreads( nbr_threads );
+    sorter.SetMaxMerge( max_merge );
+    bool okay = sorter.Begin( 3, 2, "position-bench.sort" );
+    for( size_t i=0; okay && i<nbr; i++ )
+        okay = sorter.Add( &records[3*i] );
+    okay = okay && sorter.Sort();
+    std::vector<uint64_t> sorted;
+    const uint64_t *record;
+    while( sorter.Next(record) )
+        sorted.insert( sorted.end(), record, record+3 );
+    std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+    sorter.End();
+
+    // The slow way, sorting the order added
+    std::vector<size_t> order( nbr );
+    for( size_t i=0; i<nbr; i++ )
+        order[i] = i;
+    struct Less
+    {
+        const std::vector<uint64_t> *records;
+        bool operator()( size_t a, size_t b ) const
+        {
+            const uint64_t *ra = &(*records)[3*a], *rb = &(*records)[3*b];
+            return ra[0]<rb[0] || (ra[0]==rb[0] && ra[1]<rb[1]);
+        }
+    } less;
+    less.records = &records;
+    std::stable_sort( order.begin(), order.end(), less );
+    okay = okay && sorted.size()==records.size();
+    for( size_t i=0; okay && i<nbr; i++ )
+        okay = sorted[3*i+2] == order[i];
+    printf( "ExternalSort: %lu records, %lu bytes memory, %d threads, merge %d, %.3f s, %s\n",
+                (unsigned long)nbr, (unsigned long)memory, nbr_threads, max_merge, secs.count(),
+                okay ? "sorted correctly" : "NOT SORTED" );
+    return okay;
+}
+
+// Dedup positions two ways, and compare
+//  return bool okay
+static bool check_dedup( const std::vector<thc::ChessPosition> &positions, size_t memory, int nbr_threads, int max_merge=128 )
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    thc::PositionDedup dedup;
+    dedup.SetMemory( memory );
+    dedup.SetThreads( nbr_threads );
+    dedup.SetMaxMerge( max_merge );
+    bool okay = dedup.Begin( "position-bench.dedup" );
+    for( size_t i=0; okay && i<positions.size(); i++ )
+        okay = dedup.Add( positions[i] );
+    okay = okay && dedup.Sort();
+    std::vector<uint64_t> counts;
+    std::vector<thc::CompressedPosition> distinct;
+    thc::CompressedPosition compressed;
+    uint64_t count;
+    while( dedup.Next(compressed,count) )
+    {
+        distinct.push_back( compressed );
+        counts.push_back( count );
+    }
+    okay = okay && !dedup.Error();
+    std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+    dedup.End();
+
+    // Strictly ascending, and a position survives the trip
+    for( size_t i=0; i<distinct.size(); i++ )
+    {
+        if( i>0 && memcmp(distinct[i-1].storage,distinct[i].storage,24) >= 0 )
+            okay = false;
+        thc::ChessPosition cp;
+        cp.Decompress( distinct[i] );
+        thc::CompressedPosition again;
+        cp.Compress( again );
+        if( memcmp(again.storage,distinct[i].storage,24) != 0 )
+            okay = false;
+    }
+
+    // The slow way
+    start = std::chrono::steady_clock::now();
+    std::vector<thc::ChessPosition> sorted = positions;
+    std::sort( sorted.begin(), sorted.end() );
+    std::vector<uint64_t> expected;
+    for( size_t i=0; i<sorted.size(); i++ )
+    {
+        if( i>0 && sorted[i]==sorted[i-1] )
+            expected.back()++;
+        else
+            expected.push_back( 1 );
+    }
+    std::chrono::duration<double> slow_secs = std::chrono::steady_clock::now() - start;
+    std::sort( counts.begin(), counts.end() );
+    std::sort( expected.begin(), expected.end() );
+    okay = okay && counts==expected;
+    printf( "PositionDedup: %lu positions, %lu distinct, %lu bytes memory, merge %d, %.3f s (std::sort %.3f s), %s\n",
+                (unsigned long)positions.size(), (unsigned long)distinct.size(), (unsigned long)memory,
+                max_merge, secs.count(), slow_secs.count(), okay ? "counts match" : "COUNTS DON'T MATCH" );
+    return okay;
+}
+
+// Positions that differ only in castling or en passant that can't happen
+//  are the same to PositionDedup, and positions with more than 32 men
+//  can't be added
+//  return bool okay
+static bool check_dedup_key()
+{
+    thc::ChessPosition a, b;
+    a.Forsyth( "4k3/8/8/3pP3/8/8/8/R3K3 w Qkq d6 0 1" );
+    b.Forsyth( "4k3/8/8/3pP3/8/8/8/R3K3 w Q d6 0 1" );
+    uint64_t key_a[3], key_b[3];
+    bool okay = thc::PositionDedup::Key(a,key_a) && thc::PositionDedup::Key(b,key_b) &&
+                memcmp(key_a,key_b,sizeof(key_a))==0 && a==b;
+    b.Forsyth( "4k3/8/8/3pP3/8/8/8/R3K3 w Q - 0 1" );
+    okay = okay && thc::PositionDedup::Key(b,key_b) && memcmp(key_a,key_b,sizeof(key_a))!=0 && !(a==b);
+    thc::PositionDedup dedup;
+    dedup.Begin( "position-bench.dedup" );
+    for( int i=8; i<56; i++ )
+        b.squares[i] = (i<32 ? 'P' : 'p');
+    okay = okay && !dedup.Add(b);
+    printf( "PositionDedup keys: castling and en passant %s\n", okay ? "groomed" : "NOT GROOMED" );
+    return okay;
+}
+
+// Build an index, look up every position and report
+//  return bool okay
+static bool run( const char *name, const std::vector<Game> &games, const char *filename, size_t memory )
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    thc::PositionIndexBuilder builder;
+    builder.SetMemory( memory );
+    bool okay = builder.Open( filename );
+    for( size_t i=0; i<games.size(); i++ )
+        builder.AddGame( (long long)i, games[i].start, games[i].moves );
+    long long nbr_positions = builder.NbrPositions();
+    okay = builder.Close() && okay;
+    std::chrono::duration<double> build_secs = std::chrono::steady_clock::now() - start;
+    thc::PositionIndex index;
+    if( !okay || !index.Open(filename) || index.NbrPositions()!=nbr_positions )
+    {
+        printf( "%s: cannot build or open index %s\n", name, filename );
+        return false;
+    }
+
+    // Every position of every game must be found
+    long long nbr_lookups = 0;
+    start = std::chrono::steady_clock::now();
+    for( size_t i=0; i<games.size(); i++ )
+    {
+        thc::ChessRules cr;
+        cr = games[i].start;
+        for( size_t ply=0; ply<=games[i].moves.size(); ply++ )
+        {
+            if( ply > 0 )
+                cr.PlayMove( games[i].moves[ply-1] );
+            const thc::PositionIndexEntry *first;
+            size_t nbr = index.Find( cr, first );
+            nbr_lookups++;
+            bool found = false;
+            for( size_t j=0; j<nbr; j++ )
+            {
+                if( first[j].key!=cr.key || (j>0 && first[j].game_ply<=first[j-1].game_ply) )
+                    okay = false;
+                if( first[j].Game()==(long long)i && first[j].Ply()==(int)ply )
+                    found = true;
+            }
+            if( !found )
+                okay = false;
+        }
+    }
+    std::chrono::duration<double> lookup_secs = std::chrono::steady_clock::now() - start;
+
+    // Not to mention the ones that aren't there
+    thc::ChessRules cr;
+    cr.Forsyth( "8/8/8/4k3/8/8/8/4K2R w K - 0 1" );
+    std::vector<long long> found;
+    if( index.FindGames(cr,found) != 0 )
+        okay = false;
+    index.FindGames( thc::ChessPosition(), found );
+    printf( "%s: %lu games, %lld positions, built in %.2f s (%.2f million positions/s)\n", name,
+                (unsigned long)games.size(), nbr_positions, build_secs.count(),
+                nbr_positions/1e6/build_secs.count() );
+    printf( "  %lld lookups, %.2f us each, starting position in %lu games, %s\n", nbr_lookups,
+                nbr_lookups ? lookup_secs.count()*1e6/nbr_lookups : 0.0,
+                (unsigned long)found.size(), okay ? "all positions found" : "MISSING POSITIONS" );
+    return okay;
+}
+
+// Read a whole file
+static bool read_file( const char *filename, std::string &contents )
+{
+    thc::MappedFile file;
+    if( !file.Open(filename) )
+        return false;
+    contents.assign( file.Data(), file.Size() );
+    return true;
+}
+
+int main( int argc, char *argv[] )
+{
+    if( argc > 1 )
+    {
+        std::vector<Game> games;
+        if( !read_games(argv[1],games) )
+            return 1;
+        const char *filename = argc>2 ? argv[2] : "position-bench.tmp";
+        bool ok = run( argv[1], games, filename, 256*1024*1024 );
+        if( argc <= 2 )
+            remove( filename );
+        return ok ? 0 : 1;
+    }
+
+    // Self test, the sort first
+    bool ok = check_sort( 200000, 64*1024*1024, 1 );
+    ok = check_sort( 200000, 1024*1024, 4 ) && ok;
+    ok = check_sort( 50, 1024*1024, 4 ) && ok;
+    ok = check_sort( 500000, 256*1024, 4, 3 ) && ok;   // 92 runs, merged 3 at a time
+
+    // Then an index, with the sort in memory and with runs on disk
+    const char *filename = "position-bench.tmp";
+    std::vector<Game> games;
+    make_games( 300, games, 150, 4, 2 );    // random games rarely meet, so a few common openings
+    ok = run( "Random games", games, filename, 64*1024*1024 ) && ok;
+    ok = run( "Random games", games, filename, 64*1024 ) && ok;
+    std::string expected;
+    read_file( filename, expected );
+
+    // Building from an archive of the same games gives the same index
+    const char *archive_filename = "position-bench.arc";
+    thc::GameArchiveWriter writer;
+    bool archive_ok = writer.Open( archive_filename );
+    for( size_t i=0; i<games.size(); i++ )
+        archive_ok = writer.AddGame( games[i].tags, games[i].start, games[i].moves ) && archive_ok;
+    archive_ok = writer.Close() && archive_ok;
+    thc::GameArchive archive;
+    archive_ok = archive_ok && archive.Open( archive_filename );
+    thc::PositionIndexBuilder builder;
+    builder.SetMemory( 64*1024 );
+    archive_ok = archive_ok && builder.Open(filename) && builder.AddGames(archive);
+    archive_ok = builder.Close() && archive_ok;
+    std::string contents;
+    archive_ok = archive_ok && read_file(filename,contents) && contents==expected;
+    archive.Close();
+    remove( archive_filename );
+    printf( "Index from archive %s\n", archive_ok ? "matches" : "DOES NOT MATCH" );
+    ok = ok && archive_ok;
+
+    // An empty index
+    std::vector<Game> empty;
+    ok = run( "No games", empty, filename, 64*1024 ) && ok;
+    remove( filename );
+
+    // Dedup positions, with plenty of duplicates, in memory and with runs
+    //  on disk merged in passes
+    std::vector<Game> dedup_games;
+    make_games( 400, dedup_games, 120, 6, 3 );
+    std::vector<thc::ChessPosition> positions;
+    make_positions( dedup_games, positions );
+    ok = check_dedup( positions, 64*1024*1024, 1 ) && ok;
+    ok = check_dedup( positions, 256*1024, 4 ) && ok;
+    ok = check_dedup( positions, 64*1024, 4, 4 ) && ok;
+    ok = check_dedup_key() && ok;
+    printf( "%s\n", ok ? "Position index ok" : "FAILED" );
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,159 @@
+/*
+
+    Position dump, sort and dedup tool for the THC Chess library
+
+    Reads PGN files and writes every distinct position in them (the
+    position before each move, and the final position), with the number of
+    times it occurred, sorted with PositionDedup, so any number of games
+    can be done in limited memory. Text output is a line per position, the
+    count then the FEN (clocks are always 0 1, they don't count), binary
+    output is 32 byte records, the 24 byte CompressedPosition then the count
+    (8 bytes, little endian). PositionDedup is tested by thc_position_bench.
+    Compile and link with thc.cpp.
+
+    Usage:
+        thc_position_dedup [-threads n] [-memory megabytes] [-binary] out file.pgn...
+
+    Exit status is non-zero if anything fails.
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <chrono>
+#include "thc.h"
+
+// Adds every position in the games to a PositionDedup
+class PositionDumper : public thc::PgnVisitor
+{
+public:
+    thc::PositionDedup &dedup;
+    bool                okay;
+    long long           nbr_games;
+    long long           nbr_errors;
+    PositionDumper( thc::PositionDedup &dedup_ ) : dedup(dedup_), okay(true), nbr_games(0), nbr_errors(0) {}
+    bool GameMove( const thc::PgnGame &, int, const thc::ChessRules &cr, thc::Move )
+    {
+        okay = dedup.Add( cr ) && okay;
+        return true;
+    }
+    void GameEnd( const thc::PgnGame &, const thc::ChessRules &cr, bool error )
+    {
+        okay = dedup.Add( cr ) && okay;
+        nbr_games++;
+        if( error )
+            nbr_errors++;
+    }
+};
+
+// Write the sorted positions
+//  return number of distinct positions, -1 on error
+static long long write_positions( thc::PositionDedup &dedup, FILE *out, bool binary )
+{
+    long long nbr = 0;
+    thc::CompressedPosition compressed;
+    uint64_t count;
+    while( dedup.Next(compressed,count) )
+    {
+        if( binary )
+        {
+            unsigned char buf[32];
+            memcpy( buf, compressed.storage, 24 );
+            for( int i=0; i<8; i++ )
+                buf[24+i] = (unsigned char)(count >> (8*i));
+            if( fwrite(buf,1,sizeof(buf),out) != sizeof(buf) )
+                return -1;
+        }
+        else
+        {
+            thc::ChessPosition cp;
+            cp.Decompress( compressed );
+            char fen[FORSYTH_SIZE];
+            cp.ForsythPublish( fen );
+            if( fprintf(out,"%llu %s\n",(unsigned long long)count,fen) < 0 )
+                return -1;
+        }
+        nbr++;
+    }
+    return dedup.Error() ? -1 : nbr;
+}
+
+int main( int argc, char *argv[] )
+{
+    // Options
+    int nbr_threads = 0;
+    size_t memory = 0;
+    bool binary = false;
+    int arg = 1;
+    for( ; arg<argc && argv[arg][0]=='-'; arg++ )
+    {
+        if( 0==strcmp(argv[arg],"-threads") && arg+1<argc )
+            nbr_threads = atoi( argv[++arg] );
+        else if( 0==strcmp(argv[arg],"-memory") && arg+1<argc )
+            memory = (size_t)atoi(argv[++arg]) * 1024 * 1024;
+        else if( 0==strcmp(argv[arg],"-binary") )
+            binary = true;
+        else
+            break;
+    }
+    if( arg+2 > argc )
+    {
+        printf( "Usage: thc_position_dedup [-threads n] [-memory megabytes] [-binary] out file.pgn...\n" );
+        return 1;
+    }
+    const char *out_filename = argv[arg++];
+    std::string temp_filename = std::string(out_filename) + ".tmp";
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    thc::PositionDedup dedup;
+    if( nbr_threads > 0 )
+        dedup.SetThreads( nbr_threads );
+    if( memory > 0 )
+        dedup.SetMemory( memory );
+    if( !dedup.Begin(temp_filename.c_str()) )
+    {
+        printf( "Cannot start sorting\n" );
+        return 1;
+    }
+
+    // Dump the positions
+    PositionDumper dumper( dedup );
+    for( ; arg<argc; arg++ )
+    {
+        thc::PgnReader reader;
+        if( !reader.Open(argv[arg]) )
+        {
+            printf( "Cannot open %s\n", argv[arg] );
+            return 1;
+        }
+        reader.Read( dumper );
+    }
+    if( dumper.nbr_errors )
+        printf( "%lld games with errors (moves up to the error are used)\n", dumper.nbr_errors );
+    std::chrono::duration<double> dump_secs = std::chrono::steady_clock::now() - start;
+
+    // Sort and write them
+    start = std::chrono::steady_clock::now();
+    FILE *out = fopen( out_filename, binary ? "wb" : "w" );
+    if( !out )
+    {
+        printf( "Cannot create %s\n", out_filename );
+        return 1;
+    }
+    long long nbr_distinct = -1;
+    if( dumper.okay && dedup.Sort() )
+        nbr_distinct = write_positions( dedup, out, binary );
+    if( fclose(out) != 0 )
+        nbr_distinct = -1;
+    dedup.End();
+    std::chrono::duration<double> sort_secs = std::chrono::steady_clock::now() - start;
+    if( nbr_distinct < 0 )
+    {
+        printf( "Failed, out of disk space perhaps\n" );
+        return 1;
+    }
+    printf( "%lld games, %lld positions, %lld distinct, dumped in %.2f s, sorted and written in %.2f s\n",
+                dumper.nbr_games, dedup.NbrPositions(), nbr_distinct, dump_secs.count(), sort_secs.count() );
+    return 0;
+}
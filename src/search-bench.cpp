@@ -0,0 +1,203 @@
+/*
+
+    Search test and benchmark for the THC Chess library
+
+    Searches a standard set of positions (the first six Bratko-Kopec
+    positions and the six perft positions) to a fixed depth. With -threads n
+    measures time to depth for 1, 2, 4 ... n threads (Lazy SMP); the hash
+    table is cleared before each position. With no arguments, a self test
+    that single and multithreaded searches reach the depth asked for, with
+    legal principal variations, and find a mate. Compile and link with
+    thc.cpp.
+
+    Usage:
+        thc_search_bench [-threads n] [-depth d] [-hash mb]
+
+    Time to depth is reported two ways. Elapsed time is what counts, but
+    only shows a speed up if there's a core for each thread. The main
+    thread's nodes are the work it did to reach the depth; the helpers'
+    work (done at the same time, on other cores) is what makes it smaller.
+    The ratio of main thread nodes is the speed up to expect from n cores,
+    even on a machine with fewer.
+
+    Exit status is non-zero if the self test fails.
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include "thc.h"
+
+// Bratko-Kopec 1-6 then the perft positions
+static const char *positions[] =
+{
+    "1k1r4/pp1b1R2/3q2pp/4p3/2B5/4Q3/PPP2B2/2K5 b - - 0 1",
+    "3r1k2/4npp1/1ppr3p/p6P/P2PPPP1/1NR5/5K2/2R5 w - - 0 1",
+    "2q1rr1k/3bbnnp/p2p1pp1/2pPp3/PpP1P1P1/1P2BNNP/2BQ1PRK/7R b - - 0 1",
+    "rnbqkb1r/p3pppp/1p6/2ppP3/3N4/2P5/PPP1QPPP/R1B1KB1R w KQkq - 0 1",
+    "r1b2rk1/2q1b1pp/p2ppn2/1p6/3QP3/1BN1B3/PPP3PP/R4RK1 w - - 0 1",
+    "2r3k1/pppR1pp1/4p3/4P1P1/5P2/1P4K1/P1P5/8 w - - 0 1",
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+    "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+    "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10"
+};
+static const int nbr_positions = (int)(sizeof(positions)/sizeof(positions[0]));
+
+// Search every position to depth with nbr_threads threads
+//  return bool okay (every search reached depth with a legal pv)
+static bool search_positions( thc::Search &search, int nbr_threads, int depth,
+                              double &secs, long long &nodes, long long &main_nodes, bool verbose )
+{
+    bool okay = true;
+    search.SetThreads( nbr_threads );
+    secs = 0.0;
+    nodes = 0;
+    main_nodes = 0;
+    for( int i=0; i<nbr_positions; i++ )
+    {
+        thc::ChessRules cr;
+        if( !cr.Forsyth(positions[i]) )
+        {
+            printf( "Bad FEN: %s\n", positions[i] );
+            return false;
+        }
+        search.Clear();
+        thc::SearchLimits limits;
+        limits.depth = depth;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        thc::SearchResult result = search.Go( cr, limits );
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        secs       += elapsed.count();
+        nodes      += result.nodes;
+        main_nodes += result.main_nodes;
+
+        // Mates end the iterations early
+        bool reached = result.depth==depth || (result.mate!=0 && result.depth>2*abs(result.mate));
+        bool legal   = result.pv.size()>0 && result.pv[0]==result.best_move;
+        thc::ChessRules cr_pv = cr;
+        for( unsigned int j=0; legal && j<result.pv.size(); j++ )
+        {
+            thc::Move mv = result.pv[j];
+            thc::MOVELIST list;
+            cr_pv.GenLegalMoveList( &list );
+            legal = false;
+            for( int k=0; !legal && k<list.count; k++ )
+                legal = (list.moves[k] == mv);
+            cr_pv.PlayMove( mv );
+        }
+        if( !reached || !legal )
+        {
+            printf( "%d threads, %s: depth %d, pv %s\n", nbr_threads, positions[i], result.depth,
+                    legal ? "legal" : "illegal" );
+            okay = false;
+        }
+        if( verbose )
+        {
+            thc::Move mv = result.best_move;
+            std::string best = mv.NaturalOut( &cr );
+            if( result.mate != 0 )
+                printf( "  %-8s mate %-4d", best.c_str(), result.mate );
+            else
+                printf( "  %-8s %-9d", best.c_str(), result.score_cp );
+            printf( "%10lld nodes %10lld main thread nodes %s\n", result.nodes, result.main_nodes, positions[i] );
+        }
+    }
+    return okay;
+}
+
+// Self test
+//  return bool okay
+static bool self_test()
+{
+    bool okay = true;
+    thc::Search search( 16 );
+    int thread_counts[] = { 1, 3 };
+    for( int i=0; i<2; i++ )
+    {
+        double secs;
+        long long nodes, main_nodes;
+        if( !search_positions(search,thread_counts[i],5,secs,nodes,main_nodes,false) )
+            okay = false;
+        else
+            printf( "%d threads, depth 5 okay, %lld nodes\n", thread_counts[i], nodes );
+        if( thread_counts[i]==1 && main_nodes!=nodes )
+        {
+            printf( "One thread, but %lld nodes and %lld main thread nodes\n", nodes, main_nodes );
+            okay = false;
+        }
+
+        // Bratko-Kopec 1 is a mate in 3, 1...Qd1+ 2.Kxd1 Bg4+ 3.Kc1 Rd1#
+        thc::ChessRules cr;
+        cr.Forsyth( positions[0] );
+        thc::SearchLimits limits;
+        limits.depth = 8;
+        thc::SearchResult result = search.Go( cr, limits );
+        thc::Move mv = result.best_move;
+        std::string best = mv.NaturalOut( &cr );
+        if( result.mate!=3 || best!="Qd1+" )
+        {
+            printf( "%d threads, expected Qd1+ mate in 3, got %s mate %d\n", thread_counts[i], best.c_str(), result.mate );
+            okay = false;
+        }
+    }
+    return okay;
+}
+
+int main( int argc, char *argv[] )
+{
+    int nbr_threads = 0;
+    int depth = 9;
+    int hash_megabytes = 64;
+    for( int i=1; i<argc; i++ )
+    {
+        if( 0==strcmp(argv[i],"-threads") && i+1<argc )
+            nbr_threads = atoi(argv[++i]);
+        else if( 0==strcmp(argv[i],"-depth") && i+1<argc )
+            depth = atoi(argv[++i]);
+        else if( 0==strcmp(argv[i],"-hash") && i+1<argc )
+            hash_megabytes = atoi(argv[++i]);
+        else
+        {
+            printf( "Usage: thc_search_bench [-threads n] [-depth d] [-hash mb]\n" );
+            return 1;
+        }
+    }
+    if( nbr_threads <= 0 )
+    {
+        bool okay = self_test();
+        printf( "Search self test %s\n", okay ? "passed" : "FAILED" );
+        return okay ? 0 : 1;
+    }
+
+    // Time to depth for 1, 2, 4 ... nbr_threads threads
+    printf( "Depth %d, %d positions, %d MB hash\n", depth, nbr_positions, hash_megabytes );
+    thc::Search search( hash_megabytes );
+    double base_secs = 0.0;
+    long long base_main_nodes = 0;
+    bool okay = true;
+    for( int n=1; ; n = (n*2<nbr_threads ? n*2 : nbr_threads) )
+    {
+        double secs;
+        long long nodes, main_nodes;
+        printf( "%d threads\n", n );
+        if( !search_positions(search,n,depth,secs,nodes,main_nodes,true) )
+            okay = false;
+        if( n == 1 )
+        {
+            base_secs = secs;
+            base_main_nodes = main_nodes;
+        }
+        printf( "%d threads: %.2fs (speed up %.2f), %lld nodes, %lld main thread nodes (speed up %.2f)\n",
+                n, secs, base_secs/secs, nodes, main_nodes, (double)base_main_nodes/main_nodes );
+        if( n >= nbr_threads )
+            break;
+    }
+    return okay ? 0 : 1;
+}
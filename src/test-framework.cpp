@@ -88,14 +88,32 @@ bool regenerate_h_file()
         "        ChessPosition.h",
         "        ChessRules.h",
         "        ChessEvaluation.h",
+        "        MovePicker.h",
+        "        ChessSearch.h",
+        "        MappedFile.h",
+        "        PgnReader.h",
+        "        PgnPipeline.h",
+        "        GameCodec.h",
+        "        GameArchive.h",
+        "        ExternalSort.h",
+        "        PositionIndex.h",
+        "        PositionDedup.h",
         "",
         " */",
         "",
         "#include <stddef.h>",
+        "#include <atomic>",
+        "#include <mutex>",
+        "#include <condition_variable>",
         "#include <stdint.h>",
+        "#include <stdio.h>",
         "#include <string.h>",
         "#include <string>",
-        "#include <vector>"
+        "#include <vector>",
+        "#include <map>",
+        "#if __cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)",
+        "#include <string_view>",
+        "#endif"
     };
 
     const char *hdr_files[]=
@@ -105,7 +123,17 @@ bool regenerate_h_file()
         "../src/ChessPositionRaw.h",
         "../src/ChessPosition.h",
         "../src/ChessRules.h",
-        "../src/ChessEvaluation.h"
+        "../src/ChessEvaluation.h",
+        "../src/MovePicker.h",
+        "../src/ChessSearch.h",
+        "../src/MappedFile.h",
+        "../src/PgnReader.h",
+        "../src/PgnPipeline.h",
+        "../src/GameCodec.h",
+        "../src/GameArchive.h",
+        "../src/ExternalSort.h",
+        "../src/PositionIndex.h",
+        "../src/PositionDedup.h"
     };
 
     std::ofstream out("../src/thc-regen.h");
@@ -170,6 +198,16 @@ bool regenerate_cpp_file()
         "        ChessPosition.cpp",
         "        ChessRules.cpp",
         "        ChessEvaluation.cpp",
+        "        MovePicker.cpp",
+        "        ChessSearch.cpp",
+        "        MappedFile.cpp",
+        "        PgnReader.cpp",
+        "        PgnPipeline.cpp",
+        "        GameCodec.cpp",
+        "        GameArchive.cpp",
+        "        ExternalSort.cpp",
+        "        PositionIndex.cpp",
+        "        PositionDedup.cpp",
         "        Move.cpp",
         "        PrivateChessDefs.cpp",
         "         nested inline expansion of -> GeneratedLookupTables.h",
@@ -182,6 +220,29 @@ bool regenerate_cpp_file()
         "#include <ctype.h>",
         "#include <assert.h>",
         "#include <algorithm>",
+        "#include <functional>",
+        "#include <chrono>",
+        "#include <thread>",
+        "#ifdef _MSC_VER",
+        "#include <intrin.h>",
+        "#endif",
+        "#if !defined(THC_NO_PEXT) && (defined(__x86_64__) || defined(_M_X64)) && (defined(__GNUC__) || defined(_MSC_VER))",
+        "#include <immintrin.h>",
+        "#endif",
+        "#ifdef _WIN32",
+        "#ifndef WIN32_LEAN_AND_MEAN",
+        "#define WIN32_LEAN_AND_MEAN",
+        "#endif",
+        "#ifndef NOMINMAX",
+        "#define NOMINMAX",
+        "#endif",
+        "#include <windows.h>",
+        "#else",
+        "#include <sys/mman.h>",
+        "#include <sys/stat.h>",
+        "#include <fcntl.h>",
+        "#include <unistd.h>",
+        "#endif",
         "#include \"thc.h\"",
         "using namespace std;",
         "using namespace thc;"
@@ -195,6 +256,16 @@ bool regenerate_cpp_file()
         "../src/ChessPosition.cpp",
         "../src/ChessRules.cpp",
         "../src/ChessEvaluation.cpp",
+        "../src/MovePicker.cpp",
+        "../src/ChessSearch.cpp",
+        "../src/MappedFile.cpp",
+        "../src/PgnReader.cpp",
+        "../src/PgnPipeline.cpp",
+        "../src/GameCodec.cpp",
+        "../src/GameArchive.cpp",
+        "../src/ExternalSort.cpp",
+        "../src/PositionIndex.cpp",
+        "../src/PositionDedup.cpp",
         "../src/Move.cpp",
         "../src/PrivateChessDefs.cpp"
     };
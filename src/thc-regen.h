@@ -17,14 +17,32 @@
         ChessPosition.h
         ChessRules.h
         ChessEvaluation.h
+        MovePicker.h
+        ChessSearch.h
+        MappedFile.h
+        PgnReader.h
+        PgnPipeline.h
+        GameCodec.h
+        GameArchive.h
+        ExternalSort.h
+        PositionIndex.h
+        PositionDedup.h
 
  */
 
 #include <stddef.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 #include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 #include <string>
 #include <vector>
+#include <map>
+#if __cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+#include <string_view>
+#endif
 /****************************************************************************
  * Chessdefs.h Chess classes - Common definitions
  *  Author:  Bill Forster
@@ -34,6 +52,11 @@
 #ifndef CHESSDEFS_H
 #define CHESSDEFS_H
 
+// The std::string_view overloads of the parsing functions need C++17
+#if __cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+#define THC_HAVE_STRING_VIEW
+#endif
+
 // Simple definition to aid platform portability (only remains of former Portability.h)
 int strcmp_ignore( const char *s, const char *t ); // return 0 if case-insensitive match
 
@@ -129,12 +152,35 @@ enum TERMINAL
     TERMINAL_BSTALEMATE = 2     // Black is stalemated
 };
 
+// A bitboard has one bit for each square, using the Square convention, so
+//  bit 0 is a8 and bit 63 is h1
+typedef uint64_t Bitboard;
+
+// Index into ChessPosition's array of piece bitboards
+enum BITBOARD_PIECE
+{
+    BB_WPAWN=0, BB_WKNIGHT, BB_WBISHOP, BB_WROOK, BB_WQUEEN, BB_WKING,
+    BB_BPAWN,   BB_BKNIGHT, BB_BBISHOP, BB_BROOK, BB_BQUEEN, BB_BKING,
+    BB_NBR      // also used by bb_index[] to indicate an empty square
+};
+
 // Calculate an upper limit to the length of a list of moves
 #define MAXMOVES (27 + 2*13 + 2*14 + 2*8 + 8 + 8*4  +  3*27)
                 //[Q   2*B    2*R    2*N   K   8*P] +  [3*Q]
                 //             ^                         ^
                 //[calculated practical maximum   ] + [margin]
 
+// Buffer size for a move in natural notation, the longest being eg "Nb1xd2+"
+//  or "exd8=Q+", plus the terminating '\0'
+#define NATURAL_MOVE_SIZE 8
+
+// Buffer size for a move in terse notation, eg "e7e8q", plus the '\0'
+#define TERSE_MOVE_SIZE 6
+
+// Buffer size for a position in Forsyth (FEN) notation, enough for the
+//  longest possible (with the biggest possible counts) plus the '\0'
+#define FORSYTH_SIZE 128
+
 // We have developed an algorithm to compress any legal chess position,
 //  including who to move, castling allowed flags and enpassant_target
 //  into 24 bytes
@@ -165,6 +211,7 @@ typedef int32_t DETAIL;
 // TripleHappyChess
 namespace thc
 {
+class ChessPosition;
 class ChessRules;
 
 // Our representation of a chess move
@@ -215,21 +262,99 @@ public:
     //  return bool okay
     bool NaturalIn( ChessRules *cr, const char *natural_in );
 
+    // Read natural string move of given length (needn't be '\0' terminated)
+    //  return bool okay
+    bool NaturalIn( ChessRules *cr, const char *natural_in, size_t len );
+#ifdef THC_HAVE_STRING_VIEW
+    bool NaturalIn( ChessRules *cr, std::string_view natural_in )
+        { return NaturalIn( cr, natural_in.data(), natural_in.size() ); }
+#endif
+
+    // As forgiving as NaturalIn(), but rejects input that matches more
+    //  than one legal move (NaturalIn() takes the first), eg "Nd2" if Nbd2
+    //  and Nfd2 are both legal
+    //  return bool okay
+    bool NaturalInUnique( ChessRules *cr, const char *natural_in, size_t len );
+
     // Read natural string move eg "Nf3"
     //  return bool okay
-    // Fast alternative for known good input
+    // Fast alternative, for strict SAN only (NaturalIn() is more forgiving),
+    //  rejects illegal moves and ambiguous moves, eg "Nd2" if Nbd2 and Nfd2
+    //  are both legal, so it's safe for untrusted input
     bool NaturalInFast( ChessRules *cr, const char *natural_in );
 
+    // Read natural string move of given length (needn't be '\0' terminated)
+    //  return bool okay
+    bool NaturalInFast( ChessRules *cr, const char *natural_in, size_t len );
+#ifdef THC_HAVE_STRING_VIEW
+    bool NaturalInFast( ChessRules *cr, std::string_view natural_in )
+        { return NaturalInFast( cr, natural_in.data(), natural_in.size() ); }
+#endif
+
     // Read terse string move eg "g1f3"
     //  return bool okay
     bool TerseIn( ChessRules *cr, const char *tmove );
 
+    // Read terse string move of given length (needn't be '\0' terminated)
+    //  return bool okay
+    bool TerseIn( ChessRules *cr, const char *tmove, size_t len );
+#ifdef THC_HAVE_STRING_VIEW
+    bool TerseIn( ChessRules *cr, std::string_view tmove )
+        { return TerseIn( cr, tmove.data(), tmove.size() ); }
+#endif
+
     // Convert to natural string
     //  eg "Nf3"
     std::string NaturalOut( ChessRules *cr );
 
+    // Convert to natural string in a buffer (no memory allocation)
+    //  return length
+    int NaturalOut( ChessRules *cr, char natural_out[NATURAL_MOVE_SIZE] );
+
     // Convert to terse string eg "e7e8q"
     std::string TerseOut();
+
+    // Convert to terse string in a buffer (no memory allocation)
+    //  return length
+    int TerseOut( char terse_out[TERSE_MOVE_SIZE] );
+};
+
+// A move in only 16 bits, for game storage, hash tables and the like; a
+//  return of sorts for the FMOVE. Bits 0-5 are src, bits 6-11 dst and bits
+//  12-15 special (all the SPECIAL values fit). The one thing a Move has
+//  that a PackedMove doesn't is capture, so unpacking takes it from the
+//  position the move is played in, no move generation needed. As for Move,
+//  there is no constructor on purpose, and 0 (a8a8) is invalid
+class PackedMove
+{
+public:
+    uint16_t bits;
+
+    bool operator ==(const PackedMove &other) const { return bits == other.bits; }
+    bool operator !=(const PackedMove &other) const { return bits != other.bits; }
+
+    void    Invalid()       { bits = 0; }
+
+    // Could this be a move ? Rejects 0 (and any src==dst), unknown special
+    //  values and special values that don't fit the squares (castling that
+    //  isn't from e1 or e8, promotion not to the last rank and so on).
+    //  It knows nothing of the position, so a valid PackedMove (from a hash
+    //  table say, where entries can be corrupted or collide) isn't
+    //  necessarily legal, callers must check that
+    bool    Valid() const;
+    Square  Src() const     { return (Square)(bits&0x3f); }
+    Square  Dst() const     { return (Square)((bits>>6)&0x3f); }
+    SPECIAL Special() const { return (SPECIAL)(bits>>12); }
+
+    // Pack a Move, everything but capture is kept
+    void Pack( Move mv )
+    {
+        bits = (uint16_t)( (mv.src&0x3f) | ((mv.dst&0x3f)<<6) | ((mv.special&0xf)<<12) );
+    }
+
+    // Unpack to a Move, exactly the Move that was packed if it was a legal
+    //  (or pseudo-legal) move in this position
+    Move Unpack( const ChessPosition &cp ) const;
 };
 
 // List of moves
@@ -354,6 +479,7 @@ public:
         bking_square = e8;
         half_move_clock = 0;
         full_move_count = 1;
+        BitboardsCalculate();
     }
 
     // Copy constructor and Assignment operator. Defining them this way
@@ -465,13 +591,30 @@ public:
     // For debug
     std::string ToDebugStr( const char *label = 0 );
 
+    // For debug, into a buffer (no memory allocation, output is truncated
+    //  if the buffer is too small)
+    //  return length
+    int ToDebugStr( char *buf, size_t buf_size, const char *label = 0 );
+
     // Set up position on board from Forsyth string with extensions
     //  return bool okay
     virtual bool Forsyth( const char *txt );
 
+    // Set up position on board from Forsyth string of given length (needn't
+    //  be '\0' terminated, must be less than FORSYTH_SIZE*2)
+    //  return bool okay
+    bool Forsyth( const char *txt, size_t len );
+#ifdef THC_HAVE_STRING_VIEW
+    bool Forsyth( std::string_view txt ) { return Forsyth( txt.data(), txt.size() ); }
+#endif
+
     // Publish chess position and supplementary info in forsyth notation
     std::string ForsythPublish();
 
+    // Publish in forsyth notation into a buffer (no memory allocation)
+    //  return length
+    int ForsythPublish( char forsyth_out[FORSYTH_SIZE] );
+
     // Compress a ChessPosition into 24 bytes, return 16-bit hash
     unsigned short Compress( CompressedPosition &dst ) const;
 
@@ -493,6 +636,37 @@ public:
     // Who's turn is it anyway
     inline bool WhiteToPlay() const { return white; }
     void Toggle() { white = !white; }
+
+    // Recalculate bitboards and Zobrist keys from squares[] etc. Both are
+    //  kept up to date by ChessRules::PushMove() and ChessRules::PopMove(),
+    //  so this is only needed if you change squares[] (or castling flags,
+    //  en passant target or who's turn it is) directly
+    void BitboardsCalculate();
+
+    // Recalculate Zobrist keys only
+    void KeysCalculate();
+
+    // The part of the Zobrist key representing castling and en passant
+    //  possibilities, only counting the ones that can actually happen
+    uint64_t KeyCastlingEnpassant() const;
+
+    // All pieces of either colour
+    Bitboard bb_occupied() const { return bb_white | bb_black; }
+
+    // A bitboard representation of the position, shadowing squares[]. The
+    //  DETAIL bits must remain the last 32 bits of ChessPositionRaw, so the
+    //  bitboards live here rather than there.
+    Bitboard bb_pieces[BB_NBR];     // eg bb_pieces[BB_WKNIGHT] = all white knights
+    Bitboard bb_white;              // all white pieces
+    Bitboard bb_black;              // all black pieces
+
+    // Zobrist keys, unlike Hash64Calculate() the main key distinguishes side
+    //  to move, castling and en passant possibilities. Positions with the
+    //  same pawns have the same pawn_key, positions with the same number of
+    //  each type of piece have the same material_key
+    uint64_t key;
+    uint64_t pawn_key;
+    uint64_t material_key;
 };
 
 } //namespace thc
@@ -528,6 +702,9 @@ public:
         history[0].src = a8;   // (look backwards through history stops when src==dst)
         history[0].dst = a8;
         detail_idx =0;
+        key_history_len = 0;
+        key_history_more.clear();
+        reversible_plies = 0;
     }
 
     // Copy constructor
@@ -550,6 +727,7 @@ public:
     bool TestInternals( int (*log)(const char *,...) = NULL );
 
     // Initialise from Forsyth string
+    using ChessPosition::Forsyth;
     bool Forsyth( const char *txt )
     {
         bool okay = ChessPosition::Forsyth(txt);
@@ -606,24 +784,63 @@ public:
                                            bool mate[MAXMOVES],
                                            bool stalemate[MAXMOVES] );
 
+    // Convert a list of legal moves in this position (eg from
+    //  GenLegalMoveList()) to natural strings, eg "Nf3", all at once. The
+    //  same as Move::NaturalOut() for each move, but a lot cheaper
+    void NaturalOutAll( const MOVELIST &list, char out[][NATURAL_MOVE_SIZE] );
+
+    // Create a list of captures and promotions only, (including illegally
+    //  "moving into check"), for quiescence searches. Promotions are to
+    //  queen only, underpromotions count as quiet moves here
+    void GenCaptureList( MOVELIST *list );
+
+    // Create a list of the moves GenCaptureList() doesn't generate, ie non
+    //  captures and underpromotions, (including illegally "moving into check")
+    void GenQuietList( MOVELIST *list );
+
+    // Is a move (eg a hash move, or one made up from a user's input) legal
+    //  in this position ? A lot cheaper than generating all the legal moves
+    //  and looking for it. The move must be exactly as GenLegalMoveList()
+    //  would generate it, including special and capture
+    bool IsLegalMove( Move mv );
+
+    // Is a move legal apart from possibly leaving the king in check, ie
+    //  could it have been generated by GenMoveList() in this position ?
+    bool IsPseudoLegal( Move mv );
+
+    // Count the legal moves in this position, without generating them
+    int  CountLegalMoves();
+
+    // Is there at least one legal move ? (stops looking at the first one)
+    bool HasLegalMove();
+
     // Make a move (with the potential to undo)
     void PushMove( Move& m );
 
     // Undo a move
     void PopMove( Move& m );
 
+    // Make a null move, ie pass the move to the other side (for searches)
+    void PushNullMove();
+
+    // Undo a null move
+    void PopNullMove();
+
     // Test fundamental internal assumptions and operations
     void TestInternals();
 
 // Private stuff
 protected:
+    friend class MovePicker;
+    friend class Move;
 
     // Generate a list of all possible moves in a position (including
     //  illegally "moving into check")
     void GenMoveList( MOVELIST *l );
 
-    // Generate moves for pieces that move along multi-move rays (B,R,Q)
-    void LongMoves( MOVELIST *l, Square square, const lte *ptr );
+    // Generate moves for pieces that move along multi-move rays (B,R,Q),
+    //  given the squares the piece attacks
+    void LongMoves( MOVELIST *l, Square square, Bitboard attacks );
 
     // Generate moves for pieces that move along single-move rays (K,N,P)
     void ShortMoves( MOVELIST *l, Square square, const lte *ptr, SPECIAL special  );
@@ -631,6 +848,9 @@ protected:
     // Generate list of king moves
     void KingMoves( MOVELIST *l, Square square );
 
+    // Generate list of castling moves
+    void CastlingMoves( MOVELIST *l, Square square );
+
     // Generate list of white pawn moves
     void WhitePawnMoves( MOVELIST *l, Square square );
 
@@ -640,6 +860,38 @@ protected:
     // Evaluate a position, returns bool okay (not okay means illegal position)
     bool Evaluate( MOVELIST *list, TERMINAL &score_terminal );
 
+    // Find the men pinned against our king, and the squares a man other
+    //  than the king must move to if we are in check
+    void LegalityMasks( Bitboard &pinned, Bitboard &evasions );
+
+    // Is a pseudo-legal move legal ? (given the LegalityMasks())
+    bool PseudoLegalIsLegal( Move mv, Bitboard pinned, Bitboard evasions );
+
+    // Count legal moves, optionally stopping at the first one
+    int  LegalMoveCount( bool stop_at_first );
+
+    // Find whether each of a list of legal moves gives check, mate or
+    //  stalemate
+    void GenCheckInfo( const MOVELIST &list, bool check[], bool mate[], bool stalemate[] );
+
+    // Bitboard of enemy men attacking a square, given the occupied squares
+    //  (so men can be treated as removed, eg the king when it moves)
+    Bitboard AttackersTo( Square square, bool enemy_is_white, Bitboard occupied );
+
+    // Push the current key onto the key history, and pop it
+    void KeyHistoryPush();
+    void KeyHistoryPop();
+
+    // Key history entry i (0 is the oldest)
+    uint64_t KeyHistoryKey( int i ) const
+    {
+        return i<256 ? key_history[i].key : key_history_more[i-256].key;
+    }
+    int KeyHistoryReversiblePlies( int i ) const
+    {
+        return i<256 ? key_history[i].reversible_plies : key_history_more[i-256].reversible_plies;
+    }
+
     //### Data
 
     // Move history is a ring array
@@ -649,6 +901,20 @@ protected:
     // Detail stack is a ring array
     DETAIL detail_stack[256];           // must be 256 ..
     unsigned char detail_idx;           // .. so this loops around naturally
+
+    // Key history is a stack, one entry for each PushMove() not yet undone
+    //  by PopMove(), used for repetition detection. It isn't capped, but
+    //  the first 256 entries are in an array, so ChessRules (and copies of
+    //  it) only allocate memory once there are more
+    struct KEY_HISTORY
+    {
+        uint64_t key;                   // key before the move
+        int      reversible_plies;      // reversible_plies before the move
+    };
+    KEY_HISTORY key_history[256];       // the first 256 entries ..
+    std::vector<KEY_HISTORY> key_history_more;  // .. then the rest, grown as needed and reused
+    int key_history_len;                // number of entries
+    int reversible_plies;               // plies since last pawn move or capture
 };
 
 } //namespace thc
@@ -667,6 +933,29 @@ protected:
 namespace thc
 {
 
+// Lets a search follow ChessEvaluation::Quiesce(), count nodes, stop it
+//  early and collect the principal variation. The defaults do nothing
+class QuiesceVisitor
+{
+public:
+    virtual ~QuiesceVisitor() {}
+
+    // A node is searched at ply
+    //  return bool stop (then Quiesce() gives up, and returns 0)
+    virtual bool Node( int /*ply*/ ) { return false; }
+
+    // Is the search stopping ? (asked after each move is searched)
+    virtual bool Stopping() { return false; }
+
+    // mv raised alpha at ply, the variation after it is the one found at
+    //  ply+1
+    virtual void BestMove( int /*ply*/, Move /*mv*/ ) {}
+
+    // Break ties in move ordering the other way ? (so searches that share
+    //  a hash table don't all do the same thing)
+    virtual bool ReverseTies() { return false; }
+};
+
 class ChessEvaluation: public ChessRules
 {
 public:
@@ -688,15 +977,27 @@ public:
     }
 
 
-    // Use leaf evaluator to generate a sorted move list
-    void GenLegalMoveListSorted( MOVELIST *list );
-    void GenLegalMoveListSorted( std::vector<Move> &moves );
+    // Use leaf evaluator to generate a sorted move list. By default each
+    //  move is scored by the leaf evaluator straight after it's played, so
+    //  a capture of a defended man looks good. With quiesce, captures are
+    //  resolved first (with Quiesce(), the quiescence search Search uses),
+    //  slower but a much better order
+    void GenLegalMoveListSorted( MOVELIST *list, bool quiesce=false );
+    void GenLegalMoveListSorted( std::vector<Move> &moves, bool quiesce=false );
 
     // Evaluate a position, leaf node (useful for playing programs)
     void EvaluateLeaf( int &material, int &positional );
 
+    // Static exchange evaluation, material won by a move (pawn=10) if both
+    //  sides keep capturing on its destination square
+    int SEE( Move move );
+
+    // Fast test that SEE(move) >= threshold
+    bool SEEGreaterEqual( Move move, int threshold );
+
 // internal stuff
 protected:
+    friend class Search;
 
     // Always some planning before calculating a move
     void Planning();
@@ -706,6 +1007,15 @@ protected:
     int EnpriseWhite();   // fast white to move version
     int EnpriseBlack();   // fast black to move version
 
+    // Static exchange helper, capture with least valuable attacker
+    int SeeLeastValuable( Square square, Bitboard side_attackers, Bitboard &occupied, Bitboard &attackers );
+
+    // Quiescence search, for GenLegalMoveListSorted() and Search. Score is
+    //  from the side to move's point of view in EvaluateLeaf() units
+    //  (material*4 + positional), or QUIESCE_MATE less the plies to mate
+    enum { QUIESCE_INFINITY=32000, QUIESCE_MATE=31000, QUIESCE_MAX_PLY=128 };
+    int Quiesce( int alpha, int beta, int ply, QuiesceVisitor *visitor=NULL );
+
 // misc
 private:
     bool white_is_better;
@@ -719,3 +1029,1428 @@ private:
 } //namespace thc
 
 #endif //CHESSEVALUATION_H
+/****************************************************************************
+ * MovePicker.h Chess classes - Staged move generation for searches
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#ifndef MOVEPICKER_H
+#define MOVEPICKER_H
+
+// TripleHappyChess
+namespace thc
+{
+
+// Yields the legal moves of a position one at a time, in the order a search
+//  wants to try them; hash move, winning captures, killers, quiet moves by
+//  history, losing captures. Each stage is only generated when it's reached,
+//  so if the search gets a cutoff early the later stages cost nothing
+class MovePicker
+{
+public:
+    // The hash move and killers are only picked if they are legal here (so
+    //  they can come from a different position). history[src][dst] orders
+    //  the quiet moves (NULL if not available). The position mustn't
+    //  change between calls to Next() (make/unmake pairs are fine)
+    MovePicker( ChessEvaluation &cr, Move hash_move, const Move *killers=NULL,
+                                     int nbr_killers=0, const int (*history)[64]=NULL );
+
+    // Get the next legal move, returns false if there are no more
+    bool Next( Move &mv );
+
+// internal stuff
+private:
+    enum STAGE
+    {
+        STAGE_HASH,
+        STAGE_CAPTURES_INIT,
+        STAGE_WINNING_CAPTURES,
+        STAGE_KILLERS,
+        STAGE_QUIETS_INIT,
+        STAGE_QUIETS,
+        STAGE_LOSING_CAPTURES,
+        STAGE_DONE
+    };
+
+    // Swap the best scoring move in list[from..end) into list[from]
+    void PickBest( int from, int end );
+
+    // Is a generated move legal ?
+    bool Legal( Move mv ) { return cr.PseudoLegalIsLegal( mv, pinned, evasions ); }
+
+    //### Data
+    ChessEvaluation   &cr;
+    int               stage;
+    Move              hash_move;
+    Move              killers[2];
+    int               nbr_killers;
+    const int       (*history)[64];
+    Bitboard          pinned;
+    Bitboard          evasions;
+    MOVELIST          list;             // captures, then quiet moves
+    int               scores[MAXMOVES];
+    int               idx;
+    int               nbr_captures;
+    int               nbr_losing;       // losing captures are moved to the front of list
+};
+
+} //namespace thc
+
+#endif //MOVEPICKER_H
+/****************************************************************************
+ * ChessSearch.h Chess classes - Alpha-beta search built on ChessEvaluation
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#ifndef CHESSSEARCH_H
+#define CHESSSEARCH_H
+
+// TripleHappyChess
+namespace thc
+{
+
+// Limits on a search, zero means no limit (a search always completes at
+//  least depth 1, and never goes deeper than Search::MAX_DEPTH)
+struct SearchLimits
+{
+    int       depth;            // iterations of iterative deepening
+    long long nodes;
+    int       millisecs;
+    SearchLimits() : depth(0), nodes(0), millisecs(0) {}
+};
+
+// The result of a search, the score is from the point of view of the side
+//  to move
+struct SearchResult
+{
+    Move              best_move;        // Invalid() if no legal moves
+    int               score_cp;         // centipawns, if mate==0
+    int               mate;             // +n = side to move mates in n, -n = gets mated in n
+    int               depth;            // last completed iteration
+    std::vector<Move> pv;               // principal variation, starting with best_move
+    long long         nodes;            // total, all threads
+    long long         main_nodes;       // main thread only (its time to depth)
+    int               millisecs;
+};
+
+// Note that ChessEvaluation::Planning() uses some global tables, so only one
+//  Search (with any number of threads) should run at a time
+class Search
+{
+public:
+    enum { MAX_DEPTH=64, MAX_PLY=ChessEvaluation::QUIESCE_MAX_PLY };
+
+    // Constructor, transposition table size in megabytes
+    Search( int hash_megabytes=16 );
+    ~Search();
+
+    // Search a position, game history is respected for repetitions
+    SearchResult Go( const ChessRules &position, const SearchLimits &limits );
+
+    // Stop a search in progress (can be called from another thread)
+    void Stop() { stop = true; }
+
+    // Resize the transposition table (also clears it)
+    void SetHashSize( int megabytes );
+
+    // Number of threads. Extra threads are helpers that search the same
+    //  position at staggered depths, sharing the transposition table
+    //  (so called Lazy SMP), only the main thread's result is reported
+    void SetThreads( int nbr );
+
+    // Forget everything learnt from previous searches
+    void Clear();
+
+// internal stuff
+private:
+
+    // Not copyable
+    Search( const Search& );
+    Search& operator=( const Search& );
+
+    // Transposition table entry, lock-free. Everything, including the top
+    //  16 bits of the key, is in a single 8 byte word, so threads' stores
+    //  can't interleave
+    struct TT_ENTRY
+    {
+        std::atomic<uint64_t> data;     // move, score, depth, bound, generation, key
+    };
+
+    // Entries are grouped so a probe touches a single cache line
+    struct alignas(64) TT_BUCKET
+    {
+        TT_ENTRY entries[8];
+    };
+
+    // Unpacked TT_ENTRY data, bound is one of BOUND_EXACT etc.
+    struct TT_DATA
+    {
+        PackedMove move;
+        int      score;
+        int      depth;
+        int      bound;
+    };
+    enum { BOUND_NONE=0, BOUND_UPPER=1, BOUND_LOWER=2, BOUND_EXACT=3 };
+
+    // Each thread has its own position, move ordering and PV. It follows
+    //  ChessEvaluation::Quiesce() to count nodes, stop and extend the PV
+    struct THREAD_DATA : public QuiesceVisitor
+    {
+        bool Node( int ply );
+        bool Stopping();
+        void BestMove( int ply, Move mv );
+        bool ReverseTies();
+
+        Search         *search;
+        int             id;             // 0 = main thread
+        ChessEvaluation cr;
+        Move            killers[MAX_PLY][2];
+        int             history[2][64][64];
+        Move            pv[MAX_PLY][MAX_PLY];
+        int             pv_len[MAX_PLY];
+        long long       nodes;
+    };
+
+    // Iterative deepening, main thread fills in result
+    void IterativeDeepening( THREAD_DATA *td, SearchResult *result );
+
+    // Principal variation search, score from side to move's point of view
+    int  AlphaBeta( THREAD_DATA &td, int alpha, int beta, int depth, int ply, bool null_ok );
+
+    // Count nodes, checking limits every so often
+    void CountNode( THREAD_DATA &td );
+
+    // Score the side to move's position without searching further
+    int  Evaluate( THREAD_DATA &td );
+
+    // Check time and node limits, set stop if exceeded
+    void CheckLimits();
+
+    // Elapsed time since search started
+    int  Elapsed();
+
+    // Transposition table access
+    bool Probe( uint64_t key, TT_DATA &tt_data );
+    void Store( uint64_t key, Move move, int score, int depth, int bound, int ply );
+
+    //### Data
+    TT_BUCKET                *tt;
+    uint64_t                  tt_mask;
+    unsigned int              tt_generation;
+    std::vector<THREAD_DATA*> threads;
+    SearchLimits              limits;
+    long long                 start_time;
+    bool                      can_stop;
+    std::atomic<long long>    nodes_shared;     // updated every 1024 nodes
+    std::atomic<bool>         stop;
+};
+
+} //namespace thc
+
+#endif //CHESSSEARCH_H
+/****************************************************************************
+ * MappedFile.h Chess classes - Read only memory mapped files
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+// TripleHappyChess
+namespace thc
+{
+
+// A whole file mapped read only into memory, so big files (PGN databases
+//  and the like) can be read without copying them
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+
+    // Map a file, sequential is a hint that it will be read start to end.
+    //  return bool okay
+    bool Open( const char *filename, bool sequential=false );
+
+    // Unmap the file (Open() and the destructor do this too)
+    void Close();
+
+    // The file's contents, (an empty file gives a valid pointer and size 0)
+    const char *Data() const { return data; }
+    size_t      Size() const { return size; }
+    bool        IsOpen() const { return is_open; }
+
+// internal stuff
+private:
+
+    // Not copyable
+    MappedFile( const MappedFile& );
+    MappedFile& operator=( const MappedFile& );
+
+    //### Data
+    const char *data;
+    size_t      size;
+    bool        is_open;
+    void       *file_handle;        // Windows only
+    void       *mapping_handle;     // Windows only
+};
+
+} //namespace thc
+
+#endif //MAPPEDFILE_H
+/****************************************************************************
+ * PgnReader.h Chess classes - Read games from PGN files
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#ifndef PGNREADER_H
+#define PGNREADER_H
+
+// TripleHappyChess
+namespace thc
+{
+
+// A piece of the PGN text, not '\0' terminated
+struct PgnSpan
+{
+    const char *ptr;
+    size_t      len;
+    PgnSpan() : ptr(""), len(0) {}
+    PgnSpan( const char *ptr_, size_t len_ ) : ptr(ptr_), len(len_) {}
+
+    // Is it the same as a '\0' terminated string ?
+    bool Equals( const char *s ) const;
+
+    // Copy it
+    std::string Str() const { return std::string(ptr,len); }
+#ifdef THC_HAVE_STRING_VIEW
+    std::string_view View() const { return std::string_view(ptr,len); }
+#endif
+};
+
+// A tag pair, eg [White "Carlsen, Magnus"], the value is without the
+//  quotes, but any escapes (\" and \\) are left in place
+struct PgnTag
+{
+    PgnSpan name;
+    PgnSpan value;
+};
+
+// One game as found in the PGN text, all pieces point into the text
+struct PgnGame
+{
+    enum { MAX_TAGS=32 };               // any more tags are dropped
+    long long   nbr;                    // 0 = first game (see PgnReader::Attach())
+    size_t      offset;                 // of the game in the text
+    PgnSpan     text;                   // the whole game, tags and movetext
+    PgnSpan     movetext;               // including the result
+    PgnSpan     result;                 // "1-0", "0-1", "1/2-1/2", "*" or empty if missing
+    int         nbr_tags;
+    PgnTag      tags[MAX_TAGS];
+
+    // Find a tag by name, eg "White"
+    //  return bool found
+    bool Tag( const char *name, PgnSpan &value ) const;
+};
+
+// Receives the games from PgnReader::Read() or PgnReader::Replay(). All
+//  the functions are optional
+class PgnVisitor
+{
+public:
+    virtual ~PgnVisitor() {}
+
+    // A game has been found, return false to skip replaying its moves (then
+    //  GameEnd() isn't called either)
+    virtual bool GameBegin( const PgnGame & /*game*/ ) { return true; }
+
+    // A mainline move, cr is the position before the move is played (ply
+    //  0 is the first move). Return false to stop replaying this game
+    virtual bool GameMove( const PgnGame & /*game*/, int /*ply*/, const ChessRules & /*cr*/, Move /*mv*/ ) { return true; }
+
+    // The game is over, cr is the final position. Error means a move
+    //  couldn't be read or was illegal (or the FEN tag was bad), cr is then
+    //  the position before the bad move
+    virtual void GameEnd( const PgnGame & /*game*/, const ChessRules & /*cr*/, bool /*error*/ ) {}
+};
+
+// Reads PGN straight from a memory mapped file (or from PGN text already in
+//  memory), without copying it. Games are replayed through ChessRules,
+//  mainline only, comments, NAGs and variations are skipped
+class PgnReader
+{
+public:
+    PgnReader();
+
+    // Memory map a PGN file
+    //  return bool okay
+    bool Open( const char *filename );
+
+    // Read PGN text that's already in memory (it must stay there while the
+    //  games are used), games are numbered from first_game_nbr
+    void Attach( const char *text, size_t len, long long first_game_nbr=0 );
+
+    // Finished with the file or text
+    void Close();
+
+    // Moves are read as strict SAN (Move::NaturalInFast()), anything else
+    //  is an error. If lenient, moves that aren't strict SAN (eg "g1f3",
+    //  "ef" or "e8Q") are read with the forgiving Move::NaturalIn() rules,
+    //  but moves that match more than one legal move are still errors
+    //  (default false)
+    void SetLenient( bool lenient_ ) { lenient = lenient_; }
+
+    // Find the next game, its tags and movetext
+    //  return bool found (false at end of text)
+    bool NextGame( PgnGame &game );
+
+    // Replay a game's mainline, calls visitor.GameMove() for each move, then
+    //  visitor.GameEnd() (not visitor.GameBegin(), that's up to the caller)
+    //  return bool okay (false if a move couldn't be read or was illegal)
+    bool Replay( const PgnGame &game, PgnVisitor &visitor );
+
+    // Read and replay all the (remaining) games
+    //  return number of games
+    long long Read( PgnVisitor &visitor );
+
+    // How far we've got through the text
+    size_t Offset() const { return pos; }
+    size_t Size()   const { return len; }
+
+// internal stuff
+private:
+
+    // Not copyable
+    PgnReader( const PgnReader& );
+    PgnReader& operator=( const PgnReader& );
+
+    //### Data
+    MappedFile  file;
+    const char *text;
+    size_t      len;
+    size_t      pos;
+    long long   game_nbr;
+    bool        lenient;
+    ChessRules  cr;
+};
+
+} //namespace thc
+
+#endif //PGNREADER_H
+/****************************************************************************
+ * PgnPipeline.h Chess classes - Read PGN files on multiple threads
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#ifndef PGNPIPELINE_H
+#define PGNPIPELINE_H
+
+// TripleHappyChess
+namespace thc
+{
+
+// Bounded lock-free queue, any number of threads can push and pop. Each
+//  cell has a sequence number that says whether it's ready to be written
+//  or read for the current trip around the ring (Dmitry Vyukov's design)
+template <class T>
+class BoundedQueue
+{
+public:
+    // Size is rounded up to a power of 2
+    explicit BoundedQueue( size_t size )
+    {
+        size_t n = 2;
+        while( n < size )
+            n *= 2;
+        cells = new Cell[n];
+        mask  = n-1;
+        for( size_t i=0; i<n; i++ )
+            cells[i].sequence.store( i, std::memory_order_relaxed );
+        push_pos.store( 0, std::memory_order_relaxed );
+        pop_pos.store( 0, std::memory_order_relaxed );
+    }
+    ~BoundedQueue() { delete[] cells; }
+
+    // Push an item
+    //  return bool okay (false if the queue is full)
+    bool TryPush( const T &item )
+    {
+        size_t pos = push_pos.load( std::memory_order_relaxed );
+        for(;;)
+        {
+            Cell &cell = cells[pos&mask];
+            size_t seq = cell.sequence.load( std::memory_order_acquire );
+            ptrdiff_t diff = (ptrdiff_t)seq - (ptrdiff_t)pos;
+            if( diff == 0 )
+            {
+                if( push_pos.compare_exchange_weak( pos, pos+1, std::memory_order_relaxed ) )
+                {
+                    cell.item = item;
+                    cell.sequence.store( pos+1, std::memory_order_release );
+                    return true;
+                }
+            }
+            else if( diff < 0 )
+                return false;
+            else
+                pos = push_pos.load( std::memory_order_relaxed );
+        }
+    }
+
+    // Pop an item
+    //  return bool okay (false if the queue is empty)
+    bool TryPop( T &item )
+    {
+        size_t pos = pop_pos.load( std::memory_order_relaxed );
+        for(;;)
+        {
+            Cell &cell = cells[pos&mask];
+            size_t seq = cell.sequence.load( std::memory_order_acquire );
+            ptrdiff_t diff = (ptrdiff_t)seq - (ptrdiff_t)(pos+1);
+            if( diff == 0 )
+            {
+                if( pop_pos.compare_exchange_weak( pos, pos+1, std::memory_order_relaxed ) )
+                {
+                    item = cell.item;
+                    cell.sequence.store( pos+mask+1, std::memory_order_release );
+                    return true;
+                }
+            }
+            else if( diff < 0 )
+                return false;
+            else
+                pos = pop_pos.load( std::memory_order_relaxed );
+        }
+    }
+
+// internal stuff
+private:
+
+    // Not copyable
+    BoundedQueue( const BoundedQueue& );
+    BoundedQueue& operator=( const BoundedQueue& );
+
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T                   item;
+    };
+
+    //### Data
+    Cell                            *cells;
+    size_t                           mask;
+    alignas(64) std::atomic<size_t>  push_pos;
+    alignas(64) std::atomic<size_t>  pop_pos;
+};
+
+// A piece of the PGN text made up of whole games
+struct PgnChunk
+{
+    long long   nbr;                    // 0 = first chunk
+    size_t      offset;                 // in the PGN text
+    size_t      len;
+};
+
+// The results of one chunk of games, derive your own from this
+class PgnChunkResult
+{
+public:
+    PgnChunkResult() : chunk_nbr(0), nbr_games(0), first_game_nbr(-1) {}
+    virtual ~PgnChunkResult() {}
+
+    // Filled in by the pipeline
+    long long   chunk_nbr;
+    long long   nbr_games;
+    long long   first_game_nbr;         // in the whole PGN, only known if ordered, else -1
+};
+
+// The work done on a worker thread, the PgnVisitor functions are called
+//  for each game in each chunk the worker gets
+class PgnWorker : public PgnVisitor
+{
+public:
+
+    // A chunk of games is starting, note that PgnGame nbr and offset are
+    //  relative to the chunk
+    virtual void ChunkBegin( const PgnChunk & /*chunk*/ ) {}
+
+    // The chunk is finished, return its results for PgnReducer::Reduce()
+    //  (they're deleted after that), or NULL if there aren't any
+    virtual PgnChunkResult *ChunkEnd( const PgnChunk & /*chunk*/ ) { return NULL; }
+};
+
+// Collects the results from the workers, on the thread that called
+//  PgnPipeline::Run(), one chunk at a time
+class PgnReducer
+{
+public:
+    virtual ~PgnReducer() {}
+    virtual void Reduce( PgnChunkResult &result ) = 0;
+};
+
+// Splits PGN into chunks of whole games, reads the chunks on worker threads
+//  (each with its own PgnReader and so its own ChessRules) and passes their
+//  results through a bounded lock-free queue to a reducer. Threads with
+//  nothing to do (the reducer waiting for the next chunk, a worker too far
+//  ahead of the reducer) sleep on a condition variable rather than spin
+class PgnPipeline
+{
+public:
+    PgnPipeline();
+
+    // Approximate size of each chunk (default 1 megabyte)
+    void SetChunkSize( size_t bytes ) { chunk_size = bytes>0 ? bytes : 1; }
+
+    // Most chunks in flight (being read, or waiting to be reduced) per
+    //  worker (default 4)
+    void SetQueueSize( int chunks_per_worker ) { queue_size = chunks_per_worker>0 ? chunks_per_worker : 1; }
+
+    // Reduce the chunks in the order they appear in the PGN, so results are
+    //  deterministic (default true)
+    void SetOrdered( bool ordered_ ) { ordered = ordered_; }
+
+    // Read moves that aren't strict SAN too, see PgnReader::SetLenient()
+    //  (default false)
+    void SetLenient( bool lenient_ ) { lenient = lenient_; }
+
+    // Read a PGN file, there is a worker thread for each of workers[]
+    //  return number of games, or -1 if the file can't be opened
+    long long Run( const char *filename, PgnWorker *workers[], int nbr_workers, PgnReducer &reducer );
+
+    // Read PGN text that's already in memory
+    //  return number of games
+    long long Run( const char *text, size_t len, PgnWorker *workers[], int nbr_workers, PgnReducer &reducer );
+
+    // Split PGN text into chunks of about chunk_size bytes. A chunk ends
+    //  just before a line starting "[Event ", so standard PGN (where the
+    //  Event tag comes first) splits into whole games
+    static void Split( const char *text, size_t len, size_t chunk_size, std::vector<PgnChunk> &chunks );
+
+// internal stuff
+private:
+
+    // What goes through the queue
+    struct QueueItem
+    {
+        long long        chunk_nbr;
+        long long        nbr_games;
+        PgnChunkResult  *result;
+    };
+
+    // A worker thread
+    void WorkerThread( PgnWorker *worker );
+
+    // Pass a chunk's results to the reducer
+    void Reduce( QueueItem &item, PgnReducer &reducer, long long &nbr_games );
+
+    //### Data
+    size_t                      chunk_size;
+    int                         queue_size;
+    bool                        ordered;
+    bool                        lenient;
+
+    // For the current Run()
+    const char                 *text;
+    std::vector<PgnChunk>       chunks;
+    long long                   window;         // most chunks in flight
+    std::atomic<long long>      next_chunk;     // the next one a worker takes
+    std::atomic<long long>      nbr_reduced;
+    BoundedQueue<QueueItem>    *queue;
+
+    // For sleeping, nbr_pushed is guarded by the mutex
+    std::mutex                  mutex;
+    std::condition_variable     item_ready;     // the reducer waits for this
+    std::condition_variable     space_ready;    // workers wait for this
+    long long                   nbr_pushed;
+};
+
+} //namespace thc
+
+#endif //PGNPIPELINE_H
+/****************************************************************************
+ * GameCodec.h Chess classes - Compress games, a fraction of a byte per move
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#ifndef GAMECODEC_H
+#define GAMECODEC_H
+
+// TripleHappyChess
+namespace thc
+{
+
+// Binary arithmetic (range) coder, as used by LZMA. Each bit is coded with
+//  an adaptive probability, the more predictable the bits the fewer bytes
+//  they take
+class RangeEncoder
+{
+public:
+    // Bit probabilities are 11 bits, PROB_INIT is 50%
+    enum { PROB_BITS=11, PROB_INIT=(1<<PROB_BITS)/2 };
+
+    RangeEncoder() { Begin(NULL); }
+
+    // Start a stream, bytes are appended to out as they're ready
+    void Begin( std::vector<unsigned char> *out );
+
+    // Code a bit with (and update) an adaptive probability
+    void EncodeBit( uint16_t &prob, int bit );
+
+    // Code the low nbr_bits bits of value, each 50% probable
+    void EncodeDirect( uint32_t value, int nbr_bits );
+
+    // Finish the stream, out gets the last few bytes
+    void End();
+
+// internal stuff
+private:
+    void ShiftLow();
+
+    //### Data
+    std::vector<unsigned char> *out;
+    uint64_t    low;
+    uint32_t    range;
+    uint64_t    cache_size;
+    unsigned char cache;
+};
+
+// Decodes what RangeEncoder codes
+class RangeDecoder
+{
+public:
+    RangeDecoder() { Begin(NULL,0); }
+
+    // Start a stream
+    void Begin( const unsigned char *data, size_t len );
+
+    // Decode a bit coded with RangeEncoder::EncodeBit()
+    int DecodeBit( uint16_t &prob );
+
+    // Decode bits coded with RangeEncoder::EncodeDirect()
+    uint32_t DecodeDirect( int nbr_bits );
+
+    // Have we needed more bytes than there are ? (only if the stream is
+    //  truncated or corrupt, decoded bits are meaningless after that)
+    bool Overrun() const { return overrun; }
+
+    // Has the stream ended exactly as RangeEncoder::End() left it ? (after
+    //  the last bit, every byte used and nothing left over)
+    bool Finished() const { return first_byte==0 && code==0 && pos==len && !overrun; }
+
+// internal stuff
+private:
+    unsigned char NextByte()
+    {
+        if( pos < len )
+            return data[pos++];
+        overrun = true;
+        return 0;
+    }
+
+    //### Data
+    const unsigned char *data;
+    size_t      len;
+    size_t      pos;
+    uint32_t    range;
+    uint32_t    code;
+    unsigned char first_byte;
+    bool        overrun;
+};
+
+// What GameEncoder and GameDecoder have in common. Each move is coded as
+//  its rank in a cheap, deterministic ordering of the legal moves, most
+//  likely first, and the ranks are arithmetic coded. The model (the coding
+//  probabilities, and a table of moves already played in positions seen
+//  before, so well trodden openings cost next to nothing) adapts as the
+//  games go by, so a stream of many games compresses better than one game
+class GameCodec
+{
+public:
+    GameCodec();
+
+    // The position, at the start of the game or after the last move
+    const ChessRules &Position() const { return cr; }
+
+    // The legal moves in the current position, ranked. Ordering depends only
+    //  on the position, the last move and the moves seen so far in the
+    //  stream, it's part of the compressed format so it mustn't change
+    void RankMoves();
+
+// internal stuff
+protected:
+
+    // Probabilities etc. back to the start of stream state
+    void ModelReset();
+
+    // Coding contexts for ranks, by number of legal moves and whether the
+    //  top ranked move has been played here before, or is well ahead of
+    //  the rest
+    enum { RANK_CONTEXTS=12, RANK_BUCKETS=9, BOOK_SIZE=1<<16 };
+    int  RankContext() const;
+
+    // Rank bucket b holds ranks [2^(b-1),2^b), bucket 0 just rank 0
+    static int RankBucket( int rank );
+
+    // A game has started from the position in cr
+    void GameStart();
+
+    // A move has been played
+    void PlayMove( Move mv );
+
+    // Add to the running check of the games and moves coded (GameEncoder::
+    //  End() codes it, so GameDecoder can tell if the stream is corrupt)
+    void CheckAdd( uint64_t value );
+
+    //### Data
+    ChessEvaluation     cr;                 // for SEE()
+    Move                last_move;
+    MOVELIST            list;               // legal moves, key[] ranks them
+    int64_t             key[MAXMOVES];      // bigger is better, all different
+    bool                book_hit;           // list has a move from the book
+    bool                clear_best;         // the top ranked move is well ahead
+    uint32_t            check;              // see CheckAdd()
+
+    // Model
+    uint16_t            more_games;
+    uint16_t            standard_start;
+    uint16_t            more_moves;
+    uint16_t            bucket_probs[RANK_CONTEXTS][RANK_BUCKETS];
+    uint16_t            mantissa_probs[RANK_CONTEXTS][RANK_BUCKETS][128];
+    std::vector<uint32_t> book;             // key check (16 bits), PackedMove (16 bits)
+};
+
+// Compresses a stream of games
+class GameEncoder : public GameCodec
+{
+public:
+    GameEncoder();
+
+    // Start a stream, compressed bytes are appended to out as they're ready
+    //  (so out can be written somewhere and cleared between games)
+    void Begin( std::vector<unsigned char> &out );
+
+    // Start a game, from the standard starting position
+    void GameBegin();
+
+    // Start a game from some other position
+    //  return bool okay (false if the position can't be compressed)
+    bool GameBegin( const ChessPosition &start );
+
+    // Add a move to the game
+    //  return bool okay (false if it isn't legal, nothing is coded)
+    bool AddMove( Move mv );
+
+    // Finish the game
+    void GameEnd();
+
+    // Finish the stream, a check of all the games and moves (so the decoder
+    //  can tell if the stream is corrupt) and the last bytes are appended
+    //  to out
+    void End();
+
+// internal stuff
+private:
+
+    // Not copyable
+    GameEncoder( const GameEncoder& );
+    GameEncoder& operator=( const GameEncoder& );
+
+    //### Data
+    RangeEncoder        rc;
+    bool                in_game;
+};
+
+// Decompresses a stream of games, a move at a time
+class GameDecoder : public GameCodec
+{
+public:
+    GameDecoder();
+
+    // Start a stream (it must stay in memory while it's decoded)
+    void Begin( const unsigned char *data, size_t len );
+
+    // Start the next game, Position() is its starting position
+    //  return bool found (false at the end of the stream, or on an error)
+    bool NextGame();
+
+    // Get the next move of the game (and play it, so Position() is the
+    //  position after it)
+    //  return bool found (false at the end of the game, or on an error)
+    bool NextMove( Move &mv );
+
+    // Is the stream corrupt or truncated ? (then NextGame() and NextMove()
+    //  return false from then on). Truncation is found where it happens,
+    //  but corruption mightn't be found until the end of the stream, when
+    //  the check GameEncoder::End() coded doesn't match, so games and moves
+    //  already got from a corrupt stream may be wrong
+    bool Error() const { return error; }
+
+// internal stuff
+private:
+
+    // Not copyable
+    GameDecoder( const GameDecoder& );
+    GameDecoder& operator=( const GameDecoder& );
+
+    //### Data
+    RangeDecoder        rc;
+    bool                in_game;
+    bool                ended;              // end of stream found, and checked
+    bool                error;
+};
+
+} //namespace thc
+
+#endif //GAMECODEC_H
+/****************************************************************************
+ * GameArchive.h Chess classes - Compressed game archive, random access
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#ifndef GAMEARCHIVE_H
+#define GAMEARCHIVE_H
+
+// TripleHappyChess
+namespace thc
+{
+
+// The tags of a game kept in an archive
+struct GameTags
+{
+    enum { RESULT_NONE=0, RESULT_WHITE_WINS=1, RESULT_BLACK_WINS=2, RESULT_DRAW=3 };
+    std::string white;
+    std::string black;
+    std::string event;
+    int         date;           // yyyymmdd, mm and/or dd 00 if unknown, 0 if all unknown
+    int         result;         // RESULT_NONE etc.
+    GameTags() : date(0), result(RESULT_NONE) {}
+
+    // From a PGN game's White, Black, Event, Date and Result tags (values
+    //  are as in the PGN, escapes and all)
+    void FromPgn( const PgnGame &game );
+
+    // PGN date, eg "2015.03.??" to 20150300
+    static int ParseDate( const char *s, size_t len );
+
+    // PGN result, eg "1-0" to RESULT_WHITE_WINS
+    static int ParseResult( const char *s, size_t len );
+};
+
+// Which games GameArchive::Find() finds, names must match exactly, NULL
+//  (or 0, or -1 for result) means anything will do
+struct GameFilter
+{
+    const char *player;         // white or black
+    const char *white;
+    const char *black;
+    const char *event;
+    int         date_from;      // yyyymmdd, inclusive
+    int         date_to;
+    int         result;
+    GameFilter() : player(NULL), white(NULL), black(NULL), event(NULL),
+                   date_from(0), date_to(0), result(-1) {}
+};
+
+// Writes an archive of compressed games. Games are compressed by
+//  GameEncoder in blocks of about the same size, each block coded on its
+//  own so any game can be got back by decoding just one block. The tags
+//  are kept separately, column by column, so searching them never touches
+//  the moves
+class GameArchiveWriter
+{
+public:
+    GameArchiveWriter();
+    ~GameArchiveWriter();
+
+    // Approximate size of each block of compressed games (default 4096
+    //  bytes), bigger blocks compress a little better, smaller blocks make
+    //  GameArchive::GetGame() faster. Set it before Open()
+    void SetBlockSize( size_t bytes ) { block_size = bytes>0 ? bytes : 1; }
+
+    // Create an archive
+    //  return bool okay
+    bool Open( const char *filename );
+
+    // Add a game, its ids are 0, 1, 2 ... in the order they are added
+    //  return bool okay (false if the start position can't be compressed,
+    //  then the game isn't added, or a move isn't legal, then the game is
+    //  added up to that move)
+    bool AddGame( const GameTags &tags, const ChessPosition &start, const std::vector<Move> &moves );
+
+    // Finish the archive (the destructor does this too)
+    //  return bool okay (false if anything couldn't be written)
+    bool Close();
+
+    // Games so far
+    long long NbrGames() const { return (long long)dates.size(); }
+
+// internal stuff
+private:
+
+    // Not copyable
+    GameArchiveWriter( const GameArchiveWriter& );
+    GameArchiveWriter& operator=( const GameArchiveWriter& );
+
+    // Write the current block
+    void BlockEnd();
+
+    // Write bytes, and pad them to a multiple of 8
+    void Write( const void *data, size_t len );
+
+    // Index of a string in the string table
+    uint32_t StringIndex( const std::string &s );
+
+    //### Data
+    FILE                       *file;
+    bool                        okay;
+    uint64_t                    offset;         // in the file
+    size_t                      block_size;
+    GameEncoder                 encoder;
+    std::vector<unsigned char>  block;
+    long long                   block_first_game;
+    std::vector<uint64_t>       index;          // offset, len, first game, checksum for each block
+    std::map<std::string,uint32_t> strings;
+    std::vector<uint32_t>       whites, blacks, events, dates;
+    std::vector<uint8_t>        results;
+};
+
+// Reads an archive written by GameArchiveWriter, straight from a memory
+//  mapped file. Not safe to share between threads, but any number of
+//  GameArchives can have the same file open
+class GameArchive
+{
+public:
+    GameArchive();
+
+    // Memory map an archive
+    //  return bool okay (false if it can't be opened, or isn't an archive)
+    bool Open( const char *filename );
+
+    // Finished with it
+    void Close();
+
+    // Number of games
+    long long NbrGames() const { return nbr_games; }
+
+    // Get a game's starting position and moves. Only the block the game is
+    //  in is decoded (and only up to the game), or less if the last game
+    //  got was from the same block. The block's checksum is checked before
+    //  it's decoded
+    //  return bool okay (false if id is out of range or the block is corrupt)
+    bool GetGame( long long id, ChessPosition &start, std::vector<Move> &moves );
+
+    // Get a game's tags
+    //  return bool okay (false if id is out of range)
+    bool GetTags( long long id, GameTags &tags ) const;
+
+    // Tags one at a time, without copying
+    const char *White( long long id ) const  { return String( whites, id ); }
+    const char *Black( long long id ) const  { return String( blacks, id ); }
+    const char *Event( long long id ) const  { return String( events, id ); }
+    int         Date( long long id ) const   { return (id>=0 && id<nbr_games) ? (int)dates[id] : 0; }
+    int         Result( long long id ) const { return (id>=0 && id<nbr_games) ? (int)results[id] : 0; }
+
+    // Find the games that match a filter, only the tag columns the filter
+    //  needs are scanned
+    //  return number of games found
+    long long Find( const GameFilter &filter, std::vector<long long> &ids ) const;
+
+// internal stuff
+private:
+
+    // Not copyable
+    GameArchive( const GameArchive& );
+    GameArchive& operator=( const GameArchive& );
+
+    // A string in the string table, "" if out of range
+    const char *String( const uint32_t *column, long long id ) const;
+
+    // Find a string in the (sorted) string table
+    //  return bool found
+    bool FindString( const char *s, uint32_t &idx ) const;
+
+    //### Data
+    MappedFile          file;
+    long long           nbr_games;
+    long long           nbr_blocks;
+    const uint64_t     *index;          // offset, len, first game, checksum for each block
+    const uint32_t     *whites;
+    const uint32_t     *blacks;
+    const uint32_t     *events;
+    const uint32_t     *dates;
+    const uint8_t      *results;
+    const uint32_t     *string_offsets;
+    uint32_t            nbr_strings;
+    const char         *string_data;
+    uint64_t            string_len;
+
+    // The last block decoded, and the next game in it
+    GameDecoder         decoder;
+    long long           decoder_block;
+    long long           decoder_game;
+};
+
+} //namespace thc
+
+#endif //GAMEARCHIVE_H
+/****************************************************************************
+ * ExternalSort.h Chess classes - Sort more records than fit in memory
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#ifndef EXTERNALSORT_H
+#define EXTERNALSORT_H
+
+// TripleHappyChess
+namespace thc
+{
+
+// Sorts fixed size records, each a few uint64s, the first key_words of
+//  which are the key (a big number, most significant word first). Records
+//  are collected in memory, and each time memory fills they're radix sorted
+//  on multiple threads and written to a temporary file (a run). Then the
+//  runs are merged, so the number of records is limited by disk space, not
+//  memory. Only so many runs are merged at once (so only so many files are
+//  open), if there are more they're merged in passes, each pass writing
+//  bigger runs. Records with equal keys come out in the order they were
+//  added
+class ExternalSort
+{
+public:
+    ExternalSort();
+    ~ExternalSort();
+
+    // Memory to use, (default 256 megabytes) and number of threads
+    //  (default, one per processor). Set them before Begin()
+    void SetMemory( size_t bytes ) { memory = bytes; }
+    void SetThreads( int nbr ) { nbr_threads = nbr>0 ? nbr : 1; }
+
+    // Most runs to merge at once (default 128, at least 2)
+    void SetMaxMerge( int nbr ) { max_merge = nbr>2 ? nbr : 2; }
+
+    // Combine records with equal keys into one, adding up the word after
+    //  the key (a count say), the other words are the first record's. Runs
+    //  are combined before they're written, and only written at all if
+    //  combining doesn't halve them. Set it before Begin()
+    void SetCombine( bool combine_ ) { combine = combine_; }
+
+    // Start sorting, records are record_words (at most 64) uint64s, the
+    //  first key_words (at most 8) the key. Runs are written to files named
+    //  temp_filename.0, temp_filename.1 etc.
+    //  return bool okay (false if the record or key size is unreasonable,
+    //  or there's no word after the key to combine)
+    bool Begin( int record_words, int key_words, const char *temp_filename );
+
+    // Add a record (record_words uint64s)
+    //  return bool okay (false if a run couldn't be written)
+    bool Add( const uint64_t *record );
+
+    // All records added, sort them
+    //  return bool okay (false if a run couldn't be written or read)
+    bool Sort();
+
+    // Get the records, in order, after Sort(). Record points at a copy that
+    //  is valid until the next call
+    //  return bool found (false when there are no more)
+    bool Next( const uint64_t *&record );
+
+    // Did reading the runs fail ? (then Next() returns false early)
+    bool Error() const { return error; }
+
+    // Number of records added (before any are combined)
+    long long NbrRecords() const { return nbr_records; }
+
+    // Finished, removes the temporary files (Begin() and the destructor do
+    //  this too)
+    void End();
+
+    // Radix sort records in memory (sizes limited as for Begin()), tmp must
+    //  be as big as data
+    static void RadixSort( uint64_t *data, uint64_t *tmp, size_t nbr, int record_words, int key_words, int nbr_threads );
+
+// internal stuff
+private:
+
+    // Not copyable
+    ExternalSort( const ExternalSort& );
+    ExternalSort& operator=( const ExternalSort& );
+
+    // Sort the records in memory, combining them if need be
+    void SortData();
+
+    // Write the (sorted) records in memory as a run
+    //  return bool okay
+    bool WriteRun();
+
+    // Merge runs in passes until there are few enough to merge at once
+    //  return bool okay
+    bool MergePasses();
+
+    // Open nbr runs, starting with run_files[first], for merging
+    //  return bool okay
+    bool OpenRuns( size_t first, size_t nbr );
+
+    // Close the runs being merged
+    void CloseRuns();
+
+    // Merge the next record (combining if need be) into record[]
+    //  return bool found
+    bool MergeNext();
+
+    // Refill a run's buffer
+    void ReadRun( int run );
+
+    // Does run a's current record come after run b's ? (ties go to the
+    //  earlier run, so sorting is stable)
+    bool After( int a, int b ) const;
+
+    // The top run's current record, and moving past it
+    const uint64_t *Top() const;
+    void Pop();
+
+    // A run being merged
+    struct RUN
+    {
+        FILE                 *file;
+        std::vector<uint64_t> buf;
+        size_t                pos;          // words
+        size_t                len;          // words
+    };
+
+    //### Data
+    size_t                  memory;
+    int                     nbr_threads;
+    int                     max_merge;
+    int                     record_words;
+    int                     key_words;
+    std::string             temp_filename;
+    long long               nbr_records;
+    long long               nbr_runs;       // temporary files written
+    std::vector<long long>  run_files;      // runs still to merge, in order
+    std::vector<uint64_t>   data;           // records waiting to be sorted
+    std::vector<uint64_t>   tmp;
+    size_t                  capacity;       // records
+    bool                    combine;
+    bool                    error;
+
+    // Merging (or, if everything fitted in memory, just reading data[])
+    bool                    sorted;
+    size_t                  next;           // in data[]
+    std::vector<RUN>        runs;
+    std::vector<int>        heap;           // of runs, by current record
+    std::vector<uint64_t>   record;
+};
+
+} //namespace thc
+
+#endif //EXTERNALSORT_H
+/****************************************************************************
+ * PositionIndex.h Chess classes - Which games reached a position
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#ifndef POSITIONINDEX_H
+#define POSITIONINDEX_H
+
+// TripleHappyChess
+namespace thc
+{
+
+// A position in a game, key is the position's Zobrist key (ChessPosition::key,
+//  so side to move, castling and en passant count)
+struct PositionIndexEntry
+{
+    enum { PLY_BITS=16 };
+    uint64_t    key;
+    uint64_t    game_ply;       // game id << PLY_BITS | ply
+    long long   Game() const { return (long long)(game_ply>>PLY_BITS); }
+    int         Ply() const  { return (int)(game_ply & ((1<<PLY_BITS)-1)); }
+};
+
+// Builds a position index file. Games are replayed, and every position
+//  (including the starting position, ply 0) is added, then everything is
+//  sorted by key, game and ply with ExternalSort, so the number of games
+//  isn't limited by memory
+class PositionIndexBuilder
+{
+public:
+    PositionIndexBuilder();
+
+    // Memory and threads for sorting, see ExternalSort. Set them before
+    //  Open()
+    void SetMemory( size_t bytes ) { sorter.SetMemory(bytes); }
+    void SetThreads( int nbr ) { sorter.SetThreads(nbr); }
+
+    // Start an index, temporary files are filename.run.0, filename.run.1
+    //  etc.
+    //  return bool okay
+    bool Open( const char *filename );
+
+    // Add a position (positions after ply 65535 are ignored)
+    void AddPosition( uint64_t key, long long game, int ply );
+
+    // Add a game's positions, the moves must be legal
+    void AddGame( long long game, const ChessPosition &start, const std::vector<Move> &moves );
+
+    // Add all the games in an archive, the index's game ids are the
+    //  archive's
+    //  return bool okay (false if a game can't be read)
+    bool AddGames( GameArchive &archive );
+
+    // Sort and write the index
+    //  return bool okay (false if anything couldn't be written)
+    bool Close();
+
+    // Positions so far
+    long long NbrPositions() const { return sorter.NbrRecords(); }
+
+// internal stuff
+private:
+
+    // Not copyable
+    PositionIndexBuilder( const PositionIndexBuilder& );
+    PositionIndexBuilder& operator=( const PositionIndexBuilder& );
+
+    //### Data
+    ExternalSort    sorter;
+    std::string     filename;
+    bool            okay;
+};
+
+// Looks up positions in an index written by PositionIndexBuilder. The
+//  entries are memory mapped, in pages of 256, and the key of the first
+//  entry in each page is kept in memory, so a lookup reads one or two pages
+//  of the file (three at most), however many games there are. Keys are 64
+//  bits, so in a big index there can (very rarely) be a false match, if
+//  that matters check the position by replaying the game
+class PositionIndex
+{
+public:
+    enum { ENTRIES_PER_PAGE=256 };
+    PositionIndex();
+
+    // Memory map an index
+    //  return bool okay (false if it can't be opened, or isn't an index)
+    bool Open( const char *filename );
+
+    // Finished with it
+    void Close();
+
+    // Number of positions
+    long long NbrPositions() const { return nbr_entries; }
+
+    // Find a position, first points to the entries (in the memory mapped
+    //  file), in order of game id and ply
+    //  return number of entries
+    size_t Find( uint64_t key, const PositionIndexEntry *&first ) const;
+    size_t Find( const ChessPosition &cp, const PositionIndexEntry *&first ) const { return Find( cp.key, first ); }
+
+    // Which games reached a position, each game once
+    //  return number of games
+    size_t FindGames( const ChessPosition &cp, std::vector<long long> &games ) const;
+
+// internal stuff
+private:
+
+    // Not copyable
+    PositionIndex( const PositionIndex& );
+    PositionIndex& operator=( const PositionIndex& );
+
+    //### Data
+    MappedFile                  file;
+    const PositionIndexEntry   *entries;
+    long long                   nbr_entries;
+    std::vector<uint64_t>       fences;         // first key in each page
+};
+
+} //namespace thc
+
+#endif //POSITIONINDEX_H
+/****************************************************************************
+ * PositionDedup.h Chess classes - Sort positions, and count duplicates
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#ifndef POSITIONDEDUP_H
+#define POSITIONDEDUP_H
+
+// TripleHappyChess
+namespace thc
+{
+
+// Sorts any number of positions, each distinct position coming out once
+//  with the number of times it went in. A position's sort key is worked out
+//  once, when it's added: its CompressedPosition, which already counts only
+//  the castling and en passant possibilities that are real (as
+//  ChessPosition::operator==() does), so positions are the same if and only
+//  if their keys are. Positions come out in order of their
+//  CompressedPosition bytes. Sorting is done by ExternalSort, on multiple
+//  threads in limited memory, with duplicates combined as early as possible
+class PositionDedup
+{
+public:
+    PositionDedup();
+
+    // Memory, threads and most runs merged at once for sorting, see
+    //  ExternalSort. Set them before Begin()
+    void SetMemory( size_t bytes ) { sorter.SetMemory(bytes); }
+    void SetThreads( int nbr ) { sorter.SetThreads(nbr); }
+    void SetMaxMerge( int nbr ) { sorter.SetMaxMerge(nbr); }
+
+    // Start, temporary files are temp_filename.0, temp_filename.1 etc.
+    //  return bool okay
+    bool Begin( const char *temp_filename );
+
+    // Add a position, count times
+    //  return bool okay (false if it can't be compressed, it has more than
+    //  32 men, or a temporary file couldn't be written)
+    bool Add( const ChessPosition &cp, uint64_t count=1 );
+
+    // All positions added, sort them
+    //  return bool okay
+    bool Sort();
+
+    // Get the next distinct position, and the number of times it was added
+    //  return bool found (false when there are no more)
+    bool Next( CompressedPosition &position, uint64_t &count );
+
+    // Did sorting fail ? (then Next() returns false early)
+    bool Error() const { return sorter.Error(); }
+
+    // Number of positions added (counting duplicates)
+    long long NbrPositions() const { return nbr_positions; }
+
+    // Finished, removes the temporary files (Begin() and the destructor do
+    //  this too)
+    void End() { sorter.End(); }
+
+    // The sort key, a CompressedPosition as three big endian words (so
+    //  sorting the words sorts the bytes)
+    //  return bool okay (false if the position can't be compressed)
+    static bool Key( const ChessPosition &cp, uint64_t key[3] );
+
+// internal stuff
+private:
+
+    // Not copyable
+    PositionDedup( const PositionDedup& );
+    PositionDedup& operator=( const PositionDedup& );
+
+    //### Data
+    ExternalSort    sorter;
+    long long       nbr_positions;
+};
+
+} //namespace thc
+
+#endif //POSITIONDEDUP_H
@@ -17,6 +17,16 @@
         ChessPosition.cpp
         ChessRules.cpp
         ChessEvaluation.cpp
+        MovePicker.cpp
+        ChessSearch.cpp
+        MappedFile.cpp
+        PgnReader.cpp
+        PgnPipeline.cpp
+        GameCodec.cpp
+        GameArchive.cpp
+        ExternalSort.cpp
+        PositionIndex.cpp
+        PositionDedup.cpp
         Move.cpp
         PrivateChessDefs.cpp
          nested inline expansion of -> GeneratedLookupTables.h
@@ -29,6 +39,29 @@
 #include <ctype.h>
 #include <assert.h>
 #include <algorithm>
+#include <functional>
+#include <chrono>
+#include <thread>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#if !defined(THC_NO_PEXT) && (defined(__x86_64__) || defined(_M_X64)) && (defined(__GNUC__) || defined(_MSC_VER))
+#include <immintrin.h>
+#endif
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 #include "thc.h"
 using namespace std;
 using namespace thc;
@@ -62,6 +95,15 @@ int strcmp_ignore( const char *s, const char *t )
  ****************************************************************************/
 #ifndef PRIVATE_CHESS_DEFS_H_INCLUDED
 #define PRIVATE_CHESS_DEFS_H_INCLUDED
+#ifdef _MSC_VER
+#endif
+
+// On x86-64 slider attacks can be indexed with the BMI2 PEXT instruction,
+//  which is used if the CPU supports it. Define THC_NO_PEXT to always
+//  use magic multiplication instead
+#if !defined(THC_NO_PEXT) && (defined(__x86_64__) || defined(_M_X64)) && (defined(__GNUC__) || defined(_MSC_VER))
+#define THC_PEXT
+#endif
 
 // TripleHappyChess
 namespace thc
@@ -116,7 +158,7 @@ inline Square& operator++ ( Square& sq )
     int  bking              : 1;
     int  bqueen             : 1;
 
-  We assume it is located in the last 4 bytes of ChessPosition,
+  We assume it is located in the last 4 bytes of ChessPositionRaw,
   hence the definition of typedef DETAIL as unsigned long, and
   of DETAIL_ADDR below. We assume that ANDing the unsigned
   character at this address + 3, with ~WKING, where WKING
@@ -126,7 +168,7 @@ inline Square& operator++ ( Square& sq )
   TestInternals(). If porting this code, step through that code
   first and make any adjustments necessary */
 
-#define DETAIL_ADDR         ( (DETAIL*) ((char *)this + sizeof(ChessPosition) - sizeof(DETAIL))  )
+#define DETAIL_ADDR         ( (DETAIL*) ((char *)static_cast<ChessPositionRaw*>(this) + sizeof(ChessPositionRaw) - sizeof(DETAIL))  )
 #define DETAIL_SAVE         DETAIL tmp = *DETAIL_ADDR
 #define DETAIL_RESTORE      *DETAIL_ADDR = tmp
 #define DETAIL_EQ_ALL               ( (*DETAIL_ADDR&0x0fffffff) == (tmp&0x0fffffff) )
@@ -186,6 +228,134 @@ extern const lte *attacks_white_lookup[];
 // Lookup squares from which enemy pieces attack black
 extern const lte *attacks_black_lookup[];
 
+// Bitboard with a single square set, eg BB(c5)
+#define BB(sq)      ( (Bitboard)1 << (sq) )
+
+// Bitboard of all squares on a rank, eg BB_RANK('5') -> a5-h5
+#define BB_RANK(r)  ( (Bitboard)0xff << (('8'-(r))*8) )
+
+// Number of squares set in a bitboard
+inline int bb_popcount( Bitboard bb )
+{
+#if defined(__GNUC__)
+    return __builtin_popcountll(bb);
+#else
+    bb = bb - ((bb>>1) & 0x5555555555555555ULL);
+    bb = (bb & 0x3333333333333333ULL) + ((bb>>2) & 0x3333333333333333ULL);
+    bb = (bb + (bb>>4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return (int)((bb * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+// Lowest numbered square set in a (non-zero) bitboard
+inline Square bb_lsb( Bitboard bb )
+{
+#if defined(__GNUC__)
+    return (Square)__builtin_ctzll(bb);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    unsigned long idx;
+    _BitScanForward64( &idx, bb );
+    return (Square)idx;
+#else
+    int idx = 0;
+    while( !(bb&1) )
+    {
+        bb >>= 1;
+        idx++;
+    }
+    return (Square)idx;
+#endif
+}
+
+// Remove and return lowest numbered square set in a (non-zero) bitboard
+inline Square bb_pop_lsb( Bitboard &bb )
+{
+    Square sq = bb_lsb(bb);
+    bb &= (bb-1);
+    return sq;
+}
+
+// Convert piece, e.g. 'N' to BB_WKNIGHT, empty square ' ' to BB_NBR
+extern lte bb_index[];
+
+// Bitboards of squares attacked by a piece on a given square
+extern Bitboard knight_attacks_bb[64];
+extern Bitboard king_attacks_bb[64];
+extern Bitboard pawn_white_attacks_bb[64];  // by a white pawn
+extern Bitboard pawn_black_attacks_bb[64];  // by a black pawn
+
+// Slider (bishop and rook) attacks for any occupancy, using "magic
+//  bitboards". Only the occupied squares within mask (the rays from the
+//  square less their final edge squares) can block, and they are mapped to
+//  a dense index into the attacks table, either by multiplying by a magic
+//  number found by trial and error and keeping the top bits, or in one step
+//  with the PEXT instruction
+struct SliderMagic
+{
+    Bitboard     mask;
+    Bitboard     magic;
+    Bitboard    *attacks;
+    unsigned int shift;     // 64 - number of squares in mask
+};
+extern SliderMagic bishop_magics[64];
+extern SliderMagic rook_magics[64];
+
+#ifdef THC_PEXT
+extern bool slider_use_pext;    // CPU supports PEXT, attacks tables laid out for it
+unsigned int slider_index_pext( Bitboard occupied, Bitboard mask );
+#endif
+
+inline unsigned int slider_index( const SliderMagic &m, Bitboard occupied )
+{
+#if defined(THC_PEXT) && defined(__BMI2__)
+    return (unsigned int)_pext_u64( occupied, m.mask );  // compiled for BMI2, no need to check
+#else
+    #ifdef THC_PEXT
+    if( slider_use_pext )
+        return slider_index_pext( occupied, m.mask );
+    #endif
+    return (unsigned int)( ((occupied & m.mask) * m.magic) >> m.shift );
+#endif
+}
+
+// Squares attacked by a bishop, rook or queen on square, given all occupied
+//  squares. Attacked squares include the first man on each ray (of either
+//  colour)
+inline Bitboard bishop_attacks_bb( Square square, Bitboard occupied )
+{
+    const SliderMagic &m = bishop_magics[square];
+    return m.attacks[ slider_index(m,occupied) ];
+}
+
+inline Bitboard rook_attacks_bb( Square square, Bitboard occupied )
+{
+    const SliderMagic &m = rook_magics[square];
+    return m.attacks[ slider_index(m,occupied) ];
+}
+
+inline Bitboard queen_attacks_bb( Square square, Bitboard occupied )
+{
+    return bishop_attacks_bb(square,occupied) | rook_attacks_bb(square,occupied);
+}
+
+// Squares strictly between two squares on a common line (else 0), and the
+//  whole line (edge to edge) through two squares on a common line (else 0)
+extern Bitboard between_bb[64][64];
+extern Bitboard line_bb[64][64];
+
+// Zobrist key random numbers, for each piece on each square (the material
+//  key reuses these indexed by count of pieces instead of square), white to
+//  move, each combination of castling possibilities and en passant file
+extern uint64_t zobrist_pieces[BB_NBR][64];
+extern uint64_t zobrist_white;
+extern uint64_t zobrist_castling[16];   // 1=K, 2=Q, 4=k, 8=q
+extern uint64_t zobrist_enpassant[8];
+
+// Calculate the bitboard lookup tables above from the generated lookup
+//  tables, returns true. Called automatically before the first
+//  ChessPosition is set up.
+bool bitboard_tables_init();
+
 } //namespace thc
 
 #endif // PRIVATE_CHESS_DEFS_H_INCLUDED
@@ -946,6 +1116,49 @@ std::string ChessPosition::ToDebugStr( const char *label )
     return s;
 }
 
+/****************************************************************************
+ * For debug, into a buffer
+ *   return length
+ ****************************************************************************/
+int ChessPosition::ToDebugStr( char *buf, size_t buf_size, const char *label )
+{
+    if( buf_size == 0 )
+        return 0;
+    size_t len=0;
+    const char *p = squares;
+    const char *s = (white ? "\nWhite to move\n" : "\nBlack to move\n");
+    while( label && *label && len+1<buf_size )
+        buf[len++] = *label++;
+    while( *s && len+1<buf_size )
+        buf[len++] = *s++;
+    for( int row=0; row<8; row++ )
+    {
+        for( int col=0; col<9 && len+1<buf_size; col++ )
+        {
+            char c = (col==8 ? '\n' : *p++);
+            if( c==' ' )
+                c = '.';
+            buf[len++] = c;
+        }
+    }
+    buf[len] = '\0';
+    return (int)len;
+}
+
+/****************************************************************************
+ * Set up position on board from Forsyth string of given length
+ *   return bool okay
+ ****************************************************************************/
+bool ChessPosition::Forsyth( const char *txt, size_t len )
+{
+    char buf[FORSYTH_SIZE*2];
+    if( len >= sizeof(buf) )
+        return false;
+    memcpy( buf, txt, len );
+    buf[len] = '\0';
+    return Forsyth( buf );
+}
+
 /****************************************************************************
  * Set up position on board from Forsyth string with extensions
  *   return bool okay
@@ -1212,6 +1425,7 @@ bool ChessPosition::Forsyth( const char *txt )
                 full_move_count = temp;
         }
     }
+    BitboardsCalculate();
     return( okay );
 }
 
@@ -1220,11 +1434,23 @@ bool ChessPosition::Forsyth( const char *txt )
  * Publish chess position and supplementary info in forsyth notation
  ****************************************************************************/
 std::string ChessPosition::ForsythPublish()
+{
+    char buf[FORSYTH_SIZE];
+    ForsythPublish( buf );
+    return buf;
+}
+
+/****************************************************************************
+ * Publish chess position and supplementary info in forsyth notation, into
+ *  a buffer
+ *   return length
+ ****************************************************************************/
+int ChessPosition::ForsythPublish( char forsyth_out[FORSYTH_SIZE] )
 {
     int i, empty=0, file=0, rank=7, save_file=0, save_rank=0;
     Square sq;
     char p;
-    std::string str;
+    char *str = forsyth_out;
 
     // Squares
     for( i=0; i<64; i++ )
@@ -1242,22 +1468,18 @@ std::string ChessPosition::ForsythPublish()
         {
             if( empty )
             {
-                char count = '0' + (char)empty;
-                str += count;
+                *str++ = '0' + (char)empty;
                 empty = 0;
             }
-            str += p;
+            *str++ = p;
         }
         file++;
         if( file == 8 )
         {
             if( empty )
-            {
-                char count = '0'+(char)empty;
-                str += count;
-            }
+                *str++ = '0' + (char)empty;
             if( rank )
-                str += '/';
+                *str++ = '/';
             empty = 0;
             file = 0;
             rank--;
@@ -1265,76 +1487,104 @@ std::string ChessPosition::ForsythPublish()
     }
 
     // Who to move
-    str += ' ';
-    str += (white?'w':'b');
+    *str++ = ' ';
+    *str++ = (white?'w':'b');
 
     // Castling flags
-    str += ' ';
+    *str++ = ' ';
     if( !wking_allowed() && !wqueen_allowed() && !bking_allowed() && !bqueen_allowed() )
-        str += '-';
+        *str++ = '-';
     else
     {
         if( wking_allowed() )
-            str += 'K';
+            *str++ = 'K';
         if( wqueen_allowed() )
-            str += 'Q';
+            *str++ = 'Q';
         if( bking_allowed() )
-            str += 'k';
+            *str++ = 'k';
         if( bqueen_allowed() )
-            str += 'q';
+            *str++ = 'q';
     }
 
     // Enpassant target square
-    str += ' ';
+    *str++ = ' ';
     if( enpassant_target==SQUARE_INVALID || save_rank==0 )
-        str += '-';
+        *str++ = '-';
     else
     {
-        char file2 = 'a'+(char)save_file;
-        str += file2;
-        char rank2 = '1'+(char)save_rank;
-        str += rank2;
+        *str++ = 'a'+(char)save_file;
+        *str++ = '1'+(char)save_rank;
     }
 
     // Counts
-    char buf[40];
-    sprintf( buf, " %d %d", half_move_clock, full_move_count );
-    str += buf;
-    return( str );
+    str += sprintf( str, " %d %d", half_move_clock, full_move_count );
+    return (int)(str-forsyth_out);
 }
 
 
+// Encode empty square with 2 bits, and other 12 possibilities with
+//  all the other possible nibbles that don't start with those 2 bits
+#define CEMPTY      2   // 10
+#define CWROOK      0   // 0000
+#define CWKNIGHT    1   // 0001
+#define CWBISHOP    2   // 0010
+#define CWQUEEN     3   // 0011
+#define CWKING      4   // 0100
+#define CWPAWN      5   // 0101
+#define CBROOK      6   // 0110
+#define CBKNIGHT    7   // 0111
+#define CBBISHOP   12   // 1100
+#define CBQUEEN    13   // 1101
+#define CBKING     14   // 1110
+#define CBPAWN     15   // 1111
+
+// The code for each piece, and its number of bits (2 for an empty square,
+//  or anything else, 4 for a piece), lookups rather than a switch so
+//  Compress() is fast
+struct COMPRESS_CODES
+{
+    unsigned char code[256];
+    unsigned char nbr_bits[256];
+    COMPRESS_CODES()
+    {
+        memset( code, CEMPTY, sizeof(code) );
+        memset( nbr_bits, 2, sizeof(nbr_bits) );
+        const char *pieces = "RNBQKPrnbqkp";
+        const unsigned char codes[] = { CWROOK, CWKNIGHT, CWBISHOP, CWQUEEN, CWKING, CWPAWN,
+                                        CBROOK, CBKNIGHT, CBBISHOP, CBQUEEN, CBKING, CBPAWN };
+        for( int i=0; pieces[i]; i++ )
+        {
+            code[ (unsigned char)pieces[i] ] = codes[i];
+            nbr_bits[ (unsigned char)pieces[i] ] = 4;
+        }
+    }
+};
+
 /****************************************************************************
  * Compress chess position
  ****************************************************************************/
 unsigned short ChessPosition::Compress( CompressedPosition &dst ) const
 {
-    ChessPosition src = *this;
+    // Work on a copy of the board
+    char src[64];
+    memcpy( src, squares, sizeof(src) );
     int i;
 
-    // Optimisation: Clear the last 1/3 of the 24 bytes of storage only
-    //  as the first 2/3 are cleared inherently as even 64 empty squares
-    //  require 64 * 2 bits = 16 bytes.
-    for( i = ( 2 * nbrof(dst.ints) ) / 3; i<nbrof(dst.ints); i++ )
-    {
-        dst.ints[i] = 0;
-    }
-
     // Encode "castling possible" as opposition pawn on rook's home square
     //  (which is otherwise impossible)
-    if( squares[e1] == 'K' )
+    if( src[e1] == 'K' )
     {
-        if( src.wking && src.squares[h1]=='R' )
-            src.squares[h1] = 'p';
-        if( src.wqueen && src.squares[a1]=='R' )
-            src.squares[a1] = 'p';
+        if( wking && src[h1]=='R' )
+            src[h1] = 'p';
+        if( wqueen && src[a1]=='R' )
+            src[a1] = 'p';
     }
-    if( src.squares[e8] == 'k' )
+    if( src[e8] == 'k' )
     {
-        if( src.bking && src.squares[h8]=='r' )
-            src.squares[h8] = 'P';
-        if( src.bqueen && src.squares[a8]=='r' )
-            src.squares[a8] = 'P';
+        if( bking && src[h8]=='r' )
+            src[h8] = 'P';
+        if( bqueen && src[a8]=='r' )
+            src[a8] = 'P';
     }
 
     // Encode enpassant as friendly pawn on 1st rank (otherwise impossible).
@@ -1353,20 +1603,20 @@ unsigned short ChessPosition::Compress( CompressedPosition &dst ) const
     //  for the other bug comment in this function).
     #if 1
     // White captures enpassant on a6,b6...h6
-    Square ep_target = src.groomed_enpassant_target();
-    if( src.white && ep_target!=SQUARE_INVALID )
+    Square ep_target = groomed_enpassant_target();
+    if( white && ep_target!=SQUARE_INVALID )
     {
         int idx = ep_target+8; //idx = SOUTH(enpassant_target) is black pawn
-        src.squares[idx] = src.squares[idx-24]; // store 1st rank
-        src.squares[idx-24] = 'p';              // indicate ep
+        src[idx] = src[idx-24]; // store 1st rank
+        src[idx-24] = 'p';      // indicate ep
     }
 
     // Black captures enpassant on a3,b3...h3
-    else if( !src.white && ep_target!=SQUARE_INVALID )
+    else if( !white && ep_target!=SQUARE_INVALID )
     {
         int idx = ep_target-8; //idx = NORTH(enpassant_target) is white pawn
-        src.squares[idx] = src.squares[idx+24]; // store 1st rank
-        src.squares[idx+24] = 'P';              // indicate ep
+        src[idx] = src[idx+24]; // store 1st rank
+        src[idx+24] = 'P';      // indicate ep
     }
 
     // This old ugly one has a bug ... (search for bug below)
@@ -1374,156 +1624,76 @@ unsigned short ChessPosition::Compress( CompressedPosition &dst ) const
 
     // White captures enpassant on a6,b6...h6
     bool swap = false;
-    if( src.white && a6<=src.enpassant_target && src.enpassant_target<=h6 )
+    if( white && a6<=enpassant_target && enpassant_target<=h6 )
     {
-        int idx = src.enpassant_target+8; //idx = SOUTH(src.enpassant_target)
-        if( src.enpassant_target==a6 && src.squares[idx+1]=='P' )
+        int idx = enpassant_target+8; //idx = SOUTH(enpassant_target)
+        if( enpassant_target==a6 && src[idx+1]=='P' )
             swap = true;
-        else if( src.enpassant_target==h6 && src.squares[idx-1]=='P' )
+        else if( enpassant_target==h6 && src[idx-1]=='P' )
             swap = true;
-        else if( src.squares[idx-1]=='P' || src.squares[idx+1]=='P' )
-            // BUG! src.enpassant_target can be a6 or h6 in this clause
+        else if( src[idx-1]=='P' || src[idx+1]=='P' )
+            // BUG! enpassant_target can be a6 or h6 in this clause
             swap = true;
         if( swap )
         {
-            src.squares[idx] = src.squares[idx-24]; // store 1st rank
-            src.squares[idx-24] = 'p';              // indicate ep
+            src[idx] = src[idx-24]; // store 1st rank
+            src[idx-24] = 'p';      // indicate ep
         }
     }
 
     // Black captures enpassant on a3,b3...h3
-    else if( !src.white && a3<=src.enpassant_target && src.enpassant_target<=h3 )
+    else if( !white && a3<=enpassant_target && enpassant_target<=h3 )
     {
-        int idx = src.enpassant_target-8; //idx = NORTH(src.enpassant_target)
-        if( src.enpassant_target==a3 && src.squares[idx+1]=='p' )
+        int idx = enpassant_target-8; //idx = NORTH(enpassant_target)
+        if( enpassant_target==a3 && src[idx+1]=='p' )
             swap = true;
-        else if( src.enpassant_target==h3 && src.squares[idx-1]=='p' )
+        else if( enpassant_target==h3 && src[idx-1]=='p' )
             swap = true;
-        else if( src.squares[idx-1]=='p' || src.squares[idx+1]=='p' )
-            // BUG! src.enpassant_target can be a3 or h3 in this clause
+        else if( src[idx-1]=='p' || src[idx+1]=='p' )
+            // BUG! enpassant_target can be a3 or h3 in this clause
             swap = true;
         if( swap )
         {
-            src.squares[idx] = src.squares[idx+24]; // store 1st rank
-            src.squares[idx+24] = 'P';              // indicate ep
+            src[idx] = src[idx+24]; // store 1st rank
+            src[idx+24] = 'P';      // indicate ep
         }
     }
     #endif
 
-
-    // Encode empty square with 2 bits, and other 12 possibilities with
-    //  all the other possible nibbles that don't start with those 2 bits
-    #define CEMPTY      2   // 10
-    #define CWROOK      0   // 0000
-    #define CWKNIGHT    1   // 0001
-    #define CWBISHOP    2   // 0010
-    #define CWQUEEN     3   // 0011
-    #define CWKING      4   // 0100
-    #define CWPAWN      5   // 0101
-    #define CBROOK      6   // 0110
-    #define CBKNIGHT    7   // 0111
-    #define CBBISHOP   12   // 1100
-    #define CBQUEEN    13   // 1101
-    #define CBKING     14   // 1110
-    #define CBPAWN     15   // 1111
-
-    unsigned char c, *p, *base;
-    int bit=7;
-    base = p = dst.storage;
-    bool second_king=false;
-    int kings=0;
-    bool err=false;
-    for( i=0; !err && i<64; i++ )
+    // Shift 2 or 4 bits per square into a buffer, most significant first,
+    //  then keep at most 24 bytes (a legal position has at most 32 men). A
+    //  byte is stored every time, and kept only if it's complete, so there
+    //  are no hard to predict branches. The code table is built on first
+    //  use (not during static initialisation, when another translation
+    //  unit might already be calling Compress())
+    static const COMPRESS_CODES compress_codes;
+    unsigned char buf[40];
+    int nbr = 0;
+    uint64_t bits = 0;
+    int nbr_bits = 0;
+    int kings = 0;
+    for( i=0; i<64; i++ )
     {
-        if( p-base >= 24 )   // never need more than 24 bytes in legal position
-        {
-            err = true;
-            break;
-        }
-        bool empty=false;
-        c = CEMPTY;
-        switch( src.squares[i] )
-        {
-            case 'R':   c = CWROOK;     break;
-            case 'N':   c = CWKNIGHT;   break;
-            case 'B':   c = CWBISHOP;   break;
-            case 'Q':   c = CWQUEEN;    break;
-            case 'K':   c = CWKING;     kings++; if( kings==2 ) second_king=true; break;
-            case 'P':   c = CWPAWN;     break;
-            case 'r':   c = CBROOK;     break;
-            case 'n':   c = CBKNIGHT;   break;
-            case 'b':   c = CBBISHOP;   break;
-            case 'q':   c = CBQUEEN;    break;
-            case 'k':   c = CBKING;     kings++; if( kings==2 ) second_king=true; break;
-            case 'p':   c = CBPAWN;     break;
-            case ' ':
-            default:    empty = true;   break;
-        }
+        unsigned char piece = (unsigned char)src[i];
+        unsigned int c = compress_codes.code[piece];
 
         // Encode black to move as two kings same colour (2 white kings if
         //  white king first, 2 black kings otherwise)
-        if( second_king )
-        {
-            second_king = false;
-            if( !src.white )
-            {
-                if( c == CBKING )
-                    c = CWKING;
-                else
-                    c = CBKING;
-            }
-        }
-
-        // Shift and mask 2 or 4 bits into storage
-        if( empty )
-        {
-            switch( bit )
-            {
-                case 7: *p = (CEMPTY<<6);
-                        bit = 5;
-                        break;
-                case 5: *p = (*p&0xc0) | (CEMPTY<<4);
-                        bit = 3;
-                        break;
-                case 3: *p = (*p&0xf0) | (CEMPTY<<2);
-                        bit = 1;
-                        break;
-                case 1: *p = (*p&0xfc) | (CEMPTY);
-                        p++;
-                        bit = 7;
-                        break;
-            }
-        }
-        else
-        {
-            switch( bit )
-            {
-                case 7: *p = (c<<4);
-                        bit = 3;
-                        break;
-                case 5: *p = (*p&0xc0) | (c<<2);
-                        bit = 1;
-                        break;
-                case 3: *p = (*p&0xf0) | (c);
-                        p++;
-                        bit = 7;
-                        break;
-                case 1:
-                {
-                        *p = (*p&0xfc) | ((c>>2)&0x03);
-                        p++;
-                        if( p-base >= 24 )
-                            err = true;
-                        else
-                        {
-                            *p = ((c<<6)&0xc0);
-                            bit = 5;
-                        }
-                        break;
-                }
-            }
-        }
+        if( (piece=='K' || piece=='k') && ++kings==2 && !white )
+            c ^= (CWKING^CBKING);
+        int n = compress_codes.nbr_bits[piece];
+        bits = (bits<<n) | c;
+        nbr_bits += n;
+        buf[nbr] = (unsigned char)((bits<<8) >> nbr_bits);
+        nbr += (nbr_bits>>3);
+        nbr_bits &= 7;
     }
+    if( nbr_bits > 0 )
+        buf[nbr++] = (unsigned char)(bits << (8-nbr_bits));
+    if( nbr > (int)sizeof(dst.storage) )
+        nbr = sizeof(dst.storage);
+    memcpy( dst.storage, buf, nbr );
+    memset( dst.storage+nbr, 0, sizeof(dst.storage)-nbr );
 
     // Create hash
     unsigned int big_hash = 0;
@@ -1737,6 +1907,77 @@ void ChessPosition::Decompress( const CompressedPosition &src )
             bqueen = true;
         }
     }
+    BitboardsCalculate();
+}
+
+/****************************************************************************
+ * Recalculate bitboards from squares[]
+ ****************************************************************************/
+void ChessPosition::BitboardsCalculate()
+{
+    static bool tables_ready = bitboard_tables_init();  // first time only
+    (void)tables_ready;
+    memset( bb_pieces, 0, sizeof(bb_pieces) );
+    bb_white = 0;
+    bb_black = 0;
+    for( Square square=a8; square<=h1; ++square )
+    {
+        int idx = bb_index[ squares[square] & 0x7f ];
+        if( idx != BB_NBR )
+        {
+            bb_pieces[idx] |= BB(square);
+            if( idx < BB_BPAWN )
+                bb_white |= BB(square);
+            else
+                bb_black |= BB(square);
+        }
+    }
+    KeysCalculate();
+}
+
+/****************************************************************************
+ * Recalculate Zobrist keys
+ ****************************************************************************/
+void ChessPosition::KeysCalculate()
+{
+    key          = KeyCastlingEnpassant() ^ (white ? zobrist_white : 0);
+    pawn_key     = 0;
+    material_key = 0;
+    for( int idx=0; idx<BB_NBR; idx++ )
+    {
+        int count = 0;
+        for( Bitboard bb=bb_pieces[idx]; bb; count++ )
+        {
+            uint64_t z = zobrist_pieces[idx][bb_pop_lsb(bb)];
+            key ^= z;
+            if( idx==BB_WPAWN || idx==BB_BPAWN )
+                pawn_key ^= z;
+            material_key ^= zobrist_pieces[idx][count];  // index by count, not square
+        }
+    }
+}
+
+/****************************************************************************
+ * Zobrist key for castling and en passant possibilities
+ ****************************************************************************/
+uint64_t ChessPosition::KeyCastlingEnpassant() const
+{
+    uint64_t z = 0;
+    if( wking || wqueen || bking || bqueen )    // quick check first, usually false
+    {
+        int castling = (wking_allowed()  ? 1 : 0) |
+                       (wqueen_allowed() ? 2 : 0) |
+                       (bking_allowed()  ? 4 : 0) |
+                       (bqueen_allowed() ? 8 : 0);
+        z = zobrist_castling[castling];
+    }
+    if( enpassant_target != SQUARE_INVALID )
+    {
+        Square ep = groomed_enpassant_target();
+        if( ep != SQUARE_INVALID )
+            z ^= zobrist_enpassant[IFILE(ep)];
+    }
+    return z;
 }
 
 /****************************************************************************
@@ -2125,6 +2366,32 @@ static unsigned char castling_prohibited_table[] =
     (unsigned char)(~(WQUEEN+WKING)),  0xff, 0xff, (unsigned char)(~WKING)  // e1-h1
 };
 
+// Toggle a piece on or off square(s) in the bitboards and Zobrist keys. A
+//  mask with one square adds or removes a piece, a mask with two squares
+//  moves one
+static inline void bb_toggle( ChessPosition *cp, char piece, Bitboard mask )
+{
+    int idx = bb_index[(int)piece];
+    cp->bb_pieces[idx] ^= mask;
+    if( idx < BB_BPAWN )
+        cp->bb_white ^= mask;
+    else
+        cp->bb_black ^= mask;
+    uint64_t z = 0;
+    for( Bitboard bb=mask; bb; )
+        z ^= zobrist_pieces[idx][bb_pop_lsb(bb)];
+    cp->key ^= z;
+    if( idx==BB_WPAWN || idx==BB_BPAWN )
+        cp->pawn_key ^= z;
+    if( !(mask & (mask-1)) )
+    {
+        int count = bb_popcount( cp->bb_pieces[idx] );    // count after toggle
+        if( cp->bb_pieces[idx] & mask )
+            count--;                                        // added
+        cp->material_key ^= zobrist_pieces[idx][count];
+    }
+}
+
 /****************************************************************************
  * Test internals, for porting to new environments etc
  *   For the moment at least, this is best used by stepping through it
@@ -2213,8 +2480,9 @@ bool ChessRules::TestInternals( int (*log)(const char *,...) )
     log( " &half_move_clock = 0x%p\n",             &half_move_clock );
     log( " &full_move_count = 0x%p\n",             &full_move_count );
     log( " size to end of full_move_count = %lu", ((char *)&full_move_count - (char *)this) + sizeof(full_move_count) );
-    log( " sizeof(ChessPosition) = %lu (should be 4 more than size to end of full_move_count)\n",
-           sizeof(ChessPosition) );
+    log( " sizeof(ChessPositionRaw) = %lu (should be 4 more than size to end of full_move_count)\n",
+           sizeof(ChessPositionRaw) );
+    log( " sizeof(ChessPosition) = %lu\n",         sizeof(ChessPosition) );
     log( " sizeof(Move) = %lu\n",                  sizeof(Move) );
 
     log( " sizeof(ChessPositionRaw) = %lu\n", sizeof(ChessPositionRaw) );
@@ -2282,8 +2550,71 @@ bool ChessRules::TestInternals( int (*log)(const char *,...) )
                bqueen?"true":"false" );
     }
 
+    // PackedMove should round trip every legal move, including en passant,
+    //  castling and promotions (with and without capture)
+    bool packed_ok = true;
+    const char *packed_fens[] =
+    {
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+        "r3k2r/1P4P1/8/2pP4/8/8/1p4p1/R3K2R w KQkq c6 0 1",
+        "r3k2r/1P4P1/8/8/3pP3/8/1p4p1/R3K2R b KQkq e3 0 1"
+    };
+    for( unsigned int i=0; i<sizeof(packed_fens)/sizeof(packed_fens[0]); i++ )
+    {
+        Forsyth( packed_fens[i] );
+        MOVELIST list;
+        GenLegalMoveList( &list );
+        for( int j=0; j<list.count; j++ )
+        {
+            PackedMove packed;
+            packed.Pack( list.moves[j] );
+            if( !packed.Valid() || packed.Unpack(*this) != list.moves[j] )
+                packed_ok = false;
+        }
+    }
+
+    // Corrupt PackedMoves are invalid, src==dst, unknown specials and
+    //  specials that don't fit the squares
+    const uint16_t corrupt[] =
+    {
+        0,
+        (uint16_t)(e2 | (e2<<6)),
+        (uint16_t)(e2 | (e4<<6) | (14<<12)),
+        (uint16_t)(e2 | (e4<<6) | (15<<12)),
+        (uint16_t)(d1 | (g1<<6) | (SPECIAL_WK_CASTLING<<12)),
+        (uint16_t)(e4 | (e5<<6) | (SPECIAL_PROMOTION_QUEEN<<12)),
+        (uint16_t)(e3 | (e5<<6) | (SPECIAL_WPAWN_2SQUARES<<12)),
+        (uint16_t)(e5 | (d6<<6) | (SPECIAL_BEN_PASSANT<<12))
+    };
+    for( unsigned int i=0; i<sizeof(corrupt)/sizeof(corrupt[0]); i++ )
+    {
+        PackedMove packed;
+        packed.bits = corrupt[i];
+        if( packed.Valid() )
+            packed_ok = false;
+    }
+    log( "PackedMove round trip %s\n", packed_ok ? "okay" : "failed" );
+
+    // Repetitions are found however far back they are. Shuffle knights out
+    //  and back for 300 plies (the initial position comes round every 4),
+    //  then undo it all
+    Forsyth( "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1" );
+    Init();
+    const char *shuffle[] = { "g1f3", "g8f6", "f3g1", "f6g8" };
+    Move shuffle_moves[300];
+    for( int i=0; i<300; i++ )
+    {
+        shuffle_moves[i].TerseIn( this, shuffle[i%4] );
+        PushMove( shuffle_moves[i] );
+    }
+    bool repetition_ok = (GetRepetitionCount() == 76);
+    for( int i=299; i>=0; i-- )
+        PopMove( shuffle_moves[i] );
+    repetition_ok = repetition_ok && GetRepetitionCount()==1 && reversible_plies==0;
+    log( "Repetition count %s\n", repetition_ok ? "okay" : "failed" );
+
     // Later, extend this to check addresses etc
-    return KQkq_allowed && Qkq_allowed && Qq_allowed && q_allowed && none_allowed && kq_allowed && none_allowed2 &&
+    return repetition_ok && packed_ok && KQkq_allowed && Qkq_allowed && Qq_allowed && q_allowed && none_allowed && kq_allowed && none_allowed2 &&
            KQkq_allowed_f && Qkq_allowed_f && Qq_allowed_f && q_allowed_f && none_allowed_f && kq_allowed_f && none_allowed2_f;
 }
 
@@ -2351,265 +2682,640 @@ void ChessRules::GenLegalMoveList( vector<Move>  &moves,
 void ChessRules::GenLegalMoveList( MOVELIST *list )
 {
     int i, j;
-    bool okay;
-    MOVELIST list2;
 
     // Generate all moves, including illegal (e.g. put king in check) moves
-    GenMoveList( &list2 );
-
-    // Loop copying the proven good ones
-    for( i=j=0; i<list2.count; i++ )
+    GenMoveList( list );
+
+    // Loop keeping the legal ones. Most moves only need the pinned and
+    //  evasion masks, so that test is done here, the rest are left to
+    //  PseudoLegalIsLegal()
+    Bitboard pinned, evasions;
+    LegalityMasks( pinned, evasions );
+    Square king_square = (Square)(white ? wking_square : bking_square);
+    bool king_present  = (squares[king_square] == (white ? 'K' : 'k'));
+    for( i=j=0; i<list->count; i++ )
     {
-        PushMove( list2.moves[i] );
-        okay = Evaluate();
-        PopMove( list2.moves[i] );
+        Move mv = list->moves[i];
+        bool okay;
+        if( king_present && mv.src!=king_square &&
+            mv.special!=SPECIAL_WEN_PASSANT && mv.special!=SPECIAL_BEN_PASSANT )
+        {
+            okay = (evasions & BB(mv.dst)) &&
+                   ( !(pinned & BB(mv.src)) || (line_bb[king_square][mv.src] & BB(mv.dst)) );
+        }
+        else
+            okay = PseudoLegalIsLegal( mv, pinned, evasions );
         if( okay )
-            list->moves[j++] = list2.moves[i];
+            list->moves[j++] = mv;
     }
     list->count  = j;
 }
 
 /****************************************************************************
- * Create a list of all legal moves in this position, with extra info
+ * Find the men pinned against our king, and the squares a man other than
+ *  the king must move to if we are in check (all squares if not in check,
+ *  no squares in double check)
  ****************************************************************************/
-void ChessRules::GenLegalMoveList( MOVELIST *list, bool check[MAXMOVES],
-                                                    bool mate[MAXMOVES],
-                                                    bool stalemate[MAXMOVES] )
-{
-    int i, j;
-    bool okay;
-    TERMINAL terminal_score;
-    MOVELIST list2;
-
-    // Generate all moves, including illegal (e.g. put king in check) moves
-    GenMoveList( &list2 );
-
-    // Loop copying the proven good ones
-    for( i=j=0; i<list2.count; i++ )
+void ChessRules::LegalityMasks( Bitboard &pinned, Bitboard &evasions )
+{
+    Square king_square = (Square)(white ? wking_square : bking_square);
+    pinned   = 0;
+    evasions = ~(Bitboard)0;
+    if( squares[king_square] != (white ? 'K' : 'k') )
+        return;
+    Bitboard occupied = bb_occupied();
+    Bitboard ours     = (white ? bb_white : bb_black);
+    const Bitboard *enemy = &bb_pieces[ white ? BB_BPAWN : BB_WPAWN ];
+    Bitboard checkers = AttackersTo( king_square, !white, occupied );
+    Bitboard snipers  = (bishop_attacks_bb(king_square,occupied&~ours) & (enemy[BB_WBISHOP]|enemy[BB_WQUEEN]))
+                      | (rook_attacks_bb  (king_square,occupied&~ours) & (enemy[BB_WROOK]  |enemy[BB_WQUEEN]));
+    while( snipers )
     {
-        PushMove( list2.moves[i] );
-        okay = Evaluate(terminal_score);
-        Square king_to_move = (Square)(white ? wking_square : bking_square );
-        bool bcheck = false;
-        if( AttackedPiece(king_to_move) )
-            bcheck = true;
-        PopMove( list2.moves[i] );
-        if( okay )
-        {
-            stalemate[j] = (terminal_score==TERMINAL_WSTALEMATE ||
-                            terminal_score==TERMINAL_BSTALEMATE);
-            mate[j]      = (terminal_score==TERMINAL_WCHECKMATE ||
-                            terminal_score==TERMINAL_BCHECKMATE);
-            check[j]     = mate[j] ? false : bcheck;
-            list->moves[j++] = list2.moves[i];
-        }
+        Bitboard blockers = between_bb[king_square][bb_pop_lsb(snipers)] & occupied;
+        if( bb_popcount(blockers) == 1 )
+            pinned |= blockers;     // must be ours, enemy men were seen through
+    }
+    if( checkers )
+    {
+        Square checker = bb_lsb(checkers);
+        evasions = (checkers&(checkers-1)) ? 0 : (between_bb[king_square][checker] | checkers);
     }
-    list->count  = j;
 }
 
 /****************************************************************************
- * Check draw rules (50 move rule etc.)
+ * Is a pseudo-legal move (one from GenMoveList() etc.) legal ? Requires the
+ *  masks calculated by LegalityMasks() for this position
  ****************************************************************************/
-bool ChessRules::IsDraw( bool white_asks, DRAWTYPE &result )
+bool ChessRules::PseudoLegalIsLegal( Move mv, Bitboard pinned, Bitboard evasions )
 {
-    bool   draw=false;
-
-    // Insufficient mating material
-    draw =  IsInsufficientDraw( white_asks, result );
+    Square king_square = (Square)(white ? wking_square : bking_square);
+    bool okay;
 
-    // 50 move rule
-    if( !draw && half_move_clock>=100 )
+    // Without a king in place there are no pins or checks to work with, so
+    //  fall back to proving the move by playing it
+    if( squares[king_square] != (white ? 'K' : 'k') )
     {
-        result = DRAWTYPE_50MOVE;
-        draw = true;
+        PushMove( mv );
+        okay = Evaluate();
+        PopMove( mv );
     }
-
-    // 3 times repetition,
-    if( !draw && GetRepetitionCount()>=3 )
+    else if( mv.src == king_square )
     {
-        result = DRAWTYPE_REPITITION;
-        draw = true;
+        // Castling already checks king isn't in or passing through check,
+        //  otherwise the destination mustn't be attacked with the king gone
+        okay = (mv.special!=SPECIAL_KING_MOVE ||
+                !AttackersTo( mv.dst, !white, bb_occupied() & ~BB(king_square) ));
+    }
+    else if( mv.special==SPECIAL_WEN_PASSANT || mv.special==SPECIAL_BEN_PASSANT )
+    {
+        // En passant clears two squares on a rank, rare enough to just
+        //  play the move to check it
+        PushMove( mv );
+        okay = !AttackedPiece( king_square );
+        PopMove( mv );
+    }
+    else
+    {
+        okay = (evasions & BB(mv.dst)) &&
+               ( !(pinned & BB(mv.src)) || (line_bb[king_square][mv.src] & BB(mv.dst)) );
     }
+    return okay;
+}
 
-    if( !draw )
-        result = NOT_DRAW;
-    return( draw );
+/****************************************************************************
+ * Is a move legal in this position ? (without generating all the moves)
+ ****************************************************************************/
+bool ChessRules::IsLegalMove( Move mv )
+{
+    if( !IsPseudoLegal(mv) )
+        return false;
+    Bitboard pinned, evasions;
+    LegalityMasks( pinned, evasions );
+    return PseudoLegalIsLegal( mv, pinned, evasions );
 }
 
 /****************************************************************************
- * Get number of times position has been repeated
+ * Count the legal moves in this position, without generating them
  ****************************************************************************/
-int ChessRules::GetRepetitionCount()
+int ChessRules::CountLegalMoves()
 {
-    int matches=0;
-
-    //  Save those aspects of current position that are changed by multiple
-    //  PopMove() calls as we search backwards (i.e. squares, white,
-    //  detail, detail_idx)
-    char save_squares[sizeof(squares)];
-    memcpy( save_squares, squares, sizeof(save_squares) );
-    unsigned char save_detail_idx = detail_idx;  // must be unsigned char
-    bool          save_white      = white;
-    unsigned char idx             = history_idx; // must be unsigned char
-    DETAIL_SAVE;
-
-    // Search backwards ....
-    int nbr_half_moves = (full_move_count-1)*2 + (!white?1:0);
-    if( nbr_half_moves > nbrof(history)-1 )
-        nbr_half_moves = nbrof(history)-1;
-    if( nbr_half_moves > nbrof(detail_stack)-1 )
-        nbr_half_moves = nbrof(detail_stack)-1;
-    for( int i=0; i<nbr_half_moves; i++ )
-    {
-        Move m = history[--idx];
-        if( m.src == m.dst )
-            break;  // unused history is set to zeroed memory
-        PopMove(m);
-
-        // ... looking for matching positions
-        if( white    == save_white      && // quick ones first!
-            DETAIL_EQ_KING_POSITIONS    &&
-            0 == memcmp(squares,save_squares,sizeof(squares) )
-            )
-        {
-            matches++;
-            if( !DETAIL_EQ_ALL )    // Castling flags and/or enpassant target different?
-            {
-                // It might not be a match (but it could be - we have to unpack what the differences
-                //  really mean)
-                bool revoke_match = false;
+    return LegalMoveCount( false );
+}
 
-                // Revoke match if different value of en-passant target square means different
-                //  en passant possibilities
-                if( !DETAIL_EQ_EN_PASSANT )
-                {
-                    int ep_saved = (int)(tmp&0xff);
-                    int ep_now   = (int)(*DETAIL_ADDR&0xff);
-
-                    // Work out whether each en_passant is a real one, i.e. is there an opposition
-                    //  pawn in place to capture (if not it's just a double pawn advance with no
-                    //  actual enpassant consequences)
-                    bool real=false;
-                    int ep = ep_saved;
-                    char const *squ = save_squares;
-                    for( int j=0; j<2; j++ )
-                    {
-                        if( ep == 0x10 )    // 0x10 = a6
-                        {
-                             real = (squ[SE(ep)] == 'P');
-                        }
-                        else if( 0x10<ep && ep<0x17 )   // 0x10 = h6
-                        {
-                             real = (squ[SW(ep)] == 'P' || squ[SE(ep)] == 'P');
-                        }
-                        else if( ep==0x17 )
-                        {
-                             real = (squ[SW(ep)] == 'P');
-                        }
-                        else if( 0x28==ep )   // 0x28 = a3
-                        {
-                             real = (squ[NE(ep)] == 'p');
-                        }
-                        else if( 0x28<ep && ep<0x2f )   // 0x2f = h3
-                        {
-                             real = (squ[NE(ep)] == 'p' || squ[NW(ep)] == 'p');
-                        }
-                        else if( ep==0x2f )
-                        {
-                             real = (squ[NW(ep)] == 'p' );
-                        }
-                        if( j > 0 )
-                            ep_now = real?ep:0x40;      // evaluate second time through
-                        else
-                        {
-                            ep_saved = real?ep:0x40;    // evaluate first time through
-                            ep = ep_now;                // setup second time through
-                            squ = squares;
-                            real = false;
-                        }
-                    }
+/****************************************************************************
+ * Is there at least one legal move ?
+ ****************************************************************************/
+bool ChessRules::HasLegalMove()
+{
+    return LegalMoveCount( true ) > 0;
+}
 
-                    // If for example one en_passant is real and the other not, it's not a real match
-                    if( ep_saved != ep_now )
-                        revoke_match = true;
-                }
+/****************************************************************************
+ * Count legal moves, optionally stopping at the first one. The destination
+ *  squares of each man are worked out as a bitboard and counted, so no
+ *  Move objects are made, except for the rare castling and en passant moves
+ ****************************************************************************/
+int ChessRules::LegalMoveCount( bool stop_at_first )
+{
+    Square king_square = (Square)(white ? wking_square : bking_square);
+    const Bitboard *ours_bb = &bb_pieces[ white ? BB_WPAWN : BB_BPAWN ];
+    const Bitboard back_ranks = 0xff000000000000ffULL;
 
-                // Revoke match if different value of castling flags means different
-                //  castling possibilities
-                if( !revoke_match && !DETAIL_EQ_CASTLING )
-                {
-                    bool wking_saved  = save_squares[e1]=='K' && save_squares[h1]=='R' && (int)(tmp&(WKING<<24));
-                    bool wking_now    = squares[e1]=='K' && squares[h1]=='R' && (int)(*DETAIL_ADDR&(WKING<<24));
-                    bool bking_saved  = save_squares[e8]=='k' && save_squares[h8]=='r' && (int)(tmp&(BKING<<24));
-                    bool bking_now    = squares[e8]=='k' && squares[h8]=='r' && (int)(*DETAIL_ADDR&(BKING<<24));
-                    bool wqueen_saved = save_squares[e1]=='K' && save_squares[a1]=='R' && (int)(tmp&(WQUEEN<<24));
-                    bool wqueen_now   = squares[e1]=='K' && squares[a1]=='R' && (int)(*DETAIL_ADDR&(WQUEEN<<24));
-                    bool bqueen_saved = save_squares[e8]=='k' && save_squares[a8]=='r' && (int)(tmp&(BQUEEN<<24));
-                    bool bqueen_now   = squares[e8]=='k' && squares[a8]=='r' && (int)(*DETAIL_ADDR&(BQUEEN<<24));
-                    revoke_match = ( wking_saved != wking_now ||
-                                     bking_saved != bking_now ||
-                                     wqueen_saved != wqueen_now ||
-                                     bqueen_saved != bqueen_now );
-                }
+    // Unusual positions (no king, extra kings, pawns on the first or last
+    //  rank) are left to the full move generator
+    if( squares[king_square] != (white ? 'K' : 'k') || ours_bb[BB_WKING] != BB(king_square) ||
+        ((bb_pieces[BB_WPAWN]|bb_pieces[BB_BPAWN]) & back_ranks) )
+    {
+        MOVELIST list;
+        GenLegalMoveList( &list );
+        return list.count;
+    }
+    Bitboard pinned, evasions;
+    LegalityMasks( pinned, evasions );
+    Bitboard occupied = bb_occupied();
+    Bitboard ours     = (white ? bb_white : bb_black);
+    Bitboard theirs   = (white ? bb_black : bb_white);
+    int count = 0;
+
+    // King moves, the only moves possible in double check
+    Bitboard targets = king_attacks_bb[king_square] & ~ours;
+    while( targets )
+    {
+        if( !AttackersTo( bb_pop_lsb(targets), !white, occupied & ~BB(king_square) ) )
+        {
+            count++;
+            if( stop_at_first )
+                return count;
+        }
+    }
+    if( !evasions )
+        return count;
+    MOVELIST special;
+    special.count = 0;
+    CastlingMoves( &special, king_square );
+    count += special.count;
+    if( stop_at_first && count )
+        return count;
+
+    // Knights, bishops, rooks and queens. A pinned man can only move along
+    //  the line through the king and the pinner (so a pinned knight can't
+    //  move at all)
+    Bitboard men = ours & ~ours_bb[BB_WPAWN] & ~ours_bb[BB_WKING];
+    while( men )
+    {
+        Square square = bb_pop_lsb(men);
+        switch( squares[square] )
+        {
+            case 'N':
+            case 'n':   targets = knight_attacks_bb[square];                 break;
+            case 'B':
+            case 'b':   targets = bishop_attacks_bb(square,occupied);        break;
+            case 'R':
+            case 'r':   targets = rook_attacks_bb(square,occupied);          break;
+            default:    targets = queen_attacks_bb(square,occupied);         break;
+        }
+        targets &= ~ours & evasions;
+        if( pinned & BB(square) )
+            targets &= line_bb[king_square][square];
+        count += bb_popcount(targets);
+        if( stop_at_first && count )
+            return count;
+    }
 
-                // If the real castling or enpassant possibilities differ, it's not a match
-                //  At one stage we just did a naive binary match of the details - not good enough. For example
-                //  a rook moving away from h1 doesn't affect the WKING flag, but does disallow white king side
-                //  castling
-                if( revoke_match )
-                     matches--;
-            }
+    // Pawns, promotions count four times. En passant is generated whenever
+    //  a pawn attacks the en passant target (as in GenMoveList()) and is
+    //  checked by playing it
+    Bitboard enpassant = ((unsigned int)enpassant_target<=(unsigned int)h1 ? BB(enpassant_target) : 0);
+    men = ours_bb[BB_WPAWN];
+    while( men )
+    {
+        Square square = bb_pop_lsb(men);
+        Bitboard attacks = (white ? pawn_white_attacks_bb[square] : pawn_black_attacks_bb[square]);
+        targets = attacks & theirs & ~enpassant;
+        Square ahead = (white ? NORTH(square) : SOUTH(square));
+        if( IsEmptySquare(squares[ahead]) )
+        {
+            targets |= BB(ahead);
+            Square ahead2 = (white ? NORTH(ahead) : SOUTH(ahead));
+            if( RANK(square)==(white?'2':'7') && IsEmptySquare(squares[ahead2]) )
+                targets |= BB(ahead2);
         }
+        targets &= evasions;
+        if( pinned & BB(square) )
+            targets &= line_bb[king_square][square];
+        count += bb_popcount(targets) * (RANK(square)==(white?'7':'2') ? 4 : 1);
+        if( attacks & enpassant )
+        {
+            Move mv;
+            mv.src     = square;
+            mv.dst     = (Square)enpassant_target;
+            mv.special = (white ? SPECIAL_WEN_PASSANT : SPECIAL_BEN_PASSANT);
+            mv.capture = (white ? 'p' : 'P');
+            if( PseudoLegalIsLegal( mv, pinned, evasions ) )
+                count++;
+        }
+        if( stop_at_first && count )
+            return count;
+    }
+    return count;
+}
 
-        // For performance reasons, abandon search early if pawn move
-        //  or capture
-        if( squares[m.src]=='P' || squares[m.src]=='p' || !IsEmptySquare(m.capture) )
+/****************************************************************************
+ * Could a move have been generated by GenMoveList() in this position ? (ie
+ *  is it legal apart from possibly leaving the king in check)
+ ****************************************************************************/
+bool ChessRules::IsPseudoLegal( Move mv )
+{
+    if( (unsigned int)mv.src>(unsigned int)h1 || (unsigned int)mv.dst>(unsigned int)h1 )
+        return false;
+    char piece  = squares[mv.src];
+    char target = squares[mv.dst];
+    if( !(white ? IsWhite(piece) : IsBlack(piece)) )
+        return false;
+    if( (white ? bb_white : bb_black) & BB(mv.dst) )
+        return false;
+    char pawn = (white ? 'P' : 'p');
+    Bitboard pawn_attacks = (white ? pawn_white_attacks_bb[mv.src] : pawn_black_attacks_bb[mv.src]);
+    Square ahead = (white ? NORTH(mv.src) : SOUTH(mv.src));
+    bool seventh = (RANK(mv.src) == (white?'7':'2'));
+
+    // En passant is the only case where the captured man isn't on the
+    //  destination square
+    if( mv.special==SPECIAL_WEN_PASSANT || mv.special==SPECIAL_BEN_PASSANT )
+    {
+        return mv.special == (white ? SPECIAL_WEN_PASSANT : SPECIAL_BEN_PASSANT) &&
+               piece == pawn && mv.dst == enpassant_target &&
+               mv.capture == (white ? 'p' : 'P') && (pawn_attacks & BB(mv.dst));
+    }
+    if( mv.capture != target )
+        return false;
+    switch( mv.special )
+    {
+        case NOT_SPECIAL:
+        {
+            Bitboard occupied = bb_occupied();
+            switch( piece )
+            {
+                case 'P':
+                case 'p':
+                    return !seventh &&
+                           ( (mv.dst==ahead && IsEmptySquare(target)) ||
+                             ((pawn_attacks & BB(mv.dst)) && !IsEmptySquare(target)) );
+                case 'N':
+                case 'n':   return (knight_attacks_bb[mv.src] & BB(mv.dst)) != 0;
+                case 'B':
+                case 'b':   return (bishop_attacks_bb(mv.src,occupied) & BB(mv.dst)) != 0;
+                case 'R':
+                case 'r':   return (rook_attacks_bb(mv.src,occupied) & BB(mv.dst)) != 0;
+                case 'Q':
+                case 'q':   return (queen_attacks_bb(mv.src,occupied) & BB(mv.dst)) != 0;
+            }
+            return false;   // king moves are always SPECIAL_KING_MOVE
+        }
+        case SPECIAL_KING_MOVE:
+            return piece == (white ? 'K' : 'k') && (king_attacks_bb[mv.src] & BB(mv.dst));
+        case SPECIAL_WK_CASTLING:
+        case SPECIAL_BK_CASTLING:
+        case SPECIAL_WQ_CASTLING:
+        case SPECIAL_BQ_CASTLING:
+        {
+            if( piece != (white ? 'K' : 'k') )
+                return false;
+            MOVELIST castling;
+            castling.count = 0;
+            CastlingMoves( &castling, mv.src );
+            for( int i=0; i<castling.count; i++ )
+            {
+                if( castling.moves[i] == mv )
+                    return true;
+            }
+            return false;
+        }
+        case SPECIAL_PROMOTION_QUEEN:
+        case SPECIAL_PROMOTION_ROOK:
+        case SPECIAL_PROMOTION_BISHOP:
+        case SPECIAL_PROMOTION_KNIGHT:
+            return piece == pawn && seventh &&
+                   ( (mv.dst==ahead && IsEmptySquare(target)) ||
+                     ((pawn_attacks & BB(mv.dst)) && !IsEmptySquare(target)) );
+        case SPECIAL_WPAWN_2SQUARES:
+        case SPECIAL_BPAWN_2SQUARES:
+            return mv.special == (white ? SPECIAL_WPAWN_2SQUARES : SPECIAL_BPAWN_2SQUARES) &&
+                   piece == pawn && RANK(mv.src) == (white?'2':'7') &&
+                   IsEmptySquare(squares[ahead]) && IsEmptySquare(target) &&
+                   mv.dst == (white ? NORTH(ahead) : SOUTH(ahead));
+        default:
             break;
     }
+    return false;
+}
 
-    // Restore current position
-    memcpy( squares, save_squares, sizeof(squares) );
-    white      = save_white;
-    detail_idx = save_detail_idx;
-    DETAIL_RESTORE;
-    return( matches+1 );  // +1 counts original position
+/****************************************************************************
+ * Create a list of all legal moves in this position, with extra info
+ ****************************************************************************/
+void ChessRules::GenLegalMoveList( MOVELIST *list, bool check[MAXMOVES],
+                                                    bool mate[MAXMOVES],
+                                                    bool stalemate[MAXMOVES] )
+{
+    GenLegalMoveList( list );
+    GenCheckInfo( *list, check, mate, stalemate );
 }
 
 /****************************************************************************
- * Check insufficient material draw rule
+ * Find whether each of a list of legal moves gives check, mate or stalemate
  ****************************************************************************/
-bool ChessRules::IsInsufficientDraw( bool white_asks, DRAWTYPE &result )
+void ChessRules::GenCheckInfo( const MOVELIST &list, bool check[], bool mate[], bool stalemate[] )
 {
-    char   piece;
-    int    piece_count=0;
-    bool   bishop_or_knight=false, lone_wking=true, lone_bking=true;
-    bool   draw=false;
+    Square enemy_king = (Square)(white ? bking_square : wking_square);
+    const Bitboard *ours_bb   = &bb_pieces[ white ? BB_WPAWN : BB_BPAWN ];
+    const Bitboard *theirs_bb = &bb_pieces[ white ? BB_BPAWN : BB_WPAWN ];
+    const Bitboard back_ranks = 0xff000000000000ffULL;
+
+    // Unusual positions (no king, extra kings, pawns on the first or last
+    //  rank), play each move in turn to get the extra info
+    if( squares[enemy_king] != (white ? 'k' : 'K') || theirs_bb[BB_WKING] != BB(enemy_king) ||
+        bb_popcount(ours_bb[BB_WKING]) != 1 || ((bb_pieces[BB_WPAWN]|bb_pieces[BB_BPAWN]) & back_ranks) )
+    {
+        TERMINAL terminal_score;
+        for( int i=0; i<list.count; i++ )
+        {
+            Move mv = list.moves[i];
+            PushMove( mv );
+            Evaluate(terminal_score);
+            Square king_to_move = (Square)(white ? wking_square : bking_square );
+            bool bcheck = false;
+            if( AttackedPiece(king_to_move) )
+                bcheck = true;
+            PopMove( mv );
+            stalemate[i] = (terminal_score==TERMINAL_WSTALEMATE ||
+                            terminal_score==TERMINAL_BSTALEMATE);
+            mate[i]      = (terminal_score==TERMINAL_WCHECKMATE ||
+                            terminal_score==TERMINAL_BCHECKMATE);
+            check[i]     = mate[i] ? false : bcheck;
+        }
+        return;
+    }
+    Bitboard occupied = bb_occupied();
+    Bitboard ours     = (white ? bb_white : bb_black);
+    Bitboard theirs   = (white ? bb_black : bb_white);
+
+    // The squares each type of our men give check from
+    Bitboard check_squares[6];
+    check_squares[BB_WPAWN]   = (white ? pawn_black_attacks_bb[enemy_king] : pawn_white_attacks_bb[enemy_king]);
+    check_squares[BB_WKNIGHT] = knight_attacks_bb[enemy_king];
+    check_squares[BB_WBISHOP] = bishop_attacks_bb(enemy_king,occupied);
+    check_squares[BB_WROOK]   = rook_attacks_bb(enemy_king,occupied);
+    check_squares[BB_WQUEEN]  = check_squares[BB_WBISHOP] | check_squares[BB_WROOK];
+    check_squares[BB_WKING]   = 0;
+
+    // A man standing alone between one of our long range men and the enemy
+    //  king is either ours, and moving it off the line discovers check, or
+    //  theirs, and it's pinned
+    Bitboard discoverers = 0, pinned = 0;
+    Bitboard snipers = (bishop_attacks_bb(enemy_king,0) & (ours_bb[BB_WBISHOP]|ours_bb[BB_WQUEEN]))
+                     | (rook_attacks_bb  (enemy_king,0) & (ours_bb[BB_WROOK]  |ours_bb[BB_WQUEEN]));
+    while( snipers )
+    {
+        Bitboard blockers = between_bb[enemy_king][bb_pop_lsb(snipers)] & occupied;
+        if( bb_popcount(blockers) == 1 )
+        {
+            if( blockers & ours )
+                discoverers |= blockers;
+            else
+                pinned |= blockers;
+        }
+    }
 
-    // Loop through the board
-    for( Square square=a8; square<=h1; ++square )
+    // Stalemate needs every one of their men to be stuck after our move.
+    //  An ordinary move that doesn't give check can take away the only
+    //  moves of at most six of their men, (by capturing one, pinning one on
+    //  each of the lines through its source and destination squares,
+    //  blocking a pawn, and moving away a man two pawns could capture), so
+    //  if they have seven unpinned men with moves now, stalemate is
+    //  impossible. Castling and en passant move or remove two men, so they
+    //  are always checked
+    enum { STALEMATE_PROOF=7 };
+    int mobile = 0;
+    Bitboard men = theirs & ~theirs_bb[BB_WKING] & ~pinned;
+    while( men && mobile<STALEMATE_PROOF )
     {
-        piece = squares[square];
-        switch( piece )
+        Square square = bb_pop_lsb(men);
+        Bitboard targets;
+        switch( squares[square] )
         {
-            case 'B':
-            case 'b':
+            case 'P':
+            case 'p':
+            {
+                Square ahead = (white ? SOUTH(square) : NORTH(square));
+                targets = (white ? pawn_black_attacks_bb[square] : pawn_white_attacks_bb[square]) & ours;
+                if( IsEmptySquare(squares[ahead]) )
+                    targets |= BB(ahead);
+                break;
+            }
             case 'N':
-            case 'n':       bishop_or_knight=true;  // and fall through
-            case 'Q':
-            case 'q':
+            case 'n':   targets = knight_attacks_bb[square] & ~theirs;                break;
+            case 'B':
+            case 'b':   targets = bishop_attacks_bb(square,occupied) & ~theirs;       break;
             case 'R':
-            case 'r':
-            case 'P':
-            case 'p':       piece_count++;
-                            if( isupper(piece) )
-                                lone_wking = false;
-                            else
-                                lone_bking = false;
-                            break;
+            case 'r':   targets = rook_attacks_bb(square,occupied) & ~theirs;         break;
+            default:    targets = queen_attacks_bb(square,occupied) & ~theirs;        break;
+        }
+        if( targets )
+            mobile++;
+    }
+
+    // Direct and discovered checks can be read off the bitboards, except for
+    //  the special moves that move or remove a second man (or change a man
+    //  into another), which are played to find out. Mate and stalemate are
+    //  only looked for if there's check, or stalemate is possible
+    for( int i=0; i<list.count; i++ )
+    {
+        Move mv = list.moves[i];
+        bool bcheck;
+        bool ordinary = (mv.special==NOT_SPECIAL || mv.special==SPECIAL_KING_MOVE ||
+                         mv.special==SPECIAL_WPAWN_2SQUARES || mv.special==SPECIAL_BPAWN_2SQUARES);
+        if( ordinary )
+        {
+            int idx = bb_index[ squares[mv.src] & 0x7f ] % BB_BPAWN;
+            bcheck = (check_squares[idx] & BB(mv.dst)) ||
+                     ((discoverers & BB(mv.src)) && !(line_bb[enemy_king][mv.src] & BB(mv.dst)));
+        }
+        else
+        {
+            PushMove( mv );
+            bcheck = AttackedPiece( enemy_king );
+            PopMove( mv );
+        }
+        bool no_moves = false;
+        bool castling_or_enpassant = !ordinary && (mv.special<SPECIAL_PROMOTION_QUEEN || mv.special>SPECIAL_PROMOTION_KNIGHT);
+        if( bcheck || mobile<STALEMATE_PROOF || castling_or_enpassant )
+        {
+            PushMove( mv );
+            no_moves = !HasLegalMove();
+            PopMove( mv );
+        }
+        mate[i]      = bcheck && no_moves;
+        stalemate[i] = !bcheck && no_moves;
+        check[i]     = bcheck && !no_moves;
+    }
+}
+
+/****************************************************************************
+ * Convert a list of legal moves to natural strings, eg "Nf3". One legal move
+ *  list and one table of the men of each type moving to each square serve
+ *  for disambiguation, and check and mate are found for all moves together
+ ****************************************************************************/
+void ChessRules::NaturalOutAll( const MOVELIST &list, char out[][NATURAL_MOVE_SIZE] )
+{
+    MOVELIST legal;
+    GenLegalMoveList( &legal );
+    bool check[MAXMOVES];
+    bool mate[MAXMOVES];
+    bool stalemate[MAXMOVES];
+    GenCheckInfo( list, check, mate, stalemate );
+
+    // sources[type][dst] = men of that type with a legal move to dst, only
+    //  the entries we use are cleared
+    Bitboard sources[BB_BPAWN][64];
+    for( int i=0; i<legal.count; i++ )
+    {
+        Move mv = legal.moves[i];
+        sources[ bb_index[squares[mv.src]&0x7f] % BB_BPAWN ][mv.dst] = 0;
+    }
+    for( int i=0; i<legal.count; i++ )
+    {
+        Move mv = legal.moves[i];
+        sources[ bb_index[squares[mv.src]&0x7f] % BB_BPAWN ][mv.dst] |= BB(mv.src);
+    }
+    for( int i=0; i<list.count; i++ )
+    {
+        Move mv = list.moves[i];
+        char *s = out[i];
+        char p  = (char)toupper(squares[mv.src]);
+        if( p == 'P' )
+        {
+            if( !IsEmptySquare(mv.capture) )
+            {
+                *s++ = FILE(mv.src);
+                *s++ = 'x';
+            }
+            *s++ = FILE(mv.dst);
+            *s++ = RANK(mv.dst);
+            const char *promotion = "";
+            switch( mv.special )
+            {
+                case SPECIAL_PROMOTION_QUEEN:   promotion = "=Q";   break;
+                case SPECIAL_PROMOTION_ROOK:    promotion = "=R";   break;
+                case SPECIAL_PROMOTION_BISHOP:  promotion = "=B";   break;
+                case SPECIAL_PROMOTION_KNIGHT:  promotion = "=N";   break;
+                default:                                            break;
+            }
+            while( *promotion )
+                *s++ = *promotion++;
+        }
+        else if( mv.special==SPECIAL_WK_CASTLING || mv.special==SPECIAL_BK_CASTLING )
+        {
+            strcpy( s, "O-O" );
+            s += 3;
+        }
+        else if( mv.special==SPECIAL_WQ_CASTLING || mv.special==SPECIAL_BQ_CASTLING )
+        {
+            strcpy( s, "O-O-O" );
+            s += 5;
+        }
+        else
+        {
+            // Disambiguate by file if that's enough, else by rank if that's
+            //  enough, else by both
+            Bitboard others = sources[ bb_index[squares[mv.src]&0x7f] % BB_BPAWN ][mv.dst] & ~BB(mv.src);
+            bool ambiguous = (others != 0);
+            bool same_file = false, same_rank = false;
+            while( others )
+            {
+                Square other = bb_pop_lsb(others);
+                if( FILE(other) == FILE(mv.src) )
+                    same_file = true;
+                if( RANK(other) == RANK(mv.src) )
+                    same_rank = true;
+            }
+            *s++ = p;
+            if( ambiguous && (!same_file || same_rank) )
+                *s++ = FILE(mv.src);
+            if( ambiguous && same_file )
+                *s++ = RANK(mv.src);
+            if( !IsEmptySquare(mv.capture) )
+                *s++ = 'x';
+            *s++ = FILE(mv.dst);
+            *s++ = RANK(mv.dst);
         }
-        if( !lone_wking && !lone_bking )
-            break;  // quit early for performance
+        if( mate[i] )
+            *s++ = '#';
+        else if( check[i] )
+            *s++ = '+';
+        *s = '\0';
+    }
+}
+
+/****************************************************************************
+ * Check draw rules (50 move rule etc.)
+ ****************************************************************************/
+bool ChessRules::IsDraw( bool white_asks, DRAWTYPE &result )
+{
+    bool   draw=false;
+
+    // Insufficient mating material
+    draw =  IsInsufficientDraw( white_asks, result );
+
+    // 50 move rule
+    if( !draw && half_move_clock>=100 )
+    {
+        result = DRAWTYPE_50MOVE;
+        draw = true;
+    }
+
+    // 3 times repetition,
+    if( !draw && GetRepetitionCount()>=3 )
+    {
+        result = DRAWTYPE_REPITITION;
+        draw = true;
+    }
+
+    if( !draw )
+        result = NOT_DRAW;
+    return( draw );
+}
+
+/****************************************************************************
+ * Get number of times position has been repeated
+ ****************************************************************************/
+int ChessRules::GetRepetitionCount()
+{
+    // Compare keys with the same side to move, going back no further than
+    //  the last pawn move or capture
+    int matches = 1;    // counts current position
+    for( int i=2; i<=reversible_plies && i<=key_history_len; i+=2 )
+    {
+        if( KeyHistoryKey(key_history_len-i) == key )
+            matches++;
     }
+    return matches;
+}
+
+/****************************************************************************
+ * Check insufficient material draw rule
+ ****************************************************************************/
+bool ChessRules::IsInsufficientDraw( bool white_asks, DRAWTYPE &result )
+{
+    bool   draw=false;
+
+    // Count everything except the kings
+    Bitboard wmen = bb_white & ~bb_pieces[BB_WKING];
+    Bitboard bmen = bb_black & ~bb_pieces[BB_BKING];
+    int  piece_count = bb_popcount( wmen|bmen );
+    bool bishop_or_knight = (bb_pieces[BB_WBISHOP] | bb_pieces[BB_WKNIGHT] |
+                             bb_pieces[BB_BBISHOP] | bb_pieces[BB_BKNIGHT]) != 0;
+    bool lone_wking = (wmen == 0);
+    bool lone_bking = (bmen == 0);
 
     // Automatic draw if K v K or K v K+N or K v K+B
     //  (note that K+B v K+N etc. is not auto granted due to
@@ -2661,115 +3367,211 @@ void ChessRules::GenMoveList( MOVELIST *l )
     // Clear move list
     l->count  = 0;   // set each field for each move
 
-    // Loop through all squares
-    for( square=a8; square<=h1; ++square )
+    // Loop through all squares occupied by a piece of the right colour
+    Bitboard occupied = bb_occupied();
+    Bitboard bb = (white ? bb_white : bb_black);
+    while( bb )
     {
-
-        // If square occupied by a piece of the right colour
+        square = bb_pop_lsb(bb);
         char piece=squares[square];
-        if( (white&&IsWhite(piece)) || (!white&&IsBlack(piece)) )
-        {
 
-            // Generate moves according to the occupying piece
-            switch( piece )
+        // Generate moves according to the occupying piece
+        switch( piece )
+        {
+            case 'P':
             {
-                case 'P':
-                {
-                    WhitePawnMoves( l, square );
-                    break;
-                }
-                case 'p':
-                {
-                    BlackPawnMoves( l, square );
-                    break;
-                }
-                case 'N':
-                case 'n':
-                {
-                    const lte *ptr = knight_lookup[square];
-                    ShortMoves( l, square, ptr, NOT_SPECIAL );
-                    break;
-                }
-                case 'B':
-                case 'b':
-                {
-                    const lte *ptr = bishop_lookup[square];
-                    LongMoves( l, square, ptr );
-                    break;
-                }
-                case 'R':
-                case 'r':
-                {
-                    const lte *ptr = rook_lookup[square];
-                    LongMoves( l, square, ptr );
-                    break;
-                }
-                case 'Q':
-                case 'q':
-                {
-                    const lte *ptr = queen_lookup[square];
-                    LongMoves( l, square, ptr );
-                    break;
-                }
-                case 'K':
-                case 'k':
-                {
-                    KingMoves( l, square );
-                    break;
-                }
+                WhitePawnMoves( l, square );
+                break;
             }
-        }
-    }
-}
-
-/****************************************************************************
- * Generate moves for pieces that move along multi-move rays (B,R,Q)
- ****************************************************************************/
-void ChessRules::LongMoves( MOVELIST *l, Square square, const lte *ptr )
-{
-    Move *m=&l->moves[l->count];
-    Square dst;
-    lte nbr_rays = *ptr++;
-    while( nbr_rays-- )
-    {
-        lte ray_len = *ptr++;
-        while( ray_len-- )
-        {
-            dst = (Square)*ptr++;
-            char piece=squares[dst];
-
-            // If square not occupied (empty), add move to list
-            if( IsEmptySquare(piece) )
+            case 'p':
             {
-                m->src     = square;
-                m->dst     = dst;
-                m->capture = ' ';
-                m->special = NOT_SPECIAL;
-                m++;
-                l->count++;
+                BlackPawnMoves( l, square );
+                break;
+            }
+            case 'N':
+            case 'n':
+            {
+                const lte *ptr = knight_lookup[square];
+                ShortMoves( l, square, ptr, NOT_SPECIAL );
+                break;
+            }
+            case 'B':
+            case 'b':
+            {
+                LongMoves( l, square, bishop_attacks_bb(square,occupied) );
+                break;
+            }
+            case 'R':
+            case 'r':
+            {
+                LongMoves( l, square, rook_attacks_bb(square,occupied) );
+                break;
+            }
+            case 'Q':
+            case 'q':
+            {
+                LongMoves( l, square, queen_attacks_bb(square,occupied) );
+                break;
+            }
+            case 'K':
+            case 'k':
+            {
+                KingMoves( l, square );
+                break;
             }
+        }
+    }
+}
 
-            // Else must move to end of ray
-            else
+// Add a move to a list
+static inline void move_list_add( MOVELIST *l, Square src, Square dst, SPECIAL special, char capture )
+{
+    Move *m = &l->moves[l->count++];
+    m->src     = src;
+    m->dst     = dst;
+    m->special = special;
+    m->capture = capture;
+}
+
+/****************************************************************************
+ * Create a list of captures and promotions only, (including illegally
+ *  "moving into check"), for quiescence searches
+ ****************************************************************************/
+void ChessRules::GenCaptureList( MOVELIST *l )
+{
+    l->count = 0;
+    Bitboard occupied = bb_occupied();
+    Bitboard enemy = (white ? bb_black : bb_white);
+    Bitboard bb = (white ? bb_white : bb_black);
+    while( bb )
+    {
+        Square square = bb_pop_lsb(bb);
+        Bitboard attacks = 0;
+        SPECIAL special = NOT_SPECIAL;
+        switch( squares[square] )
+        {
+            case 'P':
+            case 'p':
             {
-                ptr += ray_len;
-                ray_len = 0;
+                bool white_pawn = (squares[square]=='P');
+                bool promotion  = (RANK(square) == (white_pawn?'7':'2'));
+                if( promotion )
+                    special = SPECIAL_PROMOTION_QUEEN;
+                attacks = (white_pawn ? pawn_white_attacks_bb[square] : pawn_black_attacks_bb[square]);
+                if( enpassant_target!=SQUARE_INVALID && (attacks&BB(enpassant_target)) )
+                    move_list_add( l, square, enpassant_target,
+                        white_pawn ? SPECIAL_WEN_PASSANT : SPECIAL_BEN_PASSANT, white_pawn ? 'p' : 'P' );
+                attacks &= enemy;
+                Square ahead = (white_pawn ? NORTH(square) : SOUTH(square));
+                if( promotion && IsEmptySquare(squares[ahead]) )
+                    move_list_add( l, square, ahead, SPECIAL_PROMOTION_QUEEN, ' ' );
+                break;
+            }
+            case 'N':
+            case 'n':   attacks = knight_attacks_bb[square] & enemy;                    break;
+            case 'B':
+            case 'b':   attacks = bishop_attacks_bb(square,occupied) & enemy;           break;
+            case 'R':
+            case 'r':   attacks = rook_attacks_bb(square,occupied) & enemy;             break;
+            case 'Q':
+            case 'q':   attacks = queen_attacks_bb(square,occupied) & enemy;            break;
+            case 'K':
+            case 'k':   attacks = king_attacks_bb[square] & enemy;
+                        special = SPECIAL_KING_MOVE;                                    break;
+        }
+        while( attacks )
+        {
+            Square dst = bb_pop_lsb(attacks);
+            move_list_add( l, square, dst, special, squares[dst] );
+        }
+    }
+}
 
-                // If not occupied by our man add a capture
-                if( (white&&IsBlack(piece)) || (!white&&IsWhite(piece)) )
+/****************************************************************************
+ * Create a list of the moves GenCaptureList() doesn't generate, ie non
+ *  captures and underpromotions, (including illegally "moving into check")
+ ****************************************************************************/
+void ChessRules::GenQuietList( MOVELIST *l )
+{
+    l->count = 0;
+    Bitboard occupied = bb_occupied();
+    Bitboard empty = ~occupied;
+    Bitboard enemy = (white ? bb_black : bb_white);
+    Bitboard bb = (white ? bb_white : bb_black);
+    while( bb )
+    {
+        Square square = bb_pop_lsb(bb);
+        Bitboard attacks = 0;
+        SPECIAL special = NOT_SPECIAL;
+        switch( squares[square] )
+        {
+            case 'P':
+            case 'p':
+            {
+                bool white_pawn = (squares[square]=='P');
+                Square ahead = (white_pawn ? NORTH(square) : SOUTH(square));
+                if( RANK(square) == (white_pawn?'7':'2') )
+                {
+                    Bitboard dsts = (white_pawn ? pawn_white_attacks_bb[square] : pawn_black_attacks_bb[square]) & enemy;
+                    if( IsEmptySquare(squares[ahead]) )
+                        dsts |= BB(ahead);
+                    while( dsts )
+                    {
+                        Square dst = bb_pop_lsb(dsts);
+                        move_list_add( l, square, dst, SPECIAL_PROMOTION_KNIGHT, squares[dst] );
+                        move_list_add( l, square, dst, SPECIAL_PROMOTION_BISHOP, squares[dst] );
+                        move_list_add( l, square, dst, SPECIAL_PROMOTION_ROOK,   squares[dst] );
+                    }
+                }
+                else if( IsEmptySquare(squares[ahead]) )
                 {
-                    m->src     = square;
-                    m->dst     = dst;
-                    m->special = NOT_SPECIAL;
-                    m->capture = piece;
-                    l->count++;
-                    m++;
+                    move_list_add( l, square, ahead, NOT_SPECIAL, ' ' );
+                    Square ahead2 = (white_pawn ? NORTH(ahead) : SOUTH(ahead));
+                    if( RANK(square)==(white_pawn?'2':'7') && IsEmptySquare(squares[ahead2]) )
+                        move_list_add( l, square, ahead2, white_pawn ? SPECIAL_WPAWN_2SQUARES : SPECIAL_BPAWN_2SQUARES, ' ' );
                 }
+                break;
             }
+            case 'N':
+            case 'n':   attacks = knight_attacks_bb[square] & empty;                    break;
+            case 'B':
+            case 'b':   attacks = bishop_attacks_bb(square,occupied) & empty;           break;
+            case 'R':
+            case 'r':   attacks = rook_attacks_bb(square,occupied) & empty;             break;
+            case 'Q':
+            case 'q':   attacks = queen_attacks_bb(square,occupied) & empty;            break;
+            case 'K':
+            case 'k':   attacks = king_attacks_bb[square] & empty;
+                        special = SPECIAL_KING_MOVE;
+                        CastlingMoves( l, square );                                     break;
+        }
+        while( attacks )
+        {
+            Square dst = bb_pop_lsb(attacks);
+            move_list_add( l, square, dst, special, ' ' );
         }
     }
 }
 
+/****************************************************************************
+ * Generate moves for pieces that move along multi-move rays (B,R,Q)
+ ****************************************************************************/
+void ChessRules::LongMoves( MOVELIST *l, Square square, Bitboard attacks )
+{
+    Move *m=&l->moves[l->count];
+    attacks &= ~(white ? bb_white : bb_black);  // can't capture our own men
+    while( attacks )
+    {
+        Square dst = bb_pop_lsb(attacks);
+        m->src     = square;
+        m->dst     = dst;
+        m->special = NOT_SPECIAL;
+        m->capture = squares[dst];   // ' ' if square not occupied
+        m++;
+        l->count++;
+    }
+}
+
 /****************************************************************************
  * Generate moves for pieces that move along single move rays (N,K)
  ****************************************************************************/
@@ -2815,8 +3617,14 @@ void ChessRules::KingMoves( MOVELIST *l, Square square )
 {
     const lte *ptr = king_lookup[square];
     ShortMoves( l, square, ptr, SPECIAL_KING_MOVE );
+    CastlingMoves( l, square );
+}
 
-    // Generate castling king moves
+/****************************************************************************
+ * Generate list of castling moves
+ ****************************************************************************/
+void ChessRules::CastlingMoves( MOVELIST *l, Square square )
+{
     Move *m;
     m = &l->moves[l->count];
 
@@ -3137,11 +3945,49 @@ void ChessRules::BlackPawnMoves( MOVELIST *l, Square square )
     }
 }
 
+/****************************************************************************
+ * Push the key (and reversible plies) before a move onto the key history
+ ****************************************************************************/
+void ChessRules::KeyHistoryPush()
+{
+    KEY_HISTORY kh;
+    kh.key = key;
+    kh.reversible_plies = reversible_plies;
+    if( key_history_len < 256 )
+        key_history[key_history_len] = kh;
+    else
+        key_history_more.push_back( kh );   // keeps its capacity when popped
+    key_history_len++;
+}
+
+/****************************************************************************
+ * Pop the key history, restoring reversible plies
+ ****************************************************************************/
+void ChessRules::KeyHistoryPop()
+{
+    if( key_history_len > 0 )
+    {
+        key_history_len--;
+        reversible_plies = KeyHistoryReversiblePlies(key_history_len);
+        if( key_history_len >= 256 )
+            key_history_more.pop_back();
+    }
+}
+
 /****************************************************************************
  * Make a move (with the potential to undo)
  ****************************************************************************/
 void ChessRules::PushMove( Move& m )
 {
+    // Remember key for repetition detection, a pawn move or capture means
+    //  no earlier position can be repeated
+    KeyHistoryPush();
+    bool irreversible = (squares[m.src]=='P' || squares[m.src]=='p' || !IsEmptySquare(squares[m.dst]));
+    reversible_plies = irreversible ? 0 : reversible_plies+1;
+
+    // Castling and en passant possibilities are about to change
+    key ^= KeyCastlingEnpassant();
+
     // Push old details onto stack
     DETAIL_PUSH;
 
@@ -3158,16 +4004,23 @@ void ChessRules::PushMove( Move& m )
                     //  castling remains prohibited).
     enpassant_target = SQUARE_INVALID;
 
+    // Remove captured piece (if any) from bitboards, en passant is the
+    //  exception and is handled below
+    if( !IsEmptySquare(squares[m.dst]) )
+        bb_toggle( this, squares[m.dst], BB(m.dst) );
+
     // Special handling might be required
     switch( m.special )
     {
         default:
+        bb_toggle( this, squares[m.src], BB(m.src)|BB(m.dst) );
         squares[m.dst] = squares[m.src];
         squares[m.src] = ' ';
         break;
 
         // King move updates king position in details field
         case SPECIAL_KING_MOVE:
+        bb_toggle( this, squares[m.src], BB(m.src)|BB(m.dst) );
         squares[m.dst] = squares[m.src];
         squares[m.src] = ' ';
         if( white )
@@ -3178,30 +4031,40 @@ void ChessRules::PushMove( Move& m )
 
         // In promotion case, dst piece doesn't equal src piece
         case SPECIAL_PROMOTION_QUEEN:
+        bb_toggle( this, squares[m.src], BB(m.src) );
         squares[m.src] = ' ';
         squares[m.dst] = (white?'Q':'q');
+        bb_toggle( this, squares[m.dst], BB(m.dst) );
         break;
 
         // In promotion case, dst piece doesn't equal src piece
         case SPECIAL_PROMOTION_ROOK:
+        bb_toggle( this, squares[m.src], BB(m.src) );
         squares[m.src] = ' ';
         squares[m.dst] = (white?'R':'r');
+        bb_toggle( this, squares[m.dst], BB(m.dst) );
         break;
 
         // In promotion case, dst piece doesn't equal src piece
         case SPECIAL_PROMOTION_BISHOP:
+        bb_toggle( this, squares[m.src], BB(m.src) );
         squares[m.src] = ' ';
         squares[m.dst] = (white?'B':'b');
+        bb_toggle( this, squares[m.dst], BB(m.dst) );
         break;
 
         // In promotion case, dst piece doesn't equal src piece
         case SPECIAL_PROMOTION_KNIGHT:
+        bb_toggle( this, squares[m.src], BB(m.src) );
         squares[m.src] = ' ';
         squares[m.dst] = (white?'N':'n');
+        bb_toggle( this, squares[m.dst], BB(m.dst) );
         break;
 
         // White enpassant removes pawn south of destination
         case SPECIAL_WEN_PASSANT:
+        bb_toggle( this, 'P', BB(m.src)|BB(m.dst) );
+        bb_toggle( this, 'p', BB(SOUTH(m.dst)) );
         squares[m.src] = ' ';
         squares[m.dst] = 'P';
         squares[ SOUTH(m.dst) ] = ' ';
@@ -3209,6 +4072,8 @@ void ChessRules::PushMove( Move& m )
 
         // Black enpassant removes pawn north of destination
         case SPECIAL_BEN_PASSANT:
+        bb_toggle( this, 'p', BB(m.src)|BB(m.dst) );
+        bb_toggle( this, 'P', BB(NORTH(m.dst)) );
         squares[m.src] = ' ';
         squares[m.dst] = 'p';
         squares[ NORTH(m.dst) ] = ' ';
@@ -3216,6 +4081,7 @@ void ChessRules::PushMove( Move& m )
 
         // White pawn advances 2 squares sets an enpassant target
         case SPECIAL_WPAWN_2SQUARES:
+        bb_toggle( this, 'P', BB(m.src)|BB(m.dst) );
         squares[m.src] = ' ';
         squares[m.dst] = 'P';
         enpassant_target = SOUTH(m.dst);
@@ -3223,6 +4089,7 @@ void ChessRules::PushMove( Move& m )
 
         // Black pawn advances 2 squares sets an enpassant target
         case SPECIAL_BPAWN_2SQUARES:
+        bb_toggle( this, 'p', BB(m.src)|BB(m.dst) );
         squares[m.src] = ' ';
         squares[m.dst] = 'p';
         enpassant_target = NORTH(m.dst);
@@ -3230,6 +4097,8 @@ void ChessRules::PushMove( Move& m )
 
         // Castling moves update 4 squares each
         case SPECIAL_WK_CASTLING:
+        bb_toggle( this, 'K', BB(e1)|BB(g1) );
+        bb_toggle( this, 'R', BB(h1)|BB(f1) );
         squares[e1] = ' ';
         squares[f1] = 'R';
         squares[g1] = 'K';
@@ -3237,6 +4106,8 @@ void ChessRules::PushMove( Move& m )
         wking_square = g1;
         break;
         case SPECIAL_WQ_CASTLING:
+        bb_toggle( this, 'K', BB(e1)|BB(c1) );
+        bb_toggle( this, 'R', BB(a1)|BB(d1) );
         squares[e1] = ' ';
         squares[d1] = 'R';
         squares[c1] = 'K';
@@ -3244,6 +4115,8 @@ void ChessRules::PushMove( Move& m )
         wking_square = c1;
         break;
         case SPECIAL_BK_CASTLING:
+        bb_toggle( this, 'k', BB(e8)|BB(g8) );
+        bb_toggle( this, 'r', BB(h8)|BB(f8) );
         squares[e8] = ' ';
         squares[f8] = 'r';
         squares[g8] = 'k';
@@ -3251,6 +4124,8 @@ void ChessRules::PushMove( Move& m )
         bking_square = g8;
         break;
         case SPECIAL_BQ_CASTLING:
+        bb_toggle( this, 'k', BB(e8)|BB(c8) );
+        bb_toggle( this, 'r', BB(a8)|BB(d8) );
         squares[e8] = ' ';
         squares[d8] = 'r';
         squares[c8] = 'k';
@@ -3261,6 +4136,7 @@ void ChessRules::PushMove( Move& m )
 
     // Toggle who-to-move
     Toggle();
+    key ^= (zobrist_white ^ KeyCastlingEnpassant());
 }
 
 /****************************************************************************
@@ -3268,6 +4144,12 @@ void ChessRules::PushMove( Move& m )
  ****************************************************************************/
 void ChessRules::PopMove( Move& m )
 {
+    // Key history for repetition detection
+    KeyHistoryPop();
+
+    // Castling and en passant possibilities are about to change
+    key ^= (zobrist_white ^ KeyCastlingEnpassant());
+
     // Previous detail field
     DETAIL_POP;
 
@@ -3278,8 +4160,11 @@ void ChessRules::PopMove( Move& m )
     switch( m.special )
     {
         default:
+        bb_toggle( this, squares[m.dst], BB(m.src)|BB(m.dst) );
         squares[m.src] = squares[m.dst];
         squares[m.dst] = m.capture;
+        if( !IsEmptySquare(m.capture) )
+            bb_toggle( this, m.capture, BB(m.dst) );
         break;
 
         // For promotion, src piece was a pawn
@@ -3287,15 +4172,21 @@ void ChessRules::PopMove( Move& m )
         case SPECIAL_PROMOTION_ROOK:
         case SPECIAL_PROMOTION_BISHOP:
         case SPECIAL_PROMOTION_KNIGHT:
+        bb_toggle( this, squares[m.dst], BB(m.dst) );
         if( white )
             squares[m.src] = 'P';
         else
             squares[m.src] = 'p';
+        bb_toggle( this, squares[m.src], BB(m.src) );
         squares[m.dst] = m.capture;
+        if( !IsEmptySquare(m.capture) )
+            bb_toggle( this, m.capture, BB(m.dst) );
         break;
 
         // White enpassant re-insert black pawn south of destination
         case SPECIAL_WEN_PASSANT:
+        bb_toggle( this, 'P', BB(m.src)|BB(m.dst) );
+        bb_toggle( this, 'p', BB(SOUTH(m.dst)) );
         squares[m.src] = 'P';
         squares[m.dst] = ' ';
         squares[SOUTH(m.dst)] = 'p';
@@ -3303,6 +4194,8 @@ void ChessRules::PopMove( Move& m )
 
         // Black enpassant re-insert white pawn north of destination
         case SPECIAL_BEN_PASSANT:
+        bb_toggle( this, 'p', BB(m.src)|BB(m.dst) );
+        bb_toggle( this, 'P', BB(NORTH(m.dst)) );
         squares[m.src] = 'p';
         squares[m.dst] = ' ';
         squares[NORTH(m.dst)] = 'P';
@@ -3310,30 +4203,67 @@ void ChessRules::PopMove( Move& m )
 
         // Castling moves update 4 squares each
         case SPECIAL_WK_CASTLING:
+        bb_toggle( this, 'K', BB(e1)|BB(g1) );
+        bb_toggle( this, 'R', BB(h1)|BB(f1) );
         squares[e1] = 'K';
         squares[f1] = ' ';
         squares[g1] = ' ';
         squares[h1] = 'R';
         break;
         case SPECIAL_WQ_CASTLING:
+        bb_toggle( this, 'K', BB(e1)|BB(c1) );
+        bb_toggle( this, 'R', BB(a1)|BB(d1) );
         squares[e1] = 'K';
         squares[d1] = ' ';
         squares[c1] = ' ';
         squares[a1] = 'R';
         break;
         case SPECIAL_BK_CASTLING:
+        bb_toggle( this, 'k', BB(e8)|BB(g8) );
+        bb_toggle( this, 'r', BB(h8)|BB(f8) );
         squares[e8] = 'k';
         squares[f8] = ' ';
         squares[g8] = ' ';
         squares[h8] = 'r';
         break;
         case SPECIAL_BQ_CASTLING:
+        bb_toggle( this, 'k', BB(e8)|BB(c8) );
+        bb_toggle( this, 'r', BB(a8)|BB(d8) );
         squares[e8] = 'k';
         squares[d8] = ' ';
         squares[c8] = ' ';
         squares[a8] = 'r';
         break;
     }
+    key ^= KeyCastlingEnpassant();
+}
+
+
+/****************************************************************************
+ * Make a null move, ie pass the move to the other side (for searches)
+ ****************************************************************************/
+void ChessRules::PushNullMove()
+{
+    // The positions either side of a pass can't be a repetition
+    KeyHistoryPush();
+    reversible_plies = 0;
+    key ^= KeyCastlingEnpassant();
+    DETAIL_PUSH;
+    enpassant_target = SQUARE_INVALID;
+    Toggle();
+    key ^= (zobrist_white ^ KeyCastlingEnpassant());
+}
+
+/****************************************************************************
+ * Undo a null move
+ ****************************************************************************/
+void ChessRules::PopNullMove()
+{
+    KeyHistoryPop();
+    key ^= (zobrist_white ^ KeyCastlingEnpassant());
+    DETAIL_POP;
+    Toggle();
+    key ^= KeyCastlingEnpassant();
 }
 
 
@@ -3346,63 +4276,42 @@ bool ChessRules::AttackedPiece( Square square )
     return( AttackedSquare(square,enemy_is_white) );
 }
 
+/****************************************************************************
+ * Bitboard of enemy men attacking a square, given the occupied squares
+ ****************************************************************************/
+Bitboard ChessRules::AttackersTo( Square square, bool enemy_is_white, Bitboard occupied )
+{
+    const Bitboard *enemy = &bb_pieces[ enemy_is_white ? BB_WPAWN : BB_BPAWN ];
+    return (knight_attacks_bb[square] & enemy[BB_WKNIGHT])
+         | (king_attacks_bb[square]   & enemy[BB_WKING])
+         | ((enemy_is_white ? pawn_black_attacks_bb[square] : pawn_white_attacks_bb[square]) & enemy[BB_WPAWN])
+         | (bishop_attacks_bb(square,occupied) & (enemy[BB_WBISHOP]|enemy[BB_WQUEEN]))
+         | (rook_attacks_bb(square,occupied)   & (enemy[BB_WROOK]  |enemy[BB_WQUEEN]));
+}
+
 /****************************************************************************
  * Is a square is attacked by enemy ?
  ****************************************************************************/
 bool ChessRules::AttackedSquare( Square square, bool enemy_is_white )
 {
-    Square dst;
-    const lte *ptr = (enemy_is_white ? attacks_black_lookup[square] : attacks_white_lookup[square] );
-    lte nbr_rays = *ptr++;
-    while( nbr_rays-- )
-    {
-        lte ray_len = *ptr++;
-        while( ray_len-- )
-        {
-            dst = (Square)*ptr++;
-            char piece=squares[dst];
-
-            // If square not occupied (empty), continue
-            if( IsEmptySquare(piece) )
-                ptr++;  // skip mask
-
-            // Else if occupied
-            else
-            {
-                lte mask = *ptr++;
-
-                // White attacker ?
-                if( IsWhite(piece) && enemy_is_white )
-                {
-                    if( to_mask[piece] & mask )
-                        return true;
-                }
-
-                // Black attacker ?
-                else if( IsBlack(piece) && !enemy_is_white )
-                {
-                    if( to_mask[piece] & mask )
-                        return true;
-                }
-
-                // Goto end of ray
-                ptr += (2*ray_len);
-                ray_len = 0;
-            }
-        }
-    }
-
-    ptr = knight_lookup[square];
-    lte nbr_squares = *ptr++;
-    while( nbr_squares-- )
-    {
-        dst = (Square)*ptr++;
-        char piece=squares[dst];
-
-        // If occupied by an enemy knight, we have found an attacker
-        if( (enemy_is_white&&piece=='N') || (!enemy_is_white&&piece=='n') )
-            return true;
-    }
+    const Bitboard *enemy = &bb_pieces[ enemy_is_white ? BB_WPAWN : BB_BPAWN ];
+
+    // Short range attackers are a simple bitboard intersection. Note that a
+    //  pawn attacks square from the squares an opposite colour pawn on
+    //  square would attack
+    if( knight_attacks_bb[square] & enemy[BB_WKNIGHT] )
+        return true;
+    if( king_attacks_bb[square] & enemy[BB_WKING] )
+        return true;
+    if( (enemy_is_white ? pawn_black_attacks_bb[square] : pawn_white_attacks_bb[square]) & enemy[BB_WPAWN] )
+        return true;
+
+    // Long range attackers, look back from square as a bishop and a rook
+    Bitboard occupied = bb_occupied();
+    if( bishop_attacks_bb(square,occupied) & (enemy[BB_WBISHOP]|enemy[BB_WQUEEN]) )
+        return true;
+    if( rook_attacks_bb(square,occupied) & (enemy[BB_WROOK]|enemy[BB_WQUEEN]) )
+        return true;
     return false;
 }
 
@@ -3423,9 +4332,6 @@ bool ChessRules::Evaluate( TERMINAL &score_terminal )
 
 bool ChessRules::Evaluate( MOVELIST *p, TERMINAL &score_terminal )
 {
-    /* static ;remove for thread safety */ MOVELIST local_list;
-    MOVELIST &list = p?*p:local_list;
-    int i, any;
     Square my_king, enemy_king;
     bool okay;
     score_terminal=NOT_TERMINAL;
@@ -3443,18 +4349,11 @@ bool ChessRules::Evaluate( MOVELIST *p, TERMINAL &score_terminal )
         okay = true;
 
         // Work out if the game is over by checking for any legal moves
-        GenMoveList( &list );
-        for( any=i=0 ; i<list.count && any==0 ; i++ )
-        {
-            PushMove( list.moves[i] );
-            my_king = (Square)(white ? bking_square : wking_square);
-            if( !AttackedPiece(my_king) )
-                any++;
-            PopMove( list.moves[i] );
-        }
+        if( p )
+            GenMoveList( p );
 
         // If no legal moves, position is either checkmate or stalemate
-        if( any == 0 )
+        if( !HasLegalMove() )
         {
             my_king = (Square)(white ? wking_square : bking_square);
             if( AttackedPiece(my_king) )
@@ -3539,6 +4438,7 @@ void ChessRules::Transform()
             }
         }
     }
+    BitboardsCalculate();
 }
 
 
@@ -4007,7 +4907,7 @@ int ChessEvaluation::EnpriseWhite()
                     max = net;
             }
 
-            // Result is the lowest of best attacker can do and
+            // Result is the lowest of the best attacker can do and
             //  best defender can do
             int score = min<=max ? min : max;
             if( score > best_so_far )
@@ -4306,7 +5206,7 @@ int ChessEvaluation::EnpriseBlack()
                     max = net;
             }
 
-            // Result is the lowest of best attacker can do and
+            // Result is the lowest of the best attacker can do and
             //  best defender can do
             int score = min<=max ? min : max;
             if( score > best_so_far )
@@ -4320,6 +5220,159 @@ int ChessEvaluation::EnpriseBlack()
 
 
 
+/****************************************************************************
+ * Static exchange evaluation
+ ****************************************************************************/
+
+// Material value of each kind of man, indexed by BB_WPAWN .. BB_WKING (and
+//  the same values as either_colour_material[])
+static const int see_value[6] = { 10, 30, 31, 50, 90, 500 };
+
+// Value of the man arriving on the destination square, and the material
+//  gained by the move itself (capture plus any promotion)
+static void see_move_values( Move move, const char *squares, int &arriving, int &gain )
+{
+    arriving = either_colour_material[ (unsigned char)squares[move.src] ];
+    gain     = either_colour_material[ (unsigned char)move.capture ];
+    int promotion = 0;
+    switch( move.special )
+    {
+        case SPECIAL_PROMOTION_QUEEN:   promotion = see_value[BB_WQUEEN];   break;
+        case SPECIAL_PROMOTION_ROOK:    promotion = see_value[BB_WROOK];    break;
+        case SPECIAL_PROMOTION_BISHOP:  promotion = see_value[BB_WBISHOP];  break;
+        case SPECIAL_PROMOTION_KNIGHT:  promotion = see_value[BB_WKNIGHT];  break;
+        default:                                                            break;
+    }
+    if( promotion )
+    {
+        gain    += promotion - arriving;
+        arriving = promotion;
+    }
+}
+
+// Occupied squares once the move's man and anything it captures are gone
+static Bitboard see_occupied( Move move, Bitboard occupied )
+{
+    occupied &= ~BB(move.src);
+    if( move.special == SPECIAL_WEN_PASSANT )
+        occupied &= ~BB(SOUTH(move.dst));
+    else if( move.special == SPECIAL_BEN_PASSANT )
+        occupied &= ~BB(NORTH(move.dst));
+    return occupied;
+}
+
+// Remove the least valuable of a side's attackers from occupied, returning
+//  its kind (BB_WPAWN .. BB_WKING), and add any slider x-rayed through it
+int ChessEvaluation::SeeLeastValuable( Square square, Bitboard side_attackers, Bitboard &occupied, Bitboard &attackers )
+{
+    bool white = (side_attackers & bb_white) != 0;
+    const Bitboard *side = &bb_pieces[ white ? BB_WPAWN : BB_BPAWN ];
+    for( int kind=BB_WPAWN; kind<=BB_WKING; kind++ )
+    {
+        Bitboard bb = side_attackers & side[kind];
+        if( bb )
+        {
+            occupied &= ~(bb & (0-bb));
+            if( kind==BB_WPAWN || kind==BB_WBISHOP || kind==BB_WQUEEN )
+                attackers |= bishop_attacks_bb(square,occupied) &
+                    (bb_pieces[BB_WBISHOP]|bb_pieces[BB_WQUEEN]|bb_pieces[BB_BBISHOP]|bb_pieces[BB_BQUEEN]);
+            if( kind==BB_WROOK || kind==BB_WQUEEN )
+                attackers |= rook_attacks_bb(square,occupied) &
+                    (bb_pieces[BB_WROOK]|bb_pieces[BB_WQUEEN]|bb_pieces[BB_BROOK]|bb_pieces[BB_BQUEEN]);
+            attackers &= occupied;
+            return kind;
+        }
+    }
+    return BB_WKING;
+}
+
+/****************************************************************************
+ * Static exchange evaluation, the material won (negative if lost) by the
+ *  moving side if both sides keep capturing on the destination square with
+ *  their least valuable man, either side stopping when it suits them. Pins
+ *  are ignored, x-rays (eg a rook behind a queen) are not
+ ****************************************************************************/
+int ChessEvaluation::SEE( Move move )
+{
+    if( move.special>=SPECIAL_WK_CASTLING && move.special<=SPECIAL_BQ_CASTLING )
+        return 0;
+    int gain[40];
+    int arriving;
+    see_move_values( move, squares, arriving, gain[0] );
+    Square square = move.dst;
+    Bitboard occupied = see_occupied( move, bb_occupied() );
+    Bitboard attackers = (AttackersTo(square,true,occupied) | AttackersTo(square,false,occupied)) & occupied;
+    bool white = !IsWhite(squares[move.src]);
+    int depth = 0;
+    for(;;)
+    {
+        Bitboard side_attackers = attackers & (white ? bb_white : bb_black);
+        if( !side_attackers )
+            break;
+
+        // A king can only capture if there is nothing left to recapture
+        bool king = ((side_attackers & bb_pieces[white?BB_WKING:BB_BKING]) == side_attackers);
+        if( king && (attackers & ~side_attackers) )
+            break;
+        depth++;
+        gain[depth] = arriving - gain[depth-1];
+        arriving = see_value[ SeeLeastValuable( square, side_attackers, occupied, attackers ) ];
+        white = !white;
+        if( depth+1 >= (int)nbrof(gain) )
+            break;
+    }
+
+    // Each side chooses between stopping and continuing the exchange
+    while( depth > 0 )
+    {
+        if( -gain[depth] < gain[depth-1] )
+            gain[depth-1] = -gain[depth];
+        depth--;
+    }
+    return gain[0];
+}
+
+/****************************************************************************
+ * Fast test of whether SEE(move) >= threshold, gives up on the exchange as
+ *  soon as the outcome relative to the threshold is known
+ ****************************************************************************/
+bool ChessEvaluation::SEEGreaterEqual( Move move, int threshold )
+{
+    if( move.special>=SPECIAL_WK_CASTLING && move.special<=SPECIAL_BQ_CASTLING )
+        return 0 >= threshold;
+    int arriving, gain;
+    see_move_values( move, squares, arriving, gain );
+
+    // If we don't reach the threshold even if the man is captured for free
+    //  we fail, if we reach it even when our man is lost we succeed
+    int swap = gain - threshold;
+    if( swap < 0 )
+        return false;
+    swap = arriving - swap;
+    if( swap <= 0 )
+        return true;
+    Square square = move.dst;
+    Bitboard occupied = see_occupied( move, bb_occupied() );
+    Bitboard attackers = (AttackersTo(square,true,occupied) | AttackersTo(square,false,occupied)) & occupied;
+    bool white = IsWhite(squares[move.src]);
+    int result = 1;
+    for(;;)
+    {
+        white = !white;
+        Bitboard side_attackers = attackers & (white ? bb_white : bb_black);
+        if( !side_attackers )
+            break;
+        result ^= 1;
+        int kind = SeeLeastValuable( square, side_attackers, occupied, attackers );
+        if( kind == BB_WKING )
+            return (attackers & ~(white ? bb_white : bb_black)) ? !result : result!=0;
+        swap = see_value[kind] - swap;
+        if( swap < result )
+            break;
+    }
+    return result != 0;
+}
+
 //=========== EVALUATION ===============================================
 
 static int king_ending_bonus_static[] =
@@ -4348,57 +5401,14 @@ static int king_ending_bonus_static[] =
 static int king_ending_bonus_dynamic_white[0x80];
 static int king_ending_bonus_dynamic_black[0x80];
 
-// Lookup table for quick calculation of material value of white piece
-static int white_material[]=
-{
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x00-0x0f
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x10-0x1f
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x20-0x2f
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x30-0x3f
-    0,  0, 31,  0,  0,  0,  0,  0,  0,  0,  0,500,  0,  0, 30,  0,   // 0x40-0x4f    'B'=0x42, 'K'=0x4b, 'N'=0x4e
-   10, 90, 50,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x50-0x5f    'P'=0x50, 'Q'=0x51, 'R'=0x52
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x60-0x6f    'b'=0x62, 'k'=0x6b, 'n'=0x6e
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0    // 0x70-0x7f    'p'=0x70, 'q'=0x71, 'r'=0x72
-};
-
-// Lookup table for quick calculation of material value of black piece
-static int black_material[]=
-{
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x00-0x0f
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x10-0x1f
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x20-0x2f
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x30-0x3f
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x40-0x4f    'B'=0x42, 'K'=0x4b, 'N'=0x4e
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x50-0x5f    'P'=0x50, 'Q'=0x51, 'R'=0x52
-    0,  0,-31,  0,  0,  0,  0,  0,  0,  0,  0,-500, 0,  0,-30,  0,   // 0x60-0x6f    'b'=0x62, 'k'=0x6b, 'n'=0x6e
-  -10,-90,-50,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0    // 0x70-0x7f    'p'=0x70, 'q'=0x71, 'r'=0x72
-};
-
-// Lookup table for quick calculation of material value of white piece (not pawn or king)
-static int white_pieces[]=
-{
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x00-0x0f
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x10-0x1f
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x20-0x2f
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x30-0x3f
-    0,  0, 31,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, 30,  0,   // 0x40-0x4f    'B'=0x42, 'K'=0x4b, 'N'=0x4e
-    0, 90, 50,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x50-0x5f    'P'=0x50, 'Q'=0x51, 'R'=0x52
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x60-0x6f    'b'=0x62, 'k'=0x6b, 'n'=0x6e
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0    // 0x70-0x7f    'p'=0x70, 'q'=0x71, 'r'=0x72
-};
-
-// Lookup table for quick calculation of material value of black piece (not pawn or king)
-static int black_pieces[]=
+// Calculate material for one side from the piece bitboards, bb points at
+//  the six bitboards for that side, pieces excludes pawns and king
+static inline void bb_material( const Bitboard *bb, int &material, int &pieces )
 {
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x00-0x0f
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x10-0x1f
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x20-0x2f
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x30-0x3f
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x40-0x4f    'B'=0x42, 'K'=0x4b, 'N'=0x4e
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 0x50-0x5f    'P'=0x50, 'Q'=0x51, 'R'=0x52
-    0,  0, 31,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, 30,  0,   // 0x60-0x6f    'b'=0x62, 'k'=0x6b, 'n'=0x6e
-    0, 90, 50,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0    // 0x70-0x7f    'p'=0x70, 'q'=0x71, 'r'=0x72
-};
+    pieces   = 30*bb_popcount(bb[BB_WKNIGHT]) + 31*bb_popcount(bb[BB_WBISHOP]) +
+               50*bb_popcount(bb[BB_WROOK])   + 90*bb_popcount(bb[BB_WQUEEN]);
+    material = pieces + 10*bb_popcount(bb[BB_WPAWN]) + 500*bb_popcount(bb[BB_WKING]);
+}
 
 /****************************************************************************
  * Do some planning before making a move
@@ -4407,7 +5417,6 @@ static int black_pieces[]=
 void ChessEvaluation::Planning()
 {
     Square weaker_king, bonus_square;
-    char piece;
     int score_black_material = 0;
     int score_white_material = 0;
     const int MATERIAL_ENDING  = (500 + ((8*10+4*30+2*50+90)*1)/3);
@@ -4416,14 +5425,9 @@ void ChessEvaluation::Planning()
     // Get material for both sides
     int score_black_pieces = 0;
     int score_white_pieces = 0;
-    for( Square square=a8; square<=h1; ++square )
-    {
-        piece = squares[square];
-        score_black_material += black_material[ piece ];
-        score_white_material += white_material[ piece ];
-        score_black_pieces   += black_pieces[ piece ];
-        score_white_pieces   += white_pieces[ piece ];
-    }
+    bb_material( &bb_pieces[BB_WPAWN], score_white_material, score_white_pieces );
+    bb_material( &bb_pieces[BB_BPAWN], score_black_material, score_black_pieces );
+    score_black_material = 0-score_black_material;
     int score_white_pawns = score_white_material - 500 // -500 is king
                           - score_white_pieces;
     planning_score_white_pieces = score_white_pieces;
@@ -4625,14 +5629,18 @@ const int MATERIAL_MIDDLE  = (500 + ((8*10+4*30+2*50+90)*1)/3);
     int score_black_pieces = 0;
     int score_white_pieces = 0;
 
+    // Material directly from piece counts, the rank by rank scans below
+    //  then only need to visit occupied squares
+    bb_material( &bb_pieces[BB_WPAWN], score_white_material, score_white_pieces );
+    bb_material( &bb_pieces[BB_BPAWN], score_black_material, score_black_pieces );
+    score_black_material = 0-score_black_material;
+    Bitboard occupied = bb_occupied();
+
     // a8->h8
-    for( Square square=a8; square<=h8; ++square )
+    for( Bitboard bb=occupied&BB_RANK('8'); bb; )
     {
+        Square square = bb_pop_lsb(bb);
         piece = squares[square];
-        score_black_material += black_material[ piece ];
-        score_white_material += white_material[ piece ];
-        score_black_pieces   += black_pieces[ piece ];
-        score_white_pieces   += white_pieces[ piece ];
         switch( piece )
         {
             case 'K':
@@ -4705,14 +5713,12 @@ const int MATERIAL_MIDDLE  = (500 + ((8*10+4*30+2*50+90)*1)/3);
     // a7->h7
     unsigned int next_passer_mask = 0;
     unsigned int passer_mask = 0;
-    unsigned int three_files = 0x1c0;   // 1 1100 0000
-    for( Square square=a7; square<=h7; ++square )
+    unsigned int three_files;           // eg 1 1100 0000 for a-file (3 files centred on square)
+    for( Bitboard bb=occupied&BB_RANK('7'); bb; )
     {
+        Square square = bb_pop_lsb(bb);
         piece = squares[square];
-        score_black_material += black_material[ piece ];
-        score_white_material += white_material[ piece ];
-        score_black_pieces   += black_pieces[ piece ];
-        score_white_pieces   += white_pieces[ piece ];
+        three_files = 0x1c0 >> IFILE(square);
         switch( piece )
         {
             case 'K':
@@ -4790,19 +5796,16 @@ const int MATERIAL_MIDDLE  = (500 + ((8*10+4*30+2*50+90)*1)/3);
                 break;
             }
         }
-        three_files >>= 1;
     }
 
     // a6->h6
-    unsigned int file_mask = 0x80;  // 0 1000 0000
-    three_files = 0x1c0;            // 1 1100 0000
-    for( Square square=a6; square<=h6; ++square )
+    unsigned int file_mask;             // eg 0 1000 0000 for a-file
+    for( Bitboard bb=occupied&BB_RANK('6'); bb; )
     {
+        Square square = bb_pop_lsb(bb);
         piece = squares[square];
-        score_black_material += black_material[ piece ];
-        score_white_material += white_material[ piece ];
-        score_black_pieces   += black_pieces[ piece ];
-        score_white_pieces   += white_pieces[ piece ];
+        three_files = 0x1c0 >> IFILE(square);
+        file_mask   = 0x80  >> IFILE(square);
         switch( piece )
         {
             case 'k':
@@ -4876,21 +5879,15 @@ const int MATERIAL_MIDDLE  = (500 + ((8*10+4*30+2*50+90)*1)/3);
                 break;
             }
         }
-        file_mask   >>= 1;
-        three_files >>= 1;
     }
     passer_mask |= next_passer_mask;
 
     // a5->h5;
-    file_mask   = 0x80;             // 0 1000 0000
-//  three_files = 0x1c0;            // 1 1100 0000
-    for( Square square=a5; square<=h5; ++square )
+    for( Bitboard bb=occupied&BB_RANK('5'); bb; )
     {
+        Square square = bb_pop_lsb(bb);
         piece = squares[square];
-        score_black_material += black_material[ piece ];
-        score_white_material += white_material[ piece ];
-        score_black_pieces   += black_pieces[ piece ];
-        score_white_pieces   += white_pieces[ piece ];
+        file_mask   = 0x80  >> IFILE(square);
         switch( piece )
         {
             case 'k':
@@ -4969,21 +5966,16 @@ const int MATERIAL_MIDDLE  = (500 + ((8*10+4*30+2*50+90)*1)/3);
                 break;
             }
         }
-        file_mask   >>= 1;
-        // three_files >>= 1;
     }
 
     // a2->h2
     next_passer_mask = 0;
     passer_mask = 0;
-    three_files = 0x1c0;   // 1 1100 0000
-    for( Square square=a2; square<=h2; ++square )
+    for( Bitboard bb=occupied&BB_RANK('2'); bb; )
     {
+        Square square = bb_pop_lsb(bb);
         piece = squares[square];
-        score_black_material += black_material[ piece ];
-        score_white_material += white_material[ piece ];
-        score_black_pieces   += black_pieces[ piece ];
-        score_white_pieces   += white_pieces[ piece ];
+        three_files = 0x1c0 >> IFILE(square);
         switch( piece )
         {
             case 'k':
@@ -5061,19 +6053,15 @@ const int MATERIAL_MIDDLE  = (500 + ((8*10+4*30+2*50+90)*1)/3);
                 break;
             }
         }
-        three_files >>= 1;
     }
 
     // a3->h3
-    file_mask = 0x80;       // 0 1000 0000
-    three_files = 0x1c0;    // 1 1100 0000
-    for( Square square=a3; square<=h3; ++square )
+    for( Bitboard bb=occupied&BB_RANK('3'); bb; )
     {
+        Square square = bb_pop_lsb(bb);
         piece = squares[square];
-        score_black_material += black_material[ piece ];
-        score_white_material += white_material[ piece ];
-        score_black_pieces   += black_pieces[ piece ];
-        score_white_pieces   += white_pieces[ piece ];
+        three_files = 0x1c0 >> IFILE(square);
+        file_mask   = 0x80  >> IFILE(square);
         switch( piece )
         {
             case 'k':
@@ -5147,21 +6135,15 @@ const int MATERIAL_MIDDLE  = (500 + ((8*10+4*30+2*50+90)*1)/3);
                 break;
             }
         }
-        file_mask   >>= 1;
-        three_files >>= 1;
     }
     passer_mask |= next_passer_mask;
 
     // a4->h4
-    file_mask   = 0x80;             // 0 1000 0000
-//  three_files = 0x1c0;            // 1 1100 0000
-    for( Square square=a4; square<=h4; ++square )
+    for( Bitboard bb=occupied&BB_RANK('4'); bb; )
     {
+        Square square = bb_pop_lsb(bb);
         piece = squares[square];
-        score_black_material += black_material[ piece ];
-        score_white_material += white_material[ piece ];
-        score_black_pieces   += black_pieces[ piece ];
-        score_white_pieces   += white_pieces[ piece ];
+        file_mask   = 0x80  >> IFILE(square);
         switch( piece )
         {
             case 'k':
@@ -5240,18 +6222,13 @@ const int MATERIAL_MIDDLE  = (500 + ((8*10+4*30+2*50+90)*1)/3);
                 break;
             }
         }
-        file_mask   >>= 1;
-        // three_files >>= 1;
     }
 
     // a1->h1
-    for( Square square=a1; square<=h1; ++square )
+    for( Bitboard bb=occupied&BB_RANK('1'); bb; )
     {
+        Square square = bb_pop_lsb(bb);
         piece = squares[square];
-        score_black_material += black_material[ piece ];
-        score_white_material += white_material[ piece ];
-        score_black_pieces   += black_pieces[ piece ];
-        score_white_pieces   += white_pieces[ piece ];
         switch( piece )
         {
             case 'k':
@@ -5657,21 +6634,149 @@ const int MATERIAL_MIDDLE  = (500 + ((8*10+4*30+2*50+90)*1)/3);
 }
 
 
-/****************************************************************************
- * Create a list of all legal moves (sorted strongest first, public version)
- ****************************************************************************/
-void ChessEvaluation::GenLegalMoveListSorted( vector<Move> &moves )
+// Quiescence search. A pawn is 40 in EvaluateLeaf() units, captures that
+//  can't raise alpha by DELTA_MARGIN more than the man captured are pruned
+#define QUIESCE_PAWN            40
+#define QUIESCE_DELTA_MARGIN    80
+
+// Value of captured and capturing men for quiescence move ordering
+static int quiesce_value( char piece )
 {
-    MOVELIST movelist;
-    GenLegalMoveListSorted( &movelist );
-    for( int i=0; i<movelist.count; i++ )
-        moves.push_back( movelist.moves[i] );
+    switch( piece )
+    {
+        case 'P': case 'p': return 1;
+        case 'N': case 'n': return 3;
+        case 'B': case 'b': return 3;
+        case 'R': case 'r': return 5;
+        case 'Q': case 'q': return 9;
+        case 'K': case 'k': return 10;
+    }
+    return 0;
 }
 
-/****************************************************************************
- * Create a list of all legal moves (sorted strongest first)
- ****************************************************************************/
-// Sort moves according to their score
+// Select the best scoring move at or after idx, and swap it into position
+//  idx (incremental selection sort, cutoffs mean we rarely need them all)
+static void quiesce_pick( MOVELIST &list, int scores[], int idx, bool reverse_ties )
+{
+    int best = idx;
+    for( int i=idx+1; i<list.count; i++ )
+    {
+        if( scores[i]>scores[best] || (reverse_ties && scores[i]==scores[best]) )
+            best = i;
+    }
+    if( best != idx )
+    {
+        Move tmp_move = list.moves[idx];
+        list.moves[idx] = list.moves[best];
+        list.moves[best] = tmp_move;
+        int tmp_score = scores[idx];
+        scores[idx] = scores[best];
+        scores[best] = tmp_score;
+    }
+}
+
+/****************************************************************************
+ * Quiescence search, only captures and queen promotions (or all moves if in
+ *  check) until the position is quiet enough for EvaluateLeaf() to be
+ *  trusted. Captures that can't raise alpha even if they win their man free
+ *  of charge (delta pruning) or that lose material (SEE) are skipped
+ ****************************************************************************/
+int ChessEvaluation::Quiesce( int alpha, int beta, int ply, QuiesceVisitor *visitor )
+{
+    if( visitor && visitor->Node(ply) )
+        return 0;
+
+    // In check, all evasions, no standing pat
+    MOVELIST list;
+    int best_score = -QUIESCE_INFINITY;
+    int stand_pat  = -QUIESCE_INFINITY;
+    bool in_check  = AttackedPiece( white ? wking_square : bking_square );
+    if( in_check && ply<QUIESCE_MAX_PLY-1 )
+    {
+        GenLegalMoveList( &list );
+        if( list.count == 0 )
+            return -QUIESCE_MATE+ply;
+    }
+
+    // Otherwise the side to move can stand pat, or try captures
+    else
+    {
+        int material, positional;
+        EvaluateLeaf( material, positional );
+        stand_pat = material*4 /*balance=4*/ + positional;
+        if( !white )
+            stand_pat = -stand_pat;
+        if( stand_pat>=beta || ply>=QUIESCE_MAX_PLY-1 )
+            return stand_pat;
+        if( stand_pat > alpha )
+            alpha = stand_pat;
+        best_score = stand_pat;
+        GenCaptureList( &list );
+    }
+    int scores[MAXMOVES];
+    for( int i=0; i<list.count; i++ )
+    {
+        Move mv = list.moves[i];
+        scores[i] = quiesce_value(mv.capture)*16 - quiesce_value(squares[mv.src]);
+        if( mv.special == SPECIAL_PROMOTION_QUEEN )
+            scores[i] += 9*16;
+    }
+    bool reverse_ties = (visitor && visitor->ReverseTies());
+    for( int i=0; i<list.count; i++ )
+    {
+        quiesce_pick( list, scores, i, reverse_ties );
+        Move mv = list.moves[i];
+        if( !in_check )
+        {
+            int gain = quiesce_value(mv.capture) + (mv.special==SPECIAL_PROMOTION_QUEEN ? 8 : 0);
+            if( stand_pat + gain*QUIESCE_PAWN + QUIESCE_DELTA_MARGIN <= alpha )
+                continue;
+            if( !SEEGreaterEqual(mv,0) )
+                continue;
+        }
+        PushMove( mv );
+
+        // Captures are generated without regard to check
+        if( !in_check && AttackedPiece( white ? bking_square : wking_square ) )
+        {
+            PopMove( mv );
+            continue;
+        }
+        int score = -Quiesce( -beta, -alpha, ply+1, visitor );
+        PopMove( mv );
+        if( visitor && visitor->Stopping() )
+            return 0;
+        if( score > best_score )
+        {
+            best_score = score;
+            if( score > alpha )
+            {
+                alpha = score;
+                if( visitor )
+                    visitor->BestMove( ply, mv );
+                if( alpha >= beta )
+                    break;
+            }
+        }
+    }
+    return best_score;
+}
+
+/****************************************************************************
+ * Create a list of all legal moves (sorted strongest first, public version)
+ ****************************************************************************/
+void ChessEvaluation::GenLegalMoveListSorted( vector<Move> &moves, bool quiesce )
+{
+    MOVELIST movelist;
+    GenLegalMoveListSorted( &movelist, quiesce );
+    for( int i=0; i<movelist.count; i++ )
+        moves.push_back( movelist.moves[i] );
+}
+
+/****************************************************************************
+ * Create a list of all legal moves (sorted strongest first)
+ ****************************************************************************/
+// Sort moves according to their score
 struct MOVE_IDX
 {
     int score;
@@ -5680,7 +6785,7 @@ struct MOVE_IDX
     bool operator >  (const MOVE_IDX& arg) const { return score >  arg.score; }
     bool operator == (const MOVE_IDX& arg) const { return score == arg.score; }
 };
-void ChessEvaluation::GenLegalMoveListSorted( MOVELIST *list )
+void ChessEvaluation::GenLegalMoveListSorted( MOVELIST *list, bool quiesce )
 {
     int i, j;
     bool okay;
@@ -5709,6 +6814,12 @@ void ChessEvaluation::GenLegalMoveListSorted( MOVELIST *list )
             else if( terminal_score==TERMINAL_WSTALEMATE ||
                      terminal_score==TERMINAL_BSTALEMATE )
                 score = 0;
+            else if( quiesce )
+            {
+                score = Quiesce( -QUIESCE_INFINITY, QUIESCE_INFINITY, 0 );
+                if( !white )    // score is from side to move's point of view
+                    score = -score;
+            }
             else
             {
                 int material, positional;
@@ -5735,19 +6846,3851 @@ void ChessEvaluation::GenLegalMoveListSorted( MOVELIST *list )
 }
 
 /****************************************************************************
- * Move.cpp Chess classes - Move
+ * MovePicker.cpp Chess classes - Staged move generation for searches
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+
+// Value of captured and capturing men, for most valuable victim, least
+//  valuable attacker ordering of captures
+static int picker_value( char piece )
+{
+    switch( piece )
+    {
+        case 'P': case 'p': return 1;
+        case 'N': case 'n': return 3;
+        case 'B': case 'b': return 3;
+        case 'R': case 'r': return 5;
+        case 'Q': case 'q': return 9;
+        case 'K': case 'k': return 10;
+    }
+    return 0;
+}
+
+/****************************************************************************
+ * Constructor
+ ****************************************************************************/
+MovePicker::MovePicker( ChessEvaluation &cr_, Move hash_move_, const Move *killers_,
+                                     int nbr_killers_, const int (*history_)[64] )
+    : cr(cr_)
+{
+    stage        = STAGE_HASH;
+    hash_move    = hash_move_;
+    nbr_killers  = 0;
+    for( int i=0; killers_ && i<nbr_killers_ && i<2; i++ )
+        killers[nbr_killers++] = killers_[i];
+    history      = history_;
+    idx          = 0;
+    nbr_captures = 0;
+    nbr_losing   = 0;
+    list.count   = 0;
+    cr.LegalityMasks( pinned, evasions );
+}
+
+/****************************************************************************
+ * Get the next legal move, returns false if there are no more
+ ****************************************************************************/
+bool MovePicker::Next( Move &mv )
+{
+    for(;;)
+    {
+        switch( stage )
+        {
+            case STAGE_HASH:
+            {
+                stage = STAGE_CAPTURES_INIT;
+                if( hash_move.Valid() && cr.IsPseudoLegal(hash_move) && Legal(hash_move) )
+                {
+                    mv = hash_move;
+                    return true;
+                }
+                hash_move.Invalid();
+                break;
+            }
+
+            case STAGE_CAPTURES_INIT:
+            {
+                cr.GenCaptureList( &list );
+                nbr_captures = list.count;
+                for( int i=0; i<nbr_captures; i++ )
+                {
+                    Move m = list.moves[i];
+                    scores[i] = picker_value(m.capture)*16 - picker_value(cr.squares[m.src]);
+                    if( m.special == SPECIAL_PROMOTION_QUEEN )
+                        scores[i] += 9*16;
+                }
+                idx = 0;
+                stage = STAGE_WINNING_CAPTURES;
+                break;
+            }
+
+            // Captures that lose material (by SEE) are put aside until last
+            case STAGE_WINNING_CAPTURES:
+            {
+                while( idx < nbr_captures )
+                {
+                    PickBest( idx, nbr_captures );
+                    Move m = list.moves[idx++];
+                    if( m==hash_move || !Legal(m) )
+                        continue;
+                    if( !cr.SEEGreaterEqual(m,0) )
+                    {
+                        list.moves[idx-1] = list.moves[nbr_losing];
+                        list.moves[nbr_losing++] = m;
+                        continue;
+                    }
+                    mv = m;
+                    return true;
+                }
+                idx = 0;
+                stage = STAGE_KILLERS;
+                break;
+            }
+
+            // Killers are quiet moves that caused a cutoff in a sibling
+            //  position, so they need checking here
+            case STAGE_KILLERS:
+            {
+                while( idx < nbr_killers )
+                {
+                    Move m = killers[idx++];
+                    if( m.Valid() && m!=hash_move && (idx==1 || m!=killers[0]) &&
+                        IsEmptySquare(m.capture) && m.special!=SPECIAL_PROMOTION_QUEEN &&
+                        cr.IsPseudoLegal(m) && Legal(m) )
+                    {
+                        mv = m;
+                        return true;
+                    }
+
+                    // Not picked, so the quiet stage mustn't skip it
+                    if( idx==1 || m!=killers[0] )
+                        killers[idx-1].Invalid();
+                }
+                stage = STAGE_QUIETS_INIT;
+                break;
+            }
+
+            case STAGE_QUIETS_INIT:
+            {
+                MOVELIST quiets;
+                cr.GenQuietList( &quiets );
+                for( int i=0; i<quiets.count; i++ )
+                {
+                    Move m = quiets.moves[i];
+                    list.moves[nbr_captures+i] = m;
+                    scores[nbr_captures+i] = history ? history[m.src][m.dst] : 0;
+                }
+                list.count = nbr_captures + quiets.count;
+                idx = nbr_captures;
+                stage = STAGE_QUIETS;
+                break;
+            }
+
+            case STAGE_QUIETS:
+            {
+                while( idx < list.count )
+                {
+                    PickBest( idx, list.count );
+                    Move m = list.moves[idx++];
+                    if( m == hash_move )
+                        continue;
+                    if( (nbr_killers>0 && m==killers[0]) || (nbr_killers>1 && m==killers[1]) )
+                        continue;
+                    if( Legal(m) )
+                    {
+                        mv = m;
+                        return true;
+                    }
+                }
+                idx = 0;
+                stage = STAGE_LOSING_CAPTURES;
+                break;
+            }
+
+            // Already checked for legality
+            case STAGE_LOSING_CAPTURES:
+            {
+                if( idx < nbr_losing )
+                {
+                    mv = list.moves[idx++];
+                    return true;
+                }
+                stage = STAGE_DONE;
+                break;
+            }
+
+            default:
+                return false;
+        }
+    }
+}
+
+/****************************************************************************
+ * Swap the best scoring move in list[from..end) into list[from] (incremental
+ *  selection sort, cutoffs mean we rarely need them all)
+ ****************************************************************************/
+void MovePicker::PickBest( int from, int end )
+{
+    int best = from;
+    for( int i=from+1; i<end; i++ )
+    {
+        if( scores[i] > scores[best] )
+            best = i;
+    }
+    if( best != from )
+    {
+        Move tmp_move = list.moves[from];
+        list.moves[from] = list.moves[best];
+        list.moves[best] = tmp_move;
+        int tmp_score = scores[from];
+        scores[from] = scores[best];
+        scores[best] = tmp_score;
+    }
+}
+/****************************************************************************
+ * ChessSearch.cpp Chess classes - Alpha-beta search built on ChessEvaluation
  *  Author:  Bill Forster
  *  License: MIT license. Full text of license is in associated file LICENSE
  *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
  ****************************************************************************/
 
+// Scores are in EvaluateLeaf() units, material*4 + positional, so a pawn
+//  is worth 40. Mate scores are MATE less the distance to mate in plies, as
+//  in ChessEvaluation::Quiesce()
+#define SEARCH_INFINITY     ((int)ChessEvaluation::QUIESCE_INFINITY)
+#define SEARCH_MATE         ((int)ChessEvaluation::QUIESCE_MATE)
+#define SEARCH_MATE_BOUND   (SEARCH_MATE-MAX_PLY)
+#define SEARCH_ASPIRATION   20
+
+/****************************************************************************
+ * Constructor
+ ****************************************************************************/
+Search::Search( int hash_megabytes )
+{
+    stop = false;
+    tt = NULL;
+    tt_generation = 0;
+    SetThreads( 1 );
+    SetHashSize( hash_megabytes );
+}
+
+/****************************************************************************
+ * Destructor
+ ****************************************************************************/
+Search::~Search()
+{
+    SetThreads( 0 );
+    delete[] tt;
+}
+
+/****************************************************************************
+ * Resize the transposition table (also clears it)
+ ****************************************************************************/
+void Search::SetHashSize( int megabytes )
+{
+    size_t nbr = 1;
+    size_t bytes = (size_t)(megabytes<1 ? 1 : megabytes) * 1024 * 1024;
+    while( nbr*2*sizeof(TT_BUCKET) <= bytes )
+        nbr *= 2;
+    delete[] tt;
+    tt = new TT_BUCKET[nbr];
+    tt_mask = nbr-1;
+    Clear();
+}
+
+/****************************************************************************
+ * Number of threads, main thread plus helpers
+ ****************************************************************************/
+void Search::SetThreads( int nbr )
+{
+    while( (int)threads.size() > nbr )
+    {
+        delete threads.back();
+        threads.pop_back();
+    }
+    while( (int)threads.size() < nbr )
+    {
+        THREAD_DATA *td = new THREAD_DATA;
+        td->search = this;
+        td->id = (int)threads.size();
+        memset( td->killers, 0, sizeof(td->killers) );
+        memset( td->history, 0, sizeof(td->history) );
+        threads.push_back( td );
+    }
+}
+
+/****************************************************************************
+ * Forget everything learnt from previous searches
+ ****************************************************************************/
+void Search::Clear()
+{
+    for( uint64_t i=0; i<=tt_mask; i++ )
+    {
+        for( int j=0; j<8; j++ )
+            tt[i].entries[j].data.store( 0, memory_order_relaxed );
+    }
+    for( unsigned int i=0; i<threads.size(); i++ )
+    {
+        memset( threads[i]->killers, 0, sizeof(threads[i]->killers) );
+        memset( threads[i]->history, 0, sizeof(threads[i]->history) );
+    }
+}
+
+/****************************************************************************
+ * Search a position, game history is respected for repetitions
+ ****************************************************************************/
+SearchResult Search::Go( const ChessRules &position, const SearchLimits &limits_ )
+{
+    SearchResult result;
+    result.best_move.Invalid();
+    result.score_cp = 0;
+    result.mate = 0;
+    result.depth = 0;
+    result.nodes = 0;
+    result.main_nodes = 0;
+    result.millisecs = 0;
+    limits = limits_;
+    nodes_shared = 0;
+    stop = false;
+    can_stop = false;
+    start_time = chrono::duration_cast<chrono::milliseconds>(
+                    chrono::steady_clock::now().time_since_epoch() ).count();
+    tt_generation++;
+
+    // Copy as a ChessRules so the key history (for repetitions) comes along,
+    //  plan once then give every thread its own copy
+    THREAD_DATA *main_td = threads[0];
+    static_cast<ChessRules&>(main_td->cr) = position;
+    main_td->cr.Planning();
+    for( unsigned int i=0; i<threads.size(); i++ )
+    {
+        THREAD_DATA *td = threads[i];
+        if( i > 0 )
+            td->cr = main_td->cr;
+        td->nodes = 0;
+        memset( td->killers, 0, sizeof(td->killers) );
+        for( int j=0; j<2; j++ )
+        {
+            for( int k=0; k<64; k++ )
+            {
+                for( int l=0; l<64; l++ )
+                    td->history[j][k][l] /= 8;
+            }
+        }
+    }
+    MOVELIST list;
+    main_td->cr.GenLegalMoveList( &list );
+    if( list.count == 0 )
+        return result;
+    result.best_move = list.moves[0];
+
+    // Helpers run until the main thread is done
+    std::vector<std::thread> helpers;
+    for( unsigned int i=1; i<threads.size(); i++ )
+        helpers.push_back( std::thread( &Search::IterativeDeepening, this, threads[i], (SearchResult *)NULL ) );
+    IterativeDeepening( main_td, &result );
+    stop = true;
+    for( unsigned int i=0; i<helpers.size(); i++ )
+        helpers[i].join();
+    for( unsigned int i=0; i<threads.size(); i++ )
+        result.nodes += threads[i]->nodes;
+    result.main_nodes = main_td->nodes;
+    result.millisecs = Elapsed();
+    return result;
+}
+
+/****************************************************************************
+ * Iterative deepening, main thread fills in result. Helper threads start
+ *  at staggered depths, so that the threads spread out over the tree
+ ****************************************************************************/
+void Search::IterativeDeepening( THREAD_DATA *td, SearchResult *result )
+{
+    int max_depth = MAX_DEPTH;
+    if( td->id==0 && limits.depth>0 && limits.depth<MAX_DEPTH )
+        max_depth = limits.depth;
+    int score = 0;
+    for( int depth=1+(td->id&1); depth<=max_depth; depth++ )
+    {
+        // Aspiration window around the previous iteration's score, widened
+        //  on failure
+        int delta = SEARCH_ASPIRATION;
+        int alpha = -SEARCH_INFINITY;
+        int beta  =  SEARCH_INFINITY;
+        if( depth >= 4 )
+        {
+            alpha = max( score-delta, -SEARCH_INFINITY );
+            beta  = min( score+delta,  SEARCH_INFINITY );
+        }
+        int iteration_score;
+        for(;;)
+        {
+            iteration_score = AlphaBeta( *td, alpha, beta, depth, 0, false );
+            if( stop )
+                break;
+            delta *= 4;
+            if( iteration_score <= alpha )
+                alpha = max( iteration_score-delta, -SEARCH_INFINITY );
+            else if( iteration_score >= beta )
+                beta  = min( iteration_score+delta,  SEARCH_INFINITY );
+            else
+                break;
+        }
+        if( stop )
+            break;
+        score = iteration_score;
+        if( !result )
+            continue;
+
+        // Main thread iteration completed
+        can_stop = true;
+        result->depth = depth;
+        result->pv.clear();
+        for( int i=0; i<td->pv_len[0]; i++ )
+            result->pv.push_back( td->pv[0][i] );
+        if( result->pv.size() > 0 )
+            result->best_move = result->pv[0];
+        if( score >= SEARCH_MATE_BOUND )
+        {
+            result->mate = (SEARCH_MATE-score+1)/2;
+            result->score_cp = 100000;
+        }
+        else if( score <= -SEARCH_MATE_BOUND )
+        {
+            result->mate = -(SEARCH_MATE+score)/2;
+            result->score_cp = -100000;
+        }
+        else
+        {
+            result->mate = 0;
+            result->score_cp = score*10/4;
+        }
+
+        // No point looking deeper once a forced mate is found
+        if( result->mate!=0 && depth > 2*abs(result->mate) )
+            break;
+        CheckLimits();
+        if( stop )
+            break;
+    }
+}
+
+/****************************************************************************
+ * Principal variation search, score from side to move's point of view
+ ****************************************************************************/
+int Search::AlphaBeta( THREAD_DATA &td, int alpha, int beta, int depth, int ply, bool null_ok )
+{
+    ChessEvaluation &cr = td.cr;
+    td.pv_len[ply] = ply;
+
+    // Draws by repetition or insufficient material
+    if( ply > 0 )
+    {
+        DRAWTYPE draw_type;
+        if( cr.GetRepetitionCount() >= 2 )
+            return 0;
+        if( cr.IsInsufficientDraw(cr.white,draw_type) && draw_type==DRAWTYPE_INSUFFICIENT_AUTO )
+            return 0;
+    }
+    if( ply >= MAX_PLY-1 )
+        return Evaluate( td );
+
+    // Extend checks, so quiescence never starts with the king in check
+    bool in_check = cr.AttackedPiece( cr.white ? cr.wking_square : cr.bking_square );
+    if( in_check )
+        depth++;
+    if( depth <= 0 )
+        return cr.Quiesce( alpha, beta, ply, &td );
+    CountNode( td );
+    if( stop )
+        return 0;
+    bool pv_node = (beta-alpha > 1);
+
+    // Transposition table
+    Move tt_move;
+    tt_move.Invalid();
+    TT_DATA entry;
+    if( Probe( cr.key, entry ) )
+    {
+        tt_move = entry.move.Unpack( cr );
+        int tt_score = entry.score;
+        if( tt_score >= SEARCH_MATE_BOUND )
+            tt_score -= ply;
+        else if( tt_score <= -SEARCH_MATE_BOUND )
+            tt_score += ply;
+        if( !pv_node && ply>0 && entry.depth>=depth )
+        {
+            if( entry.bound == BOUND_EXACT ||
+               (entry.bound == BOUND_LOWER && tt_score >= beta) ||
+               (entry.bound == BOUND_UPPER && tt_score <= alpha) )
+                return tt_score;
+        }
+    }
+
+    // Null move pruning, if passing still fails high the position is good
+    //  enough. Not when in check, and not with only king and pawns
+    //  (zugzwang)
+    if( null_ok && !pv_node && !in_check && depth>=3 && beta<SEARCH_MATE_BOUND )
+    {
+        Bitboard pieces = cr.white ?
+            (cr.bb_pieces[BB_WKNIGHT]|cr.bb_pieces[BB_WBISHOP]|cr.bb_pieces[BB_WROOK]|cr.bb_pieces[BB_WQUEEN]) :
+            (cr.bb_pieces[BB_BKNIGHT]|cr.bb_pieces[BB_BBISHOP]|cr.bb_pieces[BB_BROOK]|cr.bb_pieces[BB_BQUEEN]);
+        if( pieces )
+        {
+            int r = 2 + depth/4;
+            cr.PushNullMove();
+            int score = -AlphaBeta( td, -beta, -beta+1, depth-1-r, ply+1, false );
+            cr.PopNullMove();
+            if( stop )
+                return 0;
+            if( score >= beta )
+                return beta;
+        }
+    }
+
+    // Search the moves, the first with a full window, then the rest with a
+    //  null window and late quiet moves at reduced depth, re-searching
+    //  if they turn out better than expected
+    int alpha_original = alpha;
+    int best_score = -SEARCH_INFINITY;
+    Move best_move;
+    best_move.Invalid();
+    int side = cr.white ? 0 : 1;
+    MovePicker picker( cr, tt_move, td.killers[ply], 2, td.history[side] );
+    Move mv;
+    int i;
+    for( i=0; picker.Next(mv); i++ )
+    {
+        bool quiet = (IsEmptySquare(mv.capture) && (mv.special<SPECIAL_PROMOTION_QUEEN || mv.special>SPECIAL_PROMOTION_KNIGHT));
+        cr.PushMove( mv );
+        bool gives_check = cr.AttackedPiece( cr.white ? cr.wking_square : cr.bking_square );
+        int score;
+        if( i == 0 )
+            score = -AlphaBeta( td, -beta, -alpha, depth-1, ply+1, true );
+        else
+        {
+            int reduction = 0;
+            if( depth>=3 && i>=3 && quiet && !in_check && !gives_check &&
+                mv!=td.killers[ply][0] && mv!=td.killers[ply][1] )
+            {
+                reduction = (i>=8 && !pv_node) ? 2 : 1;
+                if( reduction > depth-2 )
+                    reduction = depth-2;
+            }
+            score = -AlphaBeta( td, -alpha-1, -alpha, depth-1-reduction, ply+1, true );
+            if( score>alpha && reduction>0 )
+                score = -AlphaBeta( td, -alpha-1, -alpha, depth-1, ply+1, true );
+            if( score>alpha && score<beta )
+                score = -AlphaBeta( td, -beta, -alpha, depth-1, ply+1, true );
+        }
+        cr.PopMove( mv );
+        if( stop )
+            return 0;
+        if( score > best_score )
+        {
+            best_score = score;
+            best_move  = mv;
+            if( score > alpha )
+            {
+                alpha = score;
+                td.pv[ply][ply] = mv;
+                for( int j=ply+1; j<td.pv_len[ply+1]; j++ )
+                    td.pv[ply][j] = td.pv[ply+1][j];
+                td.pv_len[ply] = td.pv_len[ply+1]>ply+1 ? td.pv_len[ply+1] : ply+1;
+                if( alpha >= beta )
+                {
+                    if( quiet )
+                    {
+                        if( mv != td.killers[ply][0] )
+                        {
+                            td.killers[ply][1] = td.killers[ply][0];
+                            td.killers[ply][0] = mv;
+                        }
+                        td.history[side][mv.src][mv.dst] += depth*depth;
+                        if( td.history[side][mv.src][mv.dst] > 1000000 )
+                        {
+                            for( int j=0; j<64; j++ )
+                            {
+                                for( int k=0; k<64; k++ )
+                                    td.history[side][j][k] /= 2;
+                            }
+                        }
+                    }
+                    break;
+                }
+            }
+        }
+    }
+
+    // Mate or stalemate if there were no moves
+    if( best_score == -SEARCH_INFINITY )
+        return in_check ? -SEARCH_MATE+ply : 0;
+    int bound = best_score>=beta ? BOUND_LOWER : (best_score>alpha_original ? BOUND_EXACT : BOUND_UPPER);
+    Store( cr.key, best_move, best_score, depth, bound, ply );
+    return best_score;
+}
+
+/****************************************************************************
+ * Count nodes, checking limits every so often
+ ****************************************************************************/
+void Search::CountNode( THREAD_DATA &td )
+{
+    td.nodes++;
+    if( (td.nodes&1023) == 0 )
+    {
+        nodes_shared += 1024;
+        if( td.id==0 && can_stop )
+            CheckLimits();
+    }
+}
+
+/****************************************************************************
+ * Score the side to move's position without searching further
+ ****************************************************************************/
+int Search::Evaluate( THREAD_DATA &td )
+{
+    ChessEvaluation &cr = td.cr;
+    int material, positional;
+    cr.EvaluateLeaf( material, positional );
+    int score = material*4 + positional;    // balance = 4, as in GenLegalMoveListSorted()
+    return cr.white ? score : -score;
+}
+
+/****************************************************************************
+ * ChessEvaluation::Quiesce() is searching a node, count it
+ *  return bool stop
+ ****************************************************************************/
+bool Search::THREAD_DATA::Node( int ply )
+{
+    pv_len[ply] = ply;
+    search->CountNode( *this );
+    return search->stop;
+}
+
+/****************************************************************************
+ * Is ChessEvaluation::Quiesce() to stop ?
+ ****************************************************************************/
+bool Search::THREAD_DATA::Stopping()
+{
+    return search->stop;
+}
+
+/****************************************************************************
+ * ChessEvaluation::Quiesce() found a better move at ply, it and the PV
+ *  from ply+1 are the PV from ply
+ ****************************************************************************/
+void Search::THREAD_DATA::BestMove( int ply, Move mv )
+{
+    pv[ply][ply] = mv;
+    for( int j=ply+1; j<pv_len[ply+1]; j++ )
+        pv[ply][j] = pv[ply+1][j];
+    pv_len[ply] = pv_len[ply+1]>ply+1 ? pv_len[ply+1] : ply+1;
+}
+
+/****************************************************************************
+ * Odd numbered helper threads break ChessEvaluation::Quiesce() move
+ *  ordering ties the other way, for variety
+ ****************************************************************************/
+bool Search::THREAD_DATA::ReverseTies()
+{
+    return (id&1) != 0;
+}
+
+/****************************************************************************
+ * Check time and node limits, set stop if exceeded
+ ****************************************************************************/
+void Search::CheckLimits()
+{
+    if( limits.nodes>0 && nodes_shared>=limits.nodes )
+        stop = true;
+    if( limits.millisecs>0 && Elapsed()>=limits.millisecs )
+        stop = true;
+}
+
+/****************************************************************************
+ * Elapsed time since search started
+ ****************************************************************************/
+int Search::Elapsed()
+{
+    long long now = chrono::duration_cast<chrono::milliseconds>(
+                        chrono::steady_clock::now().time_since_epoch() ).count();
+    return (int)(now-start_time);
+}
+
+/****************************************************************************
+ * Transposition table access. Data is packed as move (a PackedMove, 16
+ *  bits), score (16), depth (8), bound (2), generation (6) and the top 16
+ *  bits of the key. The low bits of the key pick the bucket. The generation
+ *  lets us prefer to replace entries left over from previous searches
+ ****************************************************************************/
+bool Search::Probe( uint64_t key, TT_DATA &tt_data )
+{
+    TT_BUCKET &bucket = tt[key&tt_mask];
+    uint16_t key16 = (uint16_t)(key>>48);
+    for( int i=0; i<8; i++ )
+    {
+        uint64_t data = bucket.entries[i].data.load( memory_order_relaxed );
+        if( (uint16_t)(data>>48)==key16 && ((data>>40)&3)!=BOUND_NONE )
+        {
+            tt_data.move.bits = (uint16_t)data;
+            tt_data.score = (int16_t)(data>>16);
+            tt_data.depth = (int8_t)(data>>32);
+            tt_data.bound = (int)((data>>40)&3);
+            return true;
+        }
+    }
+    return false;
+}
+
+void Search::Store( uint64_t key, Move move, int score, int depth, int bound, int ply )
+{
+    // Replace the same position (unless it's deeper and we're not exact),
+    //  otherwise the shallowest entry, treating old entries as shallow
+    TT_BUCKET &bucket = tt[key&tt_mask];
+    uint16_t key16 = (uint16_t)(key>>48);
+    TT_ENTRY *replace = NULL;
+    int replace_value = 0;
+    for( int i=0; i<8; i++ )
+    {
+        TT_ENTRY *entry = &bucket.entries[i];
+        uint64_t data = entry->data.load( memory_order_relaxed );
+        int entry_depth = (int8_t)(data>>32);
+        if( (uint16_t)(data>>48)==key16 && ((data>>40)&3)!=BOUND_NONE )
+        {
+            if( entry_depth>depth && bound!=BOUND_EXACT )
+                return;
+            replace = entry;
+            break;
+        }
+        int age = (int)((tt_generation - (unsigned int)(data>>42)) & 63);
+        int value = ((data>>40)&3)==BOUND_NONE ? -1000 : entry_depth - 8*age;
+        if( replace==NULL || value<replace_value )
+        {
+            replace = entry;
+            replace_value = value;
+        }
+    }
+    if( score >= SEARCH_MATE_BOUND )
+        score += ply;
+    else if( score <= -SEARCH_MATE_BOUND )
+        score -= ply;
+    PackedMove packed;
+    packed.Pack( move );
+    uint64_t data = (uint64_t)packed.bits
+                  | ((uint64_t)(uint16_t)score << 16)
+                  | ((uint64_t)(uint8_t)depth << 32)
+                  | ((uint64_t)bound << 40)
+                  | ((uint64_t)(tt_generation&63) << 42)
+                  | ((uint64_t)key16 << 48);
+    replace->data.store( data, memory_order_relaxed );
+}
+/****************************************************************************
+ * MappedFile.cpp Chess classes - Read only memory mapped files
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#else
+#endif
+
+/****************************************************************************
+ * Constructor
+ ****************************************************************************/
+MappedFile::MappedFile()
+{
+    data           = "";
+    size           = 0;
+    is_open        = false;
+    file_handle    = NULL;
+    mapping_handle = NULL;
+}
+
+/****************************************************************************
+ * Destructor
+ ****************************************************************************/
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+/****************************************************************************
+ * Map a file
+ *  return bool okay
+ ****************************************************************************/
+bool MappedFile::Open( const char *filename, bool sequential )
+{
+    Close();
+#ifdef _WIN32
+    HANDLE file = CreateFileA( filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                               sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_ATTRIBUTE_NORMAL, NULL );
+    if( file == INVALID_HANDLE_VALUE )
+        return false;
+    LARGE_INTEGER file_size;
+    if( !GetFileSizeEx(file,&file_size) || (unsigned long long)file_size.QuadPart > (size_t)-1 )
+    {
+        CloseHandle( file );
+        return false;
+    }
+    if( file_size.QuadPart > 0 )
+    {
+        HANDLE mapping = CreateFileMappingA( file, NULL, PAGE_READONLY, 0, 0, NULL );
+        const char *view = mapping ? (const char *)MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 ) : NULL;
+        if( !view )
+        {
+            if( mapping )
+                CloseHandle( mapping );
+            CloseHandle( file );
+            return false;
+        }
+        data           = view;
+        size           = (size_t)file_size.QuadPart;
+        mapping_handle = mapping;
+    }
+    file_handle = file;
+#else
+    int fd = open( filename, O_RDONLY );
+    if( fd < 0 )
+        return false;
+    struct stat st;
+    if( fstat(fd,&st)!=0 || (unsigned long long)st.st_size > (size_t)-1 )
+    {
+        close( fd );
+        return false;
+    }
+    if( st.st_size > 0 )
+    {
+        void *view = mmap( NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        if( view == MAP_FAILED )
+        {
+            close( fd );
+            return false;
+        }
+        if( sequential )
+            madvise( view, (size_t)st.st_size, MADV_SEQUENTIAL );
+        data = (const char *)view;
+        size = (size_t)st.st_size;
+    }
+    close( fd );    // the mapping stays valid
+#endif
+    is_open = true;
+    return true;
+}
+
+/****************************************************************************
+ * Unmap the file
+ ****************************************************************************/
+void MappedFile::Close()
+{
+    if( is_open && size>0 )
+    {
+#ifdef _WIN32
+        UnmapViewOfFile( data );
+        CloseHandle( (HANDLE)mapping_handle );
+#else
+        munmap( (void *)data, size );
+#endif
+    }
+#ifdef _WIN32
+    if( is_open )
+        CloseHandle( (HANDLE)file_handle );
+#endif
+    data           = "";
+    size           = 0;
+    is_open        = false;
+    file_handle    = NULL;
+    mapping_handle = NULL;
+}
+/****************************************************************************
+ * PgnReader.cpp Chess classes - Read games from PGN files
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+
+// White space in PGN
+static inline bool pgn_space( char c )
+{
+    return c==' ' || c=='\n' || c=='\r' || c=='\t' || c=='\f' || c=='\v';
+}
+
+// Characters that end a move (or move number, or result) in the movetext
+static inline bool pgn_delimiter( char c )
+{
+    switch( c )
+    {
+        case ' ': case '\n': case '\r': case '\t': case '\f': case '\v':
+        case '{': case '}': case '(': case ')': case ';': case '$': case '[': case ']':
+            return true;
+    }
+    return false;
+}
+
+// Length of a game termination marker at p, or 0 if there isn't one
+static inline size_t pgn_result( const char *p, const char *end )
+{
+    size_t n = end-p;
+    size_t r = 0;
+    if( n>=1 && p[0]=='*' )
+        r = 1;
+    else if( n>=3 && (0==memcmp(p,"1-0",3) || 0==memcmp(p,"0-1",3)) )
+        r = 3;
+    else if( n>=7 && 0==memcmp(p,"1/2-1/2",7) )
+        r = 7;
+    if( r && r<n && !pgn_delimiter(p[r]) )
+        r = 0;
+    return r;
+}
+
+// Skip to the end of the line (to the '\n')
+static inline const char *pgn_skip_line( const char *p, const char *end )
+{
+    const char *q = (const char *)memchr( p, '\n', end-p );
+    return q ? q : end;
+}
+
+// Skip a {comment}, p points at the '{'
+static inline const char *pgn_skip_comment( const char *p, const char *end )
+{
+    const char *q = (const char *)memchr( p, '}', end-p );
+    return q ? q+1 : end;
+}
+
+/****************************************************************************
+ * Is it the same as a '\0' terminated string ?
+ ****************************************************************************/
+bool PgnSpan::Equals( const char *s ) const
+{
+    for( size_t i=0; i<len; i++ )
+    {
+        if( s[i] != ptr[i] )    // including s[i]=='\0'
+            return false;
+    }
+    return s[len] == '\0';
+}
+
+/****************************************************************************
+ * Find a tag by name
+ *  return bool found
+ ****************************************************************************/
+bool PgnGame::Tag( const char *name, PgnSpan &value ) const
+{
+    for( int i=0; i<nbr_tags; i++ )
+    {
+        if( tags[i].name.Equals(name) )
+        {
+            value = tags[i].value;
+            return true;
+        }
+    }
+    return false;
+}
+
+/****************************************************************************
+ * Constructor
+ ****************************************************************************/
+PgnReader::PgnReader()
+{
+    text     = "";
+    len      = 0;
+    pos      = 0;
+    game_nbr = 0;
+    lenient  = false;
+}
+
+/****************************************************************************
+ * Memory map a PGN file
+ *  return bool okay
+ ****************************************************************************/
+bool PgnReader::Open( const char *filename )
+{
+    Close();
+    bool okay = file.Open( filename, true );
+    if( okay )
+        Attach( file.Data(), file.Size() );
+    return okay;
+}
+
+/****************************************************************************
+ * Read PGN text that's already in memory
+ ****************************************************************************/
+void PgnReader::Attach( const char *text_, size_t len_, long long first_game_nbr )
+{
+    text     = text_;
+    len      = len_;
+    pos      = 0;
+    game_nbr = first_game_nbr;
+}
+
+/****************************************************************************
+ * Finished with the file or text
+ ****************************************************************************/
+void PgnReader::Close()
+{
+    file.Close();
+    Attach( "", 0 );
+}
+
+/****************************************************************************
+ * Find the next game
+ *  return bool found
+ ****************************************************************************/
+bool PgnReader::NextGame( PgnGame &game )
+{
+    const char *p   = text+pos;
+    const char *end = text+len;
+
+    // Skip blank lines, a byte order mark and '%' escaped lines
+    for(;;)
+    {
+        while( p<end && pgn_space(*p) )
+            p++;
+        if( p<end && *p=='%' )
+            p = pgn_skip_line(p,end);
+        else if( end-p>=3 && (unsigned char)p[0]==0xef && (unsigned char)p[1]==0xbb && (unsigned char)p[2]==0xbf )
+            p += 3;
+        else
+            break;
+    }
+    if( p >= end )
+    {
+        pos = len;
+        return false;
+    }
+    const char *start = p;
+    game.nbr      = game_nbr++;
+    game.offset   = p-text;
+    game.result   = PgnSpan();
+    game.nbr_tags = 0;
+
+    // Tag pairs, eg [Event "F/S Return Match"]
+    while( p<end && *p=='[' )
+    {
+        const char *eol = pgn_skip_line(p,end);
+        p++;
+        while( p<eol && (*p==' ' || *p=='\t') )
+            p++;
+        const char *name = p;
+        while( p<eol && !pgn_space(*p) && *p!='"' && *p!=']' )
+            p++;
+        PgnSpan name_span( name, p-name );
+        while( p<eol && *p!='"' && *p!=']' )
+            p++;
+        if( p<eol && *p=='"' )
+        {
+            const char *value = ++p;
+            while( p<eol && *p!='"' )
+            {
+                if( *p=='\\' && p+1<eol )
+                    p++;
+                p++;
+            }
+            if( game.nbr_tags<PgnGame::MAX_TAGS && name_span.len>0 )
+            {
+                PgnTag &tag = game.tags[game.nbr_tags++];
+                tag.name  = name_span;
+                tag.value = PgnSpan( value, p-value );
+            }
+        }
+
+        // Usually one tag per line, but allow more
+        const char *close = (const char *)memchr( p, ']', eol-p );
+        p = close ? close+1 : eol;
+        while( p<end && pgn_space(*p) )
+            p++;
+    }
+
+    // The movetext ends with a termination marker, or if that's missing,
+    //  where the next game's tags start
+    const char *movetext = p;
+    int depth = 0;
+    while( p < end )
+    {
+        switch( *p )
+        {
+            case '{':
+                p = pgn_skip_comment(p,end);
+                continue;
+            case ';':
+                p = pgn_skip_line(p,end);
+                continue;
+            case '(':
+                depth++;
+                break;
+            case ')':
+                if( depth > 0 )
+                    depth--;
+                break;
+            case '%':
+            case '[':
+            {
+                bool line_start = (p==text || p[-1]=='\n');
+                if( line_start && *p=='%' )
+                {
+                    p = pgn_skip_line(p,end);
+                    continue;
+                }
+                if( line_start && p>movetext )
+                    goto done;
+                break;
+            }
+            case '*':
+            case '0':
+            case '1':
+            {
+                size_t r;
+                if( depth==0 && (p==movetext || pgn_delimiter(p[-1])) && 0!=(r=pgn_result(p,end)) )
+                {
+                    game.result = PgnSpan( p, r );
+                    p += r;
+                    goto done;
+                }
+                break;
+            }
+        }
+        p++;
+    }
+done:
+    game.text     = PgnSpan( start, p-start );
+    game.movetext = PgnSpan( movetext, p-movetext );
+    pos = p-text;
+    return true;
+}
+
+/****************************************************************************
+ * Replay a game's mainline
+ *  return bool okay
+ ****************************************************************************/
+bool PgnReader::Replay( const PgnGame &game, PgnVisitor &visitor )
+{
+    bool okay = true;
+    cr = ChessPosition();
+    PgnSpan fen;
+    if( game.Tag("FEN",fen) )
+        okay = cr.Forsyth( fen.ptr, fen.len );
+    const char *p   = game.movetext.ptr;
+    const char *end = p + game.movetext.len;
+    int  ply  = 0;
+    bool stop = !okay;
+    while( !stop && p<end )
+    {
+        char c = *p;
+        if( pgn_space(c) )
+        {
+            p++;
+            continue;
+        }
+        switch( c )
+        {
+            case '{':
+                p = pgn_skip_comment(p,end);
+                break;
+            case ';':
+            case '%':
+                p = pgn_skip_line(p,end);
+                break;
+
+            // Variation, skip it (and any variations inside it)
+            case '(':
+            {
+                int depth = 1;
+                p++;
+                while( depth>0 && p<end )
+                {
+                    if( *p == '{' )
+                        p = pgn_skip_comment(p,end);
+                    else if( *p == ';' )
+                        p = pgn_skip_line(p,end);
+                    else
+                    {
+                        if( *p == '(' )
+                            depth++;
+                        else if( *p == ')' )
+                            depth--;
+                        p++;
+                    }
+                }
+                break;
+            }
+
+            // NAG, eg $1
+            case '$':
+            {
+                p++;
+                while( p<end && '0'<=*p && *p<='9' )
+                    p++;
+                break;
+            }
+
+            default:
+            {
+                const char *q = p;
+                while( q<end && !pgn_delimiter(*q) )
+                    q++;
+
+                // Result, the end of the game
+                if( pgn_result(p,q) )
+                {
+                    stop = true;
+                    break;
+                }
+
+                // Move number, eg "12." or "12...", maybe run into the move, eg "12.e4"
+                if( '0'<=c && c<='9' && !(c=='0' && q-p>=3 && p[1]=='-' && p[2]=='0') )
+                {
+                    while( p<q && '0'<=*p && *p<='9' )
+                        p++;
+                    while( p<q && *p=='.' )
+                        p++;
+                    break;
+                }
+
+                // Moves start with a piece, file or castling, anything else
+                //  (eg "!", "+-" or stray punctuation) is an annotation
+                bool is_move = ('a'<=c && c<='h') || c=='K' || c=='Q' || c=='R' ||
+                               c=='B' || c=='N' || c=='O' || c=='0';
+                bool is_ep   = (q-p==2 && 0==memcmp(p,"ep",2)) || (q-p==4 && 0==memcmp(p,"e.p.",4));
+                if( is_move && !is_ep )
+                {
+                    // The strict parser handles properly formed SAN, if
+                    //  lenient fall back to the forgiving one for anything
+                    //  else, but never guess at an ambiguous move
+                    Move mv;
+                    bool found = mv.NaturalInFast( &cr, p, q-p );
+                    if( !found && lenient )
+                        found = mv.NaturalInUnique( &cr, p, q-p );
+                    if( !found )
+                    {
+                        okay = false;
+                        stop = true;
+                    }
+                    else if( !visitor.GameMove(game,ply,cr,mv) )
+                        stop = true;
+                    else
+                    {
+                        cr.PlayMove( mv );
+                        ply++;
+                    }
+                }
+                p = q;
+                break;
+            }
+
+            // Unexpected here, ignore it
+            case ')':
+            case '}':
+            case '[':
+            case ']':
+                p++;
+                break;
+        }
+    }
+    visitor.GameEnd( game, cr, !okay );
+    return okay;
+}
+
+/****************************************************************************
+ * Read and replay all the (remaining) games
+ *  return number of games
+ ****************************************************************************/
+long long PgnReader::Read( PgnVisitor &visitor )
+{
+    long long nbr = 0;
+    PgnGame game;
+    while( NextGame(game) )
+    {
+        nbr++;
+        if( visitor.GameBegin(game) )
+            Replay( game, visitor );
+    }
+    return nbr;
+}
+/****************************************************************************
+ * PgnPipeline.cpp Chess classes - Read PGN files on multiple threads
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+
+/****************************************************************************
+ * Constructor
+ ****************************************************************************/
+PgnPipeline::PgnPipeline()
+{
+    chunk_size  = 1024*1024;
+    queue_size  = 4;
+    ordered     = true;
+    lenient     = false;
+    text        = "";
+    window      = 0;
+    next_chunk  = 0;
+    nbr_reduced = 0;
+    queue       = NULL;
+    nbr_pushed  = 0;
+}
+
+/****************************************************************************
+ * Split PGN text into chunks of whole games
+ ****************************************************************************/
+void PgnPipeline::Split( const char *text, size_t len, size_t chunk_size, std::vector<PgnChunk> &chunks )
+{
+    chunks.clear();
+    size_t start = 0;
+    while( start < len )
+    {
+        // Look for "\n[Event " from chunk_size bytes on
+        size_t end = len;
+        if( chunk_size < len-start )
+        {
+            const char *p   = text + start + chunk_size;
+            const char *eot = text + len;
+            while( p < eot )
+            {
+                p = (const char *)memchr( p, '[', eot-p );
+                if( !p )
+                    break;
+                if( p[-1]=='\n' && eot-p>=7 && 0==memcmp(p+1,"Event ",6) )
+                {
+                    end = p-text;
+                    break;
+                }
+                p++;
+            }
+        }
+        PgnChunk chunk;
+        chunk.nbr    = (long long)chunks.size();
+        chunk.offset = start;
+        chunk.len    = end-start;
+        chunks.push_back( chunk );
+        start = end;
+    }
+}
+
+/****************************************************************************
+ * Read a PGN file
+ *  return number of games, or -1 if the file can't be opened
+ ****************************************************************************/
+long long PgnPipeline::Run( const char *filename, PgnWorker *workers[], int nbr_workers, PgnReducer &reducer )
+{
+    MappedFile file;
+    if( !file.Open(filename,true) )
+        return -1;
+    return Run( file.Data(), file.Size(), workers, nbr_workers, reducer );
+}
+
+/****************************************************************************
+ * Read PGN text that's already in memory
+ *  return number of games
+ ****************************************************************************/
+long long PgnPipeline::Run( const char *text_, size_t len, PgnWorker *workers[], int nbr_workers, PgnReducer &reducer )
+{
+    text = text_;
+    Split( text, len, chunk_size, chunks );
+    long long nbr_chunks = (long long)chunks.size();
+    window      = (long long)queue_size * (nbr_workers>0 ? nbr_workers : 1);
+    next_chunk  = 0;
+    nbr_reduced = 0;
+    nbr_pushed  = 0;
+    queue       = new BoundedQueue<QueueItem>( (size_t)window );
+    std::vector<std::thread> threads;
+    for( int i=0; i<nbr_workers; i++ )
+        threads.push_back( std::thread( &PgnPipeline::WorkerThread, this, workers[i] ) );
+
+    // Reduce on this thread. When ordered, chunks that arrive early wait in
+    //  pending[], the window means there's always room for them
+    std::vector<QueueItem> pending( (size_t)window );
+    std::vector<bool>      is_pending( (size_t)window, false );
+    long long nbr_games  = 0;
+    long long reduced    = 0;
+    long long nbr_popped = 0;
+    while( reduced<nbr_chunks && nbr_workers>0 )
+    {
+        QueueItem item;
+        if( !queue->TryPop(item) )
+        {
+            // Sleep until a worker pushes something
+            std::unique_lock<std::mutex> lock( mutex );
+            while( nbr_pushed == nbr_popped )
+                item_ready.wait( lock );
+            continue;
+        }
+        nbr_popped++;
+        if( !ordered )
+        {
+            Reduce( item, reducer, nbr_games );
+            nbr_reduced.store( ++reduced, std::memory_order_release );
+        }
+        else
+        {
+            pending[ (size_t)(item.chunk_nbr%window) ]    = item;
+            is_pending[ (size_t)(item.chunk_nbr%window) ] = true;
+            while( reduced<nbr_chunks && is_pending[(size_t)(reduced%window)] )
+            {
+                is_pending[(size_t)(reduced%window)] = false;
+                Reduce( pending[(size_t)(reduced%window)], reducer, nbr_games );
+                nbr_reduced.store( ++reduced, std::memory_order_release );
+            }
+        }
+
+        // The window may have moved on, wake any workers waiting for it
+        //  (taking the mutex means a worker can't miss the wake up between
+        //  testing nbr_reduced and sleeping)
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+        }
+        space_ready.notify_all();
+    }
+    for( unsigned int i=0; i<threads.size(); i++ )
+        threads[i].join();
+    delete queue;
+    queue = NULL;
+    return nbr_games;
+}
+
+/****************************************************************************
+ * Pass a chunk's results to the reducer
+ ****************************************************************************/
+void PgnPipeline::Reduce( QueueItem &item, PgnReducer &reducer, long long &nbr_games )
+{
+    if( item.result )
+    {
+        item.result->chunk_nbr      = item.chunk_nbr;
+        item.result->nbr_games      = item.nbr_games;
+        item.result->first_game_nbr = ordered ? nbr_games : -1;
+        reducer.Reduce( *item.result );
+        delete item.result;
+        item.result = NULL;
+    }
+    nbr_games += item.nbr_games;
+}
+
+/****************************************************************************
+ * A worker thread, takes chunks until there are none left
+ ****************************************************************************/
+void PgnPipeline::WorkerThread( PgnWorker *worker )
+{
+    PgnReader reader;
+    reader.SetLenient( lenient );
+    long long nbr_chunks = (long long)chunks.size();
+    for(;;)
+    {
+        long long chunk_nbr = next_chunk.fetch_add( 1 );
+        if( chunk_nbr >= nbr_chunks )
+            break;
+
+        // Don't get too far ahead of the reducer, sleep until it catches up
+        if( chunk_nbr >= nbr_reduced.load(std::memory_order_acquire) + window )
+        {
+            std::unique_lock<std::mutex> lock( mutex );
+            while( chunk_nbr >= nbr_reduced.load(std::memory_order_acquire) + window )
+                space_ready.wait( lock );
+        }
+        const PgnChunk &chunk = chunks[(size_t)chunk_nbr];
+        reader.Attach( text+chunk.offset, chunk.len );
+        worker->ChunkBegin( chunk );
+        QueueItem item;
+        item.chunk_nbr = chunk_nbr;
+        item.nbr_games = reader.Read( *worker );
+        item.result    = worker->ChunkEnd( chunk );
+
+        // Every chunk in the queue is inside the window, and the queue holds
+        //  at least a window's worth, so there's always room
+        queue->TryPush( item );
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            nbr_pushed++;
+        }
+        item_ready.notify_one();
+    }
+}
+/****************************************************************************
+ * GameCodec.cpp Chess classes - Compress games, a fraction of a byte per move
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+
+// Probabilities move 1/32 of the way towards each bit coded
+static const int codec_prob_shift = 5;
+
+// Piece values for ranking moves
+static int codec_value( char piece )
+{
+    switch( piece )
+    {
+        case 'P': case 'p': return 100;
+        case 'N': case 'n': return 300;
+        case 'B': case 'b': return 310;
+        case 'R': case 'r': return 500;
+        case 'Q': case 'q': return 900;
+    }
+    return 0;
+}
+
+// Piece square tables for ranking moves, from white's point of view (so
+//  a8 first), flip the square (sq^56) for black. Pawn, knight, bishop,
+//  rook, queen, king (middlegame) and king (endgame)
+static const int codec_pst[7][64] =
+{
+    {     0,  0,  0,  0,  0,  0,  0,  0,
+         50, 50, 50, 50, 50, 50, 50, 50,
+         10, 10, 20, 30, 30, 20, 10, 10,
+          5,  5, 10, 25, 25, 10,  5,  5,
+          0,  0,  0, 20, 20,  0,  0,  0,
+          5, -5,-10,  0,  0,-10, -5,  5,
+          5, 10, 10,-20,-20, 10, 10,  5,
+          0,  0,  0,  0,  0,  0,  0,  0 },
+    {   -50,-40,-30,-30,-30,-30,-40,-50,
+        -40,-20,  0,  0,  0,  0,-20,-40,
+        -30,  0, 10, 15, 15, 10,  0,-30,
+        -30,  5, 15, 20, 20, 15,  5,-30,
+        -30,  0, 15, 20, 20, 15,  0,-30,
+        -30,  5, 10, 15, 15, 10,  5,-30,
+        -40,-20,  0,  5,  5,  0,-20,-40,
+        -50,-40,-30,-30,-30,-30,-40,-50 },
+    {   -20,-10,-10,-10,-10,-10,-10,-20,
+        -10,  0,  0,  0,  0,  0,  0,-10,
+        -10,  0,  5, 10, 10,  5,  0,-10,
+        -10,  5,  5, 10, 10,  5,  5,-10,
+        -10,  0, 10, 10, 10, 10,  0,-10,
+        -10, 10, 10, 10, 10, 10, 10,-10,
+        -10,  5,  0,  0,  0,  0,  5,-10,
+        -20,-10,-10,-10,-10,-10,-10,-20 },
+    {     0,  0,  0,  0,  0,  0,  0,  0,
+          5, 10, 10, 10, 10, 10, 10,  5,
+         -5,  0,  0,  0,  0,  0,  0, -5,
+         -5,  0,  0,  0,  0,  0,  0, -5,
+         -5,  0,  0,  0,  0,  0,  0, -5,
+         -5,  0,  0,  0,  0,  0,  0, -5,
+         -5,  0,  0,  0,  0,  0,  0, -5,
+          0,  0,  0,  5,  5,  0,  0,  0 },
+    {   -20,-10,-10, -5, -5,-10,-10,-20,
+        -10,  0,  0,  0,  0,  0,  0,-10,
+        -10,  0,  5,  5,  5,  5,  0,-10,
+         -5,  0,  5,  5,  5,  5,  0, -5,
+          0,  0,  5,  5,  5,  5,  0, -5,
+        -10,  5,  5,  5,  5,  5,  0,-10,
+        -10,  0,  5,  0,  0,  0,  0,-10,
+        -20,-10,-10, -5, -5,-10,-10,-20 },
+    {   -30,-40,-40,-50,-50,-40,-40,-30,
+        -30,-40,-40,-50,-50,-40,-40,-30,
+        -30,-40,-40,-50,-50,-40,-40,-30,
+        -30,-40,-40,-50,-50,-40,-40,-30,
+        -20,-30,-30,-40,-40,-30,-30,-20,
+        -10,-20,-20,-20,-20,-20,-20,-10,
+         20, 20,  0,  0,  0,  0, 20, 20,
+         20, 30, 10,  0,  0, 10, 30, 20 },
+    {   -50,-40,-30,-20,-20,-30,-40,-50,
+        -30,-20,-10,  0,  0,-10,-20,-30,
+        -30,-10, 20, 30, 30, 20,-10,-30,
+        -30,-10, 30, 40, 40, 30,-10,-30,
+        -30,-10, 30, 40, 40, 30,-10,-30,
+        -30,-10, 20, 30, 30, 20,-10,-30,
+        -30,-30,  0,  0,  0,  0,-30,-30,
+        -50,-30,-30,-30,-30,-30,-30,-50 }
+};
+
+// Squares attacked by one side's men (base = BB_WPAWN or BB_BPAWN)
+static Bitboard codec_attacks( const ChessPosition &cp, int base, Bitboard occupied )
+{
+    Bitboard attacked = 0;
+    for( int i=0; i<6; i++ )
+    {
+        for( Bitboard bb=cp.bb_pieces[base+i]; bb; )
+        {
+            Square sq = bb_pop_lsb( bb );
+            Bitboard a = 0;
+            switch( i )
+            {
+                case 0: a = base==BB_WPAWN ? pawn_white_attacks_bb[sq] : pawn_black_attacks_bb[sq]; break;
+                case 1: a = knight_attacks_bb[sq];              break;
+                case 2: a = bishop_attacks_bb(sq,occupied);     break;
+                case 3: a = rook_attacks_bb(sq,occupied);       break;
+                case 4: a = queen_attacks_bb(sq,occupied);      break;
+                case 5: a = king_attacks_bb[sq];                break;
+            }
+            attacked |= a;
+        }
+    }
+    return attacked;
+}
+
+// Squares attacked by one side's pawns
+static Bitboard codec_pawn_attacks( const ChessPosition &cp, bool white )
+{
+    Bitboard attacked = 0;
+    for( Bitboard bb=cp.bb_pieces[white?BB_WPAWN:BB_BPAWN]; bb; )
+    {
+        Square sq = bb_pop_lsb( bb );
+        attacked |= (white ? pawn_white_attacks_bb[sq] : pawn_black_attacks_bb[sq]);
+    }
+    return attacked;
+}
+
+// How much a man is likely to lose by standing on a square the other side
+//  attacks, a very rough static exchange evaluation
+static int codec_risk( Bitboard square, int value, Bitboard them, Bitboard them_pawns, Bitboard us )
+{
+    if( !(square & them) )
+        return 0;
+    if( !(square & us) )
+        return value;
+    if( square & them_pawns )
+        return value>100 ? value-100 : 0;
+    return value>330 ? value-330 : 0;
+}
+
+/****************************************************************************
+ * Start a stream
+ ****************************************************************************/
+void RangeEncoder::Begin( std::vector<unsigned char> *out_ )
+{
+    out        = out_;
+    low        = 0;
+    range      = 0xffffffff;
+    cache_size = 1;
+    cache      = 0;
+}
+
+/****************************************************************************
+ * Code a bit with an adaptive probability
+ ****************************************************************************/
+void RangeEncoder::EncodeBit( uint16_t &prob, int bit )
+{
+    uint32_t bound = (range>>PROB_BITS) * prob;
+    if( bit == 0 )
+    {
+        range = bound;
+        prob += ((1<<PROB_BITS) - prob) >> codec_prob_shift;
+    }
+    else
+    {
+        low   += bound;
+        range -= bound;
+        prob  -= prob >> codec_prob_shift;
+    }
+    while( range < (1u<<24) )
+    {
+        range <<= 8;
+        ShiftLow();
+    }
+}
+
+/****************************************************************************
+ * Code bits, each 50% probable
+ ****************************************************************************/
+void RangeEncoder::EncodeDirect( uint32_t value, int nbr_bits )
+{
+    for( int i=nbr_bits-1; i>=0; i-- )
+    {
+        range >>= 1;
+        if( (value>>i) & 1 )
+            low += range;
+        while( range < (1u<<24) )
+        {
+            range <<= 8;
+            ShiftLow();
+        }
+    }
+}
+
+/****************************************************************************
+ * Finish the stream
+ ****************************************************************************/
+void RangeEncoder::End()
+{
+    for( int i=0; i<5; i++ )
+        ShiftLow();
+}
+
+/****************************************************************************
+ * Output the top byte of low, holding back 0xff bytes until we know
+ *  whether a carry will ripple through them
+ ****************************************************************************/
+void RangeEncoder::ShiftLow()
+{
+    if( (uint32_t)low < 0xff000000 || (low>>32) != 0 )
+    {
+        unsigned char carry = (unsigned char)(low>>32);
+        unsigned char temp  = cache;
+        do
+        {
+            out->push_back( (unsigned char)(temp+carry) );
+            temp = 0xff;
+        } while( --cache_size != 0 );
+        cache = (unsigned char)(low>>24);
+    }
+    cache_size++;
+    low = (low & 0x00ffffff) << 8;
+}
+
+/****************************************************************************
+ * Start a stream
+ ****************************************************************************/
+void RangeDecoder::Begin( const unsigned char *data_, size_t len_ )
+{
+    data    = data_;
+    len     = len_;
+    pos     = 0;
+    range   = 0xffffffff;
+    code    = 0;
+    overrun = false;
+
+    // RangeEncoder's first byte is always 0 (there's nothing to carry into
+    //  it yet), so it doesn't reach code
+    first_byte = NextByte();
+    for( int i=0; i<4; i++ )
+        code = (code<<8) | NextByte();
+}
+
+/****************************************************************************
+ * Decode a bit coded with an adaptive probability
+ ****************************************************************************/
+int RangeDecoder::DecodeBit( uint16_t &prob )
+{
+    int bit;
+    uint32_t bound = (range>>RangeEncoder::PROB_BITS) * prob;
+    if( code < bound )
+    {
+        range = bound;
+        prob += ((1<<RangeEncoder::PROB_BITS) - prob) >> codec_prob_shift;
+        bit = 0;
+    }
+    else
+    {
+        code  -= bound;
+        range -= bound;
+        prob  -= prob >> codec_prob_shift;
+        bit = 1;
+    }
+    while( range < (1u<<24) )
+    {
+        range <<= 8;
+        code = (code<<8) | NextByte();
+    }
+    return bit;
+}
+
+/****************************************************************************
+ * Decode bits, each 50% probable
+ ****************************************************************************/
+uint32_t RangeDecoder::DecodeDirect( int nbr_bits )
+{
+    uint32_t value = 0;
+    for( int i=0; i<nbr_bits; i++ )
+    {
+        range >>= 1;
+        int bit = 0;
+        if( code >= range )
+        {
+            code -= range;
+            bit = 1;
+        }
+        value = (value<<1) | bit;
+        while( range < (1u<<24) )
+        {
+            range <<= 8;
+            code = (code<<8) | NextByte();
+        }
+    }
+    return value;
+}
+
+/****************************************************************************
+ * Constructor
+ ****************************************************************************/
+GameCodec::GameCodec()
+{
+    ModelReset();
+}
+
+/****************************************************************************
+ * Back to the start of stream state
+ ****************************************************************************/
+void GameCodec::ModelReset()
+{
+    cr = ChessPosition();
+    last_move.Invalid();
+    list.count = 0;
+    book_hit   = false;
+    clear_best = false;
+    check      = 2166136261u;
+    more_games     = RangeEncoder::PROB_INIT;
+    standard_start = RangeEncoder::PROB_INIT;
+    more_moves     = RangeEncoder::PROB_INIT;
+    for( int i=0; i<RANK_CONTEXTS; i++ )
+    {
+        for( int j=0; j<RANK_BUCKETS; j++ )
+        {
+            bucket_probs[i][j] = RangeEncoder::PROB_INIT;
+            for( int k=0; k<128; k++ )
+                mantissa_probs[i][j][k] = RangeEncoder::PROB_INIT;
+        }
+    }
+    book.assign( BOOK_SIZE, 0 );
+}
+
+/****************************************************************************
+ * Rank the legal moves, sets list and key[]
+ ****************************************************************************/
+void GameCodec::RankMoves()
+{
+    list.count = 0;
+    cr.GenLegalMoveList( &list );
+    book_hit   = false;
+    clear_best = false;
+    if( list.count == 0 )
+        return;
+
+    // Who attacks what
+    bool white = cr.white;
+    int  us    = white ? BB_WPAWN : BB_BPAWN;
+    int  them  = white ? BB_BPAWN : BB_WPAWN;
+    Bitboard occupied = cr.bb_occupied();
+    Bitboard us_attacks   = codec_attacks( cr, us,   occupied );
+    Bitboard them_attacks = codec_attacks( cr, them, occupied );
+    Bitboard them_pawns   = codec_pawn_attacks( cr, !white );
+
+    // Squares where each of our men would give check
+    Square king = (Square)(white ? cr.bking_square : cr.wking_square);
+    Bitboard checks[6];
+    checks[0] = white ? pawn_black_attacks_bb[king] : pawn_white_attacks_bb[king];
+    checks[1] = knight_attacks_bb[king];
+    checks[2] = bishop_attacks_bb( king, occupied );
+    checks[3] = rook_attacks_bb( king, occupied );
+    checks[4] = checks[2] | checks[3];
+    checks[5] = 0;
+
+    // Men worth more than a pawn, and more than a minor piece
+    Bitboard bigger[2];
+    bigger[1] = cr.bb_pieces[them+3] | cr.bb_pieces[them+4];
+    bigger[0] = bigger[1] | cr.bb_pieces[them+1] | cr.bb_pieces[them+2];
+
+    // The king heads for the centre as the pieces come off, phase is 0
+    //  (endgame) to 62 (all the pieces are on the board)
+    int phase = 0;
+    for( int i=1; i<5; i++ )
+    {
+        static const int weight[5] = { 0, 3, 3, 5, 9 };
+        phase += weight[i] * bb_popcount( cr.bb_pieces[BB_WPAWN+i] | cr.bb_pieces[BB_BPAWN+i] );
+    }
+    if( phase > 62 )
+        phase = 62;
+
+    // Has this position been seen before ?
+    uint32_t entry = book[ cr.key & (BOOK_SIZE-1) ];
+    uint16_t book_move = ( entry!=0 && (entry>>16)==(uint16_t)(cr.key>>48) ) ? (uint16_t)entry : 0;
+
+    // Score each move, and note how far ahead the best one is
+    int best = -1000000, second = -1000000;
+    for( int i=0; i<list.count; i++ )
+    {
+        Move mv = list.moves[i];
+        char piece = cr.squares[mv.src];
+        int  type  = bb_index[piece&0x7f] - us;
+        int  value = codec_value(piece);
+        int  src   = white ? mv.src : mv.src^56;
+        int  dst   = white ? mv.dst : mv.dst^56;
+
+        // Positional
+        int score;
+        if( type == 5 )
+            score = ( (codec_pst[5][dst]-codec_pst[5][src])*phase + (codec_pst[6][dst]-codec_pst[6][src])*(62-phase) ) / 62;
+        else
+            score = codec_pst[type][dst] - codec_pst[type][src];
+
+        // Material, what we win or lose on the destination square, plus
+        //  what we might have lost on the source square (a man escaping a
+        //  threat)
+        if( type != 5 )
+        {
+            if( mv.capture!=' ' || (BB(mv.dst)&them_attacks) )
+                score += 10*cr.SEE( mv );
+            score += codec_risk( BB(mv.src), value, them_attacks, them_pawns, us_attacks );
+        }
+        else if( mv.capture != ' ' )
+            score += codec_value(mv.capture);
+        if( mv.capture!=' ' && last_move.Valid() && mv.dst==last_move.dst )
+            score += 100;   // recapture
+        switch( mv.special )
+        {
+            case SPECIAL_PROMOTION_QUEEN:  score += 800;    break;
+            case SPECIAL_PROMOTION_KNIGHT: score += 100;    break;
+            case SPECIAL_PROMOTION_ROOK:
+            case SPECIAL_PROMOTION_BISHOP: score -= 100;    break;
+            case SPECIAL_WK_CASTLING:
+            case SPECIAL_BK_CASTLING:
+            case SPECIAL_WQ_CASTLING:
+            case SPECIAL_BQ_CASTLING:      score += 60;     break;
+            default:                                        break;
+        }
+        if( checks[type] & BB(mv.dst) )
+            score += 40;
+
+        // Attacking a bigger man with a pawn or minor piece
+        if( type == 0 )
+        {
+            Bitboard a = white ? pawn_white_attacks_bb[mv.dst] : pawn_black_attacks_bb[mv.dst];
+            if( a & bigger[0] )
+                score += 50;
+        }
+        else if( type == 1 && (knight_attacks_bb[mv.dst] & bigger[1]) )
+            score += 50;
+        else if( type == 2 && (bishop_attacks_bb(mv.dst,occupied) & bigger[1]) )
+            score += 50;
+
+        // Sort key, ties are broken by the move itself, not the order of
+        //  generation
+        PackedMove packed;
+        packed.Pack( mv );
+        if( packed.bits == book_move )
+        {
+            score += 100000;
+            book_hit = true;
+        }
+        key[i] = (int64_t)score*0x10000 + (0xffff-packed.bits);
+        if( score > best )
+        {
+            second = best;
+            best = score;
+        }
+        else if( score > second )
+            second = score;
+    }
+    clear_best = (best-second >= 100);
+}
+
+/****************************************************************************
+ * Coding context for a rank
+ ****************************************************************************/
+int GameCodec::RankContext() const
+{
+    int ctx = list.count<=8 ? 0 : (list.count<=24 ? 1 : (list.count<=40 ? 2 : 3));
+    return ctx*3 + (book_hit ? 2 : (clear_best?1:0));
+}
+
+/****************************************************************************
+ * Which bucket a rank is in
+ ****************************************************************************/
+int GameCodec::RankBucket( int rank )
+{
+    int bucket = 0;
+    while( rank > 0 )
+    {
+        bucket++;
+        rank >>= 1;
+    }
+    return bucket;
+}
+
+/****************************************************************************
+ * A move has been played, remember it for the next time we see this
+ *  position
+ ****************************************************************************/
+void GameCodec::PlayMove( Move mv )
+{
+    PackedMove packed;
+    packed.Pack( mv );
+    book[ cr.key & (BOOK_SIZE-1) ] = ((uint32_t)(uint16_t)(cr.key>>48) << 16) | packed.bits;
+    CheckAdd( packed.bits );
+    cr.PlayMove( mv );
+    last_move = mv;
+}
+
+/****************************************************************************
+ * A game has started from the position in cr
+ ****************************************************************************/
+void GameCodec::GameStart()
+{
+    last_move.Invalid();
+    CheckAdd( cr.key );
+    CheckAdd( ((uint64_t)cr.half_move_clock<<32) | (uint32_t)cr.full_move_count );
+}
+
+/****************************************************************************
+ * Add to the running check of the games and moves coded (FNV-1a, a 32 bit
+ *  word at a time)
+ ****************************************************************************/
+void GameCodec::CheckAdd( uint64_t value )
+{
+    check = (check ^ (uint32_t)value) * 16777619u;
+    check = (check ^ (uint32_t)(value>>32)) * 16777619u;
+}
+
+/****************************************************************************
+ * Constructor
+ ****************************************************************************/
+GameEncoder::GameEncoder()
+{
+    in_game = false;
+}
+
+/****************************************************************************
+ * Start a stream
+ ****************************************************************************/
+void GameEncoder::Begin( std::vector<unsigned char> &out )
+{
+    ModelReset();
+    rc.Begin( &out );
+    in_game = false;
+}
+
+/****************************************************************************
+ * Start a game from the standard starting position
+ ****************************************************************************/
+void GameEncoder::GameBegin()
+{
+    GameEnd();
+    rc.EncodeBit( more_games, 1 );
+    rc.EncodeBit( standard_start, 1 );
+    cr = ChessPosition();
+    GameStart();
+    in_game = true;
+}
+
+/****************************************************************************
+ * Start a game from some other position
+ *  return bool okay
+ ****************************************************************************/
+bool GameEncoder::GameBegin( const ChessPosition &start )
+{
+    ChessPosition standard;
+    if( start == standard && start.half_move_clock==0 && start.full_move_count==1 )
+    {
+        GameBegin();
+        return true;
+    }
+
+    // The position is stored as a CompressedPosition, make sure it survives
+    //  the trip (it won't if there are too many men for instance)
+    CompressedPosition compressed;
+    start.Compress( compressed );
+    ChessPosition position;
+    position.Decompress( compressed );
+    if( !(position==start) || start.half_move_clock>0xffff || start.full_move_count>0xffff )
+        return false;
+    GameEnd();
+    rc.EncodeBit( more_games, 1 );
+    rc.EncodeBit( standard_start, 0 );
+    for( int i=0; i<(int)sizeof(compressed.storage); i++ )
+        rc.EncodeDirect( compressed.storage[i], 8 );
+    rc.EncodeDirect( start.half_move_clock, 16 );
+    rc.EncodeDirect( start.full_move_count, 16 );
+    position.half_move_clock = start.half_move_clock;
+    position.full_move_count = start.full_move_count;
+    position.wking_square    = start.wking_square;
+    position.bking_square    = start.bking_square;
+    cr = position;
+    GameStart();
+    in_game = true;
+    return true;
+}
+
+/****************************************************************************
+ * Add a move to the game
+ *  return bool okay
+ ****************************************************************************/
+bool GameEncoder::AddMove( Move mv )
+{
+    if( !in_game )
+        return false;
+    RankMoves();
+    int idx;
+    for( idx=0; idx<list.count; idx++ )
+    {
+        if( list.moves[idx] == mv )
+            break;
+    }
+    if( idx == list.count )
+        return false;
+    rc.EncodeBit( more_moves, 1 );
+    if( list.count > 1 )
+    {
+        int rank = 0;
+        for( int i=0; i<list.count; i++ )
+        {
+            if( key[i] > key[idx] )
+                rank++;
+        }
+        int ctx    = RankContext();
+        int bucket = RankBucket(rank);
+        int last   = RankBucket(list.count-1);
+        for( int i=0; i<bucket; i++ )
+            rc.EncodeBit( bucket_probs[ctx][i], 0 );
+        if( bucket < last )
+            rc.EncodeBit( bucket_probs[ctx][bucket], 1 );
+        if( bucket >= 2 )
+        {
+            int nbr_bits = bucket-1;
+            int mantissa = rank - (1<<nbr_bits);
+            int node = 1;
+            for( int i=nbr_bits-1; i>=0; i-- )
+            {
+                int bit = (mantissa>>i) & 1;
+                rc.EncodeBit( mantissa_probs[ctx][bucket][node], bit );
+                node = node*2 + bit;
+            }
+        }
+    }
+    PlayMove( mv );
+    return true;
+}
+
+/****************************************************************************
+ * Finish the game
+ ****************************************************************************/
+void GameEncoder::GameEnd()
+{
+    if( in_game )
+    {
+        // No need to say so if there are no legal moves
+        if( cr.HasLegalMove() )
+            rc.EncodeBit( more_moves, 0 );
+        in_game = false;
+    }
+}
+
+/****************************************************************************
+ * Finish the stream
+ ****************************************************************************/
+void GameEncoder::End()
+{
+    GameEnd();
+    rc.EncodeBit( more_games, 0 );
+    rc.EncodeDirect( check, 32 );
+    rc.End();
+}
+
+/****************************************************************************
+ * Constructor
+ ****************************************************************************/
+GameDecoder::GameDecoder()
+{
+    in_game = false;
+    ended   = false;
+    error   = false;
+}
+
+/****************************************************************************
+ * Start a stream
+ ****************************************************************************/
+void GameDecoder::Begin( const unsigned char *data, size_t len )
+{
+    ModelReset();
+    rc.Begin( data, len );
+    in_game = false;
+    ended   = false;
+    error   = false;
+}
+
+/****************************************************************************
+ * Start the next game
+ *  return bool found
+ ****************************************************************************/
+bool GameDecoder::NextGame()
+{
+    // Skip what's left of the current game, the model has to see it
+    Move mv;
+    while( NextMove(mv) )
+        ;
+    if( error || ended )
+        return false;
+    if( rc.DecodeBit(more_games) == 0 )
+    {
+        // The end of the stream, is everything as the encoder saw it ?
+        ended = true;
+        if( rc.DecodeDirect(32)!=check || !rc.Finished() )
+            error = true;
+        return false;
+    }
+    if( rc.DecodeBit(standard_start) )
+        cr = ChessPosition();
+    else
+    {
+        // If the data is corrupt Decompress() can read up to 32 bytes, and
+        //  the position might not survive the trip back
+        struct
+        {
+            CompressedPosition compressed;
+            unsigned char      overflow[8];
+        } padded;
+        memset( &padded, 0, sizeof(padded) );
+        for( int i=0; i<(int)sizeof(padded.compressed.storage); i++ )
+            padded.compressed.storage[i] = (unsigned char)rc.DecodeDirect(8);
+        ChessPosition position;
+        position.Decompress( padded.compressed );
+        position.half_move_clock = (int)rc.DecodeDirect(16);
+        position.full_move_count = (int)rc.DecodeDirect(16);
+
+        // Decompress() doesn't find the kings
+        int nbr_men = 0;
+        for( int i=0; i<64; i++ )
+        {
+            if( position.squares[i] != ' ' )
+                nbr_men++;
+            if( position.squares[i] == 'K' )
+                position.wking_square = (Square)i;
+            else if( position.squares[i] == 'k' )
+                position.bking_square = (Square)i;
+        }
+        bool okay = (nbr_men <= 32);
+        if( okay )
+        {
+            CompressedPosition check;
+            position.Compress( check );
+            okay = (0 == memcmp(check.storage,padded.compressed.storage,sizeof(check.storage)));
+        }
+        if( !okay )
+        {
+            error = true;
+            return false;
+        }
+        cr = position;
+    }
+    GameStart();
+    if( rc.Overrun() )
+    {
+        error = true;
+        return false;
+    }
+    in_game = true;
+    return true;
+}
+
+/****************************************************************************
+ * Get the next move of the game
+ *  return bool found
+ ****************************************************************************/
+bool GameDecoder::NextMove( Move &mv )
+{
+    if( !in_game || error )
+        return false;
+    RankMoves();
+    if( list.count==0 || rc.DecodeBit(more_moves)==0 )
+    {
+        in_game = false;
+        if( rc.Overrun() )
+            error = true;
+        return false;
+    }
+    int rank = 0;
+    if( list.count > 1 )
+    {
+        int ctx    = RankContext();
+        int last   = RankBucket(list.count-1);
+        int bucket = 0;
+        while( bucket<last && rc.DecodeBit(bucket_probs[ctx][bucket])==0 )
+            bucket++;
+        if( bucket >= 1 )
+            rank = 1;
+        if( bucket >= 2 )
+        {
+            int nbr_bits = bucket-1;
+            int node = 1;
+            for( int i=0; i<nbr_bits; i++ )
+                node = node*2 + rc.DecodeBit( mantissa_probs[ctx][bucket][node] );
+            rank = node;    // the leading 1 bit is 1<<nbr_bits
+        }
+    }
+    if( rank>=list.count || rc.Overrun() )
+    {
+        in_game = false;
+        error   = true;
+        return false;
+    }
+
+    // The rank'th biggest key
+    int64_t sorted[MAXMOVES];
+    memcpy( sorted, key, list.count*sizeof(key[0]) );
+    nth_element( sorted, sorted+rank, sorted+list.count, greater<int64_t>() );
+    int idx = 0;
+    while( key[idx] != sorted[rank] )
+        idx++;
+    mv = list.moves[idx];
+    PlayMove( mv );
+    return true;
+}
+/****************************************************************************
+ * GameArchive.cpp Chess classes - Compressed game archive, random access
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+
+/*
+    Archive layout (all numbers in the machine's byte order, every section
+    starts on a multiple of 8 bytes)
+
+    Header, ARCHIVE_HEADER uint64s
+    Blocks, each a GameEncoder stream of one or more games
+    Block index, for each block: offset, length, id of its first game,
+     checksum (archive_checksum() of its bytes)
+    Columns, one entry per game: white, black, event (uint32 string
+     indexes), date (uint32 yyyymmdd), result (uint8)
+    String table, uint32 offsets into '\0' terminated strings, sorted
+ */
+enum
+{
+    ARCHIVE_MAGIC,
+    ARCHIVE_VERSION,
+    ARCHIVE_NBR_GAMES,
+    ARCHIVE_NBR_BLOCKS,
+    ARCHIVE_INDEX,
+    ARCHIVE_WHITES,
+    ARCHIVE_BLACKS,
+    ARCHIVE_EVENTS,
+    ARCHIVE_DATES,
+    ARCHIVE_RESULTS,
+    ARCHIVE_STRING_OFFSETS,
+    ARCHIVE_NBR_STRINGS,
+    ARCHIVE_STRING_DATA,
+    ARCHIVE_STRING_LEN,
+    ARCHIVE_HEADER=16
+};
+static const char     archive_magic[8] = { 'T','H','C','A','R','C','H','1' };
+static const uint64_t archive_version  = 2;
+static const int      archive_index_entry = 4;     // uint64s per block
+
+// FNV-1a hash of a block's bytes, so a corrupt block is found before it's
+//  decoded (the GameEncoder stream's own check is at the end of the block,
+//  and GetGame() only decodes up to the game it wants)
+static uint64_t archive_checksum( const unsigned char *data, size_t len )
+{
+    uint64_t hash = 14695981039346656037ull;
+    for( size_t i=0; i<len; i++ )
+        hash = (hash ^ data[i]) * 1099511628211ull;
+    return hash;
+}
+
+// Is [offset,offset+count*size) inside a file of file_size bytes, and is
+//  offset suitably aligned ?
+static bool archive_inside( uint64_t offset, uint64_t count, uint64_t size, uint64_t file_size )
+{
+    if( offset%8 != 0 || offset > file_size )
+        return false;
+    return count <= (file_size-offset)/size;
+}
+
+// Copy a PGN tag value, without the escapes
+static std::string archive_unescape( const PgnSpan &value )
+{
+    std::string s;
+    for( size_t i=0; i<value.len; i++ )
+    {
+        if( value.ptr[i]=='\\' && i+1<value.len )
+            i++;
+        s += value.ptr[i];
+    }
+    return s;
+}
+
+/****************************************************************************
+ * From a PGN game's tags
+ ****************************************************************************/
+void GameTags::FromPgn( const PgnGame &game )
+{
+    PgnSpan value;
+    white = game.Tag("White",value) ? archive_unescape(value) : "";
+    black = game.Tag("Black",value) ? archive_unescape(value) : "";
+    event = game.Tag("Event",value) ? archive_unescape(value) : "";
+    date  = game.Tag("Date",value) ? ParseDate(value.ptr,value.len) : 0;
+    if( game.Tag("Result",value) )
+        result = ParseResult( value.ptr, value.len );
+    else
+        result = ParseResult( game.result.ptr, game.result.len );
+}
+
+/****************************************************************************
+ * PGN date to yyyymmdd
+ ****************************************************************************/
+int GameTags::ParseDate( const char *s, size_t len )
+{
+    // "yyyy.mm.dd", each field digits, or '?'s for unknown
+    int field[3] = {0,0,0};
+    const int digits[3] = {4,2,2};
+    size_t pos = 0;
+    for( int i=0; i<3; i++ )
+    {
+        if( i>0 )
+        {
+            if( pos>=len || s[pos]!='.' )
+                break;
+            pos++;
+        }
+        int n=0, value=0;
+        bool known = true;
+        while( pos<len && s[pos]!='.' )
+        {
+            char c = s[pos++];
+            if( '0'<=c && c<='9' )
+                value = value*10 + (c-'0');
+            else
+                known = false;
+            n++;
+        }
+        if( !known || n!=digits[i] )
+            break;
+        field[i] = value;
+    }
+    if( field[0]==0 || field[1]>12 || field[2]>31 )
+        return 0;
+    if( field[1] == 0 )
+        field[2] = 0;
+    return field[0]*10000 + field[1]*100 + field[2];
+}
+
+/****************************************************************************
+ * PGN result
+ ****************************************************************************/
+int GameTags::ParseResult( const char *s, size_t len )
+{
+    PgnSpan span(s,len);
+    if( span.Equals("1-0") )
+        return RESULT_WHITE_WINS;
+    else if( span.Equals("0-1") )
+        return RESULT_BLACK_WINS;
+    else if( span.Equals("1/2-1/2") )
+        return RESULT_DRAW;
+    return RESULT_NONE;
+}
+
+/****************************************************************************
+ * Constructor
+ ****************************************************************************/
+GameArchiveWriter::GameArchiveWriter()
+{
+    file             = NULL;
+    okay             = false;
+    offset           = 0;
+    block_size       = 4096;
+    block_first_game = 0;
+}
+
+/****************************************************************************
+ * Destructor
+ ****************************************************************************/
+GameArchiveWriter::~GameArchiveWriter()
+{
+    Close();
+}
+
+/****************************************************************************
+ * Create an archive
+ *  return bool okay
+ ****************************************************************************/
+bool GameArchiveWriter::Open( const char *filename )
+{
+    Close();
+    index.clear();
+    strings.clear();
+    whites.clear();
+    blacks.clear();
+    events.clear();
+    dates.clear();
+    results.clear();
+    block.clear();
+    block_first_game = 0;
+    offset = 0;
+    file = fopen( filename, "wb" );
+    if( !file )
+        return false;
+
+    // The header is filled in by Close()
+    okay = true;
+    uint64_t header[ARCHIVE_HEADER];
+    memset( header, 0, sizeof(header) );
+    Write( header, sizeof(header) );
+    return okay;
+}
+
+/****************************************************************************
+ * Add a game
+ *  return bool okay
+ ****************************************************************************/
+bool GameArchiveWriter::AddGame( const GameTags &tags, const ChessPosition &start, const std::vector<Move> &moves )
+{
+    if( !file )
+        return false;
+
+    // Each block is a stream of its own
+    long long id = NbrGames();
+    if( block_first_game == id )
+        encoder.Begin( block );
+    if( !encoder.GameBegin(start) )
+        return false;
+    bool legal = true;
+    for( size_t i=0; legal && i<moves.size(); i++ )
+        legal = encoder.AddMove( moves[i] );
+    encoder.GameEnd();
+    whites.push_back( StringIndex(tags.white) );
+    blacks.push_back( StringIndex(tags.black) );
+    events.push_back( StringIndex(tags.event) );
+    dates.push_back( tags.date>0 ? (uint32_t)tags.date : 0 );
+    results.push_back( (uint8_t)(tags.result&3) );
+    if( block.size() >= block_size )
+        BlockEnd();
+    return legal;
+}
+
+/****************************************************************************
+ * Write the current block
+ ****************************************************************************/
+void GameArchiveWriter::BlockEnd()
+{
+    if( block_first_game == NbrGames() )
+        return;
+    encoder.End();
+    index.push_back( offset );
+    index.push_back( block.size() );
+    index.push_back( block_first_game );
+    index.push_back( archive_checksum(block.data(),block.size()) );
+    Write( block.data(), block.size() );
+    block.clear();
+    block_first_game = NbrGames();
+}
+
+/****************************************************************************
+ * Write bytes, padded to a multiple of 8
+ ****************************************************************************/
+void GameArchiveWriter::Write( const void *data, size_t len )
+{
+    static const char zeros[8] = {0,0,0,0,0,0,0,0};
+    size_t pad = (8 - len%8) % 8;
+    if( len>0 && fwrite(data,1,len,file)!=len )
+        okay = false;
+    if( pad>0 && fwrite(zeros,1,pad,file)!=pad )
+        okay = false;
+    offset += len + pad;
+}
+
+/****************************************************************************
+ * Index of a string, in order of appearance (sorted by Close())
+ ****************************************************************************/
+uint32_t GameArchiveWriter::StringIndex( const std::string &s )
+{
+    std::map<std::string,uint32_t>::iterator it = strings.find(s);
+    if( it != strings.end() )
+        return it->second;
+    uint32_t idx = (uint32_t)strings.size();
+    strings[s] = idx;
+    return idx;
+}
+
+/****************************************************************************
+ * Finish the archive
+ *  return bool okay
+ ****************************************************************************/
+bool GameArchiveWriter::Close()
+{
+    if( !file )
+        return okay;
+    BlockEnd();
+    uint64_t header[ARCHIVE_HEADER];
+    memset( header, 0, sizeof(header) );
+    memcpy( &header[ARCHIVE_MAGIC], archive_magic, sizeof(archive_magic) );
+    header[ARCHIVE_VERSION]    = archive_version;
+    header[ARCHIVE_NBR_GAMES]  = NbrGames();
+    header[ARCHIVE_NBR_BLOCKS] = index.size()/archive_index_entry;
+    header[ARCHIVE_INDEX]      = offset;
+    Write( index.data(), index.size()*sizeof(uint64_t) );
+
+    // The string table is sorted, so readers can binary search it
+    std::vector<uint32_t> remap( strings.size() );
+    std::vector<uint32_t> string_offsets;
+    std::string string_data;
+    for( std::map<std::string,uint32_t>::iterator it=strings.begin(); it!=strings.end(); ++it )
+    {
+        remap[it->second] = (uint32_t)string_offsets.size();
+        string_offsets.push_back( (uint32_t)string_data.size() );
+        string_data.append( it->first.c_str() );
+        string_data += '\0';
+    }
+    if( string_data.size() > 0xffffffff )
+        okay = false;
+    std::vector<uint32_t> *columns[3] = { &whites, &blacks, &events };
+    for( int i=0; i<3; i++ )
+    {
+        std::vector<uint32_t> &column = *columns[i];
+        for( size_t j=0; j<column.size(); j++ )
+            column[j] = remap[ column[j] ];
+        header[ARCHIVE_WHITES+i] = offset;
+        Write( column.data(), column.size()*sizeof(uint32_t) );
+    }
+    header[ARCHIVE_DATES] = offset;
+    Write( dates.data(), dates.size()*sizeof(uint32_t) );
+    header[ARCHIVE_RESULTS] = offset;
+    Write( results.data(), results.size() );
+    header[ARCHIVE_STRING_OFFSETS] = offset;
+    header[ARCHIVE_NBR_STRINGS]    = string_offsets.size();
+    Write( string_offsets.data(), string_offsets.size()*sizeof(uint32_t) );
+    header[ARCHIVE_STRING_DATA]    = offset;
+    header[ARCHIVE_STRING_LEN]     = string_data.size();
+    Write( string_data.data(), string_data.size() );
+
+    // Now the header
+    if( fseek(file,0,SEEK_SET) != 0 || fwrite(header,1,sizeof(header),file) != sizeof(header) )
+        okay = false;
+    if( fclose(file) != 0 )
+        okay = false;
+    file = NULL;
+    return okay;
+}
+
+/****************************************************************************
+ * Constructor
+ ****************************************************************************/
+GameArchive::GameArchive()
+{
+    Close();
+}
+
+/****************************************************************************
+ * Finished with it
+ ****************************************************************************/
+void GameArchive::Close()
+{
+    file.Close();
+    nbr_games      = 0;
+    nbr_blocks     = 0;
+    index          = NULL;
+    whites         = NULL;
+    blacks         = NULL;
+    events         = NULL;
+    dates          = NULL;
+    results        = NULL;
+    string_offsets = NULL;
+    nbr_strings    = 0;
+    string_data    = NULL;
+    string_len     = 0;
+    decoder_block  = -1;
+    decoder_game   = 0;
+}
+
+/****************************************************************************
+ * Memory map an archive
+ *  return bool okay
+ ****************************************************************************/
+bool GameArchive::Open( const char *filename )
+{
+    Close();
+    if( !file.Open(filename) )
+        return false;
+
+    // Check everything is where the header says, so nothing read later can
+    //  be outside the file
+    uint64_t size = file.Size();
+    const char *data = file.Data();
+    uint64_t header[ARCHIVE_HEADER];
+    bool okay = size >= sizeof(header);
+    if( okay )
+    {
+        memcpy( header, data, sizeof(header) );
+        okay = memcmp(&header[ARCHIVE_MAGIC],archive_magic,sizeof(archive_magic))==0 &&
+               header[ARCHIVE_VERSION] == archive_version;
+    }
+    uint64_t games  = okay ? header[ARCHIVE_NBR_GAMES]  : 0;
+    uint64_t blocks = okay ? header[ARCHIVE_NBR_BLOCKS] : 0;
+    okay = okay && archive_inside( header[ARCHIVE_INDEX], blocks, archive_index_entry*sizeof(uint64_t), size )
+                && archive_inside( header[ARCHIVE_WHITES], games, sizeof(uint32_t), size )
+                && archive_inside( header[ARCHIVE_BLACKS], games, sizeof(uint32_t), size )
+                && archive_inside( header[ARCHIVE_EVENTS], games, sizeof(uint32_t), size )
+                && archive_inside( header[ARCHIVE_DATES],  games, sizeof(uint32_t), size )
+                && archive_inside( header[ARCHIVE_RESULTS], games, 1, size )
+                && archive_inside( header[ARCHIVE_STRING_OFFSETS], header[ARCHIVE_NBR_STRINGS], sizeof(uint32_t), size )
+                && archive_inside( header[ARCHIVE_STRING_DATA], header[ARCHIVE_STRING_LEN], 1, size )
+                && header[ARCHIVE_NBR_STRINGS] <= 0xffffffff
+                && (blocks>0 || games==0);
+    if( okay )
+    {
+        index = (const uint64_t *)(data + header[ARCHIVE_INDEX]);
+        for( uint64_t i=0; okay && i<blocks; i++ )
+        {
+            const uint64_t *entry = index + archive_index_entry*i;
+            okay = entry[0] <= size && entry[1] <= size-entry[0] &&
+                   (i==0 ? entry[2]==0 : entry[2]>entry[2-archive_index_entry]) && entry[2]<games;
+        }
+    }
+    if( okay )
+    {
+        string_len  = header[ARCHIVE_STRING_LEN];
+        string_data = data + header[ARCHIVE_STRING_DATA];
+        okay = string_len==0 || string_data[string_len-1]=='\0';
+    }
+    if( !okay )
+    {
+        Close();
+        return false;
+    }
+    nbr_games      = (long long)games;
+    nbr_blocks     = (long long)blocks;
+    whites         = (const uint32_t *)(data + header[ARCHIVE_WHITES]);
+    blacks         = (const uint32_t *)(data + header[ARCHIVE_BLACKS]);
+    events         = (const uint32_t *)(data + header[ARCHIVE_EVENTS]);
+    dates          = (const uint32_t *)(data + header[ARCHIVE_DATES]);
+    results        = (const uint8_t  *)(data + header[ARCHIVE_RESULTS]);
+    string_offsets = (const uint32_t *)(data + header[ARCHIVE_STRING_OFFSETS]);
+    nbr_strings    = (uint32_t)header[ARCHIVE_NBR_STRINGS];
+    return true;
+}
+
+/****************************************************************************
+ * Get a game's starting position and moves
+ *  return bool okay
+ ****************************************************************************/
+bool GameArchive::GetGame( long long id, ChessPosition &start, std::vector<Move> &moves )
+{
+    moves.clear();
+    if( id<0 || id>=nbr_games )
+        return false;
+
+    // Find the game's block, the last block starting at or before it
+    long long lo=0, hi=nbr_blocks;
+    while( hi-lo > 1 )
+    {
+        long long mid = (lo+hi)/2;
+        if( (long long)index[archive_index_entry*mid+2] <= id )
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    // Carry on from the last game got if we can, else check and start the
+    //  block
+    if( decoder_block!=lo || decoder_game>id )
+    {
+        const uint64_t *entry = index + archive_index_entry*lo;
+        const unsigned char *block = (const unsigned char *)file.Data() + entry[0];
+        decoder_block = -1;
+        if( archive_checksum(block,(size_t)entry[1]) != entry[3] )
+            return false;
+        decoder.Begin( block, (size_t)entry[1] );
+        decoder_block = lo;
+        decoder_game  = (long long)entry[2];
+    }
+    bool okay = true;
+    while( okay && decoder_game<id )
+    {
+        okay = decoder.NextGame();
+        decoder_game++;
+    }
+    okay = okay && decoder.NextGame();
+    if( okay )
+    {
+        start = decoder.Position();
+        Move mv;
+        while( decoder.NextMove(mv) )
+            moves.push_back( mv );
+        okay = !decoder.Error();
+    }
+    decoder_game = id+1;
+    if( !okay )
+    {
+        moves.clear();
+        decoder_block = -1;
+    }
+    return okay;
+}
+
+/****************************************************************************
+ * Get a game's tags
+ *  return bool okay
+ ****************************************************************************/
+bool GameArchive::GetTags( long long id, GameTags &tags ) const
+{
+    if( id<0 || id>=nbr_games )
+        return false;
+    tags.white  = White(id);
+    tags.black  = Black(id);
+    tags.event  = Event(id);
+    tags.date   = Date(id);
+    tags.result = Result(id);
+    return true;
+}
+
+/****************************************************************************
+ * A string in the string table
+ ****************************************************************************/
+const char *GameArchive::String( const uint32_t *column, long long id ) const
+{
+    if( id<0 || id>=nbr_games )
+        return "";
+    uint32_t idx = column[id];
+    if( idx >= nbr_strings || string_offsets[idx] >= string_len )
+        return "";
+    return string_data + string_offsets[idx];
+}
+
+/****************************************************************************
+ * Find a string in the string table
+ *  return bool found
+ ****************************************************************************/
+bool GameArchive::FindString( const char *s, uint32_t &idx ) const
+{
+    uint32_t lo=0, hi=nbr_strings;
+    while( lo < hi )
+    {
+        uint32_t mid = lo + (hi-lo)/2;
+        const char *t = string_offsets[mid]<string_len ? string_data+string_offsets[mid] : "";
+        int cmp = strcmp( t, s );
+        if( cmp == 0 )
+        {
+            idx = mid;
+            return true;
+        }
+        if( cmp < 0 )
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    return false;
+}
+
+/****************************************************************************
+ * Find the games that match a filter
+ *  return number of games found
+ ****************************************************************************/
+long long GameArchive::Find( const GameFilter &filter, std::vector<long long> &ids ) const
+{
+    ids.clear();
+
+    // Names to string indexes, a name that isn't there matches nothing
+    const char *names[4] = { filter.player, filter.white, filter.black, filter.event };
+    uint32_t idx[4] = {0,0,0,0};
+    for( int i=0; i<4; i++ )
+    {
+        if( names[i] && !FindString(names[i],idx[i]) )
+            return 0;
+    }
+
+    // Scan only the columns needed, an unknown date never matches a date range
+    bool by_date = filter.date_from>0 || filter.date_to>0;
+    uint32_t date_from = filter.date_from>0 ? (uint32_t)filter.date_from : 1;
+    uint32_t date_to   = filter.date_to>0   ? (uint32_t)filter.date_to   : 0xffffffff;
+    for( long long id=0; id<nbr_games; id++ )
+    {
+        if( filter.player && whites[id]!=idx[0] && blacks[id]!=idx[0] )
+            continue;
+        if( filter.white && whites[id]!=idx[1] )
+            continue;
+        if( filter.black && blacks[id]!=idx[2] )
+            continue;
+        if( filter.event && events[id]!=idx[3] )
+            continue;
+        if( by_date && (dates[id]<date_from || dates[id]>date_to) )
+            continue;
+        if( filter.result>=0 && results[id]!=filter.result )
+            continue;
+        ids.push_back( id );
+    }
+    return (long long)ids.size();
+}
+/****************************************************************************
+ * ExternalSort.cpp Chess classes - Sort more records than fit in memory
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+
+// Digit d (0 = least significant) of a record's key, the key is key_words
+//  uint64s, most significant first
+static inline unsigned int esort_digit( const uint64_t *rec, int key_words, int d )
+{
+    return (unsigned int)(rec[key_words-1-d/8] >> (8*(d%8))) & 0xff;
+}
+
+// Compare two records' keys
+static inline int esort_compare( const uint64_t *a, const uint64_t *b, int key_words )
+{
+    for( int i=0; i<key_words; i++ )
+    {
+        if( a[i] != b[i] )
+            return a[i]<b[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+// What the radix sort's threads share
+struct ESORT_JOB
+{
+    uint64_t   *data;
+    uint64_t   *tmp;
+    size_t      nbr;
+    int         record_words;
+    int         key_words;
+    int         nbr_threads;
+    std::vector<size_t> counts;         // [thread][256], then offsets
+    size_t      bucket_start[257];
+    std::atomic<int> next_bucket;
+};
+
+// Split records [begin,end) by their most significant digit, first
+//  counting, then (once counts are offsets) copying
+static void esort_split( ESORT_JOB *job, int thread, bool scatter )
+{
+    size_t per_thread = job->nbr / job->nbr_threads;
+    size_t begin = per_thread * thread;
+    size_t end   = thread==job->nbr_threads-1 ? job->nbr : begin+per_thread;
+    int    rw = job->record_words;
+    int    top = job->key_words*8 - 1;
+    size_t *counts = &job->counts[ 256*thread ];
+    for( size_t i=begin; i<end; i++ )
+    {
+        const uint64_t *rec = job->data + i*rw;
+        unsigned int digit = esort_digit( rec, job->key_words, top );
+        if( scatter )
+            memcpy( job->tmp + (counts[digit]++)*rw, rec, rw*sizeof(uint64_t) );
+        else
+            counts[digit]++;
+    }
+}
+
+// Sort records on digit and the digits below it, the records are in src[],
+//  and end up in data[] (which is src[] if in_data, else dst[]). Most
+//  significant digit first, each digit splitting the records into buckets
+//  in the other buffer, until the buckets are small
+static void esort_msd( uint64_t *src, uint64_t *dst, size_t nbr, int digit, bool in_data,
+                       int record_words, int key_words )
+{
+    int rw = record_words;
+    if( nbr<64 || digit<0 )
+    {
+        // Insertion sort, stable
+        uint64_t rec[64];
+        for( size_t i=1; i<nbr; i++ )
+        {
+            size_t j = i;
+            memcpy( rec, src+i*rw, rw*sizeof(uint64_t) );
+            while( j>0 && esort_compare(src+(j-1)*rw,rec,key_words) > 0 )
+            {
+                memcpy( src+j*rw, src+(j-1)*rw, rw*sizeof(uint64_t) );
+                j--;
+            }
+            memcpy( src+j*rw, rec, rw*sizeof(uint64_t) );
+        }
+        if( !in_data )
+            memcpy( dst, src, nbr*rw*sizeof(uint64_t) );
+        return;
+    }
+
+    // A digit that's the same for every record needn't be sorted on
+    size_t count[256];
+    memset( count, 0, sizeof(count) );
+    for( size_t i=0; i<nbr; i++ )
+        count[ esort_digit(src+i*rw,key_words,digit) ]++;
+    if( count[esort_digit(src,key_words,digit)] == nbr )
+    {
+        esort_msd( src, dst, nbr, digit-1, in_data, record_words, key_words );
+        return;
+    }
+    size_t start[256];
+    size_t offset = 0;
+    for( int i=0; i<256; i++ )
+    {
+        start[i] = offset;
+        offset += count[i];
+    }
+    for( size_t i=0; i<nbr; i++ )
+    {
+        const uint64_t *rec = src + i*rw;
+        memcpy( dst + (start[esort_digit(rec,key_words,digit)]++)*rw, rec, rw*sizeof(uint64_t) );
+    }
+    offset = 0;
+    for( int i=0; i<256; i++ )
+    {
+        if( count[i] > 0 )
+            esort_msd( dst+offset*rw, src+offset*rw, count[i], digit-1, !in_data, record_words, key_words );
+        offset += count[i];
+    }
+}
+
+// A thread's part of the radix sort, bucket by bucket
+static void esort_buckets( ESORT_JOB *job )
+{
+    for(;;)
+    {
+        int bucket = job->next_bucket++;
+        if( bucket >= 256 )
+            break;
+        size_t begin = job->bucket_start[bucket];
+        size_t nbr   = job->bucket_start[bucket+1] - begin;
+        esort_msd( job->tmp + begin*job->record_words, job->data + begin*job->record_words, nbr,
+                   job->key_words*8-2, false, job->record_words, job->key_words );
+    }
+}
+
+/****************************************************************************
+ * Radix sort records in memory
+ ****************************************************************************/
+void ExternalSort::RadixSort( uint64_t *data, uint64_t *tmp, size_t nbr, int record_words, int key_words, int nbr_threads )
+{
+    if( nbr < 2 )
+        return;
+
+    // Only bother with threads if there's plenty to do
+    ESORT_JOB job;
+    job.data         = data;
+    job.tmp          = tmp;
+    job.nbr          = nbr;
+    job.record_words = record_words;
+    job.key_words    = key_words;
+    job.nbr_threads  = nbr_threads<1 ? 1 : nbr_threads;
+    if( (size_t)job.nbr_threads > nbr/65536 + 1 )
+        job.nbr_threads = (int)(nbr/65536 + 1);
+    job.counts.assign( 256*job.nbr_threads, 0 );
+    job.next_bucket = 0;
+
+    // Split by most significant digit into tmp[], each thread's records
+    //  going after the previous thread's, so the sort is stable
+    std::vector<std::thread> threads;
+    for( int i=1; i<job.nbr_threads; i++ )
+        threads.push_back( std::thread( esort_split, &job, i, false ) );
+    esort_split( &job, 0, false );
+    for( size_t i=0; i<threads.size(); i++ )
+        threads[i].join();
+    threads.clear();
+    size_t offset = 0;
+    for( int digit=0; digit<256; digit++ )
+    {
+        job.bucket_start[digit] = offset;
+        for( int i=0; i<job.nbr_threads; i++ )
+        {
+            size_t n = job.counts[256*i+digit];
+            job.counts[256*i+digit] = offset;
+            offset += n;
+        }
+    }
+    job.bucket_start[256] = offset;
+    for( int i=1; i<job.nbr_threads; i++ )
+        threads.push_back( std::thread( esort_split, &job, i, true ) );
+    esort_split( &job, 0, true );
+    for( size_t i=0; i<threads.size(); i++ )
+        threads[i].join();
+    threads.clear();
+
+    // Then sort the buckets, and put them back in data[]
+    for( int i=1; i<job.nbr_threads; i++ )
+        threads.push_back( std::thread( esort_buckets, &job ) );
+    esort_buckets( &job );
+    for( size_t i=0; i<threads.size(); i++ )
+        threads[i].join();
+}
+
+/****************************************************************************
+ * Constructor
+ ****************************************************************************/
+ExternalSort::ExternalSort()
+{
+    memory       = 256*1024*1024;
+    nbr_threads  = (int)std::thread::hardware_concurrency();
+    if( nbr_threads < 1 )
+        nbr_threads = 1;
+    max_merge    = 128;
+    record_words = 1;
+    key_words    = 1;
+    nbr_records  = 0;
+    nbr_runs     = 0;
+    capacity     = 0;
+    combine      = false;
+    error        = false;
+    sorted       = false;
+    next         = 0;
+}
+
+/****************************************************************************
+ * Destructor
+ ****************************************************************************/
+ExternalSort::~ExternalSort()
+{
+    End();
+}
+
+/****************************************************************************
+ * Start sorting
+ *  return bool okay
+ ****************************************************************************/
+bool ExternalSort::Begin( int record_words_, int key_words_, const char *temp_filename_ )
+{
+    End();
+    if( record_words_<1 || record_words_>64 || key_words_<1 || key_words_>8 || key_words_>record_words_ )
+        return false;
+    if( combine && key_words_==record_words_ )
+        return false;
+    record_words  = record_words_;
+    key_words     = key_words_;
+    temp_filename = temp_filename_;
+
+    // Half the memory for records, half for sorting them
+    capacity = memory / 2 / (record_words*sizeof(uint64_t));
+    if( capacity < 1024 )
+        capacity = 1024;
+    record.resize( record_words );
+    return true;
+}
+
+/****************************************************************************
+ * Add a record
+ *  return bool okay
+ ****************************************************************************/
+bool ExternalSort::Add( const uint64_t *rec )
+{
+    if( data.empty() )
+        data.reserve( capacity*record_words );
+    data.insert( data.end(), rec, rec+record_words );
+    nbr_records++;
+    if( data.size() >= capacity*record_words )
+    {
+        // Combining might free enough memory to carry on without a run
+        SortData();
+        if( combine && data.size() <= capacity*record_words/2 )
+            return !error;
+        return WriteRun();
+    }
+    return !error;
+}
+
+/****************************************************************************
+ * Sort the records in memory, combining them if need be
+ ****************************************************************************/
+void ExternalSort::SortData()
+{
+    size_t nbr = data.size() / record_words;
+    tmp.resize( data.size() );
+    RadixSort( data.data(), tmp.data(), nbr, record_words, key_words, nbr_threads );
+    if( combine && nbr>1 )
+    {
+        size_t out = 0;
+        for( size_t i=1; i<nbr; i++ )
+        {
+            uint64_t *prev = &data[out*record_words];
+            const uint64_t *rec = &data[i*record_words];
+            if( esort_compare(prev,rec,key_words) == 0 )
+                prev[key_words] += rec[key_words];
+            else if( ++out != i )
+                memcpy( &data[out*record_words], rec, record_words*sizeof(uint64_t) );
+        }
+        data.resize( (out+1)*record_words );
+    }
+}
+
+/****************************************************************************
+ * Write the (sorted) records in memory as a run
+ *  return bool okay
+ ****************************************************************************/
+bool ExternalSort::WriteRun()
+{
+    char buf[32];
+    sprintf( buf, ".%lld", nbr_runs );
+    FILE *file = fopen( (temp_filename+buf).c_str(), "wb" );
+    run_files.push_back( nbr_runs++ );
+    if( !file || fwrite(data.data(),sizeof(uint64_t),data.size(),file)!=data.size() )
+        error = true;
+    if( file && fclose(file)!=0 )
+        error = true;
+    data.clear();
+    return !error;
+}
+
+/****************************************************************************
+ * All records added, sort them
+ *  return bool okay
+ ****************************************************************************/
+bool ExternalSort::Sort()
+{
+    sorted = true;
+    next   = 0;
+    SortData();
+    std::vector<uint64_t>().swap( tmp );
+    if( nbr_runs == 0 )
+        return true;    // everything fitted in memory
+    if( !data.empty() )
+        WriteRun();
+    std::vector<uint64_t>().swap( data );
+    std::vector<uint64_t>().swap( tmp );
+    if( error )
+        return false;
+
+    // Merge passes if need be, then the final merge happens as Next() is
+    //  called
+    return MergePasses() && OpenRuns(0,run_files.size());
+}
+
+/****************************************************************************
+ * Merge runs in passes until there are few enough to merge at once
+ *  return bool okay
+ ****************************************************************************/
+bool ExternalSort::MergePasses()
+{
+    while( run_files.size() > (size_t)max_merge )
+    {
+        // Merge each max_merge runs in turn into a new run that takes their
+        //  place, so the runs stay in the order their records were added
+        std::vector<long long> merged;
+        for( size_t first=0; first<run_files.size(); first+=max_merge )
+        {
+            size_t nbr = run_files.size() - first;
+            if( nbr > (size_t)max_merge )
+                nbr = max_merge;
+            if( nbr == 1 )
+            {
+                merged.push_back( run_files[first] );
+                continue;
+            }
+            if( !OpenRuns(first,nbr) )
+                return false;
+            char buf[32];
+            sprintf( buf, ".%lld", nbr_runs );
+            FILE *file = fopen( (temp_filename+buf).c_str(), "wb" );
+            merged.push_back( nbr_runs++ );
+            if( !file )
+                error = true;
+            while( !error && MergeNext() )
+            {
+                if( fwrite(record.data(),sizeof(uint64_t),record_words,file) != (size_t)record_words )
+                    error = true;
+            }
+            if( file && fclose(file)!=0 )
+                error = true;
+            CloseRuns();
+            for( size_t i=first; i<first+nbr; i++ )
+            {
+                sprintf( buf, ".%lld", run_files[i] );
+                remove( (temp_filename+buf).c_str() );
+            }
+            if( error )
+                return false;
+        }
+        run_files.swap( merged );
+    }
+    return true;
+}
+
+/****************************************************************************
+ * Open runs for merging
+ *  return bool okay
+ ****************************************************************************/
+bool ExternalSort::OpenRuns( size_t first, size_t nbr )
+{
+    // Share memory between the runs' buffers
+    CloseRuns();
+    size_t words = memory / sizeof(uint64_t) / (nbr>0 ? nbr : 1);
+    words -= words%record_words;
+    if( words < 1024*(size_t)record_words )
+        words = 1024*record_words;
+    runs.resize( nbr );
+    for( size_t i=0; i<nbr; i++ )
+    {
+        char buf[32];
+        sprintf( buf, ".%lld", run_files[first+i] );
+        RUN &run = runs[i];
+        run.file = fopen( (temp_filename+buf).c_str(), "rb" );
+        run.buf.resize( words );
+        run.pos = 0;
+        run.len = 0;
+        if( !run.file )
+            error = true;
+        else
+            ReadRun( (int)i );
+    }
+
+    // Heap of runs, smallest record at the top
+    for( int i=0; i<(int)nbr; i++ )
+    {
+        if( runs[i].len == 0 )
+            continue;
+        size_t j = heap.size();
+        heap.push_back( i );
+        while( j>0 && After(heap[(j-1)/2],heap[j]) )
+        {
+            std::swap( heap[(j-1)/2], heap[j] );
+            j = (j-1)/2;
+        }
+    }
+    return !error;
+}
+
+/****************************************************************************
+ * Close the runs being merged
+ ****************************************************************************/
+void ExternalSort::CloseRuns()
+{
+    for( size_t i=0; i<runs.size(); i++ )
+    {
+        if( runs[i].file )
+            fclose( runs[i].file );
+    }
+    runs.clear();
+    heap.clear();
+}
+
+/****************************************************************************
+ * Refill a run's buffer
+ ****************************************************************************/
+void ExternalSort::ReadRun( int r )
+{
+    RUN &run = runs[r];
+    run.pos = 0;
+    run.len = 0;
+    if( !run.file )
+        return;
+    size_t n = fread( run.buf.data(), sizeof(uint64_t), run.buf.size(), run.file );
+    if( ferror(run.file) || n%record_words != 0 )
+        error = true;
+    run.len = n - n%record_words;
+    if( run.len == 0 )
+    {
+        fclose( run.file );
+        run.file = NULL;
+    }
+}
+
+/****************************************************************************
+ * Does run a's current record come after run b's ?
+ ****************************************************************************/
+bool ExternalSort::After( int a, int b ) const
+{
+    int cmp = esort_compare( &runs[a].buf[runs[a].pos], &runs[b].buf[runs[b].pos], key_words );
+    return cmp>0 || (cmp==0 && a>b);
+}
+
+/****************************************************************************
+ * Get the next record, in order
+ *  return bool found
+ ****************************************************************************/
+bool ExternalSort::Next( const uint64_t *&rec )
+{
+    if( !sorted || error )
+        return false;
+    if( nbr_runs == 0 )
+    {
+        if( next*record_words >= data.size() )
+            return false;
+        rec = &data[ next*record_words ];
+        next++;
+        return true;
+    }
+    if( !MergeNext() )
+        return false;
+    rec = record.data();
+    return true;
+}
+
+/****************************************************************************
+ * Merge the next record into record[]
+ *  return bool found
+ ****************************************************************************/
+bool ExternalSort::MergeNext()
+{
+    if( heap.empty() )
+        return false;
+
+    // Take the top run's record, and any with the same key if combining
+    memcpy( record.data(), Top(), record_words*sizeof(uint64_t) );
+    Pop();
+    while( combine && !heap.empty() && esort_compare(Top(),record.data(),key_words)==0 )
+    {
+        record[key_words] += Top()[key_words];
+        Pop();
+    }
+    return true;
+}
+
+/****************************************************************************
+ * The top run's current record
+ ****************************************************************************/
+const uint64_t *ExternalSort::Top() const
+{
+    const RUN &run = runs[ heap[0] ];
+    return &run.buf[run.pos];
+}
+
+/****************************************************************************
+ * Move past the top run's current record, and the run down the heap
+ ****************************************************************************/
+void ExternalSort::Pop()
+{
+    int r = heap[0];
+    RUN &run = runs[r];
+    run.pos += record_words;
+    if( run.pos >= run.len )
+        ReadRun( r );
+    if( run.len == 0 )
+    {
+        heap[0] = heap.back();
+        heap.pop_back();
+    }
+    size_t j = 0;
+    for(;;)
+    {
+        size_t smallest = j;
+        size_t left = 2*j+1, right = 2*j+2;
+        if( left<heap.size() && After(heap[smallest],heap[left]) )
+            smallest = left;
+        if( right<heap.size() && After(heap[smallest],heap[right]) )
+            smallest = right;
+        if( smallest == j )
+            break;
+        std::swap( heap[j], heap[smallest] );
+        j = smallest;
+    }
+}
+
+/****************************************************************************
+ * Finished, remove the temporary files
+ ****************************************************************************/
+void ExternalSort::End()
+{
+    CloseRuns();
+    for( long long i=0; i<nbr_runs; i++ )
+    {
+        char buf[32];
+        sprintf( buf, ".%lld", i );
+        remove( (temp_filename+buf).c_str() );
+    }
+    std::vector<uint64_t>().swap( data );
+    std::vector<uint64_t>().swap( tmp );
+    run_files.clear();
+    nbr_records = 0;
+    nbr_runs    = 0;
+    error       = false;
+    sorted      = false;
+    next        = 0;
+}
+/****************************************************************************
+ * PositionIndex.cpp Chess classes - Which games reached a position
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+
+/*
+    Index layout (all numbers in the machine's byte order)
+
+    Header, POSINDEX_HEADER uint64s, padded to a page
+    Entries, sorted by key, game and ply
+    Fences, the key of the first entry in each page of entries
+ */
+enum
+{
+    POSINDEX_MAGIC,
+    POSINDEX_VERSION,
+    POSINDEX_NBR_ENTRIES,
+    POSINDEX_ENTRIES,
+    POSINDEX_FENCES,
+    POSINDEX_NBR_FENCES,
+    POSINDEX_HEADER=8,
+    POSINDEX_PAGE=4096
+};
+static const char     posindex_magic[8] = { 'T','H','C','P','O','S','I','1' };
+static const uint64_t posindex_version  = 1;
+
+/****************************************************************************
+ * Constructor
+ ****************************************************************************/
+PositionIndexBuilder::PositionIndexBuilder()
+{
+    okay = false;
+}
+
+/****************************************************************************
+ * Start an index
+ *  return bool okay
+ ****************************************************************************/
+bool PositionIndexBuilder::Open( const char *filename_ )
+{
+    filename = filename_;
+    okay = sorter.Begin( 2, 2, (filename+".run").c_str() );
+    return okay;
+}
+
+/****************************************************************************
+ * Add a position
+ ****************************************************************************/
+void PositionIndexBuilder::AddPosition( uint64_t key, long long game, int ply )
+{
+    if( ply<0 || ply>=(1<<PositionIndexEntry::PLY_BITS) || game<0 )
+        return;
+    uint64_t record[2];
+    record[0] = key;
+    record[1] = ((uint64_t)game<<PositionIndexEntry::PLY_BITS) | (uint64_t)ply;
+    if( okay )
+        okay = sorter.Add( record );
+}
+
+/****************************************************************************
+ * Add a game's positions
+ ****************************************************************************/
+void PositionIndexBuilder::AddGame( long long game, const ChessPosition &start, const std::vector<Move> &moves )
+{
+    ChessRules cr;
+    cr = start;
+    AddPosition( cr.key, game, 0 );
+    for( size_t i=0; i<moves.size(); i++ )
+    {
+        cr.PlayMove( moves[i] );
+        AddPosition( cr.key, game, (int)i+1 );
+    }
+}
+
+/****************************************************************************
+ * Add all the games in an archive
+ *  return bool okay
+ ****************************************************************************/
+bool PositionIndexBuilder::AddGames( GameArchive &archive )
+{
+    ChessPosition start;
+    std::vector<Move> moves;
+    for( long long id=0; id<archive.NbrGames(); id++ )
+    {
+        if( !archive.GetGame(id,start,moves) )
+            return false;
+        AddGame( id, start, moves );
+    }
+    return okay;
+}
+
+/****************************************************************************
+ * Sort and write the index
+ *  return bool okay
+ ****************************************************************************/
+bool PositionIndexBuilder::Close()
+{
+    okay = okay && sorter.Sort();
+    FILE *file = okay ? fopen(filename.c_str(),"wb") : NULL;
+    if( !file )
+    {
+        sorter.End();
+        okay = false;
+        return false;
+    }
+
+    // Header later, then the entries, noting the first key in each page
+    std::vector<uint64_t> buf( POSINDEX_PAGE/sizeof(uint64_t), 0 );
+    if( fwrite(buf.data(),1,POSINDEX_PAGE,file) != POSINDEX_PAGE )
+        okay = false;
+    std::vector<uint64_t> fences;
+    long long nbr_entries = 0;
+    const uint64_t *record;
+    buf.clear();
+    while( sorter.Next(record) )
+    {
+        if( nbr_entries%PositionIndex::ENTRIES_PER_PAGE == 0 )
+            fences.push_back( record[0] );
+        buf.push_back( record[0] );
+        buf.push_back( record[1] );
+        nbr_entries++;
+        if( buf.size() >= 65536 )
+        {
+            if( fwrite(buf.data(),sizeof(uint64_t),buf.size(),file) != buf.size() )
+                okay = false;
+            buf.clear();
+        }
+    }
+    if( sorter.Error() || nbr_entries!=sorter.NbrRecords() )
+        okay = false;
+    if( fwrite(buf.data(),sizeof(uint64_t),buf.size(),file) != buf.size() )
+        okay = false;
+    if( fwrite(fences.data(),sizeof(uint64_t),fences.size(),file) != fences.size() )
+        okay = false;
+    uint64_t header[POSINDEX_HEADER];
+    memset( header, 0, sizeof(header) );
+    memcpy( &header[POSINDEX_MAGIC], posindex_magic, sizeof(posindex_magic) );
+    header[POSINDEX_VERSION]     = posindex_version;
+    header[POSINDEX_NBR_ENTRIES] = nbr_entries;
+    header[POSINDEX_ENTRIES]     = POSINDEX_PAGE;
+    header[POSINDEX_FENCES]      = POSINDEX_PAGE + nbr_entries*sizeof(PositionIndexEntry);
+    header[POSINDEX_NBR_FENCES]  = fences.size();
+    if( fseek(file,0,SEEK_SET) != 0 || fwrite(header,1,sizeof(header),file) != sizeof(header) )
+        okay = false;
+    if( fclose(file) != 0 )
+        okay = false;
+    sorter.End();
+    return okay;
+}
+
+/****************************************************************************
+ * Constructor
+ ****************************************************************************/
+PositionIndex::PositionIndex()
+{
+    Close();
+}
+
+/****************************************************************************
+ * Finished with it
+ ****************************************************************************/
+void PositionIndex::Close()
+{
+    file.Close();
+    entries     = NULL;
+    nbr_entries = 0;
+    fences.clear();
+}
+
+/****************************************************************************
+ * Memory map an index
+ *  return bool okay
+ ****************************************************************************/
+bool PositionIndex::Open( const char *filename )
+{
+    Close();
+    if( !file.Open(filename) )
+        return false;
+    uint64_t size = file.Size();
+    uint64_t header[POSINDEX_HEADER];
+    bool okay = size >= POSINDEX_PAGE;
+    if( okay )
+    {
+        memcpy( header, file.Data(), sizeof(header) );
+        okay = memcmp(&header[POSINDEX_MAGIC],posindex_magic,sizeof(posindex_magic))==0 &&
+               header[POSINDEX_VERSION] == posindex_version;
+    }
+
+    // The entries and fences must be in the file, one fence per page
+    uint64_t nbr = okay ? header[POSINDEX_NBR_ENTRIES] : 0;
+    uint64_t nbr_fences = (nbr+ENTRIES_PER_PAGE-1) / ENTRIES_PER_PAGE;
+    okay = okay && header[POSINDEX_ENTRIES]==POSINDEX_PAGE
+                && nbr <= (size-POSINDEX_PAGE)/sizeof(PositionIndexEntry)
+                && header[POSINDEX_FENCES] == POSINDEX_PAGE + nbr*sizeof(PositionIndexEntry)
+                && header[POSINDEX_NBR_FENCES] == nbr_fences
+                && nbr_fences <= (size-header[POSINDEX_FENCES])/sizeof(uint64_t);
+    if( !okay )
+    {
+        Close();
+        return false;
+    }
+    entries     = (const PositionIndexEntry *)(file.Data() + POSINDEX_PAGE);
+    nbr_entries = (long long)nbr;
+    fences.resize( (size_t)nbr_fences );
+    memcpy( fences.data(), file.Data() + header[POSINDEX_FENCES], (size_t)nbr_fences*sizeof(uint64_t) );
+    return true;
+}
+
+// Order entries by key alone
+static bool posindex_key_less( const PositionIndexEntry &entry, uint64_t key )
+{
+    return entry.key < key;
+}
+static bool posindex_less_key( uint64_t key, const PositionIndexEntry &entry )
+{
+    return key < entry.key;
+}
+
+/****************************************************************************
+ * Find a position
+ *  return number of entries
+ ****************************************************************************/
+size_t PositionIndex::Find( uint64_t key, const PositionIndexEntry *&first ) const
+{
+    first = entries;
+    if( nbr_entries == 0 )
+        return 0;
+
+    // The fences say which page the first entry with the key is in (or at
+    //  the start of the next page), likewise the last
+    size_t page = std::lower_bound( fences.begin(), fences.end(), key ) - fences.begin();
+    size_t lo   = (page>0 ? page-1 : 0) * ENTRIES_PER_PAGE;
+    size_t hi   = std::min( (size_t)nbr_entries, page*ENTRIES_PER_PAGE );
+    const PositionIndexEntry *begin = std::lower_bound( entries+lo, entries+hi, key, posindex_key_less );
+    page = std::upper_bound( fences.begin(), fences.end(), key ) - fences.begin();
+    lo   = (page>0 ? page-1 : 0) * ENTRIES_PER_PAGE;
+    hi   = std::min( (size_t)nbr_entries, page*ENTRIES_PER_PAGE );
+    const PositionIndexEntry *end = std::upper_bound( entries+lo, entries+hi, key, posindex_less_key );
+    first = begin;
+    return end>begin ? (size_t)(end-begin) : 0;
+}
+
+/****************************************************************************
+ * Which games reached a position
+ *  return number of games
+ ****************************************************************************/
+size_t PositionIndex::FindGames( const ChessPosition &cp, std::vector<long long> &games ) const
+{
+    games.clear();
+    const PositionIndexEntry *first;
+    size_t nbr = Find( cp, first );
+    for( size_t i=0; i<nbr; i++ )
+    {
+        long long game = first[i].Game();
+        if( games.empty() || games.back()!=game )
+            games.push_back( game );
+    }
+    return games.size();
+}
+/****************************************************************************
+ * PositionDedup.cpp Chess classes - Sort positions, and count duplicates
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+
+/****************************************************************************
+ * Constructor
+ ****************************************************************************/
+PositionDedup::PositionDedup()
+{
+    nbr_positions = 0;
+    sorter.SetCombine( true );
+}
+
+/****************************************************************************
+ * Start
+ *  return bool okay
+ ****************************************************************************/
+bool PositionDedup::Begin( const char *temp_filename )
+{
+    nbr_positions = 0;
+    return sorter.Begin( 4, 3, temp_filename );
+}
+
+/****************************************************************************
+ * The sort key
+ *  return bool okay
+ ****************************************************************************/
+bool PositionDedup::Key( const ChessPosition &cp, uint64_t key[3] )
+{
+    // Compress() only has room for 32 men
+    int men = 0;
+    for( int i=0; i<64; i++ )
+    {
+        if( cp.squares[i] != ' ' )
+            men++;
+    }
+    if( men > 32 )
+        return false;
+    CompressedPosition compressed;
+    cp.Compress( compressed );
+    for( int i=0; i<3; i++ )
+    {
+        uint64_t word = 0;
+        for( int j=0; j<8; j++ )
+            word = (word<<8) | compressed.storage[8*i+j];
+        key[i] = word;
+    }
+    return true;
+}
+
+/****************************************************************************
+ * Add a position
+ *  return bool okay
+ ****************************************************************************/
+bool PositionDedup::Add( const ChessPosition &cp, uint64_t count )
+{
+    uint64_t record[4];
+    if( !Key(cp,record) )
+        return false;
+    record[3] = count;
+    nbr_positions += (long long)count;
+    return sorter.Add( record );
+}
+
+/****************************************************************************
+ * All positions added, sort them
+ *  return bool okay
+ ****************************************************************************/
+bool PositionDedup::Sort()
+{
+    return sorter.Sort();
+}
+
+/****************************************************************************
+ * Get the next distinct position
+ *  return bool found
+ ****************************************************************************/
+bool PositionDedup::Next( CompressedPosition &position, uint64_t &count )
+{
+    const uint64_t *record;
+    if( !sorter.Next(record) )
+        return false;
+    for( int i=0; i<3; i++ )
+    {
+        for( int j=0; j<8; j++ )
+            position.storage[8*i+j] = (unsigned char)(record[i] >> (56-8*j));
+    }
+    count = record[3];
+    return true;
+}
+/****************************************************************************
+ * Move.cpp Chess classes - Move
+ *  Author:  Bill Forster
+ *  License: MIT license. Full text of license is in associated file LICENSE
+ *  Copyright 2010-2020, Bill Forster <billforsternz at gmail dot com>
+ ****************************************************************************/
+
+/****************************************************************************
+ * Make up a move from source and destination squares, as GenLegalMoveList()
+ *  would generate it (promotion is 'Q','R','B','N' or '\0' for the default
+ *  queen, and is ignored if the move isn't a promotion)
+ *  return bool legal
+ ****************************************************************************/
+static bool move_from_squares( ChessRules *cr, Square src, Square dst, char promotion, Move &mv )
+{
+    if( (unsigned int)src>(unsigned int)h1 || (unsigned int)dst>(unsigned int)h1 )
+        return false;
+    bool white = cr->white;
+    char piece = cr->squares[src];
+    mv.src     = src;
+    mv.dst     = dst;
+    mv.capture = cr->squares[dst];
+    mv.special = NOT_SPECIAL;
+    if( piece == (white?'K':'k') )
+    {
+        mv.special = SPECIAL_KING_MOVE;
+        if( src==(white?e1:e8) && dst==(white?g1:g8) )
+            mv.special = (white?SPECIAL_WK_CASTLING:SPECIAL_BK_CASTLING);
+        else if( src==(white?e1:e8) && dst==(white?c1:c8) )
+            mv.special = (white?SPECIAL_WQ_CASTLING:SPECIAL_BQ_CASTLING);
+    }
+    else if( piece == (white?'P':'p') )
+    {
+        if( RANK(dst) == (white?'8':'1') )
+        {
+            switch( promotion )
+            {
+                default:
+                case 'Q': mv.special = SPECIAL_PROMOTION_QUEEN;   break;
+                case 'R': mv.special = SPECIAL_PROMOTION_ROOK;    break;
+                case 'B': mv.special = SPECIAL_PROMOTION_BISHOP;  break;
+                case 'N': mv.special = SPECIAL_PROMOTION_KNIGHT;  break;
+            }
+        }
+        else if( dst==cr->enpassant_target && FILE(dst)!=FILE(src) )
+        {
+            mv.special = (white?SPECIAL_WEN_PASSANT:SPECIAL_BEN_PASSANT);
+            mv.capture = (white?'p':'P');
+        }
+        else if( RANK(src)==(white?'2':'7') && RANK(dst)==(white?'4':'5') )
+            mv.special = (white?SPECIAL_WPAWN_2SQUARES:SPECIAL_BPAWN_2SQUARES);
+    }
+    return cr->IsLegalMove( mv );
+}
+
 /****************************************************************************
  * Read natural string move eg "Nf3"
  *  return bool okay
  ****************************************************************************/
 bool Move::NaturalIn( ChessRules *cr, const char *natural_in )
 {
-    MOVELIST list;
+    size_t len=0;
+    while( len<10 && natural_in[len] )  // the most NaturalIn() ever looks at
+        len++;
+    return NaturalIn( cr, natural_in, len );
+}
+
+/****************************************************************************
+ * Read natural string move of given length eg "Nf3", for NaturalIn() and
+ *  NaturalInUnique(). If unique, input that more than one of our men
+ *  matches (eg "Nd2" if Nbd2 and Nfd2 are both legal) is rejected, rather
+ *  than resolved as the first match
+ *  return bool okay
+ ****************************************************************************/
+static bool move_natural_in( Move &result, ChessRules *cr, const char *natural_in, size_t natural_len, bool unique )
+{
     int  i, len=0;
     char src_file='\0', src_rank='\0', dst_file='\0', dst_rank='\0';
     char promotion='\0';
@@ -5755,7 +10698,8 @@ bool Move::NaturalIn( ChessRules *cr, const char *natural_in )
     bool kcastling=false;
     bool qcastling=false;
     Square dst_=a8;
-    Move *m, *found=NULL;
+    bool found=false;
+    Move mv;
     char *s;
     char  move[10];
     bool  white=cr->white;
@@ -5767,13 +10711,13 @@ bool Move::NaturalIn( ChessRules *cr, const char *natural_in )
 
     // Copy to read-write variable
     okay = false;
-    for( i=0; i<sizeof(move); i++ )
+    for( size_t j=0; j<sizeof(move); j++ )
     {
-        move[i] = natural_in[i];
-        if( move[i]=='\0' || move[i]==' ' || move[i]=='\t' ||
-            move[i]=='\r' || move[i]=='\n' )
+        move[j] = (j<natural_len ? natural_in[j] : '\0');
+        if( move[j]=='\0' || move[j]==' ' || move[j]=='\t' ||
+            move[j]=='\r' || move[j]=='\n' )
         {
-            move[i] = '\0';
+            move[j] = '\0';
             okay = true;
             break;
         }
@@ -5966,923 +10910,417 @@ bool Move::NaturalIn( ChessRules *cr, const char *natural_in )
         }
     }
 
-    // Check against all possible moves
+    // Check candidate source squares directly against the position. They
+    //  are tried in the order GenLegalMoveList() generates moves, so
+    //  ambiguous input is resolved as it always has been
     if( okay )
     {
-        cr->GenLegalMoveList( &list );
-
-        // Have source and destination, eg "d2d3"
         if( enpassant )
             src_rank = dst_rank = '\0';
-        if( src_file && src_rank && dst_file && dst_rank )
-        {
-            for( i=0; i<list.count; i++ )
-            {
-                m = &list.moves[i];
-                if( (default_piece || piece==cr->squares[m->src])  &&
-                    src_file  ==   FILE(m->src)       &&
-                    src_rank  ==   RANK(m->src)       &&
-                    dst_       ==   m->dst
-                )
-                {
-                    if( kcastling )
-                    {
-                        if( m->special ==
-                             (white?SPECIAL_WK_CASTLING:SPECIAL_BK_CASTLING) )
-                            found = m;
-                    }
-                    else if( qcastling )
-                    {
-                        if( m->special ==
-                             (white?SPECIAL_WQ_CASTLING:SPECIAL_BQ_CASTLING) )
-                            found = m;
-                    }
-                    else
-                        found = m;
-                    break;
-                }
-            }
-        }
-
-        // Have source file only, eg "Rae1"
-        else if( src_file && dst_file && dst_rank )
-        {
-            for( i=0; i<list.count; i++ )
-            {
-                m = &list.moves[i];
-                if( piece     ==   cr->squares[m->src]  &&
-                    src_file  ==   FILE(m->src)         &&
-                 /* src_rank  ==   RANK(m->src)  */
-                    dst_       ==   m->dst
-                )
-                {
-                    found = m;
-                    break;
-                }
-            }
-        }
-
-        // Have source rank only, eg "R2d2"
-        else if( src_rank && dst_file && dst_rank )
-        {
-            for( i=0; i<list.count; i++ )
-            {
-                m = &list.moves[i];
-                if( piece     ==   cr->squares[m->src]   &&
-                 /* src_file  ==   FILE(m->src) */
-                    src_rank  ==   RANK(m->src)          &&
-                    dst_       ==   m->dst
-                )
-                {
-                    found = m;
-                    break;
-                }
-            }
-        }
-
-        // Have destination file only eg e4f (because 2 ef moves are possible)
-        else if( src_file && src_rank && dst_file )
-        {
-            for( i=0; i<list.count; i++ )
-            {
-                m = &list.moves[i];
-                if( piece     ==   cr->squares[m->src]      &&
-                    src_file  ==   FILE(m->src)             &&
-                    src_rank  ==   RANK(m->src)             &&
-                    dst_file  ==   FILE(m->dst)
-                )
-                {
-                    found = m;
-                    break;
-                }
-            }
-        }
-
-        // Have files only, eg "ef"
-        else if( src_file && dst_file )
-        {
-            for( i=0; i<list.count; i++ )
-            {
-                m = &list.moves[i];
-                if( piece     ==   cr->squares[m->src]      &&
-                    src_file  ==   FILE(m->src)             &&
-                 /* src_rank  ==   RANK(m->src) */
-                    dst_file  ==   FILE(m->dst)
-                )
-                {
-                    if( enpassant )
-                    {
-                        if( m->special ==
-                             (white?SPECIAL_WEN_PASSANT:SPECIAL_BEN_PASSANT) )
-                            found = m;
-                    }
-                    else
-                        found = m;
-                    break;
-                }
-            }
-        }
-
-        // Have destination square only eg "a4"
-        else if( dst_rank && dst_file )
-        {
-            for( i=0; i<list.count; i++ )
-            {
-                m = &list.moves[i];
-                if( piece     ==   cr->squares[m->src]          &&
-                    dst_       ==   m->dst
-                )
-                {
-                    found = m;
-                    break;
-                }
-            }
-        }
-    }
-
-    // Copy found move
-    if( okay && found )
-    {
-        bool found_promotion =
-            ( found->special == SPECIAL_PROMOTION_QUEEN ||
-              found->special == SPECIAL_PROMOTION_ROOK ||
-              found->special == SPECIAL_PROMOTION_BISHOP ||
-              found->special == SPECIAL_PROMOTION_KNIGHT
-            );
-        if( promotion && !found_promotion )
-            okay = false;
-        if( found_promotion )
-        {
-            switch( promotion )
-            {
-                default:
-                case 'Q': found->special = SPECIAL_PROMOTION_QUEEN;   break;
-                case 'R': found->special = SPECIAL_PROMOTION_ROOK;    break;
-                case 'B': found->special = SPECIAL_PROMOTION_BISHOP;  break;
-                case 'N': found->special = SPECIAL_PROMOTION_KNIGHT;  break;
-            }
-        }
-    }
-    if( !found )
-        okay = false;
-    if( okay )
-        *this = *found;
-    return okay;
-}
-
-/****************************************************************************
- * Read natural string move eg "Nf3"
- *  return bool okay
- * Fast alternative for known good input
- ****************************************************************************/
-bool Move::NaturalInFast( ChessRules *cr, const char *natural_in )
-{
-    bool err = false;
-    bool found = false;
-    bool capture_ = false;
-    Move mv;
-
-    /*
-     Handles moves of the following type
-     exd8=N
-     e8=B
-     exd8N
-     e8B
-     exd5
-     e4
-     Nf3
-     Nxf3
-     Nef3
-     Nexf3
-     N2f3
-     N2xf3
-     O-O
-     O-O-O
-     */
-
-//
-    mv.special = NOT_SPECIAL;
-    mv.capture = ' ';
-    char f = *natural_in++;
-
-    // WHITE MOVE
-    if( cr->white )
-    {
-
-        // Pawn move ?
-        if( 'a'<=f && f<='h' )
-        {
-            char r = *natural_in++;
-            if( r != 'x')
-            {
-
-                // Non capturing, non promoting pawn move
-                if( '3'<= r && r<= '7')
-                {
-                    mv.dst = SQ(f,r);
-                    mv.src = SOUTH(mv.dst);
-                    if( cr->squares[mv.src]=='P' && cr->squares[mv.dst]==' ')
-                        found =true;
-                    else if( r=='4' && cr->squares[mv.src]==' ' && cr->squares[mv.dst]==' ')
-                    {
-                        mv.special = SPECIAL_WPAWN_2SQUARES;
-                        mv.src = SOUTH(mv.src);
-                        found = (cr->squares[mv.src]=='P');
-                    }
-                }
-
-                // Non-capturing, promoting pawn move
-                else if( r=='8' )
-                {
-                    if( *natural_in == '=' )    // now optional
-                        natural_in++;
-                    mv.dst = SQ(f,r);
-                    mv.src = SOUTH(mv.dst);
-                    if( cr->squares[mv.src]=='P' && cr->squares[mv.dst]==' ')
-                    {
-                        switch( *natural_in++ )
-                        {
-                            default:
-                            {
-                                break;
-                            }
-                            case 'Q':
-                            case 'q':
-                            {
-                                mv.special = SPECIAL_PROMOTION_QUEEN;
-                                found = true;
-                                break;
-                            }
-                            case 'R':
-                            case 'r':
-                            {
-                                mv.special = SPECIAL_PROMOTION_ROOK;
-                                found = true;
-                                break;
-                            }
-                            case 'N':
-                            case 'n':
-                            {
-                                mv.special = SPECIAL_PROMOTION_KNIGHT;
-                                found = true;
-                                break;
-                            }
-                            case 'B':
-                            case 'b':
-                            {
-                                mv.special = SPECIAL_PROMOTION_BISHOP;
-                                found = true;
-                                break;
-                            }
-                        }
-                    }
-                }
-            }
-            else // if ( r == 'x' )
-            {
-                char g = *natural_in++;
-                if( 'a'<=g && g<='h' )
-                {
-                    r = *natural_in++;
-
-                    // Non promoting, capturing pawn move
-                    if( '3'<= r && r<= '7')
-                    {
-                        mv.dst = SQ(g,r);
-                        mv.src = SQ(f,r-1);
-                        if( cr->squares[mv.src]=='P' && IsBlack(cr->squares[mv.dst]) )
-                        {
-                            mv.capture = cr->squares[mv.dst];
-                            found = true;
-                        }
-                        else if( r=='6' && cr->squares[mv.src]=='P' && cr->squares[mv.dst]==' '  && mv.dst==cr->enpassant_target && cr->squares[SOUTH(mv.dst)]=='p' )
-                        {
-                            mv.capture = 'p';
-                            mv.special = SPECIAL_WEN_PASSANT;
-                            found = true;
-                        }
-                    }
-
-                    // Promoting, capturing pawn move
-                    else if( r=='8' )
-                    {
-                        if( *natural_in == '=' )    // now optional
-                            natural_in++;
-                        mv.dst = SQ(g,r);
-                        mv.src = SQ(f,r-1);
-                        if( cr->squares[mv.src]=='P' && IsBlack(cr->squares[mv.dst]) )
-                        {
-                            mv.capture = cr->squares[mv.dst];
-                            switch( *natural_in++ )
-                            {
-                                default:
-                                {
-                                    break;
-                                }
-                                case 'Q':
-                                case 'q':
-                                {
-                                    mv.special = SPECIAL_PROMOTION_QUEEN;
-                                    found = true;
-                                    break;
-                                }
-                                case 'R':
-                                case 'r':
-                                {
-                                    mv.special = SPECIAL_PROMOTION_ROOK;
-                                    found = true;
-                                    break;
-                                }
-                                case 'N':
-                                case 'n':
-                                {
-                                    mv.special = SPECIAL_PROMOTION_KNIGHT;
-                                    found = true;
-                                    break;
-                                }
-                                case 'B':
-                                case 'b':
-                                {
-                                    mv.special = SPECIAL_PROMOTION_BISHOP;
-                                    found = true;
-                                    break;
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-        }
-        else
-        {
-
-            // Piece move
-            const lte **ray_lookup = queen_lookup;
-            switch( f )
-            {
-                case 'O':
-                {
-                    if( 0 == memcmp(natural_in,"-O-O",4) )
-                    {
-                        natural_in += 4;
-                        mv.src = e1;
-                        mv.dst = c1;
-                        mv.capture = ' ';
-                        mv.special = SPECIAL_WQ_CASTLING;
-                        found = true;
-                    }
-                    else if( 0 == memcmp(natural_in,"-O",2) )
-                    {
-                        natural_in += 2;
-                        mv.src = e1;
-                        mv.dst = g1;
-                        mv.capture = ' ';
-                        mv.special = SPECIAL_WK_CASTLING;
-                        found = true;
-                    }
-                    break;
-                }
-
-                // King is simple special case - there's only one king so no disambiguation
-                case 'K':
-                {
-                    f = *natural_in++;
-                    if( f == 'x' )
-                    {
-                        capture_ = true;
-                        f = *natural_in++;
-                    }
-                    if( 'a'<= f && f<='h' )
-                    {
-                        char r = *natural_in++;
-                        if( '1'<=r && r<='8' )
-                        {
-                            mv.src = cr->wking_square;
-                            mv.dst = SQ(f,r);
-                            mv.special = SPECIAL_KING_MOVE;
-                            mv.capture = cr->squares[mv.dst];
-                            found = ( capture_ ? IsBlack(mv.capture) : IsEmptySquare(mv.capture) );
-                        }
-                    }
-                    break;
-                }
-
-                // Other pieces may need to check legality for disambiguation
-                case 'Q':   ray_lookup = queen_lookup;                      // fall through
-                case 'R':   if( f=='R' )    ray_lookup = rook_lookup;       // fall through
-                case 'B':   if( f=='B' )    ray_lookup = bishop_lookup;     // fall through
-                case 'N':
-                {
-                    char piece = f;
-                    f = *natural_in++;
-                    char src_file='\0';
-                    char src_rank='\0';
-                    if( f == 'x' )
-                    {
-                        capture_ = true;
-                        f = *natural_in++;
-                    }
-                    if( '1'<=f && f<='8' )
-                    {
-                        src_rank = f;
-                    }
-                    else if( 'a'<= f && f<='h' )
-                    {
-                        src_file = f;
-                    }
-                    else
-                        err = true;
-                    if( !err )
-                    {
-                        char g = *natural_in++;
-                        if( g == 'x' )
-                        {
-                            if( capture_ )
-                                err = true;
-                            else
-                            {
-                                capture_ = true;
-                                g = *natural_in++;
-                            }
-                        }
-                        if( '1'<=g && g<='8' )
-                        {
-                            if( src_file )
-                            {
-                                mv.dst = SQ(src_file,g);
-                                src_file = '\0';
-                            }
-                            else
-                                err = true;
-                        }
-                        else if( 'a'<=g && g<='h' )
-                        {
-                            char dst_rank = *natural_in++;
-                            if( '1'<=dst_rank && dst_rank<='8' )
-                                mv.dst = SQ(g,dst_rank);
-                            else
-                                err = true;
-                        }
-                        else
-                            err = true;
-                        if( !err )
-                        {
-                            if( capture_ ? IsBlack(cr->squares[mv.dst]) : cr->squares[mv.dst]==' ' )
-                            {
-                                mv.capture = cr->squares[mv.dst];
-                                if( piece == 'N' )
-                                {
-                                    int count=0;
-                                    for( int probe=0; !found && probe<2; probe++ )
-                                    {
-                                        const lte *ptr = knight_lookup[mv.dst];
-                                        lte nbr_moves = *ptr++;
-                                        while( !found && nbr_moves-- )
-                                        {
-                                            Square src_ = (Square)*ptr++;
-                                            if( cr->squares[src_]=='N' )
-                                            {
-                                                bool src_file_ok = !src_file || FILE(src_)==src_file;
-                                                bool src_rank_ok = !src_rank || RANK(src_)==src_rank;
-                                                if( src_file_ok && src_rank_ok )
-                                                {
-                                                    mv.src = src_;
-                                                    if( probe == 0 )
-                                                        count++;
-                                                    else // probe==1 means disambiguate by testing whether move is legal, found will be set if
-                                                        // we are not exposing white king to check.
-                                                    {
-                                                        char temp = cr->squares[mv.dst];
-                                                        cr->squares[mv.dst] = 'N';  // temporarily make move
-                                                        cr->squares[src_] = ' ';
-                                                        found = !cr->AttackedSquare( cr->wking_square, false ); //bool AttackedSquare( Square square, bool enemy_is_white );
-                                                        cr->squares[mv.dst] = temp;  // now undo move
-                                                        cr->squares[src_] = 'N';
-                                                    }
-                                                }
-                                            }
-                                        }
-                                        if( probe==0 && count==1 )
-                                            found = true; // done, no need for disambiguation by check
-                                    }
-                                }
-                                else // if( rook, bishop, queen )
-                                {
-                                    int count = 0;
-                                    for( int probe=0; !found && probe<2; probe++ )
-                                    {
-                                        const lte *ptr = ray_lookup[mv.dst];
-                                        lte nbr_rays = *ptr++;
-                                        while( !found && nbr_rays-- )
-                                        {
-                                            lte ray_len = *ptr++;
-                                            while( !found && ray_len-- )
-                                            {
-                                                Square src_ = (Square)*ptr++;
-                                                if( !IsEmptySquare(cr->squares[src_]) )
-                                                {
-                                                    // Any piece, friend or enemy must move to end of ray
-                                                    ptr += ray_len;
-                                                    ray_len = 0;
-                                                    if( cr->squares[src_] == piece )
-                                                    {
-                                                        bool src_file_ok = !src_file || FILE(src_)==src_file;
-                                                        bool src_rank_ok = !src_rank || RANK(src_)==src_rank;
-                                                        if( src_file_ok && src_rank_ok )
-                                                        {
-                                                            mv.src = src_;
-                                                            if( probe == 0 )
-                                                                count++;
-                                                            else // probe==1 means disambiguate by testing whether move is legal, found will be set if
-                                                                // we are not exposing white king to check.
-                                                            {
-                                                                char temp = cr->squares[mv.dst];
-                                                                cr->squares[mv.dst] = piece;  // temporarily make move
-                                                                cr->squares[mv.src] = ' ';
-                                                                found = !cr->AttackedSquare( cr->wking_square, false ); //bool AttackedSquare( Square square, bool enemy_is_white );
-                                                                cr->squares[mv.dst] = temp;  // now undo move
-                                                                cr->squares[mv.src] = piece;
-                                                            }
-                                                        }
-                                                    }
-                                                }
-                                            }
-                                        }
-                                        if( probe==0 && count==1 )
-                                            found = true; // done, no need for disambiguation by check
-                                    }
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-        }
-    }
-
-    // BLACK MOVE
-    else
-    {
-        // Pawn move ?
-        if( 'a'<=f && f<='h' )
-        {
-            char r = *natural_in++;
-            if( r != 'x')
-            {
-
-                // Non capturing, non promoting pawn move
-                if( '2'<= r && r<= '6')
-                {
-                    mv.dst = SQ(f,r);
-                    mv.src = NORTH(mv.dst);
-                    if( cr->squares[mv.src]=='p' && cr->squares[mv.dst]==' ')
-                        found =true;
-                    else if( r=='5' && cr->squares[mv.src]==' ' && cr->squares[mv.dst]==' ')
-                    {
-                        mv.special = SPECIAL_BPAWN_2SQUARES;
-                        mv.src = NORTH(mv.src);
-                        found = (cr->squares[mv.src]=='p');
-                    }
-                }
-
-                // Non-capturing, promoting pawn move
-                else if( r=='1' )
-                {
-                    if( *natural_in == '=' )    // now optional
-                        natural_in++;
-                    mv.dst = SQ(f,r);
-                    mv.src = NORTH(mv.dst);
-                    if( cr->squares[mv.src]=='p' && cr->squares[mv.dst]==' ')
-                    {
-                        switch( *natural_in++ )
-                        {
-                            default:
-                            {
-                                break;
-                            }
-                            case 'Q':
-                            case 'q':
-                            {
-                                mv.special = SPECIAL_PROMOTION_QUEEN;
-                                found = true;
-                                break;
-                            }
-                            case 'R':
-                            case 'r':
-                            {
-                                mv.special = SPECIAL_PROMOTION_ROOK;
-                                found = true;
-                                break;
-                            }
-                            case 'N':
-                            case 'n':
-                            {
-                                mv.special = SPECIAL_PROMOTION_KNIGHT;
-                                found = true;
-                                break;
-                            }
-                            case 'B':
-                            case 'b':
-                            {
-                                mv.special = SPECIAL_PROMOTION_BISHOP;
-                                found = true;
-                                break;
-                            }
-                        }
-                    }
-                }
-            }
-            else // if ( r == 'x' )
-            {
-                char g = *natural_in++;
-                if( 'a'<=g && g<='h' )
-                {
-                    r = *natural_in++;
-
-                    // Non promoting, capturing pawn move
-                    if( '2'<= r && r<= '6')
-                    {
-                        mv.dst = SQ(g,r);
-                        mv.src = SQ(f,r+1);
-                        if( cr->squares[mv.src]=='p' && IsWhite(cr->squares[mv.dst]) )
-                        {
-                            mv.capture = cr->squares[mv.dst];
-                            found = true;
-                        }
-                        else if( r=='3' && cr->squares[mv.src]=='p' && cr->squares[mv.dst]==' '  && mv.dst==cr->enpassant_target && cr->squares[NORTH(mv.dst)]=='P' )
-                        {
-                            mv.capture = 'P';
-                            mv.special = SPECIAL_BEN_PASSANT;
-                            found = true;
-                        }
-                    }
-
-                    // Promoting, capturing pawn move
-                    else if( r=='1' )
-                    {
-                        if( *natural_in == '=' )    // now optional
-                            natural_in++;
-                        mv.dst = SQ(g,r);
-                        mv.src = SQ(f,r+1);
-                        if( cr->squares[mv.src]=='p' && IsWhite(cr->squares[mv.dst]) )
-                        {
-                            mv.capture = cr->squares[mv.dst];
-                            switch( *natural_in++ )
-                            {
-                                default:
-                                {
-                                    break;
-                                }
-                                case 'Q':
-                                case 'q':
-                                {
-                                    mv.special = SPECIAL_PROMOTION_QUEEN;
-                                    found = true;
-                                    break;
-                                }
-                                case 'R':
-                                case 'r':
-                                {
-                                    mv.special = SPECIAL_PROMOTION_ROOK;
-                                    found = true;
-                                    break;
-                                }
-                                case 'N':
-                                case 'n':
-                                {
-                                    mv.special = SPECIAL_PROMOTION_KNIGHT;
-                                    found = true;
-                                    break;
-                                }
-                                case 'B':
-                                case 'b':
-                                {
-                                    mv.special = SPECIAL_PROMOTION_BISHOP;
-                                    found = true;
-                                    break;
-                                }
-                            }
-                        }
-                    }
-                }
+
+        // Have source and destination, eg "d2d3"
+        if( src_file && src_rank && dst_file && dst_rank )
+        {
+            Square src_ = SQ(src_file,src_rank);
+            if( (default_piece || piece==cr->squares[src_]) &&
+                move_from_squares( cr, src_, dst_, promotion, mv ) )
+            {
+                if( kcastling )
+                    found = (mv.special == (white?SPECIAL_WK_CASTLING:SPECIAL_BK_CASTLING));
+                else if( qcastling )
+                    found = (mv.special == (white?SPECIAL_WQ_CASTLING:SPECIAL_BQ_CASTLING));
+                else
+                    found = true;
             }
         }
+
+        // Otherwise try each of our men of the right type that matches
+        //  the source file or rank if we have them, eg "Nf3", "Rae1", "R2d2",
+        //  and for pawn moves without a destination rank, eg "ef", "e4f",
+        //  the destination is the square on that file one step forward (or
+        //  two for a pawn's first move)
         else
         {
-
-            // Piece move
-            const lte **ray_lookup=queen_lookup;
-            switch( f )
+            Bitboard men = cr->bb_pieces[ bb_index[piece&0x7f] ];
+            while( (!found || unique) && men )
             {
-                case 'O':
+                Square src_ = bb_pop_lsb(men);
+                if( (src_file && src_file!=FILE(src_)) || (src_rank && src_rank!=RANK(src_)) )
+                    continue;
+                Square dst = dst_;
+                if( !dst_rank )
+                    dst = SQ( dst_file, white ? RANK(src_)+1 : RANK(src_)-1 );
+                Move candidate;
+                bool legal = move_from_squares( cr, src_, dst, promotion, candidate );
+                if( !legal && !dst_rank && dst_file==FILE(src_) )   // eg "ee"
+                    legal = move_from_squares( cr, src_, SQ( dst_file, white ? RANK(src_)+2 : RANK(src_)-2 ), promotion, candidate );
+                if( legal && found )
                 {
-                    if( 0 == memcmp(natural_in,"-O-O",4) )
-                    {
-                        natural_in += 4;
-                        mv.src = e8;
-                        mv.dst = c8;
-                        mv.capture = ' ';
-                        mv.special = SPECIAL_BQ_CASTLING;
-                        found = true;
-                    }
-                    else if( 0 == memcmp(natural_in,"-O",2) )
-                    {
-                        natural_in += 2;
-                        mv.src = e8;
-                        mv.dst = g8;
-                        mv.capture = ' ';
-                        mv.special = SPECIAL_BK_CASTLING;
-                        found = true;
-                    }
+                    okay = false;   // ambiguous
                     break;
                 }
-
-                // King is simple special case - there's only one king so no disambiguation
-                case 'K':
+                if( legal )
                 {
-                    f = *natural_in++;
-                    if( f == 'x' )
-                    {
-                        capture_ = true;
-                        f = *natural_in++;
-                    }
-                    if( 'a'<= f && f<='h' )
-                    {
-                        char r = *natural_in++;
-                        if( '1'<=r && r<='8' )
-                        {
-                            mv.src = cr->bking_square;
-                            mv.dst = SQ(f,r);
-                            mv.special = SPECIAL_KING_MOVE;
-                            mv.capture = cr->squares[mv.dst];
-                            found = ( capture_ ? IsWhite(mv.capture) : IsEmptySquare(mv.capture) );
-                        }
-                    }
-                    break;
+                    found = true;
+                    mv = candidate;
+                    if( enpassant && mv.special!=(white?SPECIAL_WEN_PASSANT:SPECIAL_BEN_PASSANT) )
+                        okay = false;
                 }
+            }
+        }
+    }
 
-                // Other pieces may need to check legality for disambiguation
-                case 'Q':   ray_lookup = queen_lookup;                      // fall through
-                case 'R':   if( f=='R' )    ray_lookup = rook_lookup;       // fall through
-                case 'B':   if( f=='B' )    ray_lookup = bishop_lookup;     // fall through
-                case 'N':
-                {
-                    char piece = static_cast<char>(tolower(f));
-                    f = *natural_in++;
-                    char src_file='\0';
-                    char src_rank='\0';
-                    if( f == 'x' )
-                    {
-                        capture_ = true;
-                        f = *natural_in++;
-                    }
-                    if( '1'<=f && f<='8' )
-                    {
-                        src_rank = f;
-                    }
-                    else if( 'a'<= f && f<='h' )
-                    {
-                        src_file = f;
-                    }
-                    else
-                        err = true;
-                    if( !err )
-                    {
-                        char g = *natural_in++;
-                        if( g == 'x' )
-                        {
-                            if( capture_ )
-                                err = true;
-                            else
-                            {
-                                capture_ = true;
-                                g = *natural_in++;
-                            }
-                        }
-                        if( '1'<=g && g<='8' )
-                        {
-                            if( src_file )
-                            {
-                                mv.dst = SQ(src_file,g);
-                                src_file = '\0';
-                            }
-                            else
-                                err = true;
-                        }
-                        else if( 'a'<=g && g<='h' )
-                        {
-                            char dst_rank = *natural_in++;
-                            if( '1'<=dst_rank && dst_rank<='8' )
-                                mv.dst = SQ(g,dst_rank);
+    // A promotion must be to a promotion square
+    if( okay && found && promotion )
+    {
+        bool found_promotion =
+            ( mv.special == SPECIAL_PROMOTION_QUEEN ||
+              mv.special == SPECIAL_PROMOTION_ROOK ||
+              mv.special == SPECIAL_PROMOTION_BISHOP ||
+              mv.special == SPECIAL_PROMOTION_KNIGHT
+            );
+        if( !found_promotion )
+            okay = false;
+    }
+    if( !found )
+        okay = false;
+    if( okay )
+        result = mv;
+    return okay;
+}
+
+/****************************************************************************
+ * Read natural string move of given length eg "Nf3"
+ *  return bool okay
+ ****************************************************************************/
+bool Move::NaturalIn( ChessRules *cr, const char *natural_in, size_t natural_len )
+{
+    return move_natural_in( *this, cr, natural_in, natural_len, false );
+}
+
+/****************************************************************************
+ * Read natural string move of given length eg "Nf3", rejecting ambiguous
+ *  input
+ *  return bool okay
+ ****************************************************************************/
+bool Move::NaturalInUnique( ChessRules *cr, const char *natural_in, size_t natural_len )
+{
+    return move_natural_in( *this, cr, natural_in, natural_len, true );
+}
+
+/****************************************************************************
+ * Tokenise SAN with a small state machine, characters are classified and
+ *  the table gives the next state for each class
+ ****************************************************************************/
+enum SAN_CLASS { C_END, C_PIECE, C_FILE, C_RANK, C_CAPTURE, C_EQUALS, C_SUFFIX, C_OTHER, C_NBR };
+enum SAN_STATE
+{
+    S_START,
+    S_PIECE,            // eg "N"
+    S_PIECE_FILE,       // eg "Nb", destination or source file
+    S_PIECE_RANK,       // eg "N1", source rank
+    S_PIECE_CAPTURE,    // eg "Nx", "Nbx"
+    S_PIECE_SQUARE,     // eg "Nb1", destination or source square
+    S_PIECE_DST_FILE,   // eg "Nbd", "Nxd"
+    S_PIECE_DST,        // eg "Nbd2"
+    S_PAWN_FILE,        // eg "e"
+    S_PAWN_CAPTURE,     // eg "ex"
+    S_PAWN_CAPTURE_FILE,// eg "exd"
+    S_PAWN_DST,         // eg "e4", "exd5", "e8"
+    S_PROMOTION_EQUALS, // eg "e8="
+    S_PROMOTION,        // eg "e8=Q", "e8Q"
+    S_SUFFIX,           // eg "e4+", "e4!?"
+    S_NBR,
+    S_ACCEPT=S_NBR,
+    S_ERROR
+};
+
+static const unsigned char san_next[S_NBR][C_NBR] =
+{
+    //  C_END     C_PIECE       C_FILE               C_RANK        C_CAPTURE         C_EQUALS            C_SUFFIX  C_OTHER
+    { S_ERROR,  S_PIECE,     S_PAWN_FILE,         S_ERROR,        S_ERROR,         S_ERROR,            S_ERROR,  S_ERROR },  // S_START
+    { S_ERROR,  S_ERROR,     S_PIECE_FILE,        S_PIECE_RANK,   S_PIECE_CAPTURE, S_ERROR,            S_ERROR,  S_ERROR },  // S_PIECE
+    { S_ERROR,  S_ERROR,     S_PIECE_DST_FILE,    S_PIECE_SQUARE, S_PIECE_CAPTURE, S_ERROR,            S_ERROR,  S_ERROR },  // S_PIECE_FILE
+    { S_ERROR,  S_ERROR,     S_PIECE_DST_FILE,    S_ERROR,        S_PIECE_CAPTURE, S_ERROR,            S_ERROR,  S_ERROR },  // S_PIECE_RANK
+    { S_ERROR,  S_ERROR,     S_PIECE_DST_FILE,    S_ERROR,        S_ERROR,         S_ERROR,            S_ERROR,  S_ERROR },  // S_PIECE_CAPTURE
+    { S_ACCEPT, S_ERROR,     S_PIECE_DST_FILE,    S_ERROR,        S_PIECE_CAPTURE, S_ERROR,            S_SUFFIX, S_ERROR },  // S_PIECE_SQUARE
+    { S_ERROR,  S_ERROR,     S_ERROR,             S_PIECE_DST,    S_ERROR,         S_ERROR,            S_ERROR,  S_ERROR },  // S_PIECE_DST_FILE
+    { S_ACCEPT, S_ERROR,     S_ERROR,             S_ERROR,        S_ERROR,         S_ERROR,            S_SUFFIX, S_ERROR },  // S_PIECE_DST
+    { S_ERROR,  S_ERROR,     S_ERROR,             S_PAWN_DST,     S_PAWN_CAPTURE,  S_ERROR,            S_ERROR,  S_ERROR },  // S_PAWN_FILE
+    { S_ERROR,  S_ERROR,     S_PAWN_CAPTURE_FILE, S_ERROR,        S_ERROR,         S_ERROR,            S_ERROR,  S_ERROR },  // S_PAWN_CAPTURE
+    { S_ERROR,  S_ERROR,     S_ERROR,             S_PAWN_DST,     S_ERROR,         S_ERROR,            S_ERROR,  S_ERROR },  // S_PAWN_CAPTURE_FILE
+    { S_ACCEPT, S_PROMOTION, S_ERROR,             S_ERROR,        S_ERROR,         S_PROMOTION_EQUALS, S_SUFFIX, S_ERROR },  // S_PAWN_DST
+    { S_ERROR,  S_PROMOTION, S_ERROR,             S_ERROR,        S_ERROR,         S_ERROR,            S_ERROR,  S_ERROR },  // S_PROMOTION_EQUALS
+    { S_ACCEPT, S_ERROR,     S_ERROR,             S_ERROR,        S_ERROR,         S_ERROR,            S_SUFFIX, S_ERROR },  // S_PROMOTION
+    { S_ACCEPT, S_ERROR,     S_ERROR,             S_ERROR,        S_ERROR,         S_ERROR,            S_SUFFIX, S_ERROR }   // S_SUFFIX
+};
+
+static inline SAN_CLASS san_class( char c )
+{
+    if( 'a'<=c && c<='h' )
+        return C_FILE;
+    if( '1'<=c && c<='8' )
+        return C_RANK;
+    switch( c )
+    {
+        case 'K': case 'Q': case 'R': case 'B': case 'N':
+            return C_PIECE;
+        case 'x':
+            return C_CAPTURE;
+        case '=':
+            return C_EQUALS;
+        case '+': case '#': case '!': case '?':
+            return C_SUFFIX;
+        case '\0': case ' ': case '\t': case '\r': case '\n':
+            return C_END;
+    }
+    return C_OTHER;
+}
+
+// Is the rest of a move only annotation, eg "+", "#", "!?" ?
+static bool san_tail( const char *s, size_t len )
+{
+    for( size_t i=0;; i++ )
+    {
+        SAN_CLASS cls = san_class( i<len ? s[i] : '\0' );
+        if( cls == C_END )
+            return true;
+        if( cls != C_SUFFIX )
+            return false;
+    }
+}
+
+/****************************************************************************
+ * Read natural string move eg "Nf3"
+ *  return bool okay
+ * Strict SAN, faster than NaturalIn() and rejects illegal and ambiguous moves
+ ****************************************************************************/
+bool Move::NaturalInFast( ChessRules *cr, const char *natural_in )
+{
+    return NaturalInFast( cr, natural_in, strlen(natural_in) );
+}
+
+/****************************************************************************
+ * Read natural string move of given length eg "Nf3"
+ *  return bool okay
+ * Strict SAN, faster than NaturalIn() and rejects illegal and ambiguous moves
+ ****************************************************************************/
+bool Move::NaturalInFast( ChessRules *cr, const char *natural_in, size_t len )
+{
+    bool white = cr->white;
+    Move mv;
+    mv.special = NOT_SPECIAL;
+    mv.capture = ' ';
+
+    // Castling, eg "O-O", "O-O-O" (or with zeros)
+    if( len>0 && (natural_in[0]=='O' || natural_in[0]=='0') )
+    {
+        char o = natural_in[0];
+        size_t i = 1;
+        while( i+1<len && natural_in[i]=='-' && natural_in[i+1]==o )
+            i += 2;
+        if( (i!=3 && i!=5) || !san_tail(natural_in+i,len-i) )
+            return false;
+        mv.src = (white?e1:e8);
+        if( i == 3 )
+        {
+            mv.dst     = (white?g1:g8);
+            mv.special = (white?SPECIAL_WK_CASTLING:SPECIAL_BK_CASTLING);
+        }
+        else
+        {
+            mv.dst     = (white?c1:c8);
+            mv.special = (white?SPECIAL_WQ_CASTLING:SPECIAL_BQ_CASTLING);
+        }
+        if( !cr->IsLegalMove(mv) )
+            return false;
+        *this = mv;
+        return true;
+    }
+
+    // Tokenise, the grammar allows at most two files and two ranks, the
+    //  last of each is the destination, a first one disambiguates
+    char piece='P', promotion='\0';
+    char files[2], ranks[2];
+    int  nbr_files=0, nbr_ranks=0;
+    bool capture_=false;
+    int  state = S_START;
+    for( size_t i=0; state<S_NBR; i++ )
+    {
+        char c = (i<len ? natural_in[i] : '\0');
+        if( (state==S_PAWN_DST || state==S_PROMOTION_EQUALS) && 'a'<=c && c<='z' )
+            c = c-'a'+'A';  // allow lower case promotions eg "e8=q"
+        SAN_CLASS cls = san_class(c);
+        state = san_next[state][cls];
+        switch( cls )
+        {
+            case C_PIECE:   if( state == S_PIECE )
+                                piece = c;
                             else
-                                err = true;
-                        }
-                        else
-                            err = true;
-                        if( !err )
-                        {
-                            if( capture_ ? IsWhite(cr->squares[mv.dst]) : cr->squares[mv.dst]==' ' )
-                            {
-                                mv.capture = cr->squares[mv.dst];
-                                if( piece == 'n' )
-                                {
-                                    int count=0;
-                                    for( int probe=0; !found && probe<2; probe++ )
-                                    {
-                                        const lte *ptr = knight_lookup[mv.dst];
-                                        lte nbr_moves = *ptr++;
-                                        while( !found && nbr_moves-- )
-                                        {
-                                            Square src_ = (Square)*ptr++;
-                                            if( cr->squares[src_]=='n' )
-                                            {
-                                                bool src_file_ok = !src_file || FILE(src_)==src_file;
-                                                bool src_rank_ok = !src_rank || RANK(src_)==src_rank;
-                                                if( src_file_ok && src_rank_ok )
-                                                {
-                                                    mv.src = src_;
-                                                    if( probe == 0 )
-                                                        count++;
-                                                    else // probe==1 means disambiguate by testing whether move is legal, found will be set if
-                                                        // we are not exposing black king to check.
-                                                    {
-                                                        char temp = cr->squares[mv.dst];
-                                                        cr->squares[mv.dst] = 'n';  // temporarily make move
-                                                        cr->squares[mv.src] = ' ';
-                                                        found = !cr->AttackedSquare( cr->bking_square, true ); //bool AttackedSquare( Square square, bool enemy_is_white );
-                                                        cr->squares[mv.dst] = temp;  // now undo move
-                                                        cr->squares[mv.src] = 'n';
-                                                    }
-                                                }
-                                            }
-                                        }
-                                        if( probe==0 && count==1 )
-                                            found = true; // done, no need for disambiguation by check
-                                    }
-                                }
-                                else // if( rook, bishop, queen )
-                                {
-                                    int count = 0;
-                                    for( int probe=0; !found && probe<2; probe++ )
-                                    {
-                                        const lte *ptr = ray_lookup[mv.dst];
-                                        lte nbr_rays = *ptr++;
-                                        while( !found && nbr_rays-- )
-                                        {
-                                            lte ray_len = *ptr++;
-                                            while( !found && ray_len-- )
-                                            {
-                                                Square src_ = (Square)*ptr++;
-                                                if( !IsEmptySquare(cr->squares[src_]) )
-                                                {
-                                                    // Any piece, friend or enemy must move to end of ray
-                                                    ptr += ray_len;
-                                                    ray_len = 0;
-                                                    if( cr->squares[src_] == piece )
-                                                    {
-                                                        bool src_file_ok = !src_file || FILE(src_)==src_file;
-                                                        bool src_rank_ok = !src_rank || RANK(src_)==src_rank;
-                                                        if( src_file_ok && src_rank_ok )
-                                                        {
-                                                            mv.src = src_;
-                                                            if( probe == 0 )
-                                                                count++;
-                                                            else // probe==1 means disambiguate by testing whether move is legal, found will be set if
-                                                                // we are not exposing black king to check.
-                                                            {
-                                                                char temp = cr->squares[mv.dst];
-                                                                cr->squares[mv.dst] = piece;  // temporarily make move
-                                                                cr->squares[mv.src] = ' ';
-                                                                found = !cr->AttackedSquare( cr->bking_square, true ); //bool AttackedSquare( Square square, bool enemy_is_white );
-                                                                cr->squares[mv.dst] = temp;  // now undo move
-                                                                cr->squares[mv.src] = piece;
-                                                            }
-                                                        }
-                                                    }
-                                                }
-                                            }
-                                        }
-                                        if( probe==0 && count==1 )
-                                            found = true; // done, no need for disambiguation by check
-                                    }
-                                }
-                            }
-                        }
-                    }
-                }
+                                promotion = c;
+                            break;
+            case C_FILE:    if( state != S_ERROR )
+                                files[nbr_files++] = c;
+                            break;
+            case C_RANK:    if( state != S_ERROR )
+                                ranks[nbr_ranks++] = c;
+                            break;
+            case C_CAPTURE: capture_ = true;
+                            break;
+            default:        break;
+        }
+    }
+    if( state != S_ACCEPT )
+        return false;
+    Square dst = SQ( files[nbr_files-1], ranks[nbr_ranks-1] );
+    Bitboard occupied = cr->bb_occupied();
+    Bitboard ours     = (white ? cr->bb_white : cr->bb_black);
+    if( ours & BB(dst) )
+        return false;
+    mv.dst     = dst;
+    mv.capture = cr->squares[dst];
+
+    // Candidate source squares, found by looking back from the destination
+    //  square. Captures must be marked and other moves mustn't be
+    Bitboard candidates;
+    if( piece == 'P' )
+    {
+        bool last_rank = (RANK(dst) == (white?'8':'1'));
+        if( last_rank != (promotion!='\0') )
+            return false;
+        switch( promotion )
+        {
+            case '\0':                                              break;
+            case 'Q':   mv.special = SPECIAL_PROMOTION_QUEEN;       break;
+            case 'R':   mv.special = SPECIAL_PROMOTION_ROOK;        break;
+            case 'B':   mv.special = SPECIAL_PROMOTION_BISHOP;      break;
+            case 'N':   mv.special = SPECIAL_PROMOTION_KNIGHT;      break;
+            default:    return false;
+        }
+        if( capture_ )
+        {
+            // A pawn attacks dst from the squares an enemy pawn on dst attacks
+            candidates = (white ? pawn_black_attacks_bb[dst] : pawn_white_attacks_bb[dst])
+                       & (0x0101010101010101ULL << (files[0]-'a'));
+            if( dst==cr->enpassant_target && IsEmptySquare(mv.capture) )
+            {
+                mv.special = (white?SPECIAL_WEN_PASSANT:SPECIAL_BEN_PASSANT);
+                mv.capture = (white?'p':'P');
+            }
+            else if( IsEmptySquare(mv.capture) )
+                return false;
+        }
+        else
+        {
+            if( !IsEmptySquare(mv.capture) || RANK(dst)==(white?'1':'8') || RANK(dst)==(white?'2':'7') )
+                return false;
+            Square src = (white ? SOUTH(dst) : NORTH(dst));
+            if( IsEmptySquare(cr->squares[src]) && RANK(dst)==(white?'4':'5') )
+            {
+                src = (white ? SOUTH(src) : NORTH(src));
+                mv.special = (white?SPECIAL_WPAWN_2SQUARES:SPECIAL_BPAWN_2SQUARES);
             }
+            candidates = BB(src);
+        }
+        candidates &= cr->bb_pieces[ white ? BB_WPAWN : BB_BPAWN ];
+    }
+    else
+    {
+        if( capture_ == IsEmptySquare(mv.capture) )
+            return false;
+        switch( piece )
+        {
+            default:
+            case 'N':   candidates = knight_attacks_bb[dst];                    break;
+            case 'B':   candidates = bishop_attacks_bb(dst,occupied);           break;
+            case 'R':   candidates = rook_attacks_bb(dst,occupied);             break;
+            case 'Q':   candidates = queen_attacks_bb(dst,occupied);            break;
+            case 'K':   candidates = king_attacks_bb[dst];
+                        mv.special = SPECIAL_KING_MOVE;                         break;
         }
+        candidates &= cr->bb_pieces[ bb_index[ white ? piece : piece-'A'+'a' ] ];
+        if( nbr_files == 2 )
+            candidates &= (0x0101010101010101ULL << (files[0]-'a'));
+        if( nbr_ranks == 2 )
+            candidates &= ((Bitboard)0xff << ('8'-ranks[0])*8);
     }
-    if( found )
+
+    // Exactly one candidate must be legal. Normally there's only one
+    //  anyway, and we check it by looking for attacks on our king with the
+    //  move made on the occupied squares
+    Square king_square = (Square)(white ? cr->wking_square : cr->bking_square);
+    bool king_present  = (cr->squares[king_square] == (white?'K':'k'));
+    int  nbr_legal = 0;
+    Move legal_mv;
+    while( candidates )
     {
-        char c = *natural_in;
-        bool problem = (isascii(c) && isalnum(c));
-        if( problem )
-            found = false;
+        mv.src = bb_pop_lsb(candidates);
+        bool legal;
+        if( !king_present || mv.special==SPECIAL_WEN_PASSANT || mv.special==SPECIAL_BEN_PASSANT )
+            legal = cr->IsLegalMove( mv );  // unusual, so check it the long way
+        else if( mv.src == king_square )
+            legal = !cr->AttackersTo( dst, !white, occupied & ~BB(king_square) );
         else
-            *this = mv;
+            legal = !( cr->AttackersTo( king_square, !white, (occupied & ~BB(mv.src)) | BB(dst) ) & ~BB(dst) );
+        if( legal )
+        {
+            legal_mv = mv;
+            if( ++nbr_legal > 1 )
+                return false;   // ambiguous
+        }
+    }
+    if( nbr_legal != 1 )
+        return false;
+    *this = legal_mv;
+    return true;
+}
+
+/****************************************************************************
+ * Unpack a PackedMove, the position supplies capture
+ ****************************************************************************/
+Move PackedMove::Unpack( const ChessPosition &cp ) const
+{
+    Move mv;
+    mv.src     = Src();
+    mv.dst     = Dst();
+    mv.special = Special();
+    if( mv.special == SPECIAL_WEN_PASSANT )
+        mv.capture = 'p';
+    else if( mv.special == SPECIAL_BEN_PASSANT )
+        mv.capture = 'P';
+    else
+        mv.capture = cp.squares[mv.dst];
+    return mv;
+}
+
+/****************************************************************************
+ * Could a PackedMove be a move ?
+ *  return bool valid
+ ****************************************************************************/
+bool PackedMove::Valid() const
+{
+    int src = Src();
+    int dst = Dst();
+    if( src == dst )
+        return false;
+    switch( Special() )
+    {
+        case NOT_SPECIAL:
+        case SPECIAL_KING_MOVE:         return true;
+        case SPECIAL_WK_CASTLING:       return src==e1 && dst==g1;
+        case SPECIAL_BK_CASTLING:       return src==e8 && dst==g8;
+        case SPECIAL_WQ_CASTLING:       return src==e1 && dst==c1;
+        case SPECIAL_BQ_CASTLING:       return src==e8 && dst==c8;
+        case SPECIAL_PROMOTION_QUEEN:
+        case SPECIAL_PROMOTION_ROOK:
+        case SPECIAL_PROMOTION_BISHOP:
+        case SPECIAL_PROMOTION_KNIGHT:  return (src/8==1 && dst/8==0) || (src/8==6 && dst/8==7);
+        case SPECIAL_WPAWN_2SQUARES:    return src/8==6 && dst==src-16;
+        case SPECIAL_BPAWN_2SQUARES:    return src/8==1 && dst==src+16;
+        case SPECIAL_WEN_PASSANT:       return src/8==3 && dst/8==2;
+        case SPECIAL_BEN_PASSANT:       return src/8==4 && dst/8==5;
     }
-    return found;
+    return false;   // unknown special
 }
 
 /****************************************************************************
@@ -6891,10 +11329,17 @@ bool Move::NaturalInFast( ChessRules *cr, const char *natural_in )
  ****************************************************************************/
 bool Move::TerseIn( ChessRules *cr, const char *tmove )
 {
-    MOVELIST list;
-    int i;
+    return TerseIn( cr, tmove, strlen(tmove) );
+}
+
+/****************************************************************************
+ * Read terse string move of given length eg "g1f3"
+ *  return bool okay
+ ****************************************************************************/
+bool Move::TerseIn( ChessRules *cr, const char *tmove, size_t len )
+{
     bool okay=false;
-    if( strlen(tmove)>=4 && 'a'<=tmove[0] && tmove[0]<='h'
+    if( len>=4 && 'a'<=tmove[0] && tmove[0]<='h'
                          && '1'<=tmove[1] && tmove[1]<='8'
                          && 'a'<=tmove[2] && tmove[2]<='h'
                          && '1'<=tmove[3] && tmove[3]<='8' )
@@ -6902,7 +11347,7 @@ bool Move::TerseIn( ChessRules *cr, const char *tmove )
         Square src_   = SQ(tmove[0],tmove[1]);
         Square dst_   = SQ(tmove[2],tmove[3]);
         char   expected_promotion_if_any = 'Q';
-        if( tmove[4] )
+        if( len>4 && tmove[4] )
         {
             if( tmove[4]=='n' || tmove[4]=='N' )
                 expected_promotion_if_any = 'N';
@@ -6912,44 +11357,12 @@ bool Move::TerseIn( ChessRules *cr, const char *tmove )
                 expected_promotion_if_any = 'R';
         }
 
-        // Generate legal moves, then search for this move
-        cr->GenLegalMoveList( &list );
-        for( i=0; !okay && i<list.count; i++ )
-        {
-            if( list.moves[i].dst==dst_ && list.moves[i].src==src_ )
-            {
-                switch( list.moves[i].special )
-                {
-                    default:    okay=true;  break;
-                    case SPECIAL_PROMOTION_QUEEN:
-                    {
-                        if( expected_promotion_if_any == 'Q' )
-                            okay = true;
-                        break;
-                    }
-                    case SPECIAL_PROMOTION_ROOK:
-                    {
-                        if( expected_promotion_if_any == 'R' )
-                            okay = true;
-                        break;
-                    }
-                    case SPECIAL_PROMOTION_BISHOP:
-                    {
-                        if( expected_promotion_if_any == 'B' )
-                            okay = true;
-                        break;
-                    }
-                    case SPECIAL_PROMOTION_KNIGHT:
-                    {
-                        if( expected_promotion_if_any == 'N' )
-                            okay = true;
-                        break;
-                    }
-                }
-            }
-            if( okay )
-                *this = list.moves[i];
-        }
+        // Check this move directly, rather than searching for it in the
+        //  legal move list
+        Move mv;
+        okay = move_from_squares( cr, src_, dst_, expected_promotion_if_any, mv );
+        if( okay )
+            *this = mv;
     }
     return okay;
 }
@@ -6959,6 +11372,18 @@ bool Move::TerseIn( ChessRules *cr, const char *tmove )
  *    eg "Nf3"
  ****************************************************************************/
 std::string Move::NaturalOut( ChessRules *cr )
+{
+    char buf[NATURAL_MOVE_SIZE];
+    NaturalOut( cr, buf );
+    return buf;
+}
+
+/****************************************************************************
+ * Convert to natural string in a buffer
+ *    eg "Nf3"
+ *  return length
+ ****************************************************************************/
+int Move::NaturalOut( ChessRules *cr, char natural_out[NATURAL_MOVE_SIZE] )
 {
 
 // Improved algorithm
@@ -6972,7 +11397,7 @@ std::string Move::NaturalOut( ChessRules *cr )
         Nb1d2 or Nb1xd2 (fallback if nothing else works)
     */
 
-    char nmove[10];
+    char *nmove = natural_out;
     nmove[0] = '-';
     nmove[1] = '-';
     nmove[2] = '\0';
@@ -7147,13 +11572,13 @@ std::string Move::NaturalOut( ChessRules *cr )
         if( do_loop && matches==1 )
             done = true;
     }   // end loop for all algorithms
+    char *s = strchr(nmove,'\0');
     if( append )
     {
-        char *s = strchr(nmove,'\0');
         *s++ = append;
         *s = '\0';
     }
-    return nmove;
+    return (int)(s-nmove);
 }
 
 /****************************************************************************
@@ -7161,7 +11586,17 @@ std::string Move::NaturalOut( ChessRules *cr )
  ****************************************************************************/
 std::string Move::TerseOut()
 {
-    char tmove[6];
+    char buf[TERSE_MOVE_SIZE];
+    TerseOut( buf );
+    return buf;
+}
+
+/****************************************************************************
+ * Convert to terse string in a buffer eg "e7e8q"
+ *  return length
+ ****************************************************************************/
+int Move::TerseOut( char tmove[TERSE_MOVE_SIZE] )
+{
     if( src == dst )   // null move should be "0000" according to UCI spec
     {
         tmove[0] = '0';
@@ -7188,7 +11623,7 @@ std::string Move::TerseOut()
             tmove[4] = '\0';
         tmove[5] = '\0';
     }
-    return tmove;
+    return tmove[4] ? 5 : 4;
 }
 
 /****************************************************************************
@@ -12984,6 +17419,249 @@ lte to_mask[] =
 #undef Q
 #undef K
 
+// A lookup table to convert our character piece convention to an index
+//  into the ChessPosition bitboards
+#define _ BB_NBR
+lte bb_index[] =
+    {_,_,_,_,_,_,_,_,_,_,_,_,_,_,_,_,                             // 0x00-0x0f
+     _,_,_,_,_,_,_,_,_,_,_,_,_,_,_,_,                             // 0x10-0x1f
+     _,_,_,_,_,_,_,_,_,_,_,_,_,_,_,_,                             // 0x20-0x2f
+     _,_,_,_,_,_,_,_,_,_,_,_,_,_,_,_,                             // 0x30-0x3f
+     _,_,BB_WBISHOP,_,_,_,_,_,_,_,_,BB_WKING,_,_,BB_WKNIGHT,_,     // 0x40-0x4f    'B'=0x42, 'K'=0x4b, 'N'=0x4e
+     BB_WPAWN,BB_WQUEEN,BB_WROOK,_,_,_,_,_,_,_,_,_,_,_,_,_,       // 0x50-0x5f    'P'=0x50, 'Q'=0x51, 'R'=0x52
+     _,_,BB_BBISHOP,_,_,_,_,_,_,_,_,BB_BKING,_,_,BB_BKNIGHT,_,     // 0x60-0x6f    'b'=0x62, 'k'=0x6b, 'n'=0x6e
+     BB_BPAWN,BB_BQUEEN,BB_BROOK,_,_,_,_,_,_,_,_,_,_,_,_,_};      // 0x70-0x7f    'p'=0x70, 'q'=0x71, 'r'=0x72
+#undef _
+
+// Bitboard lookup tables, calculated by bitboard_tables_init()
+Bitboard knight_attacks_bb[64];
+Bitboard king_attacks_bb[64];
+Bitboard pawn_white_attacks_bb[64];
+Bitboard pawn_black_attacks_bb[64];
+Bitboard between_bb[64][64];
+Bitboard line_bb[64][64];
+
+// Zobrist keys, calculated by bitboard_tables_init()
+uint64_t zobrist_pieces[BB_NBR][64];
+uint64_t zobrist_white;
+uint64_t zobrist_castling[16];
+uint64_t zobrist_enpassant[8];
+
+// Pseudo random numbers for the Zobrist keys (SplitMix64). A fixed seed
+//  means keys are the same from run to run, so they can be stored
+static uint64_t zobrist_random( uint64_t &seed )
+{
+    uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z>>30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z>>27)) * 0x94d049bb133111ebULL;
+    return z ^ (z>>31);
+}
+
+// Convert a list of squares in a generated lookup table to a bitboard
+static Bitboard squares_to_bb( const lte *ptr )
+{
+    Bitboard bb = 0;
+    lte nbr_squares = *ptr++;
+    while( nbr_squares-- )
+        bb |= BB(*ptr++);
+    return bb;
+}
+
+// Magic numbers for slider attacks, found by trial and error (random sparse
+//  candidates, keeping the first that maps every relevant occupancy to an
+//  index holding the right attacks without destructive collisions)
+static const Bitboard bishop_magic_numbers[64] =
+{
+    0x10102002004a1420ULL, 0x8020040400584008ULL, 0x10510800811201c8ULL, 0x5204042080000088ULL,
+    0x2204106880000002ULL, 0x1401042004000000ULL, 0x0400880410042004ULL, 0x0028208200a02020ULL,
+    0x1500241990010e00ULL, 0x8001200182020a40ULL, 0x40004101030b0000ULL, 0x8002041042000100ULL,
+    0x4010011041020038ULL, 0x0000010421044000ULL, 0x1500210808020a00ULL, 0x8000088400880520ULL,
+    0x0405004010040100ULL, 0x1005823210040108ULL, 0x2708008102040011ULL, 0x4048200404009100ULL,
+    0x0018104101400024ULL, 0x0003000601190101ULL, 0x8004803108491000ULL, 0x8014241200820800ULL,
+    0x0006e080100c3040ULL, 0x0501044a11041800ULL, 0x9020300008004045ULL, 0x0894080000220040ULL,
+    0x1001010083104000ULL, 0x5004030040900080ULL, 0x000400422c012400ULL, 0x0002128698404812ULL,
+    0x1010108404900440ULL, 0x0928021182084100ULL, 0x2006080409020024ULL, 0x1010202020180080ULL,
+    0xa010008200202200ULL, 0x2098015100019004ULL, 0x0002041440810811ULL, 0x802a02020000b098ULL,
+    0x0009015090004060ULL, 0x4000821082081001ULL, 0x0100210040420800ULL, 0x0800004010488a00ULL,
+    0x2000081104004040ULL, 0x4c8e029015000082ULL, 0x0420340322224842ULL, 0x1298260043400210ULL,
+    0x0000822802400008ULL, 0x00008a0101600000ULL, 0x3040003412080021ULL, 0x3040290220884800ULL,
+    0x4a1500401041004aULL, 0x8010200282020781ULL, 0x0020203142209091ULL, 0x0070300600902110ULL,
+    0x0040808800b62048ULL, 0x0000810400c44420ULL, 0x00080400440c0441ULL, 0x8340080020840411ULL,
+    0x0000000104208200ULL, 0x0000800810d00080ULL, 0x0400530411080200ULL, 0x4040702400932244ULL
+};
+
+static const Bitboard rook_magic_numbers[64] =
+{
+    0x1080004008801020ULL, 0x0840092002c03000ULL, 0x1900200010400900ULL, 0x0880100008000480ULL,
+    0x4200100420080200ULL, 0x8100020100080400ULL, 0x0200040110886200ULL, 0x0200008040220411ULL,
+    0x0404800084400220ULL, 0x0000401000402000ULL, 0x0086001081220440ULL, 0x0408800800100280ULL,
+    0x000a001201040820ULL, 0x8848800200840080ULL, 0x4001000100040200ULL, 0x0442000102105084ULL,
+    0x9080010020804100ULL, 0x0040404000201009ULL, 0x0000808010002009ULL, 0x2200090021d00100ULL,
+    0x0008008008040080ULL, 0x0004004002010040ULL, 0x0011040008015042ULL, 0x00000a0001768104ULL,
+    0x0000800080204009ULL, 0x2010004140002001ULL, 0x9800200280100080ULL, 0x1000100080080080ULL,
+    0x0442000a00049020ULL, 0x2100040080020080ULL, 0x0800120400900148ULL, 0x0010040a00128541ULL,
+    0x2800804000800030ULL, 0x1010002000400041ULL, 0x4000200011004100ULL, 0x0610008410800800ULL,
+    0x0400802402800800ULL, 0xc100020080800400ULL, 0x0002000802000401ULL, 0x0182085882000401ULL,
+    0x0220204000808000ULL, 0x2860100040024022ULL, 0x0001002004110040ULL, 0x99101042000a0020ULL,
+    0x0004080004008080ULL, 0x0010040002008080ULL, 0x2012004881020004ULL, 0x8300842444820011ULL,
+    0x0088403882010200ULL, 0x0820400080210100ULL, 0x0110910040a00300ULL, 0x0801100280080480ULL,
+    0x0242009008200600ULL, 0x1002000489500200ULL, 0x0040800200010080ULL, 0x0091800041000080ULL,
+    0x0000209300488001ULL, 0x04c1002414824001ULL, 0x020020000b001041ULL, 0x7000100004200901ULL,
+    0x8002002004100802ULL, 0x30010002084c0007ULL, 0x0888221800813004ULL, 0x4000002840840112ULL
+};
+
+// Slider attacks lookup, one variable size block per square
+SliderMagic bishop_magics[64];
+SliderMagic rook_magics[64];
+static Bitboard bishop_attacks_table[5248];    // sum over squares of 2^(squares in mask)
+static Bitboard rook_attacks_table[102400];
+
+#ifdef THC_PEXT
+bool slider_use_pext;
+
+// Kept out of line so only this function needs to be compiled for BMI2
+#if defined(__GNUC__) && !defined(__BMI2__)
+__attribute__((target("bmi2")))
+#endif
+unsigned int slider_index_pext( Bitboard occupied, Bitboard mask )
+{
+    return (unsigned int)_pext_u64( occupied, mask );
+}
+
+// Does the CPU we are running on support BMI2 (and so PEXT) ?
+static bool cpu_has_bmi2()
+{
+#if defined(__BMI2__)
+    return true;
+#elif defined(__GNUC__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("bmi2") != 0;
+#else
+    int regs[4];
+    __cpuid( regs, 0 );
+    if( regs[0] < 7 )
+        return false;
+    __cpuidex( regs, 7, 0 );
+    return (regs[1] & (1<<8)) != 0;     // EBX bit 8 = BMI2
+#endif
+}
+#endif
+
+// Walk the rays in a generated lookup table, stopping at the first occupied
+//  square on each ray, to get slider attacks the slow way. If mask_only
+//  the final square of each ray is dropped instead, giving the squares that
+//  can block (a man at the end of a ray blocks nothing)
+static Bitboard rays_walk( const lte *ptr, Bitboard occupied, bool mask_only )
+{
+    Bitboard bb = 0;
+    lte nbr_rays = *ptr++;
+    while( nbr_rays-- )
+    {
+        lte ray_len = *ptr++;
+        while( ray_len-- )
+        {
+            Bitboard sq = BB(*ptr++);
+            if( mask_only )
+            {
+                if( ray_len > 0 )
+                    bb |= sq;
+            }
+            else
+            {
+                bb |= sq;
+                if( occupied & sq )
+                {
+                    ptr += ray_len;
+                    ray_len = 0;
+                }
+            }
+        }
+    }
+    return bb;
+}
+
+// Fill in the magic lookup for bishops or rooks
+static void slider_init( SliderMagic *magics, Bitboard *table, const Bitboard *magic_numbers,
+                                                    const lte **lookup, bool use_pext )
+{
+    Bitboard *attacks = table;
+    for( Square square=a8; square<=h1; ++square )
+    {
+        SliderMagic &m = magics[square];
+        m.mask    = rays_walk( lookup[square], 0, true );
+        m.magic   = magic_numbers[square];
+        m.shift   = 64 - bb_popcount(m.mask);
+        m.attacks = attacks;
+
+        // Visit every subset of the mask (the "carry rippler" trick), which
+        //  conveniently visits them in PEXT index order
+        Bitboard occupied = 0;
+        unsigned int pext_idx = 0;
+        do
+        {
+            unsigned int idx = use_pext ? pext_idx
+                                        : (unsigned int)((occupied * m.magic) >> m.shift);
+            m.attacks[idx] = rays_walk( lookup[square], occupied, false );
+            pext_idx++;
+            occupied = (occupied - m.mask) & m.mask;
+        } while( occupied );
+        attacks += pext_idx;
+    }
+}
+
+// Calculate the bitboard lookup tables from the generated lookup tables
+bool bitboard_tables_init()
+{
+    bool use_pext = false;
+    #ifdef THC_PEXT
+    use_pext = slider_use_pext = cpu_has_bmi2();
+    #endif
+    slider_init( bishop_magics, bishop_attacks_table, bishop_magic_numbers, bishop_lookup, use_pext );
+    slider_init( rook_magics,   rook_attacks_table,   rook_magic_numbers,   rook_lookup,   use_pext );
+    for( Square square=a8; square<=h1; ++square )
+    {
+        knight_attacks_bb[square]     = squares_to_bb( knight_lookup[square] );
+        king_attacks_bb[square]       = squares_to_bb( king_lookup[square] );
+        pawn_white_attacks_bb[square] = squares_to_bb( pawn_white_lookup[square] );  // capture ray comes first
+        pawn_black_attacks_bb[square] = squares_to_bb( pawn_black_lookup[square] );
+    }
+
+    // Zobrist keys, no castling possible is zero so it drops out
+    uint64_t seed = 0x7468632d6b657973ULL;
+    for( int idx=0; idx<BB_NBR; idx++ )
+    {
+        for( int i=0; i<64; i++ )
+            zobrist_pieces[idx][i] = zobrist_random(seed);
+    }
+    zobrist_white = zobrist_random(seed);
+    zobrist_castling[0] = 0;
+    for( int i=1; i<16; i++ )
+        zobrist_castling[i] = zobrist_random(seed);
+    for( int i=0; i<8; i++ )
+        zobrist_enpassant[i] = zobrist_random(seed);
+
+    // Lines and the squares between, using the slider attacks from both ends
+    for( Square a=a8; a<=h1; ++a )
+    {
+        for( Square b=a8; b<=h1; ++b )
+        {
+            between_bb[a][b] = 0;
+            line_bb[a][b]    = 0;
+            if( bishop_attacks_bb(a,0) & BB(b) )
+            {
+                between_bb[a][b] = bishop_attacks_bb(a,BB(b)) & bishop_attacks_bb(b,BB(a));
+                line_bb[a][b]    = (bishop_attacks_bb(a,0) & bishop_attacks_bb(b,0)) | BB(a) | BB(b);
+            }
+            else if( rook_attacks_bb(a,0) & BB(b) )
+            {
+                between_bb[a][b] = rook_attacks_bb(a,BB(b)) & rook_attacks_bb(b,BB(a));
+                line_bb[a][b]    = (rook_attacks_bb(a,0) & rook_attacks_bb(b,0)) | BB(a) | BB(b);
+            }
+        }
+    }
+    return true;
+}
+
 }
 
 